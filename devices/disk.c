@@ -1,15 +1,42 @@
 #include "devices/disk.h"
 #include <ctype.h>
 #include <debug.h>
+#include <intrinsic.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include "devices/pci.h"
 #include "devices/timer.h"
+#include "devices/virtio-blk.h"
+#include "threads/instrument.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/lock-stats.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/vaddr.h"
+#include "threads/workqueue.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If the controller is a PCI bus-master IDE controller in
+   compatibility mode, sectors move by DMA: the controller copies
+   them to or from memory by itself, following a table of physical
+   regions, while the thread that asked for them sleeps.
+
+   Requests are queued per device in order of sector and served
+   by a thread per channel, which takes turns between the
+   channel's two devices, sweeps each in one direction (C-LOOK)
+   and moves requests for consecutive sectors with a single
+   command.  The two channels work independently, so swap I/O on
+   one overlaps with file system I/O on the other.  disk_read() and the like submit a
+   request and wait for it; disk_submit() returns at once.
+
+   A device slot with no ATA disk may instead hold a virtio block
+   device, in the PCI slot that VIRTIO_BLK_SLOT names for it.  Its
+   requests go through the same queue and channel thread, but move
+   through virtio-blk.c, many sectors for one exit to the host. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -22,6 +49,22 @@
 #define reg_status(CHANNEL) ((CHANNEL)->reg_base + 7)   /* Status (r/o). */
 #define reg_command(CHANNEL) reg_status (CHANNEL)       /* Command (w/o). */
 
+/* Bus-master IDE port addresses. */
+#define reg_bm_cmd(CHANNEL) ((CHANNEL)->bm_base + 0)    /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2) /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)   /* PRD table. */
+
+/* Bus-master Command Register bits. */
+#define BM_START 0x01           /* Start transfer. */
+#define BM_READ 0x08            /* Transfer to memory. */
+
+/* Bus-master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Error, write 1 to clear. */
+#define BM_STA_INTR 0x04        /* Interrupt, write 1 to clear. */
+
+/* PCI class of IDE controllers: mass storage, IDE. */
+#define PCI_CLASS_IDE 0x0101
+
 /* ATA control block port addresses.
    (If we supported non-legacy ATA controllers this would not be
    flexible enough, but it's fine for what we do.) */
@@ -32,6 +75,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -47,6 +91,34 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors moved by one command: a sector count of 0 means
+   256. */
+#define MAX_SECTORS 256
+
+/* Latency histograms have HIST_CNT buckets of TSC cycles: bucket
+   0 is below 2**(HIST_SHIFT + 1), bucket B is from 2**(HIST_SHIFT
+   + B) up to twice that, and the last takes everything above. */
+#define HIST_CNT 16
+#define HIST_SHIFT 10
+
+/* Longest time to poll for a disk interrupt, in microseconds. */
+unsigned disk_poll_us = 50;
+
+static const char *source_names[DISK_SRC_CNT] = {
+	[DISK_SRC_OTHER] = "other",
+	[DISK_SRC_DATA] = "data",
+	[DISK_SRC_META] = "metadata",
+	[DISK_SRC_FAT] = "fat",
+	[DISK_SRC_SWAP] = "swap",
+	[DISK_SRC_EXEC] = "exec",
+	[DISK_SRC_DEFRAG] = "defrag",
+};
 
 /* An ATA device. */
 struct disk {
@@ -54,11 +126,33 @@ struct disk {
 	struct channel *channel;    /* Channel disk is on. */
 	int dev_no;                 /* Device 0 or 1 for master or slave. */
 
-	bool is_ata;                /* 1=This device is an ATA disk. */
+	bool is_ata;                /* 1=This device is an ATA or virtio disk. */
+	struct virtio_blk *virtio;  /* Virtio device, or null if ATA. */
 	disk_sector_t capacity;     /* Capacity in sectors (if is_ata). */
+	size_t multiple;            /* Sectors per interrupt under READ/WRITE
+								   MULTIPLE, or 0 if not supported. */
+	bool dma;                   /* Supports READ/WRITE DMA? */
 
 	long long read_cnt;         /* Number of sectors read. */
 	long long write_cnt;        /* Number of sectors written. */
+
+	/* Guarded by the channel's lock. */
+	struct list queue;          /* Pending requests, ordered by sector. */
+	disk_sector_t head;         /* Sector just past the last one served. */
+	size_t queued;              /* Requests in QUEUE. */
+	size_t max_queued;          /* Most requests ever in QUEUE. */
+	long long request_cnt;      /* Requests submitted. */
+	long long depth_sum;        /* Sum of QUEUED at each submission. */
+	long long merge_cnt;        /* Requests merged into another's batch. */
+	long long seq_cnt;          /* Requests that started at HEAD. */
+	int64_t busy_ticks;         /* Timer ticks at the last submission
+								   not from the defragmenter. */
+
+	/* Updated by the channel thread only. */
+	long long src_cnt[DISK_SRC_CNT][2]; /* Sectors read, written, by
+										   source. */
+	long long wait_hist[HIST_CNT];      /* Queue wait, by HIST bucket. */
+	long long service_hist[HIST_CNT];   /* Service time, likewise. */
 };
 
 /* An ATA channel (aka controller).
@@ -68,37 +162,99 @@ struct channel {
 	uint16_t reg_base;          /* Base I/O port. */
 	uint8_t irq;                /* Interrupt in use. */
 
-	struct lock lock;           /* Must acquire to access the controller. */
+	struct lock lock;           /* Guards the devices' queues. */
+	struct semaphore queue_sema;    /* Counts pending requests. */
+	int next_dev;               /* Device whose queue is served next. */
 	bool expecting_interrupt;   /* True if an interrupt is expected, false if
 								   any interrupt would be spurious. */
 	struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+	uint64_t issue_tsc;         /* When the awaited interrupt was due from. */
+	uint64_t avg_wait;          /* Moving average of the time an interrupt
+								   took to come, in TSC cycles. */
+	long long poll_cnt;         /* Interrupts caught by polling. */
+	long long sleep_cnt;        /* Interrupts slept for. */
+	struct work unexpected_work;    /* Reports a spurious interrupt. */
+
+	uint16_t bm_base;           /* Bus-master base I/O port, or 0. */
+	struct prd *prdt;           /* PRD table, if BM_BASE. */
 
 	struct disk devices[2];     /* The devices on this channel. */
+
+	bool probed;                /* Devices detected? */
+	struct semaphore probe_done;    /* Up'd once they are. */
+};
+
+/* A physical region descriptor: one contiguous piece of memory of
+   a DMA transfer.  The regions must not cross 64 kB boundaries. */
+struct prd {
+	uint32_t addr;              /* Physical address. */
+	uint16_t size;              /* Bytes, 0 meaning 64 kB. */
+	uint16_t flags;             /* PRD_EOT on the last region. */
 };
+#define PRD_EOT 0x8000
+
+/* Regions per PRD table.  A command stops short of MAX_SECTORS
+   sectors if its buffers need more. */
+#define PRD_CNT 32
 
 /* We support the two "legacy" ATA channels found in a standard PC. */
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* PRD tables.  The alignment keeps all of them from crossing a
+   64 kB boundary. */
+static struct prd prdts[CHANNEL_CNT][PRD_CNT] __attribute__ ((aligned (512)));
+
+/* Most requests merged into one batch. */
+#define BATCH_MAX 16
+
+/* Requests that could not use DMA, and batches sent to a disk. */
+DEFINE_COUNTER (disk_pio_requests);
+DEFINE_COUNTER (disk_batches);
+
+/* A position in a batch of requests. */
+struct batch_pos {
+	struct list_elem *e;        /* Current request. */
+	size_t ofs;                 /* Sectors into it. */
+};
+
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void set_multiple_mode (struct disk *, uint8_t);
+static void select_sector (struct disk *, disk_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
-
+static void probe_thread (void *channel_);
+static void channel_thread (void *channel_);
+static void wait_probe (struct channel *);
+static bool dma_usable (const struct disk *, const void *, size_t cnt);
+static size_t dma_transfer (struct disk *, disk_sector_t, size_t cnt,
+		struct list *batch, struct batch_pos *, bool write);
+static size_t virtio_transfer (struct disk *, disk_sector_t, size_t cnt,
+		struct list *batch, struct batch_pos *, bool write);
+static void print_capacity (const struct disk *);
+static void input_sectors (struct channel *, void *, size_t cnt);
+static void output_sectors (struct channel *, const void *, size_t cnt);
+
+static void wait_completion (struct channel *);
 static void wait_until_idle (const struct disk *);
 static bool wait_while_busy (const struct disk *);
 static void select_device (const struct disk *);
 static void select_device_wait (const struct disk *);
 
 static void interrupt_handler (struct intr_frame *);
+static work_func report_unexpected;
 
-/* Initialize the disk subsystem and detect disks. */
+/* Initialize the disk subsystem and start detecting disks.  Each
+   channel is probed by its own thread, so that the two resets wait
+   at the same time, and disk_get() waits for the probe of its
+   channel only: the file system disk can be in use while the other
+   channel is still being reset. */
 void
 disk_init (void) {
+	uint16_t bm_base = find_bus_master ();
 	size_t chan_no;
 
 	for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
@@ -120,8 +276,18 @@ disk_init (void) {
 				NOT_REACHED ();
 		}
 		lock_init (&c->lock);
+		lock_set_name (&c->lock, "disk channel");
+		sema_init (&c->queue_sema, 0);
+		c->next_dev = 0;
 		c->expecting_interrupt = false;
 		sema_init (&c->completion_wait, 0);
+		c->issue_tsc = c->avg_wait = 0;
+		c->poll_cnt = c->sleep_cnt = 0;
+		work_init (&c->unexpected_work, report_unexpected, c);
+		c->probed = false;
+		sema_init (&c->probe_done, 0);
+		c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+		c->prdt = prdts[chan_no];
 
 		/* Initialize devices. */
 		for (dev_no = 0; dev_no < 2; dev_no++) {
@@ -131,31 +297,46 @@ disk_init (void) {
 			d->dev_no = dev_no;
 
 			d->is_ata = false;
+			d->virtio = NULL;
 			d->capacity = 0;
+			d->multiple = 0;
+			d->dma = false;
 
 			d->read_cnt = d->write_cnt = 0;
+
+			list_init (&d->queue);
+			d->head = 0;
+			d->queued = d->max_queued = 0;
+			d->request_cnt = d->depth_sum = d->merge_cnt = d->seq_cnt = 0;
+			d->busy_ticks = 0;
 		}
 
 		/* Register interrupt handler. */
 		intr_register_ext (c->irq, interrupt_handler, c->name);
 
-		/* Reset hardware. */
-		reset_channel (c);
-
-		/* Distinguish ATA hard disks from other devices. */
-		if (check_device_type (&c->devices[0]))
-			check_device_type (&c->devices[1]);
-
-		/* Read hard disk identity information. */
-		for (dev_no = 0; dev_no < 2; dev_no++)
-			if (c->devices[dev_no].is_ata)
-				identify_ata_device (&c->devices[dev_no]);
+		/* Probe the channel, then serve its requests. */
+		if (thread_create (c->name, PRI_MAX, probe_thread, c) == TID_ERROR)
+			PANIC ("%s: cannot start channel thread", c->name);
 	}
 
 	/* DO NOT MODIFY BELOW LINES. */
 	register_disk_inspect_intr ();
 }
 
+/* Prints the nonempty buckets of histogram HIST, named NAME, of
+   disk D. */
+static void
+print_hist (const struct disk *d, const char *name, const long long *hist) {
+	int i;
+
+	printf ("%s: %s cycles:", d->name, name);
+	for (i = 0; i < HIST_CNT; i++)
+		if (hist[i] != 0)
+			printf (" %s2^%d:%lld", i == HIST_CNT - 1 ? ">=" : "<",
+					HIST_SHIFT + i + (i < HIST_CNT - 1), hist[i]);
+	printf ("\n");
+}
+
 /* Prints disk statistics. */
 void
 disk_print_stats (void) {
@@ -166,10 +347,33 @@ disk_print_stats (void) {
 
 		for (dev_no = 0; dev_no < 2; dev_no++) {
 			struct disk *d = disk_get (chan_no, dev_no);
-			if (d != NULL && d->is_ata)
-				printf ("%s: %lld reads, %lld writes\n",
-						d->name, d->read_cnt, d->write_cnt);
+			int i;
+
+			if (d == NULL || !d->is_ata)
+				continue;
+			printf ("%s: %lld reads, %lld writes\n",
+					d->name, d->read_cnt, d->write_cnt);
+			if (d->request_cnt == 0)
+				continue;
+			printf ("%s: %lld requests, %lld merged, "
+					"queue depth %lld.%02lld avg, %zu max\n",
+					d->name, d->request_cnt, d->merge_cnt,
+					d->depth_sum / d->request_cnt,
+					d->depth_sum * 100 / d->request_cnt % 100,
+					d->max_queued);
+			printf ("%s: %lld sequential, %lld random\n", d->name,
+					d->seq_cnt, d->request_cnt - d->queued - d->seq_cnt);
+			for (i = 0; i < DISK_SRC_CNT; i++)
+				if (d->src_cnt[i][0] != 0 || d->src_cnt[i][1] != 0)
+					printf ("%s:   %s: %lld reads, %lld writes\n", d->name,
+							source_names[i], d->src_cnt[i][0], d->src_cnt[i][1]);
+			print_hist (d, "queue wait", d->wait_hist);
+			print_hist (d, "service", d->service_hist);
 		}
+		if (channels[chan_no].poll_cnt + channels[chan_no].sleep_cnt > 0)
+			printf ("%s: %lld completions polled, %lld slept for\n",
+					channels[chan_no].name, channels[chan_no].poll_cnt,
+					channels[chan_no].sleep_cnt);
 	}
 }
 
@@ -188,6 +392,8 @@ disk_get (int chan_no, int dev_no) {
 
 	if (chan_no < (int) CHANNEL_CNT) {
 		struct disk *d = &channels[chan_no].devices[dev_no];
+
+		wait_probe (d->channel);
 		if (d->is_ata)
 			return d;
 	}
@@ -203,27 +409,23 @@ disk_size (struct disk *d) {
 	return d->capacity;
 }
 
+/* Returns true if disk D has no request queued and none but the
+   defragmenter's has been submitted to it in the last TICKS timer
+   ticks, so that background work would not delay anyone's. */
+bool
+disk_idle (struct disk *d, int64_t ticks) {
+	ASSERT (d != NULL);
+
+	return d->queued == 0 && timer_elapsed (d->busy_ticks) >= ticks;
+}
+
 /* Reads sector SEC_NO from disk D into BUFFER, which must have
    room for DISK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
-	struct channel *c;
-
-	ASSERT (d != NULL);
-	ASSERT (buffer != NULL);
-
-	c = d->channel;
-	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-	sema_down (&c->completion_wait);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-	input_sector (c, buffer);
-	d->read_cnt++;
-	lock_release (&c->lock);
+	disk_read_multiple (d, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -233,25 +435,539 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
    per-disk locking is unneeded. */
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
-	struct channel *c;
+	disk_write_multiple (d, sec_no, 1, buffer);
+}
+
+/* Reads the CNT sectors starting at SEC_NO from disk D into
+   BUFFER, which must have room for CNT * DISK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_read_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		void *buffer) {
+	struct disk_request r;
+
+	disk_request_init (&r, d, sec_no, cnt, buffer, false);
+	disk_submit (&r);
+	disk_wait (&r);
+}
+
+/* Writes the CNT sectors starting at SEC_NO on disk D from
+   BUFFER, which must contain CNT * DISK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_write_multiple (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		const void *buffer) {
+	struct disk_request r;
 
+	disk_request_init (&r, d, sec_no, cnt, (void *) buffer, true);
+	disk_submit (&r);
+	disk_wait (&r);
+}
+
+/* Reads as disk_read_multiple(), accounting the sectors to
+   SOURCE. */
+void
+disk_read_from (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		void *buffer, enum disk_source source) {
+	struct disk_request r;
+
+	disk_request_init (&r, d, sec_no, cnt, buffer, false);
+	r.source = source;
+	disk_submit (&r);
+	disk_wait (&r);
+}
+
+/* Writes as disk_write_multiple(), accounting the sectors to
+   SOURCE. */
+void
+disk_write_from (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		const void *buffer, enum disk_source source) {
+	struct disk_request r;
+
+	disk_request_init (&r, d, sec_no, cnt, (void *) buffer, true);
+	r.source = source;
+	disk_submit (&r);
+	disk_wait (&r);
+}
+
+/* Initializes R as a request to move the CNT sectors starting at
+   SEC_NO between disk D and BUFFER, to the disk if WRITE, with no
+   completion function and not attributed to any source. */
+void
+disk_request_init (struct disk_request *r, struct disk *d,
+		disk_sector_t sec_no, size_t cnt, void *buffer, bool write) {
+	ASSERT (r != NULL);
 	ASSERT (d != NULL);
 	ASSERT (buffer != NULL);
+	ASSERT (cnt > 0);
+	ASSERT (sec_no < d->capacity && cnt <= d->capacity - sec_no);
+
+	r->disk = d;
+	r->sector = sec_no;
+	r->cnt = cnt;
+	r->buffer = buffer;
+	r->write = write;
+	r->dma = false;
+	r->source = DISK_SRC_OTHER;
+	r->complete = NULL;
+	r->aux = NULL;
+	sema_init (&r->done, 0);
+}
 
-	c = d->channel;
+/* Returns D's number in traces: its channel's number times 2
+   plus its device number. */
+static int
+disk_no (const struct disk *d) {
+	return (d->channel - channels) * 2 + d->dev_no;
+}
+
+/* Returns true if request A comes before request B in a queue. */
+static bool
+request_less (const struct list_elem *a, const struct list_elem *b,
+		void *aux UNUSED) {
+	const struct disk_request *ra = list_entry (a, struct disk_request, elem);
+	const struct disk_request *rb = list_entry (b, struct disk_request, elem);
+
+	return ra->sector < rb->sector;
+}
+
+/* Queues R on its disk's channel and returns without waiting for
+   it.  When R is done, its completion function is called by the
+   channel thread, or if it has none, its semaphore is up'd for
+   disk_wait(). */
+void
+disk_submit (struct disk_request *r) {
+	struct disk *d = r->disk;
+	struct channel *c = d->channel;
+
+	ASSERT (r->source < DISK_SRC_CNT);
+
+	r->dma = dma_usable (d, r->buffer, r->cnt);
+	if (!r->dma)
+		COUNTER_INC (disk_pio_requests);
+	r->submit_tsc = rdtsc ();
+	trace (TRACE_DISK_SUBMIT, TRACE_DISK_ARG (r->sector, r->cnt),
+			TRACE_DISK_AUX (disk_no (d), r->write));
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
-	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-	if (!wait_while_busy (d))
-		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-	output_sector (c, buffer);
-	sema_down (&c->completion_wait);
-	d->write_cnt++;
+	list_insert_ordered (&d->queue, &r->elem, request_less, NULL);
+	d->request_cnt++;
+	if (r->source != DISK_SRC_DEFRAG)
+		d->busy_ticks = timer_ticks ();
+	d->depth_sum += d->queued++;
+	if (d->queued > d->max_queued)
+		d->max_queued = d->queued;
 	lock_release (&c->lock);
+	sema_up (&c->queue_sema);
 }
-
+
+/* Waits for R, submitted without a completion function, to be
+   done. */
+void
+disk_wait (struct disk_request *r) {
+	ASSERT (r->complete == NULL);
+
+	sema_down (&r->done);
+}
+
+/* Picks the device of channel C to serve, taking turns between
+   the two, and removes from its queue the request at or after its
+   head, or the first one if none is, and the requests for the
+   sectors that follow on from it, and puts them in BATCH.  C's
+   lock must be held and a queue must not be empty.  Returns the
+   number of requests taken. */
+static size_t
+take_batch (struct channel *c, struct list *batch) {
+	struct disk *d = &c->devices[c->next_dev];
+	struct disk_request *first = NULL, *last;
+	struct list_elem *e;
+	size_t cnt;
+
+	if (list_empty (&d->queue))
+		d = &c->devices[!c->next_dev];
+	ASSERT (!list_empty (&d->queue));
+	c->next_dev = !d->dev_no;
+
+	for (e = list_begin (&d->queue); e != list_end (&d->queue);
+			e = list_next (e)) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+
+		if (r->sector >= d->head) {
+			first = r;
+			break;
+		}
+	}
+	if (first == NULL)
+		first = list_entry (list_front (&d->queue), struct disk_request, elem);
+	if (first->sector == d->head)
+		d->seq_cnt++;
+
+	last = first;
+	e = list_next (&first->elem);
+	list_remove (&first->elem);
+	list_push_back (batch, &first->elem);
+	for (cnt = 1; cnt < BATCH_MAX && e != list_end (&d->queue); cnt++) {
+		struct disk_request *r = list_entry (e, struct disk_request, elem);
+
+		if (r->write != last->write || r->dma != last->dma
+				|| r->sector != last->sector + last->cnt)
+			break;
+		e = list_remove (e);
+		list_push_back (batch, &r->elem);
+		last = r;
+	}
+	d->head = last->sector + last->cnt;
+	d->queued -= cnt;
+	d->merge_cnt += cnt - 1;
+	d->seq_cnt += cnt - 1;
+	return cnt;
+}
+
+/* Returns the address of the sector at *POS in BATCH and moves
+   *POS to the next sector. */
+static uint8_t *
+batch_next (struct list *batch, struct batch_pos *pos) {
+	struct disk_request *r = list_entry (pos->e, struct disk_request, elem);
+	uint8_t *sector = (uint8_t *) r->buffer + pos->ofs * DISK_SECTOR_SIZE;
+
+	ASSERT (pos->e != list_end (batch));
+
+	if (++pos->ofs == r->cnt) {
+		pos->e = list_next (pos->e);
+		pos->ofs = 0;
+	}
+	return sector;
+}
+
+/* Moves the CNT sectors starting at SEC_NO between disk D and the
+   buffers of BATCH, starting at *POS, by PIO.  CNT must be at most
+   MAX_SECTORS. */
+static void
+pio_transfer (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		struct list *batch, struct batch_pos *pos, bool write) {
+	struct channel *c = d->channel;
+	size_t block = d->multiple > 0 ? d->multiple : 1;
+	size_t done, i, k;
+
+	select_sector (d, sec_no, cnt);
+	if (write)
+		issue_pio_command (c, d->multiple > 0
+				? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+	else
+		issue_pio_command (c, d->multiple > 0
+				? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+
+	/* Reads interrupt before each block, writes after. */
+	for (done = 0; done < cnt; done += k) {
+		k = cnt - done < block ? cnt - done : block;
+		if (!write)
+			wait_completion (c);
+		if (!wait_while_busy (d))
+			PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+					write ? "write" : "read", sec_no + (disk_sector_t) done);
+		for (i = 0; i < k; i++)
+			if (write)
+				output_sectors (c, batch_next (batch, pos), 1);
+			else
+				input_sectors (c, batch_next (batch, pos), 1);
+		if (write)
+			wait_completion (c);
+	}
+}
+
+/* Returns the histogram bucket for CYCLES. */
+static int
+hist_bucket (uint64_t cycles) {
+	int b = 0;
+
+	for (cycles >>= HIST_SHIFT + 1; cycles != 0 && b < HIST_CNT - 1;
+			cycles >>= 1)
+		b++;
+	return b;
+}
+
+/* Detects the devices on channel CHANNEL_, then serves its
+   requests forever. */
+static void
+probe_thread (void *channel_) {
+	struct channel *c = channel_;
+	int dev_no;
+
+	/* Reset hardware. */
+	reset_channel (c);
+
+	/* Distinguish ATA hard disks from other devices. */
+	if (check_device_type (&c->devices[0]))
+		check_device_type (&c->devices[1]);
+
+	/* Read hard disk identity information, or look for a virtio
+	   disk in the slot. */
+	for (dev_no = 0; dev_no < 2; dev_no++) {
+		struct disk *d = &c->devices[dev_no];
+
+		if (d->is_ata)
+			identify_ata_device (d);
+		else {
+			d->virtio = virtio_blk_probe (VIRTIO_BLK_SLOT
+					+ (c - channels) * 2 + dev_no);
+			if (d->virtio != NULL) {
+				d->is_ata = true;
+				d->capacity = virtio_blk_capacity (d->virtio);
+				print_capacity (d);
+				printf (" virtio disk\n");
+			}
+		}
+	}
+
+	c->probed = true;
+	sema_up (&c->probe_done);
+	channel_thread (c);
+}
+
+/* Waits until the devices on channel C have been detected.  In an
+   interrupt handler, which cannot wait, they must have been. */
+static void
+wait_probe (struct channel *c) {
+	if (c->probed)
+		return;
+	ASSERT (!intr_context ());
+	sema_down (&c->probe_done);
+	sema_up (&c->probe_done);
+}
+
+/* Serves the requests of channel CHANNEL_ forever. */
+static void
+channel_thread (void *channel_) {
+	struct channel *c = channel_;
+
+	for (;;) {
+		struct list batch;
+		struct batch_pos pos;
+		struct disk_request *first;
+		struct disk *d;
+		disk_sector_t sec_no;
+		size_t cnt = 0, n;
+		struct list_elem *e;
+		uint64_t start, end;
+
+		sema_down (&c->queue_sema);
+		list_init (&batch);
+		lock_acquire (&c->lock);
+		n = take_batch (c, &batch);
+		lock_release (&c->lock);
+
+		/* Each request taken went with one sema_up(). */
+		while (--n > 0)
+			sema_down (&c->queue_sema);
+
+		first = list_entry (list_front (&batch), struct disk_request, elem);
+		d = first->disk;
+		sec_no = first->sector;
+		for (e = list_begin (&batch); e != list_end (&batch); e = list_next (e))
+			cnt += list_entry (e, struct disk_request, elem)->cnt;
+
+		/* Move the batch in commands of up to MAX_SECTORS. */
+		COUNTER_INC (disk_batches);
+		start = rdtsc ();
+		pos.e = list_begin (&batch);
+		pos.ofs = 0;
+		while (cnt > 0) {
+			size_t k = cnt < MAX_SECTORS ? cnt : MAX_SECTORS;
+
+			if (d->virtio != NULL)
+				k = virtio_transfer (d, sec_no, k, &batch, &pos, first->write);
+			else if (first->dma)
+				k = dma_transfer (d, sec_no, k, &batch, &pos, first->write);
+			else
+				pio_transfer (d, sec_no, k, &batch, &pos, first->write);
+			if (first->write)
+				d->write_cnt += k;
+			else
+				d->read_cnt += k;
+			sec_no += k;
+			cnt -= k;
+		}
+
+		end = rdtsc ();
+
+		while (!list_empty (&batch)) {
+			struct disk_request *r = list_entry (list_pop_front (&batch),
+					struct disk_request, elem);
+
+			d->src_cnt[r->source][r->write] += r->cnt;
+			d->wait_hist[hist_bucket (start - r->submit_tsc)]++;
+			d->service_hist[hist_bucket (end - start)]++;
+			trace (TRACE_DISK_DONE, TRACE_DISK_ARG (r->sector, r->cnt),
+					TRACE_DISK_AUX (disk_no (d), r->write));
+			if (r->complete != NULL)
+				r->complete (r, r->aux);
+			else
+				sema_up (&r->done);
+		}
+	}
+}
+
+/* Returns true if the CNT sectors of BUFFER can move between disk D
+   and memory by DMA: the controller must be a bus master, D must
+   support DMA, and BUFFER must be word-aligned kernel memory below
+   4 GB.  A virtio disk moves everything by DMA, so BUFFER must be
+   kernel memory. */
+static bool
+dma_usable (const struct disk *d, const void *buffer, size_t cnt) {
+	uint64_t pa;
+
+	if (d->virtio != NULL) {
+		ASSERT (is_kernel_vaddr (buffer));
+		return true;
+	}
+
+	if (d->channel->bm_base == 0 || !d->dma || (uintptr_t) buffer % 2 != 0
+			|| !is_kernel_vaddr (buffer))
+		return false;
+	pa = vtop (buffer);
+	return pa + cnt * DISK_SECTOR_SIZE <= (1ULL << 32);
+}
+
+/* Adds the LENGTH bytes at physical address PA to the *N regions
+   in PRDT, extending the last region if they follow on from it.
+   Regions are split at 64 kB boundaries, so up to 2 are added for
+   a sector. */
+static void
+prd_add (struct prd *prdt, size_t *n, uint64_t pa, size_t length) {
+	while (length > 0) {
+		size_t chunk = 0x10000 - (pa & 0xffff);
+		struct prd *last = *n > 0 ? &prdt[*n - 1] : NULL;
+
+		if (chunk > length)
+			chunk = length;
+		if (last != NULL && last->addr + last->size == pa
+				&& (pa & 0xffff) != 0)
+			last->size += chunk;
+		else {
+			ASSERT (*n < PRD_CNT);
+			prdt[*n].addr = pa;
+			prdt[*n].size = chunk & 0xffff;
+			prdt[*n].flags = 0;
+			++*n;
+		}
+		pa += chunk;
+		length -= chunk;
+	}
+}
+
+/* Moves up to CNT sectors starting at SEC_NO between disk D and
+   the buffers of BATCH, starting at *POS, by DMA, to the disk if
+   WRITE, and waits for the controller to finish.  Moves fewer
+   sectors if their buffers do not fit in one PRD table.  The
+   buffers must pass dma_usable().  Returns the number of sectors
+   moved. */
+static size_t
+dma_transfer (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		struct list *batch, struct batch_pos *pos, bool write) {
+	struct channel *c = d->channel;
+	size_t n = 0, k;
+	uint8_t bm_status;
+
+	/* Describe the buffers in a PRD table. */
+	for (k = 0; k < cnt && n + 2 <= PRD_CNT; k++) {
+		uint8_t *sector = batch_next (batch, pos);
+
+		prd_add (c->prdt, &n, vtop (sector), DISK_SECTOR_SIZE);
+	}
+	c->prdt[n - 1].flags = PRD_EOT;
+
+	/* Set up the controller, then the disk, then start. */
+	outl (reg_bm_prdt (c), vtop (c->prdt));
+	outb (reg_bm_cmd (c), write ? 0 : BM_READ);
+	outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+	select_sector (d, sec_no, k);
+	issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+	outb (reg_bm_cmd (c), (write ? 0 : BM_READ) | BM_START);
+
+	/* The disk interrupts once, when it is done. */
+	wait_completion (c);
+	outb (reg_bm_cmd (c), 0);
+	bm_status = inb (reg_bm_status (c));
+	outb (reg_bm_status (c), BM_STA_ERR | BM_STA_INTR);
+	if ((bm_status & BM_STA_ERR) || (inb (reg_alt_status (c)) & STA_ERR))
+		PANIC ("%s: disk DMA %s failed, sector=%"PRDSNu,
+				d->name, write ? "write" : "read", sec_no);
+	return k;
+}
+
+/* Moves up to CNT sectors starting at SEC_NO between virtio disk D
+   and the buffers of BATCH, starting at *POS, to the disk if WRITE,
+   and waits for the device to finish.  Moves fewer sectors if their
+   buffers are in more than VIRTIO_BLK_SEGS pieces.  Returns the
+   number of sectors moved. */
+static size_t
+virtio_transfer (struct disk *d, disk_sector_t sec_no, size_t cnt,
+		struct list *batch, struct batch_pos *pos, bool write) {
+	struct virtio_blk_seg segs[VIRTIO_BLK_SEGS];
+	size_t n = 0, k;
+
+	for (k = 0; k < cnt; k++) {
+		struct list_elem *e = pos->e;
+		size_t ofs = pos->ofs;
+		uint64_t pa = vtop (batch_next (batch, pos));
+
+		if (n > 0 && segs[n - 1].pa + segs[n - 1].length == pa)
+			segs[n - 1].length += DISK_SECTOR_SIZE;
+		else if (n < VIRTIO_BLK_SEGS) {
+			segs[n].pa = pa;
+			segs[n].length = DISK_SECTOR_SIZE;
+			n++;
+		} else {
+			/* Leave this sector for the next request. */
+			pos->e = e;
+			pos->ofs = ofs;
+			break;
+		}
+	}
+	if (!virtio_blk_transfer (d->virtio, sec_no, segs, n, write))
+		PANIC ("%s: virtio %s failed, sector=%"PRDSNu,
+				d->name, write ? "write" : "read", sec_no);
+	return k;
+}
+
 /* Disk detection and identification. */
 
+/* Looks on PCI bus 0 for an IDE controller that runs both channels
+   at the legacy ports and can be a bus master.  If there is one,
+   enables its bus mastering and returns its bus-master base port;
+   otherwise returns 0. */
+static uint16_t
+find_bus_master (void) {
+	int dev, fn;
+
+	for (dev = 0; dev < 32; dev++)
+		for (fn = 0; fn < 8; fn++) {
+			uint32_t class, bar;
+
+			if ((pci_read_config (dev, fn, PCI_REG_ID) & 0xffff) == 0xffff)
+				continue;
+
+			/* Programming interface: bit 7 is bus mastering, bits 0
+			   and 2 native mode for either channel. */
+			class = pci_read_config (dev, fn, PCI_REG_CLASS);
+			if (class >> 16 != PCI_CLASS_IDE
+					|| (class & 0x8500) != 0x8000)
+				continue;
+
+			/* BAR 4 holds the bus-master ports. */
+			bar = pci_read_config (dev, fn, 0x20);
+			if (!(bar & 1) || (bar & 0xfffc) == 0)
+				continue;
+			pci_write_config (dev, fn, PCI_REG_COMMAND,
+					pci_read_config (dev, fn, PCI_REG_COMMAND)
+					| PCI_CMD_BUS_MASTER);
+			return bar & 0xfffc;
+		}
+	return 0;
+}
+
 static void print_ata_string (char *string, size_t size);
 
 /* Resets an ATA channel and waits for any devices present on it
@@ -359,12 +1075,32 @@ identify_ata_device (struct disk *d) {
 		d->is_ata = false;
 		return;
 	}
-	input_sector (c, id);
+	input_sectors (c, id, 1);
 
 	/* Calculate capacity. */
 	d->capacity = id[60] | ((uint32_t) id[61] << 16);
 
+	/* Word 49 bit 8 tells whether DMA is supported. */
+	d->dma = (id[49] & 0x0100) != 0;
+
+	/* Word 47 gives the most sectors READ/WRITE MULTIPLE can move
+	   per interrupt. */
+	if ((id[47] & 0xff) > 1)
+		set_multiple_mode (d, id[47] & 0xff);
+
 	/* Print identification message. */
+	print_capacity (d);
+	printf (" disk, model \"");
+	print_ata_string ((char *) &id[27], 40);
+	printf ("\", serial \"");
+	print_ata_string ((char *) &id[10], 20);
+	printf ("\"\n");
+}
+
+/* Prints the start of the message that describes disk D: its name
+   and size. */
+static void
+print_capacity (const struct disk *d) {
 	printf ("%s: detected %'"PRDSNu" sector (", d->name, d->capacity);
 	if (d->capacity > 1024 / DISK_SECTOR_SIZE * 1024 * 1024)
 		printf ("%"PRDSNu" GB",
@@ -375,11 +1111,23 @@ identify_ata_device (struct disk *d) {
 		printf ("%"PRDSNu" kB", d->capacity / (1024 / DISK_SECTOR_SIZE));
 	else
 		printf ("%"PRDSNu" byte", d->capacity * DISK_SECTOR_SIZE);
-	printf (") disk, model \"");
-	print_ata_string ((char *) &id[27], 40);
-	printf ("\", serial \"");
-	print_ata_string ((char *) &id[10], 20);
-	printf ("\"\n");
+	printf (")");
+}
+
+/* Sends a SET MULTIPLE MODE command to disk D for SECTORS
+   sectors per interrupt and, if the disk accepts it, sets D's
+   multiple member. */
+static void
+set_multiple_mode (struct disk *d, uint8_t sectors) {
+	struct channel *c = d->channel;
+
+	select_device_wait (d);
+	outb (reg_nsect (c), sectors);
+	issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+	sema_down (&c->completion_wait);
+	wait_while_busy (d);
+	if (!(inb (reg_alt_status (c)) & STA_ERR))
+		d->multiple = sectors;
 }
 
 /* Prints STRING, which consists of SIZE bytes in a funky format:
@@ -402,17 +1150,18 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT, at most MAX_SECTORS, to the disk's
+   sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) {
 	struct channel *c = d->channel;
 
-	ASSERT (sec_no < d->capacity);
-	ASSERT (sec_no < (1UL << 28));
+	ASSERT (cnt > 0 && cnt <= MAX_SECTORS);
+	ASSERT (sec_no < d->capacity && cnt <= d->capacity - sec_no);
+	ASSERT (sec_no + cnt <= (1UL << 28));
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
+	outb (reg_nsect (c), cnt == MAX_SECTORS ? 0 : cnt);
 	outb (reg_lbal (c), sec_no);
 	outb (reg_lbam (c), sec_no >> 8);
 	outb (reg_lbah (c), (sec_no >> 16));
@@ -429,21 +1178,58 @@ issue_pio_command (struct channel *c, uint8_t command) {
 	ASSERT (intr_get_level () == INTR_ON);
 
 	c->expecting_interrupt = true;
+	c->issue_tsc = rdtsc ();
 	outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for DISK_SECTOR_SIZE bytes. */
+/* Waits for the interrupt that ends a command on channel C, or a
+   block of one.
+
+   Sleeping for it costs a wakeup and two context switches, which
+   is more than a short transfer takes under QEMU.  So, if C's
+   interrupts have been coming within disk_poll_us microseconds,
+   the channel thread first spins, for up to twice their average
+   delay, until the interrupt handler ups the semaphore, and only
+   then sleeps.  The handler still acknowledges the disk either
+   way, so polling never races with it over the status register. */
 static void
-input_sector (struct channel *c, void *sector) {
-	insw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
+wait_completion (struct channel *c) {
+	uint64_t poll_max = disk_poll_us * timer_tsc_hz () / 1000000;
+	uint64_t start = rdtsc (), now;
+
+	if (c->avg_wait < poll_max) {
+		uint64_t spin = 2 * c->avg_wait < poll_max ? 2 * c->avg_wait
+			: poll_max;
+
+		while (__atomic_load_n (&c->completion_wait.value, __ATOMIC_ACQUIRE)
+				== 0 && rdtsc () - start < spin)
+			asm volatile ("pause");
+	}
+	if (__atomic_load_n (&c->completion_wait.value, __ATOMIC_ACQUIRE) > 0)
+		c->poll_cnt++;
+	else
+		c->sleep_cnt++;
+	sema_down (&c->completion_wait);
+
+	/* The next block of a PIO command is due from now. */
+	now = rdtsc ();
+	c->avg_wait += ((int64_t) (now - c->issue_tsc) - (int64_t) c->avg_wait) / 8;
+	c->issue_tsc = now;
+}
+
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * DISK_SECTOR_SIZE
+   bytes. */
+static void
+input_sectors (struct channel *c, void *sectors, size_t cnt) {
+	insw (reg_data (c), sectors, cnt * DISK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain DISK_SECTOR_SIZE bytes. */
+/* Writes CNT sectors from SECTORS to channel C's data register in
+   PIO mode.  SECTORS must contain CNT * DISK_SECTOR_SIZE bytes. */
 static void
-output_sector (struct channel *c, const void *sector) {
-	outsw (reg_data (c), sector, DISK_SECTOR_SIZE / 2);
+output_sectors (struct channel *c, const void *sectors, size_t cnt) {
+	outsw (reg_data (c), sectors, cnt * DISK_SECTOR_SIZE / 2);
 }
 
 /* Low-level ATA primitives. */
@@ -522,13 +1308,22 @@ interrupt_handler (struct intr_frame *f) {
 				inb (reg_status (c));               /* Acknowledge interrupt. */
 				sema_up (&c->completion_wait);      /* Wake up waiter. */
 			} else
-				printf ("%s: unexpected interrupt\n", c->name);
+				work_submit (&c->unexpected_work);
 			return;
 		}
 
 	NOT_REACHED ();
 }
 
+/* Reports an unexpected interrupt on channel CHANNEL_, from a
+   worker thread rather than with interrupts off. */
+static void
+report_unexpected (void *channel_) {
+	struct channel *c = channel_;
+
+	printf ("%s: unexpected interrupt\n", c->name);
+}
+
 static void
 inspect_read_cnt (struct intr_frame *f) {
 	struct disk * d = disk_get (f->R.rdx, f->R.rcx);
@@ -541,6 +1336,38 @@ inspect_write_cnt (struct intr_frame *f) {
 	f->R.rax = d->write_cnt;
 }
 
+/* Answers the disk accounting inspection interrupt. */
+static void
+inspect_io (struct intr_frame *f) {
+	struct disk * d = disk_get (f->R.rdx, f->R.rcx);
+	uint64_t i = f->R.rsi;
+
+	f->R.rax = -1;
+	if (d == NULL)
+		return;
+	switch (f->R.rdi) {
+		case 0:
+		case 1:
+			if (i < DISK_SRC_CNT)
+				f->R.rax = d->src_cnt[i][f->R.rdi];
+			break;
+		case 2:
+			if (i < HIST_CNT)
+				f->R.rax = d->wait_hist[i];
+			break;
+		case 3:
+			if (i < HIST_CNT)
+				f->R.rax = d->service_hist[i];
+			break;
+		case 4:
+			f->R.rax = d->seq_cnt;
+			break;
+		case 5:
+			f->R.rax = d->request_cnt - d->queued - d->seq_cnt;
+			break;
+	}
+}
+
 /* Tool for testing disk r/w cnt. Calling this function via int 0x43 and int 0x44.
  * Input:
  *   @RDX - chan_no of disk to inspect
@@ -551,4 +1378,17 @@ void
 register_disk_inspect_intr (void) {
 	intr_register_int (0x43, 3, INTR_OFF, inspect_read_cnt, "Inspect Disk Read Count");
 	intr_register_int (0x44, 3, INTR_OFF, inspect_write_cnt, "Inspect Disk Write Count");
+
+	/* Disk I/O accounting, via int 0x49.
+	   Input:
+	     @RDX, @RCX - chan_no and dev_no of disk to inspect
+	     @RDI - 0: sectors read for source RSI (enum disk_source),
+	            1: sectors written for source RSI,
+	            2: requests in queue wait histogram bucket RSI,
+	            3: requests in service time histogram bucket RSI,
+	            4: sequential requests served,
+	            5: random requests served.
+	   Output:
+	     @RAX - Requested counter, or -1 if out of range. */
+	intr_register_int (0x49, 3, INTR_OFF, inspect_io, "Inspect Disk I/O");
 }
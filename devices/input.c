@@ -2,14 +2,23 @@
 #include <debug.h>
 #include "devices/intq.h"
 #include "devices/serial.h"
+#include "threads/poll.h"
+#include "threads/synch.h"
 
-/* Stores keys from the keyboard and serial port. */
+/* Stores keys from the keyboard and serial port.  Their interrupt
+   handlers add keys with interrupts off; threads take them out as
+   its single consumer, one at a time under READ_LOCK, with
+   interrupts on.  Threads in poll() wait on POLLERS for keys. */
 static struct intq buffer;
+static struct lock read_lock;
+static struct poll_queue pollers;
 
 /* Initializes the input buffer. */
 void
 input_init (void) {
 	intq_init (&buffer);
+	lock_init (&read_lock);
+	poll_queue_init (&pollers);
 }
 
 /* Adds a key to the input buffer.
@@ -21,21 +30,76 @@ input_putc (uint8_t key) {
 
 	intq_putc (&buffer, key);
 	serial_notify ();
+	poll_wake (&pollers);
+}
+
+/* Adds the N keys in BUF to the input buffer, telling the serial
+   port once rather than for each key.
+   Interrupts must be off and the buffer must have room for them. */
+void
+input_putbuf (const uint8_t *buf, size_t n) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (n <= intq_space (&buffer));
+
+	intq_write (&buffer, buf, n);
+	serial_notify ();
+	poll_wake (&pollers);
 }
 
 /* Retrieves a key from the input buffer.
    If the buffer is empty, waits for a key to be pressed. */
 uint8_t
 input_getc (void) {
-	enum intr_level old_level;
 	uint8_t key;
 
-	old_level = intr_disable ();
-	key = intq_getc (&buffer);
-	serial_notify ();
+	input_read (&key, 1, false);
+	return key;
+}
+
+/* Moves up to N keys from the input buffer into BUF, without
+   turning interrupts off to copy them, and returns the number
+   moved.  If the buffer is empty, first waits for a key, unless
+   NONBLOCKING, in which case returns 0. */
+size_t
+input_read (uint8_t *buf, size_t n, bool nonblocking) {
+	enum intr_level old_level;
+	size_t cnt;
+
+	if (n == 0)
+		return 0;
+
+	lock_acquire (&read_lock);
+	cnt = intq_spsc_read (&buffer, buf, n, !nonblocking);
+	lock_release (&read_lock);
+
+	/* There is room again for the serial port to receive into. */
+	if (cnt > 0) {
+		old_level = intr_disable ();
+		serial_notify ();
+		intr_set_level (old_level);
+	}
+	return cnt;
+}
+
+/* Returns true if the input buffer holds a key, and adds it to the
+   queues PT waits on. */
+bool
+input_poll (struct poll_table *pt) {
+	enum intr_level old_level = intr_disable ();
+	bool ready;
+
+	poll_add (pt, &pollers);
+	ready = !intq_empty (&buffer);
 	intr_set_level (old_level);
+	return ready;
+}
 
-	return key;
+/* Returns the number of keys the input buffer has room for.
+   Interrupts must be off. */
+size_t
+input_space (void) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	return intq_space (&buffer);
 }
 
 /* Returns true if the input buffer is full,
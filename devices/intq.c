@@ -1,5 +1,6 @@
 #include "devices/intq.h"
 #include <debug.h>
+#include <string.h>
 #include "threads/thread.h"
 
 static int next (int pos);
@@ -28,6 +29,14 @@ intq_full (const struct intq *q) {
 	return next (q->head) == q->tail;
 }
 
+/* Returns the number of bytes that can be added to Q before it is
+   full. */
+size_t
+intq_space (const struct intq *q) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	return (q->tail - q->head - 1 + INTQ_BUFSIZE) % INTQ_BUFSIZE;
+}
+
 /* Removes a byte from Q and returns it.
    Q must not be empty if called from an interrupt handler.
    Otherwise, if Q is empty, first sleeps until a byte is
@@ -50,6 +59,83 @@ intq_getc (struct intq *q) {
 	return byte;
 }
 
+/* Removes up to N bytes from Q into BUF without sleeping and
+   returns the number removed, which is 0 if Q is empty.  The
+   bytes are copied a contiguous run of the buffer at a time. */
+size_t
+intq_read (struct intq *q, uint8_t *buf, size_t n) {
+	size_t cnt = 0;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	while (cnt < n && !intq_empty (q)) {
+		size_t run = (q->head > q->tail ? q->head : INTQ_BUFSIZE) - q->tail;
+
+		if (run > n - cnt)
+			run = n - cnt;
+		memcpy (buf + cnt, q->buf + q->tail, run);
+		barrier ();
+		q->tail = (q->tail + run) % INTQ_BUFSIZE;
+		cnt += run;
+	}
+	if (cnt > 0)
+		signal (q, &q->not_full);
+	return cnt;
+}
+
+/* Removes up to N bytes from Q into BUF, as intq_read(), but with
+   interrupts on or off, for Q's only consumer.  If BLOCK and Q is
+   empty, first waits for a byte.  See intq.h. */
+size_t
+intq_spsc_read (struct intq *q, uint8_t *buf, size_t n, bool block) {
+	size_t cnt = 0;
+
+	ASSERT (!intr_context ());
+
+	if (n == 0)
+		return 0;
+	if (block && q->head == q->tail) {
+		enum intr_level old_level = intr_disable ();
+
+		while (intq_empty (q)) {
+			lock_acquire (&q->lock);
+			wait (q, &q->not_empty);
+			lock_release (&q->lock);
+		}
+		intr_set_level (old_level);
+	}
+
+	while (cnt < n) {
+		int head, tail = q->tail;
+		size_t run;
+
+		/* Read HEAD before the bytes it covers. */
+		barrier ();
+		head = q->head;
+		barrier ();
+		if (head == tail)
+			break;
+		run = (head > tail ? head : INTQ_BUFSIZE) - tail;
+		if (run > n - cnt)
+			run = n - cnt;
+		memcpy (buf + cnt, q->buf + tail, run);
+
+		/* Copy the bytes out before giving their room back. */
+		barrier ();
+		q->tail = (tail + run) % INTQ_BUFSIZE;
+		cnt += run;
+	}
+
+	/* A producer that found Q full waits with interrupts off, so
+	   it is waiting already if it ever will for these bytes. */
+	barrier ();
+	if (cnt > 0 && q->not_full != NULL) {
+		enum intr_level old_level = intr_disable ();
+		signal (q, &q->not_full);
+		intr_set_level (old_level);
+	}
+	return cnt;
+}
+
 /* Adds BYTE to the end of Q.
    Q must not be full if called from an interrupt handler.
    Otherwise, if Q is full, first sleeps until a byte is
@@ -65,10 +151,36 @@ intq_putc (struct intq *q, uint8_t byte) {
 	}
 
 	q->buf[q->head] = byte;
+	barrier ();
 	q->head = next (q->head);
 	signal (q, &q->not_empty);
 }
 
+/* Adds up to N bytes from BUF to the end of Q without sleeping and
+   returns the number added, which is 0 if Q is full.  The bytes are
+   copied a contiguous run of the buffer at a time. */
+size_t
+intq_write (struct intq *q, const uint8_t *buf, size_t n) {
+	size_t cnt = 0;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	while (cnt < n && !intq_full (q)) {
+		/* Stop one short of TAIL, which must stay unequal to HEAD. */
+		size_t run = (q->tail > q->head ? q->tail - 1 : INTQ_BUFSIZE
+				- (q->tail == 0)) - q->head;
+
+		if (run > n - cnt)
+			run = n - cnt;
+		memcpy (q->buf + q->head, buf + cnt, run);
+		barrier ();
+		q->head = (q->head + run) % INTQ_BUFSIZE;
+		cnt += run;
+	}
+	if (cnt > 0)
+		signal (q, &q->not_empty);
+	return cnt;
+}
+
 /* Returns the position after POS within an intq. */
 static int
 next (int pos) {
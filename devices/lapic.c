@@ -0,0 +1,163 @@
+#include "devices/lapic.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+/* See [IA32-v3a] chapter 10 "Advanced Programmable Interrupt
+   Controller (APIC)" for hardware details of the local APIC.
+
+   The PICs keep delivering the other external interrupts, through
+   the local APIC's LINT0 pin in virtual wire mode.  Only the timer
+   moves to the local APIC. */
+
+#define CPUID_1_EDX_APIC (1 << 9)           /* Local APIC present. */
+#define CPUID_1_ECX_TSC_DEADLINE (1 << 24)  /* TSC-deadline timer mode. */
+
+#define MSR_APIC_BASE 0x1b                  /* IA32_APIC_BASE. */
+#define MSR_TSC_DEADLINE 0x6e0              /* IA32_TSC_DEADLINE. */
+#define APIC_BASE_ENABLE (1 << 11)          /* APIC globally enabled. */
+#define APIC_BASE_ADDR 0xfffff000           /* Physical base of registers. */
+
+/* Registers, as byte offsets. */
+#define REG_ID 0x020                        /* Local APIC ID. */
+#define REG_EOI 0x0b0                       /* End of interrupt. */
+#define REG_SVR 0x0f0                       /* Spurious interrupt vector. */
+#define REG_LVT_TIMER 0x320                 /* Timer LVT entry. */
+#define REG_LVT_LINT0 0x350                 /* LINT0 LVT entry. */
+#define REG_LVT_LINT1 0x360                 /* LINT1 LVT entry. */
+#define REG_TIMER_INIT 0x380                /* Timer initial count. */
+#define REG_TIMER_CUR 0x390                 /* Timer current count. */
+#define REG_TIMER_DIV 0x3e0                 /* Timer divide configuration. */
+
+#define SVR_ENABLE (1 << 8)                 /* APIC software enable. */
+#define LVT_MASKED (1 << 16)                /* Interrupt masked. */
+#define LVT_EXTINT (7 << 8)                 /* Delivery mode ExtINT. */
+#define LVT_NMI (4 << 8)                    /* Delivery mode NMI. */
+#define LVT_TIMER_ONESHOT (0 << 17)         /* Timer mode one-shot. */
+#define LVT_TIMER_TSC_DEADLINE (2 << 17)    /* Timer mode TSC deadline. */
+#define TIMER_DIV_16 0x3                    /* Timer counts bus clock / 16. */
+
+/* Registers, mapped uncached, or null if there is no local APIC. */
+static volatile uint32_t *lapic;
+
+/* TSC-deadline timer mode supported? */
+static bool tsc_deadline;
+
+static intr_handler_func spurious_interrupt;
+
+static inline uint32_t
+lapic_read (int reg) {
+	return lapic[reg / 4];
+}
+
+static inline void
+lapic_write (int reg, uint32_t value) {
+	lapic[reg / 4] = value;
+}
+
+/* Maps and enables the local APIC, if the CPU has one, with LINT0
+   and LINT1 in virtual wire mode so that the PICs keep working. */
+void
+lapic_init (void) {
+	uint32_t ecx, edx;
+	uint64_t base, *pte;
+	void *va;
+
+	cpuid (1, &ecx, &edx);
+	if (!(edx & CPUID_1_EDX_APIC))
+		return;
+	tsc_deadline = (ecx & CPUID_1_ECX_TSC_DEADLINE) != 0;
+
+	base = read_msr (MSR_APIC_BASE);
+	write_msr (MSR_APIC_BASE, base | APIC_BASE_ENABLE);
+
+	/* The registers sit in the hole below 4 GB, past the RAM that
+	   paging_init() mapped, and must not be cached. */
+	va = ptov (base & APIC_BASE_ADDR);
+	pte = pml4e_walk (base_pml4, (uint64_t) va, 1);
+	if (pte == NULL)
+		return;
+	*pte = (base & APIC_BASE_ADDR) | PTE_P | PTE_W | PTE_PCD | PTE_PWT;
+	invlpg ((uint64_t) va);
+	lapic = va;
+
+	intr_register_ext (LAPIC_SPURIOUS_VEC, spurious_interrupt,
+			"Local APIC Spurious");
+	lapic_write (REG_LVT_TIMER, LVT_MASKED);
+	lapic_write (REG_LVT_LINT0, LVT_EXTINT);
+	lapic_write (REG_LVT_LINT1, LVT_NMI);
+	lapic_write (REG_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VEC);
+}
+
+/* Returns true if the CPU has a local APIC, which lapic_init()
+   enabled. */
+bool
+lapic_present (void) {
+	return lapic != NULL;
+}
+
+/* Returns true if the local APIC timer has TSC-deadline mode. */
+bool
+lapic_has_tsc_deadline (void) {
+	return lapic != NULL && tsc_deadline;
+}
+
+/* Returns the local APIC ID of the running CPU, or 0 if there is
+   no local APIC. */
+uint8_t
+lapic_id (void) {
+	return lapic != NULL ? lapic_read (REG_ID) >> 24 : 0;
+}
+
+/* Acknowledges the interrupt being handled. */
+void
+lapic_eoi (void) {
+	lapic_write (REG_EOI, 0);
+}
+
+/* Sets up the timer to raise LAPIC_TIMER_VEC, in TSC-deadline mode
+   if TSC_DEADLINE, in one-shot mode counting the bus clock divided
+   by 16 otherwise.  The timer is left stopped. */
+void
+lapic_timer_setup (bool tsc_deadline_mode) {
+	ASSERT (lapic != NULL);
+	ASSERT (!tsc_deadline_mode || tsc_deadline);
+
+	lapic_write (REG_TIMER_INIT, 0);
+	lapic_write (REG_TIMER_DIV, TIMER_DIV_16);
+	lapic_write (REG_LVT_TIMER, LAPIC_TIMER_VEC
+			| (tsc_deadline_mode ? LVT_TIMER_TSC_DEADLINE : LVT_TIMER_ONESHOT));
+	if (tsc_deadline_mode)
+		write_msr (MSR_TSC_DEADLINE, 0);
+}
+
+/* In one-shot mode, starts the timer to interrupt after COUNT
+   counts, or stops it if COUNT is 0. */
+void
+lapic_timer_oneshot (uint32_t count) {
+	lapic_write (REG_TIMER_INIT, count);
+}
+
+/* In TSC-deadline mode, arms the timer to interrupt once the TSC
+   reaches TSC, right away if it has, or disarms it if TSC is 0. */
+void
+lapic_timer_deadline (uint64_t tsc) {
+	write_msr (MSR_TSC_DEADLINE, tsc);
+}
+
+/* In one-shot mode, returns the counts left until the timer
+   interrupts. */
+uint32_t
+lapic_timer_count (void) {
+	return lapic_read (REG_TIMER_CUR);
+}
+
+/* A spurious interrupt needs no acknowledgment. */
+static void
+spurious_interrupt (struct intr_frame *f UNUSED) {
+}
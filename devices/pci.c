@@ -0,0 +1,25 @@
+#include "devices/pci.h"
+#include "threads/io.h"
+
+/* Access to the configuration space of the devices on PCI bus 0,
+   through configuration mechanism #1, which every PC since the
+   first PCI ones has. */
+
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Returns the configuration dword at offset REG of PCI function
+   FN of device DEV on bus 0. */
+uint32_t
+pci_read_config (int dev, int fn, int reg) {
+	outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (fn << 8) | reg);
+	return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes DATA to the configuration dword at offset REG of PCI
+   function FN of device DEV on bus 0. */
+void
+pci_write_config (int dev, int fn, int reg, uint32_t data) {
+	outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (fn << 8) | reg);
+	outl (PCI_CONFIG_DATA, data);
+}
@@ -37,6 +37,16 @@
 #define IER_RECV 0x01           /* Interrupt when data received. */
 #define IER_XMIT 0x02           /* Interrupt when transmit finishes. */
 
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable the receive and transmit FIFOs. */
+#define FCR_CLEAR 0x06          /* Clear both FIFOs. */
+#define FCR_RX_TRIGGER_8 0x80   /* Interrupt once 8 bytes are received. */
+
+/* Bytes the transmit FIFO holds once THR is empty, and the most the
+   receive FIFO holds. */
+#define TX_FIFO_SIZE 16
+#define RX_FIFO_SIZE 16
+
 /* Line Control Register bits. */
 #define LCR_N81 0x03            /* No parity, 8 data bits, 1 stop bit. */
 #define LCR_DLAB 0x80           /* Divisor Latch Access Bit (DLAB). */
@@ -54,6 +64,10 @@ static enum { UNINIT, POLL, QUEUE } mode;
 /* Data to be transmitted. */
 static struct intq txq;
 
+/* Bytes that can go to THR before the transmit FIFO may be full.
+   Each wait for THR empty lets a FIFO's worth through. */
+static int tx_room;
+
 static void set_serial (int bps);
 static void putc_poll (uint8_t);
 static void write_ier (void);
@@ -67,7 +81,7 @@ static void
 init_poll (void) {
 	ASSERT (mode == UNINIT);
 	outb (IER_REG, 0);                    /* Turn off all interrupts. */
-	outb (FCR_REG, 0);                    /* Disable FIFO. */
+	outb (FCR_REG, FCR_ENABLE | FCR_CLEAR);   /* Enable FIFOs. */
 	set_serial (115200);                  /* 115.2 kbps, N-8-1. */
 	outb (MCR_REG, MCR_OUT2);             /* Required to enable interrupts. */
 	intq_init (&txq);
@@ -88,6 +102,10 @@ serial_init_queue (void) {
 	intr_register_ext (0x20 + 4, serial_interrupt, "serial");
 	mode = QUEUE;
 	old_level = intr_disable ();
+	/* Let each transmit interrupt hand the UART a FIFO's worth, and
+	   each receive interrupt take several bytes.  Fewer than 8 still
+	   interrupt, after 4 characters' time without more. */
+	outb (FCR_REG, FCR_ENABLE | FCR_RX_TRIGGER_8);
 	write_ier ();
 	intr_set_level (old_level);
 }
@@ -122,6 +140,44 @@ serial_putc (uint8_t byte) {
 	intr_set_level (old_level);
 }
 
+/* Sends the N bytes in BUF to the serial port.  Unlike calling
+   serial_putc() for each byte, interrupts are disabled only once
+   and the interrupt enable register is only rewritten when the
+   transmit queue fills up and at the end. */
+void
+serial_putbuf (const uint8_t *buf, size_t n) {
+	enum intr_level old_level = intr_disable ();
+
+	if (mode != QUEUE) {
+		if (mode == UNINIT)
+			init_poll ();
+		while (n-- > 0)
+			putc_poll (*buf++);
+	} else {
+		while (n > 0) {
+			size_t k = intq_write (&txq, buf, n);
+
+			buf += k;
+			n -= k;
+			if (n > 0) {
+				/* The queue is full.  As in serial_putc().
+				   Otherwise make sure the queue drains while
+				   intq_putc() waits for room. */
+				if (old_level == INTR_OFF)
+					putc_poll (intq_getc (&txq));
+				else {
+					write_ier ();
+					intq_putc (&txq, *buf++);
+					n--;
+				}
+			}
+		}
+		write_ier ();
+	}
+
+	intr_set_level (old_level);
+}
+
 /* Flushes anything in the serial buffer out the port in polling
    mode. */
 void
@@ -183,14 +239,19 @@ write_ier (void) {
 }
 
 /* Polls the serial port until it's ready,
-   and then transmits BYTE. */
+   and then transmits BYTE.  Once THR is empty, the next
+   TX_FIFO_SIZE bytes go out without polling. */
 static void
 putc_poll (uint8_t byte) {
 	ASSERT (intr_get_level () == INTR_OFF);
 
-	while ((inb (LSR_REG) & LSR_THRE) == 0)
-		continue;
+	if (tx_room == 0) {
+		while ((inb (LSR_REG) & LSR_THRE) == 0)
+			continue;
+		tx_room = TX_FIFO_SIZE;
+	}
 	outb (THR_REG, byte);
+	tx_room--;
 }
 
 /* Serial interrupt handler. */
@@ -201,14 +262,31 @@ serial_interrupt (struct intr_frame *f UNUSED) {
 	inb (IIR_REG);
 
 	/* As long as we have room to receive a byte, and the hardware
-	   has a byte for us, receive a byte.  */
-	while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
-		input_putc (inb (RBR_REG));
+	   has a byte for us, receive a byte, a FIFO's worth at a time
+	   into the input buffer.  */
+	for (;;) {
+		uint8_t rx[RX_FIFO_SIZE];
+		size_t space = input_space (), n = 0;
+
+		while (n < space && n < RX_FIFO_SIZE
+				&& (inb (LSR_REG) & LSR_DR) != 0)
+			rx[n++] = inb (RBR_REG);
+		if (n == 0)
+			break;
+		input_putbuf (rx, n);
+		if (n < RX_FIFO_SIZE)
+			break;
+	}
 
 	/* As long as we have a byte to transmit, and the hardware is
-	   ready to accept a byte for transmission, transmit a byte. */
-	while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0)
-		outb (THR_REG, intq_getc (&txq));
+	   ready to accept bytes for transmission, fill its FIFO. */
+	if ((inb (LSR_REG) & LSR_THRE) != 0) {
+		tx_room = TX_FIFO_SIZE;
+		while (tx_room > 0 && !intq_empty (&txq)) {
+			outb (THR_REG, intq_getc (&txq));
+			tx_room--;
+		}
+	}
 
 	/* Update interrupt enable register based on queue status. */
 	write_ier ();
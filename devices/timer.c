@@ -2,13 +2,25 @@
 #include <debug.h>
 #include <inttypes.h>
 #include <round.h>
+#include <list.h>
 #include <stdio.h>
+#include "devices/lapic.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
 
-/* See [8254] for hardware details of the 8254 timer chip. */
+/* See [8254] for hardware details of the 8254 timer chip.
+
+   The 8254 PIT drives the tick at boot.  timer_calibrate() measures
+   the TSC and the local APIC timer against it, and with "-timer=apic"
+   then hands the tick to the local APIC timer.  That timer is
+   programmed one-shot, in TSC-deadline mode if the CPU has it, for
+   the earliest of the next tick and the earliest high-resolution
+   sleeper, so the periodic tick stays on a fixed TSC grid and
+   sub-tick sleeps need not busy-wait. */
 
 #if TIMER_FREQ < 19
 #error 8254 timer requires TIMER_FREQ >= 19
@@ -17,35 +29,130 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
+/* 8254 input frequency, and the PIT count for one timer tick
+   rounded to nearest. */
+#define PIT_FREQ 1193180
+#define PIT_TICK_COUNT ((PIT_FREQ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Longest idle period the 16-bit PIT counter can span, in ticks. */
+#define PIT_MAX_TICKS (0xffff / PIT_TICK_COUNT)
+
+/* Longest idle period the local APIC timer is armed for, in
+   ticks. */
+#define APIC_MAX_TICKS (10 * TIMER_FREQ)
+
+/* PIT ticks over which the TSC and local APIC timer are measured. */
+#define CALIBRATE_TICKS 4
+
+/* Sub-tick sleeps of fewer TSC cycles than a tick's worth divided
+   by this spin rather than block, since blocking costs more. */
+#define HR_SPIN_DIV 1000
+
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* If nonnull, gets a copy of TICKS each time it changes. */
+static volatile int64_t *ticks_mirror;
+
+/* Copies TICKS into the mirror.  Called wherever TICKS changes. */
+static inline void
+publish_ticks (void) {
+	if (ticks_mirror != NULL)
+		*ticks_mirror = ticks;
+}
+
+/* If true, stop the periodic tick while the CPU is idle.
+   Controlled by kernel command-line option "-tickless". */
+bool timer_tickless;
+
+/* If true, move the tick to the local APIC timer once calibrated.
+   Set by kernel command-line option "-timer=apic". */
+bool timer_use_apic;
+
+/* What drives the tick. */
+static enum timer_backend {
+	BACKEND_PIT,                /* 8254 PIT, periodic. */
+	BACKEND_APIC,               /* Local APIC timer, one-shot count. */
+	BACKEND_DEADLINE            /* Local APIC timer, TSC deadline. */
+} backend = BACKEND_PIT;
+
+/* TSC cycles and local APIC timer counts per tick, 0 until
+   calibrated. */
+static uint64_t tsc_per_tick;
+static uint64_t apic_per_tick;
+
+/* With the local APIC timer, the TSC at which the next periodic
+   interrupt is due, the TSC cycles between them, and, during a
+   tickless idle period, the TSC at which it ends. */
+static uint64_t next_event;
+static uint64_t event_period;
+static uint64_t tickless_deadline;
+
+/* A thread in a high-resolution sleep. */
+struct hr_sleeper {
+	uint64_t deadline;          /* TSC to wake up at. */
+	struct thread *thread;      /* The sleeper. */
+	struct list_elem elem;      /* Element in HR_SLEEPERS. */
+};
+
+/* Threads in high-resolution sleeps, soonest first. */
+static struct list hr_sleepers;
+
+/* Tickless idle state.  While TICKLESS_TICKS is nonzero the PIT is
+   programmed to fire once after TICKLESS_TICKS ticks instead of every
+   tick. */
+static int64_t tickless_ticks;
+
+/* PIT interrupts per timer tick, more than one only to take
+   profiling samples faster, and the PIT count for one of them.
+   SUBTICKS_LEFT counts down the interrupts to the next tick. */
+static int subticks = 1;
+static uint16_t subtick_count = PIT_TICK_COUNT;
+static int subticks_left = 1;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
 static intr_handler_func timer_interrupt;
+static intr_handler_func apic_timer_interrupt;
+static void calibrate_tsc (void);
+static void apic_start (void);
+static void apic_arm (void);
+static int64_t apic_advance (uint64_t now, bool *event);
+static void hr_sleep (uint64_t cycles);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
+static void pit_set_count (uint16_t count);
+static uint16_t pit_read_count (void);
+static intr_handler_func inspect_timer;
 
 /* Sets up the 8254 Programmable Interval Timer (PIT) to
    interrupt PIT_FREQ times per second, and registers the
    corresponding interrupt. */
 void
 timer_init (void) {
-	/* 8254 input frequency divided by TIMER_FREQ, rounded to
-	   nearest. */
-	uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
-
-	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
-	outb (0x40, count & 0xff);
-	outb (0x40, count >> 8);
+	pit_set_count (PIT_TICK_COUNT);
+	list_init (&hr_sleepers);
 
 	intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+	if (lapic_present ())
+		intr_register_ext (LAPIC_TIMER_VEC, apic_timer_interrupt,
+				"Local APIC Timer");
+
+	/* Timer inspection, via int 0x4a, for benchmarks.
+	   Input:
+	     @RDI - 0: TSC frequency in Hz, 0 until calibrated,
+	            1: timer ticks since boot.
+	   Output:
+	     @RAX - Requested value, or -1 if RDI is out of range. */
+	intr_register_int (0x4a, 3, INTR_OFF, inspect_timer, "Inspect Timer");
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Calibrates loops_per_tick, used to implement brief delays, and
+   the TSC, and then moves the tick to the local APIC timer if
+   there is one. */
 void
 timer_calibrate (void) {
 	unsigned high_bit, test_bit;
@@ -68,6 +175,11 @@ timer_calibrate (void) {
 			loops_per_tick |= test_bit;
 
 	printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+	calibrate_tsc ();
+	if (timer_use_apic && lapic_present () && tsc_per_tick != 0
+			&& (lapic_has_tsc_deadline () || apic_per_tick != 0))
+		apic_start ();
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -87,6 +199,39 @@ timer_elapsed (int64_t then) {
 	return timer_ticks () - then;
 }
 
+/* Answers the timer inspection interrupt. */
+static void
+inspect_timer (struct intr_frame *f) {
+	switch (f->R.rdi) {
+		case 0:
+			f->R.rax = timer_tsc_hz ();
+			break;
+		case 1:
+			f->R.rax = ticks;
+			break;
+		default:
+			f->R.rax = -1;
+			break;
+	}
+}
+
+/* Returns the TSC frequency in Hz, or 0 until timer_calibrate()
+   has measured it. */
+uint64_t
+timer_tsc_hz (void) {
+	return tsc_per_tick * TIMER_FREQ;
+}
+
+/* Makes the timer store the tick count into *MIRROR, now and
+   each time it changes, e.g. for user programs to read. */
+void
+timer_mirror_ticks (volatile int64_t *mirror) {
+	enum intr_level old_level = intr_disable ();
+	ticks_mirror = mirror;
+	*mirror = ticks;
+	intr_set_level (old_level);
+}
+
 /* Suspends execution for approximately TICKS timer ticks. */
 void
 timer_sleep (int64_t ticks) {
@@ -120,17 +265,337 @@ timer_nsleep (int64_t ns) {
 /* Prints timer statistics. */
 void
 timer_print_stats (void) {
-	printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+	printf ("Timer: %"PRId64" ticks", timer_ticks ());
+	if (backend == BACKEND_APIC)
+		printf (" from the local APIC timer");
+	else if (backend == BACKEND_DEADLINE)
+		printf (" from the local APIC timer in TSC-deadline mode");
+	printf ("\n");
+}
+
+/* Makes the timer interrupt about HZ times per second for the
+   profiler, rounded to a multiple of TIMER_FREQ from TIMER_FREQ up
+   to 1000, while keeping TIMER_FREQ ticks per second.  Returns the
+   rate chosen. */
+int
+timer_set_sample_rate (int hz) {
+	enum intr_level old_level;
+	int n = (hz + TIMER_FREQ / 2) / TIMER_FREQ;
+
+	if (n < 1)
+		n = 1;
+	if (n > 1000 / TIMER_FREQ)
+		n = 1000 / TIMER_FREQ;
+
+	old_level = intr_disable ();
+	subticks = subticks_left = n;
+	subtick_count = (PIT_FREQ + TIMER_FREQ * n / 2) / (TIMER_FREQ * n);
+	if (backend != BACKEND_PIT)
+		event_period = tsc_per_tick / n;
+	else if (tickless_ticks == 0)
+		pit_set_count (subtick_count);
+	intr_set_level (old_level);
+	return TIMER_FREQ * n;
 }
 
+/* Called by the idle thread, with interrupts off, right before it
+   halts the CPU.  If tickless idle is enabled, reprograms the timer
+   to fire at the next sleep deadline (or as late as the timer
+   allows) instead of on every tick. */
+void
+timer_idle_enter (void) {
+	int64_t deadline, n, max_ticks;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!timer_tickless || tickless_ticks != 0)
+		return;
+
+	max_ticks = backend == BACKEND_PIT ? PIT_MAX_TICKS : APIC_MAX_TICKS;
+	if (backend == BACKEND_APIC
+			&& (uint64_t) max_ticks > UINT32_MAX / apic_per_tick)
+		max_ticks = UINT32_MAX / apic_per_tick;
+
+	deadline = thread_next_wakeup ();
+	n = deadline == INT64_MAX ? max_ticks : deadline - ticks;
+	if (n <= 1)
+		return;
+	if (n > max_ticks)
+		n = max_ticks;
+
+	tickless_ticks = n;
+	if (backend == BACKEND_PIT)
+		pit_set_count (n * PIT_TICK_COUNT);
+	else {
+		/* The next tick is due SUBTICKS_LEFT events from now, and
+		   tick TICKS + N is N - 1 ticks after it. */
+		tickless_deadline = next_event + (subticks_left - 1) * event_period
+			+ (n - 1) * tsc_per_tick;
+		apic_arm ();
+	}
+}
+
+/* Called by the idle thread, with interrupts off, after the CPU was
+   woken up.  If an interrupt other than the timer ended a tickless
+   period early, credits the whole ticks that elapsed so far and
+   returns the timer to periodic mode.  With the PIT the partial
+   tick in progress is dropped. */
+void
+timer_idle_exit (void) {
+	int64_t elapsed;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (tickless_ticks == 0)
+		return;
+
+	if (backend == BACKEND_PIT) {
+		elapsed = (tickless_ticks * PIT_TICK_COUNT - pit_read_count ())
+			/ PIT_TICK_COUNT;
+		tickless_ticks = 0;
+		subticks_left = subticks;
+		pit_set_count (subtick_count);
+	} else {
+		/* The TSC grid keeps the partial tick. */
+		elapsed = apic_advance (rdtsc (), NULL);
+		tickless_ticks = 0;
+		apic_arm ();
+	}
+
+	ticks += elapsed;
+	publish_ticks ();
+	thread_idle_catch_up (elapsed);
+}
+
 /* Timer interrupt handler. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED) {
+timer_interrupt (struct intr_frame *args) {
+	if (profile_hz != 0)
+		profile_sample (args);
+
+	if (tickless_ticks != 0) {
+		/* End of a tickless idle period.  thread_tick() below
+		   accounts for the last of its ticks. */
+		ticks += tickless_ticks - 1;
+		thread_idle_catch_up (tickless_ticks - 1);
+		tickless_ticks = 0;
+		subticks_left = subticks;
+		pit_set_count (subtick_count);
+	} else if (--subticks_left > 0)
+		return;
+	subticks_left = subticks;
 	ticks++;
+	publish_ticks ();
 	thread_tick ();
 	thread_wakeup (timer_ticks());
 }
 
+/* Programs PIT counter 0 to interrupt every COUNT input cycles. */
+static void
+pit_set_count (uint16_t count) {
+	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
+	outb (0x40, count & 0xff);
+	outb (0x40, count >> 8);
+}
+
+/* Returns the number of input cycles left in PIT counter 0's
+   current period. */
+static uint16_t
+pit_read_count (void) {
+	uint8_t lo, hi;
+
+	outb (0x43, 0x00);    /* CW: latch counter 0. */
+	lo = inb (0x40);
+	hi = inb (0x40);
+	return ((uint16_t) hi << 8) | lo;
+}
+
+/* Measures TSC_PER_TICK, and APIC_PER_TICK if there is a local
+   APIC, over CALIBRATE_TICKS ticks of the PIT. */
+static void
+calibrate_tsc (void) {
+	enum intr_level old_level;
+	uint64_t tsc0;
+	uint32_t count0 = 0;
+	int64_t start;
+
+	if (lapic_present ()) {
+		lapic_timer_setup (false);
+		lapic_timer_oneshot (UINT32_MAX);
+	}
+
+	/* Wait for a timer tick. */
+	start = ticks;
+	while (ticks == start)
+		barrier ();
+
+	old_level = intr_disable ();
+	tsc0 = rdtsc ();
+	if (lapic_present ())
+		count0 = lapic_timer_count ();
+	intr_set_level (old_level);
+
+	start = ticks;
+	while (ticks - start < CALIBRATE_TICKS)
+		barrier ();
+
+	old_level = intr_disable ();
+	tsc_per_tick = (rdtsc () - tsc0) / CALIBRATE_TICKS;
+	if (lapic_present ()) {
+		apic_per_tick = (count0 - lapic_timer_count ()) / CALIBRATE_TICKS;
+		lapic_timer_oneshot (0);
+	}
+	intr_set_level (old_level);
+}
+
+/* Moves the tick from the PIT to the local APIC timer. */
+static void
+apic_start (void) {
+	enum intr_level old_level = intr_disable ();
+
+	backend = lapic_has_tsc_deadline () ? BACKEND_DEADLINE : BACKEND_APIC;
+	lapic_timer_setup (backend == BACKEND_DEADLINE);
+
+	/* Mask IRQ 0 on the master PIC. */
+	outb (0x21, inb (0x21) | 0x01);
+
+	event_period = tsc_per_tick / subticks;
+	subticks_left = subticks;
+	next_event = rdtsc () + event_period;
+	apic_arm ();
+	intr_set_level (old_level);
+}
+
+/* Arms the local APIC timer for the earliest of the next periodic
+   interrupt, or the end of the tickless idle period if one is
+   under way, and the earliest high-resolution sleeper's deadline.
+   Interrupts must be off. */
+static void
+apic_arm (void) {
+	uint64_t deadline = tickless_ticks != 0 ? tickless_deadline : next_event;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!list_empty (&hr_sleepers)) {
+		struct hr_sleeper *s = list_entry (list_front (&hr_sleepers),
+				struct hr_sleeper, elem);
+
+		if (s->deadline < deadline)
+			deadline = s->deadline;
+	}
+
+	if (backend == BACKEND_DEADLINE)
+		lapic_timer_deadline (deadline);
+	else {
+		uint64_t now = rdtsc ();
+		uint64_t count = deadline > now
+			? (deadline - now) * apic_per_tick / tsc_per_tick : 0;
+
+		lapic_timer_oneshot (count < 1 ? 1
+				: count > UINT32_MAX ? UINT32_MAX : count);
+	}
+}
+
+/* Moves NEXT_EVENT past NOW, one periodic interrupt's worth at a
+   time, and returns the number of ticks that passed meanwhile.
+   Sets *EVENT, if EVENT is nonnull, to whether any periodic
+   interrupt was due. */
+static int64_t
+apic_advance (uint64_t now, bool *event) {
+	int64_t elapsed = 0;
+
+	if (event != NULL)
+		*event = next_event <= now;
+	while (next_event <= now) {
+		next_event += event_period;
+		if (--subticks_left == 0) {
+			subticks_left = subticks;
+			elapsed++;
+		}
+	}
+	return elapsed;
+}
+
+/* Local APIC timer interrupt handler: takes the periodic ticks
+   that are due and wakes the high-resolution sleepers whose
+   deadlines have passed. */
+static void
+apic_timer_interrupt (struct intr_frame *args) {
+	uint64_t now = rdtsc ();
+	int64_t elapsed;
+	bool event;
+
+	elapsed = apic_advance (now, &event);
+	if (event && profile_hz != 0)
+		profile_sample (args);
+
+	if (elapsed > 0) {
+		/* Ticks other than the last, from the end of a tickless
+		   idle period or from interrupts held off for that long,
+		   are credited without thread_tick(). */
+		ticks += elapsed - 1;
+		if (tickless_ticks != 0) {
+			thread_idle_catch_up (elapsed - 1);
+			tickless_ticks = 0;
+		}
+		ticks++;
+		publish_ticks ();
+		thread_tick ();
+		thread_wakeup (ticks);
+	}
+
+	while (!list_empty (&hr_sleepers)) {
+		struct hr_sleeper *s = list_entry (list_front (&hr_sleepers),
+				struct hr_sleeper, elem);
+
+		if (s->deadline > now)
+			break;
+		list_pop_front (&hr_sleepers);
+		thread_unblock (s->thread);
+		if (s->thread->priority > thread_current ()->priority)
+			intr_yield_on_return ();
+	}
+
+	apic_arm ();
+}
+
+/* Orders high-resolution sleepers by deadline. */
+static bool
+hr_less (const struct list_elem *a_, const struct list_elem *b_,
+		void *aux UNUSED) {
+	const struct hr_sleeper *a = list_entry (a_, struct hr_sleeper, elem);
+	const struct hr_sleeper *b = list_entry (b_, struct hr_sleeper, elem);
+
+	return a->deadline < b->deadline;
+}
+
+/* Sleeps for CYCLES TSC cycles, less than a tick.  Blocks until the
+   local APIC timer wakes us if it drives the tick, interrupts are
+   on and the sleep is worth blocking for, and spins on the TSC
+   otherwise. */
+static void
+hr_sleep (uint64_t cycles) {
+	uint64_t deadline = rdtsc () + cycles;
+
+	if (backend != BACKEND_PIT && cycles >= tsc_per_tick / HR_SPIN_DIV
+			&& intr_get_level () == INTR_ON && !intr_context ()) {
+		struct hr_sleeper s;
+		enum intr_level old_level;
+
+		s.deadline = deadline;
+		s.thread = thread_current ();
+		old_level = intr_disable ();
+		list_insert_ordered (&hr_sleepers, &s.elem, hr_less, NULL);
+		apic_arm ();
+		thread_block ();
+		intr_set_level (old_level);
+		return;
+	}
+
+	while (rdtsc () < deadline)
+		asm volatile ("pause");
+}
+
 /* Returns true if LOOPS iterations waits for more than one timer
    tick, otherwise false. */
 static bool
@@ -179,8 +644,12 @@ real_time_sleep (int64_t num, int32_t denom) {
 		   timer_sleep() because it will yield the CPU to other
 		   processes. */
 		timer_sleep (ticks);
+	} else if (tsc_per_tick != 0) {
+		/* Otherwise, time the sub-tick delay with the TSC.  NUM/DENOM
+		   is less than a tick, so the product cannot overflow. */
+		hr_sleep (num * tsc_per_tick * TIMER_FREQ / denom);
 	} else {
-		/* Otherwise, use a busy-wait loop for more accurate
+		/* Before calibration, use a busy-wait loop for more accurate
 		   sub-tick timing.  We scale the numerator and denominator
 		   down by 1000 to avoid the possibility of overflow. */
 		ASSERT (denom % 1000 == 0);
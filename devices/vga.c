@@ -25,6 +25,7 @@ static size_t cx, cy;
    The attribute at (x,y) is fb[y][x][1]. */
 static uint8_t (*fb)[COL_CNT][2];
 
+static void put_char (int c);
 static void clear_row (size_t y);
 static void cls (void);
 static void newline (void);
@@ -52,7 +53,33 @@ vga_putc (int c) {
 	enum intr_level old_level = intr_disable ();
 
 	init ();
+	put_char (c);
 
+	/* Update cursor position. */
+	move_cursor ();
+
+	intr_set_level (old_level);
+}
+
+/* Writes the N characters in BUF to the VGA text display, as
+   vga_putc() would one at a time, but moving the hardware cursor,
+   which takes port writes, only once at the end. */
+void
+vga_putbuf (const char *buf, size_t n) {
+	enum intr_level old_level = intr_disable ();
+
+	init ();
+	while (n-- > 0)
+		put_char (*buf++);
+	move_cursor ();
+
+	intr_set_level (old_level);
+}
+
+/* Writes C to the framebuffer at the cursor and advances the
+   cursor, but not the hardware cursor. */
+static void
+put_char (int c) {
 	switch (c) {
 		case '\n':
 			newline ();
@@ -84,11 +111,6 @@ vga_putc (int c) {
 				newline ();
 			break;
 	}
-
-	/* Update cursor position. */
-	move_cursor ();
-
-	intr_set_level (old_level);
 }
 
 /* Clears the screen and moves the cursor to the upper left. */
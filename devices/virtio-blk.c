@@ -0,0 +1,305 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A driver for virtio block devices, through the legacy ("0.9.5")
+   PCI interface that QEMU's virtio-blk-pci offers as well as the
+   modern one.
+
+   Under QEMU each port access of ATA PIO is an exit to the host,
+   hundreds of them per sector.  A virtio device instead reads
+   requests from a queue in memory and moves the data itself, so a
+   request of any size costs one notification and one interrupt.
+
+   The queue is a split virtqueue: a table of descriptors of pieces
+   of memory, a ring in which the driver makes chains of them
+   available, and a ring in which the device returns them used.  A
+   request is one chain: a header with the operation and sector,
+   the data, and a status byte the device writes.  disk.c sends one
+   request at a time per device, from the thread of its channel,
+   which sleeps until the device interrupts. */
+
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001        /* Transitional virtio-blk. */
+
+/* Legacy interface registers, in the I/O space of BAR 0. */
+#define reg_features(V) ((V)->io_base + 0x00)       /* Device features. */
+#define reg_guest_features(V) ((V)->io_base + 0x04) /* Driver features. */
+#define reg_queue_pfn(V) ((V)->io_base + 0x08)      /* Queue page number. */
+#define reg_queue_size(V) ((V)->io_base + 0x0c)     /* Queue size (r/o). */
+#define reg_queue_select(V) ((V)->io_base + 0x0e)   /* Queue selector. */
+#define reg_queue_notify(V) ((V)->io_base + 0x10)   /* Queue notifier. */
+#define reg_status(V) ((V)->io_base + 0x12)         /* Device status. */
+#define reg_isr(V) ((V)->io_base + 0x13)            /* ISR status (r/o). */
+#define reg_capacity(V) ((V)->io_base + 0x14)       /* Sectors, 64 bits. */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01         /* Driver found the device. */
+#define STATUS_DRIVER 0x02              /* Driver can drive it. */
+#define STATUS_DRIVER_OK 0x04           /* Driver is ready. */
+#define STATUS_FAILED 0x80              /* Driver gave up. */
+
+/* ISR status bits.  Reading the register clears them. */
+#define ISR_QUEUE 0x01                  /* A queue was used. */
+
+/* Legacy queues are aligned, and the used ring within them, to
+   this. */
+#define QUEUE_ALIGN 4096
+
+/* A descriptor of a piece of memory. */
+struct vring_desc {
+	uint64_t addr;              /* Physical address. */
+	uint32_t len;               /* Length in bytes. */
+	uint16_t flags;             /* VRING_DESC_F_*. */
+	uint16_t next;              /* Next in chain, if VRING_DESC_F_NEXT. */
+};
+#define VRING_DESC_F_NEXT 0x1           /* Chain goes on in NEXT. */
+#define VRING_DESC_F_WRITE 0x2          /* Device writes, not reads. */
+
+/* Chains the driver offers the device. */
+struct vring_avail {
+	uint16_t flags;
+	uint16_t idx;               /* Where the next entry goes in RING. */
+	uint16_t ring[];            /* Heads of chains. */
+};
+
+/* Chains the device is done with. */
+struct vring_used_elem {
+	uint32_t id;                /* Head of the chain. */
+	uint32_t len;               /* Bytes written to it. */
+};
+struct vring_used {
+	uint16_t flags;
+	uint16_t idx;               /* Where the next entry goes in RING. */
+	struct vring_used_elem ring[];
+};
+
+/* Request header. */
+struct virtio_blk_hdr {
+	uint32_t type;              /* VIRTIO_BLK_T_*. */
+	uint32_t reserved;
+	uint64_t sector;            /* First sector. */
+};
+#define VIRTIO_BLK_T_IN 0               /* Read. */
+#define VIRTIO_BLK_T_OUT 1              /* Write. */
+
+/* Status the device writes after the data. */
+#define VIRTIO_BLK_S_OK 0
+
+/* A virtio block device. */
+struct virtio_blk {
+	int slot;                   /* PCI device number on bus 0. */
+	uint16_t io_base;           /* Base of the legacy registers. */
+	uint8_t irq;                /* Interrupt vector. */
+	disk_sector_t capacity;     /* Capacity in sectors. */
+
+	uint16_t queue_size;        /* Descriptors in the queue. */
+	size_t queue_pages;         /* Pages the queue takes. */
+	struct vring_desc *desc;    /* Descriptor table. */
+	struct vring_avail *avail;  /* Available ring. */
+	volatile struct vring_used *used;   /* Used ring. */
+	uint16_t used_idx;          /* Entries of USED seen. */
+
+	/* The request in flight. */
+	struct virtio_blk_hdr hdr;  /* Its header. */
+	volatile uint8_t status;    /* Its status. */
+	bool busy;                  /* True if one is in flight. */
+	struct semaphore done;      /* Up'd by the interrupt handler. */
+};
+
+/* Devices found, for the interrupt handler, which asks each on the
+   interrupt whether it was the one. */
+#define DEVICE_MAX 8
+static struct virtio_blk *devices[DEVICE_MAX];
+static size_t device_cnt;
+
+static bool setup_queue (struct virtio_blk *);
+static void interrupt_handler (struct intr_frame *);
+
+/* Looks for a virtio block device in PCI slot SLOT of bus 0 and,
+   if there is one, sets it up and returns it.  Returns a null
+   pointer if there is none or it cannot be set up. */
+struct virtio_blk *
+virtio_blk_probe (int slot) {
+	struct virtio_blk *v;
+	uint32_t bar, intr;
+	uint64_t capacity;
+	enum intr_level old_level;
+	bool shared = false;
+	size_t i;
+
+	if (pci_read_config (slot, 0, PCI_REG_ID)
+			!= (VIRTIO_BLK_DEVICE << 16 | VIRTIO_VENDOR))
+		return NULL;
+	bar = pci_read_config (slot, 0, PCI_REG_BAR0);
+	intr = pci_read_config (slot, 0, PCI_REG_INTR) & 0xff;
+	if (!(bar & 1) || (bar & 0xfffc) == 0 || intr >= 16
+			|| device_cnt >= DEVICE_MAX)
+		return NULL;
+
+	v = malloc (sizeof *v);
+	if (v == NULL)
+		return NULL;
+	v->slot = slot;
+	v->io_base = bar & 0xfffc;
+	v->irq = intr + 0x20;
+	v->busy = false;
+	sema_init (&v->done, 0);
+	pci_write_config (slot, 0, PCI_REG_COMMAND,
+			pci_read_config (slot, 0, PCI_REG_COMMAND)
+			| PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+
+	/* Reset the device, tell it we drive it, and take none of its
+	   optional features. */
+	outb (reg_status (v), 0);
+	outb (reg_status (v), STATUS_ACKNOWLEDGE);
+	outb (reg_status (v), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+	inl (reg_features (v));
+	outl (reg_guest_features (v), 0);
+	if (!setup_queue (v)) {
+		outb (reg_status (v), STATUS_FAILED);
+		free (v);
+		return NULL;
+	}
+
+	capacity = inl (reg_capacity (v))
+		| (uint64_t) inl (reg_capacity (v) + 4) << 32;
+	v->capacity = capacity < UINT32_MAX ? capacity : UINT32_MAX;
+
+	/* Devices may share an interrupt; its handler serves all. */
+	old_level = intr_disable ();
+	for (i = 0; i < device_cnt; i++)
+		if (devices[i]->irq == v->irq)
+			shared = true;
+	devices[device_cnt++] = v;
+	if (!shared)
+		intr_register_ext (v->irq, interrupt_handler, "virtio-blk");
+	intr_set_level (old_level);
+
+	outb (reg_status (v), STATUS_ACKNOWLEDGE | STATUS_DRIVER
+			| STATUS_DRIVER_OK);
+	return v;
+}
+
+/* Allocates queue 0 of V and hands it to the device.  Returns
+   false if the device has no such queue or memory is short. */
+static bool
+setup_queue (struct virtio_blk *v) {
+	size_t avail_end;
+	uint8_t *queue;
+
+	outw (reg_queue_select (v), 0);
+	v->queue_size = inw (reg_queue_size (v));
+	if (v->queue_size < 3)
+		return false;
+
+	/* The descriptors, then the available ring, then at the next
+	   QUEUE_ALIGN boundary the used ring, all in one physically
+	   contiguous piece. */
+	avail_end = sizeof (struct vring_desc) * v->queue_size
+		+ sizeof (struct vring_avail) + sizeof (uint16_t) * (v->queue_size + 1);
+	v->queue_pages = DIV_ROUND_UP (ROUND_UP (avail_end, QUEUE_ALIGN)
+			+ sizeof (struct vring_used)
+			+ sizeof (struct vring_used_elem) * v->queue_size
+			+ sizeof (uint16_t), PGSIZE);
+	queue = palloc_get_multiple (PAL_ZERO, v->queue_pages);
+	if (queue == NULL)
+		return false;
+
+	v->desc = (struct vring_desc *) queue;
+	v->avail = (struct vring_avail *) (queue + sizeof (struct vring_desc)
+			* v->queue_size);
+	v->used = (struct vring_used *) (queue + ROUND_UP (avail_end, QUEUE_ALIGN));
+	v->used_idx = 0;
+	outl (reg_queue_pfn (v), vtop (queue) / QUEUE_ALIGN);
+	return true;
+}
+
+/* Returns the size of V, measured in DISK_SECTOR_SIZE-byte
+   sectors. */
+disk_sector_t
+virtio_blk_capacity (const struct virtio_blk *v) {
+	return v->capacity;
+}
+
+/* Moves the sectors starting at SEC_NO between V and the SEG_CNT
+   pieces of memory in SEGS, to the disk if WRITE, and waits for the
+   device to finish.  SEG_CNT must be from 1 to VIRTIO_BLK_SEGS.
+   Only one thread may call this for V at a time.  Returns true if
+   successful, false if the device reports an error. */
+bool
+virtio_blk_transfer (struct virtio_blk *v, disk_sector_t sec_no,
+		const struct virtio_blk_seg *segs, size_t seg_cnt, bool write) {
+	size_t i;
+
+	ASSERT (seg_cnt > 0 && seg_cnt <= VIRTIO_BLK_SEGS);
+	ASSERT (intr_get_level () == INTR_ON);
+
+	/* Never more descriptors than the queue has. */
+	if (seg_cnt + 2 > v->queue_size)
+		PANIC ("virtio-blk %d: queue of %u too small for %zu pieces",
+				v->slot, (unsigned) v->queue_size, seg_cnt);
+
+	/* Chain: header, data, status. */
+	v->hdr.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+	v->hdr.reserved = 0;
+	v->hdr.sector = sec_no;
+	v->status = 0xff;
+	v->desc[0].addr = vtop (&v->hdr);
+	v->desc[0].len = sizeof v->hdr;
+	v->desc[0].flags = VRING_DESC_F_NEXT;
+	v->desc[0].next = 1;
+	for (i = 0; i < seg_cnt; i++) {
+		struct vring_desc *d = &v->desc[i + 1];
+
+		ASSERT (segs[i].length % DISK_SECTOR_SIZE == 0);
+		d->addr = segs[i].pa;
+		d->len = segs[i].length;
+		d->flags = VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE);
+		d->next = i + 2;
+	}
+	v->desc[seg_cnt + 1].addr = vtop (&v->status);
+	v->desc[seg_cnt + 1].len = sizeof v->status;
+	v->desc[seg_cnt + 1].flags = VRING_DESC_F_WRITE;
+	v->desc[seg_cnt + 1].next = 0;
+
+	/* The device must see the chain before the ring entry, and the
+	   entry before the index.  x86 keeps stores in order, so only
+	   the compiler needs to be stopped from moving them. */
+	v->avail->ring[v->avail->idx % v->queue_size] = 0;
+	barrier ();
+	v->busy = true;
+	v->avail->idx++;
+	barrier ();
+	outw (reg_queue_notify (v), 0);
+
+	/* The device interrupts once, when it is done. */
+	sema_down (&v->done);
+	v->used_idx++;
+	return v->status == VIRTIO_BLK_S_OK;
+}
+
+/* Virtio block interrupt handler. */
+static void
+interrupt_handler (struct intr_frame *f) {
+	size_t i;
+
+	for (i = 0; i < device_cnt; i++) {
+		struct virtio_blk *v = devices[i];
+
+		/* Reading the ISR acknowledges the interrupt. */
+		if (v->irq == f->vec_no && (inb (reg_isr (v)) & ISR_QUEUE)
+				&& v->busy && v->used->idx != v->used_idx) {
+			v->busy = false;
+			sema_up (&v->done);
+		}
+	}
+}
@@ -0,0 +1,721 @@
+/* cache.c: Write-back cache of file system sectors.
+ *
+ * Every read and write of the file system disk goes through
+ * CACHE_SIZE sector buffers, found by sector number in a hash
+ * table and replaced in clock order.  Dirty buffers are written
+ * back when they are replaced, by cache_flush() and by the flush
+ * daemon in page_cache.c, which runs once a second and also as
+ * soon as half of the cache is dirty.  Repeated writes to a sector
+ * only touch memory until then.
+ *
+ * Sectors that a reader is about to need are queued with
+ * cache_readahead() and read in by the worker daemon, which runs
+ * cache_work(), so that the reader only waits for the sector it
+ * needs now.
+ *
+ * Flushes and readahead submit all of their sectors to the disk at
+ * once, straight from and to the entries, and only then wait; the
+ * disk merges the requests for consecutive sectors.
+ *
+ * Metadata written while the journal is open is logged in a
+ * transaction, and its entry is neither replaced nor flushed until
+ * journal.c has committed the transaction and written the sector in
+ * place itself.
+ *
+ * Entries are for a sector of a mounted file system, and the cache
+ * follows each mount's policy: a mount at its quota of entries
+ * replaces one of its own, and only the sectors of write-behind
+ * mounts are written back by the flush daemon.
+ *
+ * A tmpfs holds its sectors in memory already, so they are read and
+ * written there in place, bypassing the cache.
+ *
+ * File data opened with O_DIRECT bypasses the cache too, moving
+ * straight between the disk and user pages; cache_bypass() keeps
+ * the cache coherent with such transfers.
+ *
+ * The cache counts its hits, misses and other events in STATS,
+ * which int 0x4b reports to user programs.
+ *
+ * CACHE_LOCK guards the table, the clock hand, STATS and each
+ * entry's sector, flags and pin count; an entry's own lock guards
+ * its data.  A pinned entry keeps its sector, so its lock can be
+ * waited for without holding CACHE_LOCK. */
+
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "filesys/mount.h"
+#include "filesys/tmpfs.h"
+#include "threads/interrupt.h"
+#include "threads/lock-stats.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of sectors cached: 64 kB, of which up to JOURNAL_LIMIT
+ * may be held by the running transaction. */
+#define CACHE_SIZE 128
+
+/* A cached sector. */
+struct cache_entry {
+	struct hash_elem elem;      /* Element in CACHE_MAP, if valid. */
+	struct mount *mnt;          /* File system of SECTOR. */
+	disk_sector_t sector;       /* Sector held. */
+	bool valid;                 /* Holds SECTOR? */
+	bool dirty;                 /* DATA newer than the disk? */
+	bool accessed;              /* Used since the clock hand passed? */
+	bool readahead;             /* Read ahead and not used since? */
+	unsigned pin_cnt;           /* Not to be replaced while nonzero. */
+	unsigned tx;                /* Uncommitted transaction, or 0. */
+	enum disk_source source;    /* Disk I/O accounted to, per last use. */
+	struct lock lock;           /* Guards DATA. */
+	uint8_t data[DISK_SECTOR_SIZE];
+};
+
+/* Dirty entries that make the worker daemon flush early. */
+#define DIRTY_HIGH (CACHE_SIZE / 2)
+
+/* Sectors of readahead that may be queued at once. */
+#define RA_QUEUE_SIZE 32
+
+/* Most consecutive queued sectors read ahead together. */
+#define RUN_MAX 8
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct hash cache_map;   /* Valid entries, keyed on mount, sector. */
+static size_t clock_hand;       /* Next entry the clock looks at. */
+static struct lock cache_lock;
+static size_t dirty_cnt;        /* Number of dirty entries. */
+static struct cache_stats stats;
+
+/* Work for the worker daemon, guarded by CACHE_LOCK.  WORK_SEMA
+ * counts queued sectors plus flush requests. */
+static disk_sector_t ra_queue[RA_QUEUE_SIZE]; /* Ring of sectors. */
+static struct mount *ra_mnt[RA_QUEUE_SIZE]; /* Their file systems. */
+static enum disk_source ra_source[RA_QUEUE_SIZE]; /* Their sources. */
+static size_t ra_head;          /* Index of the first queued sector. */
+static size_t ra_cnt;           /* Number of queued sectors. */
+static bool flush_pending;      /* cache_request_flush() called? */
+static struct semaphore work_sema;
+
+/* Disk requests.  FLUSH_LOCK serializes cache_flush() and guards
+ * FLUSH_REQS; RA_REQS is only used by the worker daemon. */
+static struct lock flush_lock;
+static struct disk_request flush_reqs[CACHE_SIZE];
+static struct disk_request ra_reqs[RUN_MAX];
+
+/* Returns a hash of the mount and sector of cache entry E. */
+static uint64_t
+entry_hash (const struct hash_elem *e_, void *aux UNUSED) {
+	const struct cache_entry *e = hash_entry (e_, struct cache_entry, elem);
+
+	return hash_u64 (e->sector ^ hash_u64 ((uintptr_t) e->mnt));
+}
+
+/* Returns true if cache entry A holds a lower sector than B, on
+ * the same mount, or is on a lower mount. */
+static bool
+entry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct cache_entry *a = hash_entry (a_, struct cache_entry, elem);
+	const struct cache_entry *b = hash_entry (b_, struct cache_entry, elem);
+
+	if (a->mnt != b->mnt)
+		return (uintptr_t) a->mnt < (uintptr_t) b->mnt;
+	return a->sector < b->sector;
+}
+
+static intr_handler_func inspect_cache;
+
+/* Initializes the sector cache. */
+void
+cache_init (void) {
+	size_t i;
+
+	lock_init (&cache_lock);
+	lock_set_name (&cache_lock, "buffer cache");
+	lock_init (&flush_lock);
+	sema_init (&work_sema, 0);
+	if (!hash_init (&cache_map, entry_hash, entry_less, NULL))
+		PANIC ("sector cache: out of memory");
+	for (i = 0; i < CACHE_SIZE; i++)
+		lock_init (&cache[i].lock);
+
+	/* Cache statistics, via int 0x4b.
+	   Input:
+	     @RDI - Index of a member of struct cache_stats: 0 for hits,
+	            1 misses, 2 evictions, 3 writebacks, 4 readahead
+	            hits, 5 wasted readahead.
+	   Output:
+	     @RAX - Its value, or -1 if RDI is out of range. */
+	intr_register_int (0x4b, 3, INTR_OFF, inspect_cache,
+			"Inspect Buffer Cache");
+}
+
+/* Returns the valid entry for SECTOR of MNT, or a null pointer if
+ * SECTOR is not cached.  CACHE_LOCK must be held. */
+static struct cache_entry *
+cache_find (struct mount *mnt, disk_sector_t sector) {
+	struct cache_entry key;
+	struct hash_elem *e;
+
+	key.mnt = mnt;
+	key.sector = sector;
+	e = hash_find (&cache_map, &key.elem);
+	return e != NULL ? hash_entry (e, struct cache_entry, elem) : NULL;
+}
+
+/* Advances the clock hand to an unpinned entry that has not been
+ * used since the hand last passed it and is not waiting for its
+ * transaction to commit, and returns that entry, or a null pointer
+ * if every entry is pinned.  If MNT, which needs an entry, holds
+ * its quota already, only its own entries are candidates.
+ * CACHE_LOCK must be held. */
+static struct cache_entry *
+cache_evict (struct mount *mnt) {
+	bool own = mnt->cache_cnt >= mnt->cache_quota;
+	size_t i;
+
+	/* Two sweeps: the first may only clear accessed bits. */
+	for (i = 0; i < 2 * CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[clock_hand];
+
+		clock_hand = (clock_hand + 1) % CACHE_SIZE;
+		if (e->pin_cnt > 0 || e->tx != 0
+				|| (own && (!e->valid || e->mnt != mnt)))
+			continue;
+		if (e->accessed)
+			e->accessed = false;
+		else
+			return e;
+	}
+	return NULL;
+}
+
+/* Writes entry E back to disk if it is dirty.  E's lock must be
+ * held. */
+static void
+cache_write_back (struct cache_entry *e) {
+	if (e->dirty) {
+		disk_write_from (e->mnt->disk, e->sector, 1, e->data, e->source);
+		lock_acquire (&cache_lock);
+		e->dirty = false;
+		dirty_cnt--;
+		stats.writebacks++;
+		lock_release (&cache_lock);
+	}
+}
+
+/* Lets go of entry E, returned by cache_get(). */
+static void
+cache_put (struct cache_entry *e) {
+	lock_release (&e->lock);
+	lock_acquire (&cache_lock);
+	e->pin_cnt--;
+	lock_release (&cache_lock);
+}
+
+/* Returns the entry for SECTOR of MNT, pinned and with its lock
+ * held.  If SECTOR was not cached, the entry's data is left for
+ * the caller to fill and *FRESH is set to true.  Unless USE is
+ * false because the sector is only read ahead, the entry is marked
+ * used.  Its disk I/O is accounted to SOURCE from now on. */
+static struct cache_entry *
+cache_claim (struct mount *mnt, disk_sector_t sector, bool use,
+		enum disk_source source, bool *fresh) {
+	struct cache_entry *e;
+
+	for (;;) {
+		lock_acquire (&cache_lock);
+		e = cache_find (mnt, sector);
+		if (e != NULL) {
+			e->pin_cnt++;
+			e->accessed |= use;
+			if (use) {
+				e->source = source;
+				stats.hits++;
+				if (e->readahead) {
+					e->readahead = false;
+					stats.ra_hits++;
+				}
+			}
+			lock_release (&cache_lock);
+			lock_acquire (&e->lock);
+			*fresh = false;
+			return e;
+		}
+
+		e = cache_evict (mnt);
+		if (e == NULL) {
+			/* Every entry is in use.  Wait for one to be put. */
+			lock_release (&cache_lock);
+			thread_yield ();
+			continue;
+		}
+		if (!e->valid || !e->dirty)
+			break;
+
+		/* Write the victim back while it still answers for its
+		 * sector, so that nobody reads the sector from disk
+		 * meanwhile, then look again. */
+		e->pin_cnt++;
+		lock_release (&cache_lock);
+		lock_acquire (&e->lock);
+		cache_write_back (e);
+		cache_put (e);
+	}
+
+	/* E is clean and unpinned, so its lock is free. */
+	if (e->valid) {
+		hash_delete (&cache_map, &e->elem);
+		e->mnt->cache_cnt--;
+		stats.evictions++;
+		if (e->readahead)
+			stats.ra_wasted++;
+	}
+	if (use)
+		stats.misses++;
+	e->mnt = mnt;
+	mnt->cache_cnt++;
+	e->sector = sector;
+	e->valid = true;
+	e->dirty = false;
+	e->accessed = use;
+	e->readahead = !use;
+	e->source = source;
+	e->pin_cnt = 1;
+	e->tx = 0;
+	hash_insert (&cache_map, &e->elem);
+	lock_acquire (&e->lock);
+	lock_release (&cache_lock);
+	*fresh = true;
+	return e;
+}
+
+/* Returns the entry for SECTOR of MNT, as cache_claim().  If
+ * SECTOR is not cached, it is read in, unless FILL is false
+ * because the caller is about to overwrite all of it. */
+static struct cache_entry *
+cache_get (struct mount *mnt, disk_sector_t sector, bool fill, bool use,
+		enum disk_source source) {
+	bool fresh;
+	struct cache_entry *e = cache_claim (mnt, sector, use, source, &fresh);
+
+	if (fresh && fill) {
+		disk_read_from (mnt->disk, sector, 1, e->data, source);
+		thread_current ()->rusage.ru_inblock++;
+	}
+	return e;
+}
+
+/* Reads SIZE bytes at offset OFS of SECTOR of MNT into BUFFER,
+ * accounting any disk I/O for SECTOR to SOURCE. */
+void
+cache_read (struct mount *mnt, disk_sector_t sector, void *buffer, int ofs,
+		int size, enum disk_source source) {
+	struct cache_entry *e;
+
+	ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	if (mnt->tmpfs != NULL) {
+		tmpfs_read (mnt->tmpfs, sector, buffer, ofs, size);
+		return;
+	}
+	e = cache_get (mnt, sector, true, true, source);
+	memcpy (buffer, e->data + ofs, size);
+	cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS of SECTOR of MNT,
+ * accounting any disk I/O for SECTOR to SOURCE.  The sector reaches
+ * the disk when it is replaced or flushed, or, if it is metadata
+ * that the journal logs, when its transaction commits. */
+void
+cache_write (struct mount *mnt, disk_sector_t sector, const void *buffer,
+		int ofs, int size, enum disk_source source) {
+	struct cache_entry *e;
+	unsigned tx;
+
+	ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	if (mnt->tmpfs != NULL) {
+		tmpfs_write (mnt->tmpfs, sector, buffer, ofs, size);
+		return;
+	}
+	e = cache_get (mnt, sector, size < DISK_SECTOR_SIZE, true, source);
+	memcpy (e->data + ofs, buffer, size);
+	tx = mnt->journaled
+		&& (source == DISK_SRC_META || source == DISK_SRC_FAT)
+		? journal_log (sector, e->tx) : e->tx;
+	if (!e->dirty || tx != e->tx) {
+		bool wake = false;
+
+		lock_acquire (&cache_lock);
+		if (!e->dirty) {
+			e->dirty = true;
+			wake = ++dirty_cnt == DIRTY_HIGH;
+			thread_current ()->rusage.ru_oublock++;
+		}
+		e->tx = tx;
+		lock_release (&cache_lock);
+		if (wake)
+			cache_request_flush ();
+	}
+	cache_put (e);
+}
+
+/* Returns true if entry E holds one of the CNT sectors of MNT from
+ * SECTOR.  CACHE_LOCK must be held. */
+static bool
+entry_in (const struct cache_entry *e, struct mount *mnt,
+		disk_sector_t sector, size_t cnt) {
+	return e->valid && e->mnt == mnt && e->sector >= sector
+		&& e->sector - sector < cnt;
+}
+
+/* Readies the CNT sectors of MNT from SECTOR, file data, to be
+ * moved straight between the disk and memory without the cache.
+ * Before reading them from disk, writes back those cached dirty.
+ * Before writing them, which the caller must keep anyone else from
+ * doing meanwhile, forgets them, cached or queued for readahead,
+ * dirty or not, since the write leaves them stale. */
+void
+cache_bypass (struct mount *mnt, disk_sector_t sector, size_t cnt,
+		bool write) {
+	size_t i, j;
+
+	ASSERT (mnt->tmpfs == NULL);
+
+	lock_acquire (&cache_lock);
+	if (write) {
+		/* As in cache_drop(). */
+		for (i = j = 0; i < ra_cnt; i++) {
+			size_t from = (ra_head + i) % RA_QUEUE_SIZE;
+			size_t to = (ra_head + j) % RA_QUEUE_SIZE;
+
+			if (ra_mnt[from] == mnt && ra_queue[from] >= sector
+					&& ra_queue[from] - sector < cnt)
+				continue;
+			ra_queue[to] = ra_queue[from];
+			ra_mnt[to] = ra_mnt[from];
+			ra_source[to] = ra_source[from];
+			j++;
+		}
+		ra_cnt = j;
+	}
+
+	for (i = 0; i < CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[i];
+
+		while (entry_in (e, mnt, sector, cnt)
+				&& (write ? e->pin_cnt > 0 : e->dirty)) {
+			if (e->pin_cnt > 0 && write) {
+				/* In use or being read ahead; wait for it. */
+				lock_release (&cache_lock);
+				thread_yield ();
+			} else {
+				e->pin_cnt++;
+				lock_release (&cache_lock);
+				lock_acquire (&e->lock);
+				cache_write_back (e);
+				cache_put (e);
+			}
+			lock_acquire (&cache_lock);
+		}
+		if (write && entry_in (e, mnt, sector, cnt)) {
+			ASSERT (e->tx == 0);
+			if (e->dirty)
+				dirty_cnt--;
+			if (e->readahead)
+				stats.ra_wasted++;
+			hash_delete (&cache_map, &e->elem);
+			e->valid = false;
+			e->dirty = false;
+			e->mnt = NULL;
+			mnt->cache_cnt--;
+		}
+	}
+	lock_release (&cache_lock);
+}
+
+/* Marks SECTOR of the root file system clean if it is cached and
+ * was last logged in transaction TX, which journal.c has just
+ * written in place. */
+void
+cache_clean (disk_sector_t sector, unsigned tx) {
+	struct cache_entry *e;
+
+	lock_acquire (&cache_lock);
+	e = cache_find (root_mount, sector);
+	if (e == NULL) {
+		lock_release (&cache_lock);
+		return;
+	}
+	e->pin_cnt++;
+	lock_release (&cache_lock);
+
+	/* A writer holding the lock may be about to log it again. */
+	lock_acquire (&e->lock);
+	lock_acquire (&cache_lock);
+	if (e->tx == tx) {
+		e->tx = 0;
+		if (e->dirty) {
+			e->dirty = false;
+			dirty_cnt--;
+		}
+	}
+	lock_release (&cache_lock);
+	cache_put (e);
+}
+
+/* Writes every dirty sector of MNT back to disk, or if MNT is null
+ * those of every write-behind mount, in order of sector number to
+ * keep the disk heads moving one way, except for those waiting for
+ * their transaction to commit. */
+void
+cache_flush (struct mount *mnt) {
+	struct cache_entry *dirty[CACHE_SIZE];
+	size_t cnt = 0, i, j;
+
+	/* Pin the dirty entries, insertion sorted by sector.  Only
+	 * cache_flush() writes back pinned entries, so they stay dirty
+	 * until then. */
+	lock_acquire (&flush_lock);
+	lock_acquire (&cache_lock);
+	for (i = 0; i < CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[i];
+
+		if (!e->valid || !e->dirty || e->tx != 0
+				|| (mnt != NULL ? e->mnt != mnt : !e->mnt->write_behind))
+			continue;
+		e->pin_cnt++;
+		for (j = cnt++; j > 0 && dirty[j - 1]->sector > e->sector; j--)
+			dirty[j] = dirty[j - 1];
+		dirty[j] = e;
+	}
+	lock_release (&cache_lock);
+
+	for (i = 0; i < cnt; i++) {
+		lock_acquire (&dirty[i]->lock);
+		disk_request_init (&flush_reqs[i], dirty[i]->mnt->disk,
+				dirty[i]->sector, 1, dirty[i]->data, true);
+		flush_reqs[i].source = dirty[i]->source;
+		disk_submit (&flush_reqs[i]);
+	}
+	for (i = 0; i < cnt; i++)
+		disk_wait (&flush_reqs[i]);
+
+	lock_acquire (&cache_lock);
+	for (i = 0; i < cnt; i++)
+		dirty[i]->dirty = false;
+	dirty_cnt -= cnt;
+	stats.writebacks += cnt;
+	lock_release (&cache_lock);
+	for (i = 0; i < cnt; i++)
+		cache_put (dirty[i]);
+	lock_release (&flush_lock);
+}
+
+/* Queues SECTOR of MNT to be read in by the worker daemon,
+ * accounted to SOURCE, unless it is cached or queued already.
+ * Readahead is only a hint: it is dropped if the queue is full. */
+void
+cache_readahead (struct mount *mnt, disk_sector_t sector,
+		enum disk_source source) {
+	size_t i, tail;
+
+	if (mnt->tmpfs != NULL)
+		return;
+	lock_acquire (&cache_lock);
+	if (ra_cnt == RA_QUEUE_SIZE || cache_find (mnt, sector) != NULL) {
+		lock_release (&cache_lock);
+		return;
+	}
+	for (i = 0; i < ra_cnt; i++) {
+		size_t idx = (ra_head + i) % RA_QUEUE_SIZE;
+
+		if (ra_queue[idx] == sector && ra_mnt[idx] == mnt) {
+			lock_release (&cache_lock);
+			return;
+		}
+	}
+	tail = (ra_head + ra_cnt++) % RA_QUEUE_SIZE;
+	ra_queue[tail] = sector;
+	ra_mnt[tail] = mnt;
+	ra_source[tail] = source;
+	lock_release (&cache_lock);
+	sema_up (&work_sema);
+}
+
+/* Asks the worker daemon to write every dirty sector back. */
+void
+cache_request_flush (void) {
+	lock_acquire (&cache_lock);
+	flush_pending = true;
+	lock_release (&cache_lock);
+	sema_up (&work_sema);
+}
+
+/* Reads in the N sectors of MNT starting at SECTOR that are not
+ * cached yet, for SOURCE, leaving them unused. */
+static void
+cache_read_run (struct mount *mnt, disk_sector_t sector, size_t n,
+		enum disk_source source) {
+	struct cache_entry *run[RUN_MAX];
+	size_t cnt = 0, i;
+
+	ASSERT (n <= RUN_MAX);
+
+	for (i = 0; i < n; i++) {
+		bool fresh;
+		struct cache_entry *e = cache_claim (mnt, sector + i, false, source,
+				&fresh);
+
+		if (!fresh) {
+			cache_put (e);
+			continue;
+		}
+		disk_request_init (&ra_reqs[cnt], mnt->disk, e->sector, 1,
+				e->data, false);
+		ra_reqs[cnt].source = source;
+		disk_submit (&ra_reqs[cnt]);
+		run[cnt++] = e;
+	}
+	for (i = 0; i < cnt; i++) {
+		disk_wait (&ra_reqs[i]);
+		cache_put (run[i]);
+	}
+}
+
+/* Waits for a queued sector or flush request and carries it out.
+ * Queued sectors that follow on from the first are read in along
+ * with it.  Run over and over by the worker daemon. */
+void
+cache_work (void) {
+	struct mount *mnt;
+	disk_sector_t sector;
+	enum disk_source source;
+	size_t n = 1;
+	bool flush;
+
+	sema_down (&work_sema);
+	lock_acquire (&cache_lock);
+	flush = flush_pending;
+	flush_pending = false;
+	if (!flush) {
+		/* Each queued sector went with one sema_up(), so there is
+		 * one, unless the flush request was taken by an earlier
+		 * call. */
+		if (ra_cnt == 0) {
+			lock_release (&cache_lock);
+			return;
+		}
+		sector = ra_queue[ra_head];
+		mnt = ra_mnt[ra_head];
+		source = ra_source[ra_head];
+		ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+		ra_cnt--;
+		while (n < RUN_MAX && ra_cnt > 0
+				&& ra_queue[ra_head] == sector + n && ra_mnt[ra_head] == mnt) {
+			ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+			ra_cnt--;
+			n++;
+		}
+	}
+	lock_release (&cache_lock);
+
+	if (flush)
+		cache_flush (NULL);
+	else {
+		/* Those sema_up()s are taken now too. */
+		size_t i;
+
+		for (i = 1; i < n; i++)
+			sema_down (&work_sema);
+		cache_read_run (mnt, sector, n, source);
+	}
+}
+
+/* Writes back the dirty sectors of MNT, which is being unmounted
+ * and no longer used, and forgets all of its sectors, cached or
+ * queued for readahead. */
+void
+cache_drop (struct mount *mnt) {
+	size_t i, j;
+
+	cache_flush (mnt);
+	lock_acquire (&cache_lock);
+
+	/* Queued sectors keep their sema_up()s, which cache_work()
+	 * takes as spurious. */
+	for (i = j = 0; i < ra_cnt; i++) {
+		size_t from = (ra_head + i) % RA_QUEUE_SIZE;
+		size_t to = (ra_head + j) % RA_QUEUE_SIZE;
+
+		if (ra_mnt[from] == mnt)
+			continue;
+		ra_queue[to] = ra_queue[from];
+		ra_mnt[to] = ra_mnt[from];
+		ra_source[to] = ra_source[from];
+		j++;
+	}
+	ra_cnt = j;
+
+	for (i = 0; i < CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[i];
+
+		/* The worker daemon may be reading it ahead. */
+		while (e->valid && e->mnt == mnt && e->pin_cnt > 0) {
+			lock_release (&cache_lock);
+			thread_yield ();
+			lock_acquire (&cache_lock);
+		}
+		if (e->valid && e->mnt == mnt) {
+			ASSERT (!e->dirty);
+			if (e->readahead)
+				stats.ra_wasted++;
+			hash_delete (&cache_map, &e->elem);
+			e->valid = false;
+			e->mnt = NULL;
+			mnt->cache_cnt--;
+		}
+	}
+	lock_release (&cache_lock);
+}
+
+/* Copies the cache's statistics into *S. */
+void
+cache_get_stats (struct cache_stats *s) {
+	lock_acquire (&cache_lock);
+	*s = stats;
+	lock_release (&cache_lock);
+}
+
+/* Prints the cache's statistics. */
+void
+cache_print_stats (void) {
+	struct cache_stats s;
+
+	cache_get_stats (&s);
+	printf ("Cache: %llu hits, %llu misses, %llu evictions, "
+			"%llu writebacks\n", s.hits, s.misses, s.evictions, s.writebacks);
+	printf ("Cache: %llu sectors read ahead used, %llu wasted\n",
+			s.ra_hits, s.ra_wasted);
+}
+
+/* Answers the cache inspection interrupt. */
+static void
+inspect_cache (struct intr_frame *f) {
+	const uint64_t *counters = (const uint64_t *) &stats;
+
+	/* CACHE_LOCK cannot be taken here, but each counter is read
+	 * whole. */
+	if (f->R.rdi < sizeof stats / sizeof *counters)
+		f->R.rax = counters[f->R.rdi];
+	else
+		f->R.rax = -1;
+}
@@ -0,0 +1,248 @@
+/* dcache.c: Cache of directory entries.
+ *
+ * Maps a directory's file system and inode sector and a name in it
+ * to the inode sector the name refers to, or records that the name
+ * is not there, so that resolving a name does not search the directory
+ * on disk again.  Sector 0 holds the free map and never is a
+ * file's inode, so it marks the negative entries.
+ *
+ * Callers hold the directory's lock as they do for the directory
+ * itself: for reading to look up and record what they found, for
+ * writing to record a change.  An entry for a directory thus always
+ * agrees with it.
+ *
+ * The same entries also map the inode sector of a symbolic link,
+ * under the empty name, which no directory entry has, to the inode
+ * sector its chain of links ends at.  Such an entry depends on
+ * every directory the chain passes through, so any change to any
+ * directory bumps LINK_GEN and makes all of them stale. */
+
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdint.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/lock-stats.h"
+#include "threads/synch.h"
+
+/* Number of names cached. */
+#define DCACHE_SIZE 128
+
+/* A cached name. */
+struct dentry {
+	struct hash_elem elem;      /* Element in DENTRIES, if used. */
+	struct list_elem lru_elem;  /* Element in LRU. */
+	struct mount *mnt;          /* File system of the directory. */
+	disk_sector_t dir;          /* Directory's inode sector. */
+	char name[NAME_MAX + 1];    /* Name in the directory. */
+	disk_sector_t sector;       /* Inode sector, or 0 if absent. */
+	unsigned gen;               /* LINK_GEN when resolved, for a link. */
+	bool used;                  /* In DENTRIES? */
+};
+
+static struct dentry dentry_pool[DCACHE_SIZE];
+static struct hash dentries;    /* Used dentries, on (mnt, dir, name). */
+static struct list lru;         /* All dentries, most recent first. */
+static struct lock dcache_lock; /* Guards all of the above. */
+static unsigned link_gen;       /* Bumped by every directory change. */
+
+/* Returns a hash of the directory and name of dentry E. */
+static uint64_t
+dentry_hash (const struct hash_elem *e_, void *aux UNUSED) {
+	const struct dentry *e = hash_entry (e_, struct dentry, elem);
+
+	return hash_str (e->name,
+			hash_u64 (e->dir ^ hash_u64 ((uintptr_t) e->mnt)));
+}
+
+/* Returns true if dentry A orders before B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct dentry *a = hash_entry (a_, struct dentry, elem);
+	const struct dentry *b = hash_entry (b_, struct dentry, elem);
+
+	if (a->mnt != b->mnt)
+		return (uintptr_t) a->mnt < (uintptr_t) b->mnt;
+	if (a->dir != b->dir)
+		return a->dir < b->dir;
+	return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the dentry cache. */
+void
+dcache_init (void) {
+	size_t i;
+
+	lock_init (&dcache_lock);
+	lock_set_name (&dcache_lock, "dcache");
+	list_init (&lru);
+	if (!hash_init (&dentries, dentry_hash, dentry_less, NULL))
+		PANIC ("dentry cache: out of memory");
+	for (i = 0; i < DCACHE_SIZE; i++)
+		list_push_back (&lru, &dentry_pool[i].lru_elem);
+}
+
+static void dentry_insert (struct mount *, disk_sector_t dir,
+		const char *name, disk_sector_t sector, unsigned gen);
+
+/* Returns the used dentry for NAME in DIR of MNT, or a null
+ * pointer.  DCACHE_LOCK must be held. */
+static struct dentry *
+dentry_find (struct mount *mnt, disk_sector_t dir, const char *name) {
+	struct dentry key;
+	struct hash_elem *e;
+
+	if (strlen (name) > NAME_MAX)
+		return NULL;
+	key.mnt = mnt;
+	key.dir = dir;
+	strlcpy (key.name, name, sizeof key.name);
+	e = hash_find (&dentries, &key.elem);
+	return e != NULL ? hash_entry (e, struct dentry, elem) : NULL;
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR of
+ * MNT.  On a hit, stores the sector of NAME's inode into
+ * *SECTOR. */
+enum dcache_result
+dcache_lookup (struct mount *mnt, disk_sector_t dir, const char *name,
+		disk_sector_t *sector) {
+	enum dcache_result result = DCACHE_MISS;
+	struct dentry *e;
+
+	lock_acquire (&dcache_lock);
+	e = dentry_find (mnt, dir, name);
+	if (e != NULL && *name == '\0' && e->gen != link_gen)
+		e = NULL;
+	if (e != NULL) {
+		list_remove (&e->lru_elem);
+		list_push_front (&lru, &e->lru_elem);
+		if (e->sector != 0) {
+			*sector = e->sector;
+			result = DCACHE_HIT;
+		} else
+			result = DCACHE_NEGATIVE;
+	}
+	lock_release (&dcache_lock);
+	return result;
+}
+
+/* Records that NAME in the directory whose inode is in sector DIR
+ * of MNT refers to the inode in SECTOR, or is not there if SECTOR
+ * is 0.  The least recently used name makes room.  A change, made
+ * with the directory's lock held for writing, also makes the
+ * resolved links stale. */
+void
+dcache_insert (struct mount *mnt, disk_sector_t dir, const char *name,
+		disk_sector_t sector) {
+	lock_acquire (&dcache_lock);
+	link_gen++;
+	lock_release (&dcache_lock);
+	dentry_insert (mnt, dir, name, sector, 0);
+}
+
+/* Records that NAME in the directory whose inode is in sector DIR
+ * of MNT was found to refer to the inode in SECTOR, or not to be
+ * there if SECTOR is 0, by a lookup. */
+void
+dcache_found (struct mount *mnt, disk_sector_t dir, const char *name,
+		disk_sector_t sector) {
+	dentry_insert (mnt, dir, name, sector, 0);
+}
+
+/* Looks up the symbolic link whose inode is in sector LINK of MNT.
+ * On a hit, stores the sector of the inode its chain of links ends
+ * at into *SECTOR. */
+enum dcache_result
+dcache_lookup_link (struct mount *mnt, disk_sector_t link,
+		disk_sector_t *sector) {
+	return dcache_lookup (mnt, link, "", sector);
+}
+
+/* Returns the generation to pass to dcache_insert_link() for a
+ * link about to be resolved. */
+unsigned
+dcache_link_gen (void) {
+	return link_gen;
+}
+
+/* Records that the chain of symbolic links from the inode in sector
+ * LINK of MNT ends at the inode in SECTOR, or leads nowhere if
+ * SECTOR is 0, as resolved from the directories as of generation
+ * GEN. */
+void
+dcache_insert_link (struct mount *mnt, disk_sector_t link,
+		disk_sector_t sector, unsigned gen) {
+	dentry_insert (mnt, link, "", sector, gen);
+}
+
+/* Makes the dentry for NAME in DIR of MNT refer to SECTOR, tagged
+ * with GEN. */
+static void
+dentry_insert (struct mount *mnt, disk_sector_t dir, const char *name,
+		disk_sector_t sector, unsigned gen) {
+	struct dentry *e;
+
+	if (strlen (name) > NAME_MAX)
+		return;
+
+	lock_acquire (&dcache_lock);
+	e = dentry_find (mnt, dir, name);
+	if (e == NULL) {
+		e = list_entry (list_back (&lru), struct dentry, lru_elem);
+		if (e->used)
+			hash_delete (&dentries, &e->elem);
+		e->mnt = mnt;
+		e->dir = dir;
+		strlcpy (e->name, name, sizeof e->name);
+		e->used = true;
+		hash_insert (&dentries, &e->elem);
+	}
+	e->sector = sector;
+	e->gen = gen;
+	list_remove (&e->lru_elem);
+	list_push_front (&lru, &e->lru_elem);
+	lock_release (&dcache_lock);
+}
+
+/* Forgets every name in the directory whose inode is in sector DIR
+ * of MNT, because a new directory is being created there. */
+void
+dcache_purge (struct mount *mnt, disk_sector_t dir) {
+	size_t i;
+
+	lock_acquire (&dcache_lock);
+	for (i = 0; i < DCACHE_SIZE; i++) {
+		struct dentry *e = &dentry_pool[i];
+
+		if (e->used && e->mnt == mnt && e->dir == dir) {
+			hash_delete (&dentries, &e->elem);
+			e->used = false;
+			list_remove (&e->lru_elem);
+			list_push_back (&lru, &e->lru_elem);
+		}
+	}
+	lock_release (&dcache_lock);
+}
+
+/* Forgets every name on MNT, which is being unmounted. */
+void
+dcache_drop (struct mount *mnt) {
+	size_t i;
+
+	lock_acquire (&dcache_lock);
+	for (i = 0; i < DCACHE_SIZE; i++) {
+		struct dentry *e = &dentry_pool[i];
+
+		if (e->used && e->mnt == mnt) {
+			hash_delete (&dentries, &e->elem);
+			e->used = false;
+			list_remove (&e->lru_elem);
+			list_push_back (&lru, &e->lru_elem);
+		}
+	}
+	lock_release (&dcache_lock);
+}
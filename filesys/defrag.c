@@ -0,0 +1,157 @@
+/* defrag.c: Online defragmenter.
+ *
+ * A kernel thread at the lowest priority walks the directory tree
+ * of the root file system every DEFRAG_INTERVAL ticks and moves
+ * each file whose data lies in more than one place on disk into
+ * one run of free sectors, by inode_defrag(), so that reading it
+ * through is one sweep rather than a seek per extent.
+ *
+ * It keeps out of the way of foreground I/O: before each file, and
+ * before each chunk of sectors it copies, it waits until the disk
+ * has been idle for DEFRAG_IDLE ticks, which only the requests of
+ * others count against, as its own are accounted to
+ * DISK_SRC_DEFRAG.
+ *
+ * Files keep their data in extents allocated from the free map.
+ * The FAT, under EFILESYS, holds no file's clusters, so there are
+ * no cluster chains to move, and the defragmenter is not started
+ * there. */
+
+#include "filesys/defrag.h"
+#include <debug.h>
+#include <stdio.h>
+#include "devices/disk.h"
+#include "devices/timer.h"
+#include "filesys/directory.h"
+#include "filesys/inode.h"
+#include "filesys/mount.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Ticks between two passes over the file system. */
+#define DEFRAG_INTERVAL (5 * TIMER_FREQ)
+
+/* Ticks the disk must have been idle for before each step. */
+#define DEFRAG_IDLE (TIMER_FREQ / 10)
+
+/* Deepest directory the walk descends into. */
+#define DEFRAG_DEPTH 16
+
+bool defrag_enabled;
+
+/* Held by the daemon while it moves a file, and for good by
+ * defrag_done(), so that no file is being moved once the file
+ * system shuts down. */
+static struct lock defrag_lock;
+static bool stopping;
+
+/* Statistics. */
+static long long pass_cnt;              /* Passes over the tree. */
+static long long file_cnt;              /* Files looked at. */
+static long long moved_cnt;             /* Files moved. */
+static long long sector_cnt;            /* Sectors moved. */
+
+static void defrag_daemon (void *aux);
+
+/* Starts the defragmenter, if "-defrag" was given. */
+void
+defrag_init (void) {
+	lock_init (&defrag_lock);
+	if (defrag_enabled
+			&& thread_create ("kdefragd", PRI_MIN, defrag_daemon, NULL)
+			== TID_ERROR)
+		PANIC ("defragmenter creation failed");
+}
+
+/* Stops the defragmenter, waiting for the file it is moving, if
+ * any, as the file system shuts down. */
+void
+defrag_done (void) {
+	stopping = true;
+	lock_acquire (&defrag_lock);
+}
+
+/* Waits until the disk of MNT has been idle for a while, before a
+ * step of moving a file.  Returns false, for the move to be given
+ * up, if the defragmenter is being stopped. */
+bool
+defrag_throttle (struct mount *mnt) {
+	while (!stopping && !disk_idle (mnt->disk, DEFRAG_IDLE))
+		timer_sleep (DEFRAG_IDLE);
+	return !stopping;
+}
+
+/* Moves INODE into one run, if it is a fragmented file, unless the
+ * defragmenter is being stopped. */
+static void
+defrag_file (struct inode *inode) {
+	size_t moved;
+
+	if (!defrag_throttle (root_mount))
+		return;
+	lock_acquire (&defrag_lock);
+	if (!stopping) {
+		file_cnt++;
+		moved = inode_defrag (inode);
+		if (moved > 0) {
+			moved_cnt++;
+			sector_cnt += moved;
+		}
+	}
+	lock_release (&defrag_lock);
+}
+
+/* Walks the directory tree of the root file system, depth first,
+ * moving each fragmented file found. */
+static void
+defrag_pass (void) {
+	struct dir *stack[DEFRAG_DEPTH];
+	char name[NAME_MAX + 1];
+	size_t depth = 0;
+
+	stack[0] = dir_open_root ();
+	if (stack[0] != NULL)
+		depth = 1;
+	while (depth > 0) {
+		struct dir *dir = stack[depth - 1];
+		struct inode *inode;
+
+		if (stopping || !dir_readdir (dir, name)) {
+			dir_close (dir);
+			depth--;
+			continue;
+		}
+		if (!dir_lookup (dir, name, &inode) || inode == NULL)
+			continue;
+		if (inode_is_dir (inode)) {
+			if (depth < DEFRAG_DEPTH) {
+				stack[depth] = dir_open (inode);
+				if (stack[depth] != NULL)
+					depth++;
+			} else
+				inode_close (inode);
+			continue;
+		}
+		defrag_file (inode);
+		inode_close (inode);
+	}
+	pass_cnt++;
+}
+
+/* The defragmenter's thread. */
+static void
+defrag_daemon (void *aux UNUSED) {
+	while (!stopping) {
+		timer_sleep (DEFRAG_INTERVAL);
+		defrag_pass ();
+	}
+}
+
+/* Prints defragmenter statistics. */
+void
+defrag_print_stats (void) {
+	if (!defrag_enabled)
+		return;
+	printf ("Defrag: %lld passes, %lld files checked, %lld moved, "
+			"%lld sectors\n", pass_cnt, file_cnt, moved_cnt, sector_cnt);
+}
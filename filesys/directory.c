@@ -1,10 +1,15 @@
 #include "filesys/directory.h"
+#include <hash.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/mount.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir {
@@ -19,11 +24,46 @@ struct dir_entry {
 	bool in_use;                        /* In use or free? */
 };
 
+/* Directories with this many slots or more get a hashed index.
+ * Smaller ones are searched linearly.
+ *
+ * The index is a hash table of slot numbers, kept in an inode of
+ * its own that inode_get_index() returns: a struct index_header,
+ * then BUCKET_CNT buckets, each the number of a slot plus one,
+ * BUCKET_EMPTY or BUCKET_DEAD.  Free slots of an indexed directory
+ * are chained through their inode_sector members, from FREE_HEAD,
+ * so adding an entry does not scan for one either.  Any failure to
+ * keep the index up to date drops it, falling back to the linear
+ * format, which the entries themselves always are. */
+#define DIR_INDEX_MIN 32
+
+#define INDEX_MAGIC 0x44494458          /* "DIDX". */
+#define BUCKET_EMPTY 0                  /* Never used. */
+#define BUCKET_DEAD UINT32_MAX          /* Held an entry since removed. */
+
+/* Start of a directory index. */
+struct index_header {
+	uint32_t magic;                     /* INDEX_MAGIC. */
+	uint32_t bucket_cnt;                /* Buckets, a power of 2. */
+	uint32_t load;                      /* Buckets not BUCKET_EMPTY. */
+	uint32_t free_head;                 /* First free slot plus 1, or 0. */
+};
+
+/* An open directory index. */
+struct dir_index {
+	struct inode *inode;                /* Index inode. */
+	struct index_header h;              /* Its header. */
+};
+
 /* Creates a directory with space for ENTRY_CNT entries in the
- * given SECTOR.  Returns true if successful, false on failure. */
+ * given SECTOR of file system MNT.  Returns true if successful,
+ * false on failure. */
 bool
-dir_create (disk_sector_t sector, size_t entry_cnt) {
-	return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+dir_create (struct mount *mnt, disk_sector_t sector, size_t entry_cnt) {
+	/* Names cached for an earlier directory there are stale. */
+	dcache_purge (mnt, sector);
+	return inode_create (mnt, sector, entry_cnt * sizeof (struct dir_entry),
+			INODE_TYPE_DIR);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -32,6 +72,7 @@ struct dir *
 dir_open (struct inode *inode) {
 	struct dir *dir = calloc (1, sizeof *dir);
 	if (inode != NULL && dir != NULL) {
+		inode_set_meta (inode);
 		dir->inode = inode;
 		dir->pos = 0;
 		return dir;
@@ -42,11 +83,26 @@ dir_open (struct inode *inode) {
 	}
 }
 
-/* Opens the root directory and returns a directory for it.
+/* Opens the root directory of the root file system and returns a
+ * directory for it.
  * Return true if successful, false on failure. */
 struct dir *
 dir_open_root (void) {
-	return dir_open (inode_open (ROOT_DIR_SECTOR));
+	return dir_open_mount (root_mount);
+}
+
+/* Opens the root directory of file system MNT and returns a
+ * directory for it.
+ * Return true if successful, false on failure. */
+struct dir *
+dir_open_mount (struct mount *mnt) {
+	return dir_open (inode_open (mnt, ROOT_DIR_SECTOR));
+}
+
+/* Returns the file system DIR is on. */
+static struct mount *
+dir_mount (const struct dir *dir) {
+	return inode_get_mount (dir->inode);
 }
 
 /* Opens and returns a new directory for the same inode as DIR.
@@ -71,6 +127,203 @@ dir_get_inode (struct dir *dir) {
 	return dir->inode;
 }
 
+/* Each directory's entries are guarded by the lock returned by
+ * inode_dir_lock() for its inode.  Lookups and listings hold it for
+ * reading and so proceed in parallel; adding and removing entries
+ * hold it for writing.  Different directories never contend. */
+
+/* Returns the hash of file name NAME. */
+static uint32_t
+name_hash (const char *name) {
+	return hash_string (name);
+}
+
+/* Opens the index of DIR into *INDEX.  Returns false if DIR has
+ * none or it cannot be read. */
+static bool
+index_open (const struct dir *dir, struct dir_index *index) {
+	disk_sector_t sector = inode_get_index (dir->inode);
+
+	if (sector == 0)
+		return false;
+	index->inode = inode_open (dir_mount (dir), sector);
+	if (index->inode == NULL)
+		return false;
+	inode_set_meta (index->inode);
+	if (inode_read_at (index->inode, &index->h, sizeof index->h, 0)
+				!= sizeof index->h
+			|| index->h.magic != INDEX_MAGIC) {
+		inode_close (index->inode);
+		return false;
+	}
+	return true;
+}
+
+/* Reads bucket B of INDEX into *VALUE. */
+static bool
+bucket_read (struct dir_index *index, uint32_t b, uint32_t *value) {
+	off_t ofs = sizeof index->h + b * sizeof *value;
+
+	return inode_read_at (index->inode, value, sizeof *value, ofs)
+		== sizeof *value;
+}
+
+/* Writes VALUE to bucket B of INDEX. */
+static bool
+bucket_write (struct dir_index *index, uint32_t b, uint32_t value) {
+	off_t ofs = sizeof index->h + b * sizeof value;
+
+	return inode_write_at (index->inode, &value, sizeof value, ofs)
+		== sizeof value;
+}
+
+/* Writes the header of INDEX. */
+static bool
+index_write_header (struct dir_index *index) {
+	return inode_write_at (index->inode, &index->h, sizeof index->h, 0)
+		== sizeof index->h;
+}
+
+/* Looks NAME up in INDEX of DIR, as lookup() does.  Sets *BUCKETP
+ * to the bucket of the entry if found, or otherwise to the bucket
+ * where NAME would be inserted.  Returns false if NAME is not in
+ * DIR, or if the index could not be read, in which case *BUCKETP
+ * is UINT32_MAX. */
+static bool
+index_find (struct dir_index *index, const struct dir *dir,
+		const char *name, struct dir_entry *ep, off_t *ofsp,
+		uint32_t *bucketp) {
+	uint32_t mask = index->h.bucket_cnt - 1;
+	uint32_t b = name_hash (name) & mask, dead = UINT32_MAX, i;
+
+	*bucketp = UINT32_MAX;
+	for (i = 0; i < index->h.bucket_cnt; i++, b = (b + 1) & mask) {
+		struct dir_entry e;
+		uint32_t value;
+		off_t ofs;
+
+		if (!bucket_read (index, b, &value))
+			return false;
+		if (value == BUCKET_EMPTY) {
+			*bucketp = dead != UINT32_MAX ? dead : b;
+			return false;
+		}
+		if (value == BUCKET_DEAD) {
+			if (dead == UINT32_MAX)
+				dead = b;
+			continue;
+		}
+		ofs = (off_t) (value - 1) * sizeof e;
+		if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+			return false;
+		if (e.in_use && !strcmp (name, e.name)) {
+			if (ep != NULL)
+				*ep = e;
+			if (ofsp != NULL)
+				*ofsp = ofs;
+			*bucketp = b;
+			return true;
+		}
+	}
+	*bucketp = dead;
+	return false;
+}
+
+/* Removes the index of DIR, which is searched linearly from now
+ * on. */
+static void
+index_drop (struct dir *dir) {
+	disk_sector_t sector = inode_get_index (dir->inode);
+	struct inode *inode;
+
+	if (sector == 0)
+		return;
+	inode_set_index (dir->inode, 0);
+	inode = inode_open (dir_mount (dir), sector);
+	if (inode != NULL) {
+		inode_remove (inode);
+		inode_close (inode);
+	}
+}
+
+/* Builds the index of DIR afresh from its entries, with room for
+ * twice as many entries as DIR has slots, creating the index inode
+ * if DIR has none yet.  On failure DIR is left without an
+ * index. */
+static void
+index_build (struct dir *dir) {
+	size_t slot_cnt = inode_length (dir->inode) / sizeof (struct dir_entry);
+	struct dir_index index;
+	disk_sector_t sector = inode_get_index (dir->inode);
+	uint32_t *buckets, mask, bucket_cnt = 64;
+	off_t size;
+	size_t slot;
+
+	while (bucket_cnt < 2 * slot_cnt)
+		bucket_cnt *= 2;
+	mask = bucket_cnt - 1;
+	buckets = calloc (bucket_cnt, sizeof *buckets);
+	if (buckets == NULL)
+		goto fail;
+
+	index.h.magic = INDEX_MAGIC;
+	index.h.bucket_cnt = bucket_cnt;
+	index.h.load = 0;
+	index.h.free_head = 0;
+
+	/* Hash the entries in use and chain the free slots, last first,
+	 * so that the lowest free slot is used first. */
+	for (slot = slot_cnt; slot-- > 0; ) {
+		struct dir_entry e;
+		off_t ofs = slot * sizeof e;
+
+		if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+			goto fail;
+		if (e.in_use) {
+			uint32_t b = name_hash (e.name) & mask;
+
+			while (buckets[b] != BUCKET_EMPTY)
+				b = (b + 1) & mask;
+			buckets[b] = slot + 1;
+			index.h.load++;
+		} else {
+			e.inode_sector = index.h.free_head;
+			index.h.free_head = slot + 1;
+			if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+				goto fail;
+		}
+	}
+
+	if (sector == 0) {
+		if (!free_map_allocate_near (dir_mount (dir), 1,
+					inode_get_inumber (dir->inode), &sector))
+			goto fail;
+		if (!inode_create (dir_mount (dir), sector, 0, INODE_TYPE_FILE)) {
+			free_map_release (dir_mount (dir), sector, 1);
+			goto fail;
+		}
+		inode_set_index (dir->inode, sector);
+	}
+	index.inode = inode_open (dir_mount (dir), sector);
+	if (index.inode == NULL)
+		goto fail;
+	inode_set_meta (index.inode);
+	size = bucket_cnt * sizeof *buckets;
+	if (!index_write_header (&index)
+			|| inode_write_at (index.inode, buckets, size, sizeof index.h)
+				!= size) {
+		inode_close (index.inode);
+		goto fail;
+	}
+	inode_close (index.inode);
+	free (buckets);
+	return;
+
+fail:
+	free (buckets);
+	index_drop (dir);
+}
+
 /* Searches DIR for a file with the given NAME.
  * If successful, returns true, sets *EP to the directory entry
  * if EP is non-null, and sets *OFSP to the byte offset of the
@@ -79,12 +332,23 @@ dir_get_inode (struct dir *dir) {
 static bool
 lookup (const struct dir *dir, const char *name,
 		struct dir_entry *ep, off_t *ofsp) {
+	struct dir_index index;
 	struct dir_entry e;
 	size_t ofs;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
+	if (index_open (dir, &index)) {
+		uint32_t b;
+		bool found = index_find (&index, dir, name, ep, ofsp, &b);
+
+		inode_close (index.inode);
+		if (found || b != UINT32_MAX)
+			return found;
+		/* The index could not be read: search linearly. */
+	}
+
 	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 			ofs += sizeof e)
 		if (e.in_use && !strcmp (name, e.name)) {
@@ -105,18 +369,83 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
 		struct inode **inode) {
 	struct dir_entry e;
+	disk_sector_t sector;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
-	if (lookup (dir, name, &e, NULL))
-		*inode = inode_open (e.inode_sector);
-	else
-		*inode = NULL;
+	rwlock_acquire_read (inode_dir_lock (dir->inode));
+	switch (dcache_lookup (dir_mount (dir), inode_get_inumber (dir->inode),
+				name, &sector)) {
+		case DCACHE_HIT:
+			*inode = inode_open (dir_mount (dir), sector);
+			break;
+		case DCACHE_NEGATIVE:
+			*inode = NULL;
+			break;
+		case DCACHE_MISS:
+			if (lookup (dir, name, &e, NULL)) {
+				*inode = inode_open (dir_mount (dir), e.inode_sector);
+				sector = e.inode_sector;
+			} else {
+				*inode = NULL;
+				sector = 0;
+			}
+			dcache_found (dir_mount (dir), inode_get_inumber (dir->inode), name,
+					sector);
+			break;
+	}
+	rwlock_release_read (inode_dir_lock (dir->inode));
 
 	return *inode != NULL;
 }
 
+/* Adds NAME for INODE_SECTOR to DIR through its INDEX, as
+ * dir_add() does.  Sets *FULL if the index should be rebuilt
+ * larger, or from scratch because it could not be updated. */
+static bool
+index_add (struct dir_index *index, struct dir *dir, const char *name,
+		disk_sector_t inode_sector, bool *full) {
+	struct dir_entry e;
+	uint32_t b, old, slot;
+	off_t ofs;
+
+	if (index_find (index, dir, name, NULL, NULL, &b))
+		return false;
+	if (b == UINT32_MAX || !bucket_read (index, b, &old)) {
+		*full = true;
+		return false;
+	}
+
+	/* Take the first free slot, or a new one at end of file. */
+	if (index->h.free_head != 0) {
+		slot = index->h.free_head - 1;
+		if (inode_read_at (dir->inode, &e, sizeof e, slot * sizeof e)
+				!= sizeof e) {
+			*full = true;
+			return false;
+		}
+		index->h.free_head = e.inode_sector;
+	} else
+		slot = inode_length (dir->inode) / sizeof e;
+
+	ofs = (off_t) slot * sizeof e;
+	e.in_use = true;
+	strlcpy (e.name, name, sizeof e.name);
+	e.inode_sector = inode_sector;
+	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) {
+		*full = true;
+		return false;
+	}
+	if (old == BUCKET_EMPTY)
+		index->h.load++;
+	if (!bucket_write (index, b, slot + 1) || !index_write_header (index))
+		*full = true;
+	else if (index->h.load * 4 >= index->h.bucket_cnt * 3)
+		*full = true;
+	return true;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
  * file by that name.  The file's inode is in sector
  * INODE_SECTOR.
@@ -125,9 +454,10 @@ dir_lookup (const struct dir *dir, const char *name,
  * error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
+	struct dir_index index;
 	struct dir_entry e;
 	off_t ofs;
-	bool success = false;
+	bool success = false, full = false;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
@@ -136,6 +466,17 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	if (*name == '\0' || strlen (name) > NAME_MAX)
 		return false;
 
+	rwlock_acquire_write (inode_dir_lock (dir->inode));
+
+	if (index_open (dir, &index)) {
+		success = index_add (&index, dir, name, inode_sector, &full);
+		inode_close (index.inode);
+		if (full)
+			index_build (dir);
+		goto done;
+	}
+	index_drop (dir);
+
 	/* Check that NAME is not in use. */
 	if (lookup (dir, name, NULL, NULL))
 		goto done;
@@ -158,7 +499,16 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	e.inode_sector = inode_sector;
 	success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
+	/* Index the directory once it is large. */
+	if (success
+			&& inode_length (dir->inode) / sizeof e >= DIR_INDEX_MIN)
+		index_build (dir);
+
 done:
+	if (success)
+		dcache_insert (dir_mount (dir), inode_get_inumber (dir->inode), name,
+				inode_sector);
+	rwlock_release_write (inode_dir_lock (dir->inode));
 	return success;
 }
 
@@ -167,50 +517,146 @@ done:
  * which occurs only if there is no file with the given NAME. */
 bool
 dir_remove (struct dir *dir, const char *name) {
+	struct dir_index index;
 	struct dir_entry e;
 	struct inode *inode = NULL;
-	bool success = false;
+	bool success = false, indexed;
 	off_t ofs;
+	uint32_t b;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
+	rwlock_acquire_write (inode_dir_lock (dir->inode));
+
 	/* Find directory entry. */
-	if (!lookup (dir, name, &e, &ofs))
-		goto done;
+	indexed = index_open (dir, &index);
+	if (indexed && !index_find (&index, dir, name, &e, &ofs, &b)) {
+		if (b != UINT32_MAX)
+			goto done;
+		/* The index could not be read. */
+		inode_close (index.inode);
+		indexed = false;
+	}
+	if (!indexed) {
+		index_drop (dir);
+		if (!lookup (dir, name, &e, &ofs))
+			goto done;
+	}
 
 	/* Open inode. */
-	inode = inode_open (e.inode_sector);
+	inode = inode_open (dir_mount (dir), e.inode_sector);
 	if (inode == NULL)
 		goto done;
 
-	/* Erase directory entry. */
+	/* Erase directory entry, and chain its slot as free. */
 	e.in_use = false;
+	if (indexed)
+		e.inode_sector = index.h.free_head;
 	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
 		goto done;
+	if (indexed) {
+		index.h.free_head = ofs / sizeof e + 1;
+		if (!bucket_write (&index, b, BUCKET_DEAD)
+				|| !index_write_header (&index)) {
+			inode_close (index.inode);
+			indexed = false;
+			index_build (dir);
+		}
+	}
 
 	/* Remove inode. */
 	inode_remove (inode);
+	dcache_insert (dir_mount (dir), inode_get_inumber (dir->inode), name, 0);
 	success = true;
 
 done:
+	if (indexed)
+		inode_close (index.inode);
+	rwlock_release_write (inode_dir_lock (dir->inode));
 	inode_close (inode);
 	return success;
 }
 
+/* Entries that a scan of a directory reads at a time: a sector's
+ * worth. */
+#define SCAN_ENTRIES (DISK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* Queues the inodes of the entries in use among the CNT in ENTS of
+ * DIR to be read ahead, as a program that lists a directory tends
+ * to go on to open or stat everything listed. */
+static void
+prefetch_inodes (struct dir *dir, const struct dir_entry *ents, size_t cnt) {
+	size_t i;
+
+	for (i = 0; i < cnt; i++)
+		if (ents[i].in_use)
+			inode_prefetch (dir_mount (dir), ents[i].inode_sector);
+}
+
 /* Reads the next directory entry in DIR and stores the name in
  * NAME.  Returns true if successful, false if the directory
- * contains no more entries. */
+ * contains no more entries.  The inodes of the entries are read
+ * ahead as the scan reaches them, SCAN_ENTRIES at a time. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
 	struct dir_entry e;
+	bool found = false;
 
-	while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
+	rwlock_acquire_read (inode_dir_lock (dir->inode));
+	for (;;) {
+		if (dir->pos % (SCAN_ENTRIES * sizeof e) == 0) {
+			struct dir_entry ents[SCAN_ENTRIES];
+
+			prefetch_inodes (dir, ents,
+					inode_read_at (dir->inode, ents, sizeof ents, dir->pos)
+					/ sizeof e);
+		}
+		if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+			break;
 		dir->pos += sizeof e;
 		if (e.in_use) {
 			strlcpy (name, e.name, NAME_MAX + 1);
-			return true;
+			found = true;
+			break;
 		}
 	}
-	return false;
+	rwlock_release_read (inode_dir_lock (dir->inode));
+	return found;
+}
+
+/* Stores the entries in use of DIR from byte *POS on into ENTS, at
+ * most CNT of them, and advances *POS past the last one stored.
+ * The entries are read a sector's worth at a time, and their
+ * inodes read ahead.  Returns the number of entries stored, 0 at
+ * the end of DIR. */
+size_t
+dir_read_entries (struct dir *dir, off_t *pos, struct dirent *ents,
+		size_t cnt) {
+	struct dir_entry buf[SCAN_ENTRIES];
+	size_t stored = 0;
+
+	ASSERT (NAME_MAX <= DIRENT_NAME_MAX);
+
+	rwlock_acquire_read (inode_dir_lock (dir->inode));
+	while (stored < cnt) {
+		off_t n = inode_read_at (dir->inode, buf, sizeof buf, *pos)
+			/ sizeof *buf;
+		off_t i;
+
+		if (n == 0)
+			break;
+		prefetch_inodes (dir, buf, n);
+		for (i = 0; i < n && stored < cnt; i++) {
+			*pos += sizeof *buf;
+			if (buf[i].in_use) {
+				ents[stored].d_ino = buf[i].inode_sector;
+				strlcpy (ents[stored].d_name, buf[i].name,
+						sizeof ents[stored].d_name);
+				stored++;
+			}
+		}
+	}
+	rwlock_release_read (inode_dir_lock (dir->inode));
+	return stored;
 }
@@ -1,8 +1,12 @@
 #include "filesys/fat.h"
 #include "devices/disk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "filesys/mount.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/vmalloc.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -14,6 +18,9 @@ struct fat_boot {
 	unsigned int fat_start;
 	unsigned int fat_sectors; /* Size of FAT in sectors. */
 	unsigned int root_dir_cluster;
+	unsigned int journal_start; /* First sector of the journal. */
+	unsigned int journal_sectors; /* Size of the journal, 0 if none. */
+	unsigned int fat_valid_sectors; /* FAT sectors written, 0 if all. */
 };
 
 /* FAT FS */
@@ -22,8 +29,9 @@ struct fat_fs {
 	unsigned int *fat;
 	unsigned int fat_length;
 	disk_sector_t data_start;
+	unsigned int valid_sectors; /* FAT sectors below the high-water mark. */
 	cluster_t last_clst;
-	struct lock write_lock;
+	struct lock write_lock;     /* Guards cluster allocation. */
 };
 
 static struct fat_fs *fat_fs;
@@ -36,14 +44,11 @@ fat_init (void) {
 	fat_fs = calloc (1, sizeof (struct fat_fs));
 	if (fat_fs == NULL)
 		PANIC ("FAT init failed");
+	lock_init (&fat_fs->write_lock);
 
 	// Read boot sector from the disk
-	unsigned int *bounce = malloc (DISK_SECTOR_SIZE);
-	if (bounce == NULL)
-		PANIC ("FAT init failed");
-	disk_read (filesys_disk, FAT_BOOT_SECTOR, bounce);
-	memcpy (&fat_fs->bs, bounce, sizeof (fat_fs->bs));
-	free (bounce);
+	cache_read (root_mount, FAT_BOOT_SECTOR, &fat_fs->bs, 0,
+			sizeof (fat_fs->bs), DISK_SRC_FAT);
 
 	// Extract FAT info
 	if (fat_fs->bs.magic != FAT_MAGIC)
@@ -53,63 +58,73 @@ fat_init (void) {
 
 void
 fat_open (void) {
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
+	fat_fs->fat = vcalloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT load failed");
 
-	// Load FAT directly from the disk
+	// Finish the last commit before the FAT is read
+	if (fat_fs->bs.journal_sectors >= JOURNAL_SECTORS)
+		journal_open (fat_fs->bs.journal_start);
+
+	// Load FAT directly from the disk.  The sectors past the
+	// high-water mark were never written and hold only free entries,
+	// the zeros vcalloc() left.
 	uint8_t *buffer = (uint8_t *) fat_fs->fat;
 	off_t bytes_read = 0;
 	off_t bytes_left = sizeof (fat_fs->fat);
 	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
+	for (unsigned i = 0; i < fat_fs->valid_sectors; i++) {
 		bytes_left = fat_size_in_bytes - bytes_read;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i,
-			           buffer + bytes_read);
-			bytes_read += DISK_SECTOR_SIZE;
-		} else {
-			uint8_t *bounce = malloc (DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT load failed");
-			disk_read (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			memcpy (buffer + bytes_read, bounce, bytes_left);
-			bytes_read += bytes_left;
-			free (bounce);
-		}
+		if (bytes_left <= 0)
+			break;
+		if (bytes_left > DISK_SECTOR_SIZE)
+			bytes_left = DISK_SECTOR_SIZE;
+		cache_read (root_mount, fat_fs->bs.fat_start + i,
+				buffer + bytes_read, 0, bytes_left, DISK_SRC_FAT);
+		bytes_read += bytes_left;
 	}
 }
 
 void
 fat_close (void) {
-	// Write FAT boot sector
-	uint8_t *bounce = calloc (1, DISK_SECTOR_SIZE);
-	if (bounce == NULL)
-		PANIC ("FAT close failed");
-	memcpy (bounce, &fat_fs->bs, sizeof (fat_fs->bs));
-	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
-	free (bounce);
-
-	// Write FAT directly to the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
+	static uint8_t zeros[DISK_SECTOR_SIZE];
 	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
-		}
+	cluster_t last;
+	unsigned int used;
+
+	// Raise the high-water mark over the last sector with an entry
+	// in use.  The sectors past it were never written and read as
+	// free, so they need not be written now.
+	for (last = fat_fs->fat_length - 1; last > 0; last--)
+		if (fat_fs->fat[last] != 0)
+			break;
+	used = last * sizeof (cluster_t) / DISK_SECTOR_SIZE + 1;
+	if (used > fat_fs->valid_sectors)
+		fat_fs->valid_sectors = used;
+	fat_fs->bs.fat_valid_sectors = fat_fs->valid_sectors;
+
+	// Write FAT boot sector
+	cache_write (root_mount, FAT_BOOT_SECTOR, zeros, 0, DISK_SECTOR_SIZE,
+			DISK_SRC_FAT);
+	cache_write (root_mount, FAT_BOOT_SECTOR, &fat_fs->bs, 0,
+			sizeof (fat_fs->bs), DISK_SRC_FAT);
+
+	// Write the FAT below the mark.  The part of the last sector past
+	// the table is zeros.
+	for (unsigned i = 0; i < fat_fs->valid_sectors; i++) {
+		off_t ofs = (off_t) i * DISK_SECTOR_SIZE;
+		off_t bytes_left = fat_size_in_bytes - ofs;
+
+		if (bytes_left <= 0)
+			bytes_left = 0;
+		else if (bytes_left > DISK_SECTOR_SIZE)
+			bytes_left = DISK_SECTOR_SIZE;
+		if (bytes_left < DISK_SECTOR_SIZE)
+			cache_write (root_mount, fat_fs->bs.fat_start + i, zeros, 0,
+					DISK_SECTOR_SIZE, DISK_SRC_FAT);
+		if (bytes_left > 0)
+			cache_write (root_mount, fat_fs->bs.fat_start + i,
+					(uint8_t *) fat_fs->fat + ofs, 0, bytes_left, DISK_SRC_FAT);
 	}
 }
 
@@ -118,21 +133,24 @@ fat_create (void) {
 	// Create FAT boot
 	fat_boot_create ();
 	fat_fs_init ();
+	journal_create (fat_fs->bs.journal_start);
 
-	// Create FAT table
-	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
+	// Create FAT table.  Whatever the disk held there before lies
+	// past the high-water mark, so only the sectors of the FAT that
+	// come to be used are ever written, and formatting takes the
+	// same time whatever the size of the disk.
+	fat_fs->fat = vcalloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT creation failed");
+	fat_fs->valid_sectors = 0;
 
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
 
 	// Fill up ROOT_DIR_CLUSTER region with 0
-	uint8_t *buf = calloc (1, DISK_SECTOR_SIZE);
-	if (buf == NULL)
-		PANIC ("FAT create failed due to OOM");
-	disk_write (filesys_disk, cluster_to_sector (ROOT_DIR_CLUSTER), buf);
-	free (buf);
+	static uint8_t zeros[DISK_SECTOR_SIZE];
+	cache_write (root_mount, cluster_to_sector (ROOT_DIR_CLUSTER), zeros, 0,
+			DISK_SECTOR_SIZE, DISK_SRC_META);
 }
 
 void
@@ -147,12 +165,22 @@ fat_boot_create (void) {
 	    .fat_start = 1,
 	    .fat_sectors = fat_sectors,
 	    .root_dir_cluster = ROOT_DIR_CLUSTER,
+	    .journal_start = 1 + fat_sectors,
+	    .journal_sectors = JOURNAL_SECTORS,
 	};
 }
 
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors
+		+ fat_fs->bs.journal_sectors;
+	fat_fs->fat_length = (fat_fs->bs.total_sectors - fat_fs->data_start)
+		/ SECTORS_PER_CLUSTER;
+	/* A disk formatted before the mark was kept has every FAT
+	 * sector written; a fresh format always writes the first. */
+	fat_fs->valid_sectors = fat_fs->bs.fat_valid_sectors != 0
+		? fat_fs->bs.fat_valid_sectors : fat_fs->bs.fat_sectors;
+	fat_fs->last_clst = ROOT_DIR_CLUSTER;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -164,30 +192,62 @@ fat_fs_init (void) {
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	cluster_t c, found = 0;
+	unsigned int i;
+
+	lock_acquire (&fat_fs->write_lock);
+	/* Look for a free cluster from the last one handed out on. */
+	for (i = 1; i < fat_fs->fat_length; i++) {
+		c = (fat_fs->last_clst + i) % fat_fs->fat_length;
+		if (c > ROOT_DIR_CLUSTER && fat_fs->fat[c] == 0) {
+			found = c;
+			break;
+		}
+	}
+	if (found != 0) {
+		fat_fs->fat[found] = EOChain;
+		if (clst != 0)
+			fat_fs->fat[clst] = found;
+		fat_fs->last_clst = found;
+	}
+	lock_release (&fat_fs->write_lock);
+	return found;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	if (pclst != 0)
+		fat_fs->fat[pclst] = EOChain;
+	while (clst != 0 && clst != EOChain) {
+		cluster_t next = fat_fs->fat[clst];
+
+		fat_fs->fat[clst] = 0;
+		clst = next;
+	}
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	fat_fs->fat[clst] = val;
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+	return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0);
+	return fat_fs->data_start + (clst - 1) * SECTORS_PER_CLUSTER;
 }
+
@@ -1,37 +1,102 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <poll.h>
 #include "filesys/inode.h"
+#include "filesys/page_cache.h"
+#include "filesys/pipe.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
-/* An open file. */
+/* An open file, or an end of a pipe.  File descriptors and
+ * processes may share one with file_dup(); it is freed when the
+ * last of them closes it. */
 struct file {
-	struct inode *inode;        /* File's inode. */
+	struct inode *inode;        /* File's inode, or null for a pipe. */
+	int ref_cnt;                /* References, each closed separately. */
+	struct spinlock ref_lock;   /* Guards ref_cnt. */
 	off_t pos;                  /* Current position. */
 	bool deny_write;            /* Has file_deny_write() been called? */
+	struct pipe *pipe;          /* Pipe, if INODE is null. */
+	bool pipe_writer;           /* Write end of PIPE? */
+	bool direct;                /* Opened with O_DIRECT? */
+
+	/* Sequential readahead. */
+	off_t ra_next;              /* Where a sequential read would start. */
+	off_t ra_end;               /* End of what was read ahead so far. */
+	off_t ra_window;            /* Bytes to keep read ahead, 0 if random. */
 };
 
+/* Readahead window of a file read sequentially, in bytes: it starts
+ * at RA_MIN and doubles with each sequential read up to RA_MAX. */
+#define RA_MIN (4 * DISK_SECTOR_SIZE)
+#define RA_MAX (16 * DISK_SECTOR_SIZE)
+
+/* Cache of struct file. */
+static struct kmem_cache *file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void) {
+	file_cache = kmem_cache_create ("file", sizeof (struct file), 0, NULL);
+	if (file_cache == NULL)
+		PANIC ("file cache creation failed");
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
  * and returns the new file.  Returns a null pointer if an
  * allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) {
-	struct file *file = calloc (1, sizeof *file);
+	struct file *file = kmem_cache_alloc (file_cache);
 	if (inode != NULL && file != NULL) {
 		file->inode = inode;
+		file->ref_cnt = 1;
+		spin_init (&file->ref_lock);
 		file->pos = 0;
 		file->deny_write = false;
+		file->pipe = NULL;
+		file->direct = false;
+		file->ra_next = 0;
+		file->ra_end = 0;
+		file->ra_window = 0;
 		return file;
 	} else {
 		inode_close (inode);
-		free (file);
+		kmem_cache_free (file_cache, file);
 		return NULL;
 	}
 }
 
-/* Opens and returns a new file for the same inode as FILE.
+/* Opens and returns a new file for the write end of PIPE if
+ * WRITER, or for its read end otherwise.  Returns a null pointer
+ * if an allocation fails. */
+struct file *
+file_open_pipe (struct pipe *pipe, bool writer) {
+	struct file *file = kmem_cache_alloc (file_cache);
+	if (file != NULL) {
+		file->inode = NULL;
+		file->ref_cnt = 1;
+		spin_init (&file->ref_lock);
+		file->pos = 0;
+		file->deny_write = false;
+		file->pipe = pipe;
+		file->pipe_writer = writer;
+		file->direct = false;
+		pipe_open (pipe, writer);
+	}
+	return file;
+}
+
+/* Opens and returns a new file for the same inode as FILE, or for
+ * the same end of the same pipe.
  * Returns a null pointer if unsuccessful. */
 struct file *
 file_reopen (struct file *file) {
+	if (file->pipe != NULL)
+		return file_open_pipe (file->pipe, file->pipe_writer);
 	return file_open (inode_reopen (file->inode));
 }
 
@@ -39,40 +104,100 @@ file_reopen (struct file *file) {
  * same inode as FILE. Returns a null pointer if unsuccessful. */
 struct file *
 file_duplicate (struct file *file) {
-	struct file *nfile = file_open (inode_reopen (file->inode));
+	struct file *nfile = file_reopen (file);
 	if (nfile) {
 		nfile->pos = file->pos;
+		nfile->direct = file->direct;
 		if (file->deny_write)
 			file_deny_write (nfile);
 	}
 	return nfile;
 }
 
-/* Closes FILE. */
+/* Returns FILE with another reference to it, which is closed with
+ * file_close() like the first.  Unlike file_duplicate(), the
+ * holders of the references share FILE's position. */
+struct file *
+file_dup (struct file *file) {
+	spin_lock (&file->ref_lock);
+	file->ref_cnt++;
+	spin_unlock (&file->ref_lock);
+	return file;
+}
+
+/* Closes a reference to FILE, and FILE itself with the last. */
 void
 file_close (struct file *file) {
 	if (file != NULL) {
-		file_allow_write (file);
-		inode_close (file->inode);
-		free (file);
+		bool last;
+
+		spin_lock (&file->ref_lock);
+		last = --file->ref_cnt == 0;
+		spin_unlock (&file->ref_lock);
+		if (!last)
+			return;
+
+		if (file->pipe != NULL)
+			pipe_close (file->pipe, file->pipe_writer);
+		else {
+			file_allow_write (file);
+			inode_trim (file->inode);
+			inode_close (file->inode);
+		}
+		kmem_cache_free (file_cache, file);
 	}
 }
 
-/* Returns the inode encapsulated by FILE. */
+/* Returns the inode encapsulated by FILE, or a null pointer if
+ * FILE is an end of a pipe. */
 struct inode *
 file_get_inode (struct file *file) {
 	return file->inode;
 }
 
+/* Notes that FILE was read from offset START up to its position.
+ * A read that starts where the last one ended is sequential, and
+ * the sectors past it are queued to be read ahead. */
+static void
+file_readahead (struct file *file, off_t start) {
+	off_t end;
+
+	if (start != file->ra_next) {
+		/* Random access: stop reading ahead. */
+		file->ra_window = 0;
+		file->ra_end = 0;
+	} else if (file->ra_window == 0)
+		file->ra_window = RA_MIN;
+	else if (file->ra_window < RA_MAX)
+		file->ra_window *= 2;
+	file->ra_next = file->pos;
+	if (file->ra_window == 0)
+		return;
+
+	end = file->pos + file->ra_window;
+	if (file->ra_end < file->pos)
+		file->ra_end = file->pos;
+	if (file->ra_end < end) {
+		inode_readahead (file->inode, file->ra_end, end);
+		file->ra_end = end;
+	}
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
  * starting at the file's current position.
  * Returns the number of bytes actually read,
  * which may be less than SIZE if end of file is reached.
- * Advances FILE's position by the number of bytes read. */
+ * Advances FILE's position by the number of bytes read.
+ * The read end of a pipe is read with pipe_read() instead; its
+ * write end reads nothing. */
 off_t
 file_read (struct file *file, void *buffer, off_t size) {
-	off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+	if (file->pipe != NULL)
+		return file->pipe_writer ? 0 : pipe_read (file->pipe, buffer, size);
+	off_t bytes_read = page_cache_read_at (file->inode, buffer, size,
+			file->pos);
 	file->pos += bytes_read;
+	file_readahead (file, file->pos - bytes_read);
 	return bytes_read;
 }
 
@@ -80,10 +205,13 @@ file_read (struct file *file, void *buffer, off_t size) {
  * starting at offset FILE_OFS in the file.
  * Returns the number of bytes actually read,
  * which may be less than SIZE if end of file is reached.
- * The file's current position is unaffected. */
+ * The file's current position is unaffected.
+ * Pipes have no offsets and read nothing. */
 off_t
 file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
-	return inode_read_at (file->inode, buffer, size, file_ofs);
+	if (file->pipe != NULL)
+		return 0;
+	return page_cache_read_at (file->inode, buffer, size, file_ofs);
 }
 
 /* Writes SIZE bytes from BUFFER into FILE,
@@ -92,9 +220,15 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs) {
  * which may be less than SIZE if end of file is reached.
  * (Normally we'd grow the file in that case, but file growth is
  * not yet implemented.)
- * Advances FILE's position by the number of bytes read. */
+ * Advances FILE's position by the number of bytes read.
+ * The write end of a pipe is written with pipe_write() instead;
+ * its read end writes nothing, nor does a directory. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) {
+	if (file->pipe != NULL)
+		return file->pipe_writer ? pipe_write (file->pipe, buffer, size) : 0;
+	if (inode_is_dir (file->inode))
+		return 0;
 	off_t bytes_written = inode_write_at (file->inode, buffer, size, file->pos);
 	file->pos += bytes_written;
 	return bytes_written;
@@ -106,19 +240,133 @@ file_write (struct file *file, const void *buffer, off_t size) {
  * which may be less than SIZE if end of file is reached.
  * (Normally we'd grow the file in that case, but file growth is
  * not yet implemented.)
- * The file's current position is unaffected. */
+ * The file's current position is unaffected.
+ * Pipes have no offsets and write nothing, nor do directories. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
 		off_t file_ofs) {
+	if (file->pipe != NULL || inode_is_dir (file->inode))
+		return 0;
 	return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Returns the events of <poll.h> that FILE is ready for, and adds
+ * the queues woken when that changes to those PT waits on.  A file
+ * or directory can always be read and written without waiting for
+ * anything but the disk. */
+unsigned
+file_poll (struct file *file, struct poll_table *pt) {
+	if (file->pipe != NULL)
+		return pipe_poll (file->pipe, file->pipe_writer, pt);
+	return POLLIN | POLLOUT;
+}
+
+/* Sets whether FILE was opened with O_DIRECT, for its reads and
+ * writes to bypass the buffer cache with file_direct(). */
+void
+file_set_direct (struct file *file, bool direct) {
+	file->direct = direct;
+}
+
+/* Returns true if FILE was opened with O_DIRECT. */
+bool
+file_is_direct (struct file *file) {
+	return file->direct;
+}
+
+/* Makes FILE, opened with O_COMPRESS, keep its data compressed, with
+ * inode_set_compressed().  Returns false for a pipe, a directory or
+ * a file that already holds data uncompressed. */
+bool
+file_set_compressed (struct file *file) {
+	if (file->pipe != NULL || inode_is_dir (file->inode))
+		return false;
+	return inode_set_compressed (file->inode);
+}
+
+/* Reads SIZE bytes from FILE at its position into PAGES, or writes
+ * them from there if WRITE, straight between the disk and memory
+ * without the buffer cache, with inode_direct_at(), and advances
+ * the position by the number of bytes moved, which it returns.
+ * Each of PAGES holds PGSIZE bytes.  Returns -1, moving nothing, if
+ * file_read() or file_write() must move them instead: if SIZE or
+ * the position is not a multiple of DISK_SECTOR_SIZE, for a pipe or
+ * a directory, or as inode_direct_at() says. */
+off_t
+file_direct (struct file *file, void *const pages[], off_t size,
+		bool write) {
+	off_t moved;
+
+	if (file->pipe != NULL || inode_is_dir (file->inode)
+			|| size % DISK_SECTOR_SIZE != 0
+			|| file->pos % DISK_SECTOR_SIZE != 0)
+		return -1;
+	moved = inode_direct_at (file->inode, pages, size, file->pos, write);
+	if (moved > 0)
+		file->pos += moved;
+	return moved;
+}
+
+/* Copies up to SIZE bytes from SRC, starting at its position, into
+ * DST at its position, and advances both by the bytes copied.  The
+ * data passes through a kernel page, a page at a time, and never
+ * through the caller's memory.  Returns the number of bytes copied,
+ * which is less than SIZE if SRC ends or DST takes no more, or -1 if
+ * memory is short.  From a pipe, bytes DST does not take are lost;
+ * from a file, SRC is left just past the last byte copied. */
+off_t
+file_copy (struct file *dst, struct file *src, off_t size) {
+	uint8_t *buf = palloc_get_page (0);
+	off_t copied = 0;
+
+	if (buf == NULL)
+		return -1;
+	while (copied < size) {
+		off_t chunk = size - copied < PGSIZE ? size - copied : PGSIZE;
+		off_t n = file_read (src, buf, chunk);
+		off_t written = n > 0 ? file_write (dst, buf, n) : 0;
+
+		copied += written;
+		if (written < n) {
+			if (src->pipe == NULL)
+				src->pos -= n - written;
+			break;
+		}
+		if (n < chunk)
+			break;
+	}
+	palloc_free_page (buf);
+	return copied;
+}
+
+/* Makes FILE at least SIZE bytes long and allocates all of its
+ * first SIZE bytes on disk, in as few extents as the free space
+ * allows.  Returns false for a pipe or a directory, or if the space
+ * could not all be allocated. */
+bool
+file_allocate (struct file *file, off_t size) {
+	if (file->pipe != NULL || inode_is_dir (file->inode))
+		return false;
+	return inode_allocate (file->inode, size);
+}
+
+/* Sets the length of FILE to SIZE bytes, giving back the sectors
+ * past a shorter end or adding zeros up to a longer one.  The
+ * file's position is unaffected.  Returns false for a pipe or a
+ * directory, or on failure. */
+bool
+file_truncate (struct file *file, off_t size) {
+	if (file->pipe != NULL || inode_is_dir (file->inode))
+		return false;
+	return inode_truncate (file->inode, size);
+}
+
 /* Prevents write operations on FILE's underlying inode
  * until file_allow_write() is called or FILE is closed. */
 void
 file_deny_write (struct file *file) {
 	ASSERT (file != NULL);
-	if (!file->deny_write) {
+	if (!file->deny_write && file->pipe == NULL) {
 		file->deny_write = true;
 		inode_deny_write (file->inode);
 	}
@@ -136,11 +384,11 @@ file_allow_write (struct file *file) {
 	}
 }
 
-/* Returns the size of FILE in bytes. */
+/* Returns the size of FILE in bytes, which is 0 for a pipe. */
 off_t
 file_length (struct file *file) {
 	ASSERT (file != NULL);
-	return inode_length (file->inode);
+	return file->pipe != NULL ? 0 : inode_length (file->inode);
 }
 
 /* Sets the current position in FILE to NEW_POS bytes from the
@@ -159,3 +407,23 @@ file_tell (struct file *file) {
 	ASSERT (file != NULL);
 	return file->pos;
 }
+
+/* If FILE is the write end of a pipe, passes PAGE, a page from
+ * palloc_get_page() full of data, to the pipe without copying it
+ * and returns true; the pipe then owns PAGE.  Otherwise, or if the
+ * pipe has no readers, returns false. */
+bool
+file_give_page (struct file *file, void *page) {
+	return file->pipe != NULL && file->pipe_writer
+		&& pipe_give_page (file->pipe, page);
+}
+
+/* If FILE is the read end of a pipe whose next unread page is
+ * whole, removes the page from the pipe and returns it; the caller
+ * must free it with palloc_free_page().  Otherwise returns a null
+ * pointer. */
+void *
+file_take_page (struct file *file) {
+	return file->pipe != NULL && !file->pipe_writer
+		? pipe_take_page (file->pipe) : NULL;
+}
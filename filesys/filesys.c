@@ -1,18 +1,48 @@
 #include "filesys/filesys.h"
 #include <debug.h>
+#include <stat.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
+#include "filesys/defrag.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "filesys/directory.h"
+#include "filesys/mount.h"
+#include "filesys/page_cache.h"
 #include "devices/disk.h"
+#include "threads/synch.h"
 
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
 
+/* Most symbolic links followed to open one name. */
+#define SYMLINK_MAX 8
+
+/* Group commit of filesys_sync(): one flush at a time, shared by
+ * every caller that arrived before it began. */
+static struct lock sync_lock;
+static struct condition sync_cond;
+static unsigned sync_started;           /* Flushes begun. */
+static unsigned sync_done;              /* Flushes finished. */
+static bool syncing;                    /* Is one running? */
+
 static void do_format (void);
 
+/* Allocates the sector of a new inode in DIR into *SECTORP, near the
+ * directory's own, so that the inodes of a directory lie together
+ * and its files' data, which follows their inodes, nearby. */
+static bool
+allocate_inode (struct dir *dir, disk_sector_t *sectorp) {
+	struct inode *inode = dir_get_inode (dir);
+
+	return free_map_allocate_near (inode_get_mount (inode), 1,
+			inode_get_inumber (inode), sectorp);
+}
+
 /* Initializes the file system module.
  * If FORMAT is true, reformats the file system. */
 void
@@ -21,7 +51,14 @@ filesys_init (bool format) {
 	if (filesys_disk == NULL)
 		PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
+	cache_init ();
+	lock_init (&sync_lock);
+	cond_init (&sync_cond);
+	mount_init (filesys_disk);
+	journal_init ();
+	dcache_init ();
 	inode_init ();
+	file_init ();
 
 #ifdef EFILESYS
 	fat_init ();
@@ -32,12 +69,18 @@ filesys_init (bool format) {
 	fat_open ();
 #else
 	/* Original FS */
-	free_map_init ();
+	if (!free_map_init (root_mount))
+		PANIC ("bitmap creation failed--disk is too large");
 
 	if (format)
 		do_format ();
 
-	free_map_open ();
+	journal_open (JOURNAL_SECTOR);
+	free_map_open (root_mount);
+#endif
+	pagecache_init ();
+#ifndef EFILESYS
+	defrag_init ();
 #endif
 }
 
@@ -45,63 +88,398 @@ filesys_init (bool format) {
  * to disk. */
 void
 filesys_done (void) {
+#ifndef EFILESYS
+	defrag_done ();
+#endif
+	if (!inode_flush_delayed ())
+		printf ("filesys: file data with no room on disk was lost\n");
+	mount_done ();
+
 	/* Original FS */
 #ifdef EFILESYS
 	fat_close ();
 #else
-	free_map_close ();
+	free_map_close (root_mount);
 #endif
+	journal_commit_final ();
+	cache_flush (root_mount);
 }
 
-/* Creates a file named NAME with the given INITIAL_SIZE.
+/* Commits the running journal transaction and writes every dirty
+ * sector in the cache back to disk, in order of sector number, as
+ * fsync() and sync() do.  Callers that arrive while a flush runs
+ * wait for it and are then all served by a single next one, since
+ * the running one may have passed their writes by; so N threads
+ * syncing at once cost two flushes, not N. */
+void
+filesys_sync (void) {
+	unsigned target;
+
+	lock_acquire (&sync_lock);
+	target = sync_started + 1;
+	while ((int) (sync_done - target) < 0) {
+		if (syncing) {
+			cond_wait (&sync_cond, &sync_lock);
+			continue;
+		}
+		syncing = true;
+		sync_started++;
+		lock_release (&sync_lock);
+
+		inode_flush_delayed ();
+		journal_commit ();
+		cache_flush (NULL);
+
+		lock_acquire (&sync_lock);
+		sync_done = sync_started;
+		syncing = false;
+		cond_broadcast (&sync_cond, &sync_lock);
+	}
+	lock_release (&sync_lock);
+}
+
+/* Splits PATH into the file system it is on and the name of the
+ * file in that file system's root directory, stored into NAME: "a"
+ * and "/a" name a on the root file system, "m/a" and "/m/a" name a
+ * on the file system mounted on m.  The name is "" for a root
+ * directory itself, as in "/" and "/m".
+ * Returns the file system, with a reference that mount_put() drops,
+ * or a null pointer if PATH is empty or too long or has a directory
+ * part that is not a mount point. */
+static struct mount *
+split_path (const char *path, char name[NAME_MAX + 1]) {
+	char first[NAME_MAX + 1];
+	const char *slash;
+	struct mount *mnt;
+
+	if (*path == '\0')
+		return NULL;
+	if (*path == '/')
+		path++;
+
+	slash = strchr (path, '/');
+	if (slash == NULL) {
+		if (strlen (path) > NAME_MAX)
+			return NULL;
+
+		/* A mount point alone names the root directory mounted
+		 * there. */
+		mnt = *path != '\0' ? mount_get (path) : NULL;
+		if (mnt != NULL) {
+			name[0] = '\0';
+			return mnt;
+		}
+		strlcpy (name, path, NAME_MAX + 1);
+		return mount_get ("");
+	}
+
+	if (slash == path || slash - path > NAME_MAX
+			|| strchr (slash + 1, '/') != NULL || strlen (slash + 1) > NAME_MAX)
+		return NULL;
+	memcpy (first, path, slash - path);
+	first[slash - path] = '\0';
+	mnt = mount_get (first);
+	if (mnt != NULL)
+		strlcpy (name, slash + 1, NAME_MAX + 1);
+	return mnt;
+}
+
+/* Creates a file named PATH with the given INITIAL_SIZE.
  * Returns true if successful, false otherwise.
- * Fails if a file named NAME already exists,
+ * Fails if a file named PATH already exists,
  * or if internal memory allocation fails. */
 bool
-filesys_create (const char *name, off_t initial_size) {
+filesys_create (const char *path, off_t initial_size) {
+	char name[NAME_MAX + 1];
 	disk_sector_t inode_sector = 0;
-	struct dir *dir = dir_open_root ();
-	bool success = (dir != NULL
-			&& free_map_allocate (1, &inode_sector)
-			&& inode_create (inode_sector, initial_size)
+	struct mount *mnt = split_path (path, name);
+	struct dir *dir;
+	bool success;
+
+	if (mnt == NULL)
+		return false;
+	journal_begin ();
+	dir = dir_open_mount (mnt);
+	success = (dir != NULL
+			&& allocate_inode (dir, &inode_sector)
+			&& inode_create (mnt, inode_sector, initial_size, INODE_TYPE_FILE)
 			&& dir_add (dir, name, inode_sector));
 	if (!success && inode_sector != 0)
-		free_map_release (inode_sector, 1);
+		free_map_release (mnt, inode_sector, 1);
 	dir_close (dir);
+	journal_end ();
+	mount_put (mnt);
 
 	return success;
 }
 
-/* Opens the file with the given NAME.
+/* Reads the target of symbolic link LINK into BUF, of SIZE bytes,
+ * as a name in the root directory of its file system.
+ * Returns true if successful, false if the target does not fit. */
+static bool
+read_link (struct inode *link, char *buf, size_t size) {
+	off_t length = inode_length (link);
+
+	if (length <= 0 || (size_t) length >= size
+			|| inode_read_at (link, buf, length, 0) != length)
+		return false;
+	buf[length] = '\0';
+
+	/* Links only lead to names in the root directory, so "/a" and
+	 * "a" are the same name. */
+	if (buf[0] == '/')
+		memmove (buf, buf + 1, length);
+	return true;
+}
+
+/* Looks up NAME in DIR, following symbolic links to what they end
+ * at.  A link once resolved goes straight to its end from the
+ * dentry cache until some directory changes.
+ * Returns the inode, or a null pointer if NAME does not exist, a
+ * link dangles, or more than SYMLINK_MAX links are in the way. */
+static struct inode *
+resolve (struct dir *dir, const char *name) {
+	char target[NAME_MAX + 2];
+	struct inode *inode, *link;
+	struct mount *mnt;
+	disk_sector_t sector;
+	unsigned gen;
+	int hops;
+
+	if (!dir_lookup (dir, name, &inode) || !inode_is_symlink (inode))
+		return inode;
+
+	link = inode;
+	mnt = inode_get_mount (link);
+	switch (dcache_lookup_link (mnt, inode_get_inumber (link), &sector)) {
+		case DCACHE_HIT:
+			inode_close (link);
+			return inode_open (mnt, sector);
+		case DCACHE_NEGATIVE:
+			inode_close (link);
+			return NULL;
+		case DCACHE_MISS:
+			break;
+	}
+
+	/* Directories changed while the chain is followed may make the
+	 * result stale, so it is recorded as of the generation before. */
+	gen = dcache_link_gen ();
+	inode = inode_reopen (link);
+	for (hops = 0; inode != NULL && inode_is_symlink (inode); hops++) {
+		bool ok = hops < SYMLINK_MAX
+			&& read_link (inode, target, sizeof target);
+
+		inode_close (inode);
+		if (!ok || !dir_lookup (dir, target, &inode))
+			inode = NULL;
+	}
+	dcache_insert_link (mnt, inode_get_inumber (link),
+			inode != NULL ? inode_get_inumber (inode) : 0, gen);
+	inode_close (link);
+	return inode;
+}
+
+/* Returns the inode of the file with the given PATH, following
+ * symbolic links, with a reference the caller must close, or a
+ * null pointer if there is no such file. */
+static struct inode *
+lookup (const char *path) {
+	char name[NAME_MAX + 1];
+	struct mount *mnt = split_path (path, name);
+	struct dir *dir;
+	struct inode *inode = NULL;
+
+	if (mnt == NULL)
+		return NULL;
+	dir = dir_open_mount (mnt);
+
+	/* "/" and mount points open a root directory itself, whose
+	 * entries getdents() then lists. */
+	if (dir != NULL && name[0] == '\0')
+		inode = inode_reopen (dir_get_inode (dir));
+	else if (dir != NULL)
+		inode = resolve (dir, name);
+	dir_close (dir);
+	mount_put (mnt);
+	return inode;
+}
+
+/* Opens the file with the given PATH, following symbolic links.
  * Returns the new file if successful or a null pointer
  * otherwise.
- * Fails if no file named NAME exists,
+ * Fails if no file named PATH exists,
  * or if an internal memory allocation fails. */
 struct file *
-filesys_open (const char *name) {
-	struct dir *dir = dir_open_root ();
+filesys_open (const char *path) {
+	return file_open (lookup (path));
+}
+
+/* Stores what stat() reports about the file with the given PATH,
+ * following symbolic links, into *ST, without opening it.
+ * Returns false if no file named PATH exists. */
+bool
+filesys_stat (const char *path, struct stat *st) {
+	struct inode *inode = lookup (path);
+
+	if (inode == NULL)
+		return false;
+	inode_stat (inode, st);
+	inode_close (inode);
+	return true;
+}
+
+/* Creates a symbolic link named LINKPATH to TARGET, which need not
+ * exist and is a name in the root directory of the link's file
+ * system.  TARGET is kept as the link's data, so a short one stays
+ * inside the link's inode and resolving the link reads no other
+ * sector.
+ * Returns true if successful, false otherwise. */
+bool
+filesys_symlink (const char *target, const char *linkpath) {
+	char name[NAME_MAX + 1];
+	disk_sector_t inode_sector = 0;
+	off_t length = strlen (target);
 	struct inode *inode = NULL;
+	struct mount *mnt;
+	struct dir *dir;
+	bool success;
+
+	if (length == 0 || length > NAME_MAX + 1)
+		return false;
+	mnt = split_path (linkpath, name);
+	if (mnt == NULL)
+		return false;
 
-	if (dir != NULL)
-		dir_lookup (dir, name, &inode);
+	journal_begin ();
+	dir = dir_open_mount (mnt);
+	success = (dir != NULL
+			&& allocate_inode (dir, &inode_sector)
+			&& inode_create (mnt, inode_sector, 0, INODE_TYPE_SYMLINK)
+			&& (inode = inode_open (mnt, inode_sector)) != NULL
+			&& inode_write_at (inode, target, length, 0) == length
+			&& dir_add (dir, name, inode_sector));
+	if (!success && inode != NULL)
+		inode_remove (inode);
+	else if (!success && inode_sector != 0)
+		free_map_release (mnt, inode_sector, 1);
+	inode_close (inode);
 	dir_close (dir);
+	journal_end ();
+	mount_put (mnt);
 
-	return file_open (inode);
+	return success;
 }
 
-/* Deletes the file named NAME.
+/* Deletes the file named PATH.  A symbolic link is deleted itself,
+ * not what it refers to.
  * Returns true if successful, false on failure.
- * Fails if no file named NAME exists,
+ * Fails if no file named PATH exists,
  * or if an internal memory allocation fails. */
 bool
-filesys_remove (const char *name) {
-	struct dir *dir = dir_open_root ();
-	bool success = dir != NULL && dir_remove (dir, name);
+filesys_remove (const char *path) {
+	char name[NAME_MAX + 1];
+	struct mount *mnt = split_path (path, name);
+	struct dir *dir;
+	bool success;
+
+	if (mnt == NULL)
+		return false;
+	journal_begin ();
+	dir = dir_open_mount (mnt);
+	success = dir != NULL && dir_remove (dir, name);
 	dir_close (dir);
+	journal_end ();
+	mount_put (mnt);
+
+	return success;
+}
+
+/* Creates a file named DST that shares the data of the regular file
+ * SRC, following symbolic links, by inode_clone(), so that nothing
+ * is copied until one of them is written.
+ * Returns true if successful, false otherwise.
+ * Fails if SRC does not exist or is a directory, DST exists or is
+ * on another file system, or resources are short. */
+bool
+filesys_clone (const char *src, const char *dst) {
+	struct inode *from = lookup (src), *to = NULL;
+	bool created = false, success;
 
+	success = from != NULL && !inode_is_dir (from)
+		&& (created = filesys_create (dst, 0))
+		&& (to = lookup (dst)) != NULL && inode_clone (to, from);
+	inode_close (to);
+	inode_close (from);
+	if (!success && created)
+		filesys_remove (dst);
 	return success;
 }
 
+/* Mounts disk DEV_NO of channel CHAN_NO on PATH, a name in the root
+ * directory that no file has, such as "/scratch", formatting it
+ * first if FORMAT is true.
+ * Returns true if successful, false otherwise, such as if the disk
+ * holds no file system and FORMAT is false. */
+bool
+filesys_mount (const char *path, int chan_no, int dev_no, bool format) {
+	struct inode *inode = NULL;
+	struct disk *disk;
+	struct dir *dir;
+	bool taken;
+
+	if (*path == '/')
+		path++;
+	if (strchr (path, '/') != NULL || chan_no < 0
+			|| (dev_no != 0 && dev_no != 1))
+		return false;
+
+	/* hd0:0 holds the kernel and hd1:1 is for swap. */
+	if ((chan_no == 0 && dev_no == 0) || (chan_no == 1 && dev_no == 1))
+		return false;
+	disk = disk_get (chan_no, dev_no);
+	if (disk == NULL)
+		return false;
+
+	dir = dir_open_root ();
+	taken = dir == NULL || dir_lookup (dir, path, &inode);
+	inode_close (inode);
+	dir_close (dir);
+	return !taken && mount_attach (path, disk, format);
+}
+
+/* Mounts a fresh tmpfs of SIZE_KB kB, held in memory, on PATH, a
+ * name in the root directory that no file has.
+ * Returns true if successful, false otherwise. */
+bool
+filesys_mount_tmpfs (const char *path, int size_kb) {
+	struct inode *inode = NULL;
+	struct dir *dir;
+	bool taken;
+
+	if (*path == '/')
+		path++;
+	if (strchr (path, '/') != NULL || size_kb < TMPFS_MIN_KB
+			|| size_kb > TMPFS_MAX_KB)
+		return false;
+
+	dir = dir_open_root ();
+	taken = dir == NULL || dir_lookup (dir, path, &inode);
+	inode_close (inode);
+	dir_close (dir);
+	return !taken && mount_attach_tmpfs (path,
+			size_kb * (1024 / DISK_SECTOR_SIZE));
+}
+
+/* Unmounts the file system mounted on PATH, writing it back.
+ * Returns false if nothing is mounted there or it is busy. */
+bool
+filesys_umount (const char *path) {
+	if (*path == '/')
+		path++;
+	return strchr (path, '/') == NULL && mount_detach (path);
+}
+
 /* Formats the file system. */
 static void
 do_format (void) {
@@ -112,10 +490,11 @@ do_format (void) {
 	fat_create ();
 	fat_close ();
 #else
-	free_map_create ();
-	if (!dir_create (ROOT_DIR_SECTOR, 16))
+	free_map_create (root_mount);
+	journal_create (JOURNAL_SECTOR);
+	if (!dir_create (root_mount, ROOT_DIR_SECTOR, 16))
 		PANIC ("root directory creation failed");
-	free_map_close ();
+	free_map_close (root_mount);
 #endif
 
 	printf ("done.\n");
@@ -1,77 +1,660 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <itree.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "filesys/mount.h"
+#include "filesys/tmpfs.h"
+#include "threads/lock-stats.h"
+#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
-static struct file *free_map_file;   /* Free map file. */
-static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
+/* The bitmap is the free map proper, and what is written to disk.
+ *
+ * Small requests are served next fit, scanning the bitmap from
+ * where the last allocation ended, so that the sectors of files
+ * written one after the other follow each other on disk.  Requests
+ * of BEST_FIT_MIN sectors or more are served best fit from an index
+ * of the runs of free sectors, kept in an interval tree, so that
+ * large files take the smallest run that holds them whole.  If
+ * memory runs short, the index is dropped and all requests are
+ * served next fit.
+ *
+ * A request may name a goal instead, the sector it would best
+ * start at, such as just past the file's other sectors or its
+ * directory.  It takes the first free run that holds it at or
+ * after the goal, if one starts within NEAR_MAX sectors, so that
+ * what is read together lies together.
+ *
+ * Changing the bitmap only marks the sectors of the free map file
+ * that hold the changed bits.  free_map_flush(), called by each
+ * journal commit and at close, writes those through the sector
+ * cache, so that the operations of one transaction rewrite each
+ * sector of the file once.  On a journaled file system, each sector
+ * newly marked is charged to the running transaction, which the
+ * commit writes it in.
+ *
+ * Sectors may be reserved, as a count rather than particular ones,
+ * for data written to a file and not yet given sectors.  Other
+ * allocations only take what is left free past the reserved count,
+ * and free_map_allocate_reserved() takes from the reserved ones, so
+ * the data always finds room once it is allocated.
+ *
+ * A sector may be shared by files cloned from one another.  REFS
+ * counts the references to each sector past the first, so that
+ * releasing a shared sector drops a reference and only releasing
+ * the last one frees it.  The counts follow the bitmap in the free
+ * map file, from its next sector boundary, and change and are
+ * written with it.  A free map file from before the counts has no
+ * room for them; its sectors cannot be shared.
+ *
+ * Each mounted file system has a free map of its own, for its
+ * disk.  That of a tmpfs also has the tmpfs keep in memory just the
+ * pages of the sectors it allocates. */
+#define BEST_FIT_MIN 8
+#define NEAR_MAX 1024
 
-/* Initializes the free map. */
-void
-free_map_init (void) {
-	free_map = bitmap_create (disk_size (filesys_disk));
-	if (free_map == NULL)
-		PANIC ("bitmap creation failed--disk is too large");
-	bitmap_mark (free_map, FREE_MAP_SECTOR);
-	bitmap_mark (free_map, ROOT_DIR_SECTOR);
+/* A free map. */
+struct free_map {
+	struct file *file;               /* Free map file. */
+	struct bitmap *map;              /* Free map, one bit per disk sector. */
+	struct bitmap *dirty_map;        /* Changed sectors of the file. */
+	struct lock lock;                /* Guards all of the above and below. */
+	disk_sector_t next_fit;          /* Where the next scan starts. */
+	struct itree free_runs;          /* Runs of free sectors. */
+	bool index_valid;                /* FREE_RUNS is up to date? */
+	size_t free_cnt;                 /* Number of free sectors. */
+	size_t reserved;                 /* Number of them reserved. */
+	uint8_t *refs;                   /* More references, per sector. */
+	bool refs_kept;                  /* REFS has room in the file? */
+	bool journaled;                  /* Changes charged to the journal? */
+};
+
+/* Offset of the reference counts of FM in its file, and the size
+ * of the file with them. */
+static size_t
+refs_ofs (const struct free_map *fm) {
+	return ROUND_UP (bitmap_file_size (fm->map), DISK_SECTOR_SIZE);
+}
+
+static size_t
+file_size (const struct free_map *fm) {
+	return refs_ofs (fm) + bitmap_size (fm->map);
+}
+
+/* A run of free sectors, in the index. */
+struct free_run {
+	struct itree_elem elem;          /* Element in free_runs. */
+};
+
+static struct kmem_cache *run_cache; /* Cache of struct free_run. */
+
+static void index_build (struct free_map *);
+
+/* Initializes the free map of MNT, for the whole of its disk.
+ * Returns false if memory is short. */
+bool
+free_map_init (struct mount *mnt) {
+	struct free_map *fm = calloc (1, sizeof *fm);
+
+	if (fm == NULL)
+		return false;
+	fm->map = bitmap_create (mount_size (mnt));
+	if (fm->map != NULL) {
+		fm->dirty_map = bitmap_create (DIV_ROUND_UP (file_size (fm),
+					DISK_SECTOR_SIZE));
+		fm->refs = calloc (bitmap_size (fm->map), sizeof *fm->refs);
+	}
+	if (fm->dirty_map == NULL || fm->refs == NULL) {
+		if (fm->dirty_map != NULL)
+			bitmap_destroy (fm->dirty_map);
+		free (fm->refs);
+		bitmap_destroy (fm->map);
+		free (fm);
+		return false;
+	}
+	fm->journaled = mnt->journaled;
+	bitmap_mark (fm->map, FREE_MAP_SECTOR);
+	bitmap_mark (fm->map, ROOT_DIR_SECTOR);
+	bitmap_set_multiple (fm->map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+	lock_init (&fm->lock);
+	lock_set_name (&fm->lock, "free map");
+	if (run_cache == NULL)
+		run_cache = kmem_cache_create ("free_run", sizeof (struct free_run),
+				0, NULL);
+	itree_init (&fm->free_runs);
+	index_build (fm);
+	fm->free_cnt = bitmap_count (fm->map, 0, bitmap_size (fm->map), false);
+	mnt->free_map = fm;
+	return true;
+}
+
+/* Frees every run in the index of FM and marks it invalid. */
+static void
+index_drop (struct free_map *fm) {
+	struct itree_elem *e;
+
+	while ((e = itree_first (&fm->free_runs)) != NULL) {
+		itree_remove (&fm->free_runs, e);
+		kmem_cache_free (run_cache, itree_entry (e, struct free_run, elem));
+	}
+	fm->index_valid = false;
+}
+
+/* Adds [START, END) to the index of FM, or drops the index if
+ * memory is short.  RUN is reused if it is not null. */
+static void
+index_insert (struct free_map *fm, struct free_run *run, uintptr_t start,
+		uintptr_t end) {
+	if (run == NULL && run_cache != NULL)
+		run = kmem_cache_alloc (run_cache);
+	if (run == NULL) {
+		index_drop (fm);
+		return;
+	}
+	itree_insert (&fm->free_runs, &run->elem, start, end);
+}
+
+/* Rebuilds the index of FM from its bitmap. */
+static void
+index_build (struct free_map *fm) {
+	size_t size = bitmap_size (fm->map);
+	size_t start = 0, end;
+
+	index_drop (fm);
+	fm->index_valid = true;
+	while (fm->index_valid
+			&& (start = bitmap_scan (fm->map, start, 1, false))
+				!= BITMAP_ERROR) {
+		for (end = start + 1; end < size && !bitmap_test (fm->map, end); end++)
+			continue;
+		index_insert (fm, NULL, start, end);
+		start = end;
+	}
+}
+
+/* Removes the free sectors [START, START + CNT) from the index of
+ * FM.  They must lie within one run. */
+static void
+index_take (struct free_map *fm, disk_sector_t start, size_t cnt) {
+	struct itree_elem *e;
+	struct free_run *run;
+	uintptr_t run_start, run_end;
+
+	if (!fm->index_valid)
+		return;
+	e = itree_find (&fm->free_runs, start);
+	ASSERT (e != NULL && e->end >= start + cnt);
+	run = itree_entry (e, struct free_run, elem);
+	run_start = e->start;
+	run_end = e->end;
+	itree_remove (&fm->free_runs, e);
+
+	/* Keep what is left on either side, reusing RUN once. */
+	if (run_start < start) {
+		index_insert (fm, run, run_start, start);
+		run = NULL;
+	}
+	if (fm->index_valid && start + cnt < run_end) {
+		index_insert (fm, run, start + cnt, run_end);
+		run = NULL;
+	}
+	if (run != NULL)
+		kmem_cache_free (run_cache, run);
+}
+
+/* Adds the sectors [START, START + CNT), just freed, to the index
+ * of FM, merging them with the runs next to them. */
+static void
+index_give (struct free_map *fm, disk_sector_t start, size_t cnt) {
+	struct itree_elem *before, *after;
+	struct free_run *run = NULL;
+	uintptr_t run_start = start, run_end = start + cnt;
+
+	if (!fm->index_valid)
+		return;
+	before = start > 0 ? itree_find (&fm->free_runs, start - 1) : NULL;
+	after = itree_find (&fm->free_runs, start + cnt);
+	if (before != NULL) {
+		run_start = before->start;
+		itree_remove (&fm->free_runs, before);
+		run = itree_entry (before, struct free_run, elem);
+	}
+	if (after != NULL) {
+		run_end = after->end;
+		itree_remove (&fm->free_runs, after);
+		if (run == NULL)
+			run = itree_entry (after, struct free_run, elem);
+		else
+			kmem_cache_free (run_cache,
+					itree_entry (after, struct free_run, elem));
+	}
+	index_insert (fm, run, run_start, run_end);
+}
+
+/* Returns the start of the smallest run in the index of FM of at
+ * least CNT sectors, or BITMAP_ERROR if there is none. */
+static size_t
+best_fit (struct free_map *fm, size_t cnt) {
+	struct itree_elem *e, *best = NULL;
+
+	for (e = itree_first (&fm->free_runs); e != NULL; e = itree_next (e)) {
+		size_t length = e->end - e->start;
+
+		if (length >= cnt
+				&& (best == NULL || length < best->end - best->start)) {
+			best = e;
+			if (length == cnt)
+				break;
+		}
+	}
+	return best != NULL ? best->start : BITMAP_ERROR;
+}
+
+/* Marks the CNT sectors of the file of FM starting at FIRST
+ * changed, charging the journal for those newly marked. */
+static void
+mark_file_dirty (struct free_map *fm, size_t first, size_t cnt) {
+	if (fm->journaled)
+		journal_charge (cnt - bitmap_count (fm->dirty_map, first, cnt, true));
+	bitmap_set_multiple (fm->dirty_map, first, cnt, true);
+}
+
+/* Marks the sectors of the file of FM that hold the bits of
+ * [SECTOR, SECTOR + CNT) changed. */
+static void
+mark_dirty (struct free_map *fm, disk_sector_t sector, size_t cnt) {
+	size_t first = sector / 8 / DISK_SECTOR_SIZE;
+	size_t last = (sector + cnt - 1) / 8 / DISK_SECTOR_SIZE;
+
+	mark_file_dirty (fm, first, last - first + 1);
+}
+
+/* Marks the sectors of the file of FM that hold the reference
+ * counts of [SECTOR, SECTOR + CNT) changed. */
+static void
+mark_refs_dirty (struct free_map *fm, disk_sector_t sector, size_t cnt) {
+	size_t first = (refs_ofs (fm) + sector) / DISK_SECTOR_SIZE;
+	size_t last = (refs_ofs (fm) + sector + cnt - 1) / DISK_SECTOR_SIZE;
+
+	mark_file_dirty (fm, first, last - first + 1);
+}
+
+/* Marks the CNT free sectors of FM starting at SECTOR used. */
+static void
+take (struct free_map *fm, disk_sector_t sector, size_t cnt) {
+	bitmap_set_multiple (fm->map, sector, cnt, true);
+	index_take (fm, sector, cnt);
+	mark_dirty (fm, sector, cnt);
+	fm->free_cnt -= cnt;
+}
+
+/* Gives the CNT free sectors of MNT from SECTOR on, about to be
+ * allocated, memory to be held in, if MNT is a tmpfs.  Returns false
+ * if memory is short.  The free map's lock must be held. */
+static bool
+populate (struct mount *mnt, disk_sector_t sector, size_t cnt) {
+	if (mnt->tmpfs == NULL)
+		return true;
+	if (tmpfs_populate (mnt->tmpfs, sector, cnt))
+		return true;
+	tmpfs_release (mnt->tmpfs, sector, cnt, mnt->free_map->map);
+	return false;
+}
+
+/* Returns true if CNT sectors of FM are free past those reserved.
+ * The free map's lock must be held. */
+static inline bool
+unreserved (const struct free_map *fm, size_t cnt) {
+	return fm->free_cnt >= fm->reserved + cnt;
+}
+
+/* Returns the first of CNT consecutive free sectors of FM, best fit
+ * or next fit as CNT calls for, or BITMAP_ERROR if there are none.
+ * The free map's lock must be held. */
+static size_t
+scan (struct free_map *fm, size_t cnt) {
+	size_t sector;
+
+	if (cnt >= BEST_FIT_MIN && fm->index_valid)
+		return best_fit (fm, cnt);
+	if (fm->next_fit >= bitmap_size (fm->map))
+		fm->next_fit = 0;
+	sector = bitmap_scan (fm->map, fm->next_fit, cnt, false);
+	if (sector == BITMAP_ERROR && fm->next_fit > 0)
+		sector = bitmap_scan (fm->map, 0, cnt, false);
+	return sector;
+}
+
+/* Returns the first of CNT consecutive free sectors of FM that
+ * start at most NEAR_MAX sectors past GOAL, or BITMAP_ERROR if
+ * there are none.  The free map's lock must be held. */
+static size_t
+scan_near (struct free_map *fm, size_t cnt, disk_sector_t goal) {
+	size_t sector = BITMAP_ERROR;
+
+	if (goal < bitmap_size (fm->map))
+		sector = bitmap_scan (fm->map, goal, cnt, false);
+	return sector != BITMAP_ERROR && sector - goal <= NEAR_MAX
+		? sector : BITMAP_ERROR;
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
- * the first into *SECTORP.
+/* Allocates CNT consecutive sectors from the free map of MNT and
+ * stores the first into *SECTORP.
  * Returns true if successful, false if all sectors were
  * available. */
 bool
-free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
-	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
-		bitmap_set_multiple (free_map, sector, cnt, false);
+free_map_allocate (struct mount *mnt, size_t cnt, disk_sector_t *sectorp) {
+	struct free_map *fm = mnt->free_map;
+	size_t sector = BITMAP_ERROR;
+
+	lock_acquire (&fm->lock);
+	if (unreserved (fm, cnt))
+		sector = scan (fm, cnt);
+	if (sector != BITMAP_ERROR && !populate (mnt, sector, cnt))
+		sector = BITMAP_ERROR;
+	if (sector != BITMAP_ERROR) {
+		take (fm, sector, cnt);
+		fm->next_fit = sector + cnt;
+	}
+	lock_release (&fm->lock);
+	if (sector != BITMAP_ERROR)
+		*sectorp = sector;
+	return sector != BITMAP_ERROR;
+}
+
+/* Allocates CNT consecutive sectors from the free map of MNT, as
+ * close past GOAL as it can, and stores the first into *SECTORP.
+ * If none start within NEAR_MAX sectors of GOAL, allocates as
+ * free_map_allocate() does.
+ * Returns true if successful, false if all sectors were
+ * available. */
+bool
+free_map_allocate_near (struct mount *mnt, size_t cnt, disk_sector_t goal,
+		disk_sector_t *sectorp) {
+	struct free_map *fm = mnt->free_map;
+	size_t sector = BITMAP_ERROR;
+
+	lock_acquire (&fm->lock);
+	if (unreserved (fm, cnt))
+		sector = scan_near (fm, cnt, goal);
+	if (sector != BITMAP_ERROR && populate (mnt, sector, cnt))
+		take (fm, sector, cnt);
+	else
+		sector = BITMAP_ERROR;
+	lock_release (&fm->lock);
+	if (sector == BITMAP_ERROR)
+		return free_map_allocate (mnt, cnt, sectorp);
+	*sectorp = sector;
+	return true;
+}
+
+/* Allocates CNT consecutive sectors from those reserved in the free
+ * map of MNT, as free_map_allocate_near() does, and stores the
+ * first into *SECTORP.  At least CNT sectors must be reserved.
+ * Returns true if successful, false if no CNT free sectors follow
+ * each other or a tmpfs is short of memory; they stay reserved. */
+bool
+free_map_allocate_reserved (struct mount *mnt, size_t cnt,
+		disk_sector_t goal, disk_sector_t *sectorp) {
+	struct free_map *fm = mnt->free_map;
+	size_t sector;
+
+	lock_acquire (&fm->lock);
+	ASSERT (fm->reserved >= cnt);
+	sector = scan_near (fm, cnt, goal);
+	if (sector == BITMAP_ERROR) {
+		sector = scan (fm, cnt);
+		if (sector != BITMAP_ERROR)
+			fm->next_fit = sector + cnt;
+	}
+	if (sector != BITMAP_ERROR && !populate (mnt, sector, cnt))
 		sector = BITMAP_ERROR;
+	if (sector != BITMAP_ERROR) {
+		take (fm, sector, cnt);
+		fm->reserved -= cnt;
 	}
+	lock_release (&fm->lock);
 	if (sector != BITMAP_ERROR)
 		*sectorp = sector;
 	return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Reserves CNT sectors of MNT, of those free, for
+ * free_map_allocate_reserved() to allocate.  Returns false,
+ * reserving none, if fewer are free past those already reserved. */
+bool
+free_map_reserve (struct mount *mnt, size_t cnt) {
+	struct free_map *fm = mnt->free_map;
+	bool success;
+
+	lock_acquire (&fm->lock);
+	success = unreserved (fm, cnt);
+	if (success)
+		fm->reserved += cnt;
+	lock_release (&fm->lock);
+	return success;
+}
+
+/* Gives back CNT of the sectors reserved in MNT, unallocated. */
 void
-free_map_release (disk_sector_t sector, size_t cnt) {
-	ASSERT (bitmap_all (free_map, sector, cnt));
-	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+free_map_unreserve (struct mount *mnt, size_t cnt) {
+	struct free_map *fm = mnt->free_map;
+
+	lock_acquire (&fm->lock);
+	ASSERT (fm->reserved >= cnt);
+	fm->reserved -= cnt;
+	lock_release (&fm->lock);
 }
 
-/* Opens the free map file and reads it from disk. */
+/* Allocates the CNT sectors of MNT starting at SECTOR, if they are
+ * all free, so that a file can grow in place.
+ * Returns true if successful, false otherwise. */
+bool
+free_map_allocate_at (struct mount *mnt, disk_sector_t sector, size_t cnt) {
+	struct free_map *fm = mnt->free_map;
+	bool success = false;
+
+	lock_acquire (&fm->lock);
+	if (sector + cnt <= bitmap_size (fm->map) && unreserved (fm, cnt)
+			&& bitmap_none (fm->map, sector, cnt)
+			&& populate (mnt, sector, cnt)) {
+		take (fm, sector, cnt);
+		success = true;
+	}
+	lock_release (&fm->lock);
+	return success;
+}
+
+/* Frees the CNT sectors of MNT starting at SECTOR.  The free map's
+ * lock must be held. */
+static void
+give (struct mount *mnt, disk_sector_t sector, size_t cnt) {
+	struct free_map *fm = mnt->free_map;
+
+	bitmap_set_multiple (fm->map, sector, cnt, false);
+	index_give (fm, sector, cnt);
+	mark_dirty (fm, sector, cnt);
+	fm->free_cnt += cnt;
+	if (mnt->tmpfs != NULL)
+		tmpfs_release (mnt->tmpfs, sector, cnt, fm->map);
+}
+
+/* Drops a reference to each of the CNT sectors of MNT starting at
+ * SECTOR, making those that had no other available for use. */
+void
+free_map_release (struct mount *mnt, disk_sector_t sector, size_t cnt) {
+	struct free_map *fm = mnt->free_map;
+	size_t end = sector + cnt, i, j;
+
+	lock_acquire (&fm->lock);
+	ASSERT (bitmap_all (fm->map, sector, cnt));
+	for (i = sector; i < end; i = j) {
+		if (fm->refs[i] > 0) {
+			fm->refs[i]--;
+			mark_refs_dirty (fm, i, 1);
+			j = i + 1;
+			continue;
+		}
+		for (j = i + 1; j < end && fm->refs[j] == 0; j++)
+			continue;
+		give (mnt, i, j - i);
+	}
+	lock_release (&fm->lock);
+}
+
+/* Adds a reference to each of the CNT sectors of MNT starting at
+ * SECTOR, all in use, for a file cloned to share them.  Returns
+ * false, adding none, if the free map keeps no reference counts or
+ * one of them is at its limit. */
+bool
+free_map_share (struct mount *mnt, disk_sector_t sector, size_t cnt) {
+	struct free_map *fm = mnt->free_map;
+	size_t i;
+	bool success;
+
+	if (fm == NULL)
+		return false;
+	lock_acquire (&fm->lock);
+	ASSERT (bitmap_all (fm->map, sector, cnt));
+	success = fm->refs_kept;
+	for (i = 0; success && i < cnt; i++)
+		success = fm->refs[sector + i] < UINT8_MAX;
+	if (success) {
+		for (i = 0; i < cnt; i++)
+			fm->refs[sector + i]++;
+		mark_refs_dirty (fm, sector, cnt);
+	}
+	lock_release (&fm->lock);
+	return success;
+}
+
+/* Returns true if any of the CNT sectors of MNT starting at SECTOR
+ * is shared by more than one file. */
+bool
+free_map_shared (struct mount *mnt, disk_sector_t sector, size_t cnt) {
+	struct free_map *fm = mnt->free_map;
+	bool shared = false;
+	size_t i;
+
+	if (fm == NULL || !fm->refs_kept)
+		return false;
+	lock_acquire (&fm->lock);
+	for (i = 0; !shared && i < cnt; i++)
+		shared = fm->refs[sector + i] > 0;
+	lock_release (&fm->lock);
+	return shared;
+}
+
+/* Writes the changed sectors of the free map of MNT to its free map
+ * file, if it is open. */
 void
-free_map_open (void) {
-	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-	if (free_map_file == NULL)
+free_map_flush (struct mount *mnt) {
+	struct free_map *fm = mnt->free_map;
+	size_t size, idx = 0;
+
+	if (fm == NULL)
+		return;
+	lock_acquire (&fm->lock);
+	if (fm->file != NULL) {
+		size = bitmap_file_size (fm->map);
+		while ((idx = bitmap_scan (fm->dirty_map, idx, 1, true))
+				!= BITMAP_ERROR) {
+			size_t ofs = idx * DISK_SECTOR_SIZE;
+
+			bitmap_reset (fm->dirty_map, idx);
+			if (ofs < size)
+				bitmap_write_at (fm->map, fm->file, ofs,
+						size - ofs < DISK_SECTOR_SIZE ? size - ofs
+						: DISK_SECTOR_SIZE);
+			else if (fm->refs_kept) {
+				size_t len = file_size (fm) - ofs < DISK_SECTOR_SIZE
+					? file_size (fm) - ofs : DISK_SECTOR_SIZE;
+
+				file_write_at (fm->file, fm->refs + (ofs - refs_ofs (fm)), len,
+						ofs);
+			}
+		}
+	}
+	lock_release (&fm->lock);
+}
+
+/* Opens the free map file of MNT and reads it from disk. */
+void
+free_map_open (struct mount *mnt) {
+	struct free_map *fm = mnt->free_map;
+
+	fm->file = file_open (inode_open (mnt, FREE_MAP_SECTOR));
+	if (fm->file == NULL)
 		PANIC ("can't open free map");
-	if (!bitmap_read (free_map, free_map_file))
+	inode_set_meta (file_get_inode (fm->file));
+	if (!bitmap_read (fm->map, fm->file))
 		PANIC ("can't read free map");
+	fm->refs_kept = file_length (fm->file) >= (off_t) file_size (fm)
+		&& file_read_at (fm->file, fm->refs, bitmap_size (fm->map),
+			refs_ofs (fm)) == (off_t) bitmap_size (fm->map);
+	if (!fm->refs_kept)
+		memset (fm->refs, 0, bitmap_size (fm->map));
+	bitmap_set_all (fm->dirty_map, false);
+	index_build (fm);
+	fm->free_cnt = bitmap_count (fm->map, 0, bitmap_size (fm->map), false);
 }
 
-/* Writes the free map to disk and closes the free map file. */
+/* Writes the free map of MNT to disk and closes the free map
+ * file. */
 void
-free_map_close (void) {
-	file_close (free_map_file);
+free_map_close (struct mount *mnt) {
+	struct free_map *fm = mnt->free_map;
+
+	free_map_flush (mnt);
+	file_close (fm->file);
+	fm->file = NULL;
 }
 
-/* Creates a new free map file on disk and writes the free map to
- * it. */
+/* Creates a new free map file on the disk of MNT and writes the
+ * free map to it. */
 void
-free_map_create (void) {
+free_map_create (struct mount *mnt) {
+	struct free_map *fm = mnt->free_map;
+
 	/* Create inode. */
-	if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+	if (!inode_create (mnt, FREE_MAP_SECTOR, file_size (fm),
+				INODE_TYPE_FILE))
 		PANIC ("free map creation failed");
 
-	/* Write bitmap to file. */
-	free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-	if (free_map_file == NULL)
+	/* Write bitmap and reference counts to file.  The file starts
+	 * as a hole, so writing it allocates its sectors and changes the
+	 * map again; those changes stay marked for free_map_close().
+	 * Flushes then find every sector allocated. */
+	fm->file = file_open (inode_open (mnt, FREE_MAP_SECTOR));
+	if (fm->file == NULL)
 		PANIC ("can't open free map");
-	if (!bitmap_write (free_map, free_map_file))
+	if (!bitmap_write (fm->map, fm->file)
+			|| file_write_at (fm->file, fm->refs, bitmap_size (fm->map),
+				refs_ofs (fm)) != (off_t) bitmap_size (fm->map))
 		PANIC ("can't write free map");
+	fm->refs_kept = true;
+}
+
+/* Frees the free map of MNT, whose file is closed. */
+void
+free_map_destroy (struct mount *mnt) {
+	struct free_map *fm = mnt->free_map;
+
+	if (fm == NULL)
+		return;
+	ASSERT (fm->file == NULL);
+	index_drop (fm);
+	bitmap_destroy (fm->dirty_map);
+	bitmap_destroy (fm->map);
+	free (fm->refs);
+	free (fm);
+	mnt->free_map = NULL;
 }
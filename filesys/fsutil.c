@@ -1,5 +1,6 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +12,25 @@
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 
+/* Starts R moving the next chunk of a transfer with SIZE bytes left
+ * between scratch disk D, at *SECTOR, and BUFFER, to the disk if
+ * WRITE.  A chunk is a page, or what is left if less, in one disk
+ * command.  Advances *SECTOR past the chunk.
+ * Returns false, starting nothing, if the chunk does not fit on D. */
+static bool
+start_chunk (struct disk_request *r, struct disk *d, disk_sector_t *sector,
+		off_t size, void *buffer, bool write) {
+	size_t cnt = DIV_ROUND_UP (size < PGSIZE ? size : PGSIZE,
+			DISK_SECTOR_SIZE);
+
+	if (*sector >= disk_size (d) || cnt > disk_size (d) - *sector)
+		return false;
+	disk_request_init (r, d, *sector, cnt, buffer, write);
+	disk_submit (r);
+	*sector += cnt;
+	return true;
+}
+
 /* List files in the root directory. */
 void
 fsutil_ls (char **argv UNUSED) {
@@ -73,23 +93,30 @@ fsutil_rm (char **argv) {
  * The first call to this function will read starting at the
  * beginning of the scratch disk.  Later calls advance across the
  * disk.  This disk position is independent of that used for
- * fsutil_get(), so all `put's should precede all `get's. */
+ * fsutil_get(), so all `put's should precede all `get's.
+ *
+ * The file is created at its full size, so its sectors are
+ * allocated at once, and its content is read from the scratch disk
+ * a page at a time, the next page while the last is written. */
 void
 fsutil_put (char **argv) {
 	static disk_sector_t sector = 0;
 
 	const char *file_name = argv[1];
+	struct disk_request reqs[2];
 	struct disk *src;
 	struct file *dst;
 	off_t size;
-	void *buffer;
+	void *buffers[2];
+	int cur = 0;
 
 	printf ("Putting '%s' into the file system...\n", file_name);
 
-	/* Allocate buffer. */
-	buffer = malloc (DISK_SECTOR_SIZE);
-	if (buffer == NULL)
-		PANIC ("couldn't allocate buffer");
+	/* Allocate buffers. */
+	buffers[0] = palloc_get_page (0);
+	buffers[1] = palloc_get_page (0);
+	if (buffers[0] == NULL || buffers[1] == NULL)
+		PANIC ("couldn't allocate buffers");
 
 	/* Open source disk and read file size. */
 	src = disk_get (1, 0);
@@ -97,10 +124,10 @@ fsutil_put (char **argv) {
 		PANIC ("couldn't open source disk (hdc or hd1:0)");
 
 	/* Read file size. */
-	disk_read (src, sector++, buffer);
-	if (memcmp (buffer, "PUT", 4))
+	disk_read (src, sector++, buffers[0]);
+	if (memcmp (buffers[0], "PUT", 4))
 		PANIC ("%s: missing PUT signature on scratch disk", file_name);
-	size = ((int32_t *) buffer)[1];
+	size = ((int32_t *) buffers[0])[1];
 	if (size < 0)
 		PANIC ("%s: invalid file size %d", file_name, size);
 
@@ -112,18 +139,27 @@ fsutil_put (char **argv) {
 		PANIC ("%s: open failed", file_name);
 
 	/* Do copy. */
+	if (size > 0 && !start_chunk (&reqs[cur], src, &sector, size,
+				buffers[cur], false))
+		PANIC ("%s: scratch disk ends before file content", file_name);
 	while (size > 0) {
-		int chunk_size = size > DISK_SECTOR_SIZE ? DISK_SECTOR_SIZE : size;
-		disk_read (src, sector++, buffer);
-		if (file_write (dst, buffer, chunk_size) != chunk_size)
+		off_t chunk_size = size > PGSIZE ? PGSIZE : size;
+
+		disk_wait (&reqs[cur]);
+		if (size > chunk_size && !start_chunk (&reqs[!cur], src, &sector,
+					size - chunk_size, buffers[!cur], false))
+			PANIC ("%s: scratch disk ends before file content", file_name);
+		if (file_write (dst, buffers[cur], chunk_size) != chunk_size)
 			PANIC ("%s: write failed with %"PROTd" bytes unwritten",
 					file_name, size);
 		size -= chunk_size;
+		cur = !cur;
 	}
 
 	/* Finish up. */
 	file_close (dst);
-	free (buffer);
+	palloc_free_page (buffers[0]);
+	palloc_free_page (buffers[1]);
 }
 
 /* Copies file FILE_NAME from the file system to the scratch disk.
@@ -136,23 +172,30 @@ fsutil_put (char **argv) {
  * The first call to this function will write starting at the
  * beginning of the scratch disk.  Later calls advance across the
  * disk.  This disk position is independent of that used for
- * fsutil_put(), so all `put's should precede all `get's. */
+ * fsutil_put(), so all `put's should precede all `get's.
+ *
+ * The file's data is written to the scratch disk a page at a time,
+ * the next page read from the file while the last is written. */
 void
 fsutil_get (char **argv) {
 	static disk_sector_t sector = 0;
 
 	const char *file_name = argv[1];
-	void *buffer;
+	struct disk_request reqs[2];
+	bool pending[2] = {false, false};
+	void *buffers[2];
 	struct file *src;
 	struct disk *dst;
 	off_t size;
+	int cur = 0;
 
 	printf ("Getting '%s' from the file system...\n", file_name);
 
-	/* Allocate buffer. */
-	buffer = malloc (DISK_SECTOR_SIZE);
-	if (buffer == NULL)
-		PANIC ("couldn't allocate buffer");
+	/* Allocate buffers. */
+	buffers[0] = palloc_get_page (0);
+	buffers[1] = palloc_get_page (0);
+	if (buffers[0] == NULL || buffers[1] == NULL)
+		PANIC ("couldn't allocate buffers");
 
 	/* Open source file. */
 	src = filesys_open (file_name);
@@ -166,24 +209,33 @@ fsutil_get (char **argv) {
 		PANIC ("couldn't open target disk (hdc or hd1:0)");
 
 	/* Write size to sector 0. */
-	memset (buffer, 0, DISK_SECTOR_SIZE);
-	memcpy (buffer, "GET", 4);
-	((int32_t *) buffer)[1] = size;
-	disk_write (dst, sector++, buffer);
+	memset (buffers[0], 0, DISK_SECTOR_SIZE);
+	memcpy (buffers[0], "GET", 4);
+	((int32_t *) buffers[0])[1] = size;
+	disk_write (dst, sector++, buffers[0]);
 
 	/* Do copy. */
 	while (size > 0) {
-		int chunk_size = size > DISK_SECTOR_SIZE ? DISK_SECTOR_SIZE : size;
-		if (sector >= disk_size (dst))
-			PANIC ("%s: out of space on scratch disk", file_name);
-		if (file_read (src, buffer, chunk_size) != chunk_size)
+		off_t chunk_size = size > PGSIZE ? PGSIZE : size;
+
+		if (pending[cur])
+			disk_wait (&reqs[cur]);
+		if (file_read (src, buffers[cur], chunk_size) != chunk_size)
 			PANIC ("%s: read failed with %"PROTd" bytes unread", file_name, size);
-		memset (buffer + chunk_size, 0, DISK_SECTOR_SIZE - chunk_size);
-		disk_write (dst, sector++, buffer);
+		memset (buffers[cur] + chunk_size, 0, PGSIZE - chunk_size);
+		if (!start_chunk (&reqs[cur], dst, &sector, size, buffers[cur], true))
+			PANIC ("%s: out of space on scratch disk", file_name);
+		pending[cur] = true;
 		size -= chunk_size;
+		cur = !cur;
 	}
 
 	/* Finish up. */
+	if (pending[0])
+		disk_wait (&reqs[0]);
+	if (pending[1])
+		disk_wait (&reqs[1]);
 	file_close (src);
-	free (buffer);
+	palloc_free_page (buffers[0]);
+	palloc_free_page (buffers[1]);
 }
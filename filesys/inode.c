@@ -1,22 +1,91 @@
 #include "filesys/inode.h"
+#include <crc32c.h>
+#include <hash.h>
 #include <list.h>
+#include <lz.h>
 #include <debug.h>
 #include <round.h>
+#include <stat.h>
+#include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/defrag.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "filesys/mount.h"
+#include "filesys/page_cache.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/process.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of consecutive data sectors. */
+struct extent {
+	disk_sector_t start;                /* First sector. */
+	uint32_t length;                    /* Number of sectors. */
+};
+
+/* Extents kept in the inode itself and in its indirect block. */
+#define INODE_EXTENTS 60
+#define INDIRECT_EXTENTS (DISK_SECTOR_SIZE / sizeof (struct extent))
+#define MAX_EXTENTS (INODE_EXTENTS + INDIRECT_EXTENTS)
+
 /* On-disk inode.
- * Must be exactly DISK_SECTOR_SIZE bytes long. */
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ * The file's data are the sectors of its extents, in order; the
+ * first INODE_EXTENTS of them are here and the rest in sector
+ * INDIRECT, allocated once needed.  Sector 0 holds the free map,
+ * so it never is an indirect block.
+ *
+ * An extent that starts at HOLE is a hole: its sectors are not
+ * allocated and read as zeros, and they are allocated only once
+ * written.
+ *
+ * A file of up to INLINE_MAX bytes instead keeps its data in place
+ * of the extents and has no sectors, so that it takes one sector
+ * and one read.  It moves to sectors of its own once it grows
+ * past that.  Bytes past its end there are zeros.
+ *
+ * An inode with INODE_CKSUM set holds the CRC-32C of its sector,
+ * taken with CHECKSUM zero, and fails to open if that does not
+ * match, so that a corrupted inode is not followed to the wrong
+ * sectors.
+ *
+ * An inode with INODE_COMPRESS set keeps its data compressed, in
+ * clusters, and its extents hold its cluster map instead: see
+ * "Transparent compression" below. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t extent_cnt;                /* Number of extents. */
+	disk_sector_t indirect;             /* Block of further extents, or 0. */
+	struct extent extents[INODE_EXTENTS]; /* First extents, or data. */
+	disk_sector_t index;                /* Directory index inode, or 0. */
+	uint32_t flags;                     /* INODE_* flags. */
+	uint32_t checksum;                  /* CRC-32C, if INODE_CKSUM. */
+	uint32_t unused;                    /* Not used. */
+};
+
+#define HOLE 0                         /* Start of a hole's extent. */
+#define INODE_INLINE 0x1                /* Data in place of the extents. */
+#define INODE_DIR 0x2                   /* A directory. */
+#define INODE_SYMLINK 0x4               /* A symbolic link. */
+#define INODE_CKSUM 0x8                 /* CHECKSUM is valid. */
+#define INODE_COMPRESS 0x10             /* Data compressed in clusters. */
+#define INLINE_MAX ((off_t) sizeof ((struct inode_disk *) 0)->extents)
+
+/* An extent, with where it starts in the file, for lookup. */
+struct run {
+	uint32_t first;                     /* Index of its first sector in file. */
+	disk_sector_t start;                /* First disk sector. */
+	uint32_t length;                    /* Number of sectors. */
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,112 +97,1462 @@ bytes_to_sectors (off_t size) {
 
 /* In-memory inode. */
 struct inode {
-	struct list_elem elem;              /* Element in inode list. */
+	struct hash_elem elem;              /* Element in open_inodes. */
+	struct list_elem closed_elem;       /* Element in closed_inodes. */
+	struct mount *mnt;                  /* File system it is on. */
 	disk_sector_t sector;               /* Sector number of disk location. */
 	int open_cnt;                       /* Number of openers. */
+	struct spinlock open_cnt_lock;      /* Guards open_cnt. */
 	bool removed;                       /* True if deleted, false otherwise. */
+	bool meta;                          /* Contents are file system metadata? */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+	struct rwlock data_lock;            /* Guards data and file contents. */
+	struct rwlock dir_lock;             /* Guards entries, if a directory. */
+	unsigned write_gen;                 /* Bumped by every write. */
+	struct run *runs;                   /* All extents, in file order. */
+	size_t run_cap;                     /* Capacity of RUNS. */
+	uint8_t *delay_buf;                 /* Sectors awaiting allocation, or null. */
+	size_t delay_first;                 /* Index of the first of them. */
+	size_t delay_cnt;                   /* Number of them. */
+	size_t delay_resv;                  /* Free sectors reserved for them. */
+	bool delay_claim;                   /* Allocating from DELAY_RESV? */
+	bool delay_stuck;                   /* Last flush of them failed? */
+	bool delay_held;                    /* Kept open until they are flushed? */
+	struct list_elem delay_elem;        /* Element in delayed_inodes. */
+	bool shared;                        /* May share sectors with a clone? */
+	struct cluster_buf *cbuf;           /* If compressed, or null. */
+	struct lock cbuf_lock;              /* Guards CBUF for readers. */
 	struct inode_disk data;             /* Inode content. */
 };
 
+/* Returns true if INODE keeps its data inline. */
+static inline bool
+is_inline (const struct inode *inode) {
+	return (inode->data.flags & INODE_INLINE) != 0;
+}
+
+/* Returns true if INODE keeps its data compressed. */
+static inline bool
+is_compressed (const struct inode *inode) {
+	return (inode->data.flags & INODE_COMPRESS) != 0;
+}
+
+/* Returns how many of the SIZE bytes at OFFSET of inline INODE are
+ * before its end. */
+static off_t
+inline_span (const struct inode *inode, off_t offset, off_t size) {
+	off_t left = inode->data.length - offset;
+
+	if (left <= 0)
+		return 0;
+	return size < left ? size : left;
+}
+
+/* Returns the number of sectors allocated to INODE. */
+static size_t
+inode_sectors (const struct inode *inode) {
+	size_t cnt = inode->data.extent_cnt;
+
+	return cnt > 0 ? inode->runs[cnt - 1].first + inode->runs[cnt - 1].length
+		: 0;
+}
+
+/* Returns what disk I/O for the data of INODE is accounted to:
+ * metadata for directories and the free map, which the journal
+ * logs, an executable while a process runs it, file data
+ * otherwise. */
+static enum disk_source
+data_source (const struct inode *inode) {
+	if (inode->meta)
+		return DISK_SRC_META;
+	return inode->deny_write_cnt > 0 ? DISK_SRC_EXEC : DISK_SRC_DATA;
+}
+
+/* Returns the position in INODE's runs of the run that holds
+ * sector IDX of the file, which must be within the runs.
+ * Binary search over the extents, so O(log extents). */
+static size_t
+find_run (const struct inode *inode, size_t idx) {
+	size_t lo = 0, hi = inode->data.extent_cnt;
+
+	ASSERT (idx < inode_sectors (inode));
+	while (hi - lo > 1) {
+		size_t mid = (lo + hi) / 2;
+
+		if (inode->runs[mid].first <= idx)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	ASSERT (idx - inode->runs[lo].first < inode->runs[lo].length);
+	return lo;
+}
+
+/* Returns the disk sector of sector IDX of INODE, or HOLE if it is
+ * in a hole. */
+static disk_sector_t
+index_to_sector (const struct inode *inode, size_t idx) {
+	const struct run *r = &inode->runs[find_run (inode, idx)];
+
+	return r->start != HOLE ? r->start + (idx - r->first) : HOLE;
+}
+
 /* Returns the disk sector that contains byte offset POS within
- * INODE.
+ * INODE, or HOLE if it is in a hole.
  * Returns -1 if INODE does not contain data for a byte at offset
  * POS. */
 static disk_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) {
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
-	else
+	if (pos >= inode->data.length)
 		return -1;
+	return index_to_sector (inode, pos / DISK_SECTOR_SIZE);
+}
+
+/* Makes room in INODE for CNT runs.  Returns false if memory is
+ * short. */
+static bool
+reserve_runs (struct inode *inode, size_t cnt) {
+	struct run *runs;
+	size_t cap;
+
+	if (cnt <= inode->run_cap)
+		return true;
+	cap = inode->run_cap > 0 ? inode->run_cap * 2 : 4;
+	if (cap > MAX_EXTENTS)
+		cap = MAX_EXTENTS;
+	runs = realloc (inode->runs, cap * sizeof *runs);
+	if (runs == NULL)
+		return false;
+	inode->runs = runs;
+	inode->run_cap = cap;
+	return true;
+}
+
+/* Reads the extents of INODE, whose data has been read, into its
+ * runs.  Returns false if memory is short. */
+static bool
+read_runs (struct inode *inode) {
+	struct extent *extents = inode->data.extents;
+	struct extent indirect[INDIRECT_EXTENTS];
+	size_t cnt = inode->data.extent_cnt, i;
+	uint32_t first = 0;
+
+	ASSERT (cnt <= MAX_EXTENTS);
+
+	if (!reserve_runs (inode, cnt))
+		return false;
+	if (cnt > INODE_EXTENTS)
+		cache_read (inode->mnt, inode->data.indirect, indirect, 0,
+				sizeof indirect, DISK_SRC_META);
+	for (i = 0; i < cnt; i++) {
+		const struct extent *e = i < INODE_EXTENTS ? &extents[i]
+			: &indirect[i - INODE_EXTENTS];
+
+		inode->runs[i].first = first;
+		inode->runs[i].start = e->start;
+		inode->runs[i].length = e->length;
+		first += e->length;
+	}
+	inode->shared = false;
+	for (i = 0; i < cnt && !inode->shared; i++)
+		inode->shared = inode->runs[i].start != HOLE
+			&& free_map_shared (inode->mnt, inode->runs[i].start,
+				inode->runs[i].length);
+	return true;
+}
+
+/* Whether inodes are written with checksums. */
+bool inode_checksums;
+
+/* Returns the checksum of DATA. */
+static uint32_t
+inode_checksum (const struct inode_disk *data) {
+	struct inode_disk copy = *data;
+
+	copy.checksum = 0;
+	return crc32c (0, &copy, sizeof copy);
+}
+
+/* Writes INODE's extents and length to disk. */
+static void
+write_inode (struct inode *inode) {
+	size_t cnt = inode->data.extent_cnt, i;
+
+	for (i = 0; i < cnt && i < INODE_EXTENTS; i++) {
+		inode->data.extents[i].start = inode->runs[i].start;
+		inode->data.extents[i].length = inode->runs[i].length;
+	}
+	if (cnt > INODE_EXTENTS) {
+		struct extent indirect[INDIRECT_EXTENTS];
+
+		memset (indirect, 0, sizeof indirect);
+		for (i = INODE_EXTENTS; i < cnt; i++) {
+			indirect[i - INODE_EXTENTS].start = inode->runs[i].start;
+			indirect[i - INODE_EXTENTS].length = inode->runs[i].length;
+		}
+		cache_write (inode->mnt, inode->data.indirect, indirect, 0,
+				sizeof indirect, DISK_SRC_META);
+	}
+	if (inode_checksums) {
+		inode->data.flags |= INODE_CKSUM;
+		inode->data.checksum = inode_checksum (&inode->data);
+	} else {
+		inode->data.flags &= ~INODE_CKSUM;
+		inode->data.checksum = 0;
+	}
+	cache_write (inode->mnt, inode->sector, &inode->data, 0, DISK_SECTOR_SIZE,
+			DISK_SRC_META);
+}
+
+/* Allocates CNT consecutive sectors for INODE as
+ * free_map_allocate_near() does, or while its delayed allocation
+ * buffer is flushed from the sectors reserved for it. */
+static bool
+alloc_near (struct inode *inode, size_t cnt, disk_sector_t goal,
+		disk_sector_t *sectorp) {
+	if (!inode->delay_claim)
+		return free_map_allocate_near (inode->mnt, cnt, goal, sectorp);
+	if (cnt > inode->delay_resv
+			|| !free_map_allocate_reserved (inode->mnt, cnt, goal, sectorp))
+		return false;
+	inode->delay_resv -= cnt;
+	return true;
+}
+
+/* Makes room in INODE's extent table for CNT more runs, allocating
+ * the indirect block if they need it.  Returns false if the table
+ * would be full or memory or disk space is short. */
+static bool
+make_room (struct inode *inode, size_t cnt) {
+	size_t n = inode->data.extent_cnt + cnt;
+
+	return n <= MAX_EXTENTS && reserve_runs (inode, n)
+		&& (n <= INODE_EXTENTS || inode->data.indirect != 0
+			|| alloc_near (inode, 1, inode->sector + 1, &inode->data.indirect));
+}
+
+/* Returns where sectors added at position POS of INODE's runs are
+ * best placed: just past the allocated run before POS, or if there
+ * is none just past the inode itself, so that a file's data
+ * follows its inode on disk. */
+static disk_sector_t
+alloc_goal (const struct inode *inode, size_t pos) {
+	while (pos-- > 0)
+		if (inode->runs[pos].start != HOLE)
+			return inode->runs[pos].start + inode->runs[pos].length;
+	return inode->sector + 1;
+}
+
+/* Inserts a run of LENGTH sectors from disk sector START, or a hole
+ * if START is HOLE, at position POS of INODE's runs, as sector
+ * FIRST of the file on.  make_room() must have made room for it. */
+static void
+insert_run (struct inode *inode, size_t pos, uint32_t first,
+		disk_sector_t start, uint32_t length) {
+	size_t n = inode->data.extent_cnt;
+
+	ASSERT (pos <= n && n < inode->run_cap);
+
+	memmove (&inode->runs[pos + 1], &inode->runs[pos],
+			(n - pos) * sizeof *inode->runs);
+	inode->runs[pos].first = first;
+	inode->runs[pos].start = start;
+	inode->runs[pos].length = length;
+	inode->data.extent_cnt++;
+}
+
+/* Removes the run at position POS of INODE's runs. */
+static void
+remove_run (struct inode *inode, size_t pos) {
+	size_t n = --inode->data.extent_cnt;
+
+	memmove (&inode->runs[pos], &inode->runs[pos + 1],
+			(n - pos) * sizeof *inode->runs);
+}
+
+/* Allocates CNT more sectors to the end of INODE, and up to EXTRA
+ * more past those as a preallocation window for the writes to
+ * come.  The last extent is extended in place if the sectors after
+ * it are free; otherwise new extents as long as the free space
+ * allows are added.  INODE's extents are written to disk, but not
+ * its length.  Returns false if the disk or the extent table is
+ * full or memory is short before CNT sectors were allocated, after
+ * keeping whatever was. */
+static bool
+grow_sectors (struct inode *inode, size_t cnt, size_t extra) {
+	bool success = true;
+
+	cnt += extra;
+	while (cnt > 0) {
+		size_t n = inode->data.extent_cnt;
+		struct run *last = n > 0 ? &inode->runs[n - 1] : NULL;
+		disk_sector_t start;
+		size_t got;
+
+		if (last != NULL && last->start != HOLE
+				&& free_map_allocate_at (inode->mnt,
+					last->start + last->length, cnt)) {
+			got = cnt;
+			last->length += got;
+		} else {
+			if (!make_room (inode, 1)) {
+				success = cnt <= extra;
+				break;
+			}
+			for (got = cnt; got > 0 && !free_map_allocate_near (inode->mnt,
+						got, alloc_goal (inode, n), &start); got /= 2)
+				continue;
+			if (got == 0) {
+				success = cnt <= extra;
+				break;
+			}
+			insert_run (inode, n, inode_sectors (inode), start, got);
+		}
+		cnt -= got;
+	}
+	write_inode (inode);
+	return success;
+}
+
+/* Adds a hole of CNT sectors to the end of INODE.  Returns false if
+ * the extent table is full or memory is short. */
+static bool
+add_hole (struct inode *inode, size_t cnt) {
+	size_t n = inode->data.extent_cnt;
+
+	if (n > 0 && inode->runs[n - 1].start == HOLE)
+		inode->runs[n - 1].length += cnt;
+	else if (make_room (inode, 1))
+		insert_run (inode, n, inode_sectors (inode), HOLE, cnt);
+	else
+		return false;
+	return true;
+}
+
+/* Allocates sectors of INODE from sector IDX, which is in a hole,
+ * up to CNT of them but not past the hole, and fills them with
+ * zeros.  Extends the run before the hole instead of adding one
+ * when the sectors follow it on disk, as they do when a hole is
+ * written from its start.  INODE's extents are written to disk.
+ * Returns false if no sector could be allocated. */
+static bool
+fill_hole (struct inode *inode, size_t idx, size_t cnt) {
+	static char zeros[DISK_SECTOR_SIZE];
+	size_t pos = find_run (inode, idx);
+	size_t first = inode->runs[pos].first;
+	size_t end = first + inode->runs[pos].length;
+	struct run *prev = pos > 0 ? &inode->runs[pos - 1] : NULL;
+	bool before, after, merge;
+	disk_sector_t start;
+	size_t got, i;
+
+	ASSERT (inode->runs[pos].start == HOLE);
+
+	if (cnt > end - idx)
+		cnt = end - idx;
+	for (got = cnt; got > 0 && !alloc_near (inode, got,
+				alloc_goal (inode, pos), &start); got /= 2)
+		continue;
+	if (got == 0)
+		return false;
+
+	/* The hole becomes what is left of it before IDX, the sectors
+	 * allocated and what is left of it after them. */
+	before = idx > first;
+	after = idx + got < end;
+	merge = !before && prev != NULL && prev->start != HOLE
+		&& prev->start + prev->length == start;
+	if (!merge && !make_room (inode, before + after)) {
+		free_map_release (inode->mnt, start, got);
+		return false;
+	}
+	if (merge) {
+		prev->length += got;
+		if (after) {
+			inode->runs[pos].first += got;
+			inode->runs[pos].length -= got;
+		} else
+			remove_run (inode, pos);
+	} else {
+		if (before) {
+			inode->runs[pos].length = idx - first;
+			insert_run (inode, ++pos, idx, start, got);
+		} else {
+			inode->runs[pos].start = start;
+			inode->runs[pos].length = got;
+		}
+		if (after)
+			insert_run (inode, pos + 1, idx + got, HOLE, end - idx - got);
+	}
+
+	for (i = 0; i < got; i++)
+		cache_write (inode->mnt, start + i, zeros, 0, DISK_SECTOR_SIZE,
+				data_source (inode));
+	write_inode (inode);
+	return true;
+}
+
+/* Transparent compression.
+ *
+ * A file opened with O_COMPRESS while empty, by
+ * inode_set_compressed(), keeps its data in clusters of
+ * CLUSTER_SECTORS sectors, each compressed on its own by
+ * lz_compress(), so that data that compresses well is read and
+ * written in fewer sectors.  A cluster takes a run of sectors of
+ * its own: as many as its compressed bytes need, or CLUSTER_SECTORS
+ * holding it as it is if compressing would not save a sector, or
+ * none if it is all zeros, which it reads as.
+ *
+ * The extents of a compressed inode hold its cluster map, an array
+ * of struct cluster that says where each of them is, and are
+ * otherwise managed as those of any file, a sector of map read as
+ * zeros until allocated.  Clusters past the end of file are zeros
+ * in the map, and the bytes past the end in the last cluster are
+ * zeros.
+ *
+ * A write of part of a cluster decompresses it, changes the bytes
+ * it covers, and compresses and writes it whole, in the sectors it
+ * had if it needs as many, or into new ones, the old ones being
+ * released, within the write's journal handle.  The last cluster
+ * read or written is kept decompressed in the inode's cluster
+ * buffer, so that reads and writes of parts of one in turn
+ * decompress it once; whole pages decompressed land in the page
+ * cache too.  A cluster stored as it is is read straight from its
+ * sectors through the sector cache.
+ *
+ * Compressed files cannot be cloned, nor read or written around
+ * the sector cache, and have no delayed allocation, preallocation
+ * window or logged writes, which all assume file sectors that each
+ * hold their sector of data. */
+#define CLUSTER_SECTORS 8
+#define CLUSTER_SIZE (CLUSTER_SECTORS * DISK_SECTOR_SIZE)
+
+/* An entry in a cluster map. */
+struct cluster {
+	disk_sector_t start;                /* First sector, if any. */
+	uint16_t sectors;                   /* Number of sectors, 0 if zeros. */
+	uint16_t size;                      /* Compressed bytes, or 0 if not. */
+};
+
+#define CLUSTERS_PER_SECTOR (DISK_SECTOR_SIZE / sizeof (struct cluster))
+
+/* The cluster buffer of a compressed inode.  Readers hold its
+ * CBUF_LOCK while they use it, and writers, who hold its data lock
+ * for writing, need not. */
+struct cluster_buf {
+	size_t idx;                         /* Cluster in DATA, or SIZE_MAX. */
+	uint8_t data[CLUSTER_SIZE];         /* Its bytes. */
+	uint8_t packed[CLUSTER_SIZE];       /* A cluster's compressed bytes. */
+	uint8_t work[LZ_WORK_SIZE];         /* Scratch for lz_compress(). */
+};
+
+/* Returns the number of clusters in compressed INODE's length. */
+static size_t
+cluster_cnt (const struct inode *inode) {
+	return DIV_ROUND_UP (inode->data.length, CLUSTER_SIZE);
+}
+
+/* Returns the number of sectors that INODE needs for its length:
+ * those of its data, or if it is compressed, those of its cluster
+ * map. */
+static size_t
+kept_sectors (const struct inode *inode) {
+	if (is_compressed (inode))
+		return DIV_ROUND_UP (cluster_cnt (inode), CLUSTERS_PER_SECTOR);
+	return bytes_to_sectors (inode->data.length);
+}
+
+/* Reads the map entry of cluster IDX of compressed INODE into *C. */
+static void
+get_cluster (const struct inode *inode, size_t idx, struct cluster *c) {
+	size_t sec = idx / CLUSTERS_PER_SECTOR;
+	disk_sector_t sector = sec < inode_sectors (inode)
+		? index_to_sector (inode, sec) : HOLE;
+
+	if (sector == HOLE)
+		memset (c, 0, sizeof *c);
+	else
+		cache_read (inode->mnt, sector, c, idx % CLUSTERS_PER_SECTOR * sizeof *c,
+				sizeof *c, DISK_SRC_META);
+}
+
+/* Writes *C as the map entry of cluster IDX of compressed INODE,
+ * allocating the sector of map it goes in if need be.  Returns
+ * false if the disk or the extent table is full. */
+static bool
+put_cluster (struct inode *inode, size_t idx, const struct cluster *c) {
+	size_t sec = idx / CLUSTERS_PER_SECTOR, have = inode_sectors (inode);
+	disk_sector_t sector = sec < have ? index_to_sector (inode, sec) : HOLE;
+
+	if (sector == HOLE) {
+		/* Already zeros. */
+		if (c->sectors == 0)
+			return true;
+		if ((sec >= have && !add_hole (inode, sec + 1 - have))
+				|| !fill_hole (inode, sec, 1))
+			return false;
+		sector = index_to_sector (inode, sec);
+	}
+	cache_write (inode->mnt, sector, c, idx % CLUSTERS_PER_SECTOR * sizeof *c,
+			sizeof *c, DISK_SRC_META);
+	return true;
+}
+
+/* Returns the cluster buffer of compressed INODE, allocating it on
+ * first use, or a null pointer if memory is short. */
+static struct cluster_buf *
+get_cluster_buf (struct inode *inode) {
+	if (inode->cbuf == NULL) {
+		inode->cbuf = malloc (sizeof *inode->cbuf);
+		if (inode->cbuf != NULL)
+			inode->cbuf->idx = SIZE_MAX;
+	}
+	return inode->cbuf;
+}
+
+/* Reads cluster IDX of compressed INODE, whose map entry is *C,
+ * into the data of CB, decompressing it.  Returns false, leaving
+ * CB holding no cluster, if the cluster is corrupt. */
+static bool
+load_cluster (const struct inode *inode, size_t idx, const struct cluster *c,
+		struct cluster_buf *cb) {
+	uint8_t *dst = c->size != 0 ? cb->packed : cb->data;
+	size_t i;
+
+	cb->idx = SIZE_MAX;
+	if (c->sectors > CLUSTER_SECTORS
+			|| c->size > c->sectors * DISK_SECTOR_SIZE
+			|| (c->size == 0 && c->sectors != 0
+				&& c->sectors != CLUSTER_SECTORS))
+		return false;
+	if (c->sectors == 0)
+		memset (cb->data, 0, CLUSTER_SIZE);
+	for (i = 0; i < c->sectors; i++)
+		cache_read (inode->mnt, c->start + i, dst + i * DISK_SECTOR_SIZE,
+				0, DISK_SECTOR_SIZE, data_source (inode));
+	if (c->size != 0 && !lz_decompress (cb->packed, c->size, cb->data,
+				CLUSTER_SIZE))
+		return false;
+	cb->idx = idx;
+	return true;
+}
+
+/* Returns true if the SIZE bytes at P are all zeros. */
+static bool
+is_zeros (const uint8_t *p, size_t size) {
+	while (size > 0)
+		if (p[--size] != 0)
+			return false;
+	return true;
+}
+
+/* Returns the sector that cluster IDX of compressed INODE, whose
+ * map entry is *C, is best allocated near: where it is, or else
+ * just past the cluster before it, so that a file written in order
+ * is laid out in order. */
+static disk_sector_t
+cluster_goal (const struct inode *inode, size_t idx, const struct cluster *c) {
+	struct cluster prev;
+
+	if (c->sectors > 0)
+		return c->start;
+	if (idx > 0) {
+		get_cluster (inode, idx - 1, &prev);
+		if (prev.sectors > 0)
+			return prev.start + prev.sectors;
+	}
+	return inode->sector + 1;
+}
+
+/* Compresses the data of CB as cluster IDX of compressed INODE,
+ * whose map entry is *C, and writes it, updating *C and the map.
+ * Returns false, leaving the cluster on disk as it was, if the
+ * disk or the extent table is full. */
+static bool
+store_cluster (struct inode *inode, size_t idx, struct cluster *c,
+		struct cluster_buf *cb) {
+	struct cluster new = { HOLE, 0, 0 };
+	const uint8_t *src;
+	size_t i;
+
+	if (!is_zeros (cb->data, CLUSTER_SIZE)) {
+		/* Stored as it is unless compressing saves a sector. */
+		new.size = lz_compress (cb->data, CLUSTER_SIZE, cb->packed,
+				CLUSTER_SIZE - DISK_SECTOR_SIZE, cb->work);
+		new.sectors = new.size != 0 ? bytes_to_sectors (new.size)
+			: CLUSTER_SECTORS;
+		if (new.size != 0)
+			memset (cb->packed + new.size, 0,
+					new.sectors * DISK_SECTOR_SIZE - new.size);
+	}
+	src = new.size != 0 ? cb->packed : cb->data;
+
+	if (new.sectors > 0 && new.sectors == c->sectors)
+		new.start = c->start;
+	else if (new.sectors > 0
+			&& !free_map_allocate_near (inode->mnt, new.sectors,
+				cluster_goal (inode, idx, c), &new.start))
+		return false;
+	if (memcmp (&new, c, sizeof new) && !put_cluster (inode, idx, &new)) {
+		if (new.start != c->start)
+			free_map_release (inode->mnt, new.start, new.sectors);
+		return false;
+	}
+	if (c->sectors > 0 && new.start != c->start)
+		free_map_release (inode->mnt, c->start, c->sectors);
+	for (i = 0; i < new.sectors; i++)
+		cache_write (inode->mnt, new.start + i, src + i * DISK_SECTOR_SIZE,
+				0, DISK_SECTOR_SIZE, data_source (inode));
+	*c = new;
+	return true;
+}
+
+/* Reads the SIZE bytes at OFS of the cluster of INODE whose map
+ * entry is *C, which is stored as it is, into BUFFER. */
+static void
+read_stored (const struct inode *inode, const struct cluster *c,
+		uint8_t *buffer, off_t ofs, off_t size) {
+	off_t pos;
+
+	for (pos = ofs; pos < ofs + size; ) {
+		int sector_ofs = pos % DISK_SECTOR_SIZE;
+		int n = DISK_SECTOR_SIZE - sector_ofs;
+
+		if (n > ofs + size - pos)
+			n = ofs + size - pos;
+		cache_read (inode->mnt, c->start + pos / DISK_SECTOR_SIZE,
+				buffer + (pos - ofs), sector_ofs, n, data_source (inode));
+		pos += n;
+	}
+}
+
+/* Reads up to SIZE bytes of compressed INODE at OFFSET into BUFFER,
+ * stopping at end of file or a corrupt cluster, and returns the
+ * number read.  Its data lock must be held. */
+static off_t
+compressed_read (struct inode *inode, uint8_t *buffer, off_t size,
+		off_t offset) {
+	off_t bytes_read = 0;
+
+	if (offset >= inode->data.length)
+		return 0;
+	if (size > inode->data.length - offset)
+		size = inode->data.length - offset;
+	while (bytes_read < size) {
+		size_t idx = offset / CLUSTER_SIZE;
+		off_t ofs = offset % CLUSTER_SIZE;
+		off_t chunk = CLUSTER_SIZE - ofs;
+		struct cluster c;
+
+		if (chunk > size - bytes_read)
+			chunk = size - bytes_read;
+		get_cluster (inode, idx, &c);
+		if (c.sectors == 0)
+			memset (buffer + bytes_read, 0, chunk);
+		else if (c.size == 0 && c.sectors == CLUSTER_SECTORS)
+			read_stored (inode, &c, buffer + bytes_read, ofs, chunk);
+		else {
+			struct cluster_buf *cb;
+			bool ok;
+
+			lock_acquire (&inode->cbuf_lock);
+			cb = get_cluster_buf (inode);
+			ok = cb != NULL && (cb->idx == idx
+					|| load_cluster (inode, idx, &c, cb));
+			if (ok)
+				memcpy (buffer + bytes_read, cb->data + ofs, chunk);
+			lock_release (&inode->cbuf_lock);
+			if (!ok)
+				break;
+		}
+		bytes_read += chunk;
+		offset += chunk;
+	}
+	return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into compressed INODE at OFFSET,
+ * extending it if the write goes past its end, and returns the
+ * number written, which is less if the disk is full.  Its data
+ * lock must be held for writing, inside a journal handle. */
+static off_t
+compressed_write (struct inode *inode, const uint8_t *buffer, off_t size,
+		off_t offset) {
+	struct cluster_buf *cb = get_cluster_buf (inode);
+	off_t bytes_written = 0;
+
+	if (cb == NULL)
+		return 0;
+	while (bytes_written < size) {
+		size_t idx = offset / CLUSTER_SIZE;
+		off_t ofs = offset % CLUSTER_SIZE;
+		off_t chunk = CLUSTER_SIZE - ofs;
+		struct cluster c;
+
+		if (chunk > size - bytes_written)
+			chunk = size - bytes_written;
+		get_cluster (inode, idx, &c);
+
+		/* A write of a whole cluster need not read it first. */
+		if (cb->idx != idx && chunk < CLUSTER_SIZE
+				&& !load_cluster (inode, idx, &c, cb))
+			break;
+		cb->idx = idx;
+		memcpy (cb->data + ofs, buffer + bytes_written, chunk);
+		if (!store_cluster (inode, idx, &c, cb)) {
+			cb->idx = SIZE_MAX;
+			break;
+		}
+		bytes_written += chunk;
+		offset += chunk;
+	}
+	if (offset > inode->data.length && bytes_written > 0) {
+		inode->data.length = offset;
+		write_inode (inode);
+	}
+	return bytes_written;
+}
+
+/* Extends compressed INODE to LENGTH bytes, if it is shorter.  The
+ * bytes added are zeros, in clusters that take no sectors. */
+static void
+compressed_grow (struct inode *inode, off_t length) {
+	if (length > inode->data.length) {
+		inode->data.length = length;
+		write_inode (inode);
+	}
+}
+
+/* Releases the clusters of compressed INODE past LENGTH bytes, which
+ * is less than its length, and zeros the bytes past it in the last
+ * one, for inode_truncate() to set the length.  Returns false if
+ * the disk is full or the last cluster is corrupt.  Its data lock
+ * must be held for writing, inside a journal handle. */
+static bool
+compressed_shrink (struct inode *inode, off_t length) {
+	static const struct cluster none;
+	size_t keep = DIV_ROUND_UP (length, CLUSTER_SIZE);
+	size_t cnt = cluster_cnt (inode), idx;
+	struct cluster c;
+
+	if (length % CLUSTER_SIZE != 0) {
+		struct cluster_buf *cb = get_cluster_buf (inode);
+		off_t ofs = length % CLUSTER_SIZE;
+
+		idx = length / CLUSTER_SIZE;
+		get_cluster (inode, idx, &c);
+		if (cb == NULL || (cb->idx != idx
+					&& !load_cluster (inode, idx, &c, cb)))
+			return false;
+		memset (cb->data + ofs, 0, CLUSTER_SIZE - ofs);
+		if (!store_cluster (inode, idx, &c, cb)) {
+			cb->idx = SIZE_MAX;
+			return false;
+		}
+	}
+	for (idx = keep; idx < cnt; idx++) {
+		get_cluster (inode, idx, &c);
+		if (c.sectors > 0) {
+			free_map_release (inode->mnt, c.start, c.sectors);
+			put_cluster (inode, idx, &none);
+		}
+	}
+	if (inode->cbuf != NULL && inode->cbuf->idx >= keep)
+		inode->cbuf->idx = SIZE_MAX;
+	return true;
+}
+
+/* Log-structured write mode, turned on by "-lfs".  An overwrite of
+ * a file's allocated sectors does not write them in place: each is
+ * moved to a new sector at the log head of the file system, which
+ * only moves forward, and the old one is freed, so that small
+ * writes scattered over a file or over many files reach the disk
+ * as one sequential run when the cache writes them back.  The
+ * extents of each inode stay its map to the latest copy of each of
+ * its sectors.  The defragmenter, which the mode starts, is the
+ * cleaner: it moves each file that the log has scattered back into
+ * one run, which also gives back the extents the moves took.
+ *
+ * Only journaled file systems log writes, so that a move commits
+ * with the free map.  Metadata, inline files and symbolic links are
+ * written in place, and so is a sector once a file's extent table
+ * has no room to split its run.
+ *
+ * A sector shared with a clone, by inode_clone(), is moved the same
+ * way on any file system before it is written, which is its copy
+ * on write. */
+bool inode_log_writes;
+
+/* Returns true if overwrites of INODE are logged. */
+static bool
+logs_writes (const struct inode *inode) {
+	return inode_log_writes && inode->mnt->journaled && !inode->meta
+		&& (inode->data.flags
+			& (INODE_INLINE | INODE_DIR | INODE_SYMLINK)) == 0;
+}
+
+/* Moves sector IDX of INODE, which is allocated, to a new sector at
+ * the log head if it logs writes or else near the sectors before
+ * it, copying its data there first if COPY, for a write that does
+ * not cover all of it, and releases the old one.  The run before it
+ * is extended instead of adding one when the new sector follows it
+ * on disk, as it does when a file is overwritten from its start.
+ * INODE's extents are written to disk.  Returns false, moving
+ * nothing, if the disk or the extent table is full. */
+static bool
+move_sector (struct inode *inode, size_t idx, bool copy) {
+	struct mount *mnt = inode->mnt;
+	size_t pos = find_run (inode, idx);
+	size_t first = inode->runs[pos].first;
+	size_t end = first + inode->runs[pos].length;
+	disk_sector_t old = inode->runs[pos].start + (idx - first), start;
+	struct run *prev = pos > 0 ? &inode->runs[pos - 1] : NULL;
+	bool before = idx > first, after = idx + 1 < end, merge;
+	bool logged = logs_writes (inode);
+
+	ASSERT (inode->runs[pos].start != HOLE);
+
+	if (!free_map_allocate_near (mnt, 1,
+				logged ? mnt->log_head : alloc_goal (inode, pos), &start))
+		return false;
+	merge = !before && prev != NULL && prev->start != HOLE
+		&& prev->start + prev->length == start;
+	if (!merge && !make_room (inode, before + after)) {
+		free_map_release (mnt, start, 1);
+		return false;
+	}
+	if (logged)
+		mnt->log_head = start + 1;
+	if (copy) {
+		uint8_t buf[DISK_SECTOR_SIZE];
+
+		cache_read (mnt, old, buf, 0, DISK_SECTOR_SIZE, data_source (inode));
+		cache_write (mnt, start, buf, 0, DISK_SECTOR_SIZE,
+				data_source (inode));
+	}
+
+	/* The run becomes what is left of it before IDX, the new
+	 * sector and what is left of it after IDX. */
+	if (merge) {
+		prev->length++;
+		if (after) {
+			inode->runs[pos].first++;
+			inode->runs[pos].start++;
+			inode->runs[pos].length--;
+		} else
+			remove_run (inode, pos);
+	} else {
+		if (before) {
+			inode->runs[pos].length = idx - first;
+			insert_run (inode, ++pos, idx, start, 1);
+		} else {
+			inode->runs[pos].start = start;
+			inode->runs[pos].length = 1;
+		}
+		if (after)
+			insert_run (inode, pos + 1, idx + 1, old + 1, end - idx - 1);
+	}
+	free_map_release (mnt, old, 1);
+	write_inode (inode);
+	return true;
+}
+
+/* Returns how many sectors to preallocate past the end of INODE
+ * when a write extends it: as many as it has, within
+ * [PREALLOC_MIN, PREALLOC_MAX], so that a file written by small
+ * appends grows by a few extents only.  The window left at the
+ * last close is given back by inode_trim().  Directories, which
+ * are not closed as files, get none. */
+#define PREALLOC_MIN 8
+#define PREALLOC_MAX 64
+static size_t
+prealloc_window (const struct inode *inode) {
+	size_t have = inode_sectors (inode);
+
+	if (inode->meta)
+		return 0;
+	return have < PREALLOC_MIN ? PREALLOC_MIN
+		: have > PREALLOC_MAX ? PREALLOC_MAX : have;
+}
+
+/* Moves the data of inline INODE to a sector of its own, keeping
+ * its length, so that it can grow past INLINE_MAX.  Returns false,
+ * leaving INODE as it was, if the sector could not be
+ * allocated. */
+static bool
+move_inline (struct inode *inode) {
+	uint8_t first[DISK_SECTOR_SIZE];
+
+	ASSERT (is_inline (inode));
+
+	memset (first, 0, sizeof first);
+	memcpy (first, inode->data.extents, inode->data.length);
+	memset (inode->data.extents, 0, sizeof inode->data.extents);
+	inode->data.flags &= ~INODE_INLINE;
+	if (inode->data.length > 0) {
+		if (!grow_sectors (inode, 1, 0)) {
+			memcpy (inode->data.extents, first, inode->data.length);
+			inode->data.flags |= INODE_INLINE;
+			write_inode (inode);
+			return false;
+		}
+		cache_write (inode->mnt, index_to_sector (inode, 0), first, 0,
+				DISK_SECTOR_SIZE, data_source (inode));
+	}
+	write_inode (inode);
+	return true;
+}
+
+/* Extends INODE to LENGTH bytes, which are zeros past the old end
+ * of file.  Sectors past the old end before sector FIRST, the first
+ * about to be written, become a hole; the rest are allocated, with
+ * up to EXTRA sectors more preallocated.  Returns false, leaving
+ * the length as it was, if the sectors could not be allocated. */
+static bool
+inode_grow (struct inode *inode, off_t length, size_t first, size_t extra) {
+	static char zeros[DISK_SECTOR_SIZE];
+	size_t need = bytes_to_sectors (length), have, i;
+
+	if (length <= inode->data.length)
+		return true;
+	if (is_inline (inode)) {
+		if (length <= INLINE_MAX) {
+			inode->data.length = length;
+			write_inode (inode);
+			return true;
+		}
+		if (!move_inline (inode))
+			return false;
+	}
+
+	have = inode_sectors (inode);
+	if (need > have) {
+		size_t hole = first > have ? (first < need ? first : need) - have : 0;
+
+		if (hole > 0 && !add_hole (inode, hole))
+			return false;
+		if (need > have + hole
+				&& !grow_sectors (inode, need - have - hole, extra))
+			return false;
+	}
+
+	/* Sectors past the old end, freshly allocated or preallocated,
+	 * hold whatever was there last. */
+	for (i = bytes_to_sectors (inode->data.length); i < need; i++) {
+		disk_sector_t sector = index_to_sector (inode, i);
+
+		if (sector != HOLE)
+			cache_write (inode->mnt, sector, zeros, 0, DISK_SECTOR_SIZE,
+					data_source (inode));
+	}
+	inode->data.length = length;
+	write_inode (inode);
+	return true;
+}
+
+/* Gives back the sectors allocated to INODE past its end.  Its
+ * data lock must be held for writing. */
+static void
+trim_sectors (struct inode *inode) {
+	size_t keep = kept_sectors (inode);
+	size_t have = inode_sectors (inode);
+
+	if (have <= keep)
+		return;
+	while (inode->data.extent_cnt > 0) {
+		struct run *last = &inode->runs[inode->data.extent_cnt - 1];
+		size_t cut;
+
+		if (last->first >= keep) {
+			if (last->start != HOLE)
+				free_map_release (inode->mnt, last->start, last->length);
+			inode->data.extent_cnt--;
+			continue;
+		}
+		cut = last->first + last->length - keep;
+		if (cut > 0) {
+			if (last->start != HOLE)
+				free_map_release (inode->mnt, last->start + last->length - cut,
+						cut);
+			last->length -= cut;
+		}
+		break;
+	}
+	write_inode (inode);
+}
+
+/* Releases the data sectors and indirect block of INODE, and the
+ * clusters of a compressed one. */
+static void
+free_blocks (struct inode *inode) {
+	size_t i;
+
+	if (is_compressed (inode))
+		for (i = 0; i < cluster_cnt (inode); i++) {
+			struct cluster c;
+
+			get_cluster (inode, i, &c);
+			if (c.sectors > 0)
+				free_map_release (inode->mnt, c.start, c.sectors);
+		}
+	for (i = 0; i < inode->data.extent_cnt; i++)
+		if (inode->runs[i].start != HOLE)
+			free_map_release (inode->mnt, inode->runs[i].start,
+					inode->runs[i].length);
+	if (inode->data.indirect != 0)
+		free_map_release (inode->mnt, inode->data.indirect, 1);
+}
+
+/* Delayed allocation.
+ *
+ * A write that extends a regular file of a write-behind file system
+ * past its allocated sectors allocates none for the new data.  The
+ * inode keeps the data in a buffer of up to DELAY_MAX sectors
+ * instead, over a hole that its extents end in, so that a crash
+ * leaves zeros there.  The sectors are allocated only when the
+ * buffer is flushed, by delay_flush(), in one run if the free space
+ * allows: once a write goes past the buffer, before the sectors are
+ * needed otherwise, as the file is closed, and once a second by the
+ * flush daemon through inode_flush_delayed().  Files that grow side
+ * by side thus each get long runs, rather than sectors interleaved
+ * with each other's.
+ *
+ * The write that puts sectors in the buffer reserves free sectors
+ * for them, and one more for the indirect block if the inode has
+ * none, and the flush allocates from those.  A write that finds too
+ * few free allocates at once instead, so that it comes up short as
+ * any write does on a full disk, rather than being taken and lost
+ * later.  A flush can still fail if the extent table fills up or
+ * memory is short.  The data then stays in the buffer; a close that
+ * cannot flush it keeps the inode open so that the flush daemon
+ * retries, and fsync() reports it.
+ *
+ * At most DELAY_INODES inodes have a buffer at once; the writes to
+ * others allocate as they go.  DELAY_LOCK guards DELAYED_INODES and
+ * DELAYED_CNT, and an inode's data lock guards its buffer. */
+#define DELAY_PAGES 16
+#define DELAY_MAX (DELAY_PAGES * PGSIZE / DISK_SECTOR_SIZE)
+#define DELAY_INODES 4
+static struct list delayed_inodes;
+static size_t delayed_cnt;
+static struct lock delay_lock;
+
+/* Returns true if sector IDX of INODE is in its delayed allocation
+ * buffer. */
+static inline bool
+is_delayed (const struct inode *inode, size_t idx) {
+	return inode->delay_buf != NULL && idx >= inode->delay_first
+		&& idx < inode->delay_first + inode->delay_cnt;
+}
+
+/* Returns the buffered data of sector IDX of INODE, which is
+ * delayed. */
+static inline uint8_t *
+delay_sector (const struct inode *inode, size_t idx) {
+	return inode->delay_buf + (idx - inode->delay_first) * DISK_SECTOR_SIZE;
+}
+
+/* Frees the delayed allocation buffer of INODE, if it has one,
+ * along with the data in it and the sectors reserved for it. */
+static void
+delay_free (struct inode *inode) {
+	if (inode->delay_buf == NULL)
+		return;
+	if (inode->delay_resv > 0)
+		free_map_unreserve (inode->mnt, inode->delay_resv);
+	inode->delay_resv = 0;
+	inode->delay_stuck = false;
+
+	/* The reference that inode_trim() kept goes too.  The caller
+	 * holds one of its own, so it is not the last. */
+	if (inode->delay_held) {
+		inode->delay_held = false;
+		spin_lock (&inode->open_cnt_lock);
+		ASSERT (inode->open_cnt > 1);
+		inode->open_cnt--;
+		spin_unlock (&inode->open_cnt_lock);
+	}
+	lock_acquire (&delay_lock);
+	list_remove (&inode->delay_elem);
+	delayed_cnt--;
+	lock_release (&delay_lock);
+	palloc_free_multiple (inode->delay_buf, DELAY_PAGES);
+	inode->delay_buf = NULL;
+}
+
+/* Allocates the sectors in the delayed allocation buffer of INODE
+ * from those reserved for them, in as few runs as the free space
+ * allows, writes their data to them and frees the buffer.  Returns
+ * false, keeping the sectors not allocated in the buffer, if the
+ * extent table is full or memory is short.  INODE's data lock must
+ * be held for writing, inside a journal handle. */
+static bool
+delay_flush (struct inode *inode) {
+	size_t idx, end;
+
+	if (inode->delay_buf == NULL)
+		return true;
+	idx = inode->delay_first;
+	end = idx + inode->delay_cnt;
+	inode->delay_claim = true;
+	while (idx < end) {
+		struct run *run;
+		size_t stop;
+
+		/* Room for the runs fill_hole() may split the hole into is
+		 * made first, so that it never gives sectors back once it
+		 * has them. */
+		if (!make_room (inode, 2) || !fill_hole (inode, idx, end - idx)) {
+			inode->delay_claim = false;
+			inode->delay_stuck = true;
+			memmove (inode->delay_buf, delay_sector (inode, idx),
+					(end - idx) * DISK_SECTOR_SIZE);
+			memset (inode->delay_buf + (end - idx) * DISK_SECTOR_SIZE, 0,
+					(DELAY_MAX - (end - idx)) * DISK_SECTOR_SIZE);
+			inode->delay_first = idx;
+			inode->delay_cnt = end - idx;
+			return false;
+		}
+		run = &inode->runs[find_run (inode, idx)];
+		stop = run->first + run->length < end ? run->first + run->length : end;
+		for (; idx < stop; idx++)
+			cache_write (inode->mnt, run->start + (idx - run->first),
+					delay_sector (inode, idx), 0, DISK_SECTOR_SIZE,
+					data_source (inode));
+	}
+	inode->delay_claim = false;
+	delay_free (inode);
+	return true;
+}
+
+/* Extends INODE to OFFSET + SIZE bytes for a write of SIZE bytes at
+ * OFFSET, putting the new sectors in its delayed allocation buffer,
+ * with a hole before them if the write starts past them.  A buffer
+ * that the write does not fit in is flushed first and a new one
+ * started.  Returns false, for the caller to allocate the sectors,
+ * if they cannot be delayed.  INODE's data lock must be held for
+ * writing, inside a journal handle. */
+static bool
+delay_grow (struct inode *inode, off_t offset, off_t size) {
+	size_t first = offset / DISK_SECTOR_SIZE;
+	size_t need = bytes_to_sectors (offset + size);
+	size_t have, end, resv = 0;
+
+	if (!inode->mnt->write_behind || inode->meta || is_inline (inode)
+			|| inode_is_symlink (inode))
+		return false;
+	if (inode->delay_buf != NULL
+			&& (need > inode->delay_first + DELAY_MAX
+				|| inode->delay_first + inode->delay_cnt != inode_sectors (inode))
+			&& !delay_flush (inode))
+		return false;
+
+	if (inode->delay_buf == NULL) {
+		uint8_t *buf;
+		bool room;
+
+		/* The buffer starts where the allocated sectors end, so any
+		 * preallocated past the end of file go. */
+		if (inode_sectors (inode) > bytes_to_sectors (inode->data.length))
+			trim_sectors (inode);
+		have = inode_sectors (inode);
+		if (need <= have || need - (first > have ? first : have) > DELAY_MAX)
+			return false;
+		buf = palloc_get_multiple (PAL_ZERO, DELAY_PAGES);
+		if (buf == NULL)
+			return false;
+		lock_acquire (&delay_lock);
+		room = delayed_cnt < DELAY_INODES;
+		if (room) {
+			delayed_cnt++;
+			list_push_back (&delayed_inodes, &inode->delay_elem);
+		}
+		lock_release (&delay_lock);
+		if (!room) {
+			palloc_free_multiple (buf, DELAY_PAGES);
+			return false;
+		}
+		inode->delay_buf = buf;
+		inode->delay_first = first > have ? first : have;
+		inode->delay_cnt = 0;
+		resv = inode->data.indirect == 0;
+	}
+
+	end = inode->delay_first + inode->delay_cnt;
+	if (need > end)
+		resv += need - end;
+	if (resv > 0 && !free_map_reserve (inode->mnt, resv)) {
+		if (inode->delay_cnt == 0)
+			delay_free (inode);
+		return false;
+	}
+	inode->delay_resv += resv;
+
+	have = inode_sectors (inode);
+	if (need > have && !add_hole (inode, need - have)) {
+		inode->delay_resv -= resv;
+		free_map_unreserve (inode->mnt, resv);
+		if (inode->delay_cnt == 0)
+			delay_free (inode);
+		return false;
+	}
+	if (need > inode->delay_first + inode->delay_cnt)
+		inode->delay_cnt = need - inode->delay_first;
+	inode->data.length = offset + size;
+	write_inode (inode);
+	return true;
 }
 
-/* List of open inodes, so that opening a single inode twice
- * returns the same `struct inode'. */
-static struct list open_inodes;
+/* Table of open inodes, keyed on file system and sector, so that
+ * opening a single inode twice returns the same `struct inode'.
+ * Lookups hold OPEN_INODES_LOCK for reading, so any number of them
+ * may run at once; inserting and removing hold it for writing.
+ *
+ * The last close of an inode that is not removed keeps it in the
+ * table, at the front of CLOSED_INODES, so that reopening a hot
+ * file does not read its disk inode again.  Past CLOSED_MAX such
+ * inodes, the least recently closed is freed.  Both are guarded
+ * by OPEN_INODES_LOCK too. */
+static struct hash open_inodes;
+static struct rwlock open_inodes_lock;
+static struct list closed_inodes;
+static size_t closed_cnt;
+#define CLOSED_MAX 16
+
+/* Cache of struct inode.  A freed inode's locks are all released,
+ * so they stay initialized from one use of a slot to the next. */
+static struct kmem_cache *inode_cache;
+
+/* Constructs the inode slot OBJ. */
+static void
+inode_ctor (void *obj) {
+	struct inode *inode = obj;
+
+	spin_init (&inode->open_cnt_lock);
+	rwlock_init (&inode->data_lock);
+	rwlock_init (&inode->dir_lock);
+	lock_init (&inode->cbuf_lock);
+}
+
+/* Returns a hash of the file system and sector of inode E. */
+static uint64_t
+inode_hash (const struct hash_elem *e_, void *aux UNUSED) {
+	const struct inode *e = hash_entry (e_, struct inode, elem);
+
+	return hash_u64 (e->sector ^ hash_u64 ((uintptr_t) e->mnt));
+}
+
+/* Returns true if inode A is in a lower sector than B, on the same
+ * file system, or on a lower file system. */
+static bool
+inode_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct inode *a = hash_entry (a_, struct inode, elem);
+	const struct inode *b = hash_entry (b_, struct inode, elem);
+
+	if (a->mnt != b->mnt)
+		return (uintptr_t) a->mnt < (uintptr_t) b->mnt;
+	return a->sector < b->sector;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) {
-	list_init (&open_inodes);
+	if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+		PANIC ("inode table: out of memory");
+	rwlock_init (&open_inodes_lock);
+	list_init (&closed_inodes);
+	list_init (&delayed_inodes);
+	lock_init (&delay_lock);
+	inode_cache = kmem_cache_create ("inode", sizeof (struct inode), 0,
+			inode_ctor);
+	if (inode_cache == NULL)
+		PANIC ("inode cache creation failed");
+}
+
+/* Returns the inode in the table for SECTOR of MNT, or a null
+ * pointer.  OPEN_INODES_LOCK must be held. */
+static struct inode *
+find_inode (struct mount *mnt, disk_sector_t sector) {
+	struct inode key;
+	struct hash_elem *e;
+
+	key.mnt = mnt;
+	key.sector = sector;
+	e = hash_find (&open_inodes, &key.elem);
+	return e != NULL ? hash_entry (e, struct inode, elem) : NULL;
 }
 
-/* Initializes an inode with LENGTH bytes of data and
- * writes the new inode to sector SECTOR on the file system
- * disk.
+/* Returns the open inode for SECTOR of MNT with its open count
+ * bumped, or a null pointer if SECTOR is not open.
+ * OPEN_INODES_LOCK must be held, for writing if CLOSED, in which
+ * case an inode kept after its last close is opened again too. */
+static struct inode *
+find_open_inode (struct mount *mnt, disk_sector_t sector, bool closed) {
+	struct inode *inode = find_inode (mnt, sector);
+	bool open;
+
+	if (inode == NULL)
+		return NULL;
+	spin_lock (&inode->open_cnt_lock);
+	open = inode->open_cnt > 0;
+	if (open || closed)
+		inode->open_cnt++;
+	spin_unlock (&inode->open_cnt_lock);
+	if (open)
+		return inode;
+	if (!closed)
+		return NULL;
+	list_remove (&inode->closed_elem);
+	closed_cnt--;
+	return inode;
+}
+
+/* Frees INODE, which is out of the table. */
+static void
+inode_free (struct inode *inode) {
+	delay_free (inode);
+	free (inode->runs);
+	free (inode->cbuf);
+	kmem_cache_free (inode_cache, inode);
+}
+
+/* Initializes an inode of TYPE with LENGTH bytes of data and
+ * writes the new inode to sector SECTOR on the disk of file system
+ * MNT.
  * Returns true if successful.
  * Returns false if memory or disk allocation fails. */
 bool
-inode_create (disk_sector_t sector, off_t length) {
-	struct inode_disk *disk_inode = NULL;
-	bool success = false;
+inode_create (struct mount *mnt, disk_sector_t sector, off_t length,
+		enum inode_type type) {
+	struct inode *inode;
+	bool success;
 
 	ASSERT (length >= 0);
 
 	/* If this assertion fails, the inode structure is not exactly
 	 * one sector in size, and you should fix that. */
-	ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
-
-	disk_inode = calloc (1, sizeof *disk_inode);
-	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
-		disk_inode->length = length;
-		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
-			success = true; 
-		} 
-		free (disk_inode);
-	}
+	ASSERT (sizeof (struct inode_disk) == DISK_SECTOR_SIZE);
+
+	/* Only the extents and the on-disk data of this inode are
+	 * used, so it is not set up further. */
+	inode = calloc (1, sizeof *inode);
+	if (inode == NULL)
+		return false;
+	inode->mnt = mnt;
+	inode->sector = sector;
+	inode->data.magic = INODE_MAGIC;
+	if (length <= INLINE_MAX)
+		inode->data.flags |= INODE_INLINE;
+	if (type == INODE_TYPE_DIR)
+		inode->data.flags |= INODE_DIR;
+	else if (type == INODE_TYPE_SYMLINK)
+		inode->data.flags |= INODE_SYMLINK;
+	journal_begin ();
+	success = inode_grow (inode, length, bytes_to_sectors (length), 0);
+	if (success)
+		write_inode (inode);
+	else
+		free_blocks (inode);
+	journal_end ();
+	free (inode->runs);
+	free (inode);
 	return success;
 }
 
-/* Reads an inode from SECTOR
+/* Returns true if SECTOR of MNT holds an inode, so that a disk
+ * can be told to hold a file system. */
+bool
+inode_probe (struct mount *mnt, disk_sector_t sector) {
+	struct inode_disk data;
+
+	cache_read (mnt, sector, &data, 0, DISK_SECTOR_SIZE, DISK_SRC_META);
+	return data.magic == INODE_MAGIC && data.extent_cnt <= MAX_EXTENTS;
+}
+
+/* Reads an inode from SECTOR of file system MNT
  * and returns a `struct inode' that contains it.
  * Returns a null pointer if memory allocation fails. */
 struct inode *
-inode_open (disk_sector_t sector) {
-	struct list_elem *e;
+inode_open (struct mount *mnt, disk_sector_t sector) {
 	struct inode *inode;
 
 	/* Check whether this inode is already open. */
-	for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-			e = list_next (e)) {
-		inode = list_entry (e, struct inode, elem);
-		if (inode->sector == sector) {
-			inode_reopen (inode);
-			return inode; 
-		}
-	}
+	rwlock_acquire_read (&open_inodes_lock);
+	inode = find_open_inode (mnt, sector, false);
+	rwlock_release_read (&open_inodes_lock);
+	if (inode != NULL)
+		return inode;
+
+	/* Check again as a writer: someone may have opened it since, or
+	 * it may have been kept after its last close. */
+	rwlock_acquire_write (&open_inodes_lock);
+	inode = find_open_inode (mnt, sector, true);
+	if (inode != NULL)
+		goto done;
 
 	/* Allocate memory. */
-	inode = malloc (sizeof *inode);
+	inode = kmem_cache_alloc (inode_cache);
 	if (inode == NULL)
-		return NULL;
+		goto done;
 
 	/* Initialize. */
-	list_push_front (&open_inodes, &inode->elem);
+	inode->mnt = mnt;
 	inode->sector = sector;
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
+	inode->meta = false;
+	inode->write_gen = 0;
+	inode->runs = NULL;
+	inode->run_cap = 0;
+	inode->delay_buf = NULL;
+	inode->delay_resv = 0;
+	inode->delay_claim = false;
+	inode->delay_stuck = false;
+	inode->delay_held = false;
+	inode->cbuf = NULL;
+	cache_read (inode->mnt, inode->sector, &inode->data, 0, DISK_SECTOR_SIZE,
+			DISK_SRC_META);
+	if ((inode->data.flags & INODE_CKSUM) != 0
+			&& inode->data.checksum != inode_checksum (&inode->data)) {
+		printf ("inode %"PRDSNu": bad checksum\n", sector);
+		inode_free (inode);
+		inode = NULL;
+	} else if (!read_runs (inode)) {
+		inode_free (inode);
+		inode = NULL;
+	} else
+		hash_insert (&open_inodes, &inode->elem);
+
+done:
+	rwlock_release_write (&open_inodes_lock);
 	return inode;
 }
 
+/* Queues the inode in SECTOR of MNT to be read into the sector
+ * cache in the background, unless it is in memory already, so that
+ * opening it soon finds it there. */
+void
+inode_prefetch (struct mount *mnt, disk_sector_t sector) {
+	bool known;
+
+	rwlock_acquire_read (&open_inodes_lock);
+	known = find_inode (mnt, sector) != NULL;
+	rwlock_release_read (&open_inodes_lock);
+	if (!known)
+		cache_readahead (mnt, sector, DISK_SRC_META);
+}
+
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode) {
-	if (inode != NULL)
+	if (inode != NULL) {
+		spin_lock (&inode->open_cnt_lock);
 		inode->open_cnt++;
+		spin_unlock (&inode->open_cnt_lock);
+	}
 	return inode;
 }
 
@@ -143,29 +1562,519 @@ inode_get_inumber (const struct inode *inode) {
 	return inode->sector;
 }
 
+/* Returns the file system INODE is on. */
+struct mount *
+inode_get_mount (const struct inode *inode) {
+	return inode->mnt;
+}
+
+/* Returns a number that changes whenever INODE's data is written,
+ * so that what was computed from the data can be checked for
+ * staleness while INODE stays open. */
+unsigned
+inode_write_gen (const struct inode *inode) {
+	return inode->write_gen;
+}
+
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode) {
+	return (inode->data.flags & INODE_DIR) != 0;
+}
+
+/* Returns true if INODE is a symbolic link. */
+bool
+inode_is_symlink (const struct inode *inode) {
+	return (inode->data.flags & INODE_SYMLINK) != 0;
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode) {
+	return inode->removed;
+}
+
+/* Allocates the sectors that INODE delays and gives back its
+ * preallocation window, as a file of it is closed. */
+void
+inode_trim (struct inode *inode) {
+	bool window;
+
+	/* Checked first, so that closing a file that was not extended
+	 * opens no handle. */
+	rwlock_acquire_read (&inode->data_lock);
+	window = inode_sectors (inode) > kept_sectors (inode)
+		|| inode->delay_buf != NULL;
+	rwlock_release_read (&inode->data_lock);
+	if (!window)
+		return;
+	journal_begin ();
+	rwlock_acquire_write (&inode->data_lock);
+
+	/* The data of a removed file is not needed.  Data that cannot
+	 * be given sectors keeps the inode open, as the last close
+	 * would free it, until the flush daemon manages to. */
+	if (inode->removed)
+		delay_free (inode);
+	else if (!delay_flush (inode) && !inode->delay_held) {
+		inode->delay_held = true;
+		inode_reopen (inode);
+	}
+	trim_sectors (inode);
+	rwlock_release_write (&inode->data_lock);
+	journal_end ();
+}
+
+/* Allocates the sectors that every inode delays, so that a flush
+ * of the sector cache that follows writes them to disk.  Run by the
+ * flush daemon and before a sync.  Returns false if the data of
+ * some inode still could not be given sectors. */
+bool
+inode_flush_delayed (void) {
+	bool success = true;
+	size_t cnt;
+
+	lock_acquire (&delay_lock);
+	for (cnt = list_size (&delayed_inodes); cnt > 0; cnt--) {
+		struct list_elem *e;
+		struct inode *inode;
+
+		if (list_empty (&delayed_inodes))
+			break;
+
+		/* Sent to the back, so that an inode whose sectors find no
+		 * room is passed over until the next time.  An inode with a
+		 * buffer is open, by a file or by inode_trim() holding it. */
+		e = list_pop_front (&delayed_inodes);
+		list_push_back (&delayed_inodes, e);
+		inode = inode_reopen (list_entry (e, struct inode, delay_elem));
+		lock_release (&delay_lock);
+
+		journal_begin ();
+		rwlock_acquire_write (&inode->data_lock);
+		if (inode->removed)
+			delay_free (inode);
+		else if (!delay_flush (inode))
+			success = false;
+		rwlock_release_write (&inode->data_lock);
+		journal_end ();
+		inode_close (inode);
+		lock_acquire (&delay_lock);
+	}
+	lock_release (&delay_lock);
+	return success;
+}
+
+/* Returns true if the last attempt to give sectors to data written
+ * to INODE failed, so that the data is only in memory. */
+bool
+inode_is_stuck (struct inode *inode) {
+	bool stuck;
+
+	rwlock_acquire_read (&inode->data_lock);
+	stuck = inode->delay_stuck;
+	rwlock_release_read (&inode->data_lock);
+	return stuck;
+}
+
+/* Makes INODE at least LENGTH bytes long, as writing zeros past
+ * its end would, and allocates every sector of its first LENGTH
+ * bytes that is not yet, holes included, in runs as long as the
+ * free space allows, so that the writes to come need no allocation
+ * and land in few extents.  A compressed file is only extended, as
+ * what its clusters take is not known until they are written.
+ * Returns false if the disk or the extent table fills up or writes
+ * are denied, keeping what was allocated by then. */
+bool
+inode_allocate (struct inode *inode, off_t length) {
+	size_t need = bytes_to_sectors (length), idx = 0;
+	bool success;
+
+	journal_begin ();
+	rwlock_acquire_write (&inode->data_lock);
+	success = inode->deny_write_cnt == 0 && delay_flush (inode);
+	if (success && is_compressed (inode))
+		compressed_grow (inode, length);
+	else if (success)
+		success = inode_grow (inode, length, 0, 0);
+	if (success && !is_inline (inode) && !is_compressed (inode)) {
+		if (need > inode_sectors (inode))
+			need = inode_sectors (inode);
+		while (success && idx < need) {
+			struct run *run = &inode->runs[find_run (inode, idx)];
+			size_t end = run->first + run->length;
+
+			if (run->start != HOLE)
+				idx = end;
+			else
+				success = fill_hole (inode, idx, (end < need ? end : need) - idx);
+		}
+	}
+	inode->write_gen++;
+	rwlock_release_write (&inode->data_lock);
+	journal_end ();
+	return success;
+}
+
+/* Sets the length of INODE to LENGTH bytes.  Shrinking gives back
+ * every sector past the new end at once; growing adds a hole, read
+ * as zeros and allocated as written.  Returns false if writes are
+ * denied or the extent table is full. */
+bool
+inode_truncate (struct inode *inode, off_t length) {
+	static char zeros[DISK_SECTOR_SIZE];
+	bool success = true;
+
+	journal_begin ();
+	rwlock_acquire_write (&inode->data_lock);
+	if (inode->deny_write_cnt != 0 || !delay_flush (inode))
+		success = false;
+	else if (length > inode->data.length && is_compressed (inode))
+		compressed_grow (inode, length);
+	else if (length > inode->data.length)
+		success = inode_grow (inode, length, bytes_to_sectors (length), 0);
+	else if (length < inode->data.length) {
+		/* Past the end stays zeros, for when the file grows again. */
+		if (is_inline (inode))
+			memset ((uint8_t *) inode->data.extents + length, 0,
+					inode->data.length - length);
+		else if (is_compressed (inode))
+			success = compressed_shrink (inode, length);
+		else if (length % DISK_SECTOR_SIZE != 0) {
+			disk_sector_t sector = byte_to_sector (inode, length);
+
+			/* A sector shared with a clone is copied first. */
+			if (sector != HOLE && inode->shared
+					&& free_map_shared (inode->mnt, sector, 1)) {
+				success = move_sector (inode, length / DISK_SECTOR_SIZE, true);
+				sector = byte_to_sector (inode, length);
+			}
+			if (success && sector != HOLE)
+				cache_write (inode->mnt, sector, zeros,
+						length % DISK_SECTOR_SIZE,
+						DISK_SECTOR_SIZE - length % DISK_SECTOR_SIZE,
+						data_source (inode));
+		}
+		if (success) {
+			inode->data.length = length;
+			if (!is_inline (inode))
+				trim_sectors (inode);
+			write_inode (inode);
+		}
+	}
+	inode->write_gen++;
+	rwlock_release_write (&inode->data_lock);
+	journal_end ();
+	return success;
+}
+
+/* Files of at most DEFRAG_MAX sectors are defragmented, a
+ * DEFRAG_CHUNK of sectors per hold of the data lock. */
+#define DEFRAG_MAX 2048
+#define DEFRAG_CHUNK 8
+
+/* Returns the number of sectors of INODE for inode_defrag() to
+ * move: all of those of a regular file in more than one place on
+ * disk, uncompressed, with no hole, delayed allocation,
+ * preallocation window or sectors shared with a clone, which moving
+ * would copy, if there are at most DEFRAG_MAX.  Returns 0 for any other inode.
+ * Its data lock must be held. */
+static size_t
+defrag_sectors (const struct inode *inode) {
+	size_t cnt = inode->data.extent_cnt, have = inode_sectors (inode), i;
+	bool split = false;
+
+	if (inode->meta || inode->removed || is_inline (inode) || inode->shared
+			|| (inode->data.flags & (INODE_DIR | INODE_COMPRESS)) != 0
+			|| cnt < 2 || inode->delay_buf != NULL || have > DEFRAG_MAX
+			|| have != bytes_to_sectors (inode->data.length))
+		return 0;
+	for (i = 0; i < cnt; i++) {
+		if (inode->runs[i].start == HOLE)
+			return 0;
+		if (i > 0 && inode->runs[i].start
+				!= inode->runs[i - 1].start + inode->runs[i - 1].length)
+			split = true;
+	}
+	return split ? have : 0;
+}
+
+/* Returns true if INODE still has the CNT runs in RUNS and has not
+ * been written since write generation GEN.  Its data lock must be
+ * held. */
+static bool
+defrag_unchanged (const struct inode *inode, const struct run *runs,
+		size_t cnt, unsigned gen) {
+	return !inode->removed && inode->write_gen == gen
+		&& inode->delay_buf == NULL && inode->data.extent_cnt == cnt
+		&& !memcmp (inode->runs, runs, cnt * sizeof *runs);
+}
+
+/* Moves the data of INODE, if it lies in more than one place on
+ * disk, into one run of free sectors, so that it is read in one
+ * sweep.  Returns the number of sectors moved, 0 if none.
+ *
+ * The data is copied through the sector cache a DEFRAG_CHUNK of
+ * sectors at a time, each under the data lock held for reading so
+ * that readers carry on, and defrag_throttle() is called before
+ * each chunk.  A write, or any other change to the runs, meanwhile
+ * gives up the move.  The copy is written back before the runs are
+ * swapped and the old ones freed in one journal handle, so that the
+ * file is found wholly in one place or the other after a crash.  A
+ * crash before then leaves the new run allocated but unused, as it
+ * would a preallocation window. */
+size_t
+inode_defrag (struct inode *inode) {
+	struct mount *mnt = inode->mnt;
+	uint8_t buf[DISK_SECTOR_SIZE];
+	struct run *old = NULL;
+	size_t sectors, cnt = 0, idx, i;
+	disk_sector_t start;
+	unsigned gen = 0;
+	bool same;
+
+	rwlock_acquire_read (&inode->data_lock);
+	sectors = defrag_sectors (inode);
+	if (sectors > 0) {
+		cnt = inode->data.extent_cnt;
+		old = malloc (cnt * sizeof *old);
+		if (old != NULL)
+			memcpy (old, inode->runs, cnt * sizeof *old);
+		gen = inode->write_gen;
+	}
+	rwlock_release_read (&inode->data_lock);
+	if (old == NULL)
+		return 0;
+
+	journal_begin ();
+	same = free_map_allocate (mnt, sectors, &start);
+	journal_end ();
+	if (!same) {
+		free (old);
+		return 0;
+	}
+
+	for (idx = 0; same && idx < sectors; idx += DEFRAG_CHUNK) {
+		if (!defrag_throttle (mnt)) {
+			same = false;
+			break;
+		}
+		rwlock_acquire_read (&inode->data_lock);
+		same = defrag_unchanged (inode, old, cnt, gen);
+		for (i = idx; same && i < sectors && i < idx + DEFRAG_CHUNK; i++) {
+			cache_read (mnt, index_to_sector (inode, i), buf, 0,
+					DISK_SECTOR_SIZE, DISK_SRC_DEFRAG);
+			cache_write (mnt, start + i, buf, 0, DISK_SECTOR_SIZE,
+					DISK_SRC_DEFRAG);
+		}
+		rwlock_release_read (&inode->data_lock);
+	}
+	if (same)
+		cache_flush (mnt);
+
+	journal_begin ();
+	rwlock_acquire_write (&inode->data_lock);
+	same = same && defrag_unchanged (inode, old, cnt, gen);
+	if (same) {
+		for (i = 0; i < cnt; i++)
+			free_map_release (mnt, old[i].start, old[i].length);
+		if (inode->data.indirect != 0) {
+			free_map_release (mnt, inode->data.indirect, 1);
+			inode->data.indirect = 0;
+		}
+		inode->data.extent_cnt = 1;
+		inode->runs[0].first = 0;
+		inode->runs[0].start = start;
+		inode->runs[0].length = sectors;
+		write_inode (inode);
+	}
+	rwlock_release_write (&inode->data_lock);
+	if (!same)
+		free_map_release (mnt, start, sectors);
+	journal_end ();
+	free (old);
+	return same ? sectors : 0;
+}
+
+/* Makes DST, an empty regular file, a clone of SRC, a regular file
+ * on the same file system, neither compressed: DST gets the length
+ * and extents of SRC, and each sector of them a reference more, so
+ * that no data is copied until either file writes a sector, which
+ * move_sector() then copies.  The preallocation window of SRC is
+ * given back first, so it is not shared.  Returns false if the
+ * files are not such, or the reference counts, the disk or memory
+ * are short. */
+bool
+inode_clone (struct inode *dst, struct inode *src) {
+	struct inode *lo = dst->sector < src->sector ? dst : src;
+	struct inode *hi = lo == dst ? src : dst;
+	size_t cnt = 0, i;
+	bool success;
+
+	if (dst == src || dst->mnt != src->mnt)
+		return false;
+
+	/* Both data locks, in sector order. */
+	journal_begin ();
+	rwlock_acquire_write (&lo->data_lock);
+	rwlock_acquire_write (&hi->data_lock);
+	success = !src->meta && !dst->meta && dst->deny_write_cnt == 0
+		&& ((src->data.flags | dst->data.flags)
+			& (INODE_DIR | INODE_SYMLINK | INODE_COMPRESS)) == 0
+		&& dst->data.length == 0 && inode_sectors (dst) == 0
+		&& dst->delay_buf == NULL && delay_flush (src);
+	if (success && is_inline (src))
+		memcpy (dst->data.extents, src->data.extents,
+				sizeof dst->data.extents);
+	else if (success) {
+		if (inode_sectors (src) > bytes_to_sectors (src->data.length))
+			trim_sectors (src);
+		cnt = src->data.extent_cnt;
+		success = make_room (dst, cnt);
+		for (i = 0; success && i < cnt; i++)
+			if (src->runs[i].start != HOLE
+					&& !free_map_share (src->mnt, src->runs[i].start,
+						src->runs[i].length)) {
+				while (i-- > 0)
+					if (src->runs[i].start != HOLE)
+						free_map_release (src->mnt, src->runs[i].start,
+								src->runs[i].length);
+				success = false;
+			}
+	}
+	if (success) {
+		if (!is_inline (src)) {
+			dst->data.flags &= ~INODE_INLINE;
+			memcpy (dst->runs, src->runs, cnt * sizeof *dst->runs);
+			dst->data.extent_cnt = cnt;
+			src->shared = dst->shared = true;
+		}
+		dst->data.length = src->data.length;
+		dst->write_gen++;
+		write_inode (dst);
+	}
+	rwlock_release_write (&hi->data_lock);
+	rwlock_release_write (&lo->data_lock);
+	journal_end ();
+	return success;
+}
+
+/* Marks the contents of INODE as file system metadata, which the
+ * journal logs along with the inode itself. */
+void
+inode_set_meta (struct inode *inode) {
+	inode->meta = true;
+}
+
+/* Makes INODE keep its data compressed from now on, as described
+ * under "Transparent compression" above, if it is an empty regular
+ * file, not cloned and not being run.  Returns true if it does so,
+ * or did already. */
+bool
+inode_set_compressed (struct inode *inode) {
+	bool success;
+
+	journal_begin ();
+	rwlock_acquire_write (&inode->data_lock);
+	success = is_compressed (inode)
+		|| (!inode->meta && !inode->shared && inode->deny_write_cnt == 0
+			&& (inode->data.flags & (INODE_DIR | INODE_SYMLINK)) == 0
+			&& inode->data.length == 0 && inode->delay_buf == NULL);
+	if (success && !is_compressed (inode)) {
+		/* Gives back any preallocation window, for the map. */
+		trim_sectors (inode);
+		inode->data.flags &= ~INODE_INLINE;
+		inode->data.flags |= INODE_COMPRESS;
+		memset (inode->data.extents, 0, sizeof inode->data.extents);
+		inode->write_gen++;
+		write_inode (inode);
+	}
+	rwlock_release_write (&inode->data_lock);
+	journal_end ();
+	return success;
+}
+
+/* Returns the sector of the inode that indexes directory INODE,
+ * or 0 if it has none. */
+disk_sector_t
+inode_get_index (const struct inode *inode) {
+	return inode->data.index;
+}
+
+/* Records that the inode in SECTOR, or none if SECTOR is 0,
+ * indexes directory INODE.  The index inode is removed along with
+ * INODE. */
+void
+inode_set_index (struct inode *inode, disk_sector_t sector) {
+	rwlock_acquire_write (&inode->data_lock);
+	inode->data.index = sector;
+	write_inode (inode);
+	rwlock_release_write (&inode->data_lock);
+}
+
+/* Returns the lock that guards INODE's directory entries.  Only
+ * meaningful if INODE is a directory. */
+struct rwlock *
+inode_dir_lock (struct inode *inode) {
+	return &inode->dir_lock;
+}
+
 /* Closes INODE and writes it to disk.
- * If this was the last reference to INODE, frees its memory.
- * If INODE was also a removed inode, frees its blocks. */
+ * If this was the last reference to INODE, keeps it among the
+ * recently closed inodes, or frees its memory and, if INODE was
+ * removed, its blocks. */
 void
 inode_close (struct inode *inode) {
+	struct inode *victim = NULL;
+	bool last;
+
 	/* Ignore null pointer. */
 	if (inode == NULL)
 		return;
 
-	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0) {
-		/* Remove from inode list and release lock. */
-		list_remove (&inode->elem);
-
-		/* Deallocate blocks if removed. */
-		if (inode->removed) {
-			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
+	/* Release resources if this was the last opener.  Done as a
+	 * writer so that no lookup can reopen INODE meanwhile. */
+	rwlock_acquire_write (&open_inodes_lock);
+	spin_lock (&inode->open_cnt_lock);
+	last = --inode->open_cnt == 0;
+	spin_unlock (&inode->open_cnt_lock);
+	if (!last) {
+		rwlock_release_write (&open_inodes_lock);
+		return;
+	}
+	if (!inode->removed) {
+		/* Keep it, making room if need be. */
+		list_push_front (&closed_inodes, &inode->closed_elem);
+		if (++closed_cnt > CLOSED_MAX) {
+			victim = list_entry (list_pop_back (&closed_inodes),
+					struct inode, closed_elem);
+			closed_cnt--;
+			hash_delete (&open_inodes, &victim->elem);
 		}
+		rwlock_release_write (&open_inodes_lock);
+		if (victim != NULL)
+			inode_free (victim);
+		return;
+	}
+
+	/* Remove from inode table and release lock. */
+	hash_delete (&open_inodes, &inode->elem);
+	rwlock_release_write (&open_inodes_lock);
 
-		free (inode); 
+	/* Deallocate blocks. */
+	journal_begin ();
+	free_map_release (inode->mnt, inode->sector, 1);
+	free_blocks (inode);
+	if (inode->data.index != 0) {
+		struct inode *index = inode_open (inode->mnt, inode->data.index);
+
+		if (index != NULL) {
+			inode_remove (index);
+			inode_close (index);
+		}
 	}
+	journal_end ();
+	inode_free (inode);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -174,6 +2083,86 @@ void
 inode_remove (struct inode *inode) {
 	ASSERT (inode != NULL);
 	inode->removed = true;
+	/* Cached pages, and a cached plan if it is an executable, would
+	 * keep its blocks allocated. */
+	page_cache_drop (inode);
+	process_uncache (inode->mnt, inode);
+}
+
+/* Drops the cached pages of every open inode of MNT, and the plans
+ * of its executables, so that neither cache holds any of them
+ * open. */
+void
+inode_uncache (struct mount *mnt) {
+	struct inode **inodes;
+	struct hash_iterator i;
+	size_t cnt = 0, n;
+
+	process_uncache (mnt, NULL);
+	rwlock_acquire_read (&open_inodes_lock);
+	inodes = malloc (hash_size (&open_inodes) * sizeof *inodes);
+	if (inodes == NULL) {
+		rwlock_release_read (&open_inodes_lock);
+		return;
+	}
+	hash_first (&i, &open_inodes);
+	while (hash_next (&i)) {
+		struct inode *inode = hash_entry (hash_cur (&i), struct inode, elem);
+
+		if (inode->mnt == mnt && find_open_inode (mnt, inode->sector, false))
+			inodes[cnt++] = inode;
+	}
+	rwlock_release_read (&open_inodes_lock);
+
+	for (n = 0; n < cnt; n++) {
+		page_cache_drop (inodes[n]);
+		inode_close (inodes[n]);
+	}
+	free (inodes);
+}
+
+/* Returns the number of open inodes of MNT. */
+size_t
+inode_open_cnt (struct mount *mnt) {
+	struct hash_iterator i;
+	size_t cnt = 0;
+
+	rwlock_acquire_read (&open_inodes_lock);
+	hash_first (&i, &open_inodes);
+	while (hash_next (&i)) {
+		struct inode *inode = hash_entry (hash_cur (&i), struct inode, elem);
+
+		if (inode->mnt != mnt)
+			continue;
+		spin_lock (&inode->open_cnt_lock);
+		if (inode->open_cnt > 0)
+			cnt++;
+		spin_unlock (&inode->open_cnt_lock);
+	}
+	rwlock_release_read (&open_inodes_lock);
+	return cnt;
+}
+
+/* Frees the inodes of MNT kept after their last close, as MNT is
+ * unmounted.  None of its inodes may be open. */
+void
+inode_purge (struct mount *mnt) {
+	struct list_elem *e;
+
+	rwlock_acquire_write (&open_inodes_lock);
+	for (e = list_begin (&closed_inodes); e != list_end (&closed_inodes); ) {
+		struct inode *inode = list_entry (e, struct inode, closed_elem);
+
+		e = list_next (e);
+		if (inode->mnt == mnt) {
+			list_remove (&inode->closed_elem);
+			closed_cnt--;
+			hash_delete (&open_inodes, &inode->elem);
+			inode_free (inode);
+		}
+	}
+	rwlock_release_write (&open_inodes_lock);
+	ASSERT (inode_open_cnt (mnt) == 0);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -183,15 +2172,25 @@ off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
 
+	rwlock_acquire_read (&inode->data_lock);
+	if (is_inline (inode)) {
+		bytes_read = inline_span (inode, offset, size);
+		if (bytes_read > 0)
+			memcpy (buffer, (uint8_t *) inode->data.extents + offset,
+					bytes_read);
+		size = 0;
+	} else if (is_compressed (inode)) {
+		bytes_read = compressed_read (inode, buffer, size, offset);
+		size = 0;
+	}
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
 		disk_sector_t sector_idx = byte_to_sector (inode, offset);
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
-		off_t inode_left = inode_length (inode) - offset;
+		off_t inode_left = inode->data.length - offset;
 		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
 		int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -200,53 +2199,274 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+		if (is_delayed (inode, offset / DISK_SECTOR_SIZE))
+			memcpy (buffer + bytes_read,
+					delay_sector (inode, offset / DISK_SECTOR_SIZE) + sector_ofs,
+					chunk_size);
+		else if (sector_idx == HOLE)
+			memset (buffer + bytes_read, 0, chunk_size);
+		else
+			cache_read (inode->mnt, sector_idx, buffer + bytes_read, sector_ofs,
+					chunk_size, data_source (inode));
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
+	rwlock_release_read (&inode->data_lock);
 
 	return bytes_read;
 }
 
+/* Sectors of file data in each page of a direct transfer. */
+#define PAGE_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Returns true if the SIZE bytes of INODE at OFFSET, which are
+ * whole sectors within the file, can move straight between the
+ * disk and memory: those of a file kept uncompressed in sectors of
+ * a disk, and for a write, only those already allocated that stay in place.
+ * INODE's data lock must be held. */
+static bool
+direct_usable (const struct inode *inode, off_t offset, off_t size,
+		bool write) {
+	off_t ofs;
+
+	if (is_inline (inode) || is_compressed (inode)
+			|| inode->mnt->tmpfs != NULL)
+		return false;
+	if (!write)
+		return true;
+	if (inode->meta || inode->shared || logs_writes (inode)
+			|| offset + size > inode->data.length)
+		return false;
+	for (ofs = offset; ofs < offset + size; ofs += DISK_SECTOR_SIZE)
+		if (is_delayed (inode, ofs / DISK_SECTOR_SIZE)
+				|| byte_to_sector (inode, ofs) == HOLE)
+			return false;
+	return true;
+}
+
+/* Returns the number of disk requests that move SEC_CNT sectors of
+ * INODE from byte OFFSET to or from PAGES, one for each run of them
+ * consecutive on disk and within one page, and if REQS is nonnull,
+ * sets them up there.  A read gets sectors of a hole or awaiting
+ * allocation from memory instead, and then copies them in. */
+static size_t
+direct_runs (const struct inode *inode, void *const pages[], off_t offset,
+		size_t sec_cnt, bool write, struct disk_request *reqs) {
+	disk_sector_t next = HOLE;
+	size_t run_cnt = 0, i;
+
+	for (i = 0; i < sec_cnt; i++) {
+		size_t idx = offset / DISK_SECTOR_SIZE + i;
+		uint8_t *buf = (uint8_t *) pages[i / PAGE_SECTORS]
+			+ i % PAGE_SECTORS * DISK_SECTOR_SIZE;
+		disk_sector_t sector = is_delayed (inode, idx) ? HOLE
+			: index_to_sector (inode, idx);
+
+		if (sector == HOLE) {
+			ASSERT (!write);
+			if (reqs == NULL)
+				;
+			else if (is_delayed (inode, idx))
+				memcpy (buf, delay_sector (inode, idx), DISK_SECTOR_SIZE);
+			else
+				memset (buf, 0, DISK_SECTOR_SIZE);
+			next = HOLE;
+			continue;
+		}
+		if (sector == next && i % PAGE_SECTORS != 0) {
+			if (reqs != NULL)
+				reqs[run_cnt - 1].cnt++;
+		} else {
+			if (reqs != NULL) {
+				disk_request_init (&reqs[run_cnt], inode->mnt->disk, sector, 1,
+						buf, write);
+				reqs[run_cnt].source = data_source (inode);
+			}
+			run_cnt++;
+		}
+		next = sector + 1;
+	}
+	return run_cnt;
+}
+
+/* Moves SIZE bytes of INODE from OFFSET, both multiples of
+ * DISK_SECTOR_SIZE, straight between the disk and PAGES, which
+ * hold PGSIZE bytes of them each, without the buffer cache: into
+ * PAGES unless WRITE.  All of the disk requests are submitted
+ * before waiting for any, so the disk may move them by DMA and
+ * merge them.  Returns the number of bytes moved, which for a read
+ * stops at end of file, with the rest of the last sector zeroed.
+ * Returns -1, moving nothing, if INODE's data cannot move this way
+ * but inode_read_at() or inode_write_at() could move it: that of
+ * an inline, compressed or tmpfs file, or for a write, at or past end of file,
+ * in holes or delayed allocation, or not to stay in place. */
+off_t
+inode_direct_at (struct inode *inode, void *const pages[], off_t size,
+		off_t offset, bool write) {
+	struct disk_request *reqs = NULL;
+	size_t sec_cnt, run_cnt, i;
+	off_t moved = -1;
+
+	ASSERT (offset % DISK_SECTOR_SIZE == 0 && size % DISK_SECTOR_SIZE == 0);
+
+	if (write)
+		rwlock_acquire_write (&inode->data_lock);
+	else
+		rwlock_acquire_read (&inode->data_lock);
+	if (write && inode->deny_write_cnt) {
+		moved = 0;
+		goto done;
+	}
+	if (!write) {
+		off_t left = inode->data.length - offset;
+
+		size = left <= 0 ? 0 : size < left ? size : left;
+	}
+	if (!direct_usable (inode, offset, size, write))
+		goto done;
+
+	sec_cnt = DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
+	run_cnt = direct_runs (inode, pages, offset, sec_cnt, write, NULL);
+	if (run_cnt > 0
+			&& (reqs = malloc (run_cnt * sizeof *reqs)) == NULL)
+		goto done;
+	direct_runs (inode, pages, offset, sec_cnt, write, reqs);
+	for (i = 0; i < run_cnt; i++) {
+		cache_bypass (inode->mnt, reqs[i].sector, reqs[i].cnt, write);
+		disk_submit (&reqs[i]);
+	}
+	for (i = 0; i < run_cnt; i++) {
+		disk_wait (&reqs[i]);
+		if (write)
+			thread_current ()->rusage.ru_oublock += reqs[i].cnt;
+		else
+			thread_current ()->rusage.ru_inblock += reqs[i].cnt;
+	}
+	free (reqs);
+
+	moved = size;
+	if (size % DISK_SECTOR_SIZE != 0) {
+		/* Past end of file, the disk may hold anything. */
+		size_t last = sec_cnt - 1;
+
+		memset ((uint8_t *) pages[last / PAGE_SECTORS]
+				+ last % PAGE_SECTORS * DISK_SECTOR_SIZE
+				+ size % DISK_SECTOR_SIZE,
+				0, DISK_SECTOR_SIZE - size % DISK_SECTOR_SIZE);
+	}
+	if (write && moved > 0)
+		inode->write_gen++;
+
+done:
+	if (write)
+		rwlock_release_write (&inode->data_lock);
+	else
+		rwlock_release_read (&inode->data_lock);
+	return moved;
+}
+
+/* Queues the sectors of INODE from byte offset START up to END to
+ * be read ahead, without waiting for them: of a compressed file,
+ * those of the clusters they are in. */
+void
+inode_readahead (struct inode *inode, off_t start, off_t end) {
+	off_t ofs;
+
+	rwlock_acquire_read (&inode->data_lock);
+	if (end > inode->data.length)
+		end = inode->data.length;
+	if (is_inline (inode))
+		end = 0;                        /* Read along with the inode. */
+	if (is_compressed (inode)) {
+		size_t idx;
+
+		for (idx = start / CLUSTER_SIZE;
+				(off_t) (idx * CLUSTER_SIZE) < end; idx++) {
+			struct cluster c;
+			size_t i;
+
+			get_cluster (inode, idx, &c);
+			for (i = 0; i < c.sectors && i < CLUSTER_SECTORS; i++)
+				cache_readahead (inode->mnt, c.start + i,
+						data_source (inode));
+		}
+		end = 0;
+	}
+	for (ofs = ROUND_DOWN (start, DISK_SECTOR_SIZE); ofs < end;
+			ofs += DISK_SECTOR_SIZE) {
+		disk_sector_t sector = byte_to_sector (inode, ofs);
+
+		if (sector != HOLE)
+			cache_readahead (inode->mnt, sector, data_source (inode));
+	}
+	rwlock_release_read (&inode->data_lock);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+ * A write past end of file extends INODE first, with zeros
+ * between the old end and OFFSET.
  * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+ * less than SIZE if the disk is full or an error occurs. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
+	bool logged = logs_writes (inode);
+	bool journaled = inode->meta || offset + size > inode_length (inode)
+		|| logged || inode->shared || is_compressed (inode);
+	off_t old_length;
 
-	if (inode->deny_write_cnt)
+	/* Metadata changes, including those to the inode and free map
+	 * when the file grows or its sectors move, commit together. */
+	if (journaled)
+		journal_begin ();
+	rwlock_acquire_write (&inode->data_lock);
+	if (inode->shared && !journaled) {
+		/* Cloned meanwhile, so its sectors may now move. */
+		rwlock_release_write (&inode->data_lock);
+		journaled = true;
+		journal_begin ();
+		rwlock_acquire_write (&inode->data_lock);
+	}
+	old_length = inode->data.length;
+	if (inode->deny_write_cnt) {
+		rwlock_release_write (&inode->data_lock);
+		if (journaled)
+			journal_end ();
 		return 0;
+	}
+	if (is_compressed (inode)) {
+		bytes_written = compressed_write (inode, buffer, size, offset);
+		size = 0;
+	} else if (size > 0 && offset + size > inode->data.length
+			&& !delay_grow (inode, offset, size)) {
+		/* The sectors past a delayed allocation buffer must follow
+		 * it, so it goes first. */
+		delay_flush (inode);
+		inode_grow (inode, offset + size, offset / DISK_SECTOR_SIZE,
+				prealloc_window (inode));
+	}
 
+	if (is_inline (inode)) {
+		bytes_written = inline_span (inode, offset, size);
+		if (bytes_written > 0) {
+			memcpy ((uint8_t *) inode->data.extents + offset, buffer,
+					bytes_written);
+			write_inode (inode);
+		}
+		size = 0;
+	}
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
 		disk_sector_t sector_idx = byte_to_sector (inode, offset);
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
-		off_t inode_left = inode_length (inode) - offset;
+		off_t inode_left = inode->data.length - offset;
 		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
 		int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -255,26 +2475,38 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
-		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
+		/* Sectors awaiting allocation are written in their buffer. */
+		if (is_delayed (inode, offset / DISK_SECTOR_SIZE))
+			memcpy (delay_sector (inode, offset / DISK_SECTOR_SIZE) + sector_ofs,
+					buffer + bytes_written, chunk_size);
+		else {
+			/* Sectors of a hole are allocated as the write reaches
+			 * them, as many at once as it covers. */
+			if (sector_idx == HOLE) {
+				size_t idx = offset / DISK_SECTOR_SIZE;
+
+				if (!fill_hole (inode, idx,
+							bytes_to_sectors (offset + size) - idx))
 					break;
-			}
+				sector_idx = byte_to_sector (inode, offset);
+			} else if (inode->shared
+					&& free_map_shared (inode->mnt, sector_idx, 1)) {
+				/* A sector shared with a clone is copied on write. */
+				if (!move_sector (inode, offset / DISK_SECTOR_SIZE,
+							chunk_size < DISK_SECTOR_SIZE))
+					break;
+				sector_idx = byte_to_sector (inode, offset);
+			} else if (logged && offset < old_length
+					&& move_sector (inode, offset / DISK_SECTOR_SIZE,
+						chunk_size < DISK_SECTOR_SIZE))
+				/* Sectors the file had go to the log, but not those
+				 * this write just allocated. */
+				sector_idx = byte_to_sector (inode, offset);
 
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
+			/* A partial sector is read in first, to keep the data
+			 * before and after the chunk. */
+			cache_write (inode->mnt, sector_idx, buffer + bytes_written,
+					sector_ofs, chunk_size, data_source (inode));
 		}
 
 		/* Advance. */
@@ -282,7 +2514,11 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
+	if (bytes_written > 0)
+		inode->write_gen++;
+	rwlock_release_write (&inode->data_lock);
+	if (journaled)
+		journal_end ();
 
 	return bytes_written;
 }
@@ -292,8 +2528,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 	void
 inode_deny_write (struct inode *inode) 
 {
+	rwlock_acquire_write (&inode->data_lock);
 	inode->deny_write_cnt++;
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+	rwlock_release_write (&inode->data_lock);
 }
 
 /* Re-enables writes to INODE.
@@ -301,13 +2539,26 @@ inode_deny_write (struct inode *inode)
  * inode_deny_write() on the inode, before closing the inode. */
 void
 inode_allow_write (struct inode *inode) {
+	rwlock_acquire_write (&inode->data_lock);
 	ASSERT (inode->deny_write_cnt > 0);
 	ASSERT (inode->deny_write_cnt <= inode->open_cnt);
 	inode->deny_write_cnt--;
+	rwlock_release_write (&inode->data_lock);
 }
 
-/* Returns the length, in bytes, of INODE's data. */
+/* Returns the length, in bytes, of INODE's data.
+ * A single aligned load, so no lock is taken. */
 off_t
 inode_length (const struct inode *inode) {
 	return inode->data.length;
 }
+
+/* Stores what stat() reports about INODE into *ST.  There are no
+ * hard links, so every inode has one name. */
+void
+inode_stat (const struct inode *inode, struct stat *st) {
+	st->st_ino = inode_get_inumber (inode);
+	st->st_size = inode_length (inode);
+	st->st_nlink = 1;
+	st->st_isdir = inode_is_dir (inode);
+}
@@ -0,0 +1,403 @@
+/* journal.c: Write-ahead journal of file system metadata.
+ *
+ * Each file system operation that changes metadata (inodes,
+ * indirect blocks, directories and their indexes, the free map and
+ * the FAT) runs inside a handle, between journal_begin() and
+ * journal_end().  The metadata sectors it writes to the sector
+ * cache join the running transaction, and the cache does not write
+ * them in place until the transaction has committed.
+ *
+ * A transaction commits once no handle is open; new handles wait
+ * meanwhile.  Its sectors are copied and written to the journal
+ * behind a header that lists and checksums them, in one sequential
+ * write, then to their places, and then the header is cleared, so
+ * that the journal never replays sectors that may since have been
+ * freed and reused.  The flush daemon commits once a second, and a
+ * handle that finds the transaction half full commits it first, so
+ * that many operations share each commit.
+ *
+ * Each outermost handle reserves JOURNAL_CREDITS sectors of the
+ * transaction as it opens, committing first if they do not fit, and
+ * the sectors it logs use them up.  The changed sectors of the free
+ * map, which join the transaction only as it commits, are charged
+ * the same way as they change, by journal_charge().  A handle that
+ * needs more than its credits takes what no handle has reserved,
+ * and past JOURNAL_MAX the slack up to JOURNAL_LIMIT, which the
+ * journal on disk has room for.  A transaction never outgrows that:
+ * no sector of metadata is ever written in place unlogged.
+ *
+ * At mount, a journal whose header lists sectors that match its
+ * checksum is replayed, which finishes the last commit if the
+ * machine stopped while its sectors were being written in place.
+ * A torn journal write fails the checksum and is ignored; the
+ * transaction before it was in place already.  The -jcrash option
+ * stops the machine at shutdown with the last transaction in the
+ * journal only, so that the next boot tests the replay. */
+
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/mount.h"
+#include "threads/lock-stats.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Identifies a journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Journal header, the first sector of the journal.
+ * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct journal_header {
+	uint32_t magic;                     /* JOURNAL_MAGIC. */
+	uint32_t seq;                       /* Number of the transaction. */
+	uint32_t cnt;                       /* Sectors logged, 0 if none. */
+	uint32_t unused;                    /* Not used. */
+	uint64_t checksum;                  /* hash_bytes() of the sectors. */
+	disk_sector_t sectors[JOURNAL_LIMIT]; /* Where each sector goes. */
+	uint8_t pad[DISK_SECTOR_SIZE - 24
+		- JOURNAL_LIMIT * sizeof (disk_sector_t)];
+};
+
+/* Sectors that each outermost handle reserves. */
+#define JOURNAL_CREDITS 8
+
+/* Stop at shutdown with the last transaction in the journal only?
+ * Set by -jcrash. */
+bool journal_crash;
+
+static bool enabled;                    /* Journal opened? */
+static disk_sector_t journal_start;     /* Sector of the header. */
+
+/* The running transaction.  JOURNAL_LOCK guards everything below;
+ * JOURNAL_COND is signaled when the last handle closes and when a
+ * commit ends.  While a commit runs, TX_SECTORS holds the sectors
+ * being committed first and those logged since after them. */
+static struct lock journal_lock;
+static struct condition journal_cond;
+static unsigned tx_seq;                 /* Running transaction, never 0. */
+static disk_sector_t tx_sectors[JOURNAL_LIMIT];
+static size_t tx_cnt;
+static size_t tx_charged;               /* Free map sectors to come. */
+static size_t tx_credits;               /* Credits of open handles left. */
+static size_t handle_cnt;               /* Outermost handles open. */
+static bool committing;                 /* A commit is running? */
+static bool flushing_maps;              /* Commit writing the free map? */
+
+/* The header and copies of the sectors of the commit running, and
+ * the requests that write the sectors in place. */
+static uint8_t *commit_buf;
+static struct disk_request home_reqs[JOURNAL_LIMIT];
+
+/* Statistics. */
+static long long commit_cnt;            /* Commits with any sectors. */
+static long long logged_cnt;            /* Sectors logged. */
+static long long overrun_cnt;           /* Sectors past a handle's credits. */
+static long long op_cnt;                /* Outermost handles. */
+
+static void commit (bool crash);
+
+/* Initializes the journal module.  The journal is not used until
+ * journal_open(). */
+void
+journal_init (void) {
+	ASSERT (sizeof (struct journal_header) == DISK_SECTOR_SIZE);
+
+	lock_init (&journal_lock);
+	lock_set_name (&journal_lock, "journal");
+	cond_init (&journal_cond);
+	commit_buf = malloc (JOURNAL_SECTORS * DISK_SECTOR_SIZE);
+	if (commit_buf == NULL)
+		PANIC ("journal: out of memory");
+	tx_seq = 1;
+}
+
+/* Writes an empty journal of JOURNAL_SECTORS sectors at START,
+ * which the file system being formatted reserves for it. */
+void
+journal_create (disk_sector_t start) {
+	struct journal_header *h = (struct journal_header *) commit_buf;
+
+	memset (h, 0, sizeof *h);
+	h->magic = JOURNAL_MAGIC;
+	disk_write_from (filesys_disk, start, 1, h, DISK_SRC_META);
+}
+
+/* Opens the journal at START, replaying its transaction, and logs
+ * metadata from now on.  A file system formatted without a journal
+ * has no header there and is left alone. */
+void
+journal_open (disk_sector_t start) {
+	struct journal_header *h = (struct journal_header *) commit_buf;
+	uint8_t *data = commit_buf + DISK_SECTOR_SIZE;
+	uint32_t i;
+
+	disk_read_from (filesys_disk, start, 1, h, DISK_SRC_META);
+	if (h->magic != JOURNAL_MAGIC)
+		return;
+	if (h->cnt > 0 && h->cnt <= JOURNAL_LIMIT) {
+		disk_read_from (filesys_disk, start + 1, h->cnt, data, DISK_SRC_META);
+		if (hash_bytes (data, h->cnt * DISK_SECTOR_SIZE) == h->checksum) {
+			printf ("journal: replaying %u sectors of transaction %u\n",
+					h->cnt, h->seq);
+			for (i = 0; i < h->cnt; i++)
+				cache_write (root_mount, h->sectors[i],
+						data + i * DISK_SECTOR_SIZE, 0, DISK_SECTOR_SIZE,
+						DISK_SRC_META);
+			cache_flush (root_mount);
+		}
+		h->cnt = 0;
+		disk_write_from (filesys_disk, start, 1, h, DISK_SRC_META);
+	}
+
+	journal_start = start;
+	tx_seq = h->seq + 1 != 0 ? h->seq + 1 : 1;
+	enabled = true;
+}
+
+/* Returns the number of sectors of the running transaction that
+ * are logged, charged or reserved.  JOURNAL_LOCK must be held. */
+static size_t
+tx_used (void) {
+	return tx_cnt + tx_charged + tx_credits;
+}
+
+/* Opens a handle for one file system operation, whose metadata
+ * changes then commit together.  Handles nest; only the outermost
+ * waits for a commit running, reserves its credits, and starts a
+ * commit first if the transaction is half full or has no room for
+ * them.  The outermost handle must be opened before any file
+ * system lock is taken, since a commit waits for all handles to
+ * close. */
+void
+journal_begin (void) {
+	struct thread *t = thread_current ();
+
+	if (t->journal_depth > 0 || !enabled) {
+		t->journal_depth++;
+		return;
+	}
+	lock_acquire (&journal_lock);
+	for (;;) {
+		if (committing)
+			cond_wait (&journal_cond, &journal_lock);
+		else if (tx_cnt + tx_charged >= JOURNAL_MAX / 2
+				|| tx_used () + JOURNAL_CREDITS > JOURNAL_MAX) {
+			lock_release (&journal_lock);
+			commit (false);
+			lock_acquire (&journal_lock);
+		} else
+			break;
+	}
+	t->journal_depth++;
+	t->journal_credits = JOURNAL_CREDITS;
+	tx_credits += JOURNAL_CREDITS;
+	handle_cnt++;
+	op_cnt++;
+	lock_release (&journal_lock);
+}
+
+/* Closes the handle opened by the matching journal_begin(). */
+void
+journal_end (void) {
+	struct thread *t = thread_current ();
+
+	ASSERT (t->journal_depth > 0);
+	if (--t->journal_depth > 0 || !enabled)
+		return;
+	lock_acquire (&journal_lock);
+	tx_credits -= t->journal_credits;
+	t->journal_credits = 0;
+	if (--handle_cnt == 0)
+		cond_broadcast (&journal_cond, &journal_lock);
+	lock_release (&journal_lock);
+}
+
+/* Takes room for CNT more sectors in the running transaction, from
+ * the credits of the running thread's handle if it has any left.
+ * JOURNAL_LOCK must be held. */
+static void
+take_room (size_t cnt) {
+	struct thread *t = thread_current ();
+
+	while (cnt-- > 0) {
+		if (t->journal_credits > 0) {
+			t->journal_credits--;
+			tx_credits--;
+		} else {
+			if (tx_used () >= JOURNAL_MAX)
+				overrun_cnt++;
+			if (tx_used () >= JOURNAL_LIMIT)
+				PANIC ("journal: transaction outgrew the journal");
+		}
+	}
+}
+
+/* Called by the sector cache on a write of metadata SECTOR, whose
+ * cache entry was last logged in transaction TX, or 0.  Adds SECTOR
+ * to the running transaction if it is not there yet and returns
+ * the number of the transaction, or returns 0 if the journal is not
+ * open and the sector may be written in place at any time. */
+unsigned
+journal_log (disk_sector_t sector, unsigned tx) {
+	unsigned running;
+
+	if (!enabled)
+		return 0;
+	lock_acquire (&journal_lock);
+	running = tx_seq;
+	if (tx != running) {
+		/* The free map's sectors were charged as they changed. */
+		if (flushing_maps && tx_charged > 0)
+			tx_charged--;
+		else
+			take_room (1);
+		tx_sectors[tx_cnt++] = sector;
+		logged_cnt++;
+	}
+	lock_release (&journal_lock);
+	return running;
+}
+
+/* Charges the running transaction for CNT sectors of the free map
+ * that an operation has just changed for the first time since the
+ * last commit, which writes them. */
+void
+journal_charge (size_t cnt) {
+	if (!enabled || cnt == 0)
+		return;
+	lock_acquire (&journal_lock);
+	take_room (cnt);
+	tx_charged += cnt;
+	lock_release (&journal_lock);
+}
+
+/* Writes the changes to the allocation maps kept in memory. */
+static void
+flush_maps (void) {
+	free_map_flush (root_mount);
+}
+
+/* Commits the running transaction, once the handles open have
+ * closed, and returns when its sectors are in place, or if CRASH
+ * as soon as they are in the journal, leaving the journal to replay
+ * them.  Must not be called inside a handle. */
+static void
+commit (bool crash) {
+	struct journal_header *h = (struct journal_header *) commit_buf;
+	uint8_t *data = commit_buf + DISK_SECTOR_SIZE;
+	size_t cnt, i;
+	unsigned seq;
+
+	ASSERT (thread_current ()->journal_depth == 0);
+
+	if (!enabled) {
+		flush_maps ();
+		return;
+	}
+
+	lock_acquire (&journal_lock);
+	while (committing)
+		cond_wait (&journal_cond, &journal_lock);
+	committing = true;
+	while (handle_cnt > 0)
+		cond_wait (&journal_cond, &journal_lock);
+	lock_release (&journal_lock);
+
+	/* The FAT and the free map are changed in memory; their changed
+	 * sectors join the transaction now that no operation is
+	 * halfway.  The writes run as if inside a handle, since new
+	 * handles would wait for this commit. */
+	thread_current ()->journal_depth++;
+	flushing_maps = true;
+	flush_maps ();
+	flushing_maps = false;
+	thread_current ()->journal_depth--;
+
+	/* Sectors logged from now on belong to the next transaction. */
+	lock_acquire (&journal_lock);
+	cnt = tx_cnt;
+	seq = tx_seq;
+	tx_seq = tx_seq + 1 != 0 ? tx_seq + 1 : 1;
+	tx_charged = 0;
+	lock_release (&journal_lock);
+
+	if (cnt > 0) {
+		/* Logged sectors stay in the cache until they are in
+		 * place, so copying them reads no disk. */
+		for (i = 0; i < cnt; i++)
+			cache_read (root_mount, tx_sectors[i], data + i * DISK_SECTOR_SIZE,
+					0, DISK_SECTOR_SIZE, DISK_SRC_META);
+		memset (h, 0, sizeof *h);
+		h->magic = JOURNAL_MAGIC;
+		h->seq = seq;
+		h->cnt = cnt;
+		h->checksum = hash_bytes (data, cnt * DISK_SECTOR_SIZE);
+		memcpy (h->sectors, tx_sectors, cnt * sizeof *tx_sectors);
+		disk_write_from (filesys_disk, journal_start, cnt + 1, commit_buf,
+				DISK_SRC_META);
+		if (crash) {
+			printf ("journal: stopping with transaction %u of %zu sectors "
+					"in the journal\n", seq, cnt);
+			return;
+		}
+
+		for (i = 0; i < cnt; i++) {
+			disk_request_init (&home_reqs[i], filesys_disk, tx_sectors[i], 1,
+					data + i * DISK_SECTOR_SIZE, true);
+			home_reqs[i].source = DISK_SRC_META;
+			disk_submit (&home_reqs[i]);
+		}
+		for (i = 0; i < cnt; i++)
+			disk_wait (&home_reqs[i]);
+		for (i = 0; i < cnt; i++)
+			cache_clean (tx_sectors[i], seq);
+
+		h->cnt = 0;
+		disk_write_from (filesys_disk, journal_start, 1, commit_buf,
+				DISK_SRC_META);
+		commit_cnt++;
+	}
+
+	lock_acquire (&journal_lock);
+	memmove (tx_sectors, tx_sectors + cnt, (tx_cnt - cnt) * sizeof *tx_sectors);
+	tx_cnt -= cnt;
+	committing = false;
+	cond_broadcast (&journal_cond, &journal_lock);
+	lock_release (&journal_lock);
+}
+
+/* Commits the running transaction, once the handles open have
+ * closed, and returns when its sectors are in place.  Must not be
+ * called inside a handle.  With -jcrash only the commits that make
+ * room for a handle run, so that a short test leaves its last
+ * transaction to journal_commit_final(). */
+void
+journal_commit (void) {
+	if (!journal_crash)
+		commit (false);
+}
+
+/* Commits the running transaction at shutdown.  With -jcrash the
+ * machine is then to stop with it only in the journal, as if it had
+ * failed while writing the sectors in place, so that the next mount
+ * replays the journal; the caller writes nothing more. */
+void
+journal_commit_final (void) {
+	commit (journal_crash);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void) {
+	if (enabled)
+		printf ("Journal: %lld operations, %lld sectors logged in %lld "
+				"commits, %lld past handle credits\n",
+				op_cnt, logged_cnt, commit_cnt, overrun_cnt);
+}
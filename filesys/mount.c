@@ -0,0 +1,280 @@
+/* mount.c: Table of mounted file systems.
+ *
+ * The root file system is mounted at boot and stays mounted.  Any
+ * other disk may be mounted on a name in the root directory, as a
+ * file system of its own: "/NAME/FILE" then names FILE in its root
+ * directory.  A disk is formatted only when the mount asks for it,
+ * so that mounting the wrong disk fails rather than wiping it.  A
+ * tmpfs, which holds its sectors in memory instead of on a disk, is
+ * formatted whenever it is mounted; see tmpfs.c.
+ *
+ * Mounted file systems are meant for scratch data, and their flush
+ * policy says so: their metadata is not journaled, and their dirty
+ * sectors are not written back by the flush daemon, only when they
+ * are replaced and at unmount.  They may hold no more than
+ * MOUNT_CACHE_QUOTA entries of the sector cache, replacing their
+ * own entries past that, so that streaming through a scratch disk
+ * leaves the root file system's hot sectors alone.
+ *
+ * MOUNT_LOCK guards the list and the reference counts and is never
+ * held across disk I/O.  ATTACH_LOCK serializes mounting and
+ * unmounting, which do I/O. */
+
+#include "filesys/mount.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "filesys/tmpfs.h"
+#include "threads/lock-stats.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Sector cache entries a mounted file system other than the root
+ * may hold: a quarter of the cache. */
+#define MOUNT_CACHE_QUOTA 16
+
+/* Entries of the root directory of a freshly formatted disk. */
+#define MOUNT_ROOT_ENTRIES 16
+
+static struct mount root;       /* The root file system. */
+struct mount *root_mount = &root;
+
+static struct list mounts;      /* All mounts, the root first. */
+static struct lock mount_lock;  /* Guards MOUNTS and reference counts. */
+static struct lock attach_lock; /* Serializes attach and detach. */
+
+/* Mounts DISK as the root file system. */
+void
+mount_init (struct disk *disk) {
+	list_init (&mounts);
+	lock_init (&mount_lock);
+	lock_set_name (&mount_lock, "mount");
+	lock_init (&attach_lock);
+
+	root.name[0] = '\0';
+	root.disk = disk;
+	root.tmpfs = NULL;
+	root.free_map = NULL;
+	root.journaled = true;
+	root.write_behind = true;
+	root.cache_quota = SIZE_MAX;
+	root.cache_cnt = 0;
+	root.log_head = 0;
+	root.ref_cnt = 0;
+	list_push_back (&mounts, &root.elem);
+}
+
+/* Returns the mount on NAME, or on DISK, or a null pointer.
+ * MOUNT_LOCK must be held. */
+static struct mount *
+find_mount (const char *name, const struct disk *disk) {
+	struct list_elem *e;
+
+	for (e = list_begin (&mounts); e != list_end (&mounts); e = list_next (e)) {
+		struct mount *mnt = list_entry (e, struct mount, elem);
+
+		if (!strcmp (mnt->name, name) || (disk != NULL && mnt->disk == disk))
+			return mnt;
+	}
+	return NULL;
+}
+
+/* Returns the file system mounted on NAME, or the root file system
+ * if NAME is "", with a reference that keeps it mounted until
+ * mount_put().  Returns a null pointer if nothing is mounted on
+ * NAME. */
+struct mount *
+mount_get (const char *name) {
+	struct mount *mnt;
+
+	lock_acquire (&mount_lock);
+	mnt = find_mount (name, NULL);
+	if (mnt != NULL)
+		mnt->ref_cnt++;
+	lock_release (&mount_lock);
+	return mnt;
+}
+
+/* Drops a reference returned by mount_get(). */
+void
+mount_put (struct mount *mnt) {
+	if (mnt == NULL)
+		return;
+	lock_acquire (&mount_lock);
+	ASSERT (mnt->ref_cnt > 0);
+	mnt->ref_cnt--;
+	lock_release (&mount_lock);
+}
+
+/* Forgets everything cached about MNT and frees it. */
+static void
+mount_free (struct mount *mnt) {
+	inode_purge (mnt);
+	cache_drop (mnt);
+	dcache_drop (mnt);
+	free_map_destroy (mnt);
+	tmpfs_destroy (mnt->tmpfs);
+	free (mnt);
+}
+
+/* Returns the number of sectors of MNT. */
+disk_sector_t
+mount_size (const struct mount *mnt) {
+	return mnt->tmpfs != NULL ? tmpfs_size (mnt->tmpfs)
+		: disk_size (mnt->disk);
+}
+
+/* Mounts DISK, or if it is null TMPFS, on NAME, formatting it first
+ * if FORMAT is true or it is a tmpfs.  Returns true if successful,
+ * false if NAME is not a valid name, something is mounted on NAME or
+ * DISK is mounted already, DISK holds no file system and is not to
+ * be formatted, or memory is short.  TMPFS is freed on failure. */
+static bool
+attach (const char *name, struct disk *disk, struct tmpfs *tmpfs,
+		bool format) {
+	struct mount *mnt;
+
+	if (*name == '\0' || strlen (name) > NAME_MAX) {
+		tmpfs_destroy (tmpfs);
+		return false;
+	}
+
+	lock_acquire (&attach_lock);
+	lock_acquire (&mount_lock);
+	mnt = find_mount (name, disk);
+	lock_release (&mount_lock);
+	if (mnt != NULL || (mnt = malloc (sizeof *mnt)) == NULL) {
+		lock_release (&attach_lock);
+		tmpfs_destroy (tmpfs);
+		return false;
+	}
+	strlcpy (mnt->name, name, sizeof mnt->name);
+	mnt->disk = disk;
+	mnt->tmpfs = tmpfs;
+	mnt->free_map = NULL;
+	mnt->journaled = false;
+	mnt->write_behind = false;
+	mnt->cache_quota = MOUNT_CACHE_QUOTA;
+	mnt->cache_cnt = 0;
+	mnt->log_head = 0;
+	mnt->ref_cnt = 0;
+
+	if (!free_map_init (mnt)) {
+		tmpfs_destroy (mnt->tmpfs);
+		free (mnt);
+		lock_release (&attach_lock);
+		return false;
+	}
+	if (tmpfs == NULL && !format) {
+		if (!inode_probe (mnt, FREE_MAP_SECTOR)
+				|| !inode_probe (mnt, ROOT_DIR_SECTOR)) {
+			mount_free (mnt);
+			lock_release (&attach_lock);
+			return false;
+		}
+		free_map_open (mnt);
+	} else {
+		if (tmpfs == NULL)
+			printf ("Formatting file system mounted on %s...", name);
+		free_map_create (mnt);
+		if (!dir_create (mnt, ROOT_DIR_SECTOR, MOUNT_ROOT_ENTRIES)) {
+			if (tmpfs == NULL)
+				printf ("failed\n");
+			free_map_close (mnt);
+			mount_free (mnt);
+			lock_release (&attach_lock);
+			return false;
+		}
+		free_map_flush (mnt);
+		if (tmpfs == NULL)
+			printf ("done.\n");
+	}
+
+	lock_acquire (&mount_lock);
+	list_push_back (&mounts, &mnt->elem);
+	lock_release (&mount_lock);
+	lock_release (&attach_lock);
+	return true;
+}
+
+/* Mounts DISK on NAME, formatting it first if FORMAT is true.
+ * Returns true if successful, false if NAME is not a valid name,
+ * something is mounted on NAME or DISK is mounted already, DISK
+ * holds no file system and FORMAT is false, or memory is short. */
+bool
+mount_attach (const char *name, struct disk *disk, bool format) {
+	return attach (name, disk, NULL, format);
+}
+
+/* Mounts a fresh tmpfs of SIZE sectors on NAME.  Returns true if
+ * successful, false if NAME is not a valid name, something is
+ * mounted on NAME, or memory is short. */
+bool
+mount_attach_tmpfs (const char *name, disk_sector_t size) {
+	struct tmpfs *tmpfs = tmpfs_create (size);
+
+	return tmpfs != NULL && attach (name, NULL, tmpfs, true);
+}
+
+/* Unmounts the file system mounted on NAME, writing back all of its
+ * sectors.  Returns false if nothing is mounted on NAME, NAME is the
+ * root, or the file system is busy: a path operation is running on
+ * it or a file on it is open. */
+bool
+mount_detach (const char *name) {
+	struct mount *mnt;
+
+	if (*name == '\0')
+		return false;
+
+	lock_acquire (&attach_lock);
+	lock_acquire (&mount_lock);
+	mnt = find_mount (name, NULL);
+	if (mnt == NULL || mnt->ref_cnt > 0) {
+		lock_release (&mount_lock);
+		lock_release (&attach_lock);
+		return false;
+	}
+	list_remove (&mnt->elem);
+	lock_release (&mount_lock);
+
+	/* No new path operation can reach MNT now.  The page cache may
+	 * still hold some of its files open, which does not make it
+	 * busy; the only other inode left open is its free map's. */
+	inode_uncache (mnt);
+	if (inode_open_cnt (mnt) > 1) {
+		lock_acquire (&mount_lock);
+		list_push_back (&mounts, &mnt->elem);
+		lock_release (&mount_lock);
+		lock_release (&attach_lock);
+		return false;
+	}
+
+	free_map_close (mnt);
+	mount_free (mnt);
+	lock_release (&attach_lock);
+	return true;
+}
+
+/* Writes back everything mounted besides the root file system, at
+ * shutdown. */
+void
+mount_done (void) {
+	struct list_elem *e;
+
+	lock_acquire (&attach_lock);
+	for (e = list_next (list_begin (&mounts)); e != list_end (&mounts);
+			e = list_next (e)) {
+		struct mount *mnt = list_entry (e, struct mount, elem);
+
+		free_map_close (mnt);
+		cache_flush (mnt);
+	}
+	lock_release (&attach_lock);
+}
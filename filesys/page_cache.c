@@ -1,6 +1,32 @@
-/* page_cache.c: Implementation of Page Cache (Buffer Cache). */
+/* page_cache.c: Implementation of Page Cache (Buffer Cache).
+ *
+ * File reads go through the same cache of whole pages of files,
+ * kept by the VM in the frame table, that executables and
+ * read-only file mappings are mapped from, so that a page read by
+ * one is found there by the others and all of them compete for
+ * memory with anonymous pages under one eviction policy.  Below
+ * it, every sector still passes through the sector cache. */
 
 #include "vm/vm.h"
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "filesys/page_cache.h"
+#include "devices/timer.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Ticks between two write-backs of the sector cache. */
+#define FLUSH_INTERVAL TIMER_FREQ
+
+/* The flusher's deadline class reservation: FLUSH_RUNTIME ticks
+   of CPU in every FLUSH_PERIOD. */
+#define FLUSH_RUNTIME 2
+#define FLUSH_PERIOD 20
+
+static void page_cache_kworkerd (void *aux);
+static void page_cache_ticker (void *aux);
 static bool page_cache_readahead (struct page *page, void *kva);
 static bool page_cache_writeback (struct page *page);
 static void page_cache_destroy (struct page *page);
@@ -13,12 +39,72 @@ static const struct page_operations page_cache_op = {
 	.type = VM_PAGE_CACHE,
 };
 
-tid_t page_cache_workerd;
+tid_t page_cache_workerd = TID_ERROR;
 
-/* The initializer of file vm */
+/* The initializer of file vm.  Starts the worker daemon and the
+ * ticker that asks it to flush, once, whichever of the file system
+ * and the VM comes up first. */
 void
 pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+	if (page_cache_workerd != TID_ERROR)
+		return;
+	page_cache_workerd = thread_create ("kworkerd", PRI_DEFAULT,
+			page_cache_kworkerd, NULL);
+	if (page_cache_workerd == TID_ERROR
+			|| thread_create ("kflushd", PRI_DEFAULT, page_cache_ticker,
+				NULL) == TID_ERROR)
+		PANIC ("page cache worker creation failed");
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at OFFSET,
+ * like inode_read_at().  A page of the file that the read covers
+ * wholly is copied from the page cache, and read into it first if
+ * need be; of a page covered in part, only a cached copy is used.
+ * Everything else is read from INODE.  Returns the number of bytes
+ * read. */
+off_t
+page_cache_read_at (struct inode *inode, void *buffer_, off_t size,
+		off_t offset) {
+#ifdef VM
+	uint8_t *buffer = buffer_;
+	off_t length = inode_length (inode);
+	off_t bytes_read = 0;
+
+	while (size > 0) {
+		off_t page_ofs = offset % PGSIZE;
+		off_t chunk = PGSIZE - page_ofs < size ? PGSIZE - page_ofs : size;
+		struct frame *frame = NULL;
+		off_t n;
+
+		if (offset - page_ofs + PGSIZE <= length)
+			frame = vm_cache_get (inode, offset - page_ofs, chunk == PGSIZE);
+		if (frame != NULL) {
+			memcpy (buffer + bytes_read, (uint8_t *) frame->kva + page_ofs,
+					chunk);
+			vm_cache_put (frame);
+			n = chunk;
+		} else
+			n = inode_read_at (inode, buffer + bytes_read, chunk, offset);
+
+		bytes_read += n;
+		if (n < chunk)
+			break;
+		offset += n;
+		size -= n;
+	}
+	return bytes_read;
+#else
+	return inode_read_at (inode, buffer_, size, offset);
+#endif
+}
+
+/* Drops the pages of INODE, which is being removed, from the page
+ * cache, which would otherwise keep it open. */
+void
+page_cache_drop (struct inode *inode UNUSED) {
+#ifdef VM
+	vm_cache_drop (inode);
+#endif
 }
 
 /* Initialize the page cache */
@@ -44,7 +130,26 @@ static void
 page_cache_destroy (struct page *page) {
 }
 
-/* Worker thread for page cache */
+/* Worker thread for page cache.  Reads in the sectors queued for
+ * readahead and writes the dirty sectors back when asked to. */
+static void
+page_cache_kworkerd (void *aux UNUSED) {
+	for (;;)
+		cache_work ();
+}
+
+/* Allocates the sectors that inodes delay, commits the journal and
+ * asks the worker to flush the sector cache every FLUSH_INTERVAL
+ * ticks, so that little is lost if the machine stops without a
+ * clean shutdown.  The worker itself waits for work and cannot time
+ * out. */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_ticker (void *aux UNUSED) {
+	thread_set_deadline (FLUSH_RUNTIME, FLUSH_PERIOD);
+	for (;;) {
+		timer_sleep (FLUSH_INTERVAL);
+		inode_flush_delayed ();
+		journal_commit ();
+		cache_request_flush ();
+	}
 }
@@ -0,0 +1,279 @@
+/* pipe.c: Pipes.
+ *
+ * A pipe holds its data in a ring of up to PIPE_BUFS pages, each
+ * with the range of it that is still unread.  Small writes are
+ * copied into the last page while it has room; a writer with a
+ * whole page of data can instead hand the page itself over with
+ * pipe_give_page(), and a reader can take a whole unread page with
+ * pipe_take_page(), so that bulk transfers move pages between the
+ * two ends without copying them.
+ *
+ * Threads in poll() wait on POLLERS, which is woken along with
+ * READABLE and WRITABLE. */
+
+#include "filesys/pipe.h"
+#include <debug.h>
+#include <poll.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/poll.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Pages of data a pipe holds: 64 kB. */
+#define PIPE_BUFS 16
+
+/* A page of data in a pipe. */
+struct pipe_buf {
+	uint8_t *page;              /* The page. */
+	size_t ofs;                 /* Offset of the first unread byte. */
+	size_t len;                 /* Number of unread bytes. */
+};
+
+/* A pipe. */
+struct pipe {
+	struct lock lock;           /* Guards the members below. */
+	struct condition readable;  /* Signaled on data or no writers. */
+	struct condition writable;  /* Signaled on room or no readers. */
+	struct poll_queue pollers;  /* Woken on either. */
+	struct pipe_buf bufs[PIPE_BUFS]; /* Ring of pages. */
+	size_t head;                /* Index of the first page in BUFS. */
+	size_t cnt;                 /* Number of pages in BUFS. */
+	int readers;                /* Open read ends. */
+	int writers;                /* Open write ends. */
+};
+
+/* Returns the I'th page of data of P, counting from the oldest. */
+static struct pipe_buf *
+pipe_buf (struct pipe *p, size_t i) {
+	return &p->bufs[(p->head + i) % PIPE_BUFS];
+}
+
+/* Returns a new pipe with no ends open, or a null pointer if
+ * memory is short.  It is freed once its last end is closed. */
+struct pipe *
+pipe_create (void) {
+	struct pipe *p = malloc (sizeof *p);
+
+	if (p != NULL) {
+		lock_init (&p->lock);
+		cond_init (&p->readable);
+		cond_init (&p->writable);
+		poll_queue_init (&p->pollers);
+		p->head = p->cnt = 0;
+		p->readers = p->writers = 0;
+	}
+	return p;
+}
+
+/* Opens a write end of P if WRITER, otherwise a read end. */
+void
+pipe_open (struct pipe *p, bool writer) {
+	lock_acquire (&p->lock);
+	if (writer)
+		p->writers++;
+	else
+		p->readers++;
+	lock_release (&p->lock);
+}
+
+/* Closes a write end of P if WRITER, otherwise a read end, waking
+ * up whoever waits on the other end if it was the last one.  Frees
+ * P when no end is open any more. */
+void
+pipe_close (struct pipe *p, bool writer) {
+	bool dead;
+
+	lock_acquire (&p->lock);
+	if (writer) {
+		ASSERT (p->writers > 0);
+		if (--p->writers == 0)
+			cond_broadcast (&p->readable, &p->lock);
+	} else {
+		ASSERT (p->readers > 0);
+		if (--p->readers == 0)
+			cond_broadcast (&p->writable, &p->lock);
+	}
+	poll_wake (&p->pollers);
+	dead = p->readers == 0 && p->writers == 0;
+	lock_release (&p->lock);
+
+	if (dead) {
+		while (p->cnt > 0) {
+			palloc_free_page (pipe_buf (p, 0)->page);
+			p->head = (p->head + 1) % PIPE_BUFS;
+			p->cnt--;
+		}
+		free (p);
+	}
+}
+
+/* Waits until P has data or no writers.  Returns false in the
+ * latter case if P is empty. */
+static bool
+wait_readable (struct pipe *p) {
+	while (p->cnt == 0 && p->writers > 0)
+		cond_wait (&p->readable, &p->lock);
+	return p->cnt > 0;
+}
+
+/* Waits until P has room for another page or no readers, and
+ * returns false in the latter case. */
+static bool
+wait_writable (struct pipe *p) {
+	while (p->cnt == PIPE_BUFS && p->readers > 0)
+		cond_wait (&p->writable, &p->lock);
+	return p->readers > 0;
+}
+
+/* Drops the first page of P, which has been read. */
+static void
+drop_page (struct pipe *p) {
+	p->head = (p->head + 1) % PIPE_BUFS;
+	if (p->cnt-- == PIPE_BUFS) {
+		cond_signal (&p->writable, &p->lock);
+		poll_wake (&p->pollers);
+	}
+}
+
+/* Adds PAGE, holding LEN bytes of data, to the end of P, which
+ * must have room for it. */
+static void
+push_page (struct pipe *p, void *page, size_t len) {
+	struct pipe_buf *b = pipe_buf (p, p->cnt++);
+
+	ASSERT (p->cnt <= PIPE_BUFS);
+	b->page = page;
+	b->ofs = 0;
+	b->len = len;
+	cond_signal (&p->readable, &p->lock);
+	poll_wake (&p->pollers);
+}
+
+/* Reads up to SIZE bytes from P into BUFFER.  Waits while P is
+ * empty and has writers.  Returns the number of bytes read, which
+ * is 0 at end of file. */
+off_t
+pipe_read (struct pipe *p, void *buffer, off_t size) {
+	uint8_t *dst = buffer;
+	off_t bytes_read = 0;
+
+	lock_acquire (&p->lock);
+	if (size > 0 && wait_readable (p)) {
+		while (bytes_read < size && p->cnt > 0) {
+			struct pipe_buf *b = pipe_buf (p, 0);
+			size_t n = (size_t) (size - bytes_read) < b->len
+				? (size_t) (size - bytes_read) : b->len;
+
+			memcpy (dst + bytes_read, b->page + b->ofs, n);
+			b->ofs += n;
+			b->len -= n;
+			bytes_read += n;
+			if (b->len == 0) {
+				palloc_free_page (b->page);
+				drop_page (p);
+			}
+		}
+	}
+	lock_release (&p->lock);
+	return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into P, waiting for room as
+ * needed.  Returns the number of bytes written, which is less than
+ * SIZE only if P loses its readers or memory is short. */
+off_t
+pipe_write (struct pipe *p, const void *buffer, off_t size) {
+	const uint8_t *src = buffer;
+	off_t bytes_written = 0;
+
+	lock_acquire (&p->lock);
+	while (bytes_written < size && p->readers > 0) {
+		struct pipe_buf *b = p->cnt > 0 ? pipe_buf (p, p->cnt - 1) : NULL;
+		size_t room, n;
+
+		if (b == NULL || b->ofs + b->len == PGSIZE) {
+			/* The last page is full: start a new one. */
+			void *page;
+
+			if (!wait_writable (p))
+				break;
+			page = palloc_get_page (0);
+			if (page == NULL)
+				break;
+			push_page (p, page, 0);
+			continue;
+		}
+
+		room = PGSIZE - (b->ofs + b->len);
+		n = (size_t) (size - bytes_written) < room
+			? (size_t) (size - bytes_written) : room;
+		memcpy (b->page + b->ofs + b->len, src + bytes_written, n);
+		b->len += n;
+		bytes_written += n;
+		cond_signal (&p->readable, &p->lock);
+		poll_wake (&p->pollers);
+	}
+	lock_release (&p->lock);
+	return bytes_written;
+}
+
+/* Adds PAGE, a page from palloc_get_page() full of data, to the
+ * end of P without copying it, waiting for room as needed.  P owns
+ * PAGE if this returns true; returns false, leaving PAGE to the
+ * caller, if P has no readers. */
+bool
+pipe_give_page (struct pipe *p, void *page) {
+	bool given;
+
+	lock_acquire (&p->lock);
+	given = wait_writable (p);
+	if (given)
+		push_page (p, page, PGSIZE);
+	lock_release (&p->lock);
+	return given;
+}
+
+/* Returns the events of <poll.h> that the write end of P is ready
+ * for if WRITER, or else its read end, and adds P to the queues PT
+ * waits on. */
+unsigned
+pipe_poll (struct pipe *p, bool writer, struct poll_table *pt) {
+	unsigned events = 0;
+
+	lock_acquire (&p->lock);
+	poll_add (pt, &p->pollers);
+	if (writer) {
+		struct pipe_buf *b = p->cnt > 0 ? pipe_buf (p, p->cnt - 1) : NULL;
+
+		if (p->readers == 0)
+			events |= POLLERR;
+		else if (p->cnt < PIPE_BUFS || b->ofs + b->len < PGSIZE)
+			events |= POLLOUT;
+	} else {
+		if (p->cnt > 0)
+			events |= POLLIN;
+		if (p->writers == 0)
+			events |= POLLHUP;
+	}
+	lock_release (&p->lock);
+	return events;
+}
+
+/* If the first page of P holds a whole page of unread data,
+ * removes it from P and returns it; the caller must free it with
+ * palloc_free_page().  Otherwise returns a null pointer without
+ * waiting. */
+void *
+pipe_take_page (struct pipe *p) {
+	void *page = NULL;
+
+	lock_acquire (&p->lock);
+	if (p->cnt > 0 && pipe_buf (p, 0)->len == PGSIZE) {
+		page = pipe_buf (p, 0)->page;
+		drop_page (p);
+	}
+	lock_release (&p->lock);
+	return page;
+}
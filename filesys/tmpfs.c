@@ -0,0 +1,153 @@
+/* tmpfs.c: File systems held in memory.
+ *
+ * A tmpfs is mounted like a disk and holds the same structures as
+ * one, free map, inodes and directories, but its sectors live in
+ * pages of memory.  The sector cache reads and writes them there in
+ * place, with no cache entries and no disk requests, and nothing of
+ * a tmpfs outlives its unmount.  That suits scratch files, which
+ * are created and removed before a disk would ever see them.
+ *
+ * A page is allocated as the free map allocates the first of its
+ * sectors, by tmpfs_populate(), so that a tmpfs that runs out of
+ * memory fills up like a full disk instead of losing writes, and
+ * freed once the free map has released all of its sectors, by
+ * tmpfs_release().  The page of the free map and root directory
+ * inodes, which the free map never allocates, is there from the
+ * start.
+ *
+ * The free map's lock serializes allocating and freeing pages.  A
+ * sector's data is guarded by whoever it belongs to, as on a disk:
+ * an inode's data lock, a directory's lock, the free map's. */
+
+#include "filesys/tmpfs.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "threads/vmalloc.h"
+
+/* Sectors held by a page. */
+#define PAGE_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+
+/* A file system in memory. */
+struct tmpfs {
+	disk_sector_t size;         /* Number of sectors. */
+	void **pages;               /* Page of each PAGE_SECTORS sectors, or null. */
+};
+
+/* Returns a new tmpfs of SIZE sectors, or a null pointer if memory
+ * is short. */
+struct tmpfs *
+tmpfs_create (disk_sector_t size) {
+	struct tmpfs *t = malloc (sizeof *t);
+
+	if (t == NULL)
+		return NULL;
+	t->size = size;
+	t->pages = vcalloc (DIV_ROUND_UP (size, PAGE_SECTORS), sizeof *t->pages);
+	if (t->pages == NULL || !tmpfs_populate (t, FREE_MAP_SECTOR, 1)
+			|| !tmpfs_populate (t, ROOT_DIR_SECTOR, 1)) {
+		tmpfs_destroy (t);
+		return NULL;
+	}
+	return t;
+}
+
+/* Frees T and all of its sectors. */
+void
+tmpfs_destroy (struct tmpfs *t) {
+	size_t i;
+
+	if (t == NULL)
+		return;
+	if (t->pages != NULL)
+		for (i = 0; i < DIV_ROUND_UP (t->size, PAGE_SECTORS); i++)
+			palloc_free_page (t->pages[i]);
+	vfree (t->pages);
+	free (t);
+}
+
+/* Returns the number of sectors of T. */
+disk_sector_t
+tmpfs_size (const struct tmpfs *t) {
+	return t->size;
+}
+
+/* Makes sure that memory holds the CNT sectors of T from SECTOR on,
+ * which are being allocated.  Returns false if memory is short,
+ * keeping the pages allocated by then, which tmpfs_release() gives
+ * back. */
+bool
+tmpfs_populate (struct tmpfs *t, disk_sector_t sector, size_t cnt) {
+	size_t i;
+
+	ASSERT (sector + cnt <= t->size);
+
+	for (i = sector / PAGE_SECTORS; cnt > 0
+			&& i <= (sector + cnt - 1) / PAGE_SECTORS; i++)
+		if (t->pages[i] == NULL
+				&& (t->pages[i] = palloc_get_page (PAL_USER | PAL_ZERO)) == NULL)
+			return false;
+	return true;
+}
+
+/* Frees the pages of the CNT sectors of T from SECTOR on, which are
+ * free, that hold no sector that USED, the free map, marks used. */
+void
+tmpfs_release (struct tmpfs *t, disk_sector_t sector, size_t cnt,
+		const struct bitmap *used) {
+	size_t i;
+
+	for (i = sector / PAGE_SECTORS; cnt > 0
+			&& i <= (sector + cnt - 1) / PAGE_SECTORS; i++) {
+		size_t first = i * PAGE_SECTORS;
+		size_t n = t->size - first < PAGE_SECTORS ? t->size - first
+			: PAGE_SECTORS;
+
+		if (t->pages[i] != NULL && bitmap_none (used, first, n)) {
+			palloc_free_page (t->pages[i]);
+			t->pages[i] = NULL;
+		}
+	}
+}
+
+/* Returns the memory of SECTOR of T, or a null pointer if it was
+ * never allocated. */
+static uint8_t *
+sector_data (struct tmpfs *t, disk_sector_t sector) {
+	uint8_t *page;
+
+	ASSERT (sector < t->size);
+
+	page = t->pages[sector / PAGE_SECTORS];
+	return page != NULL
+		? page + sector % PAGE_SECTORS * DISK_SECTOR_SIZE : NULL;
+}
+
+/* Reads SIZE bytes at offset OFS of SECTOR of T into BUFFER.  A
+ * sector never allocated reads as zeros. */
+void
+tmpfs_read (struct tmpfs *t, disk_sector_t sector, void *buffer, int ofs,
+		int size) {
+	uint8_t *data = sector_data (t, sector);
+
+	if (data != NULL)
+		memcpy (buffer, data + ofs, size);
+	else
+		memset (buffer, 0, size);
+}
+
+/* Writes SIZE bytes from BUFFER at offset OFS of SECTOR of T, which
+ * is allocated. */
+void
+tmpfs_write (struct tmpfs *t, disk_sector_t sector, const void *buffer,
+		int ofs, int size) {
+	uint8_t *data = sector_data (t, sector);
+
+	ASSERT (data != NULL);
+	memcpy (data + ofs, buffer, size);
+}
@@ -2,7 +2,11 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include "threads/synch.h"
 
 /* Size of a disk sector in bytes. */
 #define DISK_SECTOR_SIZE 512
@@ -15,13 +19,67 @@ typedef uint32_t disk_sector_t;
  * printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+/* What a disk request is for, for accounting. */
+enum disk_source {
+	DISK_SRC_OTHER,             /* Not attributed. */
+	DISK_SRC_DATA,              /* File data. */
+	DISK_SRC_META,              /* Inodes and indirect blocks. */
+	DISK_SRC_FAT,               /* FAT and boot sector. */
+	DISK_SRC_SWAP,              /* Swap slots. */
+	DISK_SRC_EXEC,              /* Executables being run. */
+	DISK_SRC_DEFRAG,            /* File data moved by the defragmenter. */
+	DISK_SRC_CNT
+};
+
+struct disk_request;
+
+/* Called by the disk's channel thread when request R is done. */
+typedef void disk_request_func (struct disk_request *r, void *aux);
+
+/* An asynchronous request for CNT sectors of DISK, starting at
+ * SECTOR, to be moved to or from BUFFER.  Set up with
+ * disk_request_init(); SOURCE, COMPLETE and AUX may then be set
+ * before disk_submit().  The request must stay alive until it is done. */
+struct disk_request {
+	struct list_elem elem;      /* Element in the channel's queue. */
+	struct disk *disk;          /* Disk. */
+	disk_sector_t sector;       /* First sector. */
+	size_t cnt;                 /* Number of sectors. */
+	void *buffer;               /* CNT * DISK_SECTOR_SIZE bytes. */
+	bool write;                 /* To the disk? */
+	bool dma;                   /* Moved by DMA?  Set on submission. */
+	enum disk_source source;    /* Accounted to. */
+	uint64_t submit_tsc;        /* TSC at submission. */
+	disk_request_func *complete;    /* Called when done, or null. */
+	void *aux;                  /* Passed to COMPLETE. */
+	struct semaphore done;      /* Up'd when done if COMPLETE is null. */
+};
+
+/* Longest time the channel thread polls for a disk interrupt that
+   usually comes quickly, in microseconds, before sleeping for it.
+   Set by kernel command-line option "-disk-poll"; 0 always sleeps. */
+extern unsigned disk_poll_us;
+
 void disk_init (void);
 void disk_print_stats (void);
 
 struct disk *disk_get (int chan_no, int dev_no);
 disk_sector_t disk_size (struct disk *);
+bool disk_idle (struct disk *, int64_t ticks);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_read_multiple (struct disk *, disk_sector_t, size_t cnt, void *);
+void disk_write_multiple (struct disk *, disk_sector_t, size_t cnt,
+		const void *);
+void disk_read_from (struct disk *, disk_sector_t, size_t cnt, void *,
+		enum disk_source);
+void disk_write_from (struct disk *, disk_sector_t, size_t cnt,
+		const void *, enum disk_source);
+
+void disk_request_init (struct disk_request *, struct disk *, disk_sector_t,
+		size_t cnt, void *buffer, bool write);
+void disk_submit (struct disk_request *);
+void disk_wait (struct disk_request *);
 
 void 	register_disk_inspect_intr ();
 #endif /* devices/disk.h */
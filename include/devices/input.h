@@ -2,11 +2,18 @@
 #define DEVICES_INPUT_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+struct poll_table;
+
 void input_init (void);
 void input_putc (uint8_t);
+void input_putbuf (const uint8_t *, size_t);
 uint8_t input_getc (void);
+size_t input_read (uint8_t *, size_t, bool nonblocking);
+bool input_poll (struct poll_table *);
+size_t input_space (void);
 bool input_full (void);
 
 #endif /* devices/input.h */
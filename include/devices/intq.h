@@ -15,7 +15,16 @@
    and condition variables from threads/synch.h cannot be used in
    this case, as they normally would, because they can only
    protect kernel threads from one another, not from interrupt
-   handlers. */
+   handlers.
+
+   intq_spsc_read() is the exception.  A single consumer thread may
+   call it with interrupts on, while a single producer adds bytes
+   with interrupts off, usually from an interrupt handler.  The
+   producer only ever advances HEAD, after storing the bytes, and the
+   consumer only ever advances TAIL, after copying them out.  On our
+   one CPU that order only has to be kept by the compiler, so
+   interrupts are turned off only to wait while Q is empty or to wake
+   a waiting producer. */
 
 /* Queue buffer size, in bytes. */
 #define INTQ_BUFSIZE 64
@@ -36,7 +45,11 @@ struct intq {
 void intq_init (struct intq *);
 bool intq_empty (const struct intq *);
 bool intq_full (const struct intq *);
+size_t intq_space (const struct intq *);
 uint8_t intq_getc (struct intq *);
+size_t intq_read (struct intq *, uint8_t *, size_t);
+size_t intq_spsc_read (struct intq *, uint8_t *, size_t, bool block);
 void intq_putc (struct intq *, uint8_t);
+size_t intq_write (struct intq *, const uint8_t *, size_t);
 
 #endif /* devices/intq.h */
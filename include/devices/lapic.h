@@ -0,0 +1,23 @@
+#ifndef DEVICES_LAPIC_H
+#define DEVICES_LAPIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Interrupt vectors of the local APIC.  Like the PIC's, they are
+   external interrupts. */
+#define LAPIC_TIMER_VEC 0xf0      /* Local APIC timer. */
+#define LAPIC_SPURIOUS_VEC 0xff   /* Spurious interrupt; takes no EOI. */
+
+void lapic_init (void);
+bool lapic_present (void);
+bool lapic_has_tsc_deadline (void);
+uint8_t lapic_id (void);
+void lapic_eoi (void);
+
+void lapic_timer_setup (bool tsc_deadline);
+void lapic_timer_oneshot (uint32_t count);
+void lapic_timer_deadline (uint64_t tsc);
+uint32_t lapic_timer_count (void);
+
+#endif /* devices/lapic.h */
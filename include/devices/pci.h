@@ -0,0 +1,20 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdint.h>
+
+/* Configuration space registers, at these offsets. */
+#define PCI_REG_ID 0x00                 /* Device and vendor IDs. */
+#define PCI_REG_COMMAND 0x04            /* Command and status. */
+#define PCI_REG_CLASS 0x08              /* Class and revision. */
+#define PCI_REG_BAR0 0x10               /* Base address register 0. */
+#define PCI_REG_INTR 0x3c               /* Interrupt line and pin. */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001               /* I/O space enable. */
+#define PCI_CMD_BUS_MASTER 0x0004       /* Bus master enable. */
+
+uint32_t pci_read_config (int dev, int fn, int reg);
+void pci_write_config (int dev, int fn, int reg, uint32_t);
+
+#endif /* devices/pci.h */
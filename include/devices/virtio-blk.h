@@ -0,0 +1,29 @@
+#ifndef DEVICES_VIRTIO_BLK_H
+#define DEVICES_VIRTIO_BLK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/disk.h"
+
+/* Disk hdC:D is the virtio block device, if any, in PCI slot
+   VIRTIO_BLK_SLOT + C * 2 + D of bus 0. */
+#define VIRTIO_BLK_SLOT 0x10
+
+/* Most pieces of memory one request moves. */
+#define VIRTIO_BLK_SEGS 64
+
+/* A physically contiguous piece of memory to move. */
+struct virtio_blk_seg {
+	uint64_t pa;                /* Physical address. */
+	uint32_t length;            /* Bytes, a multiple of DISK_SECTOR_SIZE. */
+};
+
+struct virtio_blk;
+
+struct virtio_blk *virtio_blk_probe (int slot);
+disk_sector_t virtio_blk_capacity (const struct virtio_blk *);
+bool virtio_blk_transfer (struct virtio_blk *, disk_sector_t,
+		const struct virtio_blk_seg *, size_t seg_cnt, bool write);
+
+#endif /* devices/virtio-blk.h */
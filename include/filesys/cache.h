@@ -0,0 +1,35 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdint.h>
+#include "devices/disk.h"
+
+struct mount;
+
+/* Counts of what the cache did, since boot.  Int 0x4b reports
+ * them by their position here. */
+struct cache_stats {
+	uint64_t hits;              /* Uses of a cached sector. */
+	uint64_t misses;            /* Uses of a sector not cached. */
+	uint64_t evictions;         /* Sectors replaced by others. */
+	uint64_t writebacks;        /* Dirty sectors written back. */
+	uint64_t ra_hits;           /* Sectors read ahead, then used. */
+	uint64_t ra_wasted;         /* Sectors read ahead, never used. */
+};
+
+void cache_init (void);
+void cache_read (struct mount *, disk_sector_t, void *, int ofs, int size,
+		enum disk_source);
+void cache_write (struct mount *, disk_sector_t, const void *, int ofs,
+		int size, enum disk_source);
+void cache_bypass (struct mount *, disk_sector_t, size_t cnt, bool write);
+void cache_flush (struct mount *);
+void cache_clean (disk_sector_t, unsigned tx);
+void cache_readahead (struct mount *, disk_sector_t, enum disk_source);
+void cache_request_flush (void);
+void cache_work (void);
+void cache_drop (struct mount *);
+void cache_get_stats (struct cache_stats *);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,32 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+
+struct mount;
+
+/* Result of a dentry cache lookup. */
+enum dcache_result {
+	DCACHE_MISS,                /* Not cached: ask the directory. */
+	DCACHE_HIT,                 /* The name is in the directory. */
+	DCACHE_NEGATIVE             /* The name is known not to be there. */
+};
+
+void dcache_init (void);
+enum dcache_result dcache_lookup (struct mount *, disk_sector_t dir,
+		const char *name, disk_sector_t *sector);
+void dcache_insert (struct mount *, disk_sector_t dir, const char *name,
+		disk_sector_t sector);
+void dcache_found (struct mount *, disk_sector_t dir, const char *name,
+		disk_sector_t sector);
+
+enum dcache_result dcache_lookup_link (struct mount *, disk_sector_t link,
+		disk_sector_t *sector);
+unsigned dcache_link_gen (void);
+void dcache_insert_link (struct mount *, disk_sector_t link,
+		disk_sector_t sector, unsigned gen);
+void dcache_purge (struct mount *, disk_sector_t dir);
+void dcache_drop (struct mount *);
+
+#endif /* filesys/dcache.h */
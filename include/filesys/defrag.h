@@ -0,0 +1,17 @@
+#ifndef FILESYS_DEFRAG_H
+#define FILESYS_DEFRAG_H
+
+#include <stdbool.h>
+
+struct mount;
+
+/* Run the defragmenter?  Set by kernel command-line option
+ * "-defrag". */
+extern bool defrag_enabled;
+
+void defrag_init (void);
+void defrag_done (void);
+bool defrag_throttle (struct mount *);
+void defrag_print_stats (void);
+
+#endif /* filesys/defrag.h */
@@ -1,14 +1,21 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stdbool.h>
 #include "filesys/off_t.h"
 
 struct inode;
+struct pipe;
+struct poll_table;
+
+void file_init (void);
 
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
+struct file *file_open_pipe (struct pipe *, bool writer);
 struct file *file_reopen (struct file *);
 struct file *file_duplicate (struct file *file);
+struct file *file_dup (struct file *);
 void file_close (struct file *);
 struct inode *file_get_inode (struct file *);
 
@@ -17,6 +24,21 @@ off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+bool file_give_page (struct file *, void *page);
+unsigned file_poll (struct file *, struct poll_table *);
+void *file_take_page (struct file *);
+off_t file_direct (struct file *, void *const pages[], off_t size,
+		bool write);
+off_t file_copy (struct file *dst, struct file *src, off_t size);
+bool file_allocate (struct file *, off_t size);
+bool file_truncate (struct file *, off_t size);
+
+/* Bypassing the buffer cache. */
+void file_set_direct (struct file *, bool);
+bool file_is_direct (struct file *);
+
+/* Compressing the data. */
+bool file_set_compressed (struct file *);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
@@ -4,17 +4,31 @@
 #include <stdbool.h>
 #include "filesys/off_t.h"
 
+struct stat;
+
 /* Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /* First sector of the journal. */
+
+/* Sizes of a tmpfs, in kB. */
+#define TMPFS_MIN_KB 64
+#define TMPFS_MAX_KB (32 * 1024)
 
 /* Disk used for file system. */
 extern struct disk *filesys_disk;
 
 void filesys_init (bool format);
 void filesys_done (void);
-bool filesys_create (const char *name, off_t initial_size);
-struct file *filesys_open (const char *name);
-bool filesys_remove (const char *name);
+void filesys_sync (void);
+bool filesys_create (const char *path, off_t initial_size);
+struct file *filesys_open (const char *path);
+bool filesys_stat (const char *path, struct stat *);
+bool filesys_remove (const char *path);
+bool filesys_symlink (const char *target, const char *linkpath);
+bool filesys_clone (const char *src, const char *dst);
+bool filesys_mount (const char *path, int chan_no, int dev_no, bool format);
+bool filesys_mount_tmpfs (const char *path, int size_kb);
+bool filesys_umount (const char *path);
 
 #endif /* filesys/filesys.h */
@@ -5,13 +5,26 @@
 #include <stddef.h>
 #include "devices/disk.h"
 
-void free_map_init (void);
+struct mount;
+
+bool free_map_init (struct mount *);
 void free_map_read (void);
-void free_map_create (void);
-void free_map_open (void);
-void free_map_close (void);
+void free_map_create (struct mount *);
+void free_map_open (struct mount *);
+void free_map_close (struct mount *);
+void free_map_destroy (struct mount *);
 
-bool free_map_allocate (size_t, disk_sector_t *);
-void free_map_release (disk_sector_t, size_t);
+bool free_map_allocate (struct mount *, size_t, disk_sector_t *);
+bool free_map_allocate_near (struct mount *, size_t, disk_sector_t goal,
+		disk_sector_t *);
+bool free_map_allocate_at (struct mount *, disk_sector_t, size_t);
+bool free_map_allocate_reserved (struct mount *, size_t, disk_sector_t goal,
+		disk_sector_t *);
+bool free_map_reserve (struct mount *, size_t);
+void free_map_unreserve (struct mount *, size_t);
+void free_map_release (struct mount *, disk_sector_t, size_t);
+bool free_map_share (struct mount *, disk_sector_t, size_t);
+bool free_map_shared (struct mount *, disk_sector_t, size_t);
+void free_map_flush (struct mount *);
 
 #endif /* filesys/free-map.h */
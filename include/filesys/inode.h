@@ -2,22 +2,62 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include "devices/disk.h"
 
 struct bitmap;
+struct mount;
+struct rwlock;
+struct stat;
+
+/* What an inode holds. */
+enum inode_type {
+	INODE_TYPE_FILE,            /* Regular file. */
+	INODE_TYPE_DIR,             /* Directory. */
+	INODE_TYPE_SYMLINK          /* Symbolic link, holding its target. */
+};
+
+extern bool inode_checksums;
+extern bool inode_log_writes;
 
 void inode_init (void);
-bool inode_create (disk_sector_t, off_t);
-struct inode *inode_open (disk_sector_t);
+bool inode_create (struct mount *, disk_sector_t, off_t, enum inode_type);
+bool inode_probe (struct mount *, disk_sector_t);
+struct inode *inode_open (struct mount *, disk_sector_t);
+void inode_prefetch (struct mount *, disk_sector_t);
 struct inode *inode_reopen (struct inode *);
 disk_sector_t inode_get_inumber (const struct inode *);
+struct mount *inode_get_mount (const struct inode *);
+unsigned inode_write_gen (const struct inode *);
+bool inode_is_dir (const struct inode *);
+bool inode_is_symlink (const struct inode *);
+bool inode_is_removed (const struct inode *);
+void inode_set_meta (struct inode *);
+bool inode_set_compressed (struct inode *);
+void inode_trim (struct inode *);
+bool inode_flush_delayed (void);
+bool inode_is_stuck (struct inode *);
+disk_sector_t inode_get_index (const struct inode *);
+void inode_set_index (struct inode *, disk_sector_t);
+struct rwlock *inode_dir_lock (struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+void inode_uncache (struct mount *);
+size_t inode_open_cnt (struct mount *);
+void inode_purge (struct mount *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_readahead (struct inode *, off_t start, off_t end);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_direct_at (struct inode *, void *const pages[], off_t size,
+		off_t offset, bool write);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+bool inode_allocate (struct inode *, off_t length);
+bool inode_truncate (struct inode *, off_t length);
+size_t inode_defrag (struct inode *);
+bool inode_clone (struct inode *dst, struct inode *src);
+void inode_stat (const struct inode *, struct stat *);
 
 #endif /* filesys/inode.h */
@@ -0,0 +1,32 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+
+/* Sectors one transaction admits handles into, and most sectors
+ * it may log, past the credits of its handles.  Logged sectors stay
+ * in the sector cache until they are in place, so JOURNAL_LIMIT
+ * must leave most of the cache free. */
+#define JOURNAL_MAX 32
+#define JOURNAL_LIMIT 48
+
+/* Sectors of the journal: a header and the logged sectors. */
+#define JOURNAL_SECTORS (JOURNAL_LIMIT + 1)
+
+extern bool journal_crash;
+
+void journal_init (void);
+void journal_create (disk_sector_t start);
+void journal_open (disk_sector_t start);
+
+void journal_begin (void);
+void journal_end (void);
+unsigned journal_log (disk_sector_t, unsigned tx);
+void journal_charge (size_t cnt);
+void journal_commit (void);
+void journal_commit_final (void);
+
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
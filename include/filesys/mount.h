@@ -0,0 +1,44 @@
+#ifndef FILESYS_MOUNT_H
+#define FILESYS_MOUNT_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/disk.h"
+#include "filesys/directory.h"
+
+struct free_map;
+struct tmpfs;
+
+/* A mounted file system.  The root file system is mounted at boot;
+ * others are mounted on a name in its root directory.  Each is on a
+ * disk of its own, or in memory, so it has its own inode numbers
+ * and free map, and it has its own share of the sector cache and
+ * its own flush policy. */
+struct mount {
+	struct list_elem elem;      /* Element in the mount list. */
+	char name[NAME_MAX + 1];    /* Name mounted on, "" for the root. */
+	struct disk *disk;          /* Disk it is on, or null for a tmpfs. */
+	struct tmpfs *tmpfs;        /* Memory it is in, or null. */
+	struct free_map *free_map;  /* Its free map. */
+	bool journaled;             /* Metadata logged in the journal? */
+	bool write_behind;          /* Written back by the flush daemon? */
+	size_t cache_quota;         /* Most sector cache entries held. */
+	size_t cache_cnt;           /* Entries held, guarded by the cache. */
+	disk_sector_t log_head;     /* Where "-lfs" writes go next, a hint. */
+	int ref_cnt;                /* Path operations running on it. */
+};
+
+/* The root file system. */
+extern struct mount *root_mount;
+
+void mount_init (struct disk *);
+struct mount *mount_get (const char *name);
+void mount_put (struct mount *);
+bool mount_attach (const char *name, struct disk *, bool format);
+bool mount_attach_tmpfs (const char *name, disk_sector_t size);
+disk_sector_t mount_size (const struct mount *);
+bool mount_detach (const char *name);
+void mount_done (void);
+
+#endif /* filesys/mount.h */
@@ -0,0 +1,20 @@
+#ifndef FILESYS_PIPE_H
+#define FILESYS_PIPE_H
+
+#include <stdbool.h>
+#include "filesys/off_t.h"
+
+struct pipe;
+struct poll_table;
+
+struct pipe *pipe_create (void);
+void pipe_open (struct pipe *, bool writer);
+void pipe_close (struct pipe *, bool writer);
+
+off_t pipe_read (struct pipe *, void *, off_t size);
+off_t pipe_write (struct pipe *, const void *, off_t size);
+bool pipe_give_page (struct pipe *, void *page);
+void *pipe_take_page (struct pipe *);
+unsigned pipe_poll (struct pipe *, bool writer, struct poll_table *);
+
+#endif /* filesys/pipe.h */
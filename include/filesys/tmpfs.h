@@ -0,0 +1,20 @@
+#ifndef FILESYS_TMPFS_H
+#define FILESYS_TMPFS_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+
+struct bitmap;
+struct tmpfs;
+
+struct tmpfs *tmpfs_create (disk_sector_t size);
+void tmpfs_destroy (struct tmpfs *);
+disk_sector_t tmpfs_size (const struct tmpfs *);
+bool tmpfs_populate (struct tmpfs *, disk_sector_t, size_t cnt);
+void tmpfs_release (struct tmpfs *, disk_sector_t, size_t cnt,
+		const struct bitmap *used);
+void tmpfs_read (struct tmpfs *, disk_sector_t, void *, int ofs, int size);
+void tmpfs_write (struct tmpfs *, disk_sector_t, const void *, int ofs,
+		int size);
+
+#endif /* filesys/tmpfs.h */
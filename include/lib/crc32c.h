@@ -0,0 +1,9 @@
+#ifndef __LIB_CRC32C_H
+#define __LIB_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32c (uint32_t crc, const void *, size_t);
+
+#endif /* lib/crc32c.h */
@@ -0,0 +1,13 @@
+#ifndef __LIB_DIRENT_H
+#define __LIB_DIRENT_H
+
+/* Longest file name in a struct dirent, not counting the null. */
+#define DIRENT_NAME_MAX 14
+
+/* One entry of a directory, as getdents() returns it. */
+struct dirent {
+	int d_ino;                          /* Inode number. */
+	char d_name[DIRENT_NAME_MAX + 1];   /* Null-terminated name. */
+};
+
+#endif /* lib/dirent.h */
@@ -0,0 +1,21 @@
+#ifndef __LIB_FCNTL_H
+#define __LIB_FCNTL_H
+
+/* Flags for open_flags().
+
+   With O_DIRECT, a read() or write() whose buffer starts a page
+   and whose length and file position are multiples of 512 bytes,
+   the disk's sector size, moves the data straight between the
+   disk and the buffer, bypassing the kernel's buffer cache.  Other
+   reads and writes of the file go through the cache, as without
+   it.
+
+   With O_COMPRESS, an empty file keeps the data written to it
+   compressed on disk from then on, and reads decompress it, so that
+   data that compresses well takes fewer sectors to read and write.
+   Opening a file that holds data uncompressed fails, and O_DIRECT
+   does not bypass the cache for a compressed file. */
+#define O_DIRECT 0x1                    /* Bypass the buffer cache. */
+#define O_COMPRESS 0x2                  /* Compress the file's data. */
+
+#endif /* lib/fcntl.h */
@@ -0,0 +1,66 @@
+#ifndef __LIB_IORING_H
+#define __LIB_IORING_H
+
+#include <stdint.h>
+#include <vdso.h>
+
+/* A ring of file operations for the kernel to run in the
+   background, set up by io_setup().
+
+   The process fills in the entry at sq[sq_tail % IORING_ENTRIES]
+   and then advances sq_tail, for each operation, and hands them
+   all to the kernel with one io_enter().  The kernel takes them
+   from sq_head on, advancing it, and posts a completion for each
+   at cq[cq_tail % IORING_ENTRIES] as it finishes, in whatever
+   order that is, before advancing cq_tail.  The process reaps
+   completions from cq_head up to cq_tail and then advances
+   cq_head.  The kernel takes no more operations than there are
+   free completion slots, so no completion is ever dropped.
+
+   A buffer of a READ or PREAD must stay mapped until its
+   operation completes; the data of a WRITE or PWRITE, and the
+   name of an OPEN, are copied when io_enter() takes them.  The
+   console and pipes cannot be used, and files opened by OPEN are
+   found from the root directory. */
+#define IORING_BASE VDSO_END           /* Where the ring is mapped. */
+#define IORING_END (IORING_BASE + 0x1000)
+#define IORING_ENTRIES 64               /* Entries in each ring. */
+#define IORING_MAX_LEN (64 * 1024)      /* Longest read or write. */
+
+/* Operations. */
+enum io_op {
+	IO_READ,                        /* read (fd, addr, len). */
+	IO_WRITE,                       /* write (fd, addr, len). */
+	IO_PREAD,                       /* pread (fd, addr, len, offset). */
+	IO_PWRITE,                      /* pwrite (fd, addr, len, offset). */
+	IO_FSYNC,                       /* fsync (fd). */
+	IO_OPEN,                        /* open (addr), giving the fd. */
+};
+
+/* An operation submitted. */
+struct io_sqe {
+	uint8_t op;                     /* One of enum io_op. */
+	int32_t fd;                     /* File descriptor. */
+	uint64_t addr;                  /* Buffer, or OPEN's file name. */
+	uint32_t len;                   /* Bytes to read or write. */
+	int32_t offset;                 /* File offset for PREAD, PWRITE. */
+	uint64_t user_data;             /* Passed back in the completion. */
+};
+
+/* An operation completed. */
+struct io_cqe {
+	uint64_t user_data;             /* From the operation. */
+	int32_t res;                    /* What the system call returns. */
+};
+
+/* The rings, both in the one page at IORING_BASE. */
+struct io_ring {
+	volatile uint32_t sq_head;      /* Advanced by the kernel. */
+	volatile uint32_t sq_tail;      /* Advanced by the process. */
+	volatile uint32_t cq_head;      /* Advanced by the process. */
+	volatile uint32_t cq_tail;      /* Advanced by the kernel. */
+	struct io_sqe sq[IORING_ENTRIES];
+	struct io_cqe cq[IORING_ENTRIES];
+};
+
+#endif /* lib/ioring.h */
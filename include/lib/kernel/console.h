@@ -1,8 +1,21 @@
 #ifndef __LIB_KERNEL_CONSOLE_H
 #define __LIB_KERNEL_CONSOLE_H
 
+#include <stdbool.h>
+#include <debug.h>
+
+/* Mirror console output to the VGA display? */
+extern bool console_vga;
+
+/* Send console output through the kernel log ring? */
+extern bool console_klog;
+
 void console_init (void);
+void console_start_klog (void);
 void console_panic (void);
+void console_flush (void);
 void console_print_stats (void);
 
+int klog_printf (const char *, ...) PRINTF_FORMAT (1, 2);
+
 #endif /* lib/kernel/console.h */
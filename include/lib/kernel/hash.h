@@ -54,11 +54,19 @@ typedef bool hash_less_func (const struct hash_elem *a,
  * data AUX. */
 typedef void hash_action_func (struct hash_elem *e, void *aux);
 
-/* Hash table. */
+/* Hash table.
+ *
+ * Resizing is incremental: while OLD_BUCKETS is non-null, the
+ * table is being moved from OLD_BUCKETS to BUCKETS, a few buckets
+ * per insertion or deletion.  Old buckets below MIGRATE_IDX are
+ * already empty. */
 struct hash {
 	size_t elem_cnt;            /* Number of elements in table. */
 	size_t bucket_cnt;          /* Number of buckets, a power of 2. */
 	struct list *buckets;       /* Array of `bucket_cnt' lists. */
+	struct list *old_buckets;   /* Buckets being migrated, or null. */
+	size_t old_bucket_cnt;      /* Number of old buckets, a power of 2. */
+	size_t migrate_idx;         /* Next old bucket to migrate. */
 	hash_hash_func *hash;       /* Hash function. */
 	hash_less_func *less;       /* Comparison function. */
 	void *aux;                  /* Auxiliary data for `hash' and `less'. */
@@ -97,4 +105,11 @@ uint64_t hash_bytes (const void *, size_t);
 uint64_t hash_string (const char *);
 uint64_t hash_int (int);
 
+/* Faster hash functions, with better spread, for keys of the
+   kernel's in-memory tables.  Not for anything kept on disk,
+   which must stay with the ones above. */
+uint64_t hash_u64 (uint64_t);
+uint64_t hash_buf (const void *, size_t, uint64_t seed);
+uint64_t hash_str (const char *, uint64_t seed);
+
 #endif /* lib/kernel/hash.h */
@@ -0,0 +1,69 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+/* Priority queue (heap).
+ *
+ * This is an intrusive skew heap: like the list and hash table
+ * implementations, it does not use dynamic allocation.  Each
+ * structure that can potentially be in a heap must embed a
+ * struct heap_elem member, and the heap_entry macro converts a
+ * struct heap_elem back to the structure that contains it.
+ *
+ * The heap is ordered by a "less" function supplied at
+ * initialization time.  heap_top() returns the element that is
+ * least according to that function, so a max-heap is simply a
+ * heap whose less function compares in the opposite direction.
+ *
+ * heap_push(), heap_pop() and heap_remove() take amortized
+ * O(log n) time; heap_top() takes constant time.  All operations
+ * are iterative, so large heaps do not consume kernel stack.
+ *
+ * Changing the key of an element that is in a heap breaks the
+ * heap invariant.  Call heap_update() afterward to restore it. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct heap_elem {
+	struct heap_elem *parent;   /* Parent, or null for the root. */
+	struct heap_elem *left;     /* Left child. */
+	struct heap_elem *right;    /* Right child. */
+};
+
+/* Converts pointer to heap element HEAP_ELEM into a pointer to
+ * the structure that HEAP_ELEM is embedded inside.  Supply the
+ * name of the outer structure STRUCT and the member name MEMBER
+ * of the heap element. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)           \
+	((STRUCT *) ((uint8_t *) &(HEAP_ELEM)->parent   \
+		- offsetof (STRUCT, MEMBER.parent)))
+
+/* Compares the value of two heap elements A and B, given
+ * auxiliary data AUX.  Returns true if A is less than B, or
+ * false if A is greater than or equal to B. */
+typedef bool heap_less_func (const struct heap_elem *a,
+                             const struct heap_elem *b,
+                             void *aux);
+
+/* Heap. */
+struct heap {
+	struct heap_elem *root;     /* Least element, or null. */
+	size_t elem_cnt;            /* Number of elements. */
+	heap_less_func *less;       /* Comparison function. */
+	void *aux;                  /* Auxiliary data for `less'. */
+};
+
+void heap_init (struct heap *, heap_less_func *, void *aux);
+
+void heap_push (struct heap *, struct heap_elem *);
+struct heap_elem *heap_top (struct heap *);
+struct heap_elem *heap_pop (struct heap *);
+void heap_remove (struct heap *, struct heap_elem *);
+void heap_update (struct heap *, struct heap_elem *);
+
+size_t heap_size (struct heap *);
+bool heap_empty (struct heap *);
+
+#endif /* lib/kernel/heap.h */
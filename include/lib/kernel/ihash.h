@@ -0,0 +1,70 @@
+#ifndef __LIB_KERNEL_IHASH_H
+#define __LIB_KERNEL_IHASH_H
+
+/* Integer-keyed hash table.
+ *
+ * Unlike the chained table in hash.h, this table uses open
+ * addressing and keeps its keys inline: each slot holds a 64-bit
+ * key and a pointer value, and the slots sit in one array, so a
+ * lookup touches no memory but the table's.  Beside the slots an
+ * array holds a control byte per slot, which is EMPTY, DELETED, or
+ * 7 bits of the key's hash.  A lookup loads the control bytes of a
+ * group of 8 slots as one word and matches them all against the
+ * hash bits at once, so it usually compares one key and touches
+ * one or two cache lines.
+ *
+ * Resizing is incremental: while OLD_SLOTS is non-null, the
+ * entries are being moved from the old arrays to the new, a few
+ * slots per insertion or removal.  Each key is in exactly one of
+ * the two.
+ *
+ * Values must not be null, which the functions below use to mean
+ * "not found".  The table may not be changed while it is being
+ * iterated. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A slot: a key and its value. */
+struct ihash_slot {
+	uint64_t key;
+	void *value;
+};
+
+/* Integer-keyed hash table. */
+struct ihash {
+	size_t elem_cnt;            /* Entries, in both arrays. */
+	size_t slot_cnt;            /* Slots, a power of 2 and at least 8, or 0. */
+	size_t used_cnt;            /* Slots that are not EMPTY. */
+	struct ihash_slot *slots;   /* SLOT_CNT slots. */
+	uint8_t *ctrl;              /* Control byte of each slot. */
+	struct ihash_slot *old_slots;   /* Slots being migrated, or null. */
+	uint8_t *old_ctrl;          /* Their control bytes. */
+	size_t old_slot_cnt;        /* Number of old slots. */
+	size_t migrate_idx;         /* Next old slot to migrate. */
+};
+
+/* An iterator. */
+struct ihash_iterator {
+	struct ihash *ih;           /* The table. */
+	bool old;                   /* In the old arrays? */
+	size_t idx;                 /* Next slot to look at. */
+	uint64_t key;               /* Key of the current entry. */
+	void *value;                /* Value of the current entry. */
+};
+
+void ihash_init (struct ihash *);
+void ihash_destroy (struct ihash *);
+
+void *ihash_find (struct ihash *, uint64_t key);
+bool ihash_insert (struct ihash *, uint64_t key, void *value);
+void *ihash_remove (struct ihash *, uint64_t key);
+
+void ihash_first (struct ihash_iterator *, struct ihash *);
+bool ihash_next (struct ihash_iterator *);
+
+size_t ihash_size (struct ihash *);
+bool ihash_empty (struct ihash *);
+
+#endif /* lib/kernel/ihash.h */
@@ -0,0 +1,68 @@
+#ifndef __LIB_KERNEL_ITREE_H
+#define __LIB_KERNEL_ITREE_H
+
+/* Interval tree.
+ *
+ * This is an intrusive, augmented AVL tree of half-open intervals
+ * [START, END).  Like the list, hash table and heap
+ * implementations, it does not use dynamic allocation.  Each
+ * structure that can potentially be in a tree must embed a
+ * struct itree_elem member, and the itree_entry macro converts a
+ * struct itree_elem back to the structure that contains it.
+ *
+ * Elements are ordered by start.  Each element also records the
+ * largest end in its subtree, so that itree_first_overlap() can
+ * find the lowest interval overlapping a range in O(log n) time
+ * even if intervals in the tree overlap each other.  Insertion
+ * and removal take O(log n) time and are iterative.
+ *
+ * The bounds of an element that is in a tree must not be changed;
+ * remove it and insert it again instead. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Interval tree element. */
+struct itree_elem {
+	struct itree_elem *parent;  /* Parent, or null for the root. */
+	struct itree_elem *left;    /* Left child. */
+	struct itree_elem *right;   /* Right child. */
+	uintptr_t start;            /* First value in the interval. */
+	uintptr_t end;              /* One past the last value. */
+	uintptr_t max_end;          /* Largest end in this subtree. */
+	int height;                 /* Height of this subtree. */
+};
+
+/* Converts pointer to interval tree element ITREE_ELEM into a
+ * pointer to the structure that ITREE_ELEM is embedded inside.
+ * Supply the name of the outer structure STRUCT and the member
+ * name MEMBER of the interval tree element. */
+#define itree_entry(ITREE_ELEM, STRUCT, MEMBER)         \
+	((STRUCT *) ((uint8_t *) &(ITREE_ELEM)->parent  \
+		- offsetof (STRUCT, MEMBER.parent)))
+
+/* Interval tree. */
+struct itree {
+	struct itree_elem *root;    /* Root, or null if empty. */
+	size_t elem_cnt;            /* Number of elements. */
+};
+
+void itree_init (struct itree *);
+
+void itree_insert (struct itree *, struct itree_elem *,
+		uintptr_t start, uintptr_t end);
+void itree_remove (struct itree *, struct itree_elem *);
+
+struct itree_elem *itree_find (struct itree *, uintptr_t point);
+struct itree_elem *itree_first_overlap (struct itree *,
+		uintptr_t start, uintptr_t end);
+
+/* Iteration in order of start. */
+struct itree_elem *itree_first (struct itree *);
+struct itree_elem *itree_next (struct itree_elem *);
+
+size_t itree_size (struct itree *);
+bool itree_empty (struct itree *);
+
+#endif /* lib/kernel/itree.h */
@@ -153,6 +153,9 @@ void list_sort (struct list *,
                 list_less_func *, void *aux);
 void list_insert_ordered (struct list *, struct list_elem *,
                           list_less_func *, void *aux);
+void list_insert_ordered_hint (struct list *, struct list_elem *,
+                               struct list_elem *hint,
+                               list_less_func *, void *aux);
 void list_unique (struct list *, struct list *duplicates,
                   list_less_func *, void *aux);
 
@@ -160,7 +163,4 @@ void list_unique (struct list *, struct list *duplicates,
 struct list_elem *list_max (struct list *, list_less_func *, void *aux);
 struct list_elem *list_min (struct list *, list_less_func *, void *aux);
 
-/* compare */
-bool compare (const struct list_elem *, const struct list_elem *, void *aux);
-
 #endif /* lib/kernel/list.h */
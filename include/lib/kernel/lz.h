@@ -0,0 +1,33 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+/* LZ77 compression, in a block format modeled on LZ4's.
+ *
+ * A block is a series of sequences, each a token byte, literals
+ * copied as they are, and a match: a copy of earlier output.  The
+ * high 4 bits of the token count the literals and the low 4 the
+ * bytes of the match past LZ_MIN_MATCH; a count of 15 goes on in
+ * the bytes after, each adding up to 255, the last less.  The
+ * literals follow, then the match's distance back, 2 bytes little
+ * endian, then the rest of its length.  The last sequence ends
+ * after its literals, with the block.  LZ4's end-of-block rules,
+ * such as the minimum run of literals it ends on, are not
+ * followed, so an LZ4 decoder may reject the blocks made here.
+ *
+ * Compression finds matches through a hash table of the positions
+ * of 4-byte strings, in LZ_WORK_SIZE bytes that the caller lends,
+ * one probe per position, so it is fast rather than thorough. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZ_MIN_MATCH 4                  /* Shortest match. */
+#define LZ_MAX_SIZE 65535               /* Most bytes compressed at once. */
+#define LZ_HASH_BITS 10
+#define LZ_WORK_SIZE ((1 << LZ_HASH_BITS) * sizeof (uint16_t))
+
+size_t lz_compress (const void *, size_t, void *dst, size_t cap, void *work);
+bool lz_decompress (const void *, size_t, void *dst, size_t dst_size);
+
+#endif /* lib/kernel/lz.h */
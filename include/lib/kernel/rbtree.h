@@ -0,0 +1,85 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+/* Red-black tree.
+ *
+ * This is an intrusive, ordered binary search tree.  Like the
+ * list, hash table and heap implementations, it does not use
+ * dynamic allocation.  Each structure that can potentially be in
+ * a tree must embed a struct rbtree_elem member, and the
+ * rbtree_entry macro converts a struct rbtree_elem back to the
+ * structure that contains it.
+ *
+ * The tree is ordered by a "less" function supplied at
+ * initialization time.  Equal elements may coexist; a new one goes
+ * after those already in the tree, so equal elements come out in
+ * the order they went in.  Insertion, removal, search and
+ * rbtree_first() and rbtree_last() take O(log n) time, and
+ * rbtree_next() and rbtree_prev() amortized constant time.  All
+ * operations are iterative.
+ *
+ * Searches take a probe: an element, usually on the caller's
+ * stack, whose key is set to the value to look for and which is
+ * never linked into the tree.
+ *
+ * Changing the key of an element that is in a tree breaks the tree
+ * invariant; remove it and insert it again instead. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Red-black tree element. */
+struct rbtree_elem {
+	struct rbtree_elem *parent; /* Parent, or null for the root. */
+	struct rbtree_elem *left;   /* Left child. */
+	struct rbtree_elem *right;  /* Right child. */
+	bool red;                   /* Red, or black? */
+};
+
+/* Converts pointer to red-black tree element RBTREE_ELEM into a
+ * pointer to the structure that RBTREE_ELEM is embedded inside.
+ * Supply the name of the outer structure STRUCT and the member
+ * name MEMBER of the red-black tree element. */
+#define rbtree_entry(RBTREE_ELEM, STRUCT, MEMBER)       \
+	((STRUCT *) ((uint8_t *) &(RBTREE_ELEM)->parent \
+		- offsetof (STRUCT, MEMBER.parent)))
+
+/* Compares the value of two red-black tree elements A and B, given
+ * auxiliary data AUX.  Returns true if A is less than B, or false
+ * if A is greater than or equal to B. */
+typedef bool rbtree_less_func (const struct rbtree_elem *a,
+                               const struct rbtree_elem *b,
+                               void *aux);
+
+/* Red-black tree. */
+struct rbtree {
+	struct rbtree_elem *root;   /* Root, or null if empty. */
+	size_t elem_cnt;            /* Number of elements. */
+	rbtree_less_func *less;     /* Comparison function. */
+	void *aux;                  /* Auxiliary data for `less'. */
+};
+
+void rbtree_init (struct rbtree *, rbtree_less_func *, void *aux);
+
+void rbtree_insert (struct rbtree *, struct rbtree_elem *);
+void rbtree_remove (struct rbtree *, struct rbtree_elem *);
+
+/* Search. */
+struct rbtree_elem *rbtree_find (struct rbtree *,
+		const struct rbtree_elem *probe);
+struct rbtree_elem *rbtree_lower_bound (struct rbtree *,
+		const struct rbtree_elem *probe);
+struct rbtree_elem *rbtree_upper_bound (struct rbtree *,
+		const struct rbtree_elem *probe);
+
+/* Iteration in order. */
+struct rbtree_elem *rbtree_first (struct rbtree *);
+struct rbtree_elem *rbtree_last (struct rbtree *);
+struct rbtree_elem *rbtree_next (struct rbtree_elem *);
+struct rbtree_elem *rbtree_prev (struct rbtree_elem *);
+
+size_t rbtree_size (struct rbtree *);
+bool rbtree_empty (struct rbtree *);
+
+#endif /* lib/kernel/rbtree.h */
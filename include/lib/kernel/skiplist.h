@@ -0,0 +1,109 @@
+#ifndef __LIB_KERNEL_SKIPLIST_H
+#define __LIB_KERNEL_SKIPLIST_H
+
+/* Indexable skip list.
+ *
+ * This is an intrusive, ordered list.  Like the list, hash table
+ * and heap implementations, it does not use dynamic allocation.
+ * Each structure that can potentially be in a skip list must embed
+ * a struct skiplist_elem member, and the skiplist_entry macro
+ * converts a struct skiplist_elem back to the structure that
+ * contains it.
+ *
+ * Besides the ordinary links, an element is linked into up to
+ * SKIPLIST_MAX_LEVEL - 1 express lanes, each of which skips about
+ * 3 of every 4 elements of the lane below it; an element's number
+ * of lanes is drawn at random when it is inserted.  Insertion and
+ * search take expected O(log n) time, removal expected O(log n)
+ * time without comparing elements, and skiplist_front(),
+ * skiplist_back(), skiplist_next() and skiplist_prev() constant
+ * time.  Each link also records how many elements it skips, so the
+ * list can be indexed by position in expected O(log n) time too.
+ * The lanes suit lists of up to about 4^SKIPLIST_MAX_LEVEL
+ * elements; longer lists still work, only slower.
+ *
+ * The list is ordered by a "less" function supplied at
+ * initialization time.  Equal elements may coexist; a new one goes
+ * after those already in the list.  Searches take a probe: an
+ * element, usually on the caller's stack, whose key is set to the
+ * value to look for and which is never linked into the list.
+ *
+ * Changing the key of an element that is in a list breaks the list
+ * invariant; remove it and insert it again instead. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Levels of links, the ordinary one included. */
+#define SKIPLIST_MAX_LEVEL 8
+
+struct skiplist_elem;
+
+/* A link of an element in one lane. */
+struct skiplist_link {
+	struct skiplist_elem *prev; /* Previous in lane, null if first. */
+	struct skiplist_elem *next; /* Next in lane, null if last. */
+	size_t span;                /* Positions from here to NEXT. */
+};
+
+/* Skip list element. */
+struct skiplist_elem {
+	int level;                  /* Lanes this element is in. */
+	struct skiplist_link link[SKIPLIST_MAX_LEVEL];
+};
+
+/* Converts pointer to skip list element SKIPLIST_ELEM into a
+ * pointer to the structure that SKIPLIST_ELEM is embedded inside.
+ * Supply the name of the outer structure STRUCT and the member
+ * name MEMBER of the skip list element. */
+#define skiplist_entry(SKIPLIST_ELEM, STRUCT, MEMBER)   \
+	((STRUCT *) ((uint8_t *) &(SKIPLIST_ELEM)->level \
+		- offsetof (STRUCT, MEMBER.level)))
+
+/* Compares the value of two skip list elements A and B, given
+ * auxiliary data AUX.  Returns true if A is less than B, or false
+ * if A is greater than or equal to B. */
+typedef bool skiplist_less_func (const struct skiplist_elem *a,
+                                 const struct skiplist_elem *b,
+                                 void *aux);
+
+/* Skip list. */
+struct skiplist {
+	struct skiplist_elem head;  /* Links to the first elements. */
+	struct skiplist_elem *tail; /* Last element, or null. */
+	int level;                  /* Lanes in use, at least 1. */
+	size_t elem_cnt;            /* Number of elements. */
+	uint64_t seed;              /* State for drawing levels. */
+	skiplist_less_func *less;   /* Comparison function. */
+	void *aux;                  /* Auxiliary data for `less'. */
+};
+
+void skiplist_init (struct skiplist *, skiplist_less_func *, void *aux);
+
+void skiplist_insert (struct skiplist *, struct skiplist_elem *);
+void skiplist_remove (struct skiplist *, struct skiplist_elem *);
+struct skiplist_elem *skiplist_pop_front (struct skiplist *);
+
+/* Search. */
+struct skiplist_elem *skiplist_find (struct skiplist *,
+		const struct skiplist_elem *probe);
+struct skiplist_elem *skiplist_lower_bound (struct skiplist *,
+		const struct skiplist_elem *probe);
+struct skiplist_elem *skiplist_upper_bound (struct skiplist *,
+		const struct skiplist_elem *probe);
+
+/* Indexing. */
+struct skiplist_elem *skiplist_get (struct skiplist *, size_t idx);
+size_t skiplist_index (struct skiplist *, struct skiplist_elem *);
+
+/* Iteration in order. */
+struct skiplist_elem *skiplist_front (struct skiplist *);
+struct skiplist_elem *skiplist_back (struct skiplist *);
+struct skiplist_elem *skiplist_next (struct skiplist_elem *);
+struct skiplist_elem *skiplist_prev (struct skiplist_elem *);
+
+size_t skiplist_size (struct skiplist *);
+bool skiplist_empty (struct skiplist *);
+
+#endif /* lib/kernel/skiplist.h */
@@ -0,0 +1,22 @@
+#ifndef __LIB_POLL_H
+#define __LIB_POLL_H
+
+/* A file descriptor for poll() to wait on, and the events to wait
+   for.  POLLERR, POLLHUP and POLLNVAL are reported in REVENTS
+   whether they are asked for or not. */
+struct pollfd {
+	int fd;                     /* Descriptor, or negative to skip. */
+	short events;               /* Events waited for. */
+	short revents;              /* Events ready, set by poll(). */
+};
+
+#define POLLIN 0x001            /* Can read without blocking. */
+#define POLLOUT 0x004           /* Can write without blocking. */
+#define POLLERR 0x008           /* Write end of a pipe with no readers. */
+#define POLLHUP 0x010           /* Read end of a pipe with no writers. */
+#define POLLNVAL 0x020          /* Descriptor not open. */
+
+/* Most descriptors one poll() waits on. */
+#define POLL_MAX 256
+
+#endif /* lib/poll.h */
@@ -2,9 +2,20 @@
 #define __LIB_RANDOM_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+/* State of a fast generator, for a thread, or anything else, that
+   wants a sequence of its own. */
+struct random_state {
+	uint64_t s[4];
+};
 
 void random_init (unsigned seed);
 void random_bytes (void *, size_t);
 unsigned long random_ulong (void);
 
+void random_state_init (struct random_state *, uint64_t seed);
+uint64_t random_state_u64 (struct random_state *);
+uint64_t random_u64 (void);
+
 #endif /* lib/random.h */
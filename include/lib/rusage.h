@@ -0,0 +1,19 @@
+#ifndef __LIB_RUSAGE_H
+#define __LIB_RUSAGE_H
+
+/* Whose usage getrusage() reports. */
+#define RUSAGE_SELF 0               /* The calling process. */
+#define RUSAGE_CHILDREN (-1)        /* Its children that were waited for. */
+
+/* Resources a process used, as getrusage() returns them. */
+struct rusage {
+	long long ru_ticks;             /* Timer ticks spent running. */
+	long long ru_faults;            /* Page faults taken. */
+	long long ru_swapins;           /* Pages read back in from swap. */
+	long long ru_inblock;           /* Sectors read from disk for it. */
+	long long ru_oublock;           /* Cached sectors it made dirty. */
+	long long ru_nvcsw;             /* Times it blocked. */
+	long long ru_nivcsw;            /* Times it was preempted or yielded. */
+};
+
+#endif /* lib/rusage.h */
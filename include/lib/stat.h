@@ -0,0 +1,12 @@
+#ifndef __LIB_STAT_H
+#define __LIB_STAT_H
+
+/* What stat() and fstat() report about a file. */
+struct stat {
+	int st_ino;                     /* Inode number. */
+	int st_size;                    /* Length in bytes. */
+	int st_nlink;                   /* Directory entries naming it. */
+	int st_isdir;                   /* Nonzero for a directory. */
+};
+
+#endif /* lib/stat.h */
@@ -11,7 +11,7 @@ enum {
 	SYS_WAIT,                   /* Wait for a child process to die. */
 	SYS_CREATE,                 /* Create a file. */
 	SYS_REMOVE,                 /* Delete a file. */
-	SYS_OPEN,                   /* Open a file. */
+	SYS_OPEN,                   /* Open a file, with O_* flags. */
 	SYS_FILESIZE,               /* Obtain a file's size. */
 	SYS_READ,                   /* Read from a file. */
 	SYS_WRITE,                  /* Write to a file. */
@@ -36,6 +36,62 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Extra */
+	SYS_SPAWN,                  /* Start a new process from a file. */
+	SYS_READV,                  /* Read from a file into several buffers. */
+	SYS_WRITEV,                 /* Write to a file from several buffers. */
+	SYS_PREAD,                  /* Read from a given offset in a file. */
+	SYS_PWRITE,                 /* Write at a given offset in a file. */
+	SYS_PIPE,                   /* Create a pipe. */
+	SYS_GETDENTS,               /* Read many directory entries. */
+	SYS_GETRUSAGE,              /* Report resource usage. */
+	SYS_MADVISE,                /* Give advice about use of memory. */
+	SYS_MSYNC,                  /* Write back a file mapping. */
+	SYS_CLONE,                  /* Start a thread in this process. */
+	SYS_EXIT_THREAD,            /* Terminate this thread. */
+	SYS_FUTEX,                  /* Wait on or wake a word of memory. */
+	SYS_IO_SETUP,               /* Map rings of asynchronous file I/O. */
+	SYS_IO_ENTER,               /* Submit and wait for ring operations. */
+	SYS_COPY_FILE_RANGE,        /* Copy between files in the kernel. */
+	SYS_STAT,                   /* Describe a file by name. */
+	SYS_FSTAT,                  /* Describe an open file. */
+	SYS_FSYNC,                  /* Write a file's changes to disk. */
+	SYS_SYNC,                   /* Write all changes to disk. */
+	SYS_FALLOCATE,              /* Allocate a file's blocks up front. */
+	SYS_FTRUNCATE,              /* Set a file's length. */
+	SYS_ZYGOTE,                 /* Keep a loaded program to copy. */
+	SYS_CLONE_FILE,             /* Copy a file by sharing its data. */
+	SYS_POLL,                   /* Wait for descriptors to be ready. */
 };
 
+/* File descriptor argument of mmap() that asks for zeroed,
+   anonymous memory instead of a file mapping. */
+#define MMAP_ANON -1
+
+/* Channel argument of mount() that asks for a tmpfs, a file system
+   held in memory, of as many kB as the device argument gives. */
+#define MOUNT_TMPFS -1
+
+/* Flags of mount_flags(). */
+#define MOUNT_FORMAT 0x1        /* Make a new, empty file system first. */
+
+/* Flags of mmap_flags(). */
+#define MAP_POPULATE 0x1        /* Map every page right away. */
+#define MAP_SHARED 0x2          /* Anonymous memory shared with children. */
+
+/* Advice to madvise().  The first three set the access pattern
+   expected of the areas in the range; the others act on the pages
+   in it right away. */
+#define MADV_NORMAL 0           /* No particular pattern. */
+#define MADV_RANDOM 1           /* Random accesses: no read-ahead. */
+#define MADV_SEQUENTIAL 2       /* One pass in order: read ahead more,
+                                   and drop pages once used. */
+#define MADV_WILLNEED 3         /* Start reading the pages in. */
+#define MADV_DONTNEED 4         /* Drop the pages now. */
+
+/* Operations of futex(). */
+#define FUTEX_WAIT 0            /* Sleep if the word holds VAL. */
+#define FUTEX_WAKE 1            /* Wake up to VAL sleepers. */
+
 #endif /* lib/syscall-nr.h */
@@ -4,4 +4,12 @@
 int hprintf (int, const char *, ...) PRINTF_FORMAT (2, 3);
 int vhprintf (int, const char *, va_list) PRINTF_FORMAT (2, 0);
 
+/* Buffering modes of the standard output, for setvbuf(). */
+#define _IOFBF 0        /* Write when the buffer fills up. */
+#define _IOLBF 1        /* Also write at the end of a line (default). */
+#define _IONBF 2        /* Write at the end of each call. */
+
+int setvbuf (int handle, int mode);
+int fflush (int handle);
+
 #endif /* lib/user/stdio.h */
@@ -4,6 +4,14 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include <iovec.h>
+#include <ioring.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <rusage.h>
+#include <stat.h>
+#include <vdso.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -29,6 +37,7 @@ int wait (pid_t);
 bool create (const char *file, unsigned initial_size);
 bool remove (const char *file);
 int open (const char *file);
+int open_flags (const char *file, int flags);
 int filesize (int fd);
 int read (int fd, void *buffer, unsigned length);
 int write (int fd, const void *buffer, unsigned length);
@@ -37,10 +46,44 @@ unsigned tell (int fd);
 void close (int fd);
 
 int dup2(int oldfd, int newfd);
+pid_t spawn (const char *cmd_line);
+int zygote (const char *file);
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int pread (int fd, void *buffer, unsigned length, off_t offset);
+int pwrite (int fd, const void *buffer, unsigned length, off_t offset);
+int copy_file_range (int in_fd, int out_fd, unsigned length);
+int pipe (int fds[2]);
+int getdents (int fd, struct dirent *ents, unsigned cnt);
+int getrusage (int who, struct rusage *usage);
+int stat (const char *file, struct stat *st);
+int fstat (int fd, struct stat *st);
+int fsync (int fd);
+void sync (void);
+int fallocate (int fd, off_t len);
+int ftruncate (int fd, off_t len);
+int clone_file (const char *src, const char *dst);
+int poll (struct pollfd *fds, unsigned nfds, int timeout);
 
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
+void *mmap_flags (void *addr, size_t length, int writable, int fd,
+		off_t offset, int flags);
 void munmap (void *addr);
+int msync (void *addr, size_t length);
+int madvise (void *addr, size_t length, int advice);
+
+/* Threads.  clone() starts a thread that runs FUNC (ARG) in this
+   process, on a stack of its own, and ends when FUNC returns or
+   calls exit_thread().  Then *CTID, if CTID is not null, is set
+   to 0 and woken as a futex.  exit() ends every thread. */
+pid_t clone (void (*func) (void *), void *arg, int *ctid);
+void exit_thread (void) NO_RETURN;
+int futex (int *addr, int op, int val);
+
+/* Asynchronous file operations; see lib/ioring.h. */
+struct io_ring *io_setup (void);
+int io_enter (unsigned to_submit, unsigned min_complete);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -50,6 +93,14 @@ bool isdir (int fd);
 int inumber (int fd);
 int symlink (const char* target, const char* linkpath);
 
+/* Mounts disk DEV_NO of channel CHAN_NO on PATH, or with CHAN_NO
+   MOUNT_TMPFS a tmpfs of DEV_NO kB.  A disk must hold a file
+   system already unless FLAGS has MOUNT_FORMAT, which makes a new
+   one, erasing what the disk held. */
+int mount (const char *path, int chan_no, int dev_no);
+int mount_flags (const char *path, int chan_no, int dev_no, int flags);
+int umount (const char *path);
+
 static inline void* get_phys_addr (void *user_addr) {
 	void* pa;
 	asm volatile ("movq %0, %%rax" ::"r"(user_addr));
@@ -78,4 +129,65 @@ get_fs_disk_write_cnt (void) {
 	return write_cnt;
 }
 
+/* Counts of what the buffer cache did since boot, in the order of
+ * struct cache_stats in filesys/cache.h. */
+struct cache_stats {
+	long long hits;             /* Uses of a cached sector. */
+	long long misses;           /* Uses of a sector not cached. */
+	long long evictions;        /* Sectors replaced by others. */
+	long long writebacks;       /* Dirty sectors written back. */
+	long long ra_hits;          /* Sectors read ahead, then used. */
+	long long ra_wasted;        /* Sectors read ahead, never used. */
+};
+
+static inline void
+get_cache_stats (struct cache_stats *s) {
+	long long *counters = (long long *) s;
+	long i;
+
+	for (i = 0; i < (long) (sizeof *s / sizeof *counters); i++)
+		asm volatile ("int $0x4b" : "=a" (counters[i]) : "D" (i));
+}
+
+/* Returns counter WHAT of system call NR, numbered as for int 0x4d
+ * in userprog/syscall.c: 0 for calls, 1 cycles of work, 2 cycles
+ * waiting for locks, then the buckets of their histograms.  Returns
+ * -1 if NR or WHAT is out of range.  The kernel counts only if run
+ * with "-counters". */
+static inline long long
+get_syscall_stat (int nr, int what) {
+	long long value;
+
+	asm volatile ("int $0x4d" : "=a" (value)
+			: "D" ((long) nr), "S" ((long) what));
+	return value;
+}
+
+/* Read from the vDSO pages, without entering the kernel. */
+
+/* Returns the number of timer ticks since boot. */
+static inline long long
+get_ticks (void) {
+	return ((const struct vdso *) VDSO_BASE)->ticks;
+}
+
+/* Returns the number of timer ticks per second. */
+static inline int
+get_timer_freq (void) {
+	return ((const struct vdso *) VDSO_BASE)->timer_freq;
+}
+
+/* Returns the TSC frequency in Hz, or 0 if the kernel did not
+ * measure it. */
+static inline unsigned long long
+get_tsc_hz (void) {
+	return ((const struct vdso *) VDSO_BASE)->tsc_hz;
+}
+
+/* Returns the process id of the calling process. */
+static inline pid_t
+getpid (void) {
+	return ((const struct vdso_proc *) VDSO_PROC)->pid;
+}
+
 #endif /* lib/user/syscall.h */
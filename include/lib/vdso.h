@@ -0,0 +1,28 @@
+#ifndef __LIB_VDSO_H
+#define __LIB_VDSO_H
+
+#include <stdint.h>
+
+/* Kernel data that user programs read in place of system calls.
+
+   Every process has two read-only pages mapped just above its
+   stack: at VDSO_BASE a struct vdso, the same page in every
+   process, which the kernel updates on each timer tick, and at
+   VDSO_PROC a struct vdso_proc of the process's own. */
+#define VDSO_BASE 0x47481000        /* One guard page above USER_STACK. */
+#define VDSO_PROC 0x47482000        /* The process's own page. */
+#define VDSO_END  0x47483000        /* End of the pages. */
+
+/* System-wide data. */
+struct vdso {
+	volatile int64_t ticks;         /* Timer ticks since boot. */
+	int64_t timer_freq;             /* Timer ticks per second. */
+	uint64_t tsc_hz;                /* TSC frequency in Hz, 0 if unknown. */
+};
+
+/* Data of one process. */
+struct vdso_proc {
+	int pid;                        /* Process id. */
+};
+
+#endif /* lib/vdso.h */
@@ -0,0 +1,21 @@
+#ifndef THREADS_CPU_H
+#define THREADS_CPU_H
+
+#include <stdint.h>
+
+/* Maximum number of CPUs cpu_init() keeps track of. */
+#define CPU_MAX 16
+
+/* A CPU that the firmware reported. */
+struct cpu {
+	int id;                             /* Index in cpus[]. */
+	uint8_t apic_id;                    /* Local APIC ID. */
+};
+
+/* The CPUs found, the bootstrap processor first. */
+extern struct cpu cpus[CPU_MAX];
+extern int cpu_cnt;
+
+void cpu_init (void);
+
+#endif /* threads/cpu.h */
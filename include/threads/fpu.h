@@ -0,0 +1,16 @@
+#ifndef THREADS_FPU_H
+#define THREADS_FPU_H
+
+#include <stdbool.h>
+
+struct thread;
+
+void fpu_init (void);
+bool fpu_has_sse2 (void);
+void fpu_switch (struct thread *next);
+void fpu_exit (void);
+
+void kernel_fpu_begin (void);
+void kernel_fpu_end (void);
+
+#endif /* threads/fpu.h */
@@ -0,0 +1,85 @@
+#ifndef THREADS_INSTRUMENT_H
+#define THREADS_INSTRUMENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Switches for instrumentation on hot paths.
+
+   A static key guards code that is normally off, such as a
+   tracepoint or an event counter.  If the kernel is built with
+   INSTRUMENT, as it is unless "make INSTRUMENT=0" says otherwise
+   (see Make.config), each static_branch_unlikely() on a key is a
+   5-byte no-op, and static_key_enable() rewrites every one of them
+   into a jump to the code it guards.  While the key is off, that
+   code costs not even the load of a flag.  Built without
+   INSTRUMENT, static_branch_unlikely() is false and the code it
+   guards compiles away. */
+
+struct static_key {
+	bool enabled;                   /* Do its branches jump? */
+};
+
+/* Defines static key NAME, initially off.  The branch table refers
+   to keys by symbol, so a key must be a global variable and
+   static_branch_unlikely() must be given its name. */
+#define DEFINE_STATIC_KEY(NAME) struct static_key NAME = { false }
+
+#ifdef INSTRUMENT
+/* Evaluates to true if static key NAME is on.  Records the no-op
+   that stands for the branch, where to jump, and the key, in the
+   __jump_table section. */
+#define static_branch_unlikely(NAME) __extension__ ({                   \
+	__label__ on_, out_;                                          \
+	bool taken_;                                                  \
+	asm goto ("1: .byte 0x0f, 0x1f, 0x44, 0x00, 0x00\n\t"         \
+			".pushsection __jump_table, \"aw\"\n\t"               \
+			".balign 8\n\t"                                       \
+			".quad 1b, %l[on_], " #NAME "\n\t"                    \
+			".popsection"                                         \
+			: : : : on_);                                         \
+	taken_ = false;                                               \
+	goto out_;                                                    \
+on_:                                                              \
+	taken_ = true;                                                \
+out_:                                                             \
+	taken_; })
+#else
+#define static_branch_unlikely(NAME) false
+#endif
+
+void static_key_enable (struct static_key *);
+void static_key_disable (struct static_key *);
+
+/* An event counter.  It counts only while counters are on, with
+   kernel command-line option "-counters", and its count is printed
+   at power off.  Counting is not atomic, so a count taken both in
+   and out of interrupt handlers may miss an event now and then. */
+struct counter {
+	const char *name;               /* Printed name. */
+	uint64_t value;                 /* Events counted. */
+};
+
+/* Defines counter NAME.  Counters are gathered in the __counters
+   section, from which counters_print() lists them. */
+#define DEFINE_COUNTER(NAME)                                          \
+	static struct counter NAME                                        \
+	__attribute__ ((section ("__counters"), aligned (8), used))      \
+	= { #NAME, 0 }
+
+/* Adds N to counter NAME, if counters are on. */
+#define COUNTER_ADD(NAME, N)                                          \
+	do {                                                              \
+		if (static_branch_unlikely (counters_key))                \
+			(NAME).value += (N);                                  \
+	} while (0)
+#define COUNTER_INC(NAME) COUNTER_ADD (NAME, 1)
+
+/* Counters asked for by kernel command-line option "-counters". */
+extern bool counters_enabled;
+extern struct static_key counters_key;
+
+void counters_init (void);
+void counters_print (void);
+
+#endif /* threads/instrument.h */
@@ -0,0 +1,21 @@
+#ifndef THREADS_INTR_STATS_H
+#define THREADS_INTR_STATS_H
+
+#include <stdint.h>
+
+/* Number of log2 buckets in an interrupt latency histogram.
+   Bucket B counts latencies of [2**(B-1), 2**B) TSC cycles; bucket
+   0 counts zero and the last bucket also counts everything
+   above. */
+#define INTR_HIST_BUCKETS 32
+
+/* Number of interrupts-off windows kept as the worst offenders. */
+#define INTR_OFF_SITES 8
+
+void intr_stats_register (uint8_t vec);
+void intr_stats_handler (uint8_t vec, uint64_t cycles);
+void intr_stats_off (uintptr_t disable_site, uintptr_t enable_site,
+		uint64_t cycles);
+void intr_stats_print (void);
+
+#endif /* threads/intr-stats.h */
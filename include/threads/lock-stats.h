@@ -0,0 +1,25 @@
+#ifndef THREADS_LOCK_STATS_H
+#define THREADS_LOCK_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct lock;
+
+/* Contention statistics shared by the locks given one name. */
+struct lock_stats {
+	const char *name;                   /* Name given to lock_set_name(). */
+	uint64_t acquire_cnt;               /* Times acquired. */
+	uint64_t contended_cnt;             /* Times found held by another. */
+	uint64_t wait_cycles;               /* Total cycles spent waiting. */
+	uint64_t max_wait;                  /* Longest wait, in cycles. */
+	uint64_t hold_cycles;               /* Total cycles held. */
+	uint64_t max_hold;                  /* Longest hold, in cycles. */
+};
+
+void lock_set_name (struct lock *, const char *name);
+void lock_stats_acquired (struct lock *, bool contended, uint64_t start);
+void lock_stats_released (struct lock *);
+void lock_stats_print (void);
+
+#endif /* threads/lock-stats.h */
@@ -2,12 +2,25 @@
 #define THREADS_MALLOC_H
 
 #include <debug.h>
+#include <stdbool.h>
 #include <stddef.h>
 
+/* malloc() statistics of one size class. */
+struct malloc_stats {
+	size_t block_size;          /* Size of blocks, 0 for big blocks. */
+	size_t page_cnt;            /* Pages held. */
+	size_t live_cnt;            /* Blocks allocated and not freed. */
+	size_t peak_cnt;            /* High-water mark of live_cnt. */
+	size_t failed_cnt;          /* Requests that returned null. */
+};
+
 void malloc_init (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
+bool malloc_get_stats (size_t class, struct malloc_stats *);
+void malloc_print_stats (void);
+void register_malloc_inspect_intr (void);
 
 #endif /* threads/malloc.h */
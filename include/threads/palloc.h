@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -14,10 +15,42 @@ enum palloc_flags {
 /* Maximum number of pages to put in user pool. */
 extern size_t user_page_limit;
 
+/* If false (default), pools are managed by a first-fit bitmap.
+   If true, pools are managed by a binary buddy allocator.
+   Controlled by kernel command-line option "-palloc=buddy". */
+extern bool palloc_buddy;
+
+/* If true (default), each class borrows pages from the other's
+   pool when its own runs out.  Kernel command-line option
+   "-no-borrow" turns it off, for the fixed split of "-ul". */
+extern bool palloc_borrow;
+
+/* Page allocator statistics of one pool. */
+struct palloc_stats {
+	size_t page_cnt;            /* Usable pages. */
+	size_t live_cnt;            /* Pages allocated and not freed. */
+	size_t peak_cnt;            /* High-water mark of live_cnt. */
+	size_t failed_cnt;          /* Requests that returned no pages. */
+	size_t cached_cnt;          /* Free pages held in caches. */
+	size_t largest_free;        /* Longest run of free pages. */
+	size_t lent_cnt;            /* Pages ever lent to the other class. */
+};
+
 uint64_t palloc_init (void);
+void palloc_start_zeroer (void);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
+void *palloc_get_aligned (enum palloc_flags, size_t page_cnt, size_t align);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+void palloc_free_pages (void *pages[], size_t cnt);
+bool palloc_resize (void *pages, size_t page_cnt, size_t new_cnt);
+void palloc_get_stats (enum palloc_flags, struct palloc_stats *);
+size_t palloc_free_count (enum palloc_flags);
+void clear_page (void *page);
+void copy_page (void *dst, const void *src);
+bool palloc_user_overlaps (const void *start, const void *end);
+void palloc_print_stats (void);
+void register_palloc_inspect_intr (void);
 
 #endif /* threads/palloc.h */
@@ -0,0 +1,46 @@
+#ifndef THREADS_POLL_H
+#define THREADS_POLL_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Waiting for any of several objects to become ready.  Each object
+   that poll() can wait for has a poll_queue, which it wakes with
+   poll_wake() whenever it may have become ready. */
+
+struct thread;
+struct poll_table;
+
+/* Threads polling an object. */
+struct poll_queue {
+	struct list entries;        /* Their struct poll_entry's. */
+};
+
+/* A poll_table's place on a poll_queue. */
+struct poll_entry {
+	struct list_elem elem;      /* Element in QUEUE's entries. */
+	struct poll_queue *queue;   /* Queue it is on. */
+	struct poll_table *table;   /* Table it belongs to. */
+};
+
+/* The queues that one poll() waits on.  Owned by its thread, which
+   must keep it alive until poll_table_done(). */
+struct poll_table {
+	struct thread *thread;      /* Thread polling. */
+	bool woken;                 /* A queue woken since poll_sleep()? */
+	struct poll_entry *entries; /* CAP entries, CNT of them queued. */
+	size_t cnt;
+	size_t cap;
+};
+
+void poll_queue_init (struct poll_queue *);
+void poll_wake (struct poll_queue *);
+
+void poll_table_init (struct poll_table *, struct poll_entry *, size_t cap);
+void poll_add (struct poll_table *, struct poll_queue *);
+void poll_sleep (struct poll_table *, int64_t deadline);
+void poll_table_done (struct poll_table *);
+
+#endif /* threads/poll.h */
@@ -0,0 +1,30 @@
+#ifndef THREADS_SCHED_STATS_H
+#define THREADS_SCHED_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct thread;
+
+/* Number of log2 buckets in a latency histogram.  Bucket B counts
+   latencies of [2**(B-1), 2**B) TSC cycles; bucket 0 counts zero
+   and the last bucket also counts everything above. */
+#define SCHED_HIST_BUCKETS 40
+
+/* Scheduler statistics kept in each thread. */
+struct sched_thread_stats {
+	uint64_t ready_stamp;               /* TSC when last made ready. */
+	bool woken;                         /* Made ready by thread_unblock()? */
+	uint64_t run_cnt;                   /* Times scheduled in. */
+	uint64_t preempt_cnt;               /* Times switched out while ready. */
+	uint64_t wait_cycles;               /* Total cycles spent ready. */
+};
+
+void sched_stats_unblock (struct thread *);
+void sched_stats_schedule (struct thread *curr, struct thread *next,
+		bool preempted);
+void sched_stats_launch (struct thread *next);
+void sched_stats_print (void);
+void register_sched_inspect_intr (void);
+
+#endif /* threads/sched-stats.h */
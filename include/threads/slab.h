@@ -0,0 +1,20 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Object constructor.  Brings a fresh object into its constructed
+   state, once, when the slab page that holds it is created. */
+typedef void kmem_ctor_func (void *obj);
+
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+		size_t align, kmem_ctor_func *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+
+bool slab_owns (const void *);
+void slab_free (void *);
+size_t slab_object_size (const void *);
+
+#endif /* threads/slab.h */
@@ -1,13 +1,21 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
+
+struct condition;
+struct lock_stats;
+struct thread;
 
 /* A counting semaphore. */
 struct semaphore {
 	unsigned value;             /* Current value. */
-	struct list waiters;        /* List of waiting threads. */
+	struct heap waiters;        /* Waiting threads, highest priority first. */
+	struct condition *cond;     /* Condition waited on through this, if any. */
 };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -15,12 +23,16 @@ void sema_down (struct semaphore *);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
+void sema_waiter_update (struct thread *);
 
 /* Lock. */
 struct lock {
 	struct thread *holder;      /* Thread holding lock (for debugging). */
 	struct semaphore semaphore; /* Binary semaphore controlling access. */
-	bool is_hyped;				/* holder가 있는 상태에서 acquire를 또 시도당하면 true */
+	struct heap donors;         /* Waiting threads, highest priority first. */
+	struct heap_elem elem;      /* Element in holder's held_locks. */
+	struct lock_stats *stats;   /* Statistics, if named. */
+	uint64_t acquired;          /* TSC when acquired, if named. */
 };
 
 void lock_init (struct lock *);
@@ -29,9 +41,13 @@ bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+int lock_max_donation (struct thread *);
+bool lock_donation_less (const struct heap_elem *, const struct heap_elem *,
+		void *aux);
+
 /* Condition variable. */
 struct condition {
-	struct list waiters;        /* List of waiting threads. */
+	struct heap waiters;        /* Waiting semaphores, highest priority first. */
 };
 
 void cond_init (struct condition *);
@@ -39,6 +55,30 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Reader-writer lock. */
+struct rwlock {
+	struct lock writer;         /* Held by the writer, passed by readers. */
+	unsigned readers;           /* Number of active readers. */
+	bool draining;              /* Writer waiting for readers to leave? */
+	struct semaphore drained;   /* Upped by the last reader to leave. */
+};
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+
+/* Spinlock. */
+struct spinlock {
+	bool locked;                /* Held? */
+	enum intr_level old_level;  /* Interrupt level before acquiring. */
+};
+
+void spin_init (struct spinlock *);
+void spin_lock (struct spinlock *);
+void spin_unlock (struct spinlock *);
+
 /* Optimization barrier.
  *
  * The compiler will not reorder operations across an
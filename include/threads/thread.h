@@ -2,9 +2,16 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
+#include <heap.h>
 #include <list.h>
+#include <rbtree.h>
+#include <rusage.h>
 #include <stdint.h>
 #include "threads/interrupt.h"
+#include "threads/fixed-point.h"
+#include "threads/sched-stats.h"
+#include "threads/synch.h"
 
 #ifdef VM
 #include "vm/vm.h"
@@ -18,6 +25,16 @@ enum thread_status {
 	THREAD_DYING        /* About to be destroyed. */
 };
 
+/* Points in a process's last exec(), which the thread stamps with
+   the TSC for benchmarks to read through int 0x4c. */
+enum launch_stamp {
+	LAUNCH_START,       /* exec() began. */
+	LAUNCH_LOADED,      /* Executable image is in place. */
+	LAUNCH_ARGS,        /* Arguments are set up, about to run. */
+	LAUNCH_FAULT,       /* First page fault in user mode handled. */
+	LAUNCH_STAMP_CNT
+};
+
 /* Thread identifier type.
    You can redefine this to whatever type you like. */
 typedef int tid_t;
@@ -28,9 +45,6 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
-/* for fd_table */
-#define FD_MAX 32
-
 /* A kernel thread or user process.
  *
  * Each thread structure is stored in its own 4 kB page.  The
@@ -82,12 +96,12 @@ typedef int tid_t;
  * the `magic' member of the running thread's `struct thread' is
  * set to THREAD_MAGIC.  Stack overflow will normally change this
  * value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
- * the run queue (thread.c), or it can be an element in a
- * semaphore wait list (synch.c).  It can be used these two ways
- * only because they are mutually exclusive: only a thread in the
- * ready state is on the run queue, whereas only a thread in the
- * blocked state is on a semaphore wait list. */
+/* The `elem' member is an element in the run queue (thread.c).
+ * The `heap_elem' member has a dual purpose.  It can be an element
+ * in the sleep queue (thread.c), or it can be an element in a
+ * semaphore's waiter heap (synch.c).  It can be used these two ways
+ * only because they are mutually exclusive: a sleeping thread is
+ * never waiting on a semaphore at the same time. */
 struct thread {
 	/* Owned by thread.c. */
 	tid_t tid;                          /* Thread identifier. */
@@ -99,13 +113,52 @@ struct thread {
 	struct list_elem elem;              /* List element. */
 	
 	int64_t time_to_wake_up;			/* wake up time after timer_sleep() called */
+	bool asleep;                        /* In the sleep queue? */
+	struct heap_elem heap_elem;         /* Sleep queue or semaphore waiters. */
+	struct semaphore *waiting_sema;     /* Semaphore this thread waits on. */
+	uint64_t wait_seq;                  /* Arrival order among waiters. */
 
 	/* For donation */
-	int original_priority;
-	struct lock *wanted;
-	struct list donor_list;
-	struct list_elem elem_d_luffy;
+	int original_priority;              /* Priority before donation. */
+	struct lock *wanted;                /* Lock this thread waits for. */
+	struct heap held_locks;             /* Locks held, best donation first. */
+	struct heap_elem donor_elem;        /* Element in wanted->donors. */
+
+	/* For the MLFQS. */
+	int nice;                           /* Niceness. */
+	fixed_t recent_cpu;                 /* Recent CPU time, 17.14 fixed point. */
+	bool mlfqs_dirty;                   /* In mlfqs_dirty_list? */
+	struct list_elem mlfqs_elem;        /* Element in mlfqs_dirty_list. */
+	struct list_elem allelem;           /* Element in all_list. */
+
+	struct sched_thread_stats sched_stats; /* Scheduler statistics. */
+	struct rusage rusage;               /* Resources used, kept by the
+	                                       code that uses them. */
+	uint64_t lock_wait;                 /* Cycles spent waiting for locks
+	                                       held by others. */
+
+	/* Time slice. */
+	unsigned quantum;                   /* Ticks in this thread's slice. */
+	bool slice_boost;                   /* Go to the ready queue front? */
+
+	/* Deadline class, if dl_period is nonzero. */
+	int64_t dl_runtime;                 /* Ticks of CPU per period. */
+	int64_t dl_period;                  /* Ticks per period. */
+	int64_t dl_deadline;                /* End of current period. */
+	int64_t dl_budget;                  /* Ticks of CPU left this period. */
+	struct list_elem dl_elem;           /* Element in dl_threads. */
+
+	/* Fair-share class. */
+	int64_t vruntime;                   /* Weighted ticks run. */
+	struct rbtree_elem fair_elem;       /* In fair_group's members. */
+	struct thread *fair_group;          /* Group leader, maybe itself. */
+	int64_t group_vruntime;             /* As leader: group's ticks. */
+	int64_t fair_member_min;            /* As leader: members' floor. */
+	struct rbtree fair_members;         /* As leader: ready members. */
+	struct rbtree_elem group_elem;      /* As leader: in fair_groups. */
 
+	/* Owned by threads/fpu.c. */
+	struct fpu_area *fpu;               /* Saved FPU state, or null. */
 
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
@@ -113,20 +166,42 @@ struct thread {
 	int exit_code;
 
 	/* File descriptor table. */
-	uintptr_t fd_table[FD_MAX];
-	char fd_count;
+	struct fd_table *fd_table;
 
 	/* for deny on write on executables. */
-	uintptr_t running_executable;	// file struct address of executable file for this process
+	struct file *running_executable;	// file struct address of executable file for this process
 
 	/* parent-child relationship */
 	struct child *sorry_mama;			// struct child of this process
-	struct list child_list;			// list of this process's children.
+	struct hash children;			// this process's children, by tid.
+	struct rusage child_rusage;         /* Of children waited for. */
+
+	/* TSC at each enum launch_stamp of the last exec(), or 0. */
+	uint64_t launch[LAUNCH_STAMP_CNT];
+
+	/* Threads started by clone() share the address space, open
+	   files and children of their process's main thread PROC, which
+	   is the thread itself for a main thread or a kernel thread. */
+	struct thread *proc;                /* Main thread of the process. */
+	int *clear_tid;                     /* Zeroed and woken at exit. */
+	void *user_stack;                   /* Top of the clone() stack. */
+	bool thread_done;                   /* Left by exit_thread()? */
+	int thread_cnt;                     /* Of PROC: others alive. */
+	bool exiting;                       /* Of PROC: ending them all? */
+	struct semaphore thread_gone;       /* Of PROC: upped as each exits. */
+
+	/* Rings of asynchronous file operations, or null. */
+	struct ioring *ioring;              /* Of PROC. */
 
 #endif
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	uintptr_t user_rsp;                 /* User rsp at the last syscall. */
+#endif
+#ifdef FILESYS
+	unsigned journal_depth;             /* Journal handles open. */
+	unsigned journal_credits;           /* Sectors the handle may log. */
 #endif
 
 	/* Owned by thread.c. */
@@ -139,10 +214,23 @@ struct thread {
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If false (default), use a fixed time slice.
+   If true, adapt each thread's time slice to its behavior.
+   Controlled by kernel command-line option "-slice=adaptive". */
+extern bool thread_adaptive_slice;
+
+/* If false (default), run the highest-priority ready thread.
+   If true, share the CPU fairly, by thread or, if
+   thread_fair_group, by process.  Controlled by kernel
+   command-line option "-sched=fair" or "-sched=fair-group". */
+extern bool thread_fair;
+extern bool thread_fair_group;
+
 void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_idle_catch_up (int64_t ticks);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
@@ -157,10 +245,20 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
-void thread_sleep (int64_t ticks);	/* sleep_list에 현재 스레드 추가 */
-void thread_wakeup (int64_t ticks); /* sleep_list를 순회하며 깨울 시간이 된 스레드 깨우기 */
+
+/* Performs some operation on thread t, given auxiliary data AUX. */
+typedef void thread_action_func (struct thread *t, void *aux);
+void thread_foreach (thread_action_func *, void *);
+
+void thread_sleep (int64_t ticks);	/* sleep_queue에 현재 스레드 추가 */
+void thread_wakeup (int64_t ticks); /* 깨울 시간이 된 스레드들을 sleep_queue에서 깨우기 */
+int64_t thread_next_wakeup (void);
+bool thread_wake_early (struct thread *);
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_update_priority (struct thread *, int);
+bool thread_set_deadline (int64_t runtime, int64_t period);
+void thread_set_fair_group (struct thread *leader);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
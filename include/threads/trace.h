@@ -0,0 +1,53 @@
+#ifndef THREADS_TRACE_H
+#define THREADS_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/instrument.h"
+
+/* Kinds of trace events.  utils/pintos-trace knows them by the
+   names in trace.c. */
+enum trace_event {
+	TRACE_SWITCH,               /* Switch to thread ARG; AUX: old status. */
+	TRACE_BLOCK,                /* Running thread blocks. */
+	TRACE_UNBLOCK,              /* Thread ARG made ready. */
+	TRACE_FAULT,                /* Page fault at ARG; AUX: error code. */
+	TRACE_SWAP_IN,              /* Swap slot ARG read into memory. */
+	TRACE_SWAP_OUT,             /* Page written out to swap slot ARG. */
+	TRACE_DISK_SUBMIT,          /* Request for sectors ARG submitted. */
+	TRACE_DISK_DONE,            /* Request for sectors ARG done. */
+	TRACE_SYSCALL_ENTER,        /* System call ARG entered. */
+	TRACE_SYSCALL_EXIT,         /* System call AUX returns ARG. */
+	TRACE_LOCK_WAIT,            /* Starts waiting for lock ARG. */
+	TRACE_LOCK_ACQUIRE,         /* Got lock ARG after waiting. */
+	TRACE_EVENT_CNT
+};
+
+/* Disk events put the number of sectors in the top half of ARG,
+   and the disk, as channel * 2 + device, and whether the request
+   is a write in AUX. */
+#define TRACE_DISK_ARG(SECTOR, CNT) ((SECTOR) | (uint64_t) (CNT) << 32)
+#define TRACE_DISK_AUX(DISK_NO, WRITE) ((DISK_NO) << 1 | (WRITE))
+
+/* Ring pages asked for by kernel command-line option "-trace", or
+   0 if tracing is off, and the number "-trace" alone asks for. */
+extern int trace_pages;
+#define TRACE_DEFAULT_PAGES 64
+
+/* On while events are being recorded. */
+extern struct static_key trace_key;
+
+void trace_init (void);
+void trace_record (enum trace_event, uint64_t arg, uint16_t aux);
+void trace_dump (void);
+
+/* Records EVENT with ARG and AUX if tracing is on.  Costs a no-op
+   when it is off, and nothing in a kernel built without
+   INSTRUMENT. */
+#define trace(EVENT, ARG, AUX)                                        \
+	do {                                                              \
+		if (static_branch_unlikely (trace_key))                   \
+			trace_record (EVENT, ARG, AUX);                       \
+	} while (0)
+
+#endif /* threads/trace.h */
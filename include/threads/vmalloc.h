@@ -0,0 +1,20 @@
+#ifndef THREADS_VMALLOC_H
+#define THREADS_VMALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel virtual addresses that vmalloc() maps pages into, above
+   the mapping of physical memory at KERN_BASE but within the same
+   PML4 entry. */
+#define VMALLOC_START 0xc000000000ULL
+#define VMALLOC_END (VMALLOC_START + 256 * 1024 * 1024)
+
+void vmalloc_init (uint64_t mem_end);
+void *vmalloc (size_t) __attribute__ ((malloc));
+void *vcalloc (size_t, size_t) __attribute__ ((malloc));
+void vfree (void *);
+bool is_vmalloc_addr (const void *);
+
+#endif /* threads/vmalloc.h */
@@ -0,0 +1,25 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <stdbool.h>
+
+/* Deferred work.  Interrupt handlers hand work that need not be
+   done with interrupts off to a pool of kernel threads, which run
+   it in thread context, where it may block. */
+
+typedef void work_func (void *aux);
+
+/* A piece of work.  Owned by whoever submits it, which must keep
+   it alive until it has run. */
+struct work {
+	struct work *next;          /* Next in the submit queue. */
+	work_func *func;            /* Function to run. */
+	void *aux;                  /* Its argument. */
+	bool pending;               /* Submitted but not yet started? */
+};
+
+void workqueue_init (void);
+void work_init (struct work *, work_func *, void *aux);
+bool work_submit (struct work *);
+
+#endif /* threads/workqueue.h */
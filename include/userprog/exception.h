@@ -6,6 +6,18 @@
 #define PF_W 0x2    /* 0: read, 1: write. */
 #define PF_U 0x4    /* 0: kernel, 1: user process. */
 
+/* What a page fault turned out to be, as counted by
+   exception_print_stats(). */
+enum fault_cause {
+	FAULT_MINOR,        /* Lazy page with nothing to read, or mapped again. */
+	FAULT_FILE,         /* Page read in from a file. */
+	FAULT_SWAP,         /* Page read back from swap. */
+	FAULT_COW,          /* Write to a frame shared copy-on-write. */
+	FAULT_STACK,        /* Stack growth. */
+	FAULT_INVALID,      /* Not handled: bad access. */
+	FAULT_CAUSE_CNT
+};
+
 void exception_init (void);
 void exception_print_stats (void);
 
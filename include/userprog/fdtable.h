@@ -0,0 +1,34 @@
+#ifndef USERPROG_FDTABLE_H
+#define USERPROG_FDTABLE_H
+
+#include <stdbool.h>
+
+struct file;
+
+/* Descriptors a process may have open at once, including the
+ * console's 0 and 1. */
+#define FD_LIMIT 4096
+
+/* Stand-ins for the console in a table, found under descriptors 0
+ * and 1 until they are closed or replaced: reading FD_STDIN reads
+ * the keyboard and writing FD_STDOUT writes to the console. */
+#define FD_STDIN ((struct file *) 1)
+#define FD_STDOUT ((struct file *) 2)
+
+/* Returns true if F is one of the console's stand-ins. */
+static inline bool
+fd_is_console (const struct file *f) {
+	return f == FD_STDIN || f == FD_STDOUT;
+}
+
+struct fd_table *fd_table_create (void);
+bool fd_table_copy (struct fd_table *dst, struct fd_table *src);
+void fd_table_destroy (struct fd_table *);
+
+int fd_alloc (struct fd_table *, struct file *);
+struct file *fd_get (struct fd_table *, int fd);
+struct file *fd_get_dup (struct fd_table *, int fd);
+bool fd_close (struct fd_table *, int fd);
+int fd_dup2 (struct fd_table *, int oldfd, int newfd);
+
+#endif /* userprog/fdtable.h */
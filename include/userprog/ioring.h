@@ -0,0 +1,13 @@
+#ifndef USERPROG_IORING_H
+#define USERPROG_IORING_H
+
+struct thread;
+
+void ioring_init (void);
+void *ioring_setup (struct thread *proc);
+int ioring_enter (struct thread *proc, unsigned to_submit,
+		unsigned min_complete);
+void ioring_drain (struct thread *proc);
+void ioring_destroy (struct thread *proc);
+
+#endif /* userprog/ioring.h */
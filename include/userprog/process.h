@@ -4,19 +4,32 @@
 #include "threads/thread.h"
 #include "threads/synch.h"
 
+void process_subsystem_init (void);
 tid_t process_create_initd (const char *file_name);
 tid_t process_fork (const char *name, struct intr_frame *if_);
+tid_t process_spawn (char *cmd_line);
+int process_zygote (char *file_name);
 int process_exec (void *f_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (struct thread *next);
+tid_t process_clone (struct intr_frame *if_, uintptr_t entry, uint64_t func,
+		uint64_t arg, int *ctid);
+void process_check_exit (void);
+
+struct inode;
+struct mount;
+void process_uncache (struct mount *, struct inode *);
 
 struct child {
     struct thread *self_thread;
     tid_t tid;
     int exit_code;
-	struct list_elem elem;
+	struct hash_elem elem;		// element in parent's children.
 	struct semaphore sema;
+	struct rusage rusage;		/* Of the child and its children, at exit. */
 };
 
+void process_add_child (struct thread *parent, struct thread *child);
+
 #endif /* userprog/process.h */
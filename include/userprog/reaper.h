@@ -0,0 +1,12 @@
+#ifndef USERPROG_REAPER_H
+#define USERPROG_REAPER_H
+
+#include <stdint.h>
+
+struct fd_table;
+
+void reaper_init (void);
+void reaper_release (uint64_t *pml4, struct fd_table *);
+void reaper_drain (void);
+
+#endif /* userprog/reaper.h */
@@ -5,12 +5,9 @@
 
 struct intr_frame;
 
-/* Lock used by allocate_tid(). */
-struct lock filesys_lock;
-
 void syscall_init (void);
-void assert_valid_address(void *);
-struct child *find_child (struct list *child_list, int tid);
+void syscall_print_stats (void);
+struct child *find_child (struct hash *children, int tid);
 
 void halt_syscall_handler (struct intr_frame *);
 void exit_syscall_handler (struct intr_frame *);
@@ -41,37 +38,30 @@ void dup2_syscall_handler (struct intr_frame *);
 void mount_syscall_handler (struct intr_frame *); 
 void umount_syscall_handler (struct intr_frame *);
 
-#define SYSCALL_CNT 23
-typedef void syscall_handler_func (struct intr_frame *);
-static syscall_handler_func *syscall_handlers[SYSCALL_CNT] = {
-	halt_syscall_handler,
-	exit_syscall_handler,
-	fork_syscall_handler,
-	exec_syscall_handler,
-    wait_syscall_handler,
-    create_syscall_handler,
-    remove_syscall_handler,
-    open_syscall_handler,
-    filesize_syscall_handler,
-    read_syscall_handler,
-    write_syscall_handler,
-    seek_syscall_handler,
-    tell_syscall_handler,
-    close_syscall_handler,
-    
-	mmap_syscall_handler,
-    munmap_syscall_handler,
-    
-	chdir_syscall_handler,
-    mkdir_syscall_handler,
-    readdir_syscall_handler,
-    isdir_syscall_handler,
-    inumber_syscall_handler,
-    symlink_syscall_handler,
-    
-	dup2_syscall_handler,
-    mount_syscall_handler,
-    umount_syscall_handler
-};
+void spawn_syscall_handler (struct intr_frame *);
+void readv_syscall_handler (struct intr_frame *);
+void writev_syscall_handler (struct intr_frame *);
+void pread_syscall_handler (struct intr_frame *);
+void pwrite_syscall_handler (struct intr_frame *);
+void copy_file_range_syscall_handler (struct intr_frame *);
+void pipe_syscall_handler (struct intr_frame *);
+void getdents_syscall_handler (struct intr_frame *);
+void getrusage_syscall_handler (struct intr_frame *);
+void stat_syscall_handler (struct intr_frame *);
+void fstat_syscall_handler (struct intr_frame *);
+void fsync_syscall_handler (struct intr_frame *);
+void sync_syscall_handler (struct intr_frame *);
+void fallocate_syscall_handler (struct intr_frame *);
+void ftruncate_syscall_handler (struct intr_frame *);
+void clone_file_syscall_handler (struct intr_frame *);
+void poll_syscall_handler (struct intr_frame *);
+void zygote_syscall_handler (struct intr_frame *);
+void madvise_syscall_handler (struct intr_frame *);
+void msync_syscall_handler (struct intr_frame *);
+void clone_syscall_handler (struct intr_frame *);
+void exit_thread_syscall_handler (struct intr_frame *);
+void futex_syscall_handler (struct intr_frame *);
+void io_setup_syscall_handler (struct intr_frame *);
+void io_enter_syscall_handler (struct intr_frame *);
 
 #endif /* userprog/syscall.h */
@@ -0,0 +1,17 @@
+#ifndef USERPROG_USERCOPY_H
+#define USERPROG_USERCOPY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct intr_frame;
+
+bool is_user_range (const void *uaddr, size_t size);
+bool copy_from_user (void *dst, const void *usrc, size_t size);
+bool copy_to_user (void *udst, const void *src, size_t size);
+bool copy_str_from_user (char *dst, const char *usrc, size_t size);
+bool usercopy_fixup (struct intr_frame *);
+void *pin_user_page (void *uaddr, void **pin);
+void unpin_user_page (void *pin);
+
+#endif /* userprog/usercopy.h */
@@ -0,0 +1,11 @@
+#ifndef USERPROG_VDSO_H
+#define USERPROG_VDSO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+void vdso_init (void);
+bool vdso_map (uint64_t *pml4, int pid);
+void vdso_unmap (uint64_t *pml4);
+
+#endif /* userprog/vdso.h */
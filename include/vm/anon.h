@@ -1,13 +1,26 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <stddef.h>
 #include "vm/vm.h"
 struct page;
 enum vm_type;
 
 struct anon_page {
+	size_t slot;                /* Swap slot, or BITMAP_ERROR if none. */
 };
 
+/* Most pages anon_swap_out_cluster() swaps out at once. */
+#define SWAP_CLUSTER_MAX 8
+
+/* Swap disks asked for by kernel command-line option "-swap". */
+extern char *swap_disks;
+
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+bool anon_swap_out_cluster (struct page *pages[], size_t cnt);
+size_t anon_swap_slot (const struct page *page);
+void anon_slot_write (size_t slot, const void *kva);
+void anon_swap_share (struct page *dst, const struct page *src);
+void *do_mmap_anon (void *addr, size_t length, bool writable, bool shared);
 
 #endif
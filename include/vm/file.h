@@ -4,14 +4,23 @@
 #include "vm/vm.h"
 
 struct page;
+struct vm_area;
 enum vm_type;
 
 struct file_page {
+	struct file *file;          /* Backing file, owned by the area. */
+	off_t offset;               /* Offset of the page in FILE. */
+	size_t read_bytes;          /* Bytes of the page backed by FILE. */
 };
 
 void vm_file_init (void);
+void vm_file_start_flusher (void);
+void file_backed_flush_area (struct vm_area *);
+bool file_backed_flush_range (struct vm_area *, const void *start,
+		const void *end);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+int do_msync (void *addr, size_t length);
 #endif
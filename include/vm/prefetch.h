@@ -0,0 +1,14 @@
+#ifndef VM_PREFETCH_H
+#define VM_PREFETCH_H
+#include <stdbool.h>
+
+struct file;
+
+/* Prefetch executable text at load time? */
+extern bool prefetch_enabled;
+
+void prefetch_init (void);
+void prefetch_load (struct file *exec, void *entry);
+void prefetch_record (struct file *exec);
+
+#endif /* vm/prefetch.h */
@@ -1,7 +1,12 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
+#include <itree.h>
+#include <list.h>
 #include "threads/palloc.h"
+#include "threads/synch.h"
+#include "userprog/exception.h"
 
 enum vm_type {
 	/* page not initialized */
@@ -24,14 +29,23 @@ enum vm_type {
 	VM_MARKER_END = (1 << 31),
 };
 
+/* Marks the pages of a process's stack. */
+#define VM_STACK VM_MARKER_0
+
+/* Marks the pages of an anonymous mmap() area. */
+#define VM_MMAP VM_MARKER_1
+
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
+#include "vm/vma.h"
 #ifdef EFILESYS
 #include "filesys/page_cache.h"
 #endif
 
+struct inode;
 struct page_operations;
+struct shmem;
 struct thread;
 
 #define VM_TYPE(type) ((type) & 7)
@@ -46,6 +60,14 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct hash_elem spt_elem;  /* Element in supplemental_page_table. */
+	bool writable;              /* User may write the page? */
+	uint64_t *pml4;             /* Page map of the owning process. */
+	struct supplemental_page_table *spt; /* Owner's page table. */
+	struct vm_area *area;       /* Area the page belongs to, or null. */
+	struct list_elem area_elem; /* Element in area's pages. */
+	struct list_elem frame_elem; /* Element in frame's pages. */
+	bool touched;               /* Ever accessed by its process? */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -59,10 +81,41 @@ struct page {
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame"
+ *
+ * PAGES is the frame's reverse map: every page mapping the frame,
+ * each with the pml4 and address it is mapped at, whether it came
+ * there by fork(), the text cache, the zero frame or same-page
+ * merging.  Eviction, accessed and dirty bit aggregation and
+ * copy-on-write breaking walk it, so they cost time in proportion
+ * to the sharers, never a scan of all processes.  frame_attach()
+ * and frame_detach() keep it up to date under FRAME_LOCK. */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct page *page;          /* First page in PAGES, or null. */
+	struct list pages;          /* Pages sharing the frame. */
+	size_t share_cnt;           /* Number of pages in PAGES. */
+	struct list_elem elem;      /* Element in the frame table. */
+	bool active;                /* On the active list? */
+	unsigned pin_cnt;           /* Not to be evicted while nonzero. */
+	bool writeback;             /* Being written back to its file? */
+	unsigned read_cnt;          /* File reads copying from it. */
+
+	/* Shared read-only file contents. */
+	struct inode *inode;        /* Inode read from, or null if none. */
+	off_t offset;               /* Offset in INODE. */
+	unsigned write_gen;         /* inode_write_gen() of INODE when read. */
+	struct hash_elem text_elem; /* Element in the text cache. */
+
+	/* Same-page merging. */
+	uint64_t checksum;          /* Of the contents when last scanned. */
+	unsigned ksm_pass;          /* Scan pass that last looked at it. */
+	bool ksm_listed;            /* In the merge table? */
+	struct hash_elem ksm_elem;  /* Element in the merge table. */
+
+	bool shmem;                 /* Held, pinned, by shared memory? */
+	unsigned futex_cnt;         /* Futex waiters keyed on it, each
+	                               holding a pin. */
 };
 
 /* The function table for page operations.
@@ -85,6 +138,20 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
+	struct lock lock;      /* Held over faults and changes to the
+	                          areas, by the threads sharing it. */
+	struct hash pages;     /* Pages, keyed on page-aligned va. */
+	struct itree areas;    /* Mapped areas, struct vm_area. */
+	void *ra_last;         /* Last page read back from swap. */
+	size_t ra_window;      /* Swap readahead window, in pages. */
+	void *entry;           /* Program entry point, or null. */
+	size_t stack_limit;    /* Largest size of the stack, in bytes. */
+
+	/* Memory accounting, in pages.  A limit of 0 is no limit. */
+	size_t rss;            /* Pages on a frame, but the zero frame. */
+	size_t swap_cnt;       /* Pages in a swap slot. */
+	size_t rss_soft;       /* Evict own pages first at this RSS. */
+	size_t rss_hard;       /* Never get a new frame at this RSS. */
 };
 
 #include "threads/thread.h"
@@ -97,9 +164,32 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
+/* Fault-around window, in pages; 1 disables fault-around. */
+extern size_t fault_around_pages;
+
+/* Stack limit given to new processes, in bytes. */
+extern size_t stack_limit;
+
+/* RSS limits given to new processes, in pages; 0 is no limit. */
+extern size_t rss_soft_limit;
+extern size_t rss_hard_limit;
+
+/* Back whole 2 MB chunks of areas with huge pages? */
+extern bool huge_pages;
+
+/* Reclaim free frames in the background?  And the number of free
+ * user frames below which that starts, or 0 to size it from the
+ * user pool. */
+extern bool kswapd_enabled;
+extern size_t reclaim_low_pages;
+
+/* Merge identical anonymous pages in the background? */
+extern bool ksm_enabled;
+
 void vm_init (void);
+void ksm_print_stats (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
-		bool write, bool not_present);
+		bool write, bool not_present, enum fault_cause *cause);
 
 #define vm_alloc_page(type, upage, writable) \
 	vm_alloc_page_with_initializer ((type), (upage), (writable), NULL, NULL)
@@ -107,6 +197,25 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+void vm_map_ahead (struct vm_area *, void *start, void *end);
+int vm_madvise (void *addr, size_t length, int advice);
+void vm_populate (struct vm_area *);
+void *vm_thread_stack_create (void);
+void vm_thread_stack_destroy (void *top);
+struct frame *vm_pin_user (const void *uaddr);
+void vm_unpin_user (struct frame *);
+struct shmem *shmem_create (size_t page_cnt);
+void shmem_put (struct shmem *);
+void vm_release_frame (struct page *page);
+struct frame *vm_cache_get (struct inode *, off_t offset, bool create);
+void vm_cache_put (struct frame *);
+void vm_cache_drop (struct inode *);
+size_t vm_writeback_scan (struct page *pages[], size_t max);
+size_t vm_writeback_area (struct vm_area *, const void *start,
+		const void *end, struct list_elem **cursor,
+		struct page *pages[], size_t max);
+void vm_writeback_end (struct page *page, bool ok);
+void vm_writeback_wait (struct page *page);
 enum vm_type page_get_type (struct page *page);
 
 #endif  /* VM_VM_H */
@@ -0,0 +1,45 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+#include <itree.h>
+#include <list.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+#include "vm/vm.h"
+
+struct file;
+struct page;
+struct supplemental_page_table;
+
+/* A virtual memory area: a page-aligned range of user addresses
+ * with common type, permissions and backing store.  Setting up an
+ * area takes constant time; the struct page of each of its pages
+ * is only created when the page is first touched. */
+struct vm_area {
+	struct itree_elem elem;     /* Element in spt's areas. */
+	enum vm_type type;          /* Type of the pages, with markers. */
+	bool writable;              /* Pages may be written? */
+	struct file *file;          /* Backing file, or null. */
+	off_t offset;               /* Offset in FILE of the first page. */
+	size_t read_bytes;          /* Bytes read from FILE, rest zeroed. */
+	int advice;                 /* Access pattern, an MADV_* hint. */
+	struct shmem *shmem;        /* Shared anonymous memory, or null. */
+	struct list pages;          /* Pages created so far. */
+};
+
+/* First and one past the last address of area A. */
+#define vma_start(A) ((void *) (A)->elem.start)
+#define vma_end(A) ((void *) (A)->elem.end)
+
+void vma_init (void);
+struct vm_area *vma_create (struct supplemental_page_table *, void *start,
+		size_t length, enum vm_type, bool writable,
+		struct file *, off_t offset, size_t read_bytes);
+struct vm_area *vma_find (struct supplemental_page_table *, const void *va);
+struct page *vma_populate (struct vm_area *, void *upage);
+void vma_attach (struct vm_area *, struct page *);
+void vma_page_backing (const struct page *, off_t *offset, size_t *read_bytes);
+void vma_unmap (struct vm_area *);
+void vma_destroy (struct supplemental_page_table *, struct vm_area *);
+void vma_kill (struct supplemental_page_table *);
+
+#endif /* vm/vma.h */
@@ -0,0 +1,18 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Compressed swap cache size asked for by kernel command-line
+ * option "-zswap=KB", 0 to size it from the kernel pool; and
+ * whether "-no-zswap" turned it off. */
+extern size_t zswap_max_kb;
+extern bool zswap_enabled;
+
+void zswap_init (size_t slot_cnt);
+bool zswap_store (size_t slot, const void *kva);
+bool zswap_load (size_t slot, void *kva);
+void zswap_drop (size_t slot);
+void zswap_print_stats (void);
+
+#endif /* vm/zswap.h */
@@ -0,0 +1,88 @@
+#include "crc32c.h"
+#include <stdbool.h>
+
+/* CRC-32C, the Castagnoli CRC that iSCSI, ext4, and btrfs use, with
+   the bits reflected and the register inverted before and after.
+
+   CPUs with SSE4.2 have an instruction that folds 8 bytes at a time
+   into it.  Elsewhere it is done by slicing-by-8: eight tables of
+   256 entries each, built on first use, fold 8 bytes with eight
+   lookups that do not depend on one another, instead of one lookup
+   per byte that each wait for the last. */
+
+#define POLY 0x82f63b78                 /* 0x1edc6f41, reflected. */
+
+static uint32_t table[8][256];
+static bool have_sse42;
+static bool inited;
+
+/* Builds the tables and checks for SSE4.2.  Two threads that race
+   here compute the same values. */
+static void
+init (void) {
+	uint32_t a, b, c, d, i;
+	int k;
+
+	for (i = 0; i < 256; i++) {
+		uint32_t crc = i;
+
+		for (k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+		table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+		for (k = 1; k < 8; k++)
+			table[k][i] = (table[k - 1][i] >> 8)
+				^ table[0][table[k - 1][i] & 0xff];
+
+	asm ("cpuid" : "=a" (a), "=b" (b), "=c" (c), "=d" (d) : "a" (1));
+	have_sse42 = (c & (1u << 20)) != 0;
+	inited = true;
+}
+
+/* Folds the SIZE bytes at BUF into CRC with the CRC32 instruction. */
+static uint32_t
+crc_sse42 (uint32_t crc, const uint8_t *buf, size_t size) {
+	uint64_t crc64;
+
+	for (; size > 0 && ((uintptr_t) buf & 7) != 0; size--)
+		asm ("crc32b %1, %0" : "+r" (crc) : "rm" (*buf++));
+	crc64 = crc;
+	for (; size >= 8; size -= 8, buf += 8)
+		asm ("crc32q %1, %0" : "+r" (crc64) : "rm" (*(const uint64_t *) buf));
+	crc = crc64;
+	for (; size > 0; size--)
+		asm ("crc32b %1, %0" : "+r" (crc) : "rm" (*buf++));
+	return crc;
+}
+
+/* Folds the SIZE bytes at BUF into CRC by slicing-by-8. */
+static uint32_t
+crc_slice8 (uint32_t crc, const uint8_t *buf, size_t size) {
+	for (; size >= 8; size -= 8, buf += 8) {
+		uint32_t lo = crc ^ (buf[0] | buf[1] << 8 | buf[2] << 16
+				| (uint32_t) buf[3] << 24);
+		uint32_t hi = buf[4] | buf[5] << 8 | buf[6] << 16
+			| (uint32_t) buf[7] << 24;
+
+		crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff]
+			^ table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24]
+			^ table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff]
+			^ table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+	}
+	for (; size > 0; size--)
+		crc = (crc >> 8) ^ table[0][(crc ^ *buf++) & 0xff];
+	return crc;
+}
+
+/* Returns the CRC-32C of the SIZE bytes at BUF following data whose
+   CRC-32C was CRC, which is 0 to start. */
+uint32_t
+crc32c (uint32_t crc, const void *buf, size_t size) {
+	if (!inited)
+		init ();
+	crc = ~crc;
+	crc = have_sse42 ? crc_sse42 (crc, buf, size)
+		: crc_slice8 (crc, buf, size);
+	return ~crc;
+}
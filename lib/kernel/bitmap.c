@@ -62,6 +62,30 @@ last_mask (const struct bitmap *b) {
 	int last_bits = b->bit_cnt % ELEM_BITS;
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns the number of bits in the element that starts with bit
+   START that lie between START and START + CNT, exclusive.  Sets
+   *MASK to the mask of those bits. */
+static inline size_t
+span_mask (size_t start, size_t cnt, elem_type *mask) {
+	size_t ofs = start % ELEM_BITS;
+	size_t n = cnt < ELEM_BITS - ofs ? cnt : ELEM_BITS - ofs;
+
+	*mask = n < ELEM_BITS
+		? (((elem_type) 1 << n) - 1) << ofs : (elem_type) -1;
+	return n;
+}
+
+/* Returns the number of bits set to 1 in X.  Done by hand instead
+   of with __builtin_popcountl(), which without POPCNT calls into
+   libgcc, and the kernel does not link with it. */
+static inline size_t
+elem_popcount (elem_type x) {
+	x = x - ((x >> 1) & 0x5555555555555555UL);
+	x = (x & 0x3333333333333333UL) + ((x >> 2) & 0x3333333333333333UL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (x * 0x0101010101010101UL) >> 56;
+}
 
 /* Creation and destruction. */
 
@@ -194,49 +218,70 @@ bitmap_set_all (struct bitmap *b, bool value) {
 	bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Works an element at a time.  Each element is updated
+   atomically, as bitmap_set() would, but not the whole range. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	while (cnt > 0) {
+		elem_type mask;
+		size_t n = span_mask (start, cnt, &mask);
+		elem_type *e = &b->bits[elem_idx (start)];
+
+		if (n == ELEM_BITS)
+			*e = value ? (elem_type) -1 : 0;
+		else if (value)
+			asm ("lock orq %1, %0" : "=m" (*e) : "r" (mask) : "cc");
+		else
+			asm ("lock andq %1, %0" : "=m" (*e) : "r" (~mask) : "cc");
+		start += n;
+		cnt -= n;
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t total = cnt, true_cnt = 0;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
-	return value_cnt;
+	while (cnt > 0) {
+		elem_type mask;
+		size_t n = span_mask (start, cnt, &mask);
+
+		true_cnt += elem_popcount (b->bits[elem_idx (start)] & mask);
+		start += n;
+		cnt -= n;
+	}
+	return value ? true_cnt : total - true_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
+	while (cnt > 0) {
+		elem_type mask;
+		size_t n = span_mask (start, cnt, &mask);
+		elem_type bits = b->bits[elem_idx (start)];
+
+		if (((value ? bits : ~bits) & mask) != 0)
 			return true;
+		start += n;
+		cnt -= n;
+	}
 	return false;
 }
 
@@ -263,21 +308,58 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
 
 /* Finding set or unset bits. */
 
+/* Returns the index of the first bit in B at or after START that
+   is set to VALUE, or B's bit count if there is none.
+   Examines a whole element at a time. */
+static size_t
+next_bit (const struct bitmap *b, size_t start, bool value) {
+	size_t idx, last;
+	elem_type bits;
+
+	if (start >= b->bit_cnt)
+		return b->bit_cnt;
+
+	idx = elem_idx (start);
+	last = elem_cnt (b->bit_cnt) - 1;
+	bits = value ? b->bits[idx] : ~b->bits[idx];
+	bits &= ~(elem_type) 0 << (start % ELEM_BITS);
+	while (bits == 0) {
+		if (++idx > last)
+			return b->bit_cnt;
+		bits = value ? b->bits[idx] : ~b->bits[idx];
+	}
+
+	start = idx * ELEM_BITS + __builtin_ctzl (bits);
+	return start < b->bit_cnt ? start : b->bit_cnt;
+}
+
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Skips from run to run with next_bit(), so long stretches of
+   bits set to !VALUE cost one step per element, not per bit. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
+	if (cnt > b->bit_cnt)
+		return BITMAP_ERROR;
+	if (cnt == 0)
+		return start;
+
+	while (start + cnt <= b->bit_cnt) {
+		size_t end;
+
+		start = next_bit (b, start, value);
+		if (start + cnt > b->bit_cnt)
+			break;
+		end = next_bit (b, start, !value);
+		if (end - start >= cnt)
+			return start;
+		start = end;
 	}
 	return BITMAP_ERROR;
 }
@@ -326,6 +408,17 @@ bitmap_write (const struct bitmap *b, struct file *file) {
 	off_t size = byte_cnt (b->bit_cnt);
 	return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B starting at byte OFS to the same
+   place in FILE, which B was written to in full before.  Return
+   true if successful, false otherwise. */
+bool
+bitmap_write_at (const struct bitmap *b, struct file *file, size_t ofs,
+		size_t size) {
+	ASSERT (ofs + size <= byte_cnt (b->bit_cnt));
+	return file_write_at (file, (uint8_t *) b->bits + ofs, size, ofs)
+		== (off_t) size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -1,14 +1,22 @@
 #include <console.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/serial.h"
 #include "devices/vga.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/lock-stats.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 static void vprintf_helper (char, void *);
 static void putchar_have_lock (uint8_t c);
+static void write_have_lock (const char *, size_t);
+static void acquire_console (void);
+static void release_console (void);
+static void klog_write (const char *, size_t);
+static void klog_drain (bool all);
 
 /* The console lock.
    Both the vga and serial layers do their own locking, so it's
@@ -59,25 +67,91 @@ static int console_lock_depth;
 /* Number of characters written to console. */
 static int64_t write_cnt;
 
+/* If false, output goes to the serial port only, sparing the
+   per-character cost of drawing and scrolling the display. */
+bool console_vga = true;
+
+/* If true, console output goes to the kernel log ring, and from
+   there to the console by way of the klogd thread, so that a
+   printer pays for formatting and copying but never waits for the
+   serial port.  A panic turns it off. */
+bool console_klog;
+
+/* Size of the kernel log ring, a power of 2. */
+#define KLOG_SIZE 16384
+
+/* Kernel log ring.
+
+   A writer reserves room by advancing KLOG_HEAD, copies its bytes
+   in, and then advances KLOG_DONE by as much, with atomic
+   operations only, so that any context may write, even an
+   interrupt handler that interrupted another writer.  Everything
+   below KLOG_DONE is complete whenever it has caught up with
+   KLOG_HEAD.  KLOG_TAIL, the end of what has reached the console,
+   belongs to the drainer, which holds the console lock.  Writers
+   that lap the drainer overwrite the oldest bytes, which are
+   counted as lost. */
+static char klog_buf[KLOG_SIZE];
+static uint64_t klog_head;
+static uint64_t klog_done;
+static uint64_t klog_tail;
+static int64_t klog_lost;
+
+/* Up'd for klogd when it is waiting and the ring has news. */
+static struct semaphore klog_sema;
+static bool klogd_waiting;
+
+/* klogd's deadline class reservation: KLOGD_RUNTIME ticks of CPU
+   in every KLOGD_PERIOD. */
+#define KLOGD_RUNTIME 1
+#define KLOGD_PERIOD 10
+
+/* Output of one vprintf() call, gathered so that it reaches the
+   console or the ring in chunks rather than a character at a
+   time. */
+struct vprintf_aux {
+	char buf[64];               /* Characters not yet written. */
+	size_t len;                 /* Number of them. */
+	int char_cnt;               /* Characters output in all. */
+	bool klog;                  /* To the ring? */
+};
+
 /* Enable console locking. */
 void
 console_init (void) {
 	lock_init (&console_lock);
+	lock_set_name (&console_lock, "console");
+	sema_init (&klog_sema, 0);
 	use_console_lock = true;
 }
 
 /* Notifies the console that a kernel panic is underway,
    which warns it to avoid trying to take the console lock from
-   now on. */
+   now on.  The log ring is written out first, since klogd may
+   never run again. */
 void
 console_panic (void) {
 	use_console_lock = false;
+	console_klog = false;
+	klog_drain (true);
+}
+
+/* Writes out whatever the kernel log ring holds.  Called before
+   the machine powers off. */
+void
+console_flush (void) {
+	acquire_console ();
+	klog_drain (true);
+	release_console ();
 }
 
 /* Prints console statistics. */
 void
 console_print_stats (void) {
-	printf ("Console: %lld characters output\n", write_cnt);
+	printf ("Console: %lld characters output", write_cnt);
+	if (klog_lost > 0)
+		printf (", %lld lost from the log ring", klog_lost);
+	printf ("\n");
 }
 
 /* Acquires the console lock. */
@@ -111,58 +185,118 @@ console_locked_by_current_thread (void) {
 			|| lock_held_by_current_thread (&console_lock));
 }
 
+/* Writes out the characters AUX has gathered. */
+static void
+vprintf_flush (struct vprintf_aux *aux) {
+	if (aux->klog)
+		klog_write (aux->buf, aux->len);
+	else
+		write_have_lock (aux->buf, aux->len);
+	aux->len = 0;
+}
+
 /* The standard vprintf() function,
    which is like printf() but uses a va_list.
-   Writes its output to both vga display and serial port. */
+   Writes its output to both vga display and serial port, or to
+   the kernel log ring if console_klog. */
 int
 vprintf (const char *format, va_list args) {
-	int char_cnt = 0;
+	struct vprintf_aux aux;
 
-	acquire_console ();
-	__vprintf (format, args, vprintf_helper, &char_cnt);
-	release_console ();
+	aux.len = 0;
+	aux.char_cnt = 0;
+	aux.klog = console_klog;
+	if (aux.klog) {
+		__vprintf (format, args, vprintf_helper, &aux);
+		vprintf_flush (&aux);
+	} else {
+		acquire_console ();
+		__vprintf (format, args, vprintf_helper, &aux);
+		vprintf_flush (&aux);
+		release_console ();
+	}
+
+	return aux.char_cnt;
+}
+
+/* Like printf(), but always writes to the kernel log ring, so
+   that it never waits for the console.  Safe in any context,
+   including interrupt handlers. */
+int
+klog_printf (const char *format, ...) {
+	struct vprintf_aux aux;
+	va_list args;
+
+	aux.len = 0;
+	aux.char_cnt = 0;
+	aux.klog = true;
+	va_start (args, format);
+	__vprintf (format, args, vprintf_helper, &aux);
+	va_end (args);
+	vprintf_flush (&aux);
 
-	return char_cnt;
+	return aux.char_cnt;
 }
 
 /* Writes string S to the console, followed by a new-line
    character. */
 int
 puts (const char *s) {
+	if (console_klog) {
+		klog_write (s, strlen (s));
+		klog_write ("\n", 1);
+		return 0;
+	}
+
 	acquire_console ();
-	while (*s != '\0')
-		putchar_have_lock (*s++);
+	write_have_lock (s, strlen (s));
 	putchar_have_lock ('\n');
 	release_console ();
 
 	return 0;
 }
 
-/* Writes the N characters in BUFFER to the console. */
+/* Writes the N characters in BUFFER to the console.  They go to
+   the serial port in one batch rather than a character at a
+   time. */
 void
 putbuf (const char *buffer, size_t n) {
+	if (console_klog) {
+		klog_write (buffer, n);
+		return;
+	}
+
 	acquire_console ();
-	while (n-- > 0)
-		putchar_have_lock (*buffer++);
+	write_have_lock (buffer, n);
 	release_console ();
 }
 
 /* Writes C to the vga display and serial port. */
 int
 putchar (int c) {
+	if (console_klog) {
+		char ch = c;
+
+		klog_write (&ch, 1);
+		return c;
+	}
+
 	acquire_console ();
 	putchar_have_lock (c);
 	release_console ();
 
 	return c;
 }
-
+
 /* Helper function for vprintf(). */
 static void
-vprintf_helper (char c, void *char_cnt_) {
-	int *char_cnt = char_cnt_;
-	(*char_cnt)++;
-	putchar_have_lock (c);
+vprintf_helper (char c, void *aux_) {
+	struct vprintf_aux *aux = aux_;
+
+	aux->char_cnt++;
+	aux->buf[aux->len++] = c;
+	if (aux->len == sizeof aux->buf)
+		vprintf_flush (aux);
 }
 
 /* Writes C to the vga display and serial port.
@@ -173,5 +307,98 @@ putchar_have_lock (uint8_t c) {
 	ASSERT (console_locked_by_current_thread ());
 	write_cnt++;
 	serial_putc (c);
-	vga_putc (c);
+	if (console_vga)
+		vga_putc (c);
+}
+
+/* Writes the N characters in BUFFER to the vga display and serial
+   port, to each in one batch.
+   The caller has already acquired the console lock if
+   appropriate. */
+static void
+write_have_lock (const char *buffer, size_t n) {
+	ASSERT (console_locked_by_current_thread ());
+	write_cnt += n;
+	serial_putbuf ((const uint8_t *) buffer, n);
+	if (console_vga)
+		vga_putbuf (buffer, n);
+}
+
+/* Appends the N characters in BUFFER to the kernel log ring, or
+   only their last KLOG_SIZE if there are more, and wakes klogd if
+   it is waiting. */
+static void
+klog_write (const char *buffer, size_t n) {
+	uint64_t pos;
+	size_t i;
+
+	if (n > KLOG_SIZE) {
+		buffer += n - KLOG_SIZE;
+		n = KLOG_SIZE;
+	}
+	pos = __atomic_fetch_add (&klog_head, n, __ATOMIC_RELAXED);
+	for (i = 0; i < n; i++)
+		klog_buf[(pos + i) % KLOG_SIZE] = buffer[i];
+	__atomic_fetch_add (&klog_done, n, __ATOMIC_RELEASE);
+
+	if (klogd_waiting) {
+		klogd_waiting = false;
+		sema_up (&klog_sema);
+	}
+}
+
+/* Writes what the ring holds past KLOG_TAIL to the console, whose
+   lock the caller has acquired if appropriate.  Unless ALL, writes
+   nothing while a write to the ring is under way, since the bytes
+   below KLOG_DONE may not all be complete then. */
+static void
+klog_drain (bool all) {
+	uint64_t done = __atomic_load_n (&klog_done, __ATOMIC_ACQUIRE);
+
+	if (!all && done != __atomic_load_n (&klog_head, __ATOMIC_RELAXED))
+		return;
+	if (done - klog_tail > KLOG_SIZE) {
+		klog_lost += done - klog_tail - KLOG_SIZE;
+		klog_tail = done - KLOG_SIZE;
+	}
+	while (klog_tail < done) {
+		size_t ofs = klog_tail % KLOG_SIZE;
+		size_t n = done - klog_tail;
+
+		if (n > KLOG_SIZE - ofs)
+			n = KLOG_SIZE - ofs;
+		write_have_lock (klog_buf + ofs, n);
+		klog_tail += n;
+	}
+}
+
+/* klogd thread: writes the kernel log ring to the console as it
+   fills.  It sleeps while the ring is drained, and also while a
+   write is under way, since the writer wakes it when done. */
+static void
+klogd (void *aux UNUSED) {
+	thread_set_deadline (KLOGD_RUNTIME, KLOGD_PERIOD);
+	for (;;) {
+		enum intr_level old_level;
+		bool idle;
+
+		acquire_console ();
+		klog_drain (false);
+		release_console ();
+
+		old_level = intr_disable ();
+		idle = klog_done == klog_tail || klog_done != klog_head;
+		klogd_waiting = idle;
+		intr_set_level (old_level);
+		if (idle)
+			sema_down (&klog_sema);
+	}
+}
+
+/* Starts klogd at the lowest priority, which it runs at beyond
+   its deadline class budget.  What was written to the ring before
+   reaches the console then. */
+void
+console_start_klog (void) {
+	thread_create ("klogd", PRI_MIN, klogd, NULL);
 }
@@ -7,6 +7,7 @@
 
 #include "hash.h"
 #include "../debug.h"
+#include "../string.h"
 #include "threads/malloc.h"
 
 #define list_elem_to_hash_elem(LIST_ELEM)                       \
@@ -18,6 +19,8 @@ static struct hash_elem *find_elem (struct hash *, struct list *,
 static void insert_elem (struct hash *, struct list *, struct hash_elem *);
 static void remove_elem (struct hash *, struct hash_elem *);
 static void rehash (struct hash *);
+static void rehash_step (struct hash *, size_t bucket_cnt);
+static void rehash_finish (struct hash *);
 
 /* Initializes hash table H to compute hash values using HASH and
    compare hash elements using LESS, given auxiliary data AUX. */
@@ -27,6 +30,9 @@ hash_init (struct hash *h,
 	h->elem_cnt = 0;
 	h->bucket_cnt = 4;
 	h->buckets = malloc (sizeof *h->buckets * h->bucket_cnt);
+	h->old_buckets = NULL;
+	h->old_bucket_cnt = 0;
+	h->migrate_idx = 0;
 	h->hash = hash;
 	h->less = less;
 	h->aux = aux;
@@ -51,6 +57,7 @@ void
 hash_clear (struct hash *h, hash_action_func *destructor) {
 	size_t i;
 
+	rehash_finish (h);
 	for (i = 0; i < h->bucket_cnt; i++) {
 		struct list *bucket = &h->buckets[i];
 
@@ -81,6 +88,7 @@ void
 hash_destroy (struct hash *h, hash_action_func *destructor) {
 	if (destructor != NULL)
 		hash_clear (h, destructor);
+	free (h->old_buckets);
 	free (h->buckets);
 }
 
@@ -153,6 +161,7 @@ hash_apply (struct hash *h, hash_action_func *action) {
 
 	ASSERT (action != NULL);
 
+	rehash_finish (h);
 	for (i = 0; i < h->bucket_cnt; i++) {
 		struct list *bucket = &h->buckets[i];
 		struct list_elem *elem, *next;
@@ -186,6 +195,7 @@ hash_first (struct hash_iterator *i, struct hash *h) {
 	ASSERT (i != NULL);
 	ASSERT (h != NULL);
 
+	rehash_finish (h);
 	i->hash = h;
 	i->bucket = i->hash->buckets;
 	i->elem = list_elem_to_hash_elem (list_head (i->bucket));
@@ -275,12 +285,133 @@ uint64_t
 hash_int (int i) {
 	return hash_bytes (&i, sizeof i);
 }
+
+/* Returns a hash of X, the splitmix64 finalizer.  Every bit of X
+   affects every bit of the result, so keys that differ only in
+   their high bits, or that are all multiples of a power of 2,
+   still spread across the buckets. */
+uint64_t
+hash_u64 (uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9UL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebUL;
+	x ^= x >> 31;
+	return x;
+}
+
+/* Constants for hash_buf(), from wyhash. */
+#define WY_P0 0xa0761d6478bd642fUL
+#define WY_P1 0xe7037ed1a0b428dbUL
+#define WY_P2 0x8ebc6af09c88c6e3UL
+#define WY_P3 0x589965cc75374cc3UL
+
+/* For reading words at any alignment, which x86 allows. */
+typedef uint64_t unaligned_u64 __attribute__ ((may_alias, aligned (1)));
+typedef uint32_t unaligned_u32 __attribute__ ((may_alias, aligned (1)));
+
+/* Returns the high and low halves of the 128-bit product of A
+   and B, xored together. */
+static inline uint64_t
+wy_mum (uint64_t a, uint64_t b) {
+	unsigned __int128 r = (unsigned __int128) a * b;
+	return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+static inline uint64_t
+wy_r8 (const uint8_t *p) {
+	return *(const unaligned_u64 *) p;
+}
+
+static inline uint64_t
+wy_r4 (const uint8_t *p) {
+	return *(const unaligned_u32 *) p;
+}
+
+/* Returns a hash of the SIZE bytes in BUF, started from SEED,
+   following wyhash.  Unlike hash_bytes(), reads 8 or 16 bytes
+   per step, so it suits long keys.  Different SEEDs give
+   unrelated hashes of the same bytes. */
+uint64_t
+hash_buf (const void *buf_, size_t size, uint64_t seed) {
+	const uint8_t *p = buf_;
+	uint64_t a, b;
+
+	ASSERT (p != NULL || size == 0);
+
+	seed ^= wy_mum (seed ^ WY_P0, WY_P1);
+	if (size <= 16) {
+		if (size >= 4) {
+			size_t mid = (size >> 3) << 2;
+			const uint8_t *q = p + size - 4;
+
+			a = (wy_r4 (p) << 32) | wy_r4 (p + mid);
+			b = (wy_r4 (q) << 32) | wy_r4 (q - mid);
+		} else if (size > 0) {
+			a = ((uint64_t) p[0] << 16)
+				| ((uint64_t) p[size >> 1] << 8) | p[size - 1];
+			b = 0;
+		} else
+			a = b = 0;
+	} else {
+		size_t i = size;
+
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+
+			do {
+				seed = wy_mum (wy_r8 (p) ^ WY_P1,
+						wy_r8 (p + 8) ^ seed);
+				see1 = wy_mum (wy_r8 (p + 16) ^ WY_P2,
+						wy_r8 (p + 24) ^ see1);
+				see2 = wy_mum (wy_r8 (p + 32) ^ WY_P3,
+						wy_r8 (p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = wy_mum (wy_r8 (p) ^ WY_P1, wy_r8 (p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = wy_r8 (p + i - 16);
+		b = wy_r8 (p + i - 8);
+	}
+
+	a ^= WY_P1;
+	b ^= seed;
+	{
+		unsigned __int128 r = (unsigned __int128) a * b;
+		a = (uint64_t) r;
+		b = (uint64_t) (r >> 64);
+	}
+	return wy_mum (a ^ WY_P0 ^ size, b ^ WY_P1);
+}
+
+/* Returns a hash of string S, started from SEED, as
+   hash_buf(). */
+uint64_t
+hash_str (const char *s, uint64_t seed) {
+	ASSERT (s != NULL);
+
+	return hash_buf (s, strlen (s), seed);
+}
 
-/* Returns the bucket in H that E belongs in. */
+/* Returns the bucket in H that E belongs in.  While H is being
+   resized, that is its old bucket unless that bucket has already
+   been migrated. */
 static struct list *
 find_bucket (struct hash *h, struct hash_elem *e) {
-	size_t bucket_idx = h->hash (e, h->aux) & (h->bucket_cnt - 1);
-	return &h->buckets[bucket_idx];
+	uint64_t hash = h->hash (e, h->aux);
+
+	if (h->old_buckets != NULL) {
+		size_t old_idx = hash & (h->old_bucket_cnt - 1);
+		if (old_idx >= h->migrate_idx)
+			return &h->old_buckets[old_idx];
+	}
+	return &h->buckets[hash & (h->bucket_cnt - 1)];
 }
 
 /* Searches BUCKET in H for a hash element equal to E.  Returns
@@ -314,21 +445,33 @@ is_power_of_2 (size_t x) {
 #define BEST_ELEMS_PER_BUCKET 2 /* Ideal elems/bucket. */
 #define MAX_ELEMS_PER_BUCKET  4 /* Elems/bucket > 4: increase # of buckets. */
 
+/* Number of old buckets migrated per insertion or deletion.
+   Since the table only resizes when the element count doubles or
+   halves, one bucket per step already finishes a migration before
+   the next one becomes due. */
+#define REHASH_STEP 2
+
 /* Changes the number of buckets in hash table H to match the
    ideal.  This function can fail because of an out-of-memory
    condition, but that'll just make hash accesses less efficient;
-   we can still continue. */
+   we can still continue.
+
+   The elements are not moved all at once: a large table would
+   stall the caller for a long time.  Instead the old buckets are
+   kept around and emptied REHASH_STEP at a time by each later
+   call, and a new resize only starts after that is done. */
 static void
 rehash (struct hash *h) {
-	size_t old_bucket_cnt, new_bucket_cnt;
-	struct list *new_buckets, *old_buckets;
+	size_t new_bucket_cnt;
+	struct list *new_buckets;
 	size_t i;
 
 	ASSERT (h != NULL);
 
-	/* Save old bucket info for later use. */
-	old_buckets = h->buckets;
-	old_bucket_cnt = h->bucket_cnt;
+	if (h->old_buckets != NULL) {
+		rehash_step (h, REHASH_STEP);
+		return;
+	}
 
 	/* Calculate the number of buckets to use now.
 	   We want one bucket for about every BEST_ELEMS_PER_BUCKET.
@@ -341,7 +484,7 @@ rehash (struct hash *h) {
 		new_bucket_cnt = turn_off_least_1bit (new_bucket_cnt);
 
 	/* Don't do anything if the bucket count wouldn't change. */
-	if (new_bucket_cnt == old_bucket_cnt)
+	if (new_bucket_cnt == h->bucket_cnt)
 		return;
 
 	/* Allocate new buckets and initialize them as empty. */
@@ -355,27 +498,48 @@ rehash (struct hash *h) {
 	for (i = 0; i < new_bucket_cnt; i++)
 		list_init (&new_buckets[i]);
 
-	/* Install new bucket info. */
+	/* Install new bucket info.  The old buckets are migrated
+	   lazily. */
+	h->old_buckets = h->buckets;
+	h->old_bucket_cnt = h->bucket_cnt;
+	h->migrate_idx = 0;
 	h->buckets = new_buckets;
 	h->bucket_cnt = new_bucket_cnt;
+	rehash_step (h, REHASH_STEP);
+}
 
-	/* Move each old element into the appropriate new bucket. */
-	for (i = 0; i < old_bucket_cnt; i++) {
-		struct list *old_bucket;
-		struct list_elem *elem, *next;
+/* Moves the elements of up to BUCKET_CNT old buckets of H into
+   the new buckets, and frees the old buckets once all of them are
+   empty. */
+static void
+rehash_step (struct hash *h, size_t bucket_cnt) {
+	ASSERT (h->old_buckets != NULL);
 
-		old_bucket = &old_buckets[i];
-		for (elem = list_begin (old_bucket);
-				elem != list_end (old_bucket); elem = next) {
-			struct list *new_bucket
-				= find_bucket (h, list_elem_to_hash_elem (elem));
-			next = list_next (elem);
-			list_remove (elem);
-			list_push_front (new_bucket, elem);
+	while (bucket_cnt-- > 0 && h->migrate_idx < h->old_bucket_cnt) {
+		struct list *old_bucket = &h->old_buckets[h->migrate_idx++];
+
+		while (!list_empty (old_bucket)) {
+			struct list_elem *elem = list_pop_front (old_bucket);
+			size_t bucket_idx = h->hash (list_elem_to_hash_elem (elem), h->aux)
+				& (h->bucket_cnt - 1);
+			list_push_front (&h->buckets[bucket_idx], elem);
 		}
 	}
 
-	free (old_buckets);
+	if (h->migrate_idx == h->old_bucket_cnt) {
+		free (h->old_buckets);
+		h->old_buckets = NULL;
+		h->old_bucket_cnt = 0;
+		h->migrate_idx = 0;
+	}
+}
+
+/* Completes any resize of H in progress, so that all of its
+   elements are in its current buckets. */
+static void
+rehash_finish (struct hash *h) {
+	if (h->old_buckets != NULL)
+		rehash_step (h, h->old_bucket_cnt);
 }
 
 /* Inserts E into BUCKET (in hash table H). */
@@ -0,0 +1,162 @@
+/* Priority queue (heap).
+
+   See heap.h for basic information. */
+
+#include "heap.h"
+#include "../debug.h"
+
+static struct heap_elem *merge (struct heap *,
+		struct heap_elem *, struct heap_elem *);
+
+/* Initializes heap H as an empty heap ordered by LESS given
+   auxiliary data AUX. */
+void
+heap_init (struct heap *h, heap_less_func *less, void *aux) {
+	ASSERT (h != NULL);
+	ASSERT (less != NULL);
+
+	h->root = NULL;
+	h->elem_cnt = 0;
+	h->less = less;
+	h->aux = aux;
+}
+
+/* Inserts E into H. */
+void
+heap_push (struct heap *h, struct heap_elem *e) {
+	ASSERT (h != NULL);
+	ASSERT (e != NULL);
+
+	e->parent = e->left = e->right = NULL;
+	h->root = merge (h, h->root, e);
+	h->elem_cnt++;
+}
+
+/* Returns the least element of H, or a null pointer if H is
+   empty. */
+struct heap_elem *
+heap_top (struct heap *h) {
+	ASSERT (h != NULL);
+
+	return h->root;
+}
+
+/* Removes and returns the least element of H, or returns a null
+   pointer if H is empty. */
+struct heap_elem *
+heap_pop (struct heap *h) {
+	struct heap_elem *top;
+
+	ASSERT (h != NULL);
+
+	top = h->root;
+	if (top != NULL)
+		heap_remove (h, top);
+	return top;
+}
+
+/* Removes E, which must be an element of H, from H. */
+void
+heap_remove (struct heap *h, struct heap_elem *e) {
+	struct heap_elem *parent, *sub;
+
+	ASSERT (h != NULL);
+	ASSERT (e != NULL);
+	ASSERT (h->elem_cnt > 0);
+
+	/* Replace E by the merge of its two subtrees.  Everything in
+	   them is at least as large as E, hence at least as large as
+	   E's parent, so the heap invariant still holds. */
+	parent = e->parent;
+	if (e->left != NULL)
+		e->left->parent = NULL;
+	if (e->right != NULL)
+		e->right->parent = NULL;
+	sub = merge (h, e->left, e->right);
+
+	if (sub != NULL)
+		sub->parent = parent;
+	if (parent == NULL)
+		h->root = sub;
+	else if (parent->left == e)
+		parent->left = sub;
+	else
+		parent->right = sub;
+
+	e->parent = e->left = e->right = NULL;
+	h->elem_cnt--;
+}
+
+/* Restores the heap invariant after the key of E, which must be
+   an element of H, changed in either direction. */
+void
+heap_update (struct heap *h, struct heap_elem *e) {
+	heap_remove (h, e);
+	heap_push (h, e);
+}
+
+/* Returns the number of elements in H. */
+size_t
+heap_size (struct heap *h) {
+	return h->elem_cnt;
+}
+
+/* Returns true if H is empty, false otherwise. */
+bool
+heap_empty (struct heap *h) {
+	return h->root == NULL;
+}
+
+/* Merges the heaps rooted at A and B, neither of which may have
+   a parent, and returns the root of the result.
+
+   This is the top-down skew heap merge: walk down the right
+   spines of both heaps, always continuing with the lesser node,
+   then swap the children of every node on the merged path. */
+static struct heap_elem *
+merge (struct heap *h, struct heap_elem *a, struct heap_elem *b) {
+	struct heap_elem *root, *cur, *tmp;
+
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+
+	ASSERT (a->parent == NULL && b->parent == NULL);
+
+	if (h->less (b, a, h->aux)) {
+		tmp = a;
+		a = b;
+		b = tmp;
+	}
+	root = cur = a;
+
+	/* Invariant: CUR is not greater than B. */
+	for (;;) {
+		struct heap_elem *right = cur->right;
+
+		if (right == NULL) {
+			cur->right = b;
+			b->parent = cur;
+			break;
+		}
+		if (h->less (b, right, h->aux)) {
+			cur->right = b;
+			b->parent = cur;
+			right->parent = NULL;
+			b = right;
+		}
+		cur = cur->right;
+	}
+
+	/* Swap children along the merged path, bottom up. */
+	for (;;) {
+		tmp = cur->left;
+		cur->left = cur->right;
+		cur->right = tmp;
+		if (cur == root)
+			break;
+		cur = cur->parent;
+	}
+	return root;
+}
@@ -0,0 +1,390 @@
+/* Integer-keyed hash table.
+
+   See ihash.h for basic information. */
+
+#include "ihash.h"
+#include "../debug.h"
+#include "threads/malloc.h"
+
+/* Slots whose control bytes are matched at once. */
+#define GROUP 8
+
+/* Fewest slots a table has once it has any. */
+#define MIN_SLOTS 16
+
+/* Old slots moved to the new arrays per insertion or removal. */
+#define MIGRATE_STEP 16
+
+/* Control bytes.  A full slot's is the low 7 bits of its key's
+   hash, so its top bit is clear. */
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
+
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+#define NOT_FOUND SIZE_MAX
+
+/* The control bytes of a group, loaded as one word. */
+typedef uint64_t __attribute__ ((may_alias, aligned (1))) group_t;
+
+/* Returns true if control byte C is that of a full slot. */
+static inline bool
+is_full (uint8_t c) {
+	return (c & 0x80) == 0;
+}
+
+/* Scrambles KEY, so that keys that differ in any bits land in
+   different groups: the finalizer of MurmurHash3. */
+static inline uint64_t
+hash_key (uint64_t key) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return key;
+}
+
+/* Returns the control byte of a full slot for a key with HASH. */
+static inline uint8_t
+hash_ctrl (uint64_t hash) {
+	return hash & 0x7f;
+}
+
+/* Returns the control bytes of group G of CTRL. */
+static inline uint64_t
+load_group (const uint8_t *ctrl, size_t g) {
+	return *(const group_t *) (ctrl + g * GROUP);
+}
+
+/* Returns a mask with the top bit of each byte of GROUP that
+   equals C set.  A byte just above a match may be set falsely,
+   which the caller weeds out by checking the byte. */
+static inline uint64_t
+match_byte (uint64_t group, uint8_t c) {
+	uint64_t x = group ^ (c * ONES);
+
+	return (x - ONES) & ~x & HIGHS;
+}
+
+/* Returns a mask with the top bit of each EMPTY byte of GROUP
+   set: those with the top bit set and bit 1 clear. */
+static inline uint64_t
+match_empty (uint64_t group) {
+	return group & ~(group << 6) & HIGHS;
+}
+
+/* Returns a mask with the top bit of each EMPTY or DELETED byte of
+   GROUP set. */
+static inline uint64_t
+match_free (uint64_t group) {
+	return group & HIGHS;
+}
+
+/* Returns the index of the slot within a group that the lowest
+   bit of MASK stands for. */
+static inline size_t
+mask_slot (uint64_t mask) {
+	return __builtin_ctzll (mask) / 8;
+}
+
+/* Returns the index of the slot of KEY, whose hash is HASH, among
+   the CNT slots of SLOTS with control bytes CTRL, or NOT_FOUND.
+   Groups are probed in triangular order from the one HASH picks,
+   which visits every group, up to the first that has an EMPTY
+   slot: KEY would have been put there if it got that far. */
+static size_t
+find_slot (const struct ihash_slot *slots, const uint8_t *ctrl, size_t cnt,
+		uint64_t key, uint64_t hash) {
+	size_t group_cnt = cnt / GROUP;
+	size_t g, step;
+
+	if (cnt == 0)
+		return NOT_FOUND;
+	g = (hash >> 7) & (group_cnt - 1);
+	for (step = 0; step < group_cnt; step++) {
+		uint64_t group = load_group (ctrl, g);
+		uint64_t m;
+
+		for (m = match_byte (group, hash_ctrl (hash)); m != 0; m &= m - 1) {
+			size_t i = g * GROUP + mask_slot (m);
+
+			if (ctrl[i] == hash_ctrl (hash) && slots[i].key == key)
+				return i;
+		}
+		if (match_empty (group) != 0)
+			break;
+		g = (g + step + 1) & (group_cnt - 1);
+	}
+	return NOT_FOUND;
+}
+
+/* Returns the index of the first EMPTY or DELETED slot on the
+   probe sequence of HASH among CNT slots with control bytes CTRL,
+   or NOT_FOUND if all are full. */
+static size_t
+free_slot (const uint8_t *ctrl, size_t cnt, uint64_t hash) {
+	size_t group_cnt = cnt / GROUP;
+	size_t g, step;
+
+	if (cnt == 0)
+		return NOT_FOUND;
+	g = (hash >> 7) & (group_cnt - 1);
+	for (step = 0; step < group_cnt; step++) {
+		uint64_t m = match_free (load_group (ctrl, g));
+
+		if (m != 0)
+			return g * GROUP + mask_slot (m);
+		g = (g + step + 1) & (group_cnt - 1);
+	}
+	return NOT_FOUND;
+}
+
+/* Puts KEY, whose hash is HASH, and VALUE into the new arrays of
+   IH, where KEY must not be yet.  Returns false if they are
+   full. */
+static bool
+put_slot (struct ihash *ih, uint64_t key, uint64_t hash, void *value) {
+	size_t i = free_slot (ih->ctrl, ih->slot_cnt, hash);
+
+	if (i == NOT_FOUND)
+		return false;
+	if (ih->ctrl[i] == CTRL_EMPTY)
+		ih->used_cnt++;
+	ih->ctrl[i] = hash_ctrl (hash);
+	ih->slots[i].key = key;
+	ih->slots[i].value = value;
+	return true;
+}
+
+/* Moves up to CNT old slots of IH to its new arrays, and frees
+   the old arrays once they are empty. */
+static void
+migrate (struct ihash *ih, size_t cnt) {
+	while (ih->old_slots != NULL && cnt-- > 0) {
+		size_t i = ih->migrate_idx++;
+
+		if (is_full (ih->old_ctrl[i])) {
+			struct ihash_slot *s = &ih->old_slots[i];
+			bool ok = put_slot (ih, s->key, hash_key (s->key), s->value);
+
+			ASSERT (ok);
+			ih->old_ctrl[i] = CTRL_DELETED;
+		}
+		if (ih->migrate_idx == ih->old_slot_cnt) {
+			free (ih->old_slots);
+			ih->old_slots = NULL;
+			ih->old_ctrl = NULL;
+			ih->old_slot_cnt = 0;
+			ih->migrate_idx = 0;
+		}
+	}
+}
+
+/* Starts moving IH to new arrays: twice as many slots if IH is
+   more than half full, or as many otherwise, which drops the
+   DELETED slots.  No migration may be running.  Returns false if
+   memory is short. */
+static bool
+start_resize (struct ihash *ih) {
+	size_t cnt = ih->slot_cnt == 0 ? MIN_SLOTS : ih->slot_cnt;
+	struct ihash_slot *slots;
+	size_t i;
+
+	ASSERT (ih->old_slots == NULL);
+
+	if (ih->elem_cnt + 1 > cnt / 2)
+		cnt *= 2;
+	slots = malloc (cnt * (sizeof *slots + 1));
+	if (slots == NULL)
+		return false;
+
+	if (ih->slot_cnt > 0) {
+		ih->old_slots = ih->slots;
+		ih->old_ctrl = ih->ctrl;
+		ih->old_slot_cnt = ih->slot_cnt;
+		ih->migrate_idx = 0;
+	}
+	ih->slots = slots;
+	ih->ctrl = (uint8_t *) (slots + cnt);
+	ih->slot_cnt = cnt;
+	ih->used_cnt = 0;
+	for (i = 0; i < cnt; i++)
+		ih->ctrl[i] = CTRL_EMPTY;
+	return true;
+}
+
+/* Returns the slot of KEY, whose hash is HASH, in IH, or a null
+   pointer.  Sets *OLD to whether it is in the old arrays. */
+static struct ihash_slot *
+lookup (struct ihash *ih, uint64_t key, uint64_t hash, bool *old) {
+	size_t i = find_slot (ih->slots, ih->ctrl, ih->slot_cnt, key, hash);
+
+	*old = false;
+	if (i != NOT_FOUND)
+		return &ih->slots[i];
+	if (ih->old_slots != NULL) {
+		i = find_slot (ih->old_slots, ih->old_ctrl, ih->old_slot_cnt, key, hash);
+		*old = true;
+		if (i != NOT_FOUND)
+			return &ih->old_slots[i];
+	}
+	return NULL;
+}
+
+/* Initializes IH as an empty table, which allocates no memory
+   until the first insertion. */
+void
+ihash_init (struct ihash *ih) {
+	ih->elem_cnt = 0;
+	ih->slot_cnt = 0;
+	ih->used_cnt = 0;
+	ih->slots = NULL;
+	ih->ctrl = NULL;
+	ih->old_slots = NULL;
+	ih->old_ctrl = NULL;
+	ih->old_slot_cnt = 0;
+	ih->migrate_idx = 0;
+}
+
+/* Frees the memory held by IH.  The values are the caller's. */
+void
+ihash_destroy (struct ihash *ih) {
+	free (ih->slots);
+	free (ih->old_slots);
+	ihash_init (ih);
+}
+
+/* Returns the value of KEY in IH, or a null pointer if KEY is not
+   in IH. */
+void *
+ihash_find (struct ihash *ih, uint64_t key) {
+	bool old;
+	struct ihash_slot *s = lookup (ih, key, hash_key (key), &old);
+
+	return s != NULL ? s->value : NULL;
+}
+
+/* Sets the value of KEY in IH to VALUE, which must not be null,
+   adding KEY if it is not in IH yet.  Returns false if memory is
+   short. */
+bool
+ihash_insert (struct ihash *ih, uint64_t key, void *value) {
+	uint64_t hash = hash_key (key);
+	struct ihash_slot *s;
+	bool old;
+
+	ASSERT (value != NULL);
+
+	s = lookup (ih, key, hash, &old);
+	if (s != NULL) {
+		s->value = value;
+		return true;
+	}
+
+	/* Past 7/8 of the slots in use, probe sequences grow long. */
+	migrate (ih, MIGRATE_STEP);
+	if ((ih->used_cnt + 1) * 8 > ih->slot_cnt * 7) {
+		migrate (ih, SIZE_MAX);
+		start_resize (ih);
+	}
+	if (!put_slot (ih, key, hash, value))
+		return false;
+	ih->elem_cnt++;
+	return true;
+}
+
+/* Removes KEY from IH and returns its value, or returns a null
+   pointer if KEY is not in IH. */
+void *
+ihash_remove (struct ihash *ih, uint64_t key) {
+	uint64_t hash = hash_key (key);
+	struct ihash_slot *s;
+	size_t i;
+	bool old;
+
+	migrate (ih, MIGRATE_STEP);
+	s = lookup (ih, key, hash, &old);
+	if (s == NULL)
+		return NULL;
+
+	if (old)
+		ih->old_ctrl[s - ih->old_slots] = CTRL_DELETED;
+	else {
+		/* A group with an EMPTY slot ends every probe sequence that
+		   reaches it, so none goes on past it to a key placed
+		   later: the slot may become EMPTY again. */
+		i = s - ih->slots;
+		if (match_empty (load_group (ih->ctrl, i / GROUP)) != 0) {
+			ih->ctrl[i] = CTRL_EMPTY;
+			ih->used_cnt--;
+		} else
+			ih->ctrl[i] = CTRL_DELETED;
+	}
+	ih->elem_cnt--;
+	return s->value;
+}
+
+/* Initializes I for iterating IH:
+
+   struct ihash_iterator i;
+
+   ihash_first (&i, ih);
+   while (ihash_next (&i))
+     {
+       ...do something with i.key and i.value...
+     }
+
+   IH must not be changed during the iteration. */
+void
+ihash_first (struct ihash_iterator *i, struct ihash *ih) {
+	ASSERT (i != NULL);
+	ASSERT (ih != NULL);
+
+	i->ih = ih;
+	i->old = true;
+	i->idx = 0;
+	i->key = 0;
+	i->value = NULL;
+}
+
+/* Advances I to the next entry of its table, storing its key and
+   value in I.  Returns false if there are no more entries. */
+bool
+ihash_next (struct ihash_iterator *i) {
+	struct ihash *ih = i->ih;
+
+	for (;;) {
+		const struct ihash_slot *slots = i->old ? ih->old_slots : ih->slots;
+		const uint8_t *ctrl = i->old ? ih->old_ctrl : ih->ctrl;
+		size_t cnt = slots == NULL ? 0
+			: i->old ? ih->old_slot_cnt : ih->slot_cnt;
+
+		while (i->idx < cnt) {
+			size_t idx = i->idx++;
+
+			if (is_full (ctrl[idx])) {
+				i->key = slots[idx].key;
+				i->value = slots[idx].value;
+				return true;
+			}
+		}
+		if (!i->old)
+			return false;
+		i->old = false;
+		i->idx = 0;
+	}
+}
+
+/* Returns the number of entries in IH. */
+size_t
+ihash_size (struct ihash *ih) {
+	return ih->elem_cnt;
+}
+
+/* Returns true if IH has no entries. */
+bool
+ihash_empty (struct ihash *ih) {
+	return ih->elem_cnt == 0;
+}
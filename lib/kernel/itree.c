@@ -0,0 +1,248 @@
+/* Interval tree.
+
+   See itree.h for basic information. */
+
+#include "itree.h"
+#include "../debug.h"
+
+static void retrace (struct itree *, struct itree_elem *);
+
+/* Initializes T as an empty interval tree. */
+void
+itree_init (struct itree *t) {
+	ASSERT (t != NULL);
+
+	t->root = NULL;
+	t->elem_cnt = 0;
+}
+
+/* Inserts E into T as the interval [START, END), which must not
+   be empty. */
+void
+itree_insert (struct itree *t, struct itree_elem *e,
+		uintptr_t start, uintptr_t end) {
+	struct itree_elem *parent = NULL;
+	struct itree_elem **link = &t->root;
+
+	ASSERT (t != NULL);
+	ASSERT (e != NULL);
+	ASSERT (start < end);
+
+	while (*link != NULL) {
+		parent = *link;
+		link = start < parent->start ? &parent->left : &parent->right;
+	}
+
+	e->parent = parent;
+	e->left = e->right = NULL;
+	e->start = start;
+	e->end = end;
+	e->max_end = end;
+	e->height = 1;
+	*link = e;
+	t->elem_cnt++;
+	retrace (t, parent);
+}
+
+/* Returns the leftmost element in the subtree rooted at E. */
+static struct itree_elem *
+leftmost (struct itree_elem *e) {
+	while (e->left != NULL)
+		e = e->left;
+	return e;
+}
+
+/* Makes NEW take the place of OLD as PARENT's child, or as the
+   root of T if PARENT is null.  NEW may be null. */
+static void
+replace_child (struct itree *t, struct itree_elem *parent,
+		struct itree_elem *old, struct itree_elem *new) {
+	if (parent == NULL)
+		t->root = new;
+	else if (parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+	if (new != NULL)
+		new->parent = parent;
+}
+
+/* Removes E, which must be an element of T, from T. */
+void
+itree_remove (struct itree *t, struct itree_elem *e) {
+	struct itree_elem *fix;
+
+	ASSERT (t != NULL);
+	ASSERT (e != NULL);
+	ASSERT (t->elem_cnt > 0);
+
+	if (e->left != NULL && e->right != NULL) {
+		/* Replace E by its successor S, which has no left child. */
+		struct itree_elem *s = leftmost (e->right);
+
+		if (s->parent != e) {
+			fix = s->parent;
+			replace_child (t, s->parent, s, s->right);
+			s->right = e->right;
+			s->right->parent = s;
+		} else
+			fix = s;
+		s->left = e->left;
+		s->left->parent = s;
+		replace_child (t, e->parent, e, s);
+	} else {
+		fix = e->parent;
+		replace_child (t, e->parent, e,
+				e->left != NULL ? e->left : e->right);
+	}
+	t->elem_cnt--;
+	retrace (t, fix);
+}
+
+/* Returns the element of T with the lowest start whose interval
+   contains POINT, or a null pointer if there is none. */
+struct itree_elem *
+itree_find (struct itree *t, uintptr_t point) {
+	return point + 1 != 0 ? itree_first_overlap (t, point, point + 1) : NULL;
+}
+
+/* Returns the element of T with the lowest start whose interval
+   overlaps [START, END), or a null pointer if there is none. */
+struct itree_elem *
+itree_first_overlap (struct itree *t, uintptr_t start, uintptr_t end) {
+	struct itree_elem *e;
+
+	ASSERT (t != NULL);
+
+	/* If the left subtree reaches past START, any overlap at all
+	   must be in there: the interval reaching furthest either
+	   overlaps or starts at or after END, as does everything to
+	   its right. */
+	for (e = t->root; e != NULL; ) {
+		if (e->left != NULL && e->left->max_end > start)
+			e = e->left;
+		else if (e->start >= end)
+			return NULL;
+		else if (e->end > start)
+			return e;
+		else
+			e = e->right;
+	}
+	return NULL;
+}
+
+/* Returns the element of T with the lowest start, or a null
+   pointer if T is empty. */
+struct itree_elem *
+itree_first (struct itree *t) {
+	ASSERT (t != NULL);
+
+	return t->root != NULL ? leftmost (t->root) : NULL;
+}
+
+/* Returns the element that follows E in order of start, or a null
+   pointer if E is the last one. */
+struct itree_elem *
+itree_next (struct itree_elem *e) {
+	ASSERT (e != NULL);
+
+	if (e->right != NULL)
+		return leftmost (e->right);
+	while (e->parent != NULL && e->parent->right == e)
+		e = e->parent;
+	return e->parent;
+}
+
+/* Returns the number of elements in T. */
+size_t
+itree_size (struct itree *t) {
+	return t->elem_cnt;
+}
+
+/* Returns true if T is empty, false otherwise. */
+bool
+itree_empty (struct itree *t) {
+	return t->root == NULL;
+}
+
+/* Returns the height of the subtree rooted at E. */
+static int
+height (const struct itree_elem *e) {
+	return e != NULL ? e->height : 0;
+}
+
+/* Recomputes E's height and max_end from its children. */
+static void
+update (struct itree_elem *e) {
+	int lh = height (e->left), rh = height (e->right);
+
+	e->height = (lh > rh ? lh : rh) + 1;
+	e->max_end = e->end;
+	if (e->left != NULL && e->left->max_end > e->max_end)
+		e->max_end = e->left->max_end;
+	if (e->right != NULL && e->right->max_end > e->max_end)
+		e->max_end = e->right->max_end;
+}
+
+/* Rotates the subtree rooted at X to the left and returns its new
+   root. */
+static struct itree_elem *
+rotate_left (struct itree *t, struct itree_elem *x) {
+	struct itree_elem *y = x->right;
+
+	x->right = y->left;
+	if (y->left != NULL)
+		y->left->parent = x;
+	replace_child (t, x->parent, x, y);
+	y->left = x;
+	x->parent = y;
+	update (x);
+	update (y);
+	return y;
+}
+
+/* Rotates the subtree rooted at X to the right and returns its new
+   root. */
+static struct itree_elem *
+rotate_right (struct itree *t, struct itree_elem *x) {
+	struct itree_elem *y = x->left;
+
+	x->left = y->right;
+	if (y->right != NULL)
+		y->right->parent = x;
+	replace_child (t, x->parent, x, y);
+	y->right = x;
+	x->parent = y;
+	update (x);
+	update (y);
+	return y;
+}
+
+/* Restores the AVL balance and the augmented data of the subtree
+   rooted at E, whose children are already balanced, and returns
+   its new root. */
+static struct itree_elem *
+rebalance (struct itree *t, struct itree_elem *e) {
+	int balance = height (e->left) - height (e->right);
+
+	if (balance > 1) {
+		if (height (e->left->left) < height (e->left->right))
+			rotate_left (t, e->left);
+		return rotate_right (t, e);
+	} else if (balance < -1) {
+		if (height (e->right->right) < height (e->right->left))
+			rotate_right (t, e->right);
+		return rotate_left (t, e);
+	}
+	update (e);
+	return e;
+}
+
+/* Rebalances T from E up to the root after E's subtree changed.
+   Every ancestor is visited, since each of their max_end may have
+   changed. */
+static void
+retrace (struct itree *t, struct itree_elem *e) {
+	while (e != NULL)
+		e = rebalance (t, e)->parent;
+}
@@ -1,5 +1,4 @@
 #include "list.h"
-#include "threads/thread.h"
 #include "../debug.h"
 
 /* Our doubly linked lists have two header elements: the "head"
@@ -331,84 +330,83 @@ is_sorted (struct list_elem *a, struct list_elem *b,
 	return true;
 }
 
-/* Finds a run, starting at A and ending not after B, of list
-   elements that are in nondecreasing order according to LESS
-   given auxiliary data AUX.  Returns the (exclusive) end of the
-   run.
-   A through B (exclusive) must form a non-empty range. */
-static struct list_elem *
-find_end_of_run (struct list_elem *a, struct list_elem *b,
-		list_less_func *less, void *aux) {
-	ASSERT (a != NULL);
-	ASSERT (b != NULL);
-	ASSERT (less != NULL);
-	ASSERT (a != b);
+/* Number of sublists list_sort() keeps.  Sublist K holds 2**K
+   elements, so this is enough for any list that fits in memory. */
+#define SORT_BINS 64
 
-	do {
-		a = list_next (a);
-	} while (a != b && !less (a, list_prev (a), aux));
-	return a;
-}
-
-/* Merges A0 through A1B0 (exclusive) with A1B0 through B1
-   (exclusive) to form a combined range also ending at B1
-   (exclusive).  Both input ranges must be nonempty and sorted in
-   nondecreasing order according to LESS given auxiliary data
-   AUX.  The output range will be sorted the same way. */
-static void
-inplace_merge (struct list_elem *a0, struct list_elem *a1b0,
-		struct list_elem *b1,
+/* Merges A and B, null-terminated chains of elements linked only
+   through their `next' members, each sorted in nondecreasing
+   order according to LESS given auxiliary data AUX, and returns
+   the merged chain.  Among equal elements, those of A come
+   first, so A should hold the ones that came earlier. */
+static struct list_elem *
+merge_chains (struct list_elem *a, struct list_elem *b,
 		list_less_func *less, void *aux) {
-	ASSERT (a0 != NULL);
-	ASSERT (a1b0 != NULL);
-	ASSERT (b1 != NULL);
-	ASSERT (less != NULL);
-	ASSERT (is_sorted (a0, a1b0, less, aux));
-	ASSERT (is_sorted (a1b0, b1, less, aux));
-
-	while (a0 != a1b0 && a1b0 != b1)
-		if (!less (a1b0, a0, aux))
-			a0 = list_next (a0);
-		else {
-			a1b0 = list_next (a1b0);
-			list_splice (a0, list_prev (a1b0), a1b0);
+	struct list_elem head;
+	struct list_elem *tail = &head;
+
+	while (a != NULL && b != NULL) {
+		if (less (b, a, aux)) {
+			tail->next = b;
+			b = b->next;
+		} else {
+			tail->next = a;
+			a = a->next;
 		}
+		tail = tail->next;
+	}
+	tail->next = a != NULL ? a : b;
+	return head.next;
 }
 
 /* Sorts LIST according to LESS given auxiliary data AUX, using a
-   natural iterative merge sort that runs in O(n lg n) time and
-   O(1) space in the number of elements in LIST. */
+   bottom-up merge sort that runs in O(n lg n) time in the number
+   of elements in LIST.  The sort is stable.
+
+   Each element is taken from LIST once, as a sorted chain of
+   one, and carried up through BINS like a binary counter: bin K
+   is empty or holds a sorted chain of 2**K elements, and two
+   chains of the same size are merged into one for the next bin.
+   The chains use only `next'; the `prev' links are rebuilt at
+   the end. */
 void
 list_sort (struct list *list, list_less_func *less, void *aux) {
-	size_t output_run_cnt;        /* Number of runs output in current pass. */
+	struct list_elem *bins[SORT_BINS];
+	size_t bin_cnt = 0, i;
+	struct list_elem *e, *next, *chain, *prev;
 
 	ASSERT (list != NULL);
 	ASSERT (less != NULL);
 
-	/* Pass over the list repeatedly, merging adjacent runs of
-	   nondecreasing elements, until only one run is left. */
-	do {
-		struct list_elem *a0;     /* Start of first run. */
-		struct list_elem *a1b0;   /* End of first run, start of second. */
-		struct list_elem *b1;     /* End of second run. */
-
-		output_run_cnt = 0;
-		for (a0 = list_begin (list); a0 != list_end (list); a0 = b1) {
-			/* Each iteration produces one output run. */
-			output_run_cnt++;
-
-			/* Locate two adjacent runs of nondecreasing elements
-			   A0...A1B0 and A1B0...B1. */
-			a1b0 = find_end_of_run (a0, list_end (list), less, aux);
-			if (a1b0 == list_end (list))
-				break;
-			b1 = find_end_of_run (a1b0, list_end (list), less, aux);
-
-			/* Merge the runs. */
-			inplace_merge (a0, a1b0, b1, less, aux);
+	for (e = list_begin (list); e != list_end (list); e = next) {
+		next = list_next (e);
+		e->next = NULL;
+		chain = e;
+		for (i = 0; i < bin_cnt && bins[i] != NULL; i++) {
+			chain = merge_chains (bins[i], chain, less, aux);
+			bins[i] = NULL;
 		}
+		if (i == bin_cnt) {
+			ASSERT (bin_cnt < SORT_BINS);
+			bin_cnt++;
+		}
+		bins[i] = chain;
+	}
+
+	/* Higher bins hold earlier elements. */
+	chain = NULL;
+	for (i = 0; i < bin_cnt; i++)
+		if (bins[i] != NULL)
+			chain = merge_chains (bins[i], chain, less, aux);
+
+	prev = &list->head;
+	for (e = chain; e != NULL; e = e->next) {
+		e->prev = prev;
+		prev->next = e;
+		prev = e;
 	}
-	while (output_run_cnt > 1);
+	prev->next = &list->tail;
+	list->tail.prev = prev;
 
 	ASSERT (is_sorted (list_begin (list), list_end (list), less, aux));
 }
@@ -431,6 +429,37 @@ list_insert_ordered (struct list *list, struct list_elem *elem,
 	return list_insert (e, elem);
 }
 
+/* Inserts ELEM in the proper position in LIST, which must be
+   sorted according to LESS given auxiliary data AUX, as
+   list_insert_ordered() does, but looks for it starting from
+   HINT, an element of LIST or its tail, instead of from the
+   front.  Walks forward or backward from HINT as needed, so it
+   runs in time proportional to the distance between HINT and
+   where ELEM goes: a caller inserting keys that mostly arrive in
+   order can pass the element it inserted last. */
+void
+list_insert_ordered_hint (struct list *list, struct list_elem *elem,
+		struct list_elem *hint, list_less_func *less, void *aux) {
+	struct list_elem *e = hint;
+
+	ASSERT (list != NULL);
+	ASSERT (elem != NULL);
+	ASSERT (hint != NULL);
+	ASSERT (less != NULL);
+
+	if (e != list_end (list) && !less (elem, e, aux)) {
+		/* ELEM goes after HINT. */
+		do
+			e = list_next (e);
+		while (e != list_end (list) && !less (elem, e, aux));
+	} else {
+		/* ELEM goes before HINT. */
+		while (e != list_begin (list) && less (elem, list_prev (e), aux))
+			e = list_prev (e);
+	}
+	list_insert (e, elem);
+}
+
 /* Iterates through LIST and removes all but the first in each
    set of adjacent elements that are equal according to LESS
    given auxiliary data AUX.  If DUPLICATES is non-null, then the
@@ -488,10 +517,3 @@ list_min (struct list *list, list_less_func *less, void *aux) {
 	}
 	return min;
 }
-
-bool compare (const struct list_elem *a, const struct list_elem *b, void *aux) {
-	struct thread *thread_a = list_entry(a, struct thread, elem);
-	struct thread *thread_b = list_entry(b, struct thread, elem);
-
-	return (thread_a->priority < thread_b->priority);
-}
\ No newline at end of file
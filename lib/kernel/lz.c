@@ -0,0 +1,177 @@
+/* LZ77 compression.
+
+   See lz.h for the format.  The last sequence holds only literals,
+   so that a decoder knows a block has ended when its input has,
+   and every match must lie wholly within what was decoded before
+   it, though it may overlap the bytes it makes: a distance of 1
+   repeats one byte. */
+
+#include "lz.h"
+#include <string.h>
+#include "../debug.h"
+
+/* Distinct 4-byte strings that the table can tell apart. */
+#define HASH_SIZE (1 << LZ_HASH_BITS)
+
+/* Count in a token that goes on in the bytes after it. */
+#define TOKEN_MAX 15
+
+/* Returns the 4 bytes at P as a number. */
+static inline uint32_t
+read32 (const uint8_t *p) {
+	uint32_t v;
+
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+/* Returns the hash table slot of the 4 bytes at P. */
+static inline size_t
+hash (const uint8_t *p) {
+	return (read32 (p) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Returns the most bytes that a sequence of LIT_CNT literals and
+   a match of MATCH_LEN bytes, 0 for none, can take. */
+static size_t
+sequence_size (size_t lit_cnt, size_t match_len) {
+	size_t size = 1 + lit_cnt + lit_cnt / 255 + 1;
+
+	if (match_len > 0)
+		size += 2 + (match_len - LZ_MIN_MATCH) / 255 + 1;
+	return size;
+}
+
+/* Writes the part of length LEN past what a token holds at OUT and
+   returns the byte after it.  LEN must be at least TOKEN_MAX. */
+static uint8_t *
+put_length (uint8_t *out, size_t len) {
+	for (len -= TOKEN_MAX; len >= 255; len -= 255)
+		*out++ = 255;
+	*out++ = len;
+	return out;
+}
+
+/* Writes a sequence of the LIT_CNT literals at LIT and a match of
+   MATCH_LEN bytes, 0 for none, DISTANCE bytes back, at OUT, and
+   returns the byte after it, or a null pointer if it would not fit
+   before END. */
+static uint8_t *
+put_sequence (uint8_t *out, uint8_t *end, const uint8_t *lit,
+		size_t lit_cnt, size_t distance, size_t match_len) {
+	size_t match_cnt = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+
+	if (sequence_size (lit_cnt, match_len) > (size_t) (end - out))
+		return NULL;
+	*out++ = (lit_cnt < TOKEN_MAX ? lit_cnt : TOKEN_MAX) << 4
+		| (match_cnt < TOKEN_MAX ? match_cnt : TOKEN_MAX);
+	if (lit_cnt >= TOKEN_MAX)
+		out = put_length (out, lit_cnt);
+	memcpy (out, lit, lit_cnt);
+	out += lit_cnt;
+	if (match_len > 0) {
+		*out++ = distance & 0xff;
+		*out++ = distance >> 8;
+		if (match_cnt >= TOKEN_MAX)
+			out = put_length (out, match_cnt);
+	}
+	return out;
+}
+
+/* Compresses the SIZE bytes at SRC, at most LZ_MAX_SIZE, into DST,
+   which has room for CAP bytes, using the LZ_WORK_SIZE bytes at
+   WORK as scratch.  Returns the size of the compressed block, or 0
+   if it does not fit in CAP bytes. */
+size_t
+lz_compress (const void *src_, size_t size, void *dst_, size_t cap,
+		void *work) {
+	const uint8_t *src = src_, *end = src + size;
+	const uint8_t *p = src, *anchor = src;
+	uint8_t *dst = dst_, *out = dst;
+	uint16_t *table = work;
+
+	ASSERT (size <= LZ_MAX_SIZE);
+
+	/* A slot holds a position plus 1, or 0 if it has none. */
+	memset (table, 0, HASH_SIZE * sizeof *table);
+	while (p + LZ_MIN_MATCH <= end) {
+		size_t slot = hash (p), cand = table[slot];
+		const uint8_t *ref;
+		size_t len;
+
+		table[slot] = p - src + 1;
+		if (cand == 0 || read32 (src + cand - 1) != read32 (p)) {
+			p++;
+			continue;
+		}
+		ref = src + cand - 1;
+		for (len = LZ_MIN_MATCH; p + len < end && ref[len] == p[len]; len++)
+			continue;
+		out = put_sequence (out, dst + cap, anchor, p - anchor, p - ref, len);
+		if (out == NULL)
+			return 0;
+		p += len;
+		anchor = p;
+	}
+	out = put_sequence (out, dst + cap, anchor, end - anchor, 0, 0);
+	return out != NULL ? (size_t) (out - dst) : 0;
+}
+
+/* Adds the part of a length past what its token holds, from *IN on
+   up to END, to *LEN, advancing *IN past it.  Returns false if the
+   input ends first. */
+static bool
+get_length (const uint8_t **in, const uint8_t *end, size_t *len) {
+	uint8_t b;
+
+	do {
+		if (*in == end)
+			return false;
+		b = *(*in)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+/* Decompresses the SIZE-byte block at SRC into the DST_SIZE bytes
+   at DST.  Returns true if it decodes to exactly DST_SIZE bytes,
+   false if it is corrupt, without writing outside DST either
+   way. */
+bool
+lz_decompress (const void *src_, size_t size, void *dst_, size_t dst_size) {
+	const uint8_t *in = src_, *in_end = in + size;
+	uint8_t *dst = dst_, *out = dst, *out_end = dst + dst_size;
+
+	while (in < in_end) {
+		unsigned token = *in++;
+		size_t len = token >> 4, distance;
+		const uint8_t *ref;
+
+		if (len == TOKEN_MAX && !get_length (&in, in_end, &len))
+			return false;
+		if (len > (size_t) (in_end - in) || len > (size_t) (out_end - out))
+			return false;
+		memcpy (out, in, len);
+		in += len;
+		out += len;
+		if (in == in_end)
+			break;
+
+		if (in_end - in < 2)
+			return false;
+		distance = in[0] | in[1] << 8;
+		in += 2;
+		len = (token & TOKEN_MAX) + LZ_MIN_MATCH;
+		if ((token & TOKEN_MAX) == TOKEN_MAX
+				&& !get_length (&in, in_end, &len))
+			return false;
+		if (distance == 0 || distance > (size_t) (out - dst)
+				|| len > (size_t) (out_end - out))
+			return false;
+
+		/* Byte by byte, since the match may overlap its copy. */
+		for (ref = out - distance; len > 0; len--)
+			*out++ = *ref++;
+	}
+	return out == out_end;
+}
@@ -0,0 +1,373 @@
+/* Red-black tree.
+
+   See rbtree.h for basic information.
+
+   The tree keeps the usual invariants, with null children counting
+   as black leaves: the root is black, a red element has no red
+   child, and every path from an element down to a leaf passes the
+   same number of black elements.  So no path is more than twice as
+   long as another and the height is at most 2 log2 (n + 1). */
+
+#include "rbtree.h"
+#include "../debug.h"
+
+static void insert_fixup (struct rbtree *, struct rbtree_elem *);
+static void remove_fixup (struct rbtree *, struct rbtree_elem *,
+		struct rbtree_elem *parent);
+
+/* Initializes T as an empty red-black tree ordered by LESS given
+   auxiliary data AUX. */
+void
+rbtree_init (struct rbtree *t, rbtree_less_func *less, void *aux) {
+	ASSERT (t != NULL);
+	ASSERT (less != NULL);
+
+	t->root = NULL;
+	t->elem_cnt = 0;
+	t->less = less;
+	t->aux = aux;
+}
+
+/* Inserts E into T, after any elements equal to it. */
+void
+rbtree_insert (struct rbtree *t, struct rbtree_elem *e) {
+	struct rbtree_elem *parent = NULL;
+	struct rbtree_elem **link = &t->root;
+
+	ASSERT (t != NULL);
+	ASSERT (e != NULL);
+
+	while (*link != NULL) {
+		parent = *link;
+		link = t->less (e, parent, t->aux) ? &parent->left : &parent->right;
+	}
+
+	e->parent = parent;
+	e->left = e->right = NULL;
+	e->red = true;
+	*link = e;
+	t->elem_cnt++;
+	insert_fixup (t, e);
+}
+
+/* Returns the leftmost element in the subtree rooted at E. */
+static struct rbtree_elem *
+leftmost (struct rbtree_elem *e) {
+	while (e->left != NULL)
+		e = e->left;
+	return e;
+}
+
+/* Returns the rightmost element in the subtree rooted at E. */
+static struct rbtree_elem *
+rightmost (struct rbtree_elem *e) {
+	while (e->right != NULL)
+		e = e->right;
+	return e;
+}
+
+/* Makes NEW take the place of OLD as PARENT's child, or as the
+   root of T if PARENT is null.  NEW may be null. */
+static void
+replace_child (struct rbtree *t, struct rbtree_elem *parent,
+		struct rbtree_elem *old, struct rbtree_elem *new) {
+	if (parent == NULL)
+		t->root = new;
+	else if (parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+	if (new != NULL)
+		new->parent = parent;
+}
+
+/* Removes E, which must be an element of T, from T. */
+void
+rbtree_remove (struct rbtree *t, struct rbtree_elem *e) {
+	struct rbtree_elem *child, *parent;
+	bool red;
+
+	ASSERT (t != NULL);
+	ASSERT (e != NULL);
+	ASSERT (t->elem_cnt > 0);
+
+	if (e->left != NULL && e->right != NULL) {
+		/* Replace E by its successor S, which has no left child.
+		   S takes E's color, so the black element missing, if
+		   any, is the one that was at S's old place. */
+		struct rbtree_elem *s = leftmost (e->right);
+
+		child = s->right;
+		red = s->red;
+		if (s->parent != e) {
+			parent = s->parent;
+			replace_child (t, s->parent, s, s->right);
+			s->right = e->right;
+			s->right->parent = s;
+		} else
+			parent = s;
+		s->left = e->left;
+		s->left->parent = s;
+		replace_child (t, e->parent, e, s);
+		s->red = e->red;
+	} else {
+		child = e->left != NULL ? e->left : e->right;
+		parent = e->parent;
+		red = e->red;
+		replace_child (t, parent, e, child);
+	}
+	t->elem_cnt--;
+	if (!red)
+		remove_fixup (t, child, parent);
+}
+
+/* Returns the first element of T that is not less than PROBE, or a
+   null pointer if there is none. */
+struct rbtree_elem *
+rbtree_lower_bound (struct rbtree *t, const struct rbtree_elem *probe) {
+	struct rbtree_elem *e, *found = NULL;
+
+	ASSERT (t != NULL);
+
+	for (e = t->root; e != NULL; )
+		if (t->less (e, probe, t->aux))
+			e = e->right;
+		else {
+			found = e;
+			e = e->left;
+		}
+	return found;
+}
+
+/* Returns the first element of T that is greater than PROBE, or a
+   null pointer if there is none. */
+struct rbtree_elem *
+rbtree_upper_bound (struct rbtree *t, const struct rbtree_elem *probe) {
+	struct rbtree_elem *e, *found = NULL;
+
+	ASSERT (t != NULL);
+
+	for (e = t->root; e != NULL; )
+		if (t->less (probe, e, t->aux)) {
+			found = e;
+			e = e->left;
+		} else
+			e = e->right;
+	return found;
+}
+
+/* Returns the first element of T equal to PROBE, or a null pointer
+   if there is none. */
+struct rbtree_elem *
+rbtree_find (struct rbtree *t, const struct rbtree_elem *probe) {
+	struct rbtree_elem *e = rbtree_lower_bound (t, probe);
+
+	return e != NULL && !t->less (probe, e, t->aux) ? e : NULL;
+}
+
+/* Returns the least element of T, or a null pointer if T is
+   empty. */
+struct rbtree_elem *
+rbtree_first (struct rbtree *t) {
+	ASSERT (t != NULL);
+
+	return t->root != NULL ? leftmost (t->root) : NULL;
+}
+
+/* Returns the greatest element of T, or a null pointer if T is
+   empty. */
+struct rbtree_elem *
+rbtree_last (struct rbtree *t) {
+	ASSERT (t != NULL);
+
+	return t->root != NULL ? rightmost (t->root) : NULL;
+}
+
+/* Returns the element that follows E in order, or a null pointer
+   if E is the last one. */
+struct rbtree_elem *
+rbtree_next (struct rbtree_elem *e) {
+	ASSERT (e != NULL);
+
+	if (e->right != NULL)
+		return leftmost (e->right);
+	while (e->parent != NULL && e->parent->right == e)
+		e = e->parent;
+	return e->parent;
+}
+
+/* Returns the element that precedes E in order, or a null pointer
+   if E is the first one. */
+struct rbtree_elem *
+rbtree_prev (struct rbtree_elem *e) {
+	ASSERT (e != NULL);
+
+	if (e->left != NULL)
+		return rightmost (e->left);
+	while (e->parent != NULL && e->parent->left == e)
+		e = e->parent;
+	return e->parent;
+}
+
+/* Returns the number of elements in T. */
+size_t
+rbtree_size (struct rbtree *t) {
+	return t->elem_cnt;
+}
+
+/* Returns true if T is empty, false otherwise. */
+bool
+rbtree_empty (struct rbtree *t) {
+	return t->root == NULL;
+}
+
+/* Returns true if E is a red element, false if it is black or a
+   null leaf. */
+static inline bool
+is_red (const struct rbtree_elem *e) {
+	return e != NULL && e->red;
+}
+
+/* Rotates the subtree rooted at X to the left. */
+static void
+rotate_left (struct rbtree *t, struct rbtree_elem *x) {
+	struct rbtree_elem *y = x->right;
+
+	x->right = y->left;
+	if (y->left != NULL)
+		y->left->parent = x;
+	replace_child (t, x->parent, x, y);
+	y->left = x;
+	x->parent = y;
+}
+
+/* Rotates the subtree rooted at X to the right. */
+static void
+rotate_right (struct rbtree *t, struct rbtree_elem *x) {
+	struct rbtree_elem *y = x->left;
+
+	x->left = y->right;
+	if (y->right != NULL)
+		y->right->parent = x;
+	replace_child (t, x->parent, x, y);
+	y->right = x;
+	x->parent = y;
+}
+
+/* Restores the invariants after red element E was inserted, which
+   may have given a red parent a red child. */
+static void
+insert_fixup (struct rbtree *t, struct rbtree_elem *e) {
+	struct rbtree_elem *p;
+
+	/* A red parent is not the root, so E has a grandparent. */
+	while (is_red (p = e->parent)) {
+		struct rbtree_elem *g = p->parent;
+
+		if (p == g->left) {
+			struct rbtree_elem *u = g->right;
+
+			if (is_red (u)) {
+				/* Push the grandparent's black down to both of
+				   its children and go on from the grandparent. */
+				p->red = u->red = false;
+				g->red = true;
+				e = g;
+				continue;
+			}
+			if (e == p->right) {
+				rotate_left (t, p);
+				p = e;
+			}
+			p->red = false;
+			g->red = true;
+			rotate_right (t, g);
+		} else {
+			struct rbtree_elem *u = g->left;
+
+			if (is_red (u)) {
+				p->red = u->red = false;
+				g->red = true;
+				e = g;
+				continue;
+			}
+			if (e == p->left) {
+				rotate_right (t, p);
+				p = e;
+			}
+			p->red = false;
+			g->red = true;
+			rotate_left (t, g);
+		}
+		break;
+	}
+	t->root->red = false;
+}
+
+/* Restores the invariants after a black element was removed from
+   below PARENT, leaving paths through X, which may be null, one
+   black element short. */
+static void
+remove_fixup (struct rbtree *t, struct rbtree_elem *x,
+		struct rbtree_elem *parent) {
+	/* X's sibling W is never null: the paths through it have at
+	   least one more black element than those through X. */
+	while (x != t->root && !is_red (x)) {
+		if (x == parent->left) {
+			struct rbtree_elem *w = parent->right;
+
+			if (w->red) {
+				w->red = false;
+				parent->red = true;
+				rotate_left (t, parent);
+				w = parent->right;
+			}
+			if (!is_red (w->left) && !is_red (w->right)) {
+				/* Take a black from W's side too and move up. */
+				w->red = true;
+				x = parent;
+				parent = x->parent;
+				continue;
+			}
+			if (!is_red (w->right)) {
+				w->left->red = false;
+				w->red = true;
+				rotate_right (t, w);
+				w = parent->right;
+			}
+			w->red = parent->red;
+			parent->red = false;
+			w->right->red = false;
+			rotate_left (t, parent);
+		} else {
+			struct rbtree_elem *w = parent->left;
+
+			if (w->red) {
+				w->red = false;
+				parent->red = true;
+				rotate_right (t, parent);
+				w = parent->left;
+			}
+			if (!is_red (w->left) && !is_red (w->right)) {
+				w->red = true;
+				x = parent;
+				parent = x->parent;
+				continue;
+			}
+			if (!is_red (w->left)) {
+				w->right->red = false;
+				w->red = true;
+				rotate_left (t, w);
+				w = parent->left;
+			}
+			w->red = parent->red;
+			parent->red = false;
+			w->left->red = false;
+			rotate_right (t, parent);
+		}
+		x = t->root;
+		break;
+	}
+	if (x != NULL)
+		x->red = false;
+}
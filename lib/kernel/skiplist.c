@@ -0,0 +1,294 @@
+/* Indexable skip list.
+
+   See skiplist.h for basic information.
+
+   The head is a pseudo-element at position 0 and the elements are
+   at positions 1 through ELEM_CNT, in order.  A link's span is the
+   distance from its element to the next element in its lane, or
+   to position ELEM_CNT + 1 if there is none.  The head keeps all
+   SKIPLIST_MAX_LEVEL of its links so up to date, used or not, so
+   that a new lane starts out right. */
+
+#include "skiplist.h"
+#include "../debug.h"
+
+/* Returns the element after X in lane I, or a null pointer. */
+static inline struct skiplist_elem *
+next_in (const struct skiplist_elem *x, int i) {
+	return x->link[i].next;
+}
+
+/* Returns the element before E in lane I, or the head of SL. */
+static inline struct skiplist_elem *
+prev_in (struct skiplist *sl, const struct skiplist_elem *e, int i) {
+	return e->link[i].prev != NULL ? e->link[i].prev : &sl->head;
+}
+
+/* Initializes SL as an empty skip list ordered by LESS given
+   auxiliary data AUX. */
+void
+skiplist_init (struct skiplist *sl, skiplist_less_func *less, void *aux) {
+	int i;
+
+	ASSERT (sl != NULL);
+	ASSERT (less != NULL);
+
+	sl->head.level = SKIPLIST_MAX_LEVEL;
+	for (i = 0; i < SKIPLIST_MAX_LEVEL; i++) {
+		sl->head.link[i].prev = NULL;
+		sl->head.link[i].next = NULL;
+		sl->head.link[i].span = 1;
+	}
+	sl->tail = NULL;
+	sl->level = 1;
+	sl->elem_cnt = 0;
+	sl->seed = 0x9e3779b97f4a7c15ULL ^ (uintptr_t) sl;
+	sl->less = less;
+	sl->aux = aux;
+}
+
+/* Draws the number of lanes of a new element of SL: 1 with
+   probability 3/4, 2 with probability 3/16, and so on. */
+static int
+random_level (struct skiplist *sl) {
+	uint64_t r;
+	int level = 1;
+
+	/* xorshift64*. */
+	sl->seed ^= sl->seed >> 12;
+	sl->seed ^= sl->seed << 25;
+	sl->seed ^= sl->seed >> 27;
+	r = sl->seed * 0x2545f4914f6cdd1dULL;
+
+	while (level < SKIPLIST_MAX_LEVEL && (r >> 62) == 0) {
+		level++;
+		r <<= 2;
+	}
+	return level;
+}
+
+/* Inserts E into SL, after any elements equal to it. */
+void
+skiplist_insert (struct skiplist *sl, struct skiplist_elem *e) {
+	struct skiplist_elem *update[SKIPLIST_MAX_LEVEL];
+	size_t rank[SKIPLIST_MAX_LEVEL];
+	struct skiplist_elem *x = &sl->head;
+	size_t pos = 0;
+	int i, level;
+
+	ASSERT (sl != NULL);
+	ASSERT (e != NULL);
+
+	/* Find the last element in each lane not greater than E, and
+	   its position. */
+	for (i = SKIPLIST_MAX_LEVEL - 1; i >= 0; i--) {
+		if (i < sl->level)
+			while (next_in (x, i) != NULL
+					&& !sl->less (e, next_in (x, i), sl->aux)) {
+				pos += x->link[i].span;
+				x = next_in (x, i);
+			}
+		update[i] = x;
+		rank[i] = pos;
+	}
+
+	level = random_level (sl);
+	if (level > sl->level)
+		sl->level = level;
+	e->level = level;
+	for (i = 0; i < SKIPLIST_MAX_LEVEL; i++) {
+		struct skiplist_link *up = &update[i]->link[i];
+
+		if (i < level) {
+			e->link[i].prev = update[i] != &sl->head ? update[i] : NULL;
+			e->link[i].next = up->next;
+			if (up->next != NULL)
+				up->next->link[i].prev = e;
+			up->next = e;
+			e->link[i].span = up->span - (rank[0] - rank[i]);
+			up->span = rank[0] - rank[i] + 1;
+		} else
+			up->span++;
+	}
+	if (e->link[0].next == NULL)
+		sl->tail = e;
+	sl->elem_cnt++;
+}
+
+/* Removes E, which must be an element of SL, from SL. */
+void
+skiplist_remove (struct skiplist *sl, struct skiplist_elem *e) {
+	struct skiplist_elem *x = e;
+	int i;
+
+	ASSERT (sl != NULL);
+	ASSERT (e != NULL);
+	ASSERT (sl->elem_cnt > 0);
+
+	for (i = 0; i < e->level; i++) {
+		struct skiplist_elem *prev = prev_in (sl, e, i);
+		struct skiplist_elem *next = e->link[i].next;
+
+		prev->link[i].next = next;
+		prev->link[i].span += e->link[i].span - 1;
+		if (next != NULL)
+			next->link[i].prev = e->link[i].prev;
+	}
+
+	/* The higher lanes pass over E: climb back to the element
+	   whose link in each of them does. */
+	for (; i < SKIPLIST_MAX_LEVEL; i++) {
+		while (x->level <= i)
+			x = prev_in (sl, x, x->level - 1);
+		x->link[i].span--;
+	}
+
+	if (sl->tail == e)
+		sl->tail = e->link[0].prev;
+	while (sl->level > 1 && sl->head.link[sl->level - 1].next == NULL)
+		sl->level--;
+	sl->elem_cnt--;
+}
+
+/* Removes the first element of SL and returns it, or returns a
+   null pointer if SL is empty. */
+struct skiplist_elem *
+skiplist_pop_front (struct skiplist *sl) {
+	struct skiplist_elem *e = skiplist_front (sl);
+
+	if (e != NULL)
+		skiplist_remove (sl, e);
+	return e;
+}
+
+/* Returns the first element of SL that is not less than PROBE, or
+   a null pointer if there is none. */
+struct skiplist_elem *
+skiplist_lower_bound (struct skiplist *sl,
+		const struct skiplist_elem *probe) {
+	struct skiplist_elem *x = &sl->head;
+	int i;
+
+	ASSERT (sl != NULL);
+
+	for (i = sl->level - 1; i >= 0; i--)
+		while (next_in (x, i) != NULL
+				&& sl->less (next_in (x, i), probe, sl->aux))
+			x = next_in (x, i);
+	return next_in (x, 0);
+}
+
+/* Returns the first element of SL that is greater than PROBE, or
+   a null pointer if there is none. */
+struct skiplist_elem *
+skiplist_upper_bound (struct skiplist *sl,
+		const struct skiplist_elem *probe) {
+	struct skiplist_elem *x = &sl->head;
+	int i;
+
+	ASSERT (sl != NULL);
+
+	for (i = sl->level - 1; i >= 0; i--)
+		while (next_in (x, i) != NULL
+				&& !sl->less (probe, next_in (x, i), sl->aux))
+			x = next_in (x, i);
+	return next_in (x, 0);
+}
+
+/* Returns the first element of SL equal to PROBE, or a null
+   pointer if there is none. */
+struct skiplist_elem *
+skiplist_find (struct skiplist *sl, const struct skiplist_elem *probe) {
+	struct skiplist_elem *e = skiplist_lower_bound (sl, probe);
+
+	return e != NULL && !sl->less (probe, e, sl->aux) ? e : NULL;
+}
+
+/* Returns the element of SL at index IDX, counting from 0, or a
+   null pointer if SL has no more than IDX elements. */
+struct skiplist_elem *
+skiplist_get (struct skiplist *sl, size_t idx) {
+	struct skiplist_elem *x = &sl->head;
+	size_t pos = 0;
+	int i;
+
+	ASSERT (sl != NULL);
+
+	if (idx >= sl->elem_cnt)
+		return NULL;
+	for (i = sl->level - 1; i >= 0; i--)
+		while (next_in (x, i) != NULL && pos + x->link[i].span <= idx + 1) {
+			pos += x->link[i].span;
+			x = next_in (x, i);
+		}
+	ASSERT (pos == idx + 1);
+	return x;
+}
+
+/* Returns the index of E, which must be an element of SL, counting
+   from 0. */
+size_t
+skiplist_index (struct skiplist *sl, struct skiplist_elem *e) {
+	struct skiplist_elem *x = e;
+	size_t pos = 0;
+
+	ASSERT (sl != NULL);
+	ASSERT (e != NULL);
+
+	/* Climb back to the head, each step in X's highest lane. */
+	while (x != &sl->head) {
+		struct skiplist_elem *prev = prev_in (sl, x, x->level - 1);
+
+		pos += prev->link[x->level - 1].span;
+		x = prev;
+	}
+	return pos - 1;
+}
+
+/* Returns the least element of SL, or a null pointer if SL is
+   empty. */
+struct skiplist_elem *
+skiplist_front (struct skiplist *sl) {
+	ASSERT (sl != NULL);
+
+	return sl->head.link[0].next;
+}
+
+/* Returns the greatest element of SL, or a null pointer if SL is
+   empty. */
+struct skiplist_elem *
+skiplist_back (struct skiplist *sl) {
+	ASSERT (sl != NULL);
+
+	return sl->tail;
+}
+
+/* Returns the element that follows E in order, or a null pointer
+   if E is the last one. */
+struct skiplist_elem *
+skiplist_next (struct skiplist_elem *e) {
+	ASSERT (e != NULL);
+
+	return e->link[0].next;
+}
+
+/* Returns the element that precedes E in order, or a null pointer
+   if E is the first one. */
+struct skiplist_elem *
+skiplist_prev (struct skiplist_elem *e) {
+	ASSERT (e != NULL);
+
+	return e->link[0].prev;
+}
+
+/* Returns the number of elements in SL. */
+size_t
+skiplist_size (struct skiplist *sl) {
+	return sl->elem_cnt;
+}
+
+/* Returns true if SL is empty, false otherwise. */
+bool
+skiplist_empty (struct skiplist *sl) {
+	return sl->elem_cnt == 0;
+}
@@ -11,7 +11,13 @@
    purposes.
 
    See http://en.wikipedia.org/wiki/RC4_(cipher) for information
-   on RC4.*/
+   on RC4.
+
+   The tests' checkers reproduce RC4's output, so random_bytes()
+   and random_ulong() keep it.  Code that only needs numbers fast
+   should use random_u64() or a struct random_state of its own
+   instead: xoshiro256** makes 8 bytes with a few shifts and adds
+   where RC4 makes 1 with a swap. */
 
 /* RC4 state. */
 static uint8_t s[256];          /* S[]. */
@@ -20,6 +26,10 @@ static uint8_t s_i, s_j;        /* i, j. */
 /* Already initialized? */
 static bool inited;     
 
+/* State of random_u64(), and whether it is initialized. */
+static struct random_state state;
+static bool state_inited;
+
 /* Swaps the bytes pointed to by A and B. */
 static inline void
 swap_byte (uint8_t *a, uint8_t *b) {
@@ -44,6 +54,9 @@ random_init (unsigned seed) {
 
 	s_i = s_j = 0;
 	inited = true;
+
+	random_state_init (&state, seed);
+	state_inited = true;
 }
 
 /* Writes SIZE random bytes into BUF. */
@@ -75,3 +88,54 @@ random_ulong (void) {
 	random_bytes (&ul, sizeof ul);
 	return ul;
 }
+
+/* Fast generator: xoshiro256** by Blackman and Vigna, seeded by
+   splitmix64, which turns any seed, even 0, into a state that is
+   not all zeros. */
+
+/* Returns X rotated left by K bits. */
+static inline uint64_t
+rotl (uint64_t x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+/* Initializes ST from SEED. */
+void
+random_state_init (struct random_state *st, uint64_t seed) {
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		st->s[i] = z ^ (z >> 31);
+	}
+}
+
+/* Returns the next pseudo-random number from ST. */
+uint64_t
+random_state_u64 (struct random_state *st) {
+	uint64_t *x = st->s;
+	uint64_t result = rotl (x[1] * 5, 7) * 9;
+	uint64_t t = x[1] << 17;
+
+	x[2] ^= x[0];
+	x[3] ^= x[1];
+	x[1] ^= x[2];
+	x[0] ^= x[3];
+	x[2] ^= t;
+	x[3] = rotl (x[3], 45);
+	return result;
+}
+
+/* Returns a pseudo-random 64-bit number from a state shared by the
+   whole program, seeded from random_init()'s seed. */
+uint64_t
+random_u64 (void) {
+	if (!state_inited) {
+		random_state_init (&state, 0);
+		state_inited = true;
+	}
+	return random_state_u64 (&state);
+}
@@ -1,5 +1,49 @@
 #include <string.h>
 #include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The block functions below move eight bytes at a time with the
+   string instructions, then the one to seven bytes left over.
+   For the forward copies the DF flag is clear, as the ABI
+   requires on entry: the interrupt stubs and the syscall flag mask
+   see to that in the kernel. */
+
+/* The string functions below scan eight bytes at a time.  They read
+   strings in aligned words, which is safe past the terminating null
+   because an aligned word never straddles a page: if its first byte
+   can be read, so can its last. */
+
+/* A word of memory, which may alias anything and, as WORD_U, need
+   not be aligned. */
+typedef uint64_t __attribute__ ((may_alias)) word_t;
+typedef uint64_t __attribute__ ((may_alias, aligned (1))) word_u;
+
+#define WORD_ONES  0x0101010101010101ULL
+#define WORD_HIGHS 0x8080808080808080ULL
+
+/* Returns true if any byte of W is zero. */
+static inline bool
+has_zero (uint64_t w) {
+	return ((w - WORD_ONES) & ~w & WORD_HIGHS) != 0;
+}
+
+/* Returns true if P is aligned to a word. */
+static inline bool
+word_aligned (const void *p) {
+	return (uintptr_t) p % sizeof (word_t) == 0;
+}
+
+/* Copies SIZE bytes forward from SRC to DST. */
+static inline void
+copy_forward (unsigned char *dst, const unsigned char *src, size_t size) {
+	size_t words = size / 8, bytes = size % 8;
+
+	asm volatile ("rep movsq"
+			: "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+	asm volatile ("rep movsb"
+			: "+D" (dst), "+S" (src), "+c" (bytes) : : "memory");
+}
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -11,8 +55,7 @@ memcpy (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	while (size-- > 0)
-		*dst++ = *src++;
+	copy_forward (dst, src, size);
 
 	return dst_;
 }
@@ -27,17 +70,29 @@ memmove (void *dst_, const void *src_, size_t size) {
 	ASSERT (dst != NULL || size == 0);
 	ASSERT (src != NULL || size == 0);
 
-	if (dst < src) {
-		while (size-- > 0)
-			*dst++ = *src++;
-	} else {
-		dst += size;
-		src += size;
-		while (size-- > 0)
-			*--dst = *--src;
+	if (dst <= src || dst >= src + size)
+		copy_forward (dst, src, size);
+	else {
+		/* DST overlaps the end of SRC: copy downward, the odd
+		   bytes at the end first, then the words below them.  One
+		   asm statement, so that no compiled code runs with the
+		   direction flag set. */
+		size_t words = size / 8, bytes = size % 8;
+
+		dst += size - 1;
+		src += size - 1;
+		asm volatile ("std\n"
+				"rep movsb\n"
+				"subq $7, %%rdi\n"
+				"subq $7, %%rsi\n"
+				"movq %3, %%rcx\n"
+				"rep movsq\n"
+				"cld"
+				: "+D" (dst), "+S" (src), "+c" (bytes)
+				: "r" (words) : "memory");
 	}
 
-	return dst;
+	return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -52,6 +107,13 @@ memcmp (const void *a_, const void *b_, size_t size) {
 	ASSERT (a != NULL || size == 0);
 	ASSERT (b != NULL || size == 0);
 
+	/* Skip the equal words; the bytes of the first unequal one are
+	   compared in order below.  Nothing past SIZE is read. */
+	for (; size >= sizeof (word_u); a += sizeof (word_u),
+			b += sizeof (word_u), size -= sizeof (word_u))
+		if (*(const word_u *) a != *(const word_u *) b)
+			break;
+
 	for (; size-- > 0; a++, b++)
 		if (*a != *b)
 			return *a > *b ? +1 : -1;
@@ -71,6 +133,20 @@ strcmp (const char *a_, const char *b_) {
 	ASSERT (a != NULL);
 	ASSERT (b != NULL);
 
+	while (!word_aligned (a) && *a != '\0' && *a == *b) {
+		a++;
+		b++;
+	}
+
+	/* If B is now aligned too, skip equal words with no null in
+	   them. */
+	if (word_aligned (a) && word_aligned (b))
+		while (*(const word_t *) a == *(const word_t *) b
+				&& !has_zero (*(const word_t *) a)) {
+			a += sizeof (word_t);
+			b += sizeof (word_t);
+		}
+
 	while (*a != '\0' && *a == *b) {
 		a++;
 		b++;
@@ -103,9 +179,18 @@ memchr (const void *block_, int ch_, size_t size) {
 char *
 strchr (const char *string, int c_) {
 	char c = c_;
+	uint64_t pattern = (unsigned char) c * WORD_ONES;
 
 	ASSERT (string);
 
+	/* Skip aligned words that hold neither C nor a null. */
+	while (!word_aligned (string) && *string != c && *string != '\0')
+		string++;
+	if (word_aligned (string))
+		while (!has_zero (*(const word_t *) string)
+				&& !has_zero (*(const word_t *) string ^ pattern))
+			string += sizeof (word_t);
+
 	for (;;)
 		if (*string == c)
 			return (char *) string;
@@ -258,10 +343,15 @@ void *
 memset (void *dst_, int value, size_t size) {
 	unsigned char *dst = dst_;
 
+	uint64_t word = (unsigned char) value * 0x0101010101010101ULL;
+	size_t words = size / 8, bytes = size % 8;
+
 	ASSERT (dst != NULL || size == 0);
 
-	while (size-- > 0)
-		*dst++ = value;
+	asm volatile ("rep stosq"
+			: "+D" (dst), "+c" (words) : "a" (word) : "memory");
+	asm volatile ("rep stosb"
+			: "+D" (dst), "+c" (bytes) : "a" (word) : "memory");
 
 	return dst_;
 }
@@ -269,11 +359,18 @@ memset (void *dst_, int value, size_t size) {
 /* Returns the length of STRING. */
 size_t
 strlen (const char *string) {
-	const char *p;
+	const char *p = string;
 
 	ASSERT (string);
 
-	for (p = string; *p != '\0'; p++)
+	/* Skip aligned words with no null in them. */
+	while (!word_aligned (p) && *p != '\0')
+		p++;
+	if (word_aligned (p))
+		while (!has_zero (*(const word_t *) p))
+			p += sizeof (word_t);
+
+	for (; *p != '\0'; p++)
 		continue;
 	return p - string;
 }
@@ -1,4 +1,5 @@
 lib_SRC  = lib/debug.c			# Debug helpers.
+lib_SRC += lib/crc32c.c			# CRC-32C checksums.
 lib_SRC += lib/random.c			# Pseudo-random numbers.
 lib_SRC += lib/stdio.c			# I/O library.
 lib_SRC += lib/stdlib.c			# Utility functions.
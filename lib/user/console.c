@@ -3,6 +3,19 @@
 #include <syscall.h>
 #include <syscall-nr.h>
 
+/* The standard output buffer.  Output to STDOUT_FILENO collects
+   here and is written out according to STDOUT_MODE, and in any
+   case by fflush(), which the system call wrappers for exit(),
+   fork(), exec(), wait() and the like call first, so that no
+   output is lost or duplicated and output of different processes
+   stays in order. */
+static char stdout_buf[1024];
+static size_t stdout_len;
+static int stdout_mode = _IOLBF;
+
+static void stdout_putc (char);
+static void stdout_done (bool newline);
+
 /* The standard vprintf() function,
    which is like printf() but uses a va_list. */
 int
@@ -27,8 +40,10 @@ hprintf (int handle, const char *format, ...) {
    character. */
 int
 puts (const char *s) {
-	write (STDOUT_FILENO, s, strlen (s));
-	putchar ('\n');
+	while (*s != '\0')
+		stdout_putc (*s++);
+	stdout_putc ('\n');
+	stdout_done (true);
 
 	return 0;
 }
@@ -36,11 +51,65 @@ puts (const char *s) {
 /* Writes C to the console. */
 int
 putchar (int c) {
-	char c2 = c;
-	write (STDOUT_FILENO, &c2, 1);
+	stdout_putc (c);
+	stdout_done (c == '\n');
 	return c;
 }
 
+/* Sets the buffering of HANDLE to MODE, one of _IOFBF, _IOLBF and
+   _IONBF.  Only the standard output is buffered.  Returns 0 if
+   successful, -1 otherwise. */
+int
+setvbuf (int handle, int mode) {
+	if (handle != STDOUT_FILENO
+			|| (mode != _IOFBF && mode != _IOLBF && mode != _IONBF))
+		return -1;
+	fflush (handle);
+	stdout_mode = mode;
+	return 0;
+}
+
+/* Writes out the buffered output of HANDLE.  Returns 0 if
+   successful, -1 if the write failed, in which case the output is
+   dropped. */
+int
+fflush (int handle) {
+	const char *p = stdout_buf;
+	size_t len = stdout_len;
+
+	if (handle != STDOUT_FILENO)
+		return 0;
+
+	/* Empty the buffer first, since write() flushes it too. */
+	stdout_len = 0;
+	while (len > 0) {
+		int n = write (STDOUT_FILENO, p, len);
+
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Adds C to the standard output buffer, writing the buffer out
+   first if it is full. */
+static void
+stdout_putc (char c) {
+	if (stdout_len == sizeof stdout_buf)
+		fflush (STDOUT_FILENO);
+	stdout_buf[stdout_len++] = c;
+}
+
+/* Ends a call that wrote to the standard output, which included a
+   new-line character if NEWLINE. */
+static void
+stdout_done (bool newline) {
+	if (stdout_mode == _IONBF || (stdout_mode == _IOLBF && newline))
+		fflush (STDOUT_FILENO);
+}
+
 /* Auxiliary data for vhprintf_helper(). */
 struct vhprintf_aux {
 	char buf[64];       /* Character buffer. */
@@ -49,7 +118,14 @@ struct vhprintf_aux {
 	int handle;         /* Output file handle. */
 };
 
+/* Auxiliary data for add_stdout_char(). */
+struct stdout_aux {
+	int char_cnt;       /* Total characters written so far. */
+	bool newline;       /* Wrote a new-line character? */
+};
+
 static void add_char (char, void *);
+static void add_stdout_char (char, void *);
 static void flush (struct vhprintf_aux *);
 
 /* Formats the printf() format specification FORMAT with
@@ -58,6 +134,15 @@ static void flush (struct vhprintf_aux *);
 int
 vhprintf (int handle, const char *format, va_list args) {
 	struct vhprintf_aux aux;
+
+	if (handle == STDOUT_FILENO) {
+		struct stdout_aux saux = { 0, false };
+
+		__vprintf (format, args, add_stdout_char, &saux);
+		stdout_done (saux.newline);
+		return saux.char_cnt;
+	}
+
 	aux.p = aux.buf;
 	aux.char_cnt = 0;
 	aux.handle = handle;
@@ -77,6 +162,17 @@ add_char (char c, void *aux_) {
 	aux->char_cnt++;
 }
 
+/* Adds C to the standard output buffer. */
+static void
+add_stdout_char (char c, void *aux_) {
+	struct stdout_aux *aux = aux_;
+
+	stdout_putc (c);
+	if (c == '\n')
+		aux->newline = true;
+	aux->char_cnt++;
+}
+
 /* Flushes the buffer in AUX. */
 static void
 flush (struct vhprintf_aux *aux) {
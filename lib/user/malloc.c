@@ -0,0 +1,340 @@
+#include <malloc.h>
+#include <debug.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+
+/* A user-space memory allocator on top of anonymous mmap().
+
+   Blocks of up to SMALL_MAX bytes are rounded up to one of a few
+   size classes and carved out of slabs: SLAB_SIZE-aligned pieces
+   of memory that each hold blocks of only one class, with a
+   header at the start.  Slabs come from chunks of CHUNK_SIZE bytes
+   that are mapped one after another from ARENA_BASE up, so that
+   free() finds a block's slab by rounding its address down, and
+   tells a small block from a large one by its address alone.
+   Allocating and freeing a small block takes constant time and no
+   system call, except to map a new chunk once in a while.  Chunks
+   are never unmapped; a slab left empty is kept for reuse by any
+   class.
+
+   Larger blocks each get a mapping of their own, above the slab
+   arena, with a header giving its size.  A few freed mappings are
+   kept for reuse, so that a program that keeps allocating and
+   freeing a big buffer does not map and unmap it every time.
+
+   The arena is not locked: a process that starts threads with
+   clone() must not have more than one of them in here at once. */
+
+#define PGSIZE 4096
+#define ALIGN 16                        /* Alignment of every block. */
+
+#define ARENA_BASE 0x4000000000ULL      /* Start of the slab arena. */
+#define ARENA_END  0x5000000000ULL      /* End of the slab arena. */
+#define LARGE_END  0x7000000000ULL      /* End of the large mappings. */
+
+#define CHUNK_SIZE (1024 * 1024)        /* Slab arena mapped at a time. */
+#define SLAB_SIZE (16 * 1024)           /* Size of a slab. */
+
+/* Size classes.  Blocks larger than SMALL_MAX are large. */
+static const uint16_t class_sizes[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048,
+};
+#define CLASS_CNT (sizeof class_sizes / sizeof *class_sizes)
+#define SMALL_MAX 2048
+
+/* Header of a slab. */
+struct slab {
+	struct slab *prev, *next;           /* In a partial or the empty list. */
+	struct free_block *free;            /* Freed blocks. */
+	unsigned cls;                       /* Size class. */
+	unsigned used;                      /* Blocks allocated. */
+	unsigned carved;                    /* Blocks ever handed out. */
+	unsigned cap;                       /* Blocks that fit. */
+	bool partial;                       /* In its class's partial list? */
+};
+
+/* Offset of the first block in a slab. */
+#define SLAB_HDR ((sizeof (struct slab) + ALIGN - 1) & ~(ALIGN - 1))
+
+/* A freed small block. */
+struct free_block {
+	struct free_block *next;
+};
+
+/* Header of a large block, at the start of its mapping. */
+struct large {
+	size_t pages;                       /* Size of the mapping. */
+};
+#define LARGE_HDR ((sizeof (struct large) + ALIGN - 1) & ~(ALIGN - 1))
+
+/* Freed large mappings kept for reuse. */
+#define LARGE_CACHE 4
+
+/* The allocator's state. */
+static struct arena {
+	bool initialized;
+	uint8_t class_of[SMALL_MAX / ALIGN + 1];  /* Size class by size / ALIGN. */
+	struct slab *partial[CLASS_CNT];    /* Slabs with free blocks. */
+	struct slab *empty;                 /* Slabs with no blocks in use. */
+	uintptr_t slab_next, slab_end;      /* Unused part of the last chunk. */
+	uintptr_t large_next;               /* Address of the next mapping. */
+	struct large *large_cache[LARGE_CACHE];
+} arena;
+
+static void
+arena_init (void) {
+	size_t sz;
+	unsigned cls = 0;
+
+	for (sz = 0; sz <= SMALL_MAX / ALIGN; sz++) {
+		while (class_sizes[cls] < sz * ALIGN)
+			cls++;
+		arena.class_of[sz] = cls;
+	}
+	arena.slab_next = arena.slab_end = ARENA_BASE;
+	arena.large_next = ARENA_END;
+	arena.initialized = true;
+}
+
+/* Returns true if P points into the slab arena. */
+static inline bool
+is_small (const void *p) {
+	return (uintptr_t) p >= ARENA_BASE && (uintptr_t) p < ARENA_END;
+}
+
+/* Returns the slab that small block P is in. */
+static inline struct slab *
+slab_of (void *p) {
+	return (struct slab *) ((uintptr_t) p & ~(uintptr_t) (SLAB_SIZE - 1));
+}
+
+/* Adds S to the partial list of its class. */
+static void
+partial_push (struct slab *s) {
+	struct slab **head = &arena.partial[s->cls];
+
+	s->prev = NULL;
+	s->next = *head;
+	if (*head != NULL)
+		(*head)->prev = s;
+	*head = s;
+	s->partial = true;
+}
+
+/* Removes S from the partial list of its class. */
+static void
+partial_remove (struct slab *s) {
+	if (s->prev != NULL)
+		s->prev->next = s->next;
+	else
+		arena.partial[s->cls] = s->next;
+	if (s->next != NULL)
+		s->next->prev = s->prev;
+	s->partial = false;
+}
+
+/* Returns a slab for blocks of class CLS, added to its partial
+   list, or a null pointer if memory is exhausted. */
+static struct slab *
+slab_new (unsigned cls) {
+	struct slab *s = arena.empty;
+
+	if (s != NULL)
+		arena.empty = s->next;
+	else {
+		if (arena.slab_next == arena.slab_end) {
+			if (arena.slab_end + CHUNK_SIZE > ARENA_END
+					|| mmap ((void *) arena.slab_end, CHUNK_SIZE, true,
+						MMAP_ANON, 0) == MAP_FAILED)
+				return NULL;
+			arena.slab_end += CHUNK_SIZE;
+		}
+		s = (struct slab *) arena.slab_next;
+		arena.slab_next += SLAB_SIZE;
+	}
+
+	s->free = NULL;
+	s->cls = cls;
+	s->used = s->carved = 0;
+	s->cap = (SLAB_SIZE - SLAB_HDR) / class_sizes[cls];
+	partial_push (s);
+	return s;
+}
+
+/* Allocates a block of SIZE bytes, at most SMALL_MAX, from a slab. */
+static void *
+small_alloc (size_t size) {
+	unsigned cls = arena.class_of[(size + ALIGN - 1) / ALIGN];
+	struct slab *s = arena.partial[cls];
+	void *p;
+
+	if (s == NULL && (s = slab_new (cls)) == NULL)
+		return NULL;
+
+	if (s->free != NULL) {
+		p = s->free;
+		s->free = s->free->next;
+	} else
+		p = (uint8_t *) s + SLAB_HDR + s->carved++ * class_sizes[cls];
+	if (++s->used == s->cap)
+		partial_remove (s);
+	return p;
+}
+
+/* Frees small block P. */
+static void
+small_free (void *p) {
+	struct slab *s = slab_of (p);
+	struct free_block *b = p;
+
+	b->next = s->free;
+	s->free = b;
+	if (!s->partial)
+		partial_push (s);
+
+	/* Give up an empty slab unless it is the only one its class has
+	   to allocate from, so that allocating and freeing one block
+	   over and over does not move a slab back and forth. */
+	if (--s->used == 0 && (s->prev != NULL || s->next != NULL)) {
+		partial_remove (s);
+		s->next = arena.empty;
+		arena.empty = s;
+	}
+}
+
+/* Allocates a block of SIZE bytes, more than SMALL_MAX, in a
+   mapping of its own. */
+static void *
+large_alloc (size_t size) {
+	size_t pages, i;
+	struct large *l;
+
+	if (size > LARGE_END - ARENA_END)
+		return NULL;
+	pages = (size + LARGE_HDR + PGSIZE - 1) / PGSIZE;
+
+	/* Reuse a cached mapping that is big enough but not more than
+	   twice as big as needed. */
+	for (i = 0; i < LARGE_CACHE; i++) {
+		l = arena.large_cache[i];
+		if (l != NULL && l->pages >= pages && l->pages <= 2 * pages) {
+			arena.large_cache[i] = NULL;
+			return (uint8_t *) l + LARGE_HDR;
+		}
+	}
+
+	if (arena.large_next + pages * PGSIZE > LARGE_END)
+		return NULL;
+	l = (struct large *) arena.large_next;
+	if (mmap (l, pages * PGSIZE, true, MMAP_ANON, 0) == MAP_FAILED)
+		return NULL;
+	arena.large_next += pages * PGSIZE;
+	l->pages = pages;
+	return (uint8_t *) l + LARGE_HDR;
+}
+
+/* Frees large block P. */
+static void
+large_free (void *p) {
+	struct large *l = (struct large *) ((uint8_t *) p - LARGE_HDR);
+	size_t i;
+
+	for (i = 0; i < LARGE_CACHE; i++)
+		if (arena.large_cache[i] == NULL) {
+			arena.large_cache[i] = l;
+			return;
+		}
+	munmap (l);
+}
+
+/* Returns the number of usable bytes in block P. */
+static size_t
+block_size (void *p) {
+	if (is_small (p)) {
+		return class_sizes[slab_of (p)->cls];
+	} else {
+		struct large *l = (struct large *) ((uint8_t *) p - LARGE_HDR);
+		return l->pages * PGSIZE - LARGE_HDR;
+	}
+}
+
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if memory is not available. */
+void *
+malloc (size_t size) {
+	if (!arena.initialized)
+		arena_init ();
+	if (size == 0)
+		size = 1;
+	return size <= SMALL_MAX ? small_alloc (size) : large_alloc (size);
+}
+
+/* Allocates and return A times B bytes initialized to zeroes.
+   Returns a null pointer if memory is not available. */
+void *
+calloc (size_t a, size_t b) {
+	void *p;
+	size_t size;
+
+	/* Calculate block size and make sure it fits in size_t. */
+	size = a * b;
+	if (b != 0 && size / b != a)
+		return NULL;
+
+	p = malloc (size);
+	if (p != NULL)
+		memset (p, 0, size);
+	return p;
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly moving
+   it in the process.  If successful, returns the new block; on
+   failure, returns a null pointer.  A call with null OLD_BLOCK is
+   equivalent to malloc(NEW_SIZE).  A call with zero NEW_SIZE is
+   equivalent to free(OLD_BLOCK). */
+void *
+realloc (void *old_block, size_t new_size) {
+	size_t old_size;
+	void *new_block;
+
+	if (new_size == 0) {
+		free (old_block);
+		return NULL;
+	}
+	if (old_block == NULL)
+		return malloc (new_size);
+
+	/* Keep the block if it is big enough and not much too big: a
+	   small one if it would not get a smaller class, a large one if
+	   it would not shrink by half. */
+	old_size = block_size (old_block);
+	if (new_size <= old_size
+			&& (is_small (old_block)
+				? class_sizes[arena.class_of[(new_size + ALIGN - 1) / ALIGN]]
+					== old_size
+				: new_size > old_size / 2))
+		return old_block;
+
+	new_block = malloc (new_size);
+	if (new_block != NULL) {
+		memcpy (new_block, old_block,
+				new_size < old_size ? new_size : old_size);
+		free (old_block);
+	}
+	return new_block;
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc(), calloc(), or realloc(). */
+void
+free (void *p) {
+	if (p == NULL)
+		return;
+	if (is_small (p))
+		small_free (p);
+	else
+		large_free (p);
+}
@@ -1,5 +1,6 @@
 #include <syscall.h>
 #include <stdint.h>
+#include <stdio.h>
 #include "../syscall-nr.h"
 
 __attribute__((always_inline))
@@ -54,7 +55,7 @@ static __inline int64_t syscall (uint64_t num_, uint64_t a1_, uint64_t a2_,
 			((uint64_t) ARG2), 0, 0, 0))
 
 #define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3) ( \
-		syscall(((uint64_t *) NUMBER), \
+		syscall(((uint64_t) NUMBER), \
 			((uint64_t) ARG0), \
 			((uint64_t) ARG1), \
 			((uint64_t) ARG2), \
@@ -68,30 +69,44 @@ static __inline int64_t syscall (uint64_t num_, uint64_t a1_, uint64_t a2_,
 			((uint64_t) ARG3), \
 			((uint64_t) ARG4), \
 			0))
+
+#define syscall6(NUMBER, ARG0, ARG1, ARG2, ARG3, ARG4, ARG5) ( \
+		syscall(((uint64_t) NUMBER), \
+			((uint64_t) ARG0), \
+			((uint64_t) ARG1), \
+			((uint64_t) ARG2), \
+			((uint64_t) ARG3), \
+			((uint64_t) ARG4), \
+			((uint64_t) ARG5)))
 void
 halt (void) {
+	fflush (STDOUT_FILENO);
 	syscall0 (SYS_HALT);
 	NOT_REACHED ();
 }
 
 void
 exit (int status) {
+	fflush (STDOUT_FILENO);
 	syscall1 (SYS_EXIT, status);
 	NOT_REACHED ();
 }
 
 pid_t
 fork (const char *thread_name){
+	fflush (STDOUT_FILENO);
 	return (pid_t) syscall1 (SYS_FORK, thread_name);
 }
 
 int
 exec (const char *file) {
+	fflush (STDOUT_FILENO);
 	return (pid_t) syscall1 (SYS_EXEC, file);
 }
 
 int
 wait (pid_t pid) {
+	fflush (STDOUT_FILENO);
 	return syscall1 (SYS_WAIT, pid);
 }
 
@@ -107,7 +122,12 @@ remove (const char *file) {
 
 int
 open (const char *file) {
-	return syscall1 (SYS_OPEN, file);
+	return syscall2 (SYS_OPEN, file, 0);
+}
+
+int
+open_flags (const char *file, int flags) {
+	return syscall2 (SYS_OPEN, file, flags);
 }
 
 int
@@ -117,11 +137,15 @@ filesize (int fd) {
 
 int
 read (int fd, void *buffer, unsigned size) {
+	if (fd == STDIN_FILENO)
+		fflush (STDOUT_FILENO);
 	return syscall3 (SYS_READ, fd, buffer, size);
 }
 
 int
 write (int fd, const void *buffer, unsigned size) {
+	if (fd == STDOUT_FILENO)
+		fflush (STDOUT_FILENO);
 	return syscall3 (SYS_WRITE, fd, buffer, size);
 }
 
@@ -137,17 +161,121 @@ tell (int fd) {
 
 void
 close (int fd) {
+	if (fd == STDOUT_FILENO)
+		fflush (STDOUT_FILENO);
 	syscall1 (SYS_CLOSE, fd);
 }
 
 int
 dup2 (int oldfd, int newfd) {
+	if (newfd == STDOUT_FILENO)
+		fflush (STDOUT_FILENO);
 	return syscall2 (SYS_DUP2, oldfd, newfd);
 }
 
+pid_t
+spawn (const char *cmd_line) {
+	fflush (STDOUT_FILENO);
+	return (pid_t) syscall1 (SYS_SPAWN, cmd_line);
+}
+
+int
+readv (int fd, const struct iovec *iov, int iovcnt) {
+	return syscall3 (SYS_READV, fd, iov, iovcnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int iovcnt) {
+	if (fd == STDOUT_FILENO)
+		fflush (STDOUT_FILENO);
+	return syscall3 (SYS_WRITEV, fd, iov, iovcnt);
+}
+
+int
+pread (int fd, void *buffer, unsigned size, off_t offset) {
+	return syscall4 (SYS_PREAD, fd, buffer, size, offset);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, off_t offset) {
+	return syscall4 (SYS_PWRITE, fd, buffer, size, offset);
+}
+
+int
+copy_file_range (int in_fd, int out_fd, unsigned size) {
+	return syscall3 (SYS_COPY_FILE_RANGE, in_fd, out_fd, size);
+}
+
+int
+pipe (int fds[2]) {
+	return syscall1 (SYS_PIPE, fds);
+}
+
+int
+getdents (int fd, struct dirent *ents, unsigned cnt) {
+	return syscall3 (SYS_GETDENTS, fd, ents, cnt);
+}
+
+int
+getrusage (int who, struct rusage *usage) {
+	return syscall2 (SYS_GETRUSAGE, who, usage);
+}
+
+int
+stat (const char *file, struct stat *st) {
+	return syscall2 (SYS_STAT, file, st);
+}
+
+int
+fstat (int fd, struct stat *st) {
+	return syscall2 (SYS_FSTAT, fd, st);
+}
+
+int
+fsync (int fd) {
+	return syscall1 (SYS_FSYNC, fd);
+}
+
+void
+sync (void) {
+	syscall0 (SYS_SYNC);
+}
+
+int
+fallocate (int fd, off_t len) {
+	return syscall2 (SYS_FALLOCATE, fd, len);
+}
+
+int
+ftruncate (int fd, off_t len) {
+	return syscall2 (SYS_FTRUNCATE, fd, len);
+}
+
+int
+clone_file (const char *src, const char *dst) {
+	return syscall2 (SYS_CLONE_FILE, src, dst);
+}
+
+int
+poll (struct pollfd *fds, unsigned nfds, int timeout) {
+	return syscall3 (SYS_POLL, fds, nfds, timeout);
+}
+
+int
+zygote (const char *file) {
+	return syscall1 (SYS_ZYGOTE, file);
+}
+
 void *
 mmap (void *addr, size_t length, int writable, int fd, off_t offset) {
-	return (void *) syscall5 (SYS_MMAP, addr, length, writable, fd, offset);
+	return mmap_flags (addr, length, writable, fd, offset, 0);
+}
+
+void *
+mmap_flags (void *addr, size_t length, int writable, int fd, off_t offset,
+		int flags) {
+	return (void *) syscall6 (SYS_MMAP, addr, length, writable, fd, offset,
+			flags);
 }
 
 void
@@ -155,6 +283,50 @@ munmap (void *addr) {
 	syscall1 (SYS_MUNMAP, addr);
 }
 
+int
+msync (void *addr, size_t length) {
+	return syscall2 (SYS_MSYNC, addr, length);
+}
+
+int
+madvise (void *addr, size_t length, int advice) {
+	return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+/* Where a thread started by clone() begins: runs FUNC (ARG), then
+   ends the thread. */
+static void
+clone_entry (void (*func) (void *), void *arg) {
+	func (arg);
+	exit_thread ();
+}
+
+pid_t
+clone (void (*func) (void *), void *arg, int *ctid) {
+	return (pid_t) syscall4 (SYS_CLONE, clone_entry, func, arg, ctid);
+}
+
+void
+exit_thread (void) {
+	syscall0 (SYS_EXIT_THREAD);
+	NOT_REACHED ();
+}
+
+int
+futex (int *addr, int op, int val) {
+	return syscall3 (SYS_FUTEX, addr, op, val);
+}
+
+struct io_ring *
+io_setup (void) {
+	return (struct io_ring *) syscall0 (SYS_IO_SETUP);
+}
+
+int
+io_enter (unsigned to_submit, unsigned min_complete) {
+	return syscall2 (SYS_IO_ENTER, to_submit, min_complete);
+}
+
 bool
 chdir (const char *dir) {
 	return syscall1 (SYS_CHDIR, dir);
@@ -187,7 +359,12 @@ symlink (const char* target, const char* linkpath) {
 
 int
 mount (const char *path, int chan_no, int dev_no) {
-	return syscall3 (SYS_MOUNT, path, chan_no, dev_no);
+	return mount_flags (path, chan_no, dev_no, 0);
+}
+
+int
+mount_flags (const char *path, int chan_no, int dev_no, int flags) {
+	return syscall4 (SYS_MOUNT, path, chan_no, dev_no, flags);
 }
 
 int
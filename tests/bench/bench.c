@@ -0,0 +1,106 @@
+/* Benchmark reporting.
+
+   Each benchmark times the operations it repeats with the TSC and
+   passes the samples, in cycles, to bench_report(), which prints
+   one line per metric:
+
+     (TEST) bench METRIC ops N ops/s RATE p50 CYCLES p99 CYCLES
+
+   RATE is 0 if the kernel could not tell the TSC frequency.
+   utils/pintos-bench-diff compares these lines across runs. */
+
+#include "tests/bench/bench.h"
+#include <stdlib.h>
+#include "tests/lib.h"
+
+/* Returns the TSC frequency in Hz, as measured by the kernel, or
+   0 if it is unknown. */
+uint64_t
+bench_tsc_hz (void)
+{
+  return get_tsc_hz ();
+}
+
+/* Returns the number of timer ticks since boot. */
+uint64_t
+bench_ticks (void)
+{
+  return get_ticks ();
+}
+
+/* Returns the number of page faults the kernel has taken, of every
+   cause. */
+uint64_t
+bench_page_faults (void)
+{
+  uint64_t total = 0;
+  int64_t cause, cnt;
+
+  for (cause = 0; ; cause++)
+    {
+      asm volatile ("movq $0, %%rsi; int $0x48"
+                    : "=a" (cnt) : "D" (cause) : "rsi");
+      if (cnt < 0)
+        return total;
+      total += cnt;
+    }
+}
+
+/* Returns the number of pages read from swap, or written to it if
+   WRITE is nonzero. */
+uint64_t
+bench_swap_pages (int write)
+{
+  int64_t sectors;
+
+  /* The swap disk is hd1:1, and its sectors are accounted to
+     DISK_SRC_SWAP, 4.  A page takes 8 sectors. */
+  asm volatile ("movq $1, %%rdx; movq $1, %%rcx; movq $4, %%rsi; int $0x49"
+                : "=a" (sectors) : "D" ((int64_t) (write != 0))
+                : "rcx", "rdx", "rsi");
+  return sectors > 0 ? (uint64_t) sectors / 8 : 0;
+}
+
+/* Returns the TSC value at STAMP in this process's last exec(),
+   or 0 if it did not get there. */
+uint64_t
+bench_launch_stamp (enum bench_launch_stamp stamp)
+{
+  int64_t tsc;
+
+  asm volatile ("int $0x4c" : "=a" (tsc) : "D" ((int64_t) stamp));
+  return tsc > 0 ? (uint64_t) tsc : 0;
+}
+
+static int
+compare_samples (const void *a_, const void *b_)
+{
+  const uint64_t *a = a_;
+  const uint64_t *b = b_;
+
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Prints the result of CNT operations of METRIC that took the
+   numbers of cycles in SAMPLES, which it sorts. */
+void
+bench_report (const char *metric, uint64_t samples[], size_t cnt)
+{
+  uint64_t total = 0, hz = bench_tsc_hz ();
+  uint64_t rate = 0;
+  size_t i;
+
+  if (cnt == 0)
+    fail ("%s: no samples", metric);
+
+  for (i = 0; i < cnt; i++)
+    total += samples[i];
+  if (hz != 0 && total != 0)
+    rate = hz * cnt / total;
+  qsort (samples, cnt, sizeof *samples, compare_samples);
+
+  msg ("bench %s ops %zu ops/s %llu p50 %llu p99 %llu", metric, cnt,
+       (unsigned long long) rate,
+       (unsigned long long) samples[cnt / 2],
+       (unsigned long long) samples[cnt * 99 / 100]);
+}
@@ -0,0 +1,37 @@
+#ifndef TESTS_BENCH_BENCH_H
+#define TESTS_BENCH_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Most samples a benchmark takes. */
+#define BENCH_MAX_SAMPLES 10000
+
+/* Returns the time stamp counter. */
+static inline uint64_t
+bench_rdtsc (void)
+{
+  uint32_t lo, hi;
+
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+/* Points in a process's last exec(), as the kernel numbers them. */
+enum bench_launch_stamp
+  {
+    BENCH_LAUNCH_START,         /* exec() began. */
+    BENCH_LAUNCH_LOADED,        /* Executable image is in place. */
+    BENCH_LAUNCH_ARGS,          /* Arguments are set up. */
+    BENCH_LAUNCH_FAULT,         /* First user page fault handled. */
+    BENCH_LAUNCH_STAMP_CNT
+  };
+
+uint64_t bench_tsc_hz (void);
+uint64_t bench_ticks (void);
+uint64_t bench_page_faults (void);
+uint64_t bench_swap_pages (int write);
+uint64_t bench_launch_stamp (enum bench_launch_stamp);
+void bench_report (const char *metric, uint64_t samples[], size_t cnt);
+
+#endif /* tests/bench/bench.h */
@@ -0,0 +1,29 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# Checks that the benchmark ran to its end and reported each of
+# the METRICS.  The numbers themselves are not checked.
+sub check_bench {
+    my (@metrics) = @_;
+    our ($test);
+    my (@output) = read_text_file ("$test.output");
+
+    common_checks ("run", @output);
+    @output = get_core_output ("run", @output);
+
+    my ($name) = $output[0] =~ /^\((\S+)\) begin$/;
+    fail "First line of output is not a `begin' message.\n"
+      if !defined $name;
+    fail "Output missing `($name) end' message.\n"
+      if !grep ($_ eq "($name) end", @output);
+    foreach my $metric (@metrics) {
+	fail "Output missing result of benchmark `$metric'.\n"
+	  if !grep (/^\($name\) bench \Q$metric\E ops \d+ ops\/s \d+ p50 \d+ p99 \d+$/,
+		    @output);
+    }
+    pass;
+}
+
+1;
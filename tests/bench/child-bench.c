@@ -0,0 +1,7 @@
+/* Child process of the exec benchmark: exits at once. */
+
+int
+main (void)
+{
+  return 0;
+}
@@ -0,0 +1,35 @@
+/* Times fork() and exec() of a program that exits right away,
+   together with waiting for it. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ITERATIONS 20
+
+static uint64_t samples[ITERATIONS];
+
+void
+test_main (void)
+{
+  size_t i;
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      uint64_t start = bench_rdtsc ();
+      pid_t pid = fork ("child-bench");
+
+      if (pid == 0)
+        {
+          exec ("child-bench");
+          exit (-1);
+        }
+      if (pid < 0)
+        fail ("fork failed");
+      if (wait (pid) != 0)
+        fail ("child-bench failed");
+      samples[i] = bench_rdtsc () - start;
+    }
+  bench_report ("exec", samples, ITERATIONS);
+}
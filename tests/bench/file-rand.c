@@ -0,0 +1,48 @@
+/* Times reads and writes of 4 kB blocks at random offsets in a
+   file. */
+
+#include <random.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 4096
+#define BLOCK_CNT 64
+#define ACCESS_CNT 256
+
+static char buf[BLOCK_SIZE];
+static uint64_t samples[ACCESS_CNT];
+
+void
+test_main (void)
+{
+  int fd;
+  size_t i;
+
+  memset (buf, 'a', sizeof buf);
+  CHECK (create ("bench", BLOCK_CNT * BLOCK_SIZE), "create \"bench\"");
+  CHECK ((fd = open ("bench")) > 1, "open \"bench\"");
+
+  for (i = 0; i < ACCESS_CNT; i++)
+    {
+      off_t ofs = random_ulong () % BLOCK_CNT * BLOCK_SIZE;
+      uint64_t start = bench_rdtsc ();
+      if (pwrite (fd, buf, BLOCK_SIZE, ofs) != BLOCK_SIZE)
+        fail ("write at offset %d failed", ofs);
+      samples[i] = bench_rdtsc () - start;
+    }
+  bench_report ("file-rand-write", samples, ACCESS_CNT);
+
+  for (i = 0; i < ACCESS_CNT; i++)
+    {
+      off_t ofs = random_ulong () % BLOCK_CNT * BLOCK_SIZE;
+      uint64_t start = bench_rdtsc ();
+      if (pread (fd, buf, BLOCK_SIZE, ofs) != BLOCK_SIZE)
+        fail ("read at offset %d failed", ofs);
+      samples[i] = bench_rdtsc () - start;
+    }
+  bench_report ("file-rand-read", samples, ACCESS_CNT);
+  close (fd);
+}
@@ -0,0 +1,45 @@
+/* Times sequential writes, then reads, of a file in 4 kB
+   blocks. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 4096
+#define BLOCK_CNT 64
+
+static char buf[BLOCK_SIZE];
+static uint64_t samples[BLOCK_CNT];
+
+void
+test_main (void)
+{
+  int fd;
+  size_t i;
+
+  memset (buf, 'a', sizeof buf);
+  CHECK (create ("bench", 0), "create \"bench\"");
+  CHECK ((fd = open ("bench")) > 1, "open \"bench\"");
+
+  for (i = 0; i < BLOCK_CNT; i++)
+    {
+      uint64_t start = bench_rdtsc ();
+      if (write (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("write of block %zu failed", i);
+      samples[i] = bench_rdtsc () - start;
+    }
+  bench_report ("file-seq-write", samples, BLOCK_CNT);
+
+  seek (fd, 0);
+  for (i = 0; i < BLOCK_CNT; i++)
+    {
+      uint64_t start = bench_rdtsc ();
+      if (read (fd, buf, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("read of block %zu failed", i);
+      samples[i] = bench_rdtsc () - start;
+    }
+  bench_report ("file-seq-read", samples, BLOCK_CNT);
+  close (fd);
+}
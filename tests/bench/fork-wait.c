@@ -0,0 +1,32 @@
+/* Times fork() of a process that exits right away, together with
+   waiting for it. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ITERATIONS 50
+
+static uint64_t samples[ITERATIONS];
+
+void
+test_main (void)
+{
+  size_t i;
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      uint64_t start = bench_rdtsc ();
+      pid_t pid = fork ("child");
+
+      if (pid == 0)
+        exit (0);
+      if (pid < 0)
+        fail ("fork failed");
+      if (wait (pid) != 0)
+        fail ("wait for child failed");
+      samples[i] = bench_rdtsc () - start;
+    }
+  bench_report ("fork-wait", samples, ITERATIONS);
+}
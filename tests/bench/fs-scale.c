@@ -0,0 +1,208 @@
+/* Measures how file I/O scales with the number of processes doing
+   it at once.
+
+   Usage: fs-scale MODE PROCS OPS
+
+   For 1, 2, 4, ... up to PROCS processes, each process does OPS
+   operations on a file of FILE_SIZE bytes, in blocks of BLOCK_SIZE
+   bytes at random offsets: one in WRITE_EVERY a pwrite() of what
+   the file already holds there, the others a pread() checked
+   against it.  With MODE "indep" each process has a file of its
+   own; with MODE "shared" they all use one file.
+
+   For each number of processes, prints the latency of all of their
+   operations as a "bench" line, then the throughput of all of them
+   together.  The children pass their samples back through pipes. */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/filesys/seq-test.h"
+#include "tests/lib.h"
+
+#define FILE_SIZE (64 * 1024)
+#define BLOCK_SIZE 512
+#define WRITE_EVERY 4
+#define PROC_MAX 8
+#define OPS_MAX (BENCH_MAX_SAMPLES / PROC_MAX)
+
+/* What the files hold, the same in each. */
+static char data[FILE_SIZE];
+static char iobuf[BLOCK_SIZE];
+static uint64_t samples[PROC_MAX * OPS_MAX];
+
+static bool shared;
+
+static size_t
+prepare_block_size (void)
+{
+  return 4096;
+}
+
+/* Writes the name of process PROC's file into NAME. */
+static void
+file_name (char name[16], int proc)
+{
+  snprintf (name, 16, "scale-%d", shared ? 0 : proc);
+}
+
+/* Fills PROC's file with DATA. */
+static void
+prepare (int proc)
+{
+  char name[16];
+
+  file_name (name, proc);
+  remove (name);
+  random_init (0);
+  seq_test (name, data, FILE_SIZE, 0, prepare_block_size, NULL);
+}
+
+/* Does OP_CNT operations on PROC's file, timing each into
+   TIMES. */
+static void
+run (int proc, size_t op_cnt, uint64_t *times)
+{
+  size_t block_cnt = FILE_SIZE / BLOCK_SIZE;
+  char name[16];
+  size_t i;
+  int fd;
+
+  file_name (name, proc);
+  if ((fd = open (name)) < 2)
+    fail ("open \"%s\" failed", name);
+
+  for (i = 0; i < op_cnt; i++)
+    {
+      size_t ofs = random_ulong () % block_cnt * BLOCK_SIZE;
+      bool writing = random_ulong () % WRITE_EVERY == 0;
+      uint64_t start = bench_rdtsc ();
+      int n;
+
+      n = writing ? pwrite (fd, data + ofs, BLOCK_SIZE, ofs)
+                  : pread (fd, iobuf, BLOCK_SIZE, ofs);
+      times[i] = bench_rdtsc () - start;
+
+      if (n != BLOCK_SIZE)
+        fail ("%s at offset %zu in \"%s\" failed",
+              writing ? "pwrite" : "pread", ofs, name);
+      if (!writing && memcmp (iobuf, data + ofs, BLOCK_SIZE))
+        fail ("pread at offset %zu in \"%s\" returned bad data", ofs, name);
+    }
+  close (fd);
+}
+
+/* Reads SIZE bytes from FD into BUF, as many reads as that takes.
+   Returns true if all of them arrived. */
+static bool
+read_all (int fd, void *buf_, size_t size)
+{
+  char *buf = buf_;
+
+  while (size > 0)
+    {
+      int n = read (fd, buf, size);
+      if (n <= 0)
+        return false;
+      buf += n;
+      size -= n;
+    }
+  return true;
+}
+
+/* Writes SIZE bytes from BUF to FD, as many writes as that
+   takes.  Returns true if all of them went. */
+static bool
+write_all (int fd, const void *buf_, size_t size)
+{
+  const char *buf = buf_;
+
+  while (size > 0)
+    {
+      int n = write (fd, buf, size);
+      if (n <= 0)
+        return false;
+      buf += n;
+      size -= n;
+    }
+  return true;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int proc_max, proc_cnt, proc;
+  size_t op_cnt;
+
+  test_name = argv[0];
+  msg ("begin");
+
+  if (argc != 4)
+    fail ("usage: %s MODE PROCS OPS", argv[0]);
+  shared = !strcmp (argv[1], "shared");
+  proc_max = atoi (argv[2]);
+  op_cnt = atoi (argv[3]);
+  if (!shared && strcmp (argv[1], "indep"))
+    fail ("bad mode \"%s\"", argv[1]);
+  if (proc_max < 1 || proc_max > PROC_MAX)
+    fail ("must run 1 to %d processes", PROC_MAX);
+  if (op_cnt < 1 || op_cnt > OPS_MAX)
+    fail ("must do 1 to %d operations", OPS_MAX);
+
+  for (proc = 0; proc < (shared ? 1 : proc_max); proc++)
+    prepare (proc);
+
+  for (proc_cnt = 1; proc_cnt <= proc_max; proc_cnt *= 2)
+    {
+      uint64_t hz = bench_tsc_hz ();
+      uint64_t start = bench_rdtsc (), cycles, rate = 0;
+      pid_t pids[PROC_MAX];
+      int fds[PROC_MAX][2];
+      char metric[64];
+
+      /* Process 0 is this one; the others are children. */
+      for (proc = 1; proc < proc_cnt; proc++)
+        {
+          if (pipe (fds[proc]) < 0)
+            fail ("pipe failed");
+          pids[proc] = fork ("scale");
+          if (pids[proc] == 0)
+            {
+              uint64_t *mine = samples + proc * op_cnt;
+
+              random_init (proc);
+              run (proc, op_cnt, mine);
+              exit (write_all (fds[proc][1], mine, op_cnt * sizeof *mine)
+                    ? 0 : 1);
+            }
+          if (pids[proc] < 0)
+            fail ("fork failed");
+        }
+      random_init (0);
+      run (0, op_cnt, samples);
+      for (proc = 1; proc < proc_cnt; proc++)
+        {
+          if (!read_all (fds[proc][0], samples + proc * op_cnt,
+                         op_cnt * sizeof *samples))
+            fail ("samples of process %d lost", proc);
+          if (wait (pids[proc]) != 0)
+            fail ("process %d failed", proc);
+          close (fds[proc][0]);
+          close (fds[proc][1]);
+        }
+      cycles = bench_rdtsc () - start;
+
+      snprintf (metric, sizeof metric, "%s-%d", argv[0], proc_cnt);
+      bench_report (metric, samples, op_cnt * proc_cnt);
+      if (hz != 0 && cycles != 0)
+        rate = (uint64_t) op_cnt * proc_cnt * hz / cycles;
+      msg ("fs-scale %s procs %d: %llu ops/s", argv[1], proc_cnt,
+           (unsigned long long) rate);
+    }
+
+  msg ("end");
+  return 0;
+}
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::bench::bench;
+check_bench (map ("fs-sweep-par-write-$_", 1, 64, 512, 4096, 16384, 65536));
@@ -0,0 +1,185 @@
+/* Measures file I/O over a sweep of block sizes.
+
+   Usage: fs-sweep MODE ORDER FILE_KB PROCS
+
+   For each block size from 1 byte to 64 kB, PROCS processes each
+   read (MODE "read") or write (MODE "write") a file of FILE_KB kB
+   of their own, in blocks at consecutive (ORDER "seq") or random
+   (ORDER "rand") offsets, at most MAX_OPS blocks per file.  Files
+   to be read, or written at random offsets, are first filled by
+   seq_test(); files written sequentially start out empty and grow.
+
+   For each block size, prints the latency of the first process's
+   operations as a "bench" line, then the throughput of all the
+   processes together and the sectors the file system disk read
+   and wrote while they ran. */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/filesys/seq-test.h"
+#include "tests/lib.h"
+
+#define FILE_MAX (1024 * 1024)
+#define BLOCK_MAX (64 * 1024)
+#define MAX_OPS 2048
+#define PROC_MAX 8
+
+static const size_t block_sizes[] = {1, 64, 512, 4096, 16384, BLOCK_MAX};
+#define BLOCK_SIZE_CNT (sizeof block_sizes / sizeof *block_sizes)
+
+/* What the files hold, the same in each. */
+static char data[FILE_MAX];
+static char iobuf[BLOCK_MAX];
+static uint64_t samples[MAX_OPS];
+
+static bool writing, sequential;
+static size_t file_size;
+
+static size_t
+prepare_block_size (void)
+{
+  return 4096;
+}
+
+/* Writes the name of process PROC's file into NAME. */
+static void
+file_name (char name[16], int proc)
+{
+  snprintf (name, 16, "sweep-%d", proc);
+}
+
+/* Fills PROC's file with DATA, for reading or overwriting. */
+static void
+prepare (int proc)
+{
+  char name[16];
+
+  file_name (name, proc);
+  remove (name);
+  random_init (0);
+  seq_test (name, data, file_size, 0, prepare_block_size, NULL);
+}
+
+/* Reads or writes PROC's file in blocks of BLOCK_SIZE bytes, timing
+   each into samples[].  Returns the number of blocks. */
+static size_t
+run (int proc, size_t block_size)
+{
+  size_t block_cnt = file_size / block_size;
+  size_t op_cnt = block_cnt < MAX_OPS ? block_cnt : MAX_OPS;
+  char name[16];
+  size_t i;
+  int fd;
+
+  file_name (name, proc);
+  if (writing && sequential)
+    {
+      remove (name);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+  if ((fd = open (name)) < 2)
+    fail ("open \"%s\" failed", name);
+
+  for (i = 0; i < op_cnt; i++)
+    {
+      size_t ofs = (sequential ? i : random_ulong () % block_cnt) * block_size;
+      uint64_t start = bench_rdtsc ();
+      int n;
+
+      if (sequential)
+        n = writing ? write (fd, data + ofs, block_size)
+                    : read (fd, iobuf, block_size);
+      else
+        n = writing ? pwrite (fd, data + ofs, block_size, ofs)
+                    : pread (fd, iobuf, block_size, ofs);
+      samples[i] = bench_rdtsc () - start;
+
+      if (n != (int) block_size)
+        fail ("%s of %zu bytes at offset %zu in \"%s\" failed",
+              writing ? "write" : "read", block_size, ofs, name);
+      if (!writing && memcmp (iobuf, data + ofs, block_size))
+        fail ("read of %zu bytes at offset %zu in \"%s\" returned bad data",
+              block_size, ofs, name);
+    }
+  close (fd);
+  return op_cnt;
+}
+
+int
+main (int argc, char *argv[])
+{
+  int proc_cnt, proc;
+  size_t i;
+
+  test_name = argv[0];
+  msg ("begin");
+
+  if (argc != 5)
+    fail ("usage: %s MODE ORDER FILE_KB PROCS", argv[0]);
+  writing = !strcmp (argv[1], "write");
+  sequential = !strcmp (argv[2], "seq");
+  file_size = atoi (argv[3]) * 1024;
+  proc_cnt = atoi (argv[4]);
+  if ((!writing && strcmp (argv[1], "read"))
+      || (!sequential && strcmp (argv[2], "rand")))
+    fail ("bad mode \"%s\" or order \"%s\"", argv[1], argv[2]);
+  if (file_size < BLOCK_MAX || file_size > FILE_MAX)
+    fail ("file size must be %d to %d kB", BLOCK_MAX / 1024,
+          FILE_MAX / 1024);
+  if (proc_cnt < 1 || proc_cnt > PROC_MAX)
+    fail ("must run 1 to %d processes", PROC_MAX);
+
+  if (!writing || !sequential)
+    for (proc = 0; proc < proc_cnt; proc++)
+      prepare (proc);
+
+  for (i = 0; i < BLOCK_SIZE_CNT; i++)
+    {
+      size_t block_size = block_sizes[i];
+      long long reads = get_fs_disk_read_cnt ();
+      long long writes = get_fs_disk_write_cnt ();
+      uint64_t hz = bench_tsc_hz ();
+      uint64_t start = bench_rdtsc (), cycles, rate = 0;
+      pid_t pids[PROC_MAX];
+      char metric[64];
+      size_t op_cnt;
+
+      /* Process 0 is this one; the others are children. */
+      for (proc = 1; proc < proc_cnt; proc++)
+        {
+          pids[proc] = fork ("sweep");
+          if (pids[proc] == 0)
+            {
+              random_init (proc);
+              run (proc, block_size);
+              exit (0);
+            }
+          if (pids[proc] < 0)
+            fail ("fork failed");
+        }
+      random_init (0);
+      op_cnt = run (0, block_size);
+      for (proc = 1; proc < proc_cnt; proc++)
+        if (wait (pids[proc]) != 0)
+          fail ("process %d failed", proc);
+      cycles = bench_rdtsc () - start;
+
+      snprintf (metric, sizeof metric, "%s-%zu", argv[0], block_size);
+      bench_report (metric, samples, op_cnt);
+      if (hz != 0 && cycles != 0)
+        rate = (uint64_t) op_cnt * block_size * proc_cnt * hz / cycles / 1024;
+      msg ("fs-sweep %s %s block %zu procs %d: %llu kB/s, "
+           "%lld sectors read, %lld written",
+           argv[1], argv[2], block_size, proc_cnt,
+           (unsigned long long) rate,
+           get_fs_disk_read_cnt () - reads, get_fs_disk_write_cnt () - writes);
+    }
+
+  msg ("end");
+  return 0;
+}
@@ -0,0 +1,4 @@
+/* Makes launch-big a larger executable than launch-child: 128 kB
+   more of initialized data, none of which it touches. */
+
+const char launch_pad[128 * 1024] = { 1 };
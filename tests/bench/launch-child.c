@@ -0,0 +1,48 @@
+/* Child process of the launch benchmark.
+
+   Usage: launch-child FD DEPTH
+
+   With DEPTH 0, writes to pipe FD the TSC at each point of its
+   exec(), then the TSC just before it exits, as
+   BENCH_LAUNCH_STAMP_CNT + 1 uint64_t values.  Otherwise forks
+   and execs itself with DEPTH - 1 and waits for it, so that the
+   last of a chain of DEPTH + 1 processes writes them.
+
+   launch-big is this program with launch-big.c linked in. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+
+int
+main (int argc, char *argv[])
+{
+  uint64_t stamps[BENCH_LAUNCH_STAMP_CNT + 1];
+  int fd, depth, i;
+
+  if (argc != 3)
+    return -1;
+  fd = atoi (argv[1]);
+  depth = atoi (argv[2]);
+
+  if (depth > 0)
+    {
+      char cmd[64];
+      pid_t pid;
+
+      snprintf (cmd, sizeof cmd, "%s %d %d", argv[0], fd, depth - 1);
+      pid = fork (argv[0]);
+      if (pid == 0)
+        {
+          exec (cmd);
+          exit (-1);
+        }
+      return pid < 0 ? -1 : wait (pid);
+    }
+
+  for (i = 0; i < BENCH_LAUNCH_STAMP_CNT; i++)
+    stamps[i] = bench_launch_stamp (i);
+  stamps[i] = bench_rdtsc ();
+  return write (fd, stamps, sizeof stamps) == sizeof stamps ? 0 : -1;
+}
@@ -0,0 +1,142 @@
+/* Times starting processes, broken down by the phases of their
+   startup.
+
+   fork+wait of a child that exits at once, fork+exec+wait of a
+   small (launch-child) and a larger (launch-big) executable, and
+   fork+exec chains of CHAIN_DEPTH + 1 processes like
+   tests/userprog/multi-recurse.  Reports the whole of each as
+   METRIC, and for the execs also, from the TSC stamps the kernel
+   takes during exec():
+
+     METRIC-load    from exec() to the image being in place,
+     METRIC-args    from there to the arguments being set up,
+     METRIC-fault   from there to the first user page fault
+                    being handled, 0 if there was none,
+
+   and for all but the chains METRIC-wakeup, from the child's last
+   TSC reading before it exits to wait() returning in the parent.
+   The children pass their stamps back through a pipe. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ITERATIONS 20
+#define CHAIN_ITERATIONS 5
+#define CHAIN_DEPTH 4
+
+static uint64_t total[ITERATIONS];
+static uint64_t load[ITERATIONS];
+static uint64_t args[ITERATIONS];
+static uint64_t fault[ITERATIONS];
+static uint64_t wakeup[ITERATIONS];
+
+static int fds[2];
+
+/* Reads the N stamps a child wrote into STAMPS. */
+static void
+read_stamps (uint64_t *stamps, size_t n)
+{
+  if (read (fds[0], stamps, n * sizeof *stamps) != (int) (n * sizeof *stamps))
+    fail ("child's stamps lost");
+}
+
+/* Forks a child that exits at once. */
+static void
+bench_fork (void)
+{
+  size_t i;
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      uint64_t start = bench_rdtsc (), end, exited;
+      pid_t pid = fork ("launch-child");
+
+      if (pid == 0)
+        {
+          exited = bench_rdtsc ();
+          exit (write (fds[1], &exited, sizeof exited) == sizeof exited
+                ? 0 : -1);
+        }
+      if (pid < 0)
+        fail ("fork failed");
+      if (wait (pid) != 0)
+        fail ("child failed");
+      end = bench_rdtsc ();
+      read_stamps (&exited, 1);
+      total[i] = end - start;
+      wakeup[i] = end - exited;
+    }
+  bench_report ("launch-fork", total, ITERATIONS);
+  bench_report ("launch-fork-wakeup", wakeup, ITERATIONS);
+}
+
+/* Forks and execs PROG with DEPTH, ITERATION_CNT times, and
+   reports the results as METRIC. */
+static void
+bench_exec (const char *metric, const char *prog, int depth,
+            size_t iteration_cnt)
+{
+  char cmd[64], name[64];
+  size_t i;
+
+  snprintf (cmd, sizeof cmd, "%s %d %d", prog, fds[1], depth);
+  for (i = 0; i < iteration_cnt; i++)
+    {
+      uint64_t s[BENCH_LAUNCH_STAMP_CNT + 1];
+      uint64_t start = bench_rdtsc (), end;
+      pid_t pid = fork (prog);
+
+      if (pid == 0)
+        {
+          exec (cmd);
+          exit (-1);
+        }
+      if (pid < 0)
+        fail ("fork failed");
+      if (wait (pid) != 0)
+        fail ("exec \"%s\" failed", cmd);
+      end = bench_rdtsc ();
+      read_stamps (s, BENCH_LAUNCH_STAMP_CNT + 1);
+      if (s[BENCH_LAUNCH_START] == 0 || s[BENCH_LAUNCH_LOADED] == 0
+          || s[BENCH_LAUNCH_ARGS] == 0)
+        fail ("\"%s\" has no exec() stamps", prog);
+
+      total[i] = end - start;
+      load[i] = s[BENCH_LAUNCH_LOADED] - s[BENCH_LAUNCH_START];
+      args[i] = s[BENCH_LAUNCH_ARGS] - s[BENCH_LAUNCH_LOADED];
+      fault[i] = (s[BENCH_LAUNCH_FAULT] != 0
+                  ? s[BENCH_LAUNCH_FAULT] - s[BENCH_LAUNCH_ARGS] : 0);
+      wakeup[i] = end - s[BENCH_LAUNCH_STAMP_CNT];
+    }
+
+  bench_report (metric, total, iteration_cnt);
+  if (depth > 0)
+    return;
+  snprintf (name, sizeof name, "%s-load", metric);
+  bench_report (name, load, iteration_cnt);
+  snprintf (name, sizeof name, "%s-args", metric);
+  bench_report (name, args, iteration_cnt);
+  snprintf (name, sizeof name, "%s-fault", metric);
+  bench_report (name, fault, iteration_cnt);
+  snprintf (name, sizeof name, "%s-wakeup", metric);
+  bench_report (name, wakeup, iteration_cnt);
+}
+
+void
+test_main (void)
+{
+  if (pipe (fds) < 0)
+    fail ("pipe failed");
+
+  bench_fork ();
+  bench_exec ("launch-exec", "launch-child", 0, ITERATIONS);
+  bench_exec ("launch-exec-big", "launch-big", 0, ITERATIONS);
+  bench_exec ("launch-chain", "launch-child", CHAIN_DEPTH,
+              CHAIN_ITERATIONS);
+
+  close (fds[0]);
+  close (fds[1]);
+}
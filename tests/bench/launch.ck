@@ -0,0 +1,10 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::bench::bench;
+check_bench ("launch-fork", "launch-fork-wakeup",
+	     map (("launch-exec$_", "launch-exec$_-load",
+		   "launch-exec$_-args", "launch-exec$_-fault",
+		   "launch-exec$_-wakeup"), "", "-big"),
+	     "launch-chain");
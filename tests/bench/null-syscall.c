@@ -0,0 +1,23 @@
+/* Times a system call that does next to nothing: tell() on a file
+   descriptor that is not open. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static uint64_t samples[BENCH_MAX_SAMPLES];
+
+void
+test_main (void)
+{
+  size_t i;
+
+  for (i = 0; i < BENCH_MAX_SAMPLES; i++)
+    {
+      uint64_t start = bench_rdtsc ();
+      tell (-1);
+      samples[i] = bench_rdtsc () - start;
+    }
+  bench_report ("null-syscall", samples, BENCH_MAX_SAMPLES);
+}
@@ -0,0 +1,31 @@
+/* Times the first touch of each page of an anonymous mapping,
+   each of which takes a page fault. */
+
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_CNT 1024
+
+static uint64_t samples[PAGE_CNT];
+
+void
+test_main (void)
+{
+  char *map = (char *) 0x10000000;
+  size_t i;
+
+  if (mmap (map, PAGE_CNT * 4096, 1, MMAP_ANON, 0) == MAP_FAILED)
+    fail ("mmap failed");
+
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      uint64_t start = bench_rdtsc ();
+      map[i * 4096] = 1;
+      samples[i] = bench_rdtsc () - start;
+    }
+  bench_report ("page-fault", samples, PAGE_CNT);
+  munmap (map);
+}
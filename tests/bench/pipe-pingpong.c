@@ -0,0 +1,46 @@
+/* Times passing a byte back and forth between two processes
+   through a pair of pipes.  Each round trip takes two context
+   switches. */
+
+#include <syscall.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ROUND_TRIPS 1000
+
+static uint64_t samples[ROUND_TRIPS];
+
+void
+test_main (void)
+{
+  int ping[2], pong[2];
+  char c = 'x';
+  pid_t pid;
+  size_t i;
+
+  if (pipe (ping) < 0 || pipe (pong) < 0)
+    fail ("pipe failed");
+
+  pid = fork ("child");
+  if (pid == 0)
+    {
+      for (i = 0; i < ROUND_TRIPS; i++)
+        if (read (ping[0], &c, 1) != 1 || write (pong[1], &c, 1) != 1)
+          exit (-1);
+      exit (0);
+    }
+  if (pid < 0)
+    fail ("fork failed");
+
+  for (i = 0; i < ROUND_TRIPS; i++)
+    {
+      uint64_t start = bench_rdtsc ();
+      if (write (ping[1], &c, 1) != 1 || read (pong[0], &c, 1) != 1)
+        fail ("round trip %zu failed", i);
+      samples[i] = bench_rdtsc () - start;
+    }
+  if (wait (pid) != 0)
+    fail ("child failed");
+  bench_report ("pipe-pingpong", samples, ROUND_TRIPS);
+}
@@ -0,0 +1,189 @@
+/* Stresses page replacement: touches a working set of anonymous
+   pages, possibly bigger than memory, in one of several patterns,
+   and reports how many page faults and swap transfers that took.
+   Comparing the numbers across replacement policies in vm/vm.c
+   shows how well each keeps the pages that are used again.
+
+   Usage: vm-stress PATTERN PAGES WRITE_PCT ACCESSES
+
+   PATTERN is one of:
+
+     seq    runs of RUN_LEN consecutive pages from random starts.
+     rand   pages chosen uniformly at random.
+     zipf   pages chosen with a Zipf distribution, so that a few
+            are hot and most are cold; the hot ones are spread
+            over the working set.
+     loop   every page in turn, over and over, which is the worst
+            case for LRU once the working set exceeds memory.
+
+   Each of ACCESSES accesses is a write with probability WRITE_PCT
+   percent and a read otherwise.  Every page is written once
+   before the timed accesses, so that the working set starts out
+   in memory or swap, and every read checks the page's contents. */
+
+#include <random.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/bench/bench.h"
+#include "tests/lib.h"
+
+#define PAGE_SIZE 4096
+#define MAX_PAGES 16384
+#define RUN_LEN 64
+
+static char * const map = (char *) 0x10000000;
+static uint64_t samples[BENCH_MAX_SAMPLES];
+
+/* For zipf: cumulative weights of the ranks, and the page that
+   holds each rank. */
+static uint64_t zipf_cdf[MAX_PAGES];
+static size_t zipf_stride;
+
+/* Returns the greatest common divisor of A and B. */
+static size_t
+gcd (size_t a, size_t b)
+{
+  while (b != 0)
+    {
+      size_t t = a % b;
+      a = b;
+      b = t;
+    }
+  return a;
+}
+
+/* Sets up zipf for PAGE_CNT pages.  The weight of rank R is
+   proportional to 1 / (R + 1). */
+static void
+zipf_init (size_t page_cnt)
+{
+  uint64_t total = 0;
+  size_t i;
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      total += (1ULL << 32) / (i + 1);
+      zipf_cdf[i] = total;
+    }
+
+  /* Rank R lives in page R * zipf_stride % PAGE_CNT, which visits
+     every page when the stride is coprime with PAGE_CNT. */
+  zipf_stride = page_cnt * 5 / 8 | 1;
+  while (gcd (zipf_stride, page_cnt) != 1)
+    zipf_stride += 2;
+}
+
+/* Returns a page chosen with the zipf distribution over PAGE_CNT
+   pages. */
+static size_t
+zipf_next (size_t page_cnt)
+{
+  uint64_t r = random_ulong () % zipf_cdf[page_cnt - 1];
+  size_t lo = 0, hi = page_cnt - 1;
+
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (zipf_cdf[mid] > r)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+  return lo * zipf_stride % page_cnt;
+}
+
+/* Returns the page that access I of PATTERN touches. */
+static size_t
+next_page (const char *pattern, size_t i, size_t page_cnt)
+{
+  static size_t run_page;
+
+  if (!strcmp (pattern, "seq"))
+    {
+      if (i % RUN_LEN == 0)
+        run_page = random_ulong () % page_cnt;
+      else
+        run_page = (run_page + 1) % page_cnt;
+      return run_page;
+    }
+  else if (!strcmp (pattern, "rand"))
+    return random_ulong () % page_cnt;
+  else if (!strcmp (pattern, "zipf"))
+    return zipf_next (page_cnt);
+  else
+    return i % page_cnt;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *pattern;
+  size_t page_cnt, write_pct, access_cnt, stride, sample_cnt, i;
+  uint64_t faults, swap_in, swap_out, ticks;
+
+  test_name = argv[0];
+  msg ("begin");
+  random_init (0);
+
+  if (argc != 5)
+    fail ("usage: %s PATTERN PAGES WRITE_PCT ACCESSES", argv[0]);
+  pattern = argv[1];
+  page_cnt = atoi (argv[2]);
+  write_pct = atoi (argv[3]);
+  access_cnt = atoi (argv[4]);
+  if (strcmp (pattern, "seq") && strcmp (pattern, "rand")
+      && strcmp (pattern, "zipf") && strcmp (pattern, "loop"))
+    fail ("unknown pattern \"%s\"", pattern);
+  if (page_cnt == 0 || page_cnt > MAX_PAGES)
+    fail ("working set must be 1 to %d pages", MAX_PAGES);
+  if (write_pct > 100 || access_cnt == 0)
+    fail ("bad write percentage or access count");
+  if (!strcmp (pattern, "zipf"))
+    zipf_init (page_cnt);
+
+  if (mmap (map, page_cnt * PAGE_SIZE, 1, MMAP_ANON, 0) == MAP_FAILED)
+    fail ("mmap failed");
+  for (i = 0; i < page_cnt; i++)
+    *(size_t *) (map + i * PAGE_SIZE) = i;
+
+  /* Time one access in every STRIDE, so that the samples fit. */
+  stride = (access_cnt + BENCH_MAX_SAMPLES - 1) / BENCH_MAX_SAMPLES;
+  sample_cnt = 0;
+
+  faults = bench_page_faults ();
+  swap_in = bench_swap_pages (0);
+  swap_out = bench_swap_pages (1);
+  ticks = bench_ticks ();
+  for (i = 0; i < access_cnt; i++)
+    {
+      size_t page = next_page (pattern, i, page_cnt);
+      size_t *p = (size_t *) (map + page * PAGE_SIZE);
+      bool write = random_ulong () % 100 < write_pct;
+      uint64_t start = bench_rdtsc ();
+
+      if (write)
+        p[1]++;
+      else if (*(volatile size_t *) p != page)
+        fail ("page %zu holds %zu", page, *p);
+      if (i % stride == 0)
+        samples[sample_cnt++] = bench_rdtsc () - start;
+    }
+  ticks = bench_ticks () - ticks;
+  faults = bench_page_faults () - faults;
+  swap_in = bench_swap_pages (0) - swap_in;
+  swap_out = bench_swap_pages (1) - swap_out;
+
+  bench_report (argv[0], samples, sample_cnt);
+  msg ("vm-stress %s pages %zu writes %zu%% accesses %zu: "
+       "faults %llu swap-in %llu swap-out %llu ticks %llu",
+       pattern, page_cnt, write_pct, access_cnt,
+       (unsigned long long) faults, (unsigned long long) swap_in,
+       (unsigned long long) swap_out, (unsigned long long) ticks);
+
+  munmap (map);
+  msg ("end");
+  return 0;
+}
@@ -1,4 +1,5 @@
-/* crctab[] and cksum() are from the `cksum' entry in SUSv3. */
+/* crctab[] and the algorithm of cksum() are from the `cksum' entry
+   in SUSv3. */
 
 #include <stdint.h>
 #include "tests/cksum.h"
@@ -58,6 +59,24 @@ static unsigned long crctab[] = {
   0xa2f33668, 0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
 };
 
+/* slice[K][I] is the CRC of byte I followed by K zero bytes, so
+   that cksum() can fold 8 bytes at a time with 8 independent
+   lookups ("slicing-by-8") instead of one lookup per byte. */
+static uint32_t slice[8][256];
+static int slices_ready;
+
+static void
+init_slices (void)
+{
+  int i, k;
+  for (i = 0; i < 256; i++)
+    slice[0][i] = crctab[i];
+  for (k = 1; k < 8; k++)
+    for (i = 0; i < 256; i++)
+      slice[k][i] = (slice[k - 1][i] << 8) ^ crctab[slice[k - 1][i] >> 24];
+  slices_ready = 1;
+}
+
 /* This is the algorithm used by the Posix `cksum' utility. */
 unsigned long
 cksum (const void *b_, size_t n)
@@ -65,7 +84,17 @@ cksum (const void *b_, size_t n)
   const unsigned char *b = b_;
   uint32_t s = 0;
   size_t i;
-  for (i = n; i > 0; --i)
+  if (!slices_ready)
+    init_slices ();
+  for (i = n; i >= 8; i -= 8, b += 8)
+    {
+      uint32_t hi = s ^ ((uint32_t) b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3]);
+      s = (slice[7][hi >> 24] ^ slice[6][(hi >> 16) & 0xff]
+           ^ slice[5][(hi >> 8) & 0xff] ^ slice[4][hi & 0xff]
+           ^ slice[3][b[4]] ^ slice[2][b[5]] ^ slice[1][b[6]]
+           ^ slice[0][b[7]]);
+    }
+  for (; i > 0; --i)
     {
       unsigned char c = *b++;
       s = (s << 8) ^ crctab[(s >> 24) ^ c];
@@ -0,0 +1,37 @@
+/* Checks the buffer cache statistics: reading a file that was just
+   written finds all of its sectors in the cache. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define TEST_SIZE 4096
+
+static const char file_name[] = "data";
+static char buf[TEST_SIZE];
+static char rbuf[TEST_SIZE];
+
+void
+test_main (void)
+{
+  struct cache_stats before, after;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  random_bytes (buf, sizeof buf);
+  CHECK (write (fd, buf, sizeof buf) == TEST_SIZE, "write \"%s\"", file_name);
+
+  get_cache_stats (&before);
+  seek (fd, 0);
+  CHECK (read (fd, rbuf, sizeof rbuf) == TEST_SIZE, "read \"%s\"", file_name);
+  get_cache_stats (&after);
+  compare_bytes (rbuf, buf, sizeof buf, 0, file_name);
+
+  CHECK (after.hits >= before.hits + TEST_SIZE / 512, "check hits");
+  CHECK (after.misses == before.misses, "check misses");
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(bc-stats) begin
+(bc-stats) create "data"
+(bc-stats) open "data"
+(bc-stats) write "data"
+(bc-stats) read "data"
+(bc-stats) check hits
+(bc-stats) check misses
+(bc-stats) close "data"
+(bc-stats) end
+EOF
+pass;
@@ -0,0 +1,67 @@
+/* Writes a file until the disk is full, then closes it and checks
+   that it holds every byte that a write reported written, so that
+   no write is acknowledged and then lost for want of room. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BLOCK_SIZE 4096
+
+static char buf[BLOCK_SIZE];
+static char got[BLOCK_SIZE];
+
+/* Fills BLOCK with the contents of block IDX of the file. */
+static void
+fill_block (char *block, size_t idx)
+{
+  size_t i;
+
+  for (i = 0; i < BLOCK_SIZE; i++)
+    block[i] = (idx * 7 + i) & 0xff;
+}
+
+void
+test_main (void)
+{
+  size_t size = 0, ofs;
+  int fd, n;
+
+  CHECK (create ("full", 0), "create \"full\"");
+  CHECK ((fd = open ("full")) > 1, "open \"full\"");
+  msg ("write \"full\" until the disk fills up");
+  do
+    {
+      fill_block (buf, size / BLOCK_SIZE);
+      n = write (fd, buf, BLOCK_SIZE);
+      if (n < 0)
+        fail ("write at offset %zu returned %d", size, n);
+      size += n;
+    }
+  while (n == BLOCK_SIZE);
+  if (size == 0)
+    fail ("no byte of \"full\" could be written");
+  msg ("close \"full\"");
+  close (fd);
+
+  CHECK ((fd = open ("full")) > 1, "open \"full\" for verification");
+  if (filesize (fd) != (int) size)
+    fail ("\"full\" is %d bytes long, but %zu were written",
+          filesize (fd), size);
+  for (ofs = 0; ofs < size; ofs += n)
+    {
+      size_t len = size - ofs < BLOCK_SIZE ? size - ofs : BLOCK_SIZE;
+
+      fill_block (buf, ofs / BLOCK_SIZE);
+      n = read (fd, got, len);
+      if (n != (int) len)
+        fail ("read %zu bytes at offset %zu in \"full\" returned %d",
+              len, ofs, n);
+      compare_bytes (got, buf, len, ofs, "full");
+    }
+  msg ("verified contents of \"full\"");
+  msg ("close \"full\"");
+  close (fd);
+
+  CHECK (remove ("full"), "remove \"full\"");
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-disk-full) begin
+(grow-disk-full) create "full"
+(grow-disk-full) open "full"
+(grow-disk-full) write "full" until the disk fills up
+(grow-disk-full) close "full"
+(grow-disk-full) open "full" for verification
+(grow-disk-full) verified contents of "full"
+(grow-disk-full) close "full"
+(grow-disk-full) remove "full"
+(grow-disk-full) end
+EOF
+pass;
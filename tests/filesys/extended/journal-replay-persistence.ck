@@ -0,0 +1,9 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+fail "Journal was not replayed.\n"
+  if !grep (/journal: replaying \d+ sectors/, read_text_file ("$test.output"));
+check_archive ({'d' => {'a' => ["\0" x 512], 'b' => ['']}, 'c' => ['']});
+pass;
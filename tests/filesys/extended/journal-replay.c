@@ -0,0 +1,16 @@
+/* Creates a directory and files in it, and powers off with -jcrash,
+   leaving the last transaction to be replayed from the journal by
+   the next boot, which must find them all. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK (create ("d/a", 512), "create \"d/a\"");
+  CHECK (create ("d/b", 0), "create \"d/b\"");
+  CHECK (create ("c", 0), "create \"c\"");
+}
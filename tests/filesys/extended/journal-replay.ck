@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(journal-replay) begin
+(journal-replay) mkdir "d"
+(journal-replay) create "d/a"
+(journal-replay) create "d/b"
+(journal-replay) create "c"
+(journal-replay) end
+EOF
+pass;
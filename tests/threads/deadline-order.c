@@ -0,0 +1,66 @@
+/* Checks that ready deadline threads run earliest deadline
+   first, ahead of threads of higher priority, and that admission
+   control turns away reservations the class cannot meet.
+
+   Three threads, each of a higher priority than the last but
+   with a later deadline, reserve some CPU and wait on a
+   semaphore.  The main thread, whose own reservation has the
+   earliest deadline of all, wakes them, then leaves the deadline
+   class, after which they should run in deadline order. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define THREAD_CNT 3
+
+static thread_func deadline_thread;
+static struct semaphore wait_sema;
+static int periods[THREAD_CNT] = {50, 60, 70};
+
+void
+test_deadline_order (void) 
+{
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  msg ("Reserving more CPU time than a period has.");
+  if (thread_set_deadline (5, 4))
+    fail ("thread_set_deadline (5, 4) succeeded");
+  msg ("Reserving the whole CPU.");
+  if (thread_set_deadline (10, 10))
+    fail ("thread_set_deadline (10, 10) succeeded");
+
+  sema_init (&wait_sema, 0);
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "period %d", periods[i]);
+      thread_create (name, PRI_DEFAULT + 1 + i, deadline_thread,
+                     &periods[i]);
+    }
+
+  if (!thread_set_deadline (2, 10))
+    fail ("thread_set_deadline (2, 10) failed");
+  for (i = 0; i < THREAD_CNT; i++)
+    sema_up (&wait_sema);
+  msg ("Leaving the deadline class.");
+  thread_set_deadline (0, 0);
+  msg ("All three threads should have finished by now.");
+}
+
+static void
+deadline_thread (void *period_) 
+{
+  int period = *(int *) period_;
+
+  if (!thread_set_deadline (2, period))
+    fail ("thread_set_deadline (2, %d) failed", period);
+  sema_down (&wait_sema);
+  msg ("Thread %s, priority %d, done.",
+       thread_name (), thread_get_priority ());
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(deadline-order) begin
+(deadline-order) Reserving more CPU time than a period has.
+(deadline-order) Reserving the whole CPU.
+(deadline-order) Leaving the deadline class.
+(deadline-order) Thread period 50, priority 32, done.
+(deadline-order) Thread period 60, priority 33, done.
+(deadline-order) Thread period 70, priority 34, done.
+(deadline-order) All three threads should have finished by now.
+(deadline-order) end
+EOF
+pass;
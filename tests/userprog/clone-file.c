@@ -0,0 +1,50 @@
+/* Clones a file with clone_file(), then writes to the clone and to
+   the original and checks that neither write shows in the other. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE 3000
+
+static char orig[SIZE];
+static char copy[SIZE];
+
+/* Writes the SIZE bytes at BUF to FILE_NAME at OFS. */
+static void
+write_at (const char *file_name, const char *buf, int size, int ofs) 
+{
+  int fd;
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (pwrite (fd, buf, size, ofs) == size,
+         "write %d bytes at %d in \"%s\"", size, ofs, file_name);
+  close (fd);
+}
+
+void
+test_main (void) 
+{
+  int i;
+
+  for (i = 0; i < SIZE; i++)
+    orig[i] = 'a' + i % 26;
+  CHECK (create ("orig", 0), "create \"orig\"");
+  write_at ("orig", orig, SIZE, 0);
+
+  CHECK (clone_file ("orig", "copy") == 0, "clone \"orig\" to \"copy\"");
+  check_file ("copy", orig, SIZE);
+
+  memcpy (copy, orig, SIZE);
+  memset (copy + 600, 'C', 700);
+  write_at ("copy", copy + 600, 700, 600);
+  memset (orig, 'O', 10);
+  write_at ("orig", orig, 10, 0);
+  check_file ("orig", orig, SIZE);
+  check_file ("copy", copy, SIZE);
+
+  msg ("clone onto an existing file returns %d", clone_file ("orig", "copy"));
+  msg ("clone of a missing file returns %d", clone_file ("none", "x"));
+  msg ("clone of a directory returns %d", clone_file ("/", "x"));
+}
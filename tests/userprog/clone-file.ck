@@ -0,0 +1,30 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(clone-file) begin
+(clone-file) create "orig"
+(clone-file) open "orig"
+(clone-file) write 3000 bytes at 0 in "orig"
+(clone-file) clone "orig" to "copy"
+(clone-file) open "copy" for verification
+(clone-file) verified contents of "copy"
+(clone-file) close "copy"
+(clone-file) open "copy"
+(clone-file) write 700 bytes at 600 in "copy"
+(clone-file) open "orig"
+(clone-file) write 10 bytes at 0 in "orig"
+(clone-file) open "orig" for verification
+(clone-file) verified contents of "orig"
+(clone-file) close "orig"
+(clone-file) open "copy" for verification
+(clone-file) verified contents of "copy"
+(clone-file) close "copy"
+(clone-file) clone onto an existing file returns -1
+(clone-file) clone of a missing file returns -1
+(clone-file) clone of a directory returns -1
+(clone-file) end
+clone-file: exit(0)
+EOF
+pass;
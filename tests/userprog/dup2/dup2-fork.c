@@ -0,0 +1,42 @@
+/* Checks that descriptors that share a file through dup2() still
+   share one position in a forked child, and that the child's
+   position is its own, apart from the parent's. */
+
+#include <debug.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/userprog/sample.inc"
+
+const char *test_name = "dup2-fork";
+
+static char buffer[sizeof sample];
+
+int
+main (int argc UNUSED, char *argv[] UNUSED) {
+  int fd1, fd2 = 0x1CE;
+  int byte_cnt;
+  pid_t pid;
+
+  CHECK ((fd1 = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (dup2 (fd1, fd2) == fd2, "dup2()");
+
+  if ((pid = fork ("child")) == 0) {
+    byte_cnt = read (fd1, buffer, 10);
+    byte_cnt += read (fd2, buffer + byte_cnt, sizeof sample - 1 - byte_cnt);
+    if (byte_cnt != sizeof sample - 1 || memcmp (buffer, sample, byte_cnt))
+      fail ("child: descriptors do not share a position");
+    msg ("child read the file through both descriptors");
+    exit (0);
+  }
+  if (pid < 0)
+    fail ("fork");
+  CHECK (wait (pid) == 0, "wait for child");
+
+  memset (buffer, 0, sizeof buffer);
+  byte_cnt = read (fd2, buffer, sizeof sample - 1);
+  if (byte_cnt != sizeof sample - 1 || memcmp (buffer, sample, byte_cnt))
+    fail ("parent: position moved by the child");
+  msg ("parent read the file from its start");
+  return 0;
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(dup2-fork) open "sample.txt"
+(dup2-fork) dup2()
+(dup2-fork) child read the file through both descriptors
+child: exit(0)
+(dup2-fork) wait for child
+(dup2-fork) parent read the file from its start
+dup2-fork: exit(0)
+EOF
+pass;
@@ -0,0 +1,53 @@
+/* Grows a file with fallocate(), then shrinks and regrows it with
+   ftruncate(), checking its length and that the bytes past each
+   end read as zeros. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[5000];
+
+/* Checks that the SIZE bytes of FD from OFS on are all zeros. */
+static void
+check_zeros (int fd, int ofs, int size) 
+{
+  int i;
+
+  if (pread (fd, buf, size, ofs) != size)
+    fail ("pread %d bytes at %d", size, ofs);
+  for (i = 0; i < size; i++)
+    if (buf[i] != 0)
+      fail ("byte %d is %d, not 0", ofs + i, buf[i]);
+}
+
+void
+test_main (void) 
+{
+  int fd, i;
+
+  CHECK (create ("alloc-file", 0), "create \"alloc-file\"");
+  CHECK ((fd = open ("alloc-file")) > 1, "open \"alloc-file\"");
+  for (i = 0; i < 200; i++)
+    buf[i] = 'x';
+  CHECK (write (fd, buf, 200) == 200, "write 200 bytes");
+
+  CHECK (fallocate (fd, 5000) == 0, "fallocate 5000 bytes");
+  msg ("length %d", filesize (fd));
+  check_zeros (fd, 200, 4800);
+  CHECK (fallocate (fd, 1000) == 0, "fallocate 1000 bytes");
+  msg ("length %d", filesize (fd));
+
+  CHECK (ftruncate (fd, 100) == 0, "ftruncate to 100 bytes");
+  msg ("length %d", filesize (fd));
+  CHECK (ftruncate (fd, 3000) == 0, "ftruncate to 3000 bytes");
+  msg ("length %d", filesize (fd));
+  check_zeros (fd, 100, 2900);
+  msg ("position %u", tell (fd));
+
+  msg ("fallocate of a negative length returns %d", fallocate (fd, -1));
+  msg ("ftruncate to a negative length returns %d", ftruncate (fd, -1));
+  msg ("fallocate of the console returns %d", fallocate (1, 10));
+  msg ("ftruncate of the console returns %d", ftruncate (1, 10));
+  close (fd);
+}
@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fallocate-normal) begin
+(fallocate-normal) create "alloc-file"
+(fallocate-normal) open "alloc-file"
+(fallocate-normal) write 200 bytes
+(fallocate-normal) fallocate 5000 bytes
+(fallocate-normal) length 5000
+(fallocate-normal) fallocate 1000 bytes
+(fallocate-normal) length 5000
+(fallocate-normal) ftruncate to 100 bytes
+(fallocate-normal) length 100
+(fallocate-normal) ftruncate to 3000 bytes
+(fallocate-normal) length 3000
+(fallocate-normal) position 200
+(fallocate-normal) fallocate of a negative length returns -1
+(fallocate-normal) ftruncate to a negative length returns -1
+(fallocate-normal) fallocate of the console returns -1
+(fallocate-normal) ftruncate of the console returns -1
+(fallocate-normal) end
+fallocate-normal: exit(0)
+EOF
+pass;
@@ -0,0 +1,29 @@
+/* Writes a file and checks that fsync() gets it onto the disk, and
+   that fsync() fails on descriptors with nothing to write back. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[2048];
+
+void
+test_main (void) 
+{
+  long long writes;
+  int fd, fds[2];
+
+  CHECK (create ("sync-file", 0), "create \"sync-file\"");
+  CHECK ((fd = open ("sync-file")) > 1, "open \"sync-file\"");
+  writes = get_fs_disk_write_cnt ();
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"sync-file\"");
+  CHECK (fsync (fd) == 0, "fsync \"sync-file\"");
+  CHECK (get_fs_disk_write_cnt () > writes, "the disk was written");
+  close (fd);
+  sync ();
+
+  msg ("fsync of the console returns %d", fsync (1));
+  CHECK (pipe (fds) == 0, "pipe");
+  msg ("fsync of a pipe returns %d", fsync (fds[1]));
+  msg ("fsync of a closed fd returns %d", fsync (fd));
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fsync-normal) begin
+(fsync-normal) create "sync-file"
+(fsync-normal) open "sync-file"
+(fsync-normal) write "sync-file"
+(fsync-normal) fsync "sync-file"
+(fsync-normal) the disk was written
+(fsync-normal) fsync of the console returns -1
+(fsync-normal) pipe
+(fsync-normal) fsync of a pipe returns -1
+(fsync-normal) fsync of a closed fd returns -1
+(fsync-normal) end
+fsync-normal: exit(0)
+EOF
+pass;
@@ -0,0 +1,35 @@
+/* Creates two files, then reads the root directory a few entries
+   at a time with getdents() and checks that each file is listed
+   exactly once.  Also checks that getdents() fails on a file that
+   is not a directory. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static const char *names[] = {"alpha", "beta"};
+
+void
+test_main (void) 
+{
+  struct dirent ents[2];
+  int seen[2] = {0, 0};
+  int fd, n, i, j;
+
+  for (i = 0; i < 2; i++)
+    CHECK (create (names[i], 0), "create \"%s\"", names[i]);
+  CHECK ((fd = open ("/")) > 1, "open \"/\"");
+  while ((n = getdents (fd, ents, 2)) > 0)
+    for (i = 0; i < n; i++)
+      for (j = 0; j < 2; j++)
+        if (!strcmp (ents[i].d_name, names[j]))
+          seen[j]++;
+  CHECK (n == 0, "getdents reaches the end");
+  for (i = 0; i < 2; i++)
+    msg ("\"%s\" listed %d time(s)", names[i], seen[i]);
+  close (fd);
+
+  CHECK ((fd = open ("alpha")) > 1, "open \"alpha\"");
+  msg ("getdents on a file returns %d", getdents (fd, ents, 2));
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(getdents-normal) begin
+(getdents-normal) create "alpha"
+(getdents-normal) create "beta"
+(getdents-normal) open "/"
+(getdents-normal) getdents reaches the end
+(getdents-normal) "alpha" listed 1 time(s)
+(getdents-normal) "beta" listed 1 time(s)
+(getdents-normal) open "alpha"
+(getdents-normal) getdents on a file returns -1
+(getdents-normal) end
+getdents-normal: exit(0)
+EOF
+pass;
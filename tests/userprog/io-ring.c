@@ -0,0 +1,62 @@
+/* Opens, writes, syncs and reads back a file through the ring that
+   io_setup() maps, one operation at a time, and checks that a bad
+   operation completes with -1. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static const char data[] = "through the ring";
+
+static struct io_ring *ring;
+
+/* Submits an operation OP on FD with ADDR, LEN and OFFSET, waits
+   for its completion and returns its result. */
+static int
+run (int op, int fd, const void *addr, unsigned len, int offset) 
+{
+  static uint64_t next_user_data = 1;
+  uint64_t user_data = next_user_data++;
+  struct io_sqe *sqe = &ring->sq[ring->sq_tail % IORING_ENTRIES];
+  struct io_cqe *cqe;
+  int res;
+
+  sqe->op = op;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) addr;
+  sqe->len = len;
+  sqe->offset = offset;
+  sqe->user_data = user_data;
+  ring->sq_tail++;
+  if (io_enter (1, 1) != 1)
+    fail ("io_enter did not take the operation");
+  if (ring->cq_head == ring->cq_tail)
+    fail ("io_enter returned with no completion");
+  cqe = &ring->cq[ring->cq_head % IORING_ENTRIES];
+  if (cqe->user_data != user_data)
+    fail ("completion has user_data %d, not %d",
+          (int) cqe->user_data, (int) user_data);
+  res = cqe->res;
+  ring->cq_head++;
+  return res;
+}
+
+void
+test_main (void) 
+{
+  char buf[sizeof data];
+  int fd;
+
+  CHECK ((ring = io_setup ()) == (struct io_ring *) IORING_BASE, "io_setup");
+  CHECK (create ("ring-file", 0), "create \"ring-file\"");
+  CHECK ((fd = run (IO_OPEN, 0, "ring-file", 0, 0)) > 1, "open \"ring-file\"");
+  CHECK (run (IO_PWRITE, fd, data, sizeof data, 0) == sizeof data,
+         "pwrite \"ring-file\"");
+  CHECK (run (IO_FSYNC, fd, NULL, 0, 0) == 0, "fsync \"ring-file\"");
+  CHECK (run (IO_PREAD, fd, buf, sizeof buf, 0) == sizeof buf,
+         "pread \"ring-file\"");
+  CHECK (!strcmp (buf, data), "read back what was written");
+  msg ("unknown operation completes with %d", run (99, fd, NULL, 0, 0));
+  close (fd);
+}
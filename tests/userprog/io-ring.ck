@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(io-ring) begin
+(io-ring) io_setup
+(io-ring) create "ring-file"
+(io-ring) open "ring-file"
+(io-ring) pwrite "ring-file"
+(io-ring) fsync "ring-file"
+(io-ring) pread "ring-file"
+(io-ring) read back what was written
+(io-ring) unknown operation completes with -1
+(io-ring) end
+io-ring: exit(0)
+EOF
+pass;
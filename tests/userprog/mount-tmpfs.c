@@ -0,0 +1,35 @@
+/* Mounts a tmpfs, uses a file on it, and unmounts it, checking
+   that a busy file system stays mounted and that names already
+   in use and unknown flags are refused. */
+
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf[5];
+  int fd;
+
+  CHECK (create ("taken", 0), "create \"taken\"");
+  msg ("mount on \"taken\" returns %d", mount ("taken", MOUNT_TMPFS, 64));
+  msg ("mount with unknown flags returns %d",
+       mount_flags ("scratch", MOUNT_TMPFS, 64, 0x100));
+
+  CHECK (mount ("scratch", MOUNT_TMPFS, 64) == 0, "mount \"scratch\"");
+  msg ("mount on \"scratch\" again returns %d",
+       mount ("scratch", MOUNT_TMPFS, 64));
+  CHECK (create ("/scratch/file", 0), "create \"/scratch/file\"");
+  CHECK ((fd = open ("/scratch/file")) > 1, "open \"/scratch/file\"");
+  CHECK (write (fd, "tmpfs", 5) == 5, "write \"/scratch/file\"");
+  msg ("umount while a file is open returns %d", umount ("scratch"));
+  seek (fd, 0);
+  CHECK (read (fd, buf, 5) == 5, "read \"/scratch/file\"");
+  close (fd);
+
+  CHECK (umount ("scratch") == 0, "umount \"scratch\"");
+  msg ("open \"/scratch/file\" returns %d", open ("/scratch/file"));
+  msg ("umount \"scratch\" again returns %d", umount ("scratch"));
+}
@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(mount-tmpfs) begin
+(mount-tmpfs) create "taken"
+(mount-tmpfs) mount on "taken" returns -1
+(mount-tmpfs) mount with unknown flags returns -1
+(mount-tmpfs) mount "scratch"
+(mount-tmpfs) mount on "scratch" again returns -1
+(mount-tmpfs) create "/scratch/file"
+(mount-tmpfs) open "/scratch/file"
+(mount-tmpfs) write "/scratch/file"
+(mount-tmpfs) umount while a file is open returns -1
+(mount-tmpfs) read "/scratch/file"
+(mount-tmpfs) umount "scratch"
+(mount-tmpfs) open "/scratch/file" returns -1
+(mount-tmpfs) umount "scratch" again returns -1
+(mount-tmpfs) end
+mount-tmpfs: exit(0)
+EOF
+pass;
@@ -0,0 +1,48 @@
+/* Writes data that compresses well to a file opened with
+   O_COMPRESS, overwrites part of it, and reads it all back through
+   a descriptor opened without the flag.  Also checks that the disk
+   took fewer sectors than the data fills, and that a file already
+   holding data cannot be compressed. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE 65536
+
+static char buf[SIZE];
+
+void
+test_main (void) 
+{
+  long long writes;
+  int fd, i;
+
+  for (i = 0; i < SIZE; i++)
+    buf[i] = "compressible "[i % 13];
+  CHECK (create ("comp-file", 0), "create \"comp-file\"");
+  CHECK ((fd = open_flags ("comp-file", O_COMPRESS)) > 1,
+         "open \"comp-file\" with O_COMPRESS");
+  writes = get_fs_disk_write_cnt ();
+  CHECK (write (fd, buf, SIZE) == SIZE, "write %d bytes", SIZE);
+  CHECK (fsync (fd) == 0, "fsync \"comp-file\"");
+  writes = get_fs_disk_write_cnt () - writes;
+  CHECK (writes < SIZE / 512 / 2, "fewer than half as many sectors written");
+
+  for (i = 5000; i < 5100; i++)
+    buf[i] = 'z';
+  CHECK (pwrite (fd, buf + 5000, 100, 5000) == 100,
+         "write 100 bytes at 5000");
+  close (fd);
+  check_file ("comp-file", buf, SIZE);
+  CHECK ((fd = open_flags ("comp-file", O_COMPRESS)) > 1,
+         "open \"comp-file\" with O_COMPRESS again");
+  close (fd);
+
+  CHECK (create ("plain-file", 0), "create \"plain-file\"");
+  CHECK ((fd = open ("plain-file")) > 1, "open \"plain-file\"");
+  CHECK (write (fd, buf, 10) == 10, "write 10 bytes");
+  close (fd);
+  msg ("open \"plain-file\" with O_COMPRESS returns %d",
+       open_flags ("plain-file", O_COMPRESS));
+}
@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(open-compress) begin
+(open-compress) create "comp-file"
+(open-compress) open "comp-file" with O_COMPRESS
+(open-compress) write 65536 bytes
+(open-compress) fsync "comp-file"
+(open-compress) fewer than half as many sectors written
+(open-compress) write 100 bytes at 5000
+(open-compress) open "comp-file" for verification
+(open-compress) verified contents of "comp-file"
+(open-compress) close "comp-file"
+(open-compress) open "comp-file" with O_COMPRESS again
+(open-compress) create "plain-file"
+(open-compress) open "plain-file"
+(open-compress) write 10 bytes
+(open-compress) open "plain-file" with O_COMPRESS returns -1
+(open-compress) end
+open-compress: exit(0)
+EOF
+pass;
@@ -0,0 +1,49 @@
+/* Writes and reads a file opened with O_DIRECT, to and from
+   page-aligned buffers, and checks that what goes around the
+   buffer cache and what goes through it, by another descriptor or
+   by an unaligned read, agree. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE 8192
+
+static char wbuf[SIZE] __attribute__ ((aligned (4096)));
+static char rbuf[SIZE] __attribute__ ((aligned (4096)));
+
+void
+test_main (void) 
+{
+  int dfd, fd, i;
+
+  for (i = 0; i < SIZE; i++)
+    wbuf[i] = i * 7 % 251;
+  CHECK (create ("direct-file", 0), "create \"direct-file\"");
+  CHECK ((dfd = open_flags ("direct-file", O_DIRECT)) > 1,
+         "open \"direct-file\" with O_DIRECT");
+
+  /* A write may go straight to the disk only where the file has
+     its sectors already. */
+  CHECK (fallocate (dfd, SIZE) == 0, "fallocate %d bytes", SIZE);
+  CHECK (write (dfd, wbuf, SIZE) == SIZE, "write %d bytes directly", SIZE);
+  check_file ("direct-file", wbuf, SIZE);
+
+  CHECK ((fd = open ("direct-file")) > 1, "open \"direct-file\"");
+  memset (wbuf + 512, 'c', 512);
+  CHECK (pwrite (fd, wbuf + 512, 512, 512) == 512,
+         "write 512 bytes at 512 through the cache");
+  close (fd);
+  seek (dfd, 0);
+  CHECK (read (dfd, rbuf, SIZE) == SIZE, "read %d bytes directly", SIZE);
+  compare_bytes (rbuf, wbuf, SIZE, 0, "direct-file");
+
+  seek (dfd, 10);
+  CHECK (read (dfd, rbuf + 1, 100) == 100, "read 100 bytes, unaligned");
+  compare_bytes (rbuf + 1, wbuf + 10, 100, 10, "direct-file");
+  close (dfd);
+
+  msg ("open with unknown flags returns %d",
+       open_flags ("direct-file", 0x100));
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(open-direct) begin
+(open-direct) create "direct-file"
+(open-direct) open "direct-file" with O_DIRECT
+(open-direct) fallocate 8192 bytes
+(open-direct) write 8192 bytes directly
+(open-direct) open "direct-file" for verification
+(open-direct) verified contents of "direct-file"
+(open-direct) close "direct-file"
+(open-direct) open "direct-file"
+(open-direct) write 512 bytes at 512 through the cache
+(open-direct) read 8192 bytes directly
+(open-direct) read 100 bytes, unaligned
+(open-direct) open with unknown flags returns -1
+(open-direct) end
+open-direct: exit(0)
+EOF
+pass;
@@ -0,0 +1,49 @@
+/* Polls both ends of a pipe as data comes and goes, as a child
+   writes to it while the parent waits, and as its write end is
+   closed, and polls descriptors that are skipped or not open. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct pollfd pfd[2];
+  int fds[2], cnt, status;
+  pid_t pid;
+  char buf[5];
+
+  CHECK (pipe (fds) == 0, "pipe");
+  pfd[0].fd = fds[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = fds[1];
+  pfd[1].events = POLLOUT;
+  cnt = poll (pfd, 2, 0);
+  msg ("empty pipe: %d ready, read end 0x%x, write end 0x%x", cnt,
+       pfd[0].revents, pfd[1].revents);
+  cnt = poll (pfd, 1, 10);
+  msg ("read end after a 10 ms timeout: %d ready, 0x%x", cnt,
+       pfd[0].revents);
+
+  if ((pid = fork ("child")) == 0) {
+    write (fds[1], "hello", 5);
+    exit (0);
+  }
+  cnt = poll (pfd, 1, -1);
+  status = wait (pid);
+  msg ("after the child wrote: %d ready, read end 0x%x", cnt,
+       pfd[0].revents);
+  msg ("child exit status is %d", status);
+  CHECK (read (fds[0], buf, 5) == 5, "read 5 bytes");
+
+  close (fds[1]);
+  cnt = poll (pfd, 1, -1);
+  msg ("write end closed: %d ready, read end 0x%x", cnt, pfd[0].revents);
+
+  pfd[0].fd = -1;
+  pfd[1].fd = 99;
+  cnt = poll (pfd, 2, 0);
+  msg ("fd -1 and fd 99: %d ready, 0x%x and 0x%x", cnt,
+       pfd[0].revents, pfd[1].revents);
+}
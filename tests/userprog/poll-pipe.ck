@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(poll-pipe) begin
+(poll-pipe) pipe
+(poll-pipe) empty pipe: 1 ready, read end 0x0, write end 0x4
+(poll-pipe) read end after a 10 ms timeout: 0 ready, 0x0
+child: exit(0)
+(poll-pipe) after the child wrote: 1 ready, read end 0x1
+(poll-pipe) child exit status is 0
+(poll-pipe) read 5 bytes
+(poll-pipe) write end closed: 1 ready, read end 0x10
+(poll-pipe) fd -1 and fd 99: 1 ready, 0x0 and 0x20
+(poll-pipe) end
+poll-pipe: exit(0)
+EOF
+pass;
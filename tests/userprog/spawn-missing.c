@@ -0,0 +1,12 @@
+/* Tries to spawn a nonexistent process.
+   The spawn system call must return -1. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  msg ("spawn(\"no-such-file\"): %d", spawn ("no-such-file"));
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF', <<'EOF']);
+(spawn-missing) begin
+load: no-such-file: open failed
+(spawn-missing) spawn("no-such-file"): -1
+(spawn-missing) end
+EOF
+(spawn-missing) begin
+(spawn-missing) spawn("no-such-file"): -1
+(spawn-missing) end
+EOF
+pass;
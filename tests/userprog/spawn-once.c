@@ -0,0 +1,13 @@
+/* Spawns and waits for a single child process. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  pid_t pid = spawn ("child-simple");
+
+  msg ("wait(spawn()) = %d", wait (pid));
+}
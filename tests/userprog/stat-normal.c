@@ -0,0 +1,34 @@
+/* Checks what stat() and fstat() report about a file, the root
+   directory, a name that does not exist and descriptors that have
+   no file. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  struct stat st, fst;
+  int fd;
+
+  CHECK (create ("stat-file", 123), "create \"stat-file\"");
+  CHECK (stat ("stat-file", &st) == 0, "stat \"stat-file\"");
+  msg ("size %d, links %d, directory %d", st.st_size, st.st_nlink,
+       st.st_isdir);
+
+  CHECK ((fd = open ("stat-file")) > 1, "open \"stat-file\"");
+  CHECK (fstat (fd, &fst) == 0, "fstat \"stat-file\"");
+  CHECK (fst.st_ino == st.st_ino, "fstat and stat agree on the inode");
+  seek (fd, 123);
+  CHECK (write (fd, "0123456789", 10) == 10, "write 10 bytes at the end");
+  CHECK (fstat (fd, &fst) == 0, "fstat \"stat-file\"");
+  msg ("size %d", fst.st_size);
+  close (fd);
+
+  CHECK (stat ("/", &st) == 0, "stat \"/\"");
+  msg ("directory %d", st.st_isdir);
+  msg ("stat \"no-such-file\" returns %d", stat ("no-such-file", &st));
+  msg ("fstat of the console returns %d", fstat (0, &st));
+  msg ("fstat of a closed fd returns %d", fstat (fd, &st));
+}
@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(stat-normal) begin
+(stat-normal) create "stat-file"
+(stat-normal) stat "stat-file"
+(stat-normal) size 123, links 1, directory 0
+(stat-normal) open "stat-file"
+(stat-normal) fstat "stat-file"
+(stat-normal) fstat and stat agree on the inode
+(stat-normal) write 10 bytes at the end
+(stat-normal) fstat "stat-file"
+(stat-normal) size 133
+(stat-normal) stat "/"
+(stat-normal) directory 1
+(stat-normal) stat "no-such-file" returns -1
+(stat-normal) fstat of the console returns -1
+(stat-normal) fstat of a closed fd returns -1
+(stat-normal) end
+stat-normal: exit(0)
+EOF
+pass;
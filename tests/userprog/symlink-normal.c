@@ -0,0 +1,42 @@
+/* Makes symbolic links to a file, to a name not yet created and to
+   themselves, and checks what opening each of them finds. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static const char data[] = "linked data";
+
+void
+test_main (void) 
+{
+  char buf[sizeof data];
+  int fd;
+
+  CHECK (create ("target", 0), "create \"target\"");
+  CHECK ((fd = open ("target")) > 1, "open \"target\"");
+  CHECK (write (fd, data, sizeof data) == sizeof data, "write \"target\"");
+  close (fd);
+
+  CHECK (symlink ("target", "link") == 0, "symlink \"link\" to \"target\"");
+  CHECK ((fd = open ("link")) > 1, "open \"link\"");
+  CHECK (read (fd, buf, sizeof buf) == sizeof buf, "read \"link\"");
+  CHECK (!strcmp (buf, data), "\"link\" reads what \"target\" holds");
+  close (fd);
+
+  CHECK (symlink ("ghost", "dangling") == 0,
+         "symlink \"dangling\" to \"ghost\"");
+  msg ("open \"dangling\" returns %d", open ("dangling"));
+  CHECK (create ("ghost", 0), "create \"ghost\"");
+  CHECK ((fd = open ("dangling")) > 1, "open \"dangling\"");
+  close (fd);
+
+  CHECK (symlink ("loop", "loop") == 0, "symlink \"loop\" to itself");
+  msg ("open \"loop\" returns %d", open ("loop"));
+
+  CHECK (remove ("link"), "remove \"link\"");
+  msg ("open \"link\" returns %d", open ("link"));
+  CHECK ((fd = open ("target")) > 1, "open \"target\"");
+  close (fd);
+}
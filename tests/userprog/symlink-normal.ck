@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(symlink-normal) begin
+(symlink-normal) create "target"
+(symlink-normal) open "target"
+(symlink-normal) write "target"
+(symlink-normal) symlink "link" to "target"
+(symlink-normal) open "link"
+(symlink-normal) read "link"
+(symlink-normal) "link" reads what "target" holds
+(symlink-normal) symlink "dangling" to "ghost"
+(symlink-normal) open "dangling" returns -1
+(symlink-normal) create "ghost"
+(symlink-normal) open "dangling"
+(symlink-normal) symlink "loop" to itself
+(symlink-normal) open "loop" returns -1
+(symlink-normal) remove "link"
+(symlink-normal) open "link" returns -1
+(symlink-normal) open "target"
+(symlink-normal) end
+symlink-normal: exit(0)
+EOF
+pass;
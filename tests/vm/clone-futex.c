@@ -0,0 +1,39 @@
+/* Starts a thread with clone() that sleeps on a futex until the
+   main thread wakes it, then leaves a value behind.  The main
+   thread waits for the thread to end on the futex that clone()
+   clears, and checks what the thread left. */
+
+#include <syscall.h>
+#include <syscall-nr.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static volatile int go;
+static volatile int value;
+
+static void
+worker (void *arg) 
+{
+  while (go == 0)
+    futex ((int *) &go, FUTEX_WAIT, 0);
+  value = *(int *) arg;
+}
+
+void
+test_main (void) 
+{
+  static int arg = 42;
+  static volatile int ctid = 1;
+  int c;
+
+  CHECK (futex ((int *) &go, FUTEX_WAIT, 1) == -1,
+         "futex wait on a changed value fails");
+  CHECK (futex ((int *) &go, 7, 0) == -1, "unknown futex op fails");
+
+  CHECK (clone (worker, &arg, (int *) &ctid) > 0, "clone");
+  go = 1;
+  futex ((int *) &go, FUTEX_WAKE, 1);
+  while ((c = ctid) != 0)
+    futex ((int *) &ctid, FUTEX_WAIT, c);
+  msg ("thread left %d", value);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(clone-futex) begin
+(clone-futex) futex wait on a changed value fails
+(clone-futex) unknown futex op fails
+(clone-futex) clone
+(clone-futex) thread left 42
+(clone-futex) end
+clone-futex: exit(0)
+EOF
+pass;
@@ -0,0 +1,293 @@
+/* cpu.c: CPU enumeration.
+
+   cpu_init() asks the firmware which CPUs the machine has, first
+   through the ACPI MADT ("APIC" table), then through the older
+   Intel MultiProcessor Specification tables, and records each of
+   them in cpus[] by local APIC ID.  See [ACPI] section 5.2 and
+   [MPSPEC] chapter 4.
+
+   Pintos keeps running on the bootstrap processor alone: its
+   synchronization rests on turning interrupts off, which only
+   keeps out the CPU that does it, so the others are counted but
+   never started. */
+
+#include "threads/cpu.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/init.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+#include "devices/lapic.h"
+#include "intrinsic.h"
+
+struct cpu cpus[CPU_MAX];
+int cpu_cnt;
+
+/* ACPI root system description pointer. */
+struct rsdp {
+	char signature[8];                  /* "RSD PTR ". */
+	uint8_t checksum;
+	char oem_id[6];
+	uint8_t revision;
+	uint32_t rsdt;                      /* Physical address of the RSDT. */
+} __attribute__ ((packed));
+
+/* Header of an ACPI system description table. */
+struct sdt_header {
+	char signature[4];
+	uint32_t length;                    /* Including this header. */
+	uint8_t revision;
+	uint8_t checksum;
+	char oem_id[6];
+	char oem_table_id[8];
+	uint32_t oem_revision;
+	uint32_t creator_id;
+	uint32_t creator_revision;
+} __attribute__ ((packed));
+
+/* MADT, followed by variable-length entries. */
+struct madt {
+	struct sdt_header header;           /* Signature "APIC". */
+	uint32_t lapic_addr;
+	uint32_t flags;
+} __attribute__ ((packed));
+
+/* MADT processor local APIC entry. */
+#define MADT_LAPIC 0
+#define MADT_LAPIC_ENABLED 0x1
+struct madt_lapic {
+	uint8_t type, length;
+	uint8_t acpi_id;
+	uint8_t apic_id;
+	uint32_t flags;
+} __attribute__ ((packed));
+
+/* MP floating pointer structure. */
+struct mp_float {
+	char signature[4];                  /* "_MP_". */
+	uint32_t config;                    /* Physical address of the table. */
+	uint8_t length;                     /* In 16-byte units. */
+	uint8_t spec_rev;
+	uint8_t checksum;
+	uint8_t features[5];
+} __attribute__ ((packed));
+
+/* MP configuration table header, followed by its entries. */
+struct mp_config {
+	char signature[4];                  /* "PCMP". */
+	uint16_t length;                    /* Including this header. */
+	uint8_t spec_rev;
+	uint8_t checksum;
+	char oem_id[8];
+	char product_id[12];
+	uint32_t oem_table;
+	uint16_t oem_table_size;
+	uint16_t entry_cnt;
+	uint32_t lapic_addr;
+	uint16_t ext_length;
+	uint8_t ext_checksum;
+	uint8_t reserved;
+} __attribute__ ((packed));
+
+/* MP processor entry.  The other entries are 8 bytes long. */
+#define MP_PROCESSOR 0
+#define MP_PROCESSOR_ENABLED 0x1
+#define MP_PROCESSOR_BSP 0x2
+struct mp_processor {
+	uint8_t type;
+	uint8_t apic_id;
+	uint8_t apic_version;
+	uint8_t flags;
+	uint32_t signature;
+	uint32_t features;
+	uint8_t reserved[8];
+} __attribute__ ((packed));
+
+/* Returns a kernel virtual address for the SIZE bytes of physical
+   memory at PA, mapping pages that paging_init() left out, which
+   is where ACPI tables usually are, or a null pointer if that
+   fails. */
+static void *
+phys_map (uint64_t pa, size_t size) {
+	uint64_t page;
+
+	for (page = pa & ~PGMASK; page < pa + size; page += PGSIZE) {
+		uint64_t va = (uint64_t) ptov (page);
+		uint64_t *pte = pml4e_walk (base_pml4, va, 0);
+
+		if (pte != NULL && (*pte & PTE_P))
+			continue;
+		pte = pml4e_walk (base_pml4, va, 1);
+		if (pte == NULL)
+			return NULL;
+		*pte = page | PTE_P;
+		invlpg (va);
+	}
+	return ptov (pa);
+}
+
+/* Returns true if the SIZE bytes at P add up to 0, modulo 256. */
+static bool
+checksum_ok (const void *p, size_t size) {
+	const uint8_t *b = p;
+	uint8_t sum = 0;
+
+	while (size-- > 0)
+		sum += *b++;
+	return sum == 0;
+}
+
+/* Looks for the SIZE-byte structure that starts with SIGNATURE, on
+   a 16-byte boundary, in the LEN bytes of physical memory at PA.
+   Returns it or a null pointer if there is none. */
+static void *
+scan (uint64_t pa, size_t len, const char *signature, size_t size) {
+	const uint8_t *p = ptov (pa), *end = p + len;
+
+	for (; p + size <= end; p += 16)
+		if (!memcmp (p, signature, strlen (signature))
+				&& checksum_ok (p, size))
+			return (void *) p;
+	return NULL;
+}
+
+/* Looks for the SIZE-byte structure that starts with SIGNATURE
+   where the firmware may put it: in the first kB of the extended
+   BIOS data area, or in the BIOS ROM. */
+static void *
+scan_bios (const char *signature, size_t size) {
+	uint64_t ebda = *(uint16_t *) ptov (0x40e) << 4;
+	void *p = NULL;
+
+	if (ebda != 0)
+		p = scan (ebda, 1024, signature, size);
+	if (p == NULL)
+		p = scan (0xe0000, 0x20000, signature, size);
+	return p;
+}
+
+/* Adds the CPU whose local APIC ID is APIC_ID, which is the
+   bootstrap processor if BSP. */
+static void
+add_cpu (uint8_t apic_id, bool bsp) {
+	struct cpu *c;
+	int i;
+
+	for (i = 0; i < cpu_cnt; i++)
+		if (cpus[i].apic_id == apic_id)
+			return;
+	if (cpu_cnt >= CPU_MAX) {
+		printf ("cpu: ignoring CPU with APIC ID %d, only %d supported\n",
+				apic_id, CPU_MAX);
+		return;
+	}
+	c = &cpus[cpu_cnt++];
+	c->apic_id = apic_id;
+
+	/* Keep the bootstrap processor first. */
+	if (bsp && c != &cpus[0]) {
+		struct cpu tmp = *c;
+
+		*c = cpus[0];
+		cpus[0] = tmp;
+	}
+}
+
+/* Adds the CPUs in the ACPI MADT.  Returns false if there is none. */
+static bool
+parse_madt (uint8_t bsp_id) {
+	struct rsdp *rsdp = scan_bios ("RSD PTR ", sizeof *rsdp);
+	struct sdt_header *rsdt;
+	uint32_t *entries;
+	size_t i, n;
+
+	if (rsdp == NULL)
+		return false;
+	rsdt = phys_map (rsdp->rsdt, sizeof *rsdt);
+	if (rsdt == NULL || memcmp (rsdt->signature, "RSDT", 4)
+			|| phys_map (rsdp->rsdt, rsdt->length) == NULL
+			|| !checksum_ok (rsdt, rsdt->length))
+		return false;
+
+	entries = (uint32_t *) (rsdt + 1);
+	n = (rsdt->length - sizeof *rsdt) / sizeof *entries;
+	for (i = 0; i < n; i++) {
+		struct madt *madt = phys_map (entries[i], sizeof *madt);
+		const uint8_t *p, *end;
+
+		if (madt == NULL || memcmp (madt->header.signature, "APIC", 4)
+				|| phys_map (entries[i], madt->header.length) == NULL
+				|| !checksum_ok (madt, madt->header.length))
+			continue;
+
+		p = (const uint8_t *) (madt + 1);
+		end = (const uint8_t *) madt + madt->header.length;
+		for (; p + 2 <= end && p[1] >= 2; p += p[1]) {
+			const struct madt_lapic *e = (const void *) p;
+
+			if (e->type == MADT_LAPIC && e->length >= sizeof *e
+					&& (e->flags & MADT_LAPIC_ENABLED))
+				add_cpu (e->apic_id, e->apic_id == bsp_id);
+		}
+		return cpu_cnt > 0;
+	}
+	return false;
+}
+
+/* Adds the CPUs in the MP configuration table.  Returns false if
+   there is none. */
+static bool
+parse_mp (void) {
+	struct mp_float *mpf = scan_bios ("_MP_", sizeof *mpf);
+	struct mp_config *conf;
+	const uint8_t *p, *end;
+	int i;
+
+	if (mpf == NULL || mpf->config == 0)
+		return false;
+	conf = phys_map (mpf->config, sizeof *conf);
+	if (conf == NULL || memcmp (conf->signature, "PCMP", 4)
+			|| phys_map (mpf->config, conf->length) == NULL
+			|| !checksum_ok (conf, conf->length))
+		return false;
+
+	p = (const uint8_t *) (conf + 1);
+	end = (const uint8_t *) conf + conf->length;
+	for (i = 0; i < conf->entry_cnt && p < end; i++) {
+		if (*p == MP_PROCESSOR) {
+			const struct mp_processor *e = (const void *) p;
+
+			if (e->flags & MP_PROCESSOR_ENABLED)
+				add_cpu (e->apic_id, e->flags & MP_PROCESSOR_BSP);
+			p += sizeof *e;
+		} else
+			p += 8;
+	}
+	return cpu_cnt > 0;
+}
+
+/* Finds the machine's CPUs.  Must be called after lapic_init(). */
+void
+cpu_init (void) {
+	uint8_t bsp_id = lapic_id ();
+	const char *source = "ACPI";
+	int i;
+
+	if (!parse_madt (bsp_id)) {
+		cpu_cnt = 0;
+		source = "MP table";
+		if (!parse_mp ()) {
+			cpu_cnt = 0;
+			source = "default";
+			add_cpu (bsp_id, true);
+		}
+	}
+	for (i = 0; i < cpu_cnt; i++)
+		cpus[i].id = i;
+
+	printf ("cpu: %d CPU%s found (%s), using the bootstrap processor\n",
+			cpu_cnt, cpu_cnt != 1 ? "s" : "", source);
+}
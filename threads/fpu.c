@@ -0,0 +1,205 @@
+/* fpu.c: x87 and SSE register state.
+ *
+ * The kernel is built without floating point, so it touches these
+ * registers only between kernel_fpu_begin() and kernel_fpu_end().
+ * Threads' own state is switched lazily.  The registers hold the
+ * state of FPU_OWNER, and CR0.TS is set whenever another thread
+ * runs, so that its first FPU instruction raises #NM.  The handler
+ * saves the owner's state with FXSAVE, loads the running thread's
+ * with FXRSTOR and makes it the owner.  A thread that never uses
+ * the FPU costs nothing, and one that runs alone keeps the
+ * registers across switches.
+ *
+ * kernel_fpu_begin() saves the owner's state, if any, and hands the
+ * registers to the kernel with interrupts off.  After
+ * kernel_fpu_end() the owner reloads its state at its next FPU
+ * instruction. */
+
+#include "threads/fpu.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "intrinsic.h"
+#include "threads/interrupt.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+
+#define CR0_MP (1 << 1)             /* WAIT obeys TS. */
+#define CR0_EM (1 << 2)             /* No FPU: emulate it. */
+#define CR0_TS (1 << 3)             /* Task switched: FPU use raises #NM. */
+#define CR4_OSFXSR (1 << 9)         /* FXSAVE, FXRSTOR and SSE enabled. */
+
+#define CPUID_1_EDX_FXSR (1 << 24)
+#define CPUID_1_EDX_SSE2 (1 << 26)
+
+/* MXCSR with every SSE exception masked, as at reset. */
+#define MXCSR_DEFAULT 0x1f80
+
+/* Saved FPU state of a thread, in the FXSAVE format. */
+struct fpu_area {
+	uint8_t regs[512];
+} __attribute__ ((aligned (16)));
+
+static bool fpu_enabled;            /* FXSR and SSE2 turned on? */
+static bool ts_set;                 /* CR0.TS set? */
+static struct thread *fpu_owner;    /* Thread whose state is loaded. */
+static struct kmem_cache *fpu_cache; /* Allocates struct fpu_area. */
+static struct fpu_area fpu_initial; /* State a thread starts with. */
+
+static int kernel_depth;            /* Nesting of kernel_fpu_begin(). */
+static enum intr_level kernel_level; /* Level before the outermost. */
+
+static void fpu_fault (struct intr_frame *);
+
+static inline void
+fxsave (struct fpu_area *area) {
+	asm volatile ("fxsave %0" : "=m" (*area));
+}
+
+static inline void
+fxrstor (const struct fpu_area *area) {
+	asm volatile ("fxrstor %0" : : "m" (*area));
+}
+
+/* Sets CR0.TS if ON, clears it otherwise, if it is not so already:
+ * writing CR0 serializes the CPU. */
+static void
+set_ts (bool on) {
+	uint64_t cr0;
+
+	if (ts_set == on)
+		return;
+	cr0 = rcr0 ();
+	lcr0 (on ? cr0 | CR0_TS : cr0 & ~CR0_TS);
+	ts_set = on;
+}
+
+/* Turns on FXSAVE and SSE if the CPU has them, with CR0.TS set, and
+ * takes over #NM. */
+void
+fpu_init (void) {
+	uint32_t ecx, edx, mxcsr = MXCSR_DEFAULT;
+
+	intr_register_int (7, 0, INTR_OFF, fpu_fault,
+			"#NM Device Not Available Exception");
+
+	cpuid (1, &ecx, &edx);
+	if (!(edx & CPUID_1_EDX_FXSR) || !(edx & CPUID_1_EDX_SSE2))
+		return;
+	fpu_cache = kmem_cache_create ("fpu_area", sizeof (struct fpu_area),
+			16, NULL);
+	if (fpu_cache == NULL)
+		return;
+
+	lcr0 ((rcr0 () & ~(CR0_EM | CR0_TS)) | CR0_MP);
+	lcr4 (rcr4 () | CR4_OSFXSR);
+	asm volatile ("fninit; ldmxcsr %0" : : "m" (mxcsr));
+	fxsave (&fpu_initial);
+	ts_set = false;
+	set_ts (true);
+	fpu_enabled = true;
+}
+
+/* Returns true if kernel_fpu_begin() may be used for SSE2. */
+bool
+fpu_has_sse2 (void) {
+	return fpu_enabled;
+}
+
+/* Called by the scheduler, with interrupts off, as NEXT is about to
+ * run: NEXT finds its state in the registers only if it owns them. */
+void
+fpu_switch (struct thread *next) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (kernel_depth == 0);
+
+	if (fpu_enabled)
+		set_ts (next != fpu_owner);
+}
+
+/* Frees the FPU state of the running thread, which is exiting. */
+void
+fpu_exit (void) {
+	struct thread *t = thread_current ();
+	struct fpu_area *area = t->fpu;
+	enum intr_level old_level;
+
+	if (area == NULL)
+		return;
+	old_level = intr_disable ();
+	if (fpu_owner == t)
+		fpu_owner = NULL;
+	t->fpu = NULL;
+	intr_set_level (old_level);
+	kmem_cache_free (fpu_cache, area);
+}
+
+/* Hands the FPU and SSE registers to the kernel until the matching
+ * kernel_fpu_end(), with interrupts off.  Calls nest.  Must not be
+ * called unless fpu_has_sse2(). */
+void
+kernel_fpu_begin (void) {
+	enum intr_level old_level = intr_disable ();
+
+	ASSERT (fpu_enabled);
+
+	if (kernel_depth++ > 0)
+		return;
+	kernel_level = old_level;
+	set_ts (false);
+	if (fpu_owner != NULL) {
+		fxsave (fpu_owner->fpu);
+		fpu_owner = NULL;
+	}
+}
+
+/* Ends the use of the registers begun by kernel_fpu_begin(). */
+void
+kernel_fpu_end (void) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (kernel_depth > 0);
+
+	if (--kernel_depth > 0)
+		return;
+	set_ts (true);
+	intr_set_level (kernel_level);
+}
+
+/* #NM handler: a user thread used the FPU for the first time since
+ * another thread did.  Saves the owner's state and loads the
+ * thread's own, which starts as FPU_INITIAL. */
+static void
+fpu_fault (struct intr_frame *f) {
+	struct thread *t = thread_current ();
+
+	if (!fpu_enabled || (f->cs & 3) == 0) {
+		intr_dump_frame (f);
+		PANIC ("FPU used by the kernel outside kernel_fpu_begin()");
+	}
+
+	if (t->fpu == NULL) {
+		struct fpu_area *area;
+
+		/* Allocation may sleep.  Whatever runs meanwhile leaves
+		 * CR0.TS set for us, since we own nothing. */
+		intr_enable ();
+		area = kmem_cache_alloc (fpu_cache);
+		if (area == NULL) {
+			printf ("%s: dying due to interrupt %#04llx (%s).\n",
+					thread_name (), f->vec_no, intr_name (f->vec_no));
+			thread_exit ();
+		}
+		intr_disable ();
+		memcpy (area, &fpu_initial, sizeof *area);
+		t->fpu = area;
+	}
+
+	set_ts (false);
+	if (fpu_owner != t) {
+		if (fpu_owner != NULL)
+			fxsave (fpu_owner->fpu);
+		fxrstor (t->fpu);
+		fpu_owner = t;
+	}
+}
@@ -9,34 +9,54 @@
 #include <stdlib.h>
 #include <string.h>
 #include "devices/kbd.h"
+#include "devices/lapic.h"
 #include "devices/input.h"
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "devices/vga.h"
+#include "threads/cpu.h"
+#include "threads/fpu.h"
+#include "threads/instrument.h"
 #include "threads/interrupt.h"
+#include "threads/intr-stats.h"
 #include "threads/io.h"
 #include "threads/loader.h"
+#include "threads/lock-stats.h"
 #include "threads/malloc.h"
 #include "threads/mmu.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #include "threads/synch.h"
+#include "threads/vmalloc.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
+#include "userprog/ioring.h"
+#include "userprog/reaper.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
+#include "userprog/vdso.h"
 #endif
 #include "tests/threads/tests.h"
+#include "intrinsic.h"
 #ifdef VM
+#include "vm/prefetch.h"
+#include "vm/zswap.h"
 #include "vm/vm.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "filesys/cache.h"
+#include "filesys/defrag.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
 #endif
 
 /* Page-map-level-4 with kernel mappings only. */
@@ -62,6 +82,18 @@ static void usage (void);
 
 static void print_stats (void);
 
+/* Boot phases, each with the TSC when it ended. */
+#define BOOT_PHASE_MAX 8
+static struct boot_phase {
+	const char *name;
+	uint64_t tsc;
+} boot_phases[BOOT_PHASE_MAX];
+static int boot_phase_cnt;
+static uint64_t boot_tsc;
+
+static void boot_phase (const char *name);
+static void print_boot_phases (void);
+
 
 int main (void) NO_RETURN;
 
@@ -73,6 +105,7 @@ main (void) {
 
 	/* Clear BSS and get machine's RAM size. */
 	bss_init ();
+	boot_tsc = rdtsc ();
 
 	/* Break command line into arguments and parse options. */
 	argv = read_command_line ();
@@ -87,6 +120,8 @@ main (void) {
 	mem_end = palloc_init ();
 	malloc_init ();
 	paging_init (mem_end);
+	vmalloc_init (mem_end);
+	boot_phase ("memory");
 
 #ifdef USERPROG
 	tss_init ();
@@ -95,29 +130,52 @@ main (void) {
 
 	/* Initialize interrupt handlers. */
 	intr_init ();
+	lapic_init ();
+	cpu_init ();
+	fpu_init ();
+	register_palloc_inspect_intr ();
+	register_malloc_inspect_intr ();
 	timer_init ();
+	profile_init ();
+	trace_init ();
+	counters_init ();
 	kbd_init ();
 	input_init ();
 #ifdef USERPROG
 	exception_init ();
 	syscall_init ();
+	process_subsystem_init ();
 #endif
+	boot_phase ("interrupts");
 	/* Start thread scheduler and enable interrupts. */
 	thread_start ();
+	workqueue_init ();
 	serial_init_queue ();
+	console_start_klog ();
 	timer_calibrate ();
+#ifdef USERPROG
+	vdso_init ();
+	ioring_init ();
+	reaper_init ();
+#endif
+	palloc_start_zeroer ();
+	pml4_start_cache ();
+	boot_phase ("threads");
 
 #ifdef FILESYS
 	/* Initialize file system. */
 	disk_init ();
 	filesys_init (format_filesys);
+	boot_phase ("filesys");
 #endif
 
 #ifdef VM
 	vm_init ();
+	boot_phase ("vm");
 #endif
 
 	printf ("Boot complete.\n");
+	print_boot_phases ();
 
 	/* Run actions specified on kernel command line. */
 	run_actions (argv);
@@ -128,6 +186,35 @@ main (void) {
 	thread_exit ();
 }
 
+/* Records that boot phase NAME is over. */
+static void
+boot_phase (const char *name) {
+	ASSERT (boot_phase_cnt < BOOT_PHASE_MAX);
+	boot_phases[boot_phase_cnt].name = name;
+	boot_phases[boot_phase_cnt].tsc = rdtsc ();
+	boot_phase_cnt++;
+}
+
+/* Prints how long each boot phase took. */
+static void
+print_boot_phases (void) {
+	uint64_t hz = timer_tsc_hz (), prev = boot_tsc;
+	int i;
+
+	printf ("Boot phases:");
+	for (i = 0; i < boot_phase_cnt; i++) {
+		uint64_t cycles = boot_phases[i].tsc - prev;
+
+		if (hz != 0)
+			printf (" %s %llu us", boot_phases[i].name,
+					cycles * 1000000 / hz);
+		else
+			printf (" %s %llu cycles", boot_phases[i].name, cycles);
+		prev = boot_phases[i].tsc;
+	}
+	printf ("\n");
+}
+
 /* Clear BSS */
 static void
 bss_init (void) {
@@ -151,11 +238,27 @@ paging_init (uint64_t mem_end) {
 	pml4 = base_pml4 = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 
 	extern char start, _end_kernel_text;
+
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
 	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
 		uint64_t va = (uint64_t) ptov(pa);
 
+		/* Whole 2 MB chunks get a single PDE, which saves the page
+		 * tables and TLB entries.  Kernel text keeps 4 kB pages to be
+		 * read-only, and so do user frames, whose kernel alias has
+		 * its accessed bit checked page by page. */
+		if (pa % HUGE_PGSIZE == 0 && pa + HUGE_PGSIZE <= mem_end
+				&& (va + HUGE_PGSIZE <= (uint64_t) &start
+					|| va >= (uint64_t) &_end_kernel_text)
+				&& !palloc_user_overlaps ((void *) va,
+					(void *) (va + HUGE_PGSIZE))) {
+			if ((pte = pml4e_walk_pde (pml4, va, 1)) != NULL)
+				*pte = pa | PTE_P | PTE_W | PTE_PS;
+			pa += HUGE_PGSIZE - PGSIZE;
+			continue;
+		}
+
 		perm = PTE_P | PTE_W;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
@@ -166,6 +269,7 @@ paging_init (uint64_t mem_end) {
 
 	// reload cr3
 	pml4_activate(0);
+	pml4_init_pcid ();
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -217,16 +321,105 @@ parse_options (char **argv) {
 #ifdef FILESYS
 		else if (!strcmp (name, "-f"))
 			format_filesys = true;
+		else if (!strcmp (name, "-cksum"))
+			inode_checksums = true;
+		else if (!strcmp (name, "-disk-poll"))
+			disk_poll_us = atoi (value);
+		else if (!strcmp (name, "-defrag"))
+			defrag_enabled = true;
+		else if (!strcmp (name, "-lfs"))
+			inode_log_writes = defrag_enabled = true;
+		else if (!strcmp (name, "-jcrash"))
+			journal_crash = true;
 #endif
 		else if (!strcmp (name, "-rs"))
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-tickless"))
+			timer_tickless = true;
+		else if (!strcmp (name, "-timer")) {
+			if (value != NULL && !strcmp (value, "apic"))
+				timer_use_apic = true;
+			else if (value != NULL && !strcmp (value, "pit"))
+				timer_use_apic = false;
+			else
+				PANIC ("unknown timer `%s' (use -h for help)",
+						value != NULL ? value : "");
+		}
+		else if (!strcmp (name, "-profile"))
+			profile_hz = value != NULL ? atoi (value) : TIMER_FREQ;
+		else if (!strcmp (name, "-trace"))
+			trace_pages = value != NULL ? atoi (value) : TRACE_DEFAULT_PAGES;
+		else if (!strcmp (name, "-counters"))
+			counters_enabled = true;
+		else if (!strcmp (name, "-no-vga"))
+			console_vga = false;
+		else if (!strcmp (name, "-klog"))
+			console_klog = true;
+		else if (!strcmp (name, "-palloc")) {
+			if (value != NULL && !strcmp (value, "buddy"))
+				palloc_buddy = true;
+			else if (value != NULL && !strcmp (value, "bitmap"))
+				palloc_buddy = false;
+			else
+				PANIC ("unknown page allocator `%s' (use -h for help)",
+						value != NULL ? value : "");
+		}
+		else if (!strcmp (name, "-sched")) {
+			if (value != NULL && !strcmp (value, "priority"))
+				thread_fair = thread_fair_group = false;
+			else if (value != NULL && !strcmp (value, "fair"))
+				thread_fair = true;
+			else if (value != NULL && !strcmp (value, "fair-group"))
+				thread_fair = thread_fair_group = true;
+			else
+				PANIC ("unknown scheduler `%s' (use -h for help)",
+						value != NULL ? value : "");
+		}
+		else if (!strcmp (name, "-slice")) {
+			if (value != NULL && !strcmp (value, "adaptive"))
+				thread_adaptive_slice = true;
+			else if (value != NULL && !strcmp (value, "fixed"))
+				thread_adaptive_slice = false;
+			else
+				PANIC ("unknown time slice policy `%s' (use -h for help)",
+						value != NULL ? value : "");
+		}
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
+		else if (!strcmp (name, "-no-borrow"))
+			palloc_borrow = false;
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-fa"))
+			fault_around_pages = atoi (value) > 0 ? atoi (value) : 1;
+		else if (!strcmp (name, "-prefetch"))
+			prefetch_enabled = true;
+		else if (!strcmp (name, "-no-huge"))
+			huge_pages = false;
+		else if (!strcmp (name, "-stack"))
+			stack_limit = atoi (value) > 0 ? (size_t) atoi (value) * 1024
+				: stack_limit;
+		else if (!strcmp (name, "-rss-soft"))
+			rss_soft_limit = atoi (value);
+		else if (!strcmp (name, "-rss-hard"))
+			rss_hard_limit = atoi (value);
+		else if (!strcmp (name, "-swap"))
+			swap_disks = value != NULL ? value : "";
+		else if (!strcmp (name, "-no-zswap"))
+			zswap_enabled = false;
+		else if (!strcmp (name, "-zswap"))
+			zswap_max_kb = atoi (value);
+		else if (!strcmp (name, "-no-ksm"))
+			ksm_enabled = false;
+		else if (!strcmp (name, "-no-kswapd"))
+			kswapd_enabled = false;
+		else if (!strcmp (name, "-kswapd-low"))
+			reclaim_low_pages = atoi (value);
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -325,10 +518,43 @@ usage (void) {
 			"  -h                 Print this help message and power off.\n"
 			"  -q                 Power off VM after actions or on panic.\n"
 			"  -f                 Format file system disk during startup.\n"
+#ifdef FILESYS
+			"  -cksum             Write inodes with CRC-32C checksums.\n"
+			"  -disk-poll=US      Poll up to US us for disk interrupts (default 50).\n"
+			"  -defrag            Move fragmented files into one run in the background.\n"
+			"  -lfs               Write file data log-structured, with -defrag.\n"
+			"  -jcrash            Power off with the last commit in the journal only.\n"
+#endif
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -tickless          Stop the timer tick while the CPU is idle.\n"
+			"  -profile[=RATE]    Sample where time goes, RATE times a second.\n"
+			"  -trace[=PAGES]     Record kernel events in a ring of PAGES pages.\n"
+			"  -timer=TIMER       Tick from TIMER: pit (default) or apic.\n"
+			"  -counters          Count events, printing the counts at power off.\n"
+			"  -no-vga            Write console output to the serial port only.\n"
+			"  -klog              Buffer console output in the kernel log ring.\n"
+			"  -sched=POLICY      Scheduler POLICY: priority (default), fair,\n"
+			"                     or fair-group to share fairly by process.\n"
+			"  -slice=POLICY      Time slice POLICY: fixed (default) or adaptive.\n"
+			"  -palloc=BACKEND    Page allocator BACKEND: bitmap (default) or buddy.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+			"  -no-borrow         Keep kernel and user pages in their own pools.\n"
+#endif
+#ifdef VM
+			"  -fa=PAGES          Map up to PAGES file pages per fault (default 8).\n"
+			"  -prefetch          Prefetch program text at load, sized per program.\n"
+			"  -no-huge           Map user memory with 4 kB pages only.\n"
+			"  -stack=KB          Limit user stacks to KB kB (default 1024).\n"
+			"  -rss-soft=PAGES    Past PAGES resident, evict own pages first.\n"
+			"  -rss-hard=PAGES    Keep each process to PAGES resident.\n"
+			"  -swap=DISK,...     Swap to DISKs, each hdC:D[:PRIO] (default hd1:1).\n"
+			"  -no-zswap          Write every swapped-out page to the swap disk.\n"
+			"  -zswap=KB          Keep up to KB kB of compressed swapped-out pages.\n"
+			"  -no-ksm            Do not merge identical anonymous pages.\n"
+			"  -no-kswapd         Evict only when a fault finds no free frame.\n"
+			"  -kswapd-low=PAGES  Reclaim in the background below PAGES free.\n"
 #endif
 			);
 	power_off ();
@@ -344,8 +570,11 @@ power_off (void) {
 #endif
 
 	print_stats ();
+	profile_dump ();
+	trace_dump ();
 
 	printf ("Powering off...\n");
+	console_flush ();
 	outw (0x604, 0x2000);               /* Poweroff command for qemu */
 	for (;;);
 }
@@ -355,12 +584,25 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	lock_stats_print ();
+	intr_stats_print ();
+	counters_print ();
+	palloc_print_stats ();
+	malloc_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
+	cache_print_stats ();
+	journal_print_stats ();
+	defrag_print_stats ();
 #endif
 	console_print_stats ();
 	kbd_print_stats ();
 #ifdef USERPROG
 	exception_print_stats ();
+	syscall_print_stats ();
+#endif
+#ifdef VM
+	ksm_print_stats ();
+	zswap_print_stats ();
 #endif
 }
@@ -0,0 +1,96 @@
+#include "threads/instrument.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "intrinsic.h"
+
+/* A branch on a static key, in the __jump_table section. */
+struct jump_entry {
+	uint64_t code;                  /* Address of the 5-byte no-op. */
+	uint64_t target;                /* Where the branch jumps. */
+	struct static_key *key;         /* Key it depends on. */
+};
+
+/* Bounds of the __jump_table and __counters sections, from the
+   linker script. */
+extern struct jump_entry _start_jump_table[], _end_jump_table[];
+extern struct counter _start_counters[], _end_counters[];
+
+/* The no-op of an off branch, and the opcode of the jump of an on
+   one, which is followed by a 32-bit displacement. */
+static const uint8_t branch_nop[5] = { 0x0f, 0x1f, 0x44, 0x00, 0x00 };
+#define JMP_REL32 0xe9
+
+/* Write Protect bit of CR0: lets kernel text stay read-only even to
+   the kernel. */
+#define CR0_WP (1 << 16)
+
+bool counters_enabled;
+DEFINE_STATIC_KEY (counters_key);
+
+/* Rewrites every branch on KEY to jump, if ON, or else to fall
+   through.  Kernel text is mapped read-only, so it is written with
+   CR0.WP clear, and with interrupts off, so that no interrupt
+   handler runs a branch halfway rewritten.  Pintos has a single
+   CPU, which executes the new instructions once it has jumped past
+   the writes. */
+static void
+patch_branches (struct static_key *key, bool on) {
+	enum intr_level old_level;
+	struct jump_entry *e;
+	uint64_t cr0;
+
+	old_level = intr_disable ();
+	cr0 = rcr0 ();
+	lcr0 (cr0 & ~(uint64_t) CR0_WP);
+	for (e = _start_jump_table; e < _end_jump_table; e++) {
+		uint8_t *code = (uint8_t *) e->code;
+
+		if (e->key != key)
+			continue;
+		if (on) {
+			int32_t disp = e->target - (e->code + sizeof branch_nop);
+
+			code[0] = JMP_REL32;
+			memcpy (code + 1, &disp, sizeof disp);
+		} else
+			memcpy (code, branch_nop, sizeof branch_nop);
+	}
+	lcr0 (cr0);
+	key->enabled = on;
+	intr_set_level (old_level);
+}
+
+/* Turns KEY on, making its branches jump. */
+void
+static_key_enable (struct static_key *key) {
+	if (!key->enabled)
+		patch_branches (key, true);
+}
+
+/* Turns KEY off again. */
+void
+static_key_disable (struct static_key *key) {
+	if (key->enabled)
+		patch_branches (key, false);
+}
+
+/* Starts counting if "-counters" asked for it. */
+void
+counters_init (void) {
+	if (counters_enabled)
+		static_key_enable (&counters_key);
+}
+
+/* Prints every counter, if counting was on. */
+void
+counters_print (void) {
+	struct counter *c;
+
+	if (!counters_key.enabled)
+		return;
+	printf ("Counters:\n");
+	for (c = _start_counters; c < _end_counters; c++)
+		printf ("  %-24s %llu\n", c->name, (unsigned long long) c->value);
+}
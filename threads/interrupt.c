@@ -4,15 +4,18 @@
 #include <stdint.h>
 #include <stdio.h>
 #include "threads/flags.h"
+#include "threads/intr-stats.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
+#include "devices/lapic.h"
 #include "devices/timer.h"
 #include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/gdt.h"
+#include "userprog/process.h"
 #endif
 
 /* Number of x86_64 interrupts. */
@@ -103,6 +106,17 @@ static const char *intr_names[INTR_CNT];
 static bool in_external_intr;   /* Are we processing an external interrupt? */
 static bool yield_on_return;    /* Should we yield on interrupt return? */
 
+/* Interrupts-off window opened by intr_disable(): the TSC when it
+   opened, or 0 if none is open, and the return address of the
+   call.  A window the CPU reopened interrupts in behind our back,
+   by returning from an interrupt for example, is abandoned when the
+   next interrupt arrives with interrupts on. */
+static uint64_t off_stamp;
+static uintptr_t off_site;
+
+static enum intr_level enable_at (uintptr_t site);
+static enum intr_level disable_at (uintptr_t site);
+
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
 static void pic_end_of_interrupt (int irq);
@@ -128,15 +142,36 @@ intr_get_level (void) {
    returns the previous interrupt status. */
 enum intr_level
 intr_set_level (enum intr_level level) {
-	return level == INTR_ON ? intr_enable () : intr_disable ();
+	uintptr_t site = (uintptr_t) __builtin_return_address (0);
+
+	return level == INTR_ON ? enable_at (site) : disable_at (site);
 }
 
 /* Enables interrupts and returns the previous interrupt status. */
 enum intr_level
 intr_enable (void) {
+	return enable_at ((uintptr_t) __builtin_return_address (0));
+}
+
+/* Disables interrupts and returns the previous interrupt status. */
+enum intr_level
+intr_disable (void) {
+	return disable_at ((uintptr_t) __builtin_return_address (0));
+}
+
+/* Enables interrupts for a call that returns to SITE, closing the
+   interrupts-off window, and returns the previous interrupt
+   status. */
+static enum intr_level
+enable_at (uintptr_t site) {
 	enum intr_level old_level = intr_get_level ();
 	ASSERT (!intr_context ());
 
+	if (old_level == INTR_OFF && off_stamp != 0) {
+		intr_stats_off (off_site, site, rdtsc () - off_stamp);
+		off_stamp = 0;
+	}
+
 	/* Enable interrupts by setting the interrupt flag.
 
 	   See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -146,9 +181,11 @@ intr_enable (void) {
 	return old_level;
 }
 
-/* Disables interrupts and returns the previous interrupt status. */
-enum intr_level
-intr_disable (void) {
+/* Disables interrupts for a call that returns to SITE, opening an
+   interrupts-off window if they were on, and returns the previous
+   interrupt status. */
+static enum intr_level
+disable_at (uintptr_t site) {
 	enum intr_level old_level = intr_get_level ();
 
 	/* Disable interrupts by clearing the interrupt flag.
@@ -156,6 +193,10 @@ intr_disable (void) {
 	   Hardware Interrupts". */
 	asm volatile ("cli" : : : "memory");
 
+	if (old_level == INTR_ON) {
+		off_stamp = rdtsc ();
+		off_site = site;
+	}
 	return old_level;
 }
 
@@ -219,6 +260,14 @@ register_handler (uint8_t vec_no, int dpl, enum intr_level level,
 	}
 	intr_handlers[vec_no] = handler;
 	intr_names[vec_no] = name;
+	intr_stats_register (vec_no);
+}
+
+/* Returns true if VEC_NO is an external interrupt: one of the
+   PICs' or the local APIC's. */
+static bool
+is_external (uint64_t vec_no) {
+	return (vec_no >= 0x20 && vec_no <= 0x2f) || vec_no >= LAPIC_TIMER_VEC;
 }
 
 /* Registers external interrupt VEC_NO to invoke HANDLER, which
@@ -227,7 +276,7 @@ register_handler (uint8_t vec_no, int dpl, enum intr_level level,
 void
 intr_register_ext (uint8_t vec_no, intr_handler_func *handler,
 		const char *name) {
-	ASSERT (vec_no >= 0x20 && vec_no <= 0x2f);
+	ASSERT (is_external (vec_no));
 	register_handler (vec_no, 0, INTR_OFF, handler, name);
 }
 
@@ -248,7 +297,7 @@ void
 intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
 		intr_handler_func *handler, const char *name)
 {
-	ASSERT (vec_no < 0x20 || vec_no > 0x2f);
+	ASSERT (!is_external (vec_no));
 	register_handler (vec_no, dpl, level, handler, name);
 }
 
@@ -332,12 +381,16 @@ void
 intr_handler (struct intr_frame *frame) {
 	bool external;
 	intr_handler_func *handler;
+	uint64_t start;
+
+	if (frame->eflags & FLAG_IF)
+		off_stamp = 0;
 
 	/* External interrupts are special.
 	   We only handle one at a time (so interrupts must be off)
 	   and they need to be acknowledged on the PIC (see below).
 	   An external interrupt handler cannot sleep. */
-	external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
+	external = is_external (frame->vec_no);
 	if (external) {
 		ASSERT (intr_get_level () == INTR_OFF);
 		ASSERT (!intr_context ());
@@ -348,6 +401,7 @@ intr_handler (struct intr_frame *frame) {
 
 	/* Invoke the interrupt's handler. */
 	handler = intr_handlers[frame->vec_no];
+	start = rdtsc ();
 	if (handler != NULL)
 		handler (frame);
 	else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f) {
@@ -360,6 +414,7 @@ intr_handler (struct intr_frame *frame) {
 		intr_dump_frame (frame);
 		PANIC ("Unexpected interrupt");
 	}
+	intr_stats_handler (frame->vec_no, rdtsc () - start);
 
 	/* Complete the processing of an external interrupt. */
 	if (external) {
@@ -367,10 +422,19 @@ intr_handler (struct intr_frame *frame) {
 		ASSERT (intr_context ());
 
 		in_external_intr = false;
-		pic_end_of_interrupt (frame->vec_no);
+		if (frame->vec_no < 0x30)
+			pic_end_of_interrupt (frame->vec_no);
+		else if (frame->vec_no != LAPIC_SPURIOUS_VEC)
+			lapic_eoi ();
 
 		if (yield_on_return)
 			thread_yield ();
+#ifdef USERPROG
+		/* A thread of an exiting process does not go back to user
+		   mode, even if it never makes a system call. */
+		if (frame->cs == SEL_UCSEG)
+			process_check_exit ();
+#endif
 	}
 }
 
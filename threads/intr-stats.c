@@ -0,0 +1,186 @@
+/* intr-stats.c: Interrupt handler latency and interrupts-off
+   statistics.
+
+   intr_handler() times every handler it invokes with the TSC, and
+   each vector counts its invocations.  Vectors that have a handler
+   registered also get a log2 histogram of handler times.  Times
+   are wall-clock, so a handler that blocks, as the page fault
+   handler may, includes the time it was blocked, and a handler
+   that runs with interrupts on includes any interrupts nested in
+   it.
+
+   intr_disable() and intr_enable() time each window during which
+   interrupts stay off, from the call that turned them off to the
+   one that turned them back on, even across a thread switch.
+   Windows that the CPU opens itself, on entry to an interrupt gate
+   or a system call, are not counted here: they are the handlers'
+   own time.  The INTR_OFF_SITES worst pairs of call sites are kept
+   with their return addresses, which can be looked up with
+   backtrace. */
+
+#include "threads/intr-stats.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include "threads/flags.h"
+#include "threads/interrupt.h"
+#include "intrinsic.h"
+
+/* Number of handlers that get a histogram. */
+#define HIST_SLOTS 32
+
+/* A log2 latency histogram. */
+struct intr_hist {
+	uint64_t buckets[INTR_HIST_BUCKETS];
+};
+
+/* Statistics of one interrupt vector. */
+struct intr_vec_stats {
+	uint64_t count;                     /* Number of invocations. */
+	uint64_t total;                     /* Sum of handler times. */
+	uint64_t max;                       /* Longest handler time. */
+	struct intr_hist *hist;             /* Histogram, or null. */
+};
+
+/* A pair of call sites that kept interrupts off. */
+struct intr_off_site {
+	uintptr_t disable_site;             /* Return address of intr_disable(). */
+	uintptr_t enable_site;              /* Return address of intr_enable(). */
+	uint64_t count;                     /* Number of windows. */
+	uint64_t max;                       /* Longest window. */
+};
+
+static struct intr_vec_stats vec_stats[256];
+static struct intr_hist hists[HIST_SLOTS];
+static int hist_cnt;                    /* Elements of HISTS in use. */
+
+static uint64_t off_count;              /* Interrupts-off windows. */
+static uint64_t off_total;              /* Sum of their lengths. */
+static uint64_t off_max;                /* Longest. */
+static struct intr_hist off_hist;       /* Their lengths. */
+static struct intr_off_site off_sites[INTR_OFF_SITES];
+
+/* Adds a sample of CYCLES to HIST. */
+static void
+hist_add (struct intr_hist *hist, uint64_t cycles) {
+	int bucket = cycles == 0 ? 0 : 64 - __builtin_clzll (cycles);
+
+	if (bucket >= INTR_HIST_BUCKETS)
+		bucket = INTR_HIST_BUCKETS - 1;
+	hist->buckets[bucket]++;
+}
+
+/* Prints the nonempty buckets of HIST on one line. */
+static void
+hist_print (const struct intr_hist *hist) {
+	int i;
+
+	printf ("   ");
+	for (i = 0; i < INTR_HIST_BUCKETS; i++)
+		if (hist->buckets[i] != 0)
+			printf (" <2^%d:%llu", i, hist->buckets[i]);
+	printf ("\n");
+}
+
+/* Gives vector VEC, whose handler is being registered, a
+   histogram, if any is left. */
+void
+intr_stats_register (uint8_t vec) {
+	if (vec_stats[vec].hist == NULL && hist_cnt < HIST_SLOTS)
+		vec_stats[vec].hist = &hists[hist_cnt++];
+}
+
+/* Accounts for the handler of vector VEC having run for CYCLES.
+   May be called with interrupts on. */
+void
+intr_stats_handler (uint8_t vec, uint64_t cycles) {
+	struct intr_vec_stats *s = &vec_stats[vec];
+	uint64_t flags = read_eflags ();
+
+	/* Not intr_disable(), which would count this as a window. */
+	asm volatile ("cli" : : : "memory");
+	s->count++;
+	s->total += cycles;
+	if (cycles > s->max)
+		s->max = cycles;
+	if (s->hist != NULL)
+		hist_add (s->hist, cycles);
+	if (flags & FLAG_IF)
+		asm volatile ("sti" : : : "memory");
+}
+
+/* Accounts for interrupts having been off for CYCLES, from a call
+   to intr_disable() that returned to DISABLE_SITE to one to
+   intr_enable() that returns to ENABLE_SITE.  Called with
+   interrupts off. */
+void
+intr_stats_off (uintptr_t disable_site, uintptr_t enable_site,
+		uint64_t cycles) {
+	struct intr_off_site *s, *least = NULL;
+
+	off_count++;
+	off_total += cycles;
+	if (cycles > off_max)
+		off_max = cycles;
+	hist_add (&off_hist, cycles);
+
+	/* Count the pair in its entry, or evict the entry whose worst
+	   window is shortest if this one is longer. */
+	for (s = off_sites; s < off_sites + INTR_OFF_SITES; s++) {
+		if (s->disable_site == disable_site && s->enable_site == enable_site) {
+			s->count++;
+			if (cycles > s->max)
+				s->max = cycles;
+			return;
+		}
+		if (least == NULL || s->max < least->max)
+			least = s;
+	}
+	if (cycles > least->max) {
+		least->disable_site = disable_site;
+		least->enable_site = enable_site;
+		least->count = 1;
+		least->max = cycles;
+	}
+}
+
+/* Prints interrupt statistics. */
+void
+intr_stats_print (void) {
+	bool printed[INTR_OFF_SITES] = { false };
+	int vec, i;
+
+	printf ("Interrupts:\n");
+	for (vec = 0; vec < 256; vec++) {
+		const struct intr_vec_stats *s = &vec_stats[vec];
+
+		if (s->count == 0)
+			continue;
+		printf ("  %#04x %s: %llu calls, avg %llu cycles, max %llu cycles\n",
+				vec, intr_name (vec), s->count, s->total / s->count, s->max);
+		if (s->hist != NULL)
+			hist_print (s->hist);
+	}
+
+	printf ("  interrupts off: %llu windows, avg %llu cycles, max %llu cycles\n",
+			off_count, off_count ? off_total / off_count : 0, off_max);
+	if (off_count == 0)
+		return;
+	hist_print (&off_hist);
+
+	/* Worst offenders first. */
+	for (;;) {
+		const struct intr_off_site *worst = NULL;
+
+		for (i = 0; i < INTR_OFF_SITES; i++)
+			if (!printed[i] && off_sites[i].count != 0
+					&& (worst == NULL || off_sites[i].max > worst->max))
+				worst = &off_sites[i];
+		if (worst == NULL)
+			break;
+		printed[worst - off_sites] = true;
+		printf ("    off at %#llx, on at %#llx: %llu times, max %llu cycles\n",
+				(unsigned long long) worst->disable_site,
+				(unsigned long long) worst->enable_site,
+				worst->count, worst->max);
+	}
+}
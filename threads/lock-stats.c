@@ -0,0 +1,108 @@
+/* lock-stats.c: Lock contention statistics.
+
+   Only locks given a name with lock_set_name() are measured, so
+   that the many per-object locks cost nothing.  Locks given the
+   same name, such as the locks of the two disk channels, share
+   one set of counters.  Times are measured with the TSC: a timer
+   tick is far longer than most waits. */
+
+#include "threads/lock-stats.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "intrinsic.h"
+
+/* Maximum number of distinct lock names. */
+#define LOCK_STATS_MAX 32
+
+static struct lock_stats lock_stats[LOCK_STATS_MAX];
+static int lock_stats_cnt;
+
+/* Measures LOCK under NAME from now on.  Gives up quietly if there
+   are already LOCK_STATS_MAX names. */
+void
+lock_set_name (struct lock *lock, const char *name) {
+	enum intr_level old_level = intr_disable ();
+	int i;
+
+	for (i = 0; i < lock_stats_cnt; i++)
+		if (!strcmp (lock_stats[i].name, name))
+			break;
+	if (i == lock_stats_cnt && lock_stats_cnt < LOCK_STATS_MAX)
+		lock_stats[lock_stats_cnt++].name = name;
+	if (i < lock_stats_cnt)
+		lock->stats = &lock_stats[i];
+	intr_set_level (old_level);
+}
+
+/* Accounts for the current thread acquiring LOCK, which it set out
+   to do at TSC START, after waiting if CONTENDED.  Interrupts must
+   be off. */
+void
+lock_stats_acquired (struct lock *lock, bool contended, uint64_t start) {
+	struct lock_stats *s = lock->stats;
+	uint64_t now = rdtsc ();
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	lock->acquired = now;
+	s->acquire_cnt++;
+	if (contended) {
+		uint64_t wait = now - start;
+
+		s->contended_cnt++;
+		s->wait_cycles += wait;
+		if (wait > s->max_wait)
+			s->max_wait = wait;
+	}
+}
+
+/* Accounts for the current thread releasing LOCK.  Interrupts must
+   be off. */
+void
+lock_stats_released (struct lock *lock) {
+	struct lock_stats *s = lock->stats;
+	uint64_t hold = rdtsc () - lock->acquired;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	s->hold_cycles += hold;
+	if (hold > s->max_hold)
+		s->max_hold = hold;
+}
+
+/* Prints the statistics of every named lock that was acquired,
+   most total waiting first. */
+void
+lock_stats_print (void) {
+	struct lock_stats sorted[LOCK_STATS_MAX];
+	enum intr_level old_level;
+	int cnt = 0, i, j;
+
+	/* Copy first: printing takes the console lock. */
+	old_level = intr_disable ();
+	for (i = 0; i < lock_stats_cnt; i++)
+		if (lock_stats[i].acquire_cnt != 0)
+			sorted[cnt++] = lock_stats[i];
+	intr_set_level (old_level);
+
+	for (i = 1; i < cnt; i++) {
+		struct lock_stats s = sorted[i];
+
+		for (j = i; j > 0 && sorted[j - 1].wait_cycles < s.wait_cycles; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = s;
+	}
+
+	printf ("Locks: %d named locks acquired\n", cnt);
+	for (i = 0; i < cnt; i++) {
+		const struct lock_stats *s = &sorted[i];
+
+		printf ("  %-14s %llu acquires, %llu contended, "
+				"wait %llu cycles (max %llu), hold %llu cycles (max %llu)\n",
+				s->name, s->acquire_cnt, s->contended_cnt, s->wait_cycles,
+				s->max_wait, s->hold_cycles, s->max_hold);
+	}
+}
@@ -5,7 +5,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
+#include "threads/lock-stats.h"
 #include "threads/palloc.h"
+#include "threads/slab.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -32,7 +35,23 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   Each descriptor also keeps a small cache of free blocks in
+   front of its free list, guarded by a spinlock instead of the
+   descriptor's lock.  malloc() takes blocks from the cache and,
+   when it is empty, refills it with a batch of blocks from the
+   free list.  free() puts blocks into the cache and, when it is
+   full, returns a batch of them to the free list.  Only these
+   batch transfers take the descriptor lock, which may sleep and
+   donate priority.  Blocks in the cache still count as in use in
+   their arena.  Pintos has a single CPU, so one cache per
+   descriptor plays the role of a per-CPU cache. */
+
+/* Most blocks a descriptor caches in front of its free list.
+   Descriptors with fewer blocks per arena cache at most one
+   arena's worth, so big blocks do not pin many pages. */
+#define CACHE_SIZE 32
 
 /* Descriptor. */
 struct desc {
@@ -40,6 +59,18 @@ struct desc {
 	size_t blocks_per_arena;    /* Number of blocks in an arena. */
 	struct list free_list;      /* List of free blocks. */
 	struct lock lock;           /* Lock. */
+
+	struct spinlock cache_lock; /* Guards the cache. */
+	struct block *cache[CACHE_SIZE]; /* Cached free blocks. */
+	size_t cache_cnt;           /* Number of blocks in cache. */
+	size_t cache_max;           /* Capacity of cache. */
+	size_t cache_batch;         /* Blocks moved per refill or flush. */
+
+	/* Statistics, guarded by cache_lock. */
+	size_t arena_cnt;           /* Arenas held. */
+	size_t live_cnt;            /* Blocks handed out, not yet freed. */
+	size_t peak_cnt;            /* High-water mark of live_cnt. */
+	size_t failed_cnt;          /* Requests that found no memory. */
 };
 
 /* Magic number for detecting arena corruption. */
@@ -61,8 +92,20 @@ struct block {
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Statistics of big blocks, guarded by big_lock. */
+static struct spinlock big_lock;
+static size_t big_live_cnt;     /* Big blocks handed out, not yet freed. */
+static size_t big_peak_cnt;     /* High-water mark of big_live_cnt. */
+static size_t big_page_cnt;     /* Pages held by big blocks. */
+static size_t big_failed_cnt;   /* Big requests that found no memory. */
+
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static struct block *cache_get (struct desc *);
+static void cache_put (struct desc *, struct block *);
+static void desc_release (struct desc *, struct block *);
+static void stats_alloc (struct desc *);
+static bool big_resize (struct arena *, size_t new_size);
 
 /* Initializes the malloc() descriptors. */
 void
@@ -76,7 +119,15 @@ malloc_init (void) {
 		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
 		list_init (&d->free_list);
 		lock_init (&d->lock);
+		lock_set_name (&d->lock, "malloc");
+		spin_init (&d->cache_lock);
+		d->cache_cnt = 0;
+		d->cache_max = d->blocks_per_arena < CACHE_SIZE
+			? d->blocks_per_arena : CACHE_SIZE;
+		d->cache_batch = d->cache_max > 1 ? d->cache_max / 2 : 1;
+		d->arena_cnt = d->live_cnt = d->peak_cnt = d->failed_cnt = 0;
 	}
+	spin_init (&big_lock);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
@@ -84,7 +135,6 @@ malloc_init (void) {
 void *
 malloc (size_t size) {
 	struct desc *d;
-	struct block *b;
 	struct arena *a;
 
 	/* A null pointer satisfies a request for 0 bytes. */
@@ -101,6 +151,14 @@ malloc (size_t size) {
 		   Allocate enough pages to hold SIZE plus an arena. */
 		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
 		a = palloc_get_multiple (0, page_cnt);
+		spin_lock (&big_lock);
+		if (a != NULL) {
+			big_page_cnt += page_cnt;
+			if (++big_live_cnt > big_peak_cnt)
+				big_peak_cnt = big_live_cnt;
+		} else
+			big_failed_cnt++;
+		spin_unlock (&big_lock);
 		if (a == NULL)
 			return NULL;
 
@@ -112,35 +170,7 @@ malloc (size_t size) {
 		return a + 1;
 	}
 
-	lock_acquire (&d->lock);
-
-	/* If the free list is empty, create a new arena. */
-	if (list_empty (&d->free_list)) {
-		size_t i;
-
-		/* Allocate a page. */
-		a = palloc_get_page (0);
-		if (a == NULL) {
-			lock_release (&d->lock);
-			return NULL;
-		}
-
-		/* Initialize arena and add its blocks to the free list. */
-		a->magic = ARENA_MAGIC;
-		a->desc = d;
-		a->free_cnt = d->blocks_per_arena;
-		for (i = 0; i < d->blocks_per_arena; i++) {
-			struct block *b = arena_to_block (a, i);
-			list_push_back (&d->free_list, &b->free_elem);
-		}
-	}
-
-	/* Get a block from free list and return it. */
-	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-	a = block_to_arena (b);
-	a->free_cnt--;
-	lock_release (&d->lock);
-	return b;
+	return cache_get (d);
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -178,28 +208,69 @@ block_size (void *block) {
    If successful, returns the new block; on failure, returns a
    null pointer.
    A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
-   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK).
+
+   The block stays where it is if NEW_SIZE still fits in it.  A
+   big block is first resized in place, giving back the pages it no
+   longer needs or taking the free pages that follow it, so it is
+   only copied if those are in use. */
 void *
 realloc (void *old_block, size_t new_size) {
+	void *new_block;
+	size_t old_size;
+
 	if (new_size == 0) {
 		free (old_block);
 		return NULL;
-	} else {
-		void *new_block = malloc (new_size);
-		if (old_block != NULL && new_block != NULL) {
-			size_t old_size = block_size (old_block);
-			size_t min_size = new_size < old_size ? new_size : old_size;
-			memcpy (new_block, old_block, min_size);
-			free (old_block);
-		}
-		return new_block;
 	}
+	if (old_block == NULL)
+		return malloc (new_size);
+
+	if (slab_owns (old_block))
+		old_size = slab_object_size (old_block);
+	else {
+		struct arena *a = block_to_arena (old_block);
+
+		if (a->desc == NULL && big_resize (a, new_size))
+			return old_block;
+		old_size = block_size (old_block);
+	}
+	if (new_size <= old_size)
+		return old_block;
+
+	new_block = malloc (new_size);
+	if (new_block != NULL) {
+		memcpy (new_block, old_block, old_size);
+		free (old_block);
+	}
+	return new_block;
+}
+
+/* Resizes the big block in arena A to hold NEW_SIZE bytes without
+   moving it.  Returns true if successful. */
+static bool
+big_resize (struct arena *a, size_t new_size) {
+	size_t page_cnt = DIV_ROUND_UP (new_size + sizeof *a, PGSIZE);
+
+	if (!palloc_resize (a, a->free_cnt, page_cnt))
+		return false;
+	spin_lock (&big_lock);
+	big_page_cnt = big_page_cnt - a->free_cnt + page_cnt;
+	spin_unlock (&big_lock);
+	a->free_cnt = page_cnt;
+	return true;
 }
 
 /* Frees block P, which must have been previously allocated with
-   malloc(), calloc(), or realloc(). */
+   malloc(), calloc(), or realloc().  Objects allocated with
+   kmem_cache_alloc() are also accepted and handed back to their
+   cache. */
 void
 free (void *p) {
+	if (p != NULL && slab_owns (p)) {
+		slab_free (p);
+		return;
+	}
 	if (p != NULL) {
 		struct block *b = p;
 		struct arena *a = block_to_arena (b);
@@ -213,26 +284,13 @@ free (void *p) {
 			memset (b, 0xcc, d->block_size);
 #endif
 
-			lock_acquire (&d->lock);
-
-			/* Add block to free list. */
-			list_push_front (&d->free_list, &b->free_elem);
-
-			/* If the arena is now entirely unused, free it. */
-			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
-
-				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
-			}
-
-			lock_release (&d->lock);
+			cache_put (d, b);
 		} else {
 			/* It's a big block.  Free its pages. */
+			spin_lock (&big_lock);
+			big_live_cnt--;
+			big_page_cnt -= a->free_cnt;
+			spin_unlock (&big_lock);
 			palloc_free_multiple (a, a->free_cnt);
 			return;
 		}
@@ -266,3 +324,252 @@ arena_to_block (struct arena *a, size_t idx) {
 			+ sizeof *a
 			+ idx * a->desc->block_size);
 }
+
+/* Takes a free block from D's cache, refilling the cache from
+   D's free list if it is empty.  Returns a null pointer if memory
+   is not available. */
+static struct block *
+cache_get (struct desc *d) {
+	struct block *batch[CACHE_SIZE];
+	struct block *b = NULL;
+	size_t batch_cnt = 0;
+	size_t new_arenas = 0;
+
+	spin_lock (&d->cache_lock);
+	if (d->cache_cnt > 0) {
+		b = d->cache[--d->cache_cnt];
+		stats_alloc (d);
+	}
+	spin_unlock (&d->cache_lock);
+	if (b != NULL)
+		return b;
+
+	/* Refill.  The descriptor lock may sleep, so the batch is
+	   collected without the spinlock held. */
+	lock_acquire (&d->lock);
+	while (batch_cnt < d->cache_batch) {
+		struct arena *a;
+
+		/* If the free list is empty, create a new arena, but only
+		   if the batch would otherwise stay empty. */
+		if (list_empty (&d->free_list)) {
+			size_t i;
+
+			if (batch_cnt > 0)
+				break;
+
+			/* Allocate a page. */
+			a = palloc_get_page (0);
+			if (a == NULL)
+				break;
+			new_arenas++;
+
+			/* Initialize arena and add its blocks to the free list. */
+			a->magic = ARENA_MAGIC;
+			a->desc = d;
+			a->free_cnt = d->blocks_per_arena;
+			for (i = 0; i < d->blocks_per_arena; i++) {
+				struct block *b = arena_to_block (a, i);
+				list_push_back (&d->free_list, &b->free_elem);
+			}
+		}
+
+		/* Get a block from free list. */
+		b = list_entry (list_pop_front (&d->free_list), struct block,
+				free_elem);
+		a = block_to_arena (b);
+		a->free_cnt--;
+		batch[batch_cnt++] = b;
+	}
+	lock_release (&d->lock);
+
+	if (batch_cnt == 0) {
+		spin_lock (&d->cache_lock);
+		d->failed_cnt++;
+		spin_unlock (&d->cache_lock);
+		return NULL;
+	}
+	b = batch[--batch_cnt];
+
+	/* A concurrent free() may have filled the cache meanwhile;
+	   whatever does not fit goes back to the free list. */
+	spin_lock (&d->cache_lock);
+	d->arena_cnt += new_arenas;
+	stats_alloc (d);
+	while (batch_cnt > 0 && d->cache_cnt < d->cache_max)
+		d->cache[d->cache_cnt++] = batch[--batch_cnt];
+	spin_unlock (&d->cache_lock);
+	if (batch_cnt > 0) {
+		lock_acquire (&d->lock);
+		while (batch_cnt > 0)
+			desc_release (d, batch[--batch_cnt]);
+		lock_release (&d->lock);
+	}
+	return b;
+}
+
+/* Puts free block B into D's cache.  If the cache is full, B and
+   a batch of cached blocks go back to D's free list instead. */
+static void
+cache_put (struct desc *d, struct block *b) {
+	struct block *batch[CACHE_SIZE];
+	size_t batch_cnt = 0;
+
+	spin_lock (&d->cache_lock);
+	ASSERT (d->live_cnt > 0);
+	d->live_cnt--;
+	if (d->cache_cnt < d->cache_max) {
+		d->cache[d->cache_cnt++] = b;
+		spin_unlock (&d->cache_lock);
+		return;
+	}
+	while (batch_cnt < d->cache_batch)
+		batch[batch_cnt++] = d->cache[--d->cache_cnt];
+	spin_unlock (&d->cache_lock);
+
+	/* Flush.  The descriptor lock may sleep, so it is taken only
+	   after the spinlock is released. */
+	lock_acquire (&d->lock);
+	desc_release (d, b);
+	while (batch_cnt > 0)
+		desc_release (d, batch[--batch_cnt]);
+	lock_release (&d->lock);
+}
+
+/* Returns block B to D's free list, freeing its arena if it is
+   now entirely unused.  D's lock must be held. */
+static void
+desc_release (struct desc *d, struct block *b) {
+	struct arena *a = block_to_arena (b);
+
+	ASSERT (lock_held_by_current_thread (&d->lock));
+
+	/* Add block to free list. */
+	list_push_front (&d->free_list, &b->free_elem);
+
+	/* If the arena is now entirely unused, free it. */
+	if (++a->free_cnt >= d->blocks_per_arena) {
+		size_t i;
+
+		ASSERT (a->free_cnt == d->blocks_per_arena);
+		for (i = 0; i < d->blocks_per_arena; i++) {
+			struct block *b = arena_to_block (a, i);
+			list_remove (&b->free_elem);
+		}
+		palloc_free_page (a);
+
+		spin_lock (&d->cache_lock);
+		d->arena_cnt--;
+		spin_unlock (&d->cache_lock);
+	}
+}
+
+/* Records in D's statistics that a block was handed out.  D's
+   cache_lock must be held. */
+static void
+stats_alloc (struct desc *d) {
+	if (++d->live_cnt > d->peak_cnt)
+		d->peak_cnt = d->live_cnt;
+}
+
+/* Stores a snapshot of the statistics of size class CLASS into
+   *STATS.  Classes 0 up to the number of size classes are ordered
+   by block size; the class after them describes big blocks, with
+   a block_size of 0.  Returns false if CLASS is past that.  Runs
+   with interrupts off, so that it may also be used from an
+   interrupt handler. */
+bool
+malloc_get_stats (size_t class, struct malloc_stats *stats) {
+	enum intr_level old_level;
+
+	if (class > desc_cnt)
+		return false;
+
+	old_level = intr_disable ();
+	if (class < desc_cnt) {
+		const struct desc *d = &descs[class];
+		stats->block_size = d->block_size;
+		stats->page_cnt = d->arena_cnt;
+		stats->live_cnt = d->live_cnt;
+		stats->peak_cnt = d->peak_cnt;
+		stats->failed_cnt = d->failed_cnt;
+	} else {
+		stats->block_size = 0;
+		stats->page_cnt = big_page_cnt;
+		stats->live_cnt = big_live_cnt;
+		stats->peak_cnt = big_peak_cnt;
+		stats->failed_cnt = big_failed_cnt;
+	}
+	intr_set_level (old_level);
+	return true;
+}
+
+/* Prints malloc() statistics, one line per size class in use. */
+void
+malloc_print_stats (void) {
+	struct malloc_stats s;
+	size_t class;
+
+	printf ("Malloc:");
+	for (class = 0; malloc_get_stats (class, &s); class++) {
+		if (s.page_cnt == 0 && s.peak_cnt == 0 && s.failed_cnt == 0)
+			continue;
+		if (s.block_size != 0)
+			printf (" %zu B:", s.block_size);
+		else
+			printf (" big:");
+		printf (" %zu live (peak %zu) in %zu pages", s.live_cnt, s.peak_cnt,
+				s.page_cnt);
+		if (s.failed_cnt != 0)
+			printf (", %zu failed", s.failed_cnt);
+		printf (";");
+	}
+	printf ("\n");
+}
+
+/* Answers the malloc() inspection interrupt. */
+static void
+inspect_malloc (struct intr_frame *f) {
+	struct malloc_stats s;
+
+	if (!malloc_get_stats (f->R.rdi, &s)) {
+		f->R.rax = -1;
+		return;
+	}
+	switch (f->R.rsi) {
+		case 0:
+			f->R.rax = s.block_size;
+			break;
+		case 1:
+			f->R.rax = s.live_cnt;
+			break;
+		case 2:
+			f->R.rax = s.peak_cnt;
+			break;
+		case 3:
+			f->R.rax = s.page_cnt;
+			break;
+		case 4:
+			f->R.rax = s.failed_cnt;
+			break;
+		default:
+			f->R.rax = -1;
+			break;
+	}
+}
+
+/* Tool for testing malloc(). Calling this function via int 0x47.
+ * Input:
+ *   @RDI - Size class, as for malloc_get_stats().
+ *   @RSI - 0: block size (0 for big blocks),
+ *          1: blocks in use,
+ *          2: peak blocks in use,
+ *          3: pages held,
+ *          4: failed requests.
+ * Output:
+ *   @RAX - Requested counter, or -1 if RDI or RSI is out of range. */
+void
+register_malloc_inspect_intr (void) {
+	intr_register_int (0x47, 3, INTR_OFF, inspect_malloc,
+			"Inspect Malloc");
+}
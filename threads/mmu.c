@@ -2,20 +2,185 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/workqueue.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers.  With CR4.PCIDE set, TLB entries
+ * are tagged with the PCID in the low 12 bits of CR3, and loading
+ * CR3 with CR3_NOFLUSH keeps the entries of every PCID, so that a
+ * process switched back in still finds its translations cached.
+ * PCID 0 belongs to base_pml4.  The last PCID_CNT user page tables
+ * to run hold the others, handed out round robin.  invlpg only
+ * reaches the current PCID, so a page table whose PTEs change
+ * while it is not loaded is marked stale instead and flushed on
+ * its next load; so is one given a PCID that someone else had. */
+#define PCID_CNT 15
+#define CR3_NOFLUSH (1ULL << 63)
+#define CR4_PCIDE (1 << 17)
+#define CR4_PGE (1 << 7)
+#define CPUID_1_ECX_PCID (1 << 17)
+
+struct pcid_slot {
+	uint64_t *pml4;             /* Page table holding this PCID, or null. */
+	bool stale;                 /* Flush on the next load? */
+};
+
+static bool pcid_enabled;
+static struct pcid_slot pcid_slots[PCID_CNT];
+static unsigned pcid_next;
+
+/* Above this many pages, pml4_clear_range() flushes the whole TLB
+ * rather than invalidating them one by one. */
+#define TLB_FLUSH_MAX 32
+
+/* Page-table pages.  Each new table of a page table needs a zeroed
+ * page.  Rather than palloc_get_page (PAL_ZERO) and a pool's locks
+ * for each, they come from PTP_CACHE, a stack of zeroed pages under
+ * a spinlock alone.  A work item refills it from palloc in the
+ * background once it runs low, and pml4_destroy() gives it back the
+ * tables it frees, zeroing only the entries that were in use, which
+ * it reads anyway. */
+#define PTP_MAX 64                  /* Most pages cached. */
+#define PTP_LOW (PTP_MAX / 4)       /* Refill below this many... */
+#define PTP_FILL (PTP_MAX / 2)      /* ...up to this many. */
+
+static void *ptp_cache[PTP_MAX];
+static size_t ptp_cnt;
+static struct spinlock ptp_lock;
+static struct work ptp_refill;
+static bool ptp_started;            /* Has pml4_start_cache() run? */
+
+/* Returns a zeroed page for a page table, or a null pointer if
+ * memory is short. */
+static uint64_t *
+ptp_get (void) {
+	void *page = NULL;
+	bool refill;
+
+	spin_lock (&ptp_lock);
+	if (ptp_cnt > 0)
+		page = ptp_cache[--ptp_cnt];
+	refill = ptp_started && ptp_cnt < PTP_LOW;
+	spin_unlock (&ptp_lock);
+
+	if (refill)
+		work_submit (&ptp_refill);
+	return page != NULL ? page : palloc_get_page (PAL_ZERO);
+}
+
+/* Keeps PAGE, which is zeroed, for a later page table if there is
+ * room, and returns true, or else returns false. */
+static bool
+ptp_put (void *page) {
+	bool kept;
+
+	spin_lock (&ptp_lock);
+	kept = ptp_cnt < PTP_MAX;
+	if (kept)
+		ptp_cache[ptp_cnt++] = page;
+	spin_unlock (&ptp_lock);
+	return kept;
+}
+
+/* Frees PAGE, a zeroed page table that is no longer used. */
+static void
+ptp_free (void *page) {
+	if (!ptp_put (page))
+		palloc_free_page (page);
+}
+
+/* Tops up the page-table page cache to PTP_FILL pages, or as many
+ * as palloc has.  Run by the work queue. */
+static void
+ptp_refill_work (void *aux UNUSED) {
+	for (;;) {
+		void *page;
+		bool full;
+
+		spin_lock (&ptp_lock);
+		full = ptp_cnt >= PTP_FILL;
+		spin_unlock (&ptp_lock);
+		if (full)
+			return;
+
+		page = palloc_get_page (PAL_ZERO);
+		if (page == NULL)
+			return;
+		if (!ptp_put (page)) {
+			palloc_free_page (page);
+			return;
+		}
+	}
+}
+
+/* Starts refilling the page-table page cache in the background.
+ * Must be called after the work queue is started. */
+void
+pml4_start_cache (void) {
+	work_init (&ptp_refill, ptp_refill_work, NULL);
+	ptp_started = true;
+	work_submit (&ptp_refill);
+}
+
+/* Returns true if PML4 is the page table the CPU is using. */
+static bool
+pml4_is_active (uint64_t *pml4) {
+	return PTE_ADDR (rcr3 ()) == vtop (pml4);
+}
+
+/* Notes that PTEs of PML4, which is not loaded, changed. */
+static void
+pcid_mark_stale (uint64_t *pml4) {
+	if (!pcid_enabled)
+		return;
+	for (unsigned i = 0; i < PCID_CNT; i++)
+		if (pcid_slots[i].pml4 == pml4)
+			pcid_slots[i].stale = true;
+}
+
+/* Returns true if the current TLB context may hold translations
+ * of PML4.  The kernel's are part of every page table. */
+static bool
+tlb_holds (uint64_t *pml4) {
+	return pml4 == base_pml4 || pml4_is_active (pml4);
+}
+
+/* Drops the cached translations of virtual page VA in PML4 after
+ * its PTE changed. */
+static void
+tlb_flush_page (uint64_t *pml4, uint64_t va) {
+	if (tlb_holds (pml4))
+		invlpg (va);
+	else
+		pcid_mark_stale (pml4);
+}
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
+
+		/* A 2 MB page has no page table: its PDE is the entry for
+		 * all of it, present or not.  Once it is gone, the space can
+		 * take a page table again. */
+		if ((uint64_t) pte & PTE_PS) {
+			if (!create)
+				return &pdp[idx];
+			if ((uint64_t) pte & PTE_P)
+				return NULL;
+			pdp[idx] = 0;
+			pte = NULL;
+		}
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				uint64_t *new_page = ptp_get ();
 				if (new_page)
 					pdp[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
 				else
@@ -37,7 +202,7 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 		uint64_t *pde = (uint64_t *) pdpe[idx];
 		if (!((uint64_t) pde & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				uint64_t *new_page = ptp_get ();
 				if (new_page) {
 					pdpe[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
 					allocated = 1;
@@ -49,7 +214,7 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
 	}
 	if (pte == NULL && allocated) {
-		palloc_free_page ((void *) ptov (PTE_ADDR (pdpe[idx])));
+		ptp_free ((void *) ptov (PTE_ADDR (pdpe[idx])));
 		pdpe[idx] = 0;
 	}
 	return pte;
@@ -70,7 +235,7 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 		uint64_t *pdpe = (uint64_t *) pml4e[idx];
 		if (!((uint64_t) pdpe & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				uint64_t *new_page = ptp_get ();
 				if (new_page) {
 					pml4e[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
 					allocated = 1;
@@ -82,12 +247,42 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 		pte = pdpe_walk (ptov (PTE_ADDR (pml4e[idx])), va, create);
 	}
 	if (pte == NULL && allocated) {
-		palloc_free_page ((void *) ptov (PTE_ADDR (pml4e[idx])));
+		ptp_free ((void *) ptov (PTE_ADDR (pml4e[idx])));
 		pml4e[idx] = 0;
 	}
 	return pte;
 }
 
+/* Returns the table that entry IDX of TABLE points to.  If it is
+ * not present and CREATE is true, a new, empty one is allocated;
+ * otherwise, returns a null pointer. */
+static uint64_t *
+next_level (uint64_t *table, unsigned idx, int create) {
+	if (!(table[idx] & PTE_P)) {
+		uint64_t *new_page;
+
+		if (!create || (new_page = ptp_get ()) == NULL)
+			return NULL;
+		table[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	return ptov (PTE_ADDR (table[idx]));
+}
+
+/* Returns the address of the page directory entry for virtual
+ * address VA in PML4, the entry that maps VA with a 2 MB page.
+ * If PML4 has no page directory for VA, one is created if CREATE
+ * is true; otherwise, a null pointer is returned. */
+uint64_t *
+pml4e_walk_pde (uint64_t *pml4, const uint64_t va, int create) {
+	uint64_t *pdpt, *pd;
+
+	pdpt = next_level (pml4, PML4 (va), create);
+	if (pdpt == NULL)
+		return NULL;
+	pd = next_level (pdpt, PDPE (va), create);
+	return pd != NULL ? &pd[PDX (va)] : NULL;
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -96,7 +291,7 @@ uint64_t *
 pml4_create (void) {
 	uint64_t *pml4 = palloc_get_page (0);
 	if (pml4)
-		memcpy (pml4, base_pml4, PGSIZE);
+		copy_page (pml4, base_pml4);
 	return pml4;
 }
 
@@ -122,10 +317,18 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
-					pml4_index, pdp_index, i))
+		if (!(((uint64_t) pte) & PTE_P))
+			continue;
+		if (pdp[i] & PTE_PS) {
+			/* A 2 MB page: FUNC gets its PDE. */
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+								 ((uint64_t) pdp_index << PDPESHIFT) |
+								 ((uint64_t) i << PDXSHIFT));
+			if (!func (&pdp[i], va, aux))
 				return false;
+		} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+					pml4_index, pdp_index, i))
+			return false;
 	}
 	return true;
 }
@@ -155,34 +358,175 @@ pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 	return true;
 }
 
+/* State of pml4_clone(). */
+struct clone_state {
+	uint64_t *dst;              /* Page table being filled. */
+	uint64_t start, end;        /* Range to clone. */
+	pml4_clone_func *func;
+	void *aux;
+	bool changed;               /* FUNC changed a source PTE? */
+};
+
+/* Clones the user PTEs of leaf table PT, which maps the 2 MB at
+ * BASE, into the matching leaf table of the clone, which is walked
+ * to once. */
+static bool
+pt_clone (struct clone_state *c, uint64_t *pt, uint64_t base) {
+	uint64_t *dst_pt = NULL;
+
+	for (unsigned i = 0; i < PGSIZE / sizeof (uint64_t); i++) {
+		uint64_t va = base | ((uint64_t) i << PTXSHIFT);
+		uint64_t old = pt[i], pte = 0;
+
+		if ((old & (PTE_P | PTE_U)) != (PTE_P | PTE_U)
+				|| va < c->start || va >= c->end)
+			continue;
+		if (dst_pt == NULL) {
+			uint64_t *e = pml4e_walk (c->dst, va, true);
+
+			if (e == NULL)
+				return false;
+			dst_pt = (uint64_t *) PTE_ADDR (e);
+		}
+		if (!c->func (&pt[i], &pte, (void *) va, c->aux))
+			return false;
+		c->changed = c->changed || pt[i] != old;
+		dst_pt[i] = pte;
+	}
+	return true;
+}
+
+/* Clones the part of the range that TABLE, a table LEVEL levels
+ * above the leaf tables, maps from BASE.  2 MB pages are not
+ * cloned. */
+static bool
+table_clone (struct clone_state *c, uint64_t *table, unsigned level,
+		uint64_t base) {
+	unsigned shift = PTXSHIFT + 9 * level;
+
+	for (unsigned i = 0; i < PGSIZE / sizeof (uint64_t); i++) {
+		uint64_t lo = base | ((uint64_t) i << shift);
+		uint64_t *next;
+
+		if (lo >= c->end)
+			break;
+		if (!(table[i] & PTE_P) || lo + (1ULL << shift) <= c->start
+				|| (level == 1 && (table[i] & PTE_PS)))
+			continue;
+		next = ptov (PTE_ADDR (table[i]));
+		if (!(level == 1 ? pt_clone (c, next, lo)
+					: table_clone (c, next, level - 1, lo)))
+			return false;
+	}
+	return true;
+}
+
+/* Fills user page table DST with the present user pages of SRC in
+ * [START, END), a leaf table at a time.  For each, FUNC is given
+ * the source PTE, which it may change, and stores the PTE for the
+ * clone into *DST_PTE, or 0 to leave the page out.  Unlike
+ * pml4_for_each() with pml4_set_page(), this walks each table of
+ * SRC once and each leaf table of DST once.  Returns false if FUNC
+ * does or memory is short, in which case part of the range may
+ * have been cloned.  If FUNC changed source PTEs, their cached
+ * translations are dropped. */
+bool
+pml4_clone (uint64_t *dst, uint64_t *src, void *start, void *end,
+		pml4_clone_func *func, void *aux) {
+	struct clone_state c = {
+		.dst = dst, .start = (uint64_t) start, .end = (uint64_t) end,
+		.func = func, .aux = aux, .changed = false,
+	};
+	bool success;
+
+	ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+	ASSERT ((uint64_t) end <= KERN_BASE);
+
+	success = table_clone (&c, src, 3, 0);
+	if (c.changed) {
+		if (tlb_holds (src))
+			lcr3 (rcr3 ());
+		else
+			pcid_mark_stale (src);
+	}
+	return success;
+}
+
+/* Pages freed by pml4_destroy(), handed back to palloc
+ * FREE_BATCH at a time rather than one by one. */
+#define FREE_BATCH 32
+
+struct free_batch {
+	void *pages[FREE_BATCH];
+	size_t cnt;
+};
+
+/* Frees the pages gathered in B. */
+static void
+free_batch_flush (struct free_batch *b) {
+	palloc_free_pages (b->pages, b->cnt);
+	b->cnt = 0;
+}
+
+/* Adds PAGE to B, freeing B's pages first if it is full. */
+static void
+free_batch_add (struct free_batch *b, void *page) {
+	if (b->cnt == FREE_BATCH)
+		free_batch_flush (b);
+	b->pages[b->cnt++] = page;
+}
+
+/* Frees TABLE, a page table whose entries have all been cleared, to
+ * the page-table page cache, or to B if the cache is full. */
+static void
+free_batch_add_table (struct free_batch *b, void *table) {
+	if (!ptp_put (table))
+		free_batch_add (b, table);
+}
+
+/* The *_destroy() functions clear each entry in use as they free
+ * what it points to, so that the table they free is zeroed. */
 static void
-pt_destroy (uint64_t *pt) {
+pt_destroy (uint64_t *pt, struct free_batch *b) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pt[i]);
+		if (pt[i] == 0)
+			continue;
 		if (((uint64_t) pte) & PTE_P)
-			palloc_free_page ((void *) PTE_ADDR (pte));
+			free_batch_add (b, (void *) PTE_ADDR (pte));
+		pt[i] = 0;
 	}
-	palloc_free_page ((void *) pt);
+	free_batch_add_table (b, (void *) pt);
 }
 
 static void
-pgdir_destroy (uint64_t *pdp) {
+pgdir_destroy (uint64_t *pdp, struct free_batch *b) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			pt_destroy (PTE_ADDR (pte));
+		if (pdp[i] == 0)
+			continue;
+		if (((uint64_t) pte) & PTE_P) {
+			if (pdp[i] & PTE_PS)
+				palloc_free_multiple ((void *) PTE_ADDR (pte), HUGE_PGCNT);
+			else
+				pt_destroy (PTE_ADDR (pte), b);
+		}
+		pdp[i] = 0;
 	}
-	palloc_free_page ((void *) pdp);
+	free_batch_add_table (b, (void *) pdp);
 }
 
 static void
-pdpe_destroy (uint64_t *pdpe) {
+pdpe_destroy (uint64_t *pdpe, struct free_batch *b) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdpe[i]);
+		if (pdpe[i] == 0)
+			continue;
 		if (((uint64_t) pde) & PTE_P)
-			pgdir_destroy ((void *) PTE_ADDR (pde));
+			pgdir_destroy ((void *) PTE_ADDR (pde), b);
+		pdpe[i] = 0;
 	}
-	palloc_free_page ((void *) pdpe);
+	free_batch_add_table (b, (void *) pdpe);
 }
 
 /* Destroys pml4e, freeing all the pages it references. */
@@ -194,16 +538,100 @@ pml4_destroy (uint64_t *pml4) {
 
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
+	struct free_batch b = { .cnt = 0 };
 	if (((uint64_t) pdpe) & PTE_P)
-		pdpe_destroy ((void *) PTE_ADDR (pdpe));
+		pdpe_destroy ((void *) PTE_ADDR (pdpe), &b);
+	free_batch_flush (&b);
+
+	/* Give up its PCID.  Whoever gets it next flushes it. */
+	if (pcid_enabled) {
+		enum intr_level old_level = intr_disable ();
+		for (unsigned i = 0; i < PCID_CNT; i++)
+			if (pcid_slots[i].pml4 == pml4)
+				pcid_slots[i].pml4 = NULL;
+		intr_set_level (old_level);
+	}
 	palloc_free_page ((void *) pml4);
 }
 
+/* Returns the CR3 value that loads user page table PML4, giving it
+ * a PCID if it has none.  Interrupts must be off. */
+static uint64_t
+pcid_cr3 (uint64_t *pml4) {
+	struct pcid_slot *slot = NULL, *free_slot = NULL;
+	bool flush;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	for (unsigned i = 0; i < PCID_CNT; i++) {
+		if (pcid_slots[i].pml4 == pml4)
+			slot = &pcid_slots[i];
+		else if (pcid_slots[i].pml4 == NULL && free_slot == NULL)
+			free_slot = &pcid_slots[i];
+	}
+	if (slot == NULL) {
+		slot = free_slot;
+		if (slot == NULL) {
+			slot = &pcid_slots[pcid_next];
+			pcid_next = (pcid_next + 1) % PCID_CNT;
+		}
+		slot->pml4 = pml4;
+		slot->stale = true;
+	}
+	flush = slot->stale;
+	slot->stale = false;
+	return vtop (pml4) | (uint64_t) (slot - pcid_slots + 1)
+		| (flush ? 0 : CR3_NOFLUSH);
+}
+
+/* Turns on PCIDs if the CPU has them.  base_pml4 must be loaded,
+ * as PCID 0. */
+void
+pml4_init_pcid (void) {
+	uint32_t ecx, edx;
+
+	cpuid (1, &ecx, &edx);
+	if (!(ecx & CPUID_1_ECX_PCID))
+		return;
+	lcr4 (rcr4 () | CR4_PCIDE);
+	pcid_enabled = true;
+}
+
+/* Drops the cached translations of kernel virtual addresses in
+ * every PCID, after some kernel mapping was removed or changed.
+ * invlpg would reach only the current PCID, but toggling CR4.PGE
+ * flushes the entire TLB, whatever the PCID. */
+void
+pml4_flush_kernel (void) {
+	enum intr_level old_level = intr_disable ();
+	uint64_t cr4 = rcr4 ();
+
+	lcr4 (cr4 ^ CR4_PGE);
+	lcr4 (cr4);
+	intr_set_level (old_level);
+}
+
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  Nothing is done if it is already loaded: every change
+ * to a loaded page table invalidates its own TLB entries. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	uint64_t *target = pml4 ? pml4 : base_pml4;
+	enum intr_level old_level;
+
+	if (pml4_is_active (target))
+		return;
+	if (!pcid_enabled) {
+		lcr3 (vtop (target));
+		return;
+	}
+
+	/* The kernel's mappings change only before pml4_flush_kernel(),
+	 * which flushes every PCID. */
+	old_level = intr_disable ();
+	lcr3 (target == base_pml4 ? vtop (base_pml4) | CR3_NOFLUSH
+			: pcid_cr3 (target));
+	intr_set_level (old_level);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -216,8 +644,12 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
-	if (pte && (*pte & PTE_P))
+	if (pte && (*pte & PTE_P)) {
+		if (*pte & PTE_PS)
+			return ptov (PTE_ADDR (*pte))
+				+ ((uint64_t) uaddr & (HUGE_PGSIZE - 1));
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	}
 	return NULL;
 }
 
@@ -238,11 +670,79 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
+	if (pte) {
+		bool was_present = (*pte & PTE_P) != 0;
+
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+		if (was_present)
+			tlb_flush_page (pml4, (uint64_t) upage);
+	}
 	return pte != NULL;
 }
 
+/* Maps the 2 MB of user virtual memory at UPAGE in PML4 to the
+ * physically contiguous frames starting at kernel virtual address
+ * KPAGE, with a single PDE.  Both must be 2 MB aligned.  Nothing in
+ * the range may be mapped; an empty page table left over in the
+ * way is freed.  Returns true if successful, false if memory
+ * allocation failed or part of the range is mapped. */
+bool
+pml4_set_huge_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	uint64_t *pde;
+
+	ASSERT ((uint64_t) upage % HUGE_PGSIZE == 0);
+	ASSERT (vtop (kpage) % HUGE_PGSIZE == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	pde = pml4e_walk_pde (pml4, (uint64_t) upage, 1);
+	if (pde == NULL || (*pde & PTE_PS))
+		return false;
+	if (*pde & PTE_P) {
+		uint64_t *pt = ptov (PTE_ADDR (*pde));
+
+		for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+			if (pt[i] & PTE_P)
+				return false;
+		palloc_free_page (pt);
+	}
+	*pde = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U | PTE_PS;
+	return true;
+}
+
+/* Returns true if UPAGE is mapped, present or not, as part of a
+ * 2 MB page in PML4. */
+bool
+pml4_is_huge (uint64_t *pml4, const void *upage) {
+	uint64_t *pde = pml4e_walk_pde (pml4, (uint64_t) upage, false);
+	return pde != NULL && (*pde & PTE_PS) != 0;
+}
+
+/* If UPAGE is in a 2 MB page in PML4, replaces it by 4 kB pages
+ * mapping the same frames with the same permissions, present,
+ * accessed and dirty bits.  Returns true if successful or if there
+ * was nothing to do, false if memory allocation failed. */
+bool
+pml4_split_huge (uint64_t *pml4, const void *upage) {
+	uint64_t *pde = pml4e_walk_pde (pml4, (uint64_t) upage, false);
+	uint64_t *pt, pa, flags;
+
+	if (pde == NULL || !(*pde & PTE_PS))
+		return true;
+	pt = palloc_get_page (0);
+	if (pt == NULL)
+		return false;
+
+	pa = PTE_ADDR (*pde);
+	flags = *pde & (PTE_P | PTE_W | PTE_U | PTE_A | PTE_D);
+	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+		pt[i] = (pa + i * PGSIZE) | flags;
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+	if (flags & PTE_P)
+		tlb_flush_page (pml4, (uint64_t) upage & ~(HUGE_PGSIZE - 1));
+	return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
@@ -257,11 +757,55 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		tlb_flush_page (pml4, (uint64_t) upage);
 	}
 }
 
+/* Marks the user pages in [START, END) "not present" in PML4,
+ * like pml4_clear_page() on each of them, but walking each page
+ * table once and, past TLB_FLUSH_MAX present pages, flushing the
+ * TLB once instead of page by page.  A 2 MB page is only cleared
+ * if the range covers all of it. */
+void
+pml4_clear_range (uint64_t *pml4, void *start, void *end) {
+	bool active = pml4_is_active (pml4);
+	uint64_t va = (uint64_t) start;
+	size_t cleared = 0;
+
+	ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+	ASSERT (is_user_vaddr (start) && (uint64_t) end <= KERN_BASE);
+
+	while (va < (uint64_t) end) {
+		uint64_t next = (va | (HUGE_PGSIZE - 1)) + 1;
+		uint64_t *pde = pml4e_walk_pde (pml4, va, false);
+
+		if (next > (uint64_t) end)
+			next = (uint64_t) end;
+		if (pde != NULL && (*pde & PTE_P)) {
+			if (!(*pde & PTE_PS)) {
+				uint64_t *pt = ptov (PTE_ADDR (*pde));
+
+				for (; va < next; va += PGSIZE)
+					if (pt[PTX (va)] & PTE_P) {
+						pt[PTX (va)] &= ~PTE_P;
+						if (active && ++cleared <= TLB_FLUSH_MAX)
+							invlpg (va);
+					}
+			} else if (next - va == HUGE_PGSIZE) {
+				*pde &= ~PTE_P;
+				if (active && ++cleared <= TLB_FLUSH_MAX)
+					invlpg (va);
+			}
+		}
+		va = next;
+	}
+
+	if (!active)
+		pcid_mark_stale (pml4);
+	else if (cleared > TLB_FLUSH_MAX)
+		lcr3 (rcr3 ());
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PML4 is dirty,
  * that is, if the page has been modified since the PTE was
  * installed.
@@ -281,10 +825,11 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		if (dirty)
 			*pte |= PTE_D;
 		else
-			*pte &= ~(uint32_t) PTE_D;
+			*pte &= ~(uint64_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		/* A cached entry that is already dirty would let writes
+		 * through without setting the bit again. */
+		tlb_flush_page (pml4, (uint64_t) vpage);
 	}
 }
 
@@ -307,9 +852,12 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		if (accessed)
 			*pte |= PTE_A;
 		else
-			*pte &= ~(uint32_t) PTE_A;
+			*pte &= ~(uint64_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
+		/* A page table that is not loaded is left alone: at worst a
+		 * cached entry hides a few accesses from page replacement,
+		 * which is not worth flushing its PCID for. */
+		if (tlb_holds (pml4))
 			invlpg ((uint64_t) vpage);
 	}
 }
@@ -2,15 +2,23 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/fpu.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/lock-stats.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 
 /* Page allocator.  Hands out memory in page-size (or
    page-multiple) chunks.  See malloc.h for an allocator that
@@ -24,24 +32,140 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
 
-/* A memory pool. */
+   RAM need not be contiguous: the E820 map may have holes in it.
+   So each class of pages, kernel and user, is really a set of
+   pools, one for each usable range of memory that it got, and an
+   allocation goes to each of them in turn, lowest address first.
+
+   The split is not rigid, though.  When one pool runs dry, its
+   class borrows pages from the other, as long as that leaves the
+   lender with more than 1/BORROW_RESERVE of its pages free for
+   its own class.  A borrowed page still belongs to the pool it
+   came from and returns there when freed, so that pressure on
+   either side moves pages across only for as long as it lasts:
+   kswapd reclaims user pages whenever the user pool falls below
+   its watermark, whoever took them. */
+
+/* Capacity of a pool's page magazine, and the number of pages
+   moved between it and the bitmap at a time. */
+#define MAG_SIZE 32
+#define MAG_BATCH 16
+
+/* Number of pre-zeroed pages to keep per pool. */
+#define ZEROED_MAX 64
+
+/* Number of buddy allocator free lists.  Order K holds free blocks
+   of 2**K pages aligned to 2**K pages within the pool. */
+#define BUDDY_ORDERS 32
+
+/* A pool lends pages to the other class only while more than
+   1/BORROW_RESERVE of its pages would stay free. */
+#define BORROW_RESERVE 16
+
+/* Header written into the first page of a free buddy block. */
+struct buddy_block {
+	struct list_elem elem;          /* Element in pool's buddy_free. */
+	unsigned order;                 /* Block is 2**order pages. */
+	unsigned magic;                 /* BUDDY_MAGIC. */
+};
+#define BUDDY_MAGIC 0x62756464
+
+/* A memory pool.
+
+   Single free pages are cached in a magazine in front of the
+   bitmap.  Pages in the magazine stay marked as used in the bitmap.
+   Allocation takes pages from the magazine and refills it with
+   MAG_BATCH pages from the bitmap when it is empty.  Freeing puts
+   pages back into the magazine and, when it is full, returns
+   MAG_BATCH of them to the bitmap.  Therefore most single-page
+   allocations need neither the pool lock nor a bitmap scan.
+   Pintos has a single CPU, so one magazine per pool, guarded by a
+   spinlock, plays the role of a per-CPU magazine. */
 struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	size_t next_fit;                /* Page index to start scanning at. */
+
+	struct spinlock mag_lock;       /* Guards the magazine. */
+	void *mag[MAG_SIZE];            /* Cached free pages. */
+	size_t mag_cnt;                 /* Number of pages in mag. */
+	void *zeroed[ZEROED_MAX];       /* Free pages already zeroed. */
+	size_t zeroed_cnt;              /* Number of pages in zeroed. */
+
+	/* Buddy backend, if palloc_buddy.  The bitmap still records
+	   which pages are used; free blocks are also kept here. */
+	struct spinlock buddy_lock;     /* Guards buddy_free. */
+	struct list buddy_free[BUDDY_ORDERS]; /* Free blocks by order. */
+
+	/* Statistics. */
+	struct spinlock stats_lock;     /* Guards the counters below. */
+	size_t page_cnt;                /* Usable pages in the pool. */
+	size_t live_cnt;                /* Pages handed out, not yet freed. */
+	size_t peak_cnt;                /* High-water mark of live_cnt. */
+	size_t failed_cnt;              /* Requests that found no pages. */
+	size_t lent_cnt;                /* Pages ever lent to the other class. */
 };
 
-/* Two pools: one for kernel data, one for user pages. */
-static struct pool kernel_pool, user_pool;
+/* Most pools there may be: one per usable range of memory, plus
+   one more for the range split between the classes. */
+#define POOL_MAX 16
+
+/* The pools of one class, in order of address. */
+struct pool_class {
+	const char *lock_name;          /* Name of its pools' locks. */
+	struct pool *pools[POOL_MAX];   /* Its pools. */
+	size_t pool_cnt;                /* Number of pools, at least 1. */
+};
+
+/* All the pools, and the two classes they make up: one for kernel
+   data, one for user pages. */
+static struct pool pools[POOL_MAX];
+static size_t pool_cnt;
+static struct pool_class kernel_class = { .lock_name = "kernel pool" };
+static struct pool_class user_class = { .lock_name = "user pool" };
 
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
-static void
-init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
+
+/* Use the buddy allocator instead of the bitmap? */
+bool palloc_buddy;
+
+/* May each class borrow pages from the other's pool? */
+bool palloc_borrow = true;
+
+/* Serializes splitting the kernel's 2 MB mappings of borrowed
+   user pages. */
+static struct lock split_lock;
+
+/* Background page zeroing. */
+static struct semaphore zeroer_wakeup;  /* Upped when zeroed pages run low. */
+static bool zeroer_sleeping;            /* Zeroer waiting on zeroer_wakeup? */
+static void zeroer (void *aux);
+static void *zeroed_get (struct pool *);
+static void init_pool (struct pool *p, void **bm_base, uint64_t start,
+		uint64_t end, const char *lock_name);
 
 static bool page_from_pool (const struct pool *, void *page);
+static struct pool_class *class_of (enum palloc_flags);
+static void *class_get (struct pool_class *, enum palloc_flags,
+		size_t page_cnt);
+static size_t class_count (const struct pool_class *, size_t *live_cnt);
+static void *pool_get (struct pool *, enum palloc_flags, size_t page_cnt);
+static void *pool_borrow (enum palloc_flags, size_t page_cnt);
+static struct pool *pool_of (void *page);
+static size_t pool_scan (struct pool *, size_t page_cnt);
+static size_t pool_scan_aligned (struct pool *, size_t page_cnt,
+		size_t align);
+static void pool_release (struct pool *, size_t page_idx, size_t page_cnt);
+static void buddy_init (struct pool *);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static void *magazine_get (struct pool *);
+static void magazine_put (struct pool *, void *page);
+static void stats_account (struct pool *, size_t page_cnt, bool alloc);
 
 /* multiboot info */
 struct multiboot_info {
@@ -63,174 +187,183 @@ struct e820_entry {
 	uint32_t type;
 };
 
-/* Represent the range information of the ext_mem/base_mem */
+/* A range of usable physical memory. */
 struct area {
 	uint64_t start;
 	uint64_t end;
-	uint64_t size;
 };
 
-#define BASE_MEM_THRESHOLD 0x100000
 #define USABLE 1
+#define RESERVED 2
 #define ACPI_RECLAIMABLE 3
+#define ACPI_NVS 4
+#define BAD_MEMORY 5
 #define APPEND_HILO(hi, lo) (((uint64_t) ((hi)) << 32) + (lo))
 
-/* Iterate on the e820 entry, parse the range of basemem and extmem. */
+/* Prints the E820 memory map. */
 static void
-resolve_area_info (struct area *base_mem, struct area *ext_mem) {
+print_memory_map (void) {
+	static const char *type_names[] = {
+		[USABLE] = "usable",
+		[RESERVED] = "reserved",
+		[ACPI_RECLAIMABLE] = "ACPI reclaimable",
+		[ACPI_NVS] = "ACPI NVS",
+		[BAD_MEMORY] = "bad",
+	};
 	struct multiboot_info *mb_info = ptov (MULTIBOOT_INFO);
 	struct e820_entry *entries = ptov (mb_info->mmap_base);
 	uint32_t i;
 
 	for (i = 0; i < mb_info->mmap_len / sizeof (struct e820_entry); i++) {
 		struct e820_entry *entry = &entries[i];
-		if (entry->type == ACPI_RECLAIMABLE || entry->type == USABLE) {
-			uint64_t start = APPEND_HILO (entry->mem_hi, entry->mem_lo);
-			uint64_t size = APPEND_HILO (entry->len_hi, entry->len_lo);
-			uint64_t end = start + size;
-			printf("%llx ~ %llx %d\n", start, end, entry->type);
-
-			struct area *area = start < BASE_MEM_THRESHOLD ? base_mem : ext_mem;
-
-			// First entry that belong to this area.
-			if (area->size == 0) {
-				*area = (struct area) {
-					.start = start,
-					.end = end,
-					.size = size,
-				};
-			} else {  // otherwise
-				// Extend start
-				if (area->start > start)
-					area->start = start;
-				// Extend end
-				if (area->end < end)
-					area->end = end;
-				// Extend size
-				area->size += size;
+		uint64_t start = APPEND_HILO (entry->mem_hi, entry->mem_lo);
+		uint64_t size = APPEND_HILO (entry->len_hi, entry->len_lo);
+		const char *type = entry->type <= BAD_MEMORY
+			&& type_names[entry->type] != NULL ? type_names[entry->type]
+			: "unknown";
+
+		printf ("\tmem: 0x%llx ~ 0x%llx %s (%'llu kB)\n",
+				start, start + size, type, size / 1024);
+	}
+}
+
+/* Stores into AREAS, in order of address, the usable ranges of
+   the E820 map, whole pages of them at or above FLOOR, merging
+   ranges that touch.  Returns the number of areas, at most MAX.
+   Areas that do not fit are dropped with a warning. */
+static size_t
+resolve_areas (struct area areas[], size_t max, uint64_t floor) {
+	struct multiboot_info *mb_info = ptov (MULTIBOOT_INFO);
+	struct e820_entry *entries = ptov (mb_info->mmap_base);
+	size_t cnt = 0;
+	uint32_t i;
+
+	for (i = 0; i < mb_info->mmap_len / sizeof (struct e820_entry); i++) {
+		struct e820_entry *entry = &entries[i];
+		uint64_t start, end;
+		size_t j;
+
+		if (entry->type != ACPI_RECLAIMABLE && entry->type != USABLE)
+			continue;
+		start = APPEND_HILO (entry->mem_hi, entry->mem_lo);
+		end = start + APPEND_HILO (entry->len_hi, entry->len_lo);
+		start = ROUND_UP (start > floor ? start : floor, PGSIZE);
+		end = ROUND_DOWN (end, PGSIZE);
+		if (start >= end)
+			continue;
+
+		/* Find the place of [START, END) among the areas, merging it
+		   into any that it touches. */
+		for (j = 0; j < cnt && areas[j].end < start; j++)
+			continue;
+		if (j < cnt && areas[j].start <= end) {
+			if (start < areas[j].start)
+				areas[j].start = start;
+			if (end > areas[j].end)
+				areas[j].end = end;
+			while (j + 1 < cnt && areas[j + 1].start <= areas[j].end) {
+				if (areas[j + 1].end > areas[j].end)
+					areas[j].end = areas[j + 1].end;
+				memmove (&areas[j + 1], &areas[j + 2],
+						(cnt - j - 2) * sizeof *areas);
+				cnt--;
 			}
-		}
+		} else if (cnt < max) {
+			memmove (&areas[j + 1], &areas[j], (cnt - j) * sizeof *areas);
+			areas[j] = (struct area) { .start = start, .end = end };
+			cnt++;
+		} else
+			printf ("palloc: ignoring memory at 0x%llx ~ 0x%llx\n",
+					start, end);
 	}
+	return cnt;
+}
+
+/* Adds a pool of class C spanning physical memory [START, END),
+   with its bitmap at *BM_BASE. */
+static void
+add_pool (struct pool_class *c, void **bm_base, uint64_t start,
+		uint64_t end) {
+	struct pool *p = &pools[pool_cnt++];
+
+	ASSERT (c->pool_cnt < POOL_MAX);
+	init_pool (p, bm_base, (uint64_t) ptov (start), (uint64_t) ptov (end),
+			c->lock_name);
+	c->pools[c->pool_cnt++] = p;
 }
 
 /*
- * Populate the pool.
+ * Populate the pools from the usable areas AREAS[0...CNT).
  * All the pages are manged by this allocator, even include code page.
  * Basically, give half of memory to kernel, half to user.
- * We push base_mem portion to the kernel as much as possible.
+ * The kernel's half is the lowest memory, the user's what is above
+ * it.  Each area, or each part of the one that is split between the
+ * two, becomes a pool of its own, with its own bitmap, so that the
+ * holes between areas cost nothing.
  */
 static void
-populate_pools (struct area *base_mem, struct area *ext_mem) {
+populate_pools (const struct area areas[], size_t cnt) {
 	extern char _end;
 	void *free_start = pg_round_up (&_end);
+	uint64_t total_pages = 0, user_pages, kern_pages;
+	size_t i;
 
-	uint64_t total_pages = (base_mem->size + ext_mem->size) / PGSIZE;
-	uint64_t user_pages = total_pages / 2 > user_page_limit ?
+	for (i = 0; i < cnt; i++)
+		total_pages += (areas[i].end - areas[i].start) / PGSIZE;
+	user_pages = total_pages / 2 > user_page_limit ?
 		user_page_limit : total_pages / 2;
-	uint64_t kern_pages = total_pages - user_pages;
+	kern_pages = total_pages - user_pages;
 
-	// Parse E820 map to claim the memory region for each pool.
-	enum { KERN_START, KERN, USER_START, USER } state = KERN_START;
-	uint64_t rem = kern_pages;
-	uint64_t region_start = 0, end = 0, start, size, size_in_pg;
+	for (i = 0; i < cnt; i++) {
+		uint64_t start = areas[i].start, end = areas[i].end;
+		uint64_t kern_end = end;
 
-	struct multiboot_info *mb_info = ptov (MULTIBOOT_INFO);
-	struct e820_entry *entries = ptov (mb_info->mmap_base);
+		if (kern_pages < (end - start) / PGSIZE)
+			kern_end = start + kern_pages * PGSIZE;
+		if (kern_end > start) {
+			add_pool (&kernel_class, &free_start, start, kern_end);
+			kern_pages -= (kern_end - start) / PGSIZE;
+		}
+		if (end > kern_end)
+			add_pool (&user_class, &free_start, kern_end, end);
+	}
 
-	uint32_t i;
-	for (i = 0; i < mb_info->mmap_len / sizeof (struct e820_entry); i++) {
-		struct e820_entry *entry = &entries[i];
-		if (entry->type == ACPI_RECLAIMABLE || entry->type == USABLE) {
-			start = (uint64_t) ptov (APPEND_HILO (entry->mem_hi, entry->mem_lo));
-			size = APPEND_HILO (entry->len_hi, entry->len_lo);
-			end = start + size;
-			size_in_pg = size / PGSIZE;
-
-			if (state == KERN_START) {
-				region_start = start;
-				state = KERN;
-			}
+	/* Every class has a pool, if an empty one. */
+	if (kernel_class.pool_cnt == 0)
+		add_pool (&kernel_class, &free_start, 0, 0);
+	if (user_class.pool_cnt == 0)
+		add_pool (&user_class, &free_start, 0, 0);
 
-			switch (state) {
-				case KERN:
-					if (rem > size_in_pg) {
-						rem -= size_in_pg;
-						break;
-					}
-					// generate kernel pool
-					init_pool (&kernel_pool,
-							&free_start, region_start, start + rem * PGSIZE);
-					// Transition to the next state
-					if (rem == size_in_pg) {
-						rem = user_pages;
-						state = USER_START;
-					} else {
-						region_start = start + rem * PGSIZE;
-						rem = user_pages - size_in_pg + rem;
-						state = USER;
-					}
-					break;
-				case USER_START:
-					region_start = start;
-					state = USER;
-					break;
-				case USER:
-					if (rem > size_in_pg) {
-						rem -= size_in_pg;
-						break;
-					}
-					ASSERT (rem == size);
-					break;
-				default:
-					NOT_REACHED ();
-			}
-		}
+	/* Free the pages of every pool, but for the bitmaps, which all
+	   went at the end of the kernel. */
+	for (i = 0; i < pool_cnt; i++) {
+		struct pool *pool = &pools[i];
+		uint8_t *start = pool->base;
+		uint8_t *end = pool->base + bitmap_size (pool->used_map) * PGSIZE;
+
+		if (start < (uint8_t *) free_start)
+			start = free_start;
+		if (start < end)
+			bitmap_set_multiple (pool->used_map,
+					pg_no (start) - pg_no (pool->base),
+					(end - start) / PGSIZE, false);
+		pool->page_cnt = bitmap_count (pool->used_map, 0,
+				bitmap_size (pool->used_map), false);
 	}
+}
 
-	// generate the user pool
-	init_pool(&user_pool, &free_start, region_start, end);
+/* Prints the pools of class C. */
+static void
+print_pools (const struct pool_class *c) {
+	size_t i;
 
-	// Iterate over the e820_entry. Setup the usable.
-	uint64_t usable_bound = (uint64_t) free_start;
-	struct pool *pool;
-	void *pool_end;
-	size_t page_idx, page_cnt;
+	for (i = 0; i < c->pool_cnt; i++) {
+		const struct pool *p = c->pools[i];
 
-	for (i = 0; i < mb_info->mmap_len / sizeof (struct e820_entry); i++) {
-		struct e820_entry *entry = &entries[i];
-		if (entry->type == ACPI_RECLAIMABLE || entry->type == USABLE) {
-			uint64_t start = (uint64_t)
-				ptov (APPEND_HILO (entry->mem_hi, entry->mem_lo));
-			uint64_t size = APPEND_HILO (entry->len_hi, entry->len_lo);
-			uint64_t end = start + size;
-
-			// TODO: add 0x1000 ~ 0x200000, This is not a matter for now.
-			// All the pages are unuable
-			if (end < usable_bound)
-				continue;
-
-			start = (uint64_t)
-				pg_round_up (start >= usable_bound ? start : usable_bound);
-split:
-			if (page_from_pool (&kernel_pool, (void *) start))
-				pool = &kernel_pool;
-			else if (page_from_pool (&user_pool, (void *) start))
-				pool = &user_pool;
-			else
-				NOT_REACHED ();
-
-			pool_end = pool->base + bitmap_size (pool->used_map) * PGSIZE;
-			page_idx = pg_no (start) - pg_no (pool->base);
-			if ((uint64_t) pool_end < end) {
-				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
-				start = (uint64_t) pool_end;
-				goto split;
-			} else {
-				page_cnt = ((uint64_t) end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
-			}
-		}
+		printf ("\t%s: 0x%llx ~ 0x%llx (Usable: %'zu kB)\n", c->lock_name,
+				vtop (p->base),
+				vtop (p->base) + bitmap_size (p->used_map) * PGSIZE,
+				p->page_cnt * (PGSIZE / 1024));
 	}
 }
 
@@ -240,39 +373,187 @@ palloc_init (void) {
   /* End of the kernel as recorded by the linker.
      See kernel.lds.S. */
 	extern char _end;
-	struct area base_mem = { .size = 0 };
-	struct area ext_mem = { .size = 0 };
+	struct area areas[POOL_MAX - 1];
+	size_t area_cnt, i;
 
-	resolve_area_info (&base_mem, &ext_mem);
 	printf ("Pintos booting with: \n");
-	printf ("\tbase_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
-		  base_mem.start, base_mem.end, base_mem.size / 1024);
-	printf ("\text_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
-		  ext_mem.start, ext_mem.end, ext_mem.size / 1024);
-	populate_pools (&base_mem, &ext_mem);
-	return ext_mem.end;
+	print_memory_map ();
+	area_cnt = resolve_areas (areas, sizeof areas / sizeof *areas,
+			vtop (pg_round_up (&_end)));
+	populate_pools (areas, area_cnt);
+	print_pools (&kernel_class);
+	print_pools (&user_class);
+	lock_init (&split_lock);
+	if (palloc_buddy)
+		for (i = 0; i < pool_cnt; i++)
+			buddy_init (&pools[i]);
+	return area_cnt > 0 ? areas[area_cnt - 1].end : 0;
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the pages are filled with zeros.  If too few pages are
-   available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   then the pages are filled with zeros.  If that pool has too few
+   pages, they are borrowed from the other pool, if it can spare
+   them.  If neither has enough, returns a null pointer, unless
+   PAL_ASSERT is set in FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
-	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	struct pool_class *c = class_of (flags);
+	void *pages = class_get (c, flags, page_cnt);
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
-	void *pages;
+	if (pages == NULL)
+		pages = pool_borrow (flags, page_cnt);
+	if (pages == NULL) {
+		stats_account (c->pools[0], 0, true);
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get: out of pages");
+	}
+	return pages;
+}
 
-	if (page_idx != BITMAP_ERROR)
-		pages = pool->base + PGSIZE * page_idx;
-	else
-		pages = NULL;
+/* Returns the class of pages that FLAGS ask for. */
+static struct pool_class *
+class_of (enum palloc_flags flags) {
+	return flags & PAL_USER ? &user_class : &kernel_class;
+}
+
+/* Takes PAGE_CNT contiguous pages from the first pool of class C
+   that has them, as pool_get() does, or returns a null pointer. */
+static void *
+class_get (struct pool_class *c, enum palloc_flags flags,
+		size_t page_cnt) {
+	void *pages = NULL;
+	size_t i;
 
+	for (i = 0; i < c->pool_cnt && pages == NULL; i++)
+		pages = pool_get (c->pools[i], flags, page_cnt);
+	return pages;
+}
+
+/* Returns the number of pages of class C, and stores the number of
+   them handed out into *LIVE_CNT.  Takes no lock. */
+static size_t
+class_count (const struct pool_class *c, size_t *live_cnt) {
+	size_t page_cnt = 0;
+	size_t i;
+
+	*live_cnt = 0;
+	for (i = 0; i < c->pool_cnt; i++) {
+		page_cnt += c->pools[i]->page_cnt;
+		*live_cnt += c->pools[i]->live_cnt;
+	}
+	return page_cnt;
+}
+
+/* Takes PAGE_CNT contiguous pages from POOL, zeroed if PAL_ZERO is
+   set in FLAGS, and accounts for them, or returns a null pointer if
+   POOL has too few. */
+static void *
+pool_get (struct pool *pool, enum palloc_flags flags, size_t page_cnt) {
+	void *pages = NULL;
+
+	if (page_cnt == 1) {
+		/* A pre-zeroed page saves the memset, so prefer one for
+		   PAL_ZERO; otherwise use it only as a last resort. */
+		if (flags & PAL_ZERO) {
+			pages = zeroed_get (pool);
+			if (pages != NULL) {
+				stats_account (pool, 1, true);
+				return pages;
+			}
+		}
+		pages = magazine_get (pool);
+		if (pages == NULL)
+			pages = zeroed_get (pool);
+	} else {
+		lock_acquire (&pool->lock);
+		size_t page_idx = pool_scan (pool, page_cnt);
+		lock_release (&pool->lock);
+
+		if (page_idx != BITMAP_ERROR)
+			pages = pool->base + PGSIZE * page_idx;
+	}
+
+	if (pages != NULL) {
+		stats_account (pool, page_cnt, true);
+		if (flags & PAL_ZERO)
+			memset (pages, 0, PGSIZE * page_cnt);
+	}
+	return pages;
+}
+
+/* Lends PAGE_CNT pages of the pool that FLAGS does not choose to
+   the class that it does, if palloc_borrow and that pool keeps more
+   than its reserve free, and returns them, or a null pointer.
+
+   The kernel maps the kernel pool with 2 MB pages, but page
+   replacement tests a user frame's accessed and dirty bits through
+   its own kernel mapping, so pages lent to the user class have
+   their 2 MB mappings split first.  Splitting allocates a page
+   table, so it cannot be done from an interrupt handler. */
+static void *
+pool_borrow (enum palloc_flags flags, size_t page_cnt) {
+	struct pool_class *lender = class_of (flags ^ PAL_USER);
+	struct pool *pool;
+	size_t live_cnt, lender_cnt = class_count (lender, &live_cnt);
+	size_t reserve = lender_cnt / BORROW_RESERVE;
+	uint8_t *pages, *va;
+
+	if (!palloc_borrow || lender_cnt - live_cnt < reserve + page_cnt)
+		return NULL;
+	if (flags & PAL_USER && (base_pml4 == NULL || intr_context ()))
+		return NULL;
+
+	pages = class_get (lender, flags, page_cnt);
+	if (pages == NULL)
+		return NULL;
+	if (flags & PAL_USER) {
+		lock_acquire (&split_lock);
+		va = (uint8_t *) ((uint64_t) pages & ~(HUGE_PGSIZE - 1));
+		for (; va < pages + page_cnt * PGSIZE; va += HUGE_PGSIZE)
+			if (!pml4_split_huge (base_pml4, va))
+				break;
+		lock_release (&split_lock);
+		if (va < pages + page_cnt * PGSIZE) {
+			palloc_free_multiple (pages, page_cnt);
+			return NULL;
+		}
+	}
+
+	pool = pool_of (pages);
+	spin_lock (&pool->stats_lock);
+	pool->lent_cnt += page_cnt;
+	spin_unlock (&pool->stats_lock);
+	return pages;
+}
+
+/* Like palloc_get_multiple(), but the first page is aligned to
+   ALIGN pages in physical memory.  ALIGN must be a power of 2 no
+   smaller than PAGE_CNT.  Pages come straight from the pool, never
+   from the magazine or the pre-zeroed pages. */
+void *
+palloc_get_aligned (enum palloc_flags flags, size_t page_cnt, size_t align) {
+	struct pool_class *c = class_of (flags);
+	struct pool *pool = c->pools[0];
+	void *pages = NULL;
+	size_t i;
+
+	ASSERT (align != 0 && (align & (align - 1)) == 0);
+	ASSERT (page_cnt <= align);
+
+	for (i = 0; i < c->pool_cnt && pages == NULL; i++) {
+		size_t page_idx;
+
+		pool = c->pools[i];
+		lock_acquire (&pool->lock);
+		page_idx = pool_scan_aligned (pool, page_cnt, align);
+		lock_release (&pool->lock);
+		if (page_idx != BITMAP_ERROR)
+			pages = pool->base + PGSIZE * page_idx;
+	}
+
+	stats_account (pool, pages != NULL ? page_cnt : 0, true);
 	if (pages) {
 		if (flags & PAL_ZERO)
 			memset (pages, 0, PGSIZE * page_cnt);
@@ -280,10 +561,52 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 		if (flags & PAL_ASSERT)
 			PANIC ("palloc_get: out of pages");
 	}
-
 	return pages;
 }
 
+/* Resizes the PAGE_CNT pages at PAGES, which came from
+   palloc_get_multiple(), to NEW_CNT pages without moving them, by
+   freeing the pages past the new end or by taking the pages after
+   the old end, if they are free and in the same pool.  Returns
+   true if successful.  The buddy allocator can neither split nor
+   join its blocks this way, so with it this always fails unless
+   the size stays the same. */
+bool
+palloc_resize (void *pages, size_t page_cnt, size_t new_cnt) {
+	struct pool *pool;
+	size_t page_idx, extra;
+	bool ok;
+
+	ASSERT (pg_ofs (pages) == 0);
+	ASSERT (page_cnt > 0 && new_cnt > 0);
+
+	if (new_cnt == page_cnt)
+		return true;
+	if (palloc_buddy)
+		return false;
+	if (new_cnt < page_cnt) {
+		palloc_free_multiple ((uint8_t *) pages + new_cnt * PGSIZE,
+				page_cnt - new_cnt);
+		return true;
+	}
+
+	pool = pool_of (pages);
+	page_idx = pg_no (pages) - pg_no (pool->base);
+	extra = new_cnt - page_cnt;
+	if (page_idx + new_cnt > bitmap_size (pool->used_map))
+		return false;
+
+	lock_acquire (&pool->lock);
+	ok = bitmap_none (pool->used_map, page_idx + page_cnt, extra);
+	if (ok)
+		bitmap_set_multiple (pool->used_map, page_idx + page_cnt, extra, true);
+	lock_release (&pool->lock);
+
+	if (ok)
+		stats_account (pool, extra, true);
+	return ok;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -296,6 +619,344 @@ palloc_get_page (enum palloc_flags flags) {
 	return palloc_get_multiple (flags, 1);
 }
 
+/* Finds PAGE_CNT free contiguous pages in POOL, marks them used,
+   and returns the index of the first, or BITMAP_ERROR if there are
+   none.  POOL's lock must be held.
+
+   Next fit: scanning resumes where the last allocation ended, so
+   that the allocated prefix of the pool is not walked again every
+   time, and wraps around once if that fails. */
+static size_t
+pool_scan (struct pool *pool, size_t page_cnt) {
+	size_t page_idx;
+
+	ASSERT (lock_held_by_current_thread (&pool->lock));
+
+	if (palloc_buddy)
+		return buddy_alloc (pool, page_cnt);
+
+	page_idx = bitmap_scan_and_flip (pool->used_map, pool->next_fit,
+			page_cnt, false);
+	if (page_idx == BITMAP_ERROR && pool->next_fit != 0)
+		page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+	if (page_idx != BITMAP_ERROR)
+		pool->next_fit = page_idx + page_cnt;
+	return page_idx;
+}
+
+/* Like pool_scan(), but the first page found is aligned to ALIGN
+   pages in physical memory.  Buddy blocks are aligned to their
+   size within the pool, so that backend only serves pools whose
+   base is itself aligned. */
+static size_t
+pool_scan_aligned (struct pool *pool, size_t page_cnt, size_t align) {
+	size_t pool_pages = bitmap_size (pool->used_map);
+	size_t page_idx;
+
+	ASSERT (lock_held_by_current_thread (&pool->lock));
+
+	page_idx = (align - pg_no (pool->base) % align) % align;
+	if (palloc_buddy)
+		return page_idx == 0 ? buddy_alloc (pool, align) : BITMAP_ERROR;
+
+	for (; page_idx + page_cnt <= pool_pages; page_idx += align)
+		if (bitmap_none (pool->used_map, page_idx, page_cnt)) {
+			bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+			return page_idx;
+		}
+	return BITMAP_ERROR;
+}
+
+/* Marks the PAGE_CNT pages starting at PAGE_IDX in POOL, which
+   were returned by pool_scan(), as free.  Never sleeps. */
+static void
+pool_release (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	if (palloc_buddy)
+		buddy_free (pool, page_idx, page_cnt);
+	else
+		bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+}
+
+/* Returns the smallest order whose blocks hold PAGE_CNT pages. */
+static unsigned
+buddy_order (size_t page_cnt) {
+	unsigned order = 0;
+
+	while (((size_t) 1 << order) < page_cnt)
+		order++;
+	return order;
+}
+
+/* Returns the header of the block starting at PAGE_IDX in POOL. */
+static struct buddy_block *
+block_at (struct pool *pool, size_t page_idx) {
+	return (struct buddy_block *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Adds the free block of 2**ORDER pages at PAGE_IDX to POOL's free
+   lists. */
+static void
+buddy_push (struct pool *pool, size_t page_idx, unsigned order) {
+	struct buddy_block *block = block_at (pool, page_idx);
+
+	block->order = order;
+	block->magic = BUDDY_MAGIC;
+	list_push_front (&pool->buddy_free[order], &block->elem);
+}
+
+/* Builds POOL's buddy free lists from the free pages in its bitmap,
+   cutting each run of free pages into the largest aligned blocks
+   that fit. */
+static void
+buddy_init (struct pool *pool) {
+	size_t page_cnt = bitmap_size (pool->used_map);
+	size_t page_idx = 0;
+	unsigned order;
+
+	spin_init (&pool->buddy_lock);
+	for (order = 0; order < BUDDY_ORDERS; order++)
+		list_init (&pool->buddy_free[order]);
+
+	while (page_idx < page_cnt) {
+		if (bitmap_test (pool->used_map, page_idx)) {
+			page_idx++;
+			continue;
+		}
+		for (order = 0; order + 1 < BUDDY_ORDERS; order++) {
+			size_t size = (size_t) 1 << (order + 1);
+			if (page_idx % size != 0 || page_idx + size > page_cnt
+					|| bitmap_any (pool->used_map, page_idx, size))
+				break;
+		}
+		buddy_push (pool, page_idx, order);
+		page_idx += (size_t) 1 << order;
+	}
+}
+
+/* Allocates a block of at least PAGE_CNT pages from POOL in
+   O(log n), splitting a larger block if needed, and returns the
+   index of its first page or BITMAP_ERROR if there is none. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt) {
+	unsigned want = buddy_order (page_cnt);
+	unsigned order;
+	size_t page_idx = BITMAP_ERROR;
+
+	spin_lock (&pool->buddy_lock);
+	for (order = want; order < BUDDY_ORDERS; order++)
+		if (!list_empty (&pool->buddy_free[order]))
+			break;
+	if (order < BUDDY_ORDERS) {
+		struct buddy_block *block = list_entry (
+				list_pop_front (&pool->buddy_free[order]),
+				struct buddy_block, elem);
+
+		ASSERT (block->magic == BUDDY_MAGIC && block->order == order);
+		block->magic = 0;
+		page_idx = pg_no (block) - pg_no (pool->base);
+
+		/* Give back the upper halves we don't need. */
+		while (order > want) {
+			order--;
+			buddy_push (pool, page_idx + ((size_t) 1 << order), order);
+		}
+		bitmap_set_multiple (pool->used_map, page_idx,
+				(size_t) 1 << want, true);
+	}
+	spin_unlock (&pool->buddy_lock);
+	return page_idx;
+}
+
+/* Frees the block at PAGE_IDX in POOL that buddy_alloc() returned
+   for PAGE_CNT pages, merging it with its buddy for as long as the
+   buddy is a free block of the same size.  O(log n). */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	size_t pool_pages = bitmap_size (pool->used_map);
+	unsigned order = buddy_order (page_cnt);
+
+	ASSERT (page_idx % ((size_t) 1 << order) == 0);
+
+	spin_lock (&pool->buddy_lock);
+	bitmap_set_multiple (pool->used_map, page_idx, (size_t) 1 << order, false);
+	while (order + 1 < BUDDY_ORDERS) {
+		size_t buddy_idx = page_idx ^ ((size_t) 1 << order);
+		struct buddy_block *buddy;
+
+		/* The buddy's first page is free only if it heads a free
+		   block, since any larger free block around it would
+		   contain this one too. */
+		if (buddy_idx + ((size_t) 1 << order) > pool_pages
+				|| bitmap_test (pool->used_map, buddy_idx))
+			break;
+		buddy = block_at (pool, buddy_idx);
+		ASSERT (buddy->magic == BUDDY_MAGIC);
+		if (buddy->order != order)
+			break;
+
+		list_remove (&buddy->elem);
+		buddy->magic = 0;
+		if (buddy_idx < page_idx)
+			page_idx = buddy_idx;
+		order++;
+	}
+	buddy_push (pool, page_idx, order);
+	spin_unlock (&pool->buddy_lock);
+}
+
+/* Takes a pre-zeroed page from POOL, or returns a null pointer if
+   there is none.  Wakes up the zeroer when the supply runs low. */
+static void *
+zeroed_get (struct pool *pool) {
+	void *page = NULL;
+	bool wake = false;
+
+	spin_lock (&pool->mag_lock);
+	if (pool->zeroed_cnt > 0) {
+		page = pool->zeroed[--pool->zeroed_cnt];
+		if (zeroer_sleeping && pool->zeroed_cnt < ZEROED_MAX / 2) {
+			zeroer_sleeping = false;
+			wake = true;
+		}
+	}
+	spin_unlock (&pool->mag_lock);
+
+	if (wake)
+		sema_up (&zeroer_wakeup);
+	return page;
+}
+
+/* Zeroes free pages of POOL until it has ZEROED_MAX of them or runs
+   out of free pages.  Returns false in the second case. */
+static bool
+zero_pages (struct pool *pool) {
+	for (;;) {
+		void *page;
+		bool full;
+
+		spin_lock (&pool->mag_lock);
+		full = pool->zeroed_cnt >= ZEROED_MAX;
+		spin_unlock (&pool->mag_lock);
+		if (full)
+			return true;
+
+		page = magazine_get (pool);
+		if (page == NULL)
+			return false;
+		clear_page (page);
+
+		spin_lock (&pool->mag_lock);
+		if (pool->zeroed_cnt < ZEROED_MAX) {
+			pool->zeroed[pool->zeroed_cnt++] = page;
+			page = NULL;
+		}
+		spin_unlock (&pool->mag_lock);
+		if (page != NULL)
+			magazine_put (pool, page);
+	}
+}
+
+/* Zeroer thread.  Runs at the lowest priority, so as to use only
+   time the idle thread would otherwise get, keeping a supply of
+   pre-zeroed pages so that PAL_ZERO requests skip the memset. */
+static void
+zeroer (void *aux UNUSED) {
+	if (thread_mlfqs)
+		thread_set_nice (20);
+
+	for (;;) {
+		bool all_ok = true;
+		size_t i;
+
+		for (i = 0; i < pool_cnt; i++)
+			if (!zero_pages (&pools[i]))
+				all_ok = false;
+
+		if (all_ok) {
+			/* All supplies full: wait until one runs low. */
+			enum intr_level old_level = intr_disable ();
+			zeroer_sleeping = true;
+			sema_down (&zeroer_wakeup);
+			intr_set_level (old_level);
+		} else {
+			/* Out of free pages: try again later. */
+			timer_sleep (TIMER_FREQ);
+		}
+	}
+}
+
+/* Starts the background page zeroer.  Must be called after the
+   thread system is started. */
+void
+palloc_start_zeroer (void) {
+	sema_init (&zeroer_wakeup, 0);
+	thread_create ("zeroer", PRI_MIN, zeroer, NULL);
+}
+
+/* Takes a single page from POOL's magazine, refilling it from the
+   bitmap first if it is empty.  Returns a null pointer if POOL has
+   no free page. */
+static void *
+magazine_get (struct pool *pool) {
+	void *page = NULL;
+
+	spin_lock (&pool->mag_lock);
+	if (pool->mag_cnt > 0)
+		page = pool->mag[--pool->mag_cnt];
+	spin_unlock (&pool->mag_lock);
+	if (page != NULL)
+		return page;
+
+	/* Refill.  The bitmap is scanned without the spinlock held,
+	   since taking the pool lock may sleep. */
+	void *batch[MAG_BATCH];
+	size_t batch_cnt = 0;
+
+	lock_acquire (&pool->lock);
+	while (batch_cnt < MAG_BATCH) {
+		size_t page_idx = pool_scan (pool, 1);
+		if (page_idx == BITMAP_ERROR)
+			break;
+		batch[batch_cnt++] = pool->base + PGSIZE * page_idx;
+	}
+	lock_release (&pool->lock);
+
+	if (batch_cnt == 0)
+		return NULL;
+	page = batch[--batch_cnt];
+	while (batch_cnt > 0)
+		magazine_put (pool, batch[--batch_cnt]);
+	return page;
+}
+
+/* Puts PAGE, which is marked used in POOL's bitmap, into POOL's
+   magazine.  If the magazine is full, first returns MAG_BATCH of
+   its pages to the bitmap.  Never sleeps, so it is safe with
+   interrupts off. */
+static void
+magazine_put (struct pool *pool, void *page) {
+	spin_lock (&pool->mag_lock);
+	if (pool->mag_cnt == MAG_SIZE) {
+		while (pool->mag_cnt > MAG_SIZE - MAG_BATCH) {
+			void *drained = pool->mag[--pool->mag_cnt];
+			pool_release (pool, pg_no (drained) - pg_no (pool->base), 1);
+		}
+	}
+	pool->mag[pool->mag_cnt++] = page;
+	spin_unlock (&pool->mag_lock);
+}
+
+/* Returns the pool that PAGE belongs to. */
+static struct pool *
+pool_of (void *page) {
+	size_t i;
+
+	for (i = 0; i < pool_cnt; i++)
+		if (page_from_pool (&pools[i], page))
+			return &pools[i];
+	NOT_REACHED ();
+}
+
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) {
@@ -306,20 +967,68 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 	if (pages == NULL || page_cnt == 0)
 		return;
 
-	if (page_from_pool (&kernel_pool, pages))
-		pool = &kernel_pool;
-	else if (page_from_pool (&user_pool, pages))
-		pool = &user_pool;
-	else
-		NOT_REACHED ();
-
+	pool = pool_of (pages);
 	page_idx = pg_no (pages) - pg_no (pool->base);
 
 #ifndef NDEBUG
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	stats_account (pool, page_cnt, false);
+	if (page_cnt == 1)
+		magazine_put (pool, pages);
+	else
+		pool_release (pool, page_idx, page_cnt);
+}
+
+/* Frees the CNT pages in PAGES, which need not be contiguous.
+   Each run of pages from the same pool is accounted for and put
+   into the pool's magazine under one acquisition of its locks, and
+   what does not fit in the magazine goes straight back to the
+   pool.  Never sleeps. */
+void
+palloc_free_pages (void *pages[], size_t cnt) {
+	size_t i = 0;
+
+	while (i < cnt) {
+		struct pool *pool = pool_of (pages[i]);
+		size_t end;
+
+		for (end = i; end < cnt && page_from_pool (pool, pages[end]); end++) {
+			ASSERT (pg_ofs (pages[end]) == 0);
+			ASSERT (bitmap_test (pool->used_map,
+						pg_no (pages[end]) - pg_no (pool->base)));
+#ifndef NDEBUG
+			memset (pages[end], 0xcc, PGSIZE);
+#endif
+		}
+		stats_account (pool, end - i, false);
+
+		spin_lock (&pool->mag_lock);
+		for (; i < end; i++) {
+			if (pool->mag_cnt < MAG_SIZE)
+				pool->mag[pool->mag_cnt++] = pages[i];
+			else
+				pool_release (pool, pg_no (pages[i]) - pg_no (pool->base), 1);
+		}
+		spin_unlock (&pool->mag_lock);
+	}
+}
+
+/* Returns true if any page in [START, END) belongs to a user
+   pool. */
+bool
+palloc_user_overlaps (const void *start, const void *end) {
+	size_t i;
+
+	for (i = 0; i < user_class.pool_cnt; i++) {
+		const struct pool *p = user_class.pools[i];
+		const uint8_t *p_end = p->base + PGSIZE * bitmap_size (p->used_map);
+
+		if ((const uint8_t *) start < p_end && (const uint8_t *) end > p->base)
+			return true;
+	}
+	return false;
 }
 
 /* Frees the page at PAGE. */
@@ -328,9 +1037,11 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END */
+/* Initializes pool P as starting at START and ending at END, with
+   its lock named LOCK_NAME. */
 static void
-init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
+init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end,
+		const char *lock_name) {
   /* We'll put the pool's used_map at its base.
      Calculate the space needed for the bitmap
      and subtract it from the pool's size. */
@@ -338,6 +1049,14 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
 	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
 
 	lock_init(&p->lock);
+	lock_set_name (&p->lock, lock_name);
+	p->next_fit = 0;
+	spin_init (&p->mag_lock);
+	p->mag_cnt = 0;
+	p->zeroed_cnt = 0;
+	spin_init (&p->stats_lock);
+	p->page_cnt = p->live_cnt = p->peak_cnt = p->failed_cnt = 0;
+	p->lent_cnt = 0;
 	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
 	p->base = (void *) start;
 
@@ -356,3 +1075,205 @@ page_from_pool (const struct pool *pool, void *page) {
 	size_t end_page = start_page + bitmap_size (pool->used_map);
 	return page_no >= start_page && page_no < end_page;
 }
+
+/* Records in POOL's statistics that PAGE_CNT pages were allocated,
+   if ALLOC, or freed, otherwise.  An allocation of 0 pages is a
+   failed request. */
+static void
+stats_account (struct pool *pool, size_t page_cnt, bool alloc) {
+	spin_lock (&pool->stats_lock);
+	if (!alloc) {
+		ASSERT (pool->live_cnt >= page_cnt);
+		pool->live_cnt -= page_cnt;
+	} else if (page_cnt == 0)
+		pool->failed_cnt++;
+	else {
+		pool->live_cnt += page_cnt;
+		if (pool->live_cnt > pool->peak_cnt)
+			pool->peak_cnt = pool->live_cnt;
+	}
+	spin_unlock (&pool->stats_lock);
+}
+
+/* Fills PAGE, which must be page-aligned, with zeros: with SSE2
+   non-temporal stores of 64 bytes at a time, which leave the
+   caches alone, if the CPU has SSE2, or else a word at a time. */
+void
+clear_page (void *page) {
+	size_t words = PGSIZE / sizeof (uint64_t);
+	size_t lines = PGSIZE / 64;
+
+	ASSERT (pg_ofs (page) == 0);
+	if (!fpu_has_sse2 ()) {
+		asm volatile ("rep stosq"
+				: "+D" (page), "+c" (words) : "a" (0) : "memory");
+		return;
+	}
+
+	kernel_fpu_begin ();
+	asm volatile ("pxor %%xmm0, %%xmm0\n"
+			"1:\n"
+			"movntdq %%xmm0, (%0)\n"
+			"movntdq %%xmm0, 16(%0)\n"
+			"movntdq %%xmm0, 32(%0)\n"
+			"movntdq %%xmm0, 48(%0)\n"
+			"addq $64, %0\n"
+			"decq %1\n"
+			"jnz 1b\n"
+			"sfence"
+			: "+r" (page), "+r" (lines) : : "cc", "memory");
+	kernel_fpu_end ();
+}
+
+/* Copies page SRC to page DST, both page-aligned: with SSE2, 64
+   bytes at a time, if the CPU has it, or else a word at a time. */
+void
+copy_page (void *dst, const void *src) {
+	size_t words = PGSIZE / sizeof (uint64_t);
+	size_t lines = PGSIZE / 64;
+
+	ASSERT (pg_ofs (dst) == 0 && pg_ofs (src) == 0);
+	if (!fpu_has_sse2 ()) {
+		asm volatile ("rep movsq"
+				: "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+		return;
+	}
+
+	kernel_fpu_begin ();
+	asm volatile ("1:\n"
+			"movdqa (%1), %%xmm0\n"
+			"movdqa 16(%1), %%xmm1\n"
+			"movdqa 32(%1), %%xmm2\n"
+			"movdqa 48(%1), %%xmm3\n"
+			"movntdq %%xmm0, (%0)\n"
+			"movntdq %%xmm1, 16(%0)\n"
+			"movntdq %%xmm2, 32(%0)\n"
+			"movntdq %%xmm3, 48(%0)\n"
+			"addq $64, %0\n"
+			"addq $64, %1\n"
+			"decq %2\n"
+			"jnz 1b\n"
+			"sfence"
+			: "+r" (dst), "+r" (src), "+r" (lines) : : "cc", "memory");
+	kernel_fpu_end ();
+}
+
+/* Stores a snapshot of the statistics of the user pools, if
+   PAL_USER is set in FLAGS, or the kernel pools, otherwise, into
+   *STATS.  The peak is the sum of each pool's peak, which may be
+   more than were ever in use at once.  Runs with interrupts off, so
+   that it may also be used from an interrupt handler. */
+void
+palloc_get_stats (enum palloc_flags flags, struct palloc_stats *stats) {
+	struct pool_class *c = class_of (flags);
+	size_t i, page_idx, end_idx, map_size;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	memset (stats, 0, sizeof *stats);
+	for (i = 0; i < c->pool_cnt; i++) {
+		struct pool *pool = c->pools[i];
+
+		stats->page_cnt += pool->page_cnt;
+		stats->live_cnt += pool->live_cnt;
+		stats->peak_cnt += pool->peak_cnt;
+		stats->failed_cnt += pool->failed_cnt;
+		stats->cached_cnt += pool->mag_cnt + pool->zeroed_cnt;
+		stats->lent_cnt += pool->lent_cnt;
+
+		/* Pages in the magazine and the zeroed supply are marked used
+		   in the bitmap, so they do not count toward the runs. */
+		map_size = bitmap_size (pool->used_map);
+		for (page_idx = 0; page_idx < map_size; page_idx = end_idx) {
+			page_idx = bitmap_scan (pool->used_map, page_idx, 1, false);
+			if (page_idx == BITMAP_ERROR)
+				break;
+			end_idx = bitmap_scan (pool->used_map, page_idx, 1, true);
+			if (end_idx == BITMAP_ERROR)
+				end_idx = map_size;
+			if (end_idx - page_idx > stats->largest_free)
+				stats->largest_free = end_idx - page_idx;
+		}
+	}
+	intr_set_level (old_level);
+}
+
+/* Returns the number of free pages in the pool chosen by FLAGS,
+   counting those held in caches.  Takes no lock, so the count may
+   be slightly stale, but it is cheap enough to check on every
+   allocation. */
+size_t
+palloc_free_count (enum palloc_flags flags) {
+	size_t live_cnt, page_cnt = class_count (class_of (flags), &live_cnt);
+
+	return page_cnt - live_cnt;
+}
+
+/* Prints the statistics of POOL, named NAME. */
+static void
+pool_print_stats (const char *name, enum palloc_flags flags) {
+	struct palloc_stats s;
+	size_t free_cnt;
+
+	palloc_get_stats (flags, &s);
+	free_cnt = s.page_cnt - s.live_cnt;
+	printf ("%s pool: %zu of %zu pages in use (peak %zu), %zu failed, "
+			"%zu free (%zu cached, largest run %zu), %zu lent\n",
+			name, s.live_cnt, s.page_cnt, s.peak_cnt, s.failed_cnt,
+			free_cnt, s.cached_cnt, s.largest_free, s.lent_cnt);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	pool_print_stats ("Kernel", 0);
+	pool_print_stats ("User", PAL_USER);
+}
+
+/* Answers the page allocator inspection interrupt. */
+static void
+inspect_palloc (struct intr_frame *f) {
+	struct palloc_stats s;
+
+	palloc_get_stats (f->R.rdi ? PAL_USER : 0, &s);
+	switch (f->R.rsi) {
+		case 0:
+			f->R.rax = s.live_cnt;
+			break;
+		case 1:
+			f->R.rax = s.peak_cnt;
+			break;
+		case 2:
+			f->R.rax = s.failed_cnt;
+			break;
+		case 3:
+			f->R.rax = s.page_cnt;
+			break;
+		case 4:
+			f->R.rax = s.largest_free;
+			break;
+		case 5:
+			f->R.rax = s.lent_cnt;
+			break;
+		default:
+			f->R.rax = -1;
+			break;
+	}
+}
+
+/* Tool for testing the page allocator. Calling this function via int 0x46.
+ * Input:
+ *   @RDI - 0: kernel pool, otherwise user pool.
+ *   @RSI - 0: pages in use,
+ *          1: peak pages in use,
+ *          2: failed requests,
+ *          3: usable pages,
+ *          4: longest run of free pages,
+ *          5: pages ever lent to the other class.
+ * Output:
+ *   @RAX - Requested counter, or -1 if RSI is out of range. */
+void
+register_palloc_inspect_intr (void) {
+	intr_register_int (0x46, 3, INTR_OFF, inspect_palloc,
+			"Inspect Page Allocator");
+}
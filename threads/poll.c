@@ -0,0 +1,126 @@
+/* poll.c: Waiting for any of several objects to become ready.
+
+   poll() asks each object whether it is ready, passing a poll_table
+   in which the object adds an entry on its poll_queue with
+   poll_add(), and if none is, sleeps in poll_sleep() until one of
+   those queues is woken or the timeout passes.  The entries stay
+   queued while poll() asks the objects again after waking, so that
+   a wake-up between asking and sleeping is not missed, and all come
+   off at once in poll_table_done().
+
+   The timeout is a wake-up tick in the sleep queue, from which a
+   wake-up takes the thread out early.  Queues and tables are
+   guarded by turning interrupts off, since interrupt handlers wake
+   some queues, such as the console's. */
+
+#include "threads/poll.h"
+#include <debug.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* Initializes Q as a queue with nobody polling. */
+void
+poll_queue_init (struct poll_queue *q) {
+	list_init (&q->entries);
+}
+
+/* Wakes every thread polling Q.  The object of Q may have become
+   ready.  May be called from an interrupt handler. */
+void
+poll_wake (struct poll_queue *q) {
+	struct list woken;
+	enum intr_level old_level;
+	struct list_elem *e;
+
+	old_level = intr_disable ();
+	if (list_empty (&q->entries)) {
+		intr_set_level (old_level);
+		return;
+	}
+
+	/* thread_unblock() may yield, and the queue may change while
+	   the woken threads run, so they are only unblocked once all of
+	   them are out of the sleep queue.  A blocked thread's ELEM is
+	   free meanwhile. */
+	list_init (&woken);
+	for (e = list_begin (&q->entries); e != list_end (&q->entries);
+			e = list_next (e)) {
+		struct poll_table *pt = list_entry (e, struct poll_entry, elem)->table;
+
+		if (!pt->woken) {
+			pt->woken = true;
+			if (thread_wake_early (pt->thread))
+				list_push_back (&woken, &pt->thread->elem);
+		}
+	}
+	while (!list_empty (&woken))
+		thread_unblock (list_entry (list_pop_front (&woken),
+					struct thread, elem));
+	intr_set_level (old_level);
+}
+
+/* Initializes PT for the current thread to poll up to CAP queues,
+   with the CAP entries ENTRIES. */
+void
+poll_table_init (struct poll_table *pt, struct poll_entry *entries,
+		size_t cap) {
+	pt->thread = thread_current ();
+	pt->woken = false;
+	pt->entries = entries;
+	pt->cnt = 0;
+	pt->cap = cap;
+}
+
+/* Adds Q to the queues PT waits on, unless PT is null because
+   poll() only asks whether Q's object is ready, or Q is there
+   already. */
+void
+poll_add (struct poll_table *pt, struct poll_queue *q) {
+	enum intr_level old_level;
+	struct poll_entry *pe;
+	size_t i;
+
+	if (pt == NULL)
+		return;
+	for (i = 0; i < pt->cnt; i++)
+		if (pt->entries[i].queue == q)
+			return;
+	ASSERT (pt->cnt < pt->cap);
+
+	pe = &pt->entries[pt->cnt++];
+	pe->queue = q;
+	pe->table = pt;
+	old_level = intr_disable ();
+	list_push_back (&q->entries, &pe->elem);
+	intr_set_level (old_level);
+}
+
+/* Sleeps until a queue PT waits on is woken or the timer reaches
+   tick DEADLINE, whichever is first, unless one was woken already
+   since the last call. */
+void
+poll_sleep (struct poll_table *pt, int64_t deadline) {
+	enum intr_level old_level;
+
+	ASSERT (pt->thread == thread_current ());
+
+	old_level = intr_disable ();
+	if (!pt->woken && timer_ticks () < deadline)
+		thread_sleep (deadline);
+	pt->woken = false;
+	intr_set_level (old_level);
+}
+
+/* Takes PT off all of the queues it waits on. */
+void
+poll_table_done (struct poll_table *pt) {
+	enum intr_level old_level;
+	size_t i;
+
+	old_level = intr_disable ();
+	for (i = 0; i < pt->cnt; i++)
+		list_remove (&pt->entries[i].elem);
+	intr_set_level (old_level);
+	pt->cnt = 0;
+}
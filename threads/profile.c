@@ -0,0 +1,102 @@
+/* profile.c: Sampling profiler.
+
+   With "-profile", the timer interrupt handler records where each
+   of its interrupts landed: the interrupted rip, the running
+   thread, and whether it was running in user mode.  The samples go
+   into a ring that holds the last PROFILE_SAMPLES of them, so a long
+   run keeps its end.  "-profile=RATE" also speeds up the PIT to take
+   RATE samples per second, which timer.c rounds to a multiple of
+   TIMER_FREQ; the tick itself keeps its rate.
+
+   At power off profile_dump() prints the ring, oldest first, one
+   "prof" line per sample.  utils/pintos-profile reads those lines
+   from the console log and symbolizes them into a flat profile. */
+
+#include "threads/profile.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/vmalloc.h"
+#include "devices/timer.h"
+
+/* Pages of samples in the ring. */
+#define PROFILE_PAGES 16
+
+/* Number of samples the ring holds. */
+#define PROFILE_SAMPLES (PROFILE_PAGES * PGSIZE / sizeof (struct sample))
+
+/* A sample. */
+struct sample {
+	uintptr_t rip;                      /* Interrupted instruction. */
+	tid_t tid;                          /* Running thread. */
+	bool user;                          /* In user mode? */
+};
+
+int profile_hz;
+
+static struct sample *samples;      /* The ring, or null if off. */
+static uint64_t sample_cnt;         /* Samples taken. */
+static uint64_t user_cnt;           /* Of those, in user mode. */
+static int sample_hz;               /* Actual samples per second. */
+
+/* Starts profiling if "-profile" asked for it. */
+void
+profile_init (void) {
+	if (profile_hz <= 0)
+		return;
+
+	samples = vmalloc (PROFILE_PAGES * PGSIZE);
+	if (samples == NULL) {
+		printf ("profile: no memory for samples, profiling off\n");
+		return;
+	}
+	sample_hz = timer_set_sample_rate (profile_hz);
+}
+
+/* Records where the timer interrupt described by F landed.  Called
+   by the timer interrupt handler. */
+void
+profile_sample (const struct intr_frame *f) {
+	struct sample *s;
+
+	ASSERT (intr_context ());
+
+	if (samples == NULL)
+		return;
+	s = &samples[sample_cnt++ % PROFILE_SAMPLES];
+	s->rip = f->rip;
+	s->tid = thread_current ()->tid;
+	s->user = (f->cs & 3) == 3;
+	if (s->user)
+		user_cnt++;
+}
+
+/* Prints the samples in the ring, oldest first, as
+   "prof MODE TID RIP" lines, MODE being 'k' or 'u'. */
+void
+profile_dump (void) {
+	struct sample *ring = samples;
+	uint64_t first, i;
+
+	/* Stop sampling, so that the ring holds still. */
+	if (ring == NULL)
+		return;
+	samples = NULL;
+	barrier ();
+
+	first = sample_cnt > PROFILE_SAMPLES ? sample_cnt - PROFILE_SAMPLES : 0;
+	printf ("Profile: %llu samples at %d Hz, %llu kernel, %llu user; "
+			"last %llu follow\n", sample_cnt, sample_hz, sample_cnt - user_cnt,
+			user_cnt, sample_cnt - first);
+	for (i = first; i < sample_cnt; i++) {
+		const struct sample *s = &ring[i % PROFILE_SAMPLES];
+
+		printf ("prof %c %d %#llx\n", s->user ? 'u' : 'k', s->tid,
+				(unsigned long long) s->rip);
+	}
+	vfree (ring);
+}
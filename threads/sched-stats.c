@@ -0,0 +1,170 @@
+/* sched-stats.c: Scheduler latency and context-switch statistics.
+
+   Latencies are measured with the TSC, since a timer tick is far
+   coarser than a typical context switch, and collected in log2
+   histograms. */
+
+#include "threads/sched-stats.h"
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+#include "intrinsic.h"
+
+/* A log2 latency histogram. */
+struct sched_hist {
+	uint64_t buckets[SCHED_HIST_BUCKETS];
+	uint64_t count;                     /* Number of samples. */
+	uint64_t total;                     /* Sum of all samples. */
+	uint64_t max;                       /* Largest sample. */
+};
+
+static uint64_t context_switches;   /* # of thread_launch() calls. */
+static uint64_t preemptions;        /* # of switches away from a ready thread. */
+static struct sched_hist runq_hist; /* Time from ready to running. */
+static struct sched_hist wake_hist; /* Time from thread_unblock() to running. */
+
+/* Adds a sample of CYCLES to HIST. */
+static void
+hist_add (struct sched_hist *hist, uint64_t cycles) {
+	int bucket = cycles == 0 ? 0 : 64 - __builtin_clzll (cycles);
+
+	if (bucket >= SCHED_HIST_BUCKETS)
+		bucket = SCHED_HIST_BUCKETS - 1;
+	hist->buckets[bucket]++;
+	hist->count++;
+	hist->total += cycles;
+	if (cycles > hist->max)
+		hist->max = cycles;
+}
+
+/* Prints HIST under the heading NAME, skipping empty buckets. */
+static void
+hist_print (const char *name, const struct sched_hist *hist) {
+	int i;
+
+	printf ("  %s: %llu samples, avg %llu cycles, max %llu cycles\n", name,
+			hist->count, hist->count ? hist->total / hist->count : 0,
+			hist->max);
+	for (i = 0; i < SCHED_HIST_BUCKETS; i++)
+		if (hist->buckets[i] != 0)
+			printf ("    < 2^%-2d %llu\n", i, hist->buckets[i]);
+}
+
+/* Marks T, which thread_unblock() is making ready, as woken up. */
+void
+sched_stats_unblock (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	t->sched_stats.ready_stamp = rdtsc ();
+	t->sched_stats.woken = true;
+}
+
+/* Accounts for schedule() switching from CURR to NEXT.  If
+   PREEMPTED, CURR stays ready because it was preempted or yielded,
+   and starts waiting now; NEXT stops waiting. */
+void
+sched_stats_schedule (struct thread *curr, struct thread *next,
+		bool preempted) {
+	uint64_t now = rdtsc ();
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (curr == next)
+		return;
+
+	if (preempted) {
+		curr->sched_stats.ready_stamp = now;
+		curr->sched_stats.woken = false;
+		curr->sched_stats.preempt_cnt++;
+		curr->rusage.ru_nivcsw++;
+		preemptions++;
+	} else if (curr->status == THREAD_BLOCKED)
+		curr->rusage.ru_nvcsw++;
+
+	/* The idle thread is never made ready, so it has no wait. */
+	if (next->sched_stats.ready_stamp != 0) {
+		uint64_t wait = now - next->sched_stats.ready_stamp;
+
+		hist_add (&runq_hist, wait);
+		if (next->sched_stats.woken)
+			hist_add (&wake_hist, wait);
+		next->sched_stats.wait_cycles += wait;
+		next->sched_stats.ready_stamp = 0;
+	}
+	next->sched_stats.run_cnt++;
+}
+
+/* Counts the context switch to NEXT done by thread_launch(). */
+void
+sched_stats_launch (struct thread *next UNUSED) {
+	context_switches++;
+}
+
+static void
+print_thread_stats (struct thread *t, void *aux UNUSED) {
+	printf ("  %-16s tid %d: %llu runs, %llu preemptions, %llu cycles ready\n",
+			t->name, t->tid, t->sched_stats.run_cnt, t->sched_stats.preempt_cnt,
+			t->sched_stats.wait_cycles);
+}
+
+/* Prints scheduler statistics. */
+void
+sched_stats_print (void) {
+	int64_t seconds = timer_ticks () / TIMER_FREQ;
+	enum intr_level old_level;
+
+	printf ("Scheduler: %llu context switches", context_switches);
+	if (seconds > 0)
+		printf (" (%llu/s)", context_switches / seconds);
+	printf (", %llu preemptions\n", preemptions);
+	hist_print ("run-queue wait", &runq_hist);
+	hist_print ("wake-up latency", &wake_hist);
+
+	old_level = intr_disable ();
+	thread_foreach (print_thread_stats, NULL);
+	intr_set_level (old_level);
+}
+
+/* Answers the scheduler inspection interrupt. */
+static void
+inspect_sched (struct intr_frame *f) {
+	const struct sched_thread_stats *stats = &thread_current ()->sched_stats;
+	uint64_t bucket = f->R.rsi < SCHED_HIST_BUCKETS ? f->R.rsi : 0;
+
+	switch (f->R.rdi) {
+		case 0:
+			f->R.rax = context_switches;
+			break;
+		case 1:
+			f->R.rax = runq_hist.buckets[bucket];
+			break;
+		case 2:
+			f->R.rax = wake_hist.buckets[bucket];
+			break;
+		case 3:
+			f->R.rax = stats->run_cnt;
+			break;
+		case 4:
+			f->R.rax = stats->preempt_cnt;
+			break;
+		default:
+			f->R.rax = -1;
+			break;
+	}
+}
+
+/* Tool for testing the scheduler. Calling this function via int 0x45.
+ * Input:
+ *   @RDI - 0: context switches,
+ *          1: run-queue wait histogram bucket RSI,
+ *          2: wake-up latency histogram bucket RSI,
+ *          3: current thread's run count,
+ *          4: current thread's preemption count.
+ * Output:
+ *   @RAX - Requested counter, or -1 if RDI is out of range. */
+void
+register_sched_inspect_intr (void) {
+	intr_register_int (0x45, 3, INTR_OFF, inspect_sched,
+			"Inspect Scheduler Statistics");
+}
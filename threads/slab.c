@@ -0,0 +1,228 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/lock-stats.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A slab allocator for fixed-size objects.
+
+   Each cache hands out objects of exactly one size and alignment,
+   so that hot kernel objects do not pay for malloc()'s rounding to
+   a power of two.  The cache carves one-page "slabs" into slots.
+   Each free slot is linked through a small index array kept in the
+   slab header, not through the slot itself.  Therefore a freed
+   object keeps the state its constructor gave it (if the cache has
+   one), and the constructor runs only once per slot, when the slab
+   is created.
+
+   Every cache has its own lock.  A slab is returned to the page
+   allocator when its last object is freed, unless it is the cache's
+   only slab with free slots. */
+
+/* Magic number for detecting slab corruption.  Stored at the same
+   offset as struct arena's magic in malloc.c, so that free() can
+   tell slab objects and malloc() blocks apart. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* End of a slab's free slot chain. */
+#define SLOT_NONE UINT16_MAX
+
+/* Object cache. */
+struct kmem_cache {
+	const char *name;           /* Name, for debugging. */
+	size_t obj_size;            /* Slot size in bytes. */
+	size_t obj_ofs;             /* Offset of the first slot in a slab. */
+	size_t objs_per_slab;       /* Number of slots in a slab. */
+	kmem_ctor_func *ctor;       /* Constructor, or a null pointer. */
+	struct list partial;        /* Slabs with at least one free slot. */
+	struct lock lock;           /* Lock. */
+};
+
+/* Slab header, at the start of each slab page. */
+struct slab {
+	unsigned magic;             /* Always set to SLAB_MAGIC. */
+	struct kmem_cache *cache;   /* Owning cache. */
+	size_t free_cnt;            /* Free slots. */
+	uint16_t free;              /* First free slot, or SLOT_NONE. */
+	struct list_elem elem;      /* Element in cache's partial list. */
+	uint16_t next[];            /* Next free slot after each slot. */
+};
+
+static void *slab_slot (struct slab *, size_t idx);
+
+/* Creates and returns a cache for objects of SIZE bytes aligned to
+   ALIGN bytes, a power of two; 0 means pointer alignment.  If CTOR
+   is non-null it is applied to each object before its first use.
+   NAME must stay valid for the life of the cache.
+   Returns a null pointer if memory is not available or SIZE does
+   not fit in a slab. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+		kmem_ctor_func *ctor) {
+	struct kmem_cache *cache;
+	size_t n;
+
+	if (align == 0)
+		align = sizeof (void *);
+	ASSERT ((align & (align - 1)) == 0);
+	if (size == 0)
+		size = 1;
+	size = ROUND_UP (size, align);
+
+	/* Fit as many slots as possible after the header and its
+	   index array. */
+	for (n = PGSIZE / size; n > 0; n--)
+		if (ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t), align)
+				+ n * size <= PGSIZE)
+			break;
+	if (n == 0)
+		return NULL;
+
+	cache = malloc (sizeof *cache);
+	if (cache == NULL)
+		return NULL;
+	cache->name = name;
+	cache->obj_size = size;
+	cache->obj_ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+			align);
+	cache->objs_per_slab = n;
+	cache->ctor = ctor;
+	list_init (&cache->partial);
+	lock_init (&cache->lock);
+	lock_set_name (&cache->lock, name);
+	return cache;
+}
+
+/* Allocates a new slab page for CACHE and adds it to CACHE's partial
+   list.  Returns false if no page is available. */
+static bool
+slab_grow (struct kmem_cache *cache) {
+	struct slab *slab;
+	size_t i;
+
+	slab = palloc_get_page (0);
+	if (slab == NULL)
+		return false;
+
+	slab->magic = SLAB_MAGIC;
+	slab->cache = cache;
+	slab->free_cnt = cache->objs_per_slab;
+	slab->free = 0;
+	for (i = 0; i < cache->objs_per_slab; i++) {
+		slab->next[i] = i + 1 < cache->objs_per_slab ? i + 1 : SLOT_NONE;
+		if (cache->ctor != NULL)
+			cache->ctor (slab_slot (slab, i));
+	}
+	list_push_front (&cache->partial, &slab->elem);
+	return true;
+}
+
+/* Obtains and returns an object from CACHE.
+   Returns a null pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *cache) {
+	struct slab *slab;
+	void *obj;
+
+	ASSERT (cache != NULL);
+
+	lock_acquire (&cache->lock);
+	if (list_empty (&cache->partial) && !slab_grow (cache)) {
+		lock_release (&cache->lock);
+		return NULL;
+	}
+
+	slab = list_entry (list_front (&cache->partial), struct slab, elem);
+	ASSERT (slab->free != SLOT_NONE);
+	obj = slab_slot (slab, slab->free);
+	slab->free = slab->next[slab->free];
+	if (--slab->free_cnt == 0)
+		list_remove (&slab->elem);
+	lock_release (&cache->lock);
+
+	return obj;
+}
+
+/* Returns OBJ, which must have been allocated from CACHE, to CACHE.
+   If CACHE has a constructor, OBJ must be back in its constructed
+   state. */
+void
+kmem_cache_free (struct kmem_cache *cache, void *obj) {
+	struct slab *slab;
+	size_t idx;
+
+	if (obj == NULL)
+		return;
+
+	slab = pg_round_down (obj);
+	ASSERT (slab->magic == SLAB_MAGIC);
+	ASSERT (slab->cache == cache);
+	ASSERT ((pg_ofs (obj) - cache->obj_ofs) % cache->obj_size == 0);
+	idx = (pg_ofs (obj) - cache->obj_ofs) / cache->obj_size;
+
+#ifndef NDEBUG
+	/* Clear the object to help detect use-after-free bugs, unless
+	   the constructed state must be preserved. */
+	if (cache->ctor == NULL)
+		memset (obj, 0xcc, cache->obj_size);
+#endif
+
+	lock_acquire (&cache->lock);
+	slab->next[idx] = slab->free;
+	slab->free = idx;
+	if (slab->free_cnt++ == 0)
+		list_push_front (&cache->partial, &slab->elem);
+
+	/* Give an entirely unused slab back, unless it is the only one
+	   left to allocate from. */
+	if (slab->free_cnt == cache->objs_per_slab
+			&& list_begin (&cache->partial) != list_rbegin (&cache->partial)) {
+		list_remove (&slab->elem);
+		slab->magic = 0;
+		palloc_free_page (slab);
+	}
+	lock_release (&cache->lock);
+}
+
+/* Returns true if P points into a slab page, that is, it was
+   allocated by kmem_cache_alloc(). */
+bool
+slab_owns (const void *p) {
+	const struct slab *slab = pg_round_down (p);
+
+	return slab->magic == SLAB_MAGIC;
+}
+
+/* Returns P, which was allocated by kmem_cache_alloc(), to the
+   cache it came from. */
+void
+slab_free (void *p) {
+	struct slab *slab = pg_round_down (p);
+
+	ASSERT (slab->magic == SLAB_MAGIC);
+	kmem_cache_free (slab->cache, p);
+}
+
+/* Returns the slot size of P, which was allocated by
+   kmem_cache_alloc(). */
+size_t
+slab_object_size (const void *p) {
+	const struct slab *slab = pg_round_down (p);
+
+	ASSERT (slab->magic == SLAB_MAGIC);
+	return slab->cache->obj_size;
+}
+
+/* Returns the IDX'th slot of SLAB. */
+static void *
+slab_slot (struct slab *slab, size_t idx) {
+	ASSERT (idx < slab->cache->objs_per_slab);
+	return (uint8_t *) slab + slab->cache->obj_ofs
+		+ idx * slab->cache->obj_size;
+}
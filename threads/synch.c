@@ -29,9 +29,35 @@
 #include "threads/synch.h"
 #include <stdio.h>
 #include <string.h>
+#include "threads/instrument.h"
 #include "threads/interrupt.h"
+#include "threads/lock-stats.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #include "threads/malloc.h"
+#include "intrinsic.h"
+
+/* One semaphore in a condition's waiter heap. */
+struct semaphore_elem {
+	struct heap_elem elem;              /* Heap element. */
+	struct semaphore semaphore;         /* This semaphore. */
+	struct thread *thread;              /* The thread waiting on it. */
+	int priority;                       /* Its priority, as keyed. */
+	uint64_t seq;                       /* Arrival order, for FIFO ties. */
+};
+
+/* Arrival counter that keeps equal-priority waiters FIFO, since a
+   heap by itself is not stable. */
+static uint64_t wait_seq;
+
+/* Times a thread slept in sema_down(), and found a lock held. */
+DEFINE_COUNTER (sema_sleeps);
+DEFINE_COUNTER (lock_contended);
+
+static bool sema_waiter_less (const struct heap_elem *,
+		const struct heap_elem *, void *aux);
+static bool cond_waiter_less (const struct heap_elem *,
+		const struct heap_elem *, void *aux);
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -47,7 +73,8 @@ sema_init (struct semaphore *sema, unsigned value) {
 	ASSERT (sema != NULL);
 
 	sema->value = value;
-	list_init (&sema->waiters);
+	heap_init (&sema->waiters, sema_waiter_less, NULL);
+	sema->cond = NULL;
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -67,7 +94,12 @@ sema_down (struct semaphore *sema) {
 
 	old_level = intr_disable ();
 	while (sema->value == 0) {
-		list_push_back (&sema->waiters, &thread_current ()->elem);
+		struct thread *curr = thread_current ();
+
+		curr->waiting_sema = sema;
+		curr->wait_seq = wait_seq++;
+		heap_push (&sema->waiters, &curr->heap_elem);
+		COUNTER_INC (sema_sleeps);
 		thread_block ();
 	}
 	sema->value--;
@@ -100,29 +132,60 @@ sema_try_down (struct semaphore *sema) {
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any, in O(log n) time.
 
    This function may be called from an interrupt handler. */
 void
 sema_up (struct semaphore *sema) {
 	enum intr_level old_level;
-	struct list_elem *tmp;
+	struct heap_elem *e;
 	ASSERT (sema != NULL);
 
 	old_level = intr_disable ();
-	if (!list_empty (&sema->waiters)) {
-		tmp = list_max(&sema->waiters, compare, NULL);
-		list_remove(tmp);
+	sema->value++;
+	if ((e = heap_pop (&sema->waiters)) != NULL) {
+		struct thread *t = heap_entry (e, struct thread, heap_elem);
 
-		sema->value++;
-		thread_unblock (list_entry (tmp, struct thread, elem));
-	}
-	else{
-		sema->value++;
+		t->waiting_sema = NULL;
+		thread_unblock (t);
 	}
 	intr_set_level (old_level);
 }
 
+/* Restores the order of whichever waiter heaps blocked thread T
+   sits in, after T's priority changed through donation.  Called
+   by thread_update_priority() with interrupts off. */
+void
+sema_waiter_update (struct thread *t) {
+	struct semaphore *sema = t->waiting_sema;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (sema == NULL)
+		return;
+	heap_update (&sema->waiters, &t->heap_elem);
+	if (sema->cond != NULL) {
+		struct semaphore_elem *waiter = (struct semaphore_elem *)
+			((uint8_t *) sema - offsetof (struct semaphore_elem, semaphore));
+		waiter->priority = t->priority;
+		heap_update (&sema->cond->waiters, &waiter->elem);
+	}
+}
+
+/* Orders the threads waiting on a semaphore, highest priority
+   first and FIFO among equals. */
+static bool
+sema_waiter_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct thread *a = heap_entry (a_, struct thread, heap_elem);
+	const struct thread *b = heap_entry (b_, struct thread, heap_elem);
+
+	if (a->priority != b->priority)
+		return a->priority > b->priority;
+	return a->wait_seq < b->wait_seq;
+}
+
 static void sema_test_helper (void *sema_);
 
 /* Self-test for semaphores that makes control "ping-pong"
@@ -158,6 +221,90 @@ sema_test_helper (void *sema_) {
 	}
 }
 
+/* Returns the priority that LOCK's waiters donate to its holder,
+   that is, the priority of its highest-priority waiter, or
+   PRI_MIN - 1 if nobody is waiting. */
+static int
+lock_donation (struct lock *lock) {
+	struct heap_elem *e = heap_top (&lock->donors);
+
+	return e != NULL
+		? heap_entry (e, struct thread, donor_elem)->priority
+		: PRI_MIN - 1;
+}
+
+/* Orders the threads waiting on a lock, highest priority first. */
+static bool
+donor_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct thread *a = heap_entry (a_, struct thread, donor_elem);
+	const struct thread *b = heap_entry (b_, struct thread, donor_elem);
+
+	return a->priority > b->priority;
+}
+
+/* Orders the locks held by a thread by the priority their waiters
+   donate, highest first.  Used for `struct thread''s held_locks. */
+bool
+lock_donation_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	struct lock *a = heap_entry (a_, struct lock, elem);
+	struct lock *b = heap_entry (b_, struct lock, elem);
+
+	return lock_donation (a) > lock_donation (b);
+}
+
+/* Returns the highest priority donated to T through any of the
+   locks it holds, or PRI_MIN - 1 if T receives no donation. */
+int
+lock_max_donation (struct thread *t) {
+	struct heap_elem *e = heap_top (&t->held_locks);
+
+	return e != NULL
+		? lock_donation (heap_entry (e, struct lock, elem))
+		: PRI_MIN - 1;
+}
+
+/* Returns T's effective priority: its own priority or the highest
+   priority donated to it, whichever is greater. */
+static int
+effective_priority (struct thread *t) {
+	int donated = lock_max_donation (t);
+
+	return donated > t->original_priority ? donated : t->original_priority;
+}
+
+/* Propagates the donation of LOCK's waiters to its holder, and on
+   through the chain of locks that each holder is itself waiting
+   for (nested donation).  Each hop costs O(log n).  Stops as soon
+   as a holder's effective priority does not change, since nothing
+   further down the chain can change either.
+
+   The MLFQS computes priorities by itself, so there is no
+   donation under it. */
+static void
+donate_priority (struct lock *lock) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (thread_mlfqs)
+		return;
+
+	while (lock != NULL && lock->holder != NULL) {
+		struct thread *holder = lock->holder;
+		int priority;
+
+		heap_update (&holder->held_locks, &lock->elem);
+		priority = effective_priority (holder);
+		if (priority == holder->priority)
+			break;
+		thread_update_priority (holder, priority);
+
+		lock = holder->wanted;
+		if (lock != NULL)
+			heap_update (&lock->donors, &holder->donor_elem);
+	}
+}
+
 /* Initializes LOCK.  A lock can be held by at most a single
    thread at any given time.  Our locks are not "recursive", that
    is, it is an error for the thread currently holding a lock to
@@ -179,7 +326,8 @@ lock_init (struct lock *lock) {
 
 	lock->holder = NULL;
 	sema_init (&lock->semaphore, 1);
-	lock->is_hyped = false;
+	heap_init (&lock->donors, donor_less, NULL);
+	lock->stats = NULL;
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -192,34 +340,44 @@ lock_init (struct lock *lock) {
    we need to sleep. */
 void
 lock_acquire (struct lock *lock) {
+	struct thread *curr = thread_current ();
+	enum intr_level old_level;
+	uint64_t start = lock->stats != NULL ? rdtsc () : 0;
+	bool contended;
 
 	ASSERT (lock != NULL);
 	ASSERT (!intr_context ());
 	ASSERT (!lock_held_by_current_thread (lock));
 
-	struct thread *holder = lock->holder;
-
-	if (holder != NULL) {
-		lock->is_hyped = true;
-
-		thread_current()->wanted = lock;	// wanted에 원하는 lock 명시
-		list_push_back(&(holder->donor_list), &(thread_current()->elem_d_luffy));
-		holder->priority = thread_current()->priority;	// ! donation !
-		narashi(holder, thread_current()->priority);	// for nested donation
+	old_level = intr_disable ();
+	contended = lock->holder != NULL;
+	if (contended) {
+		if (start == 0)
+			start = rdtsc ();
+		COUNTER_INC (lock_contended);
+		trace (TRACE_LOCK_WAIT, (uintptr_t) lock, 0);
+		curr->wanted = lock;	// wanted에 원하는 lock 명시
+		heap_push (&lock->donors, &curr->donor_elem);
+		donate_priority (lock);	// ! donation ! (nested 포함)
 	}
 	sema_down (&lock->semaphore);                   	// sleep에 빠짐.
 
-	/* Got the lock. */
-	lock->holder = thread_current ();
-	thread_current()->wanted = NULL;
-}
-
-void
-narashi (struct thread *holder, int priority) {
-	while (holder->wanted) {
-		holder = holder->wanted->holder;
-		holder->priority = priority;
+	/* Got the lock.  The remaining waiters now donate to us. */
+	if (curr->wanted == lock) {
+		heap_remove (&lock->donors, &curr->donor_elem);
+		curr->wanted = NULL;
 	}
+	lock->holder = curr;
+	heap_push (&curr->held_locks, &lock->elem);
+	if (contended)
+		curr->lock_wait += rdtsc () - start;
+	if (!thread_mlfqs)
+		thread_update_priority (curr, effective_priority (curr));
+	if (lock->stats != NULL)
+		lock_stats_acquired (lock, contended, start);
+	if (contended)
+		trace (TRACE_LOCK_ACQUIRE, (uintptr_t) lock, 0);
+	intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -230,52 +388,52 @@ narashi (struct thread *holder, int priority) {
    interrupt handler. */
 bool
 lock_try_acquire (struct lock *lock) {
+	enum intr_level old_level;
 	bool success;
 
 	ASSERT (lock != NULL);
 	ASSERT (!lock_held_by_current_thread (lock));
 
+	old_level = intr_disable ();
 	success = sema_try_down (&lock->semaphore);
-	if (success)
+	if (success) {
 		lock->holder = thread_current ();
+		heap_push (&lock->holder->held_locks, &lock->elem);
+		if (lock->stats != NULL)
+			lock_stats_acquired (lock, false, 0);
+	}
+	intr_set_level (old_level);
 	return success;
 }
 
 /* Releases LOCK, which must be owned by the current thread.
    This is lock_release function.
 
+   Only this lock's donation is dropped: the holder's priority
+   falls back to the best donation among the locks it still holds,
+   found at the top of its held_locks heap, without visiting any
+   individual donor.
+
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
    handler. */
 void
 lock_release (struct lock *lock) {
+	struct thread *curr = thread_current ();
+	enum intr_level old_level;
+
 	ASSERT (lock != NULL);
 	ASSERT (lock_held_by_current_thread (lock));
-	
-	struct thread *holder = lock->holder;
-	struct list *donor_list = &holder->donor_list;
-
-	/* lock을 기다리는 하나 이상의 thread가 존재하면 donation 과정 진입 */
-	if(lock->is_hyped) {
-		struct list_elem *e = list_begin(donor_list);
-		int max_priority = holder->original_priority;
-		
-		/* donor_list 순회 */
-		while (e != list_end (donor_list)) {
-			struct thread *t = list_entry(e, struct thread, elem_d_luffy);
-			if (lock == t->wanted)				// t가 원하는 lock이면, 현재쓰레드는 donate의 의무를 완료한 것.
-				e = list_remove(e);				// 따라서 donor_list에서 지워줌.
-			else {								// t가 원하는 lock이 아니면, 아직 donate의 의무를 완료하지 못한 것.
-				if (max_priority < t->priority)	// 남은 donor 중 가장 우선순위가 높은 donor의 의무부터 완료해야 함.
-					max_priority = t->priority;
-				e = list_next(e);
-			}
-		}
-		holder->priority = max_priority;
-		lock->is_hyped = false;
-	}
+
+	old_level = intr_disable ();
+	if (lock->stats != NULL)
+		lock_stats_released (lock);
+	heap_remove (&curr->held_locks, &lock->elem);
 	lock->holder = NULL;
+	if (!thread_mlfqs)
+		thread_update_priority (curr, effective_priority (curr));
 	sema_up (&lock->semaphore);
+	intr_set_level (old_level);
 }
 
 
@@ -290,12 +448,6 @@ lock_held_by_current_thread (const struct lock *lock) {
 }
 
 
-/* One semaphore in a list. */
-struct semaphore_elem {
-	struct list_elem elem;              /* List element. */
-	struct semaphore semaphore;         /* This semaphore. */
-};
-
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -303,7 +455,24 @@ void
 cond_init (struct condition *cond) {
 	ASSERT (cond != NULL);
 
-	list_init (&cond->waiters);
+	heap_init (&cond->waiters, cond_waiter_less, NULL);
+}
+
+/* Orders the waiters of a condition variable by the priority of
+   their threads, as last keyed, highest first and FIFO among
+   equals.  Keying on a copy keeps the heap in order while a
+   waiter's live priority changes before it blocks. */
+static bool
+cond_waiter_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct semaphore_elem *a =
+		heap_entry (a_, struct semaphore_elem, elem);
+	const struct semaphore_elem *b =
+		heap_entry (b_, struct semaphore_elem, elem);
+
+	if (a->priority != b->priority)
+		return a->priority > b->priority;
+	return a->seq < b->seq;
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -329,6 +498,7 @@ cond_init (struct condition *cond) {
 void
 cond_wait (struct condition *cond, struct lock *lock) {
 	struct semaphore_elem waiter;
+	enum intr_level old_level;
 
 	ASSERT (cond != NULL);
 	ASSERT (lock != NULL);
@@ -336,14 +506,35 @@ cond_wait (struct condition *cond, struct lock *lock) {
 	ASSERT (lock_held_by_current_thread (lock));
 
 	sema_init (&waiter.semaphore, 0);
-	list_push_back (&cond->waiters, &waiter.elem);
+	waiter.thread = thread_current ();
+
+	old_level = intr_disable ();
+	waiter.semaphore.cond = cond;
+	waiter.priority = waiter.thread->priority;
+	waiter.seq = wait_seq++;
+	heap_push (&cond->waiters, &waiter.elem);
+	intr_set_level (old_level);
+
 	lock_release (lock);
+
+	/* Releasing LOCK may have lowered our priority, and until we
+	   block, donations change it without reordering the waiters.
+	   Key the waiter on the priority we block with, unless a
+	   signal has already taken it off. */
+	old_level = intr_disable ();
+	if (waiter.semaphore.cond != NULL
+			&& waiter.priority != waiter.thread->priority) {
+		waiter.priority = waiter.thread->priority;
+		heap_update (&cond->waiters, &waiter.elem);
+	}
 	sema_down (&waiter.semaphore);
+	intr_set_level (old_level);
 	lock_acquire (lock);
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
+   this function signals the highest-priority one of them to wake
+   up from its wait.
    LOCK must be held before calling this function.
 
    An interrupt handler cannot acquire a lock, so it does not
@@ -356,25 +547,18 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED) {
 	ASSERT (!intr_context ());
 	ASSERT (lock_held_by_current_thread (lock));
 
-	if (!list_empty (&cond->waiters)) {
-		struct list_elem *e = list_begin(&cond->waiters);
-		struct list_elem *prior_elem = e;
-		while (list_next(e) != list_end(&cond->waiters)) {
-			if (
-				list_entry(list_max(
-				&list_entry(prior_elem, struct semaphore_elem, elem)->semaphore.waiters,
-				compare, NULL), struct thread, elem)->priority
-				<
-				list_entry(list_max(
-				&list_entry(list_next(e), struct semaphore_elem, elem)->semaphore.waiters,
-				compare, NULL), struct thread, elem)->priority
-			) prior_elem = list_next(e);
-
-			e = list_next(e);
-		}
-		list_remove(prior_elem);
-		sema_up (&(list_entry(prior_elem, struct semaphore_elem, elem)->semaphore));
+	struct heap_elem *e;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	if ((e = heap_pop (&cond->waiters)) != NULL) {
+		struct semaphore_elem *waiter =
+			heap_entry (e, struct semaphore_elem, elem);
+
+		waiter->semaphore.cond = NULL;
+		sema_up (&waiter->semaphore);
 	}
+	intr_set_level (old_level);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -388,6 +572,129 @@ cond_broadcast (struct condition *cond, struct lock *lock) {
 	ASSERT (cond != NULL);
 	ASSERT (lock != NULL);
 
-	while (!list_empty (&cond->waiters))
+	while (!heap_empty (&cond->waiters))
 		cond_signal (cond, lock);
 }
+
+/* Initializes RWLOCK.  Any number of readers may hold a
+   reader-writer lock at once, or a single writer.
+
+   The writer holds the embedded lock for its whole critical
+   section; a reader only passes through it on the way in.  So as
+   soon as a writer arrives no new reader can enter (writer
+   preference), and threads blocked behind a writer donate their
+   priority to it like for any other lock.  Readers, of which
+   there may be many, do not receive donations. */
+void
+rwlock_init (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_init (&rw->writer);
+	rw->readers = 0;
+	rw->draining = false;
+	sema_init (&rw->drained, 0);
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   waits for it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw) {
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+	ASSERT (!intr_context ());
+
+	lock_acquire (&rw->writer);
+	old_level = intr_disable ();
+	rw->readers++;
+	intr_set_level (old_level);
+	lock_release (&rw->writer);
+}
+
+/* Releases RW, which the current thread must hold for reading.
+   The last reader to leave wakes up a writer waiting for them. */
+void
+rwlock_release_read (struct rwlock *rw) {
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+
+	old_level = intr_disable ();
+	ASSERT (rw->readers > 0);
+	if (--rw->readers == 0 && rw->draining) {
+		rw->draining = false;
+		sema_up (&rw->drained);
+	}
+	intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until no other writer holds
+   it and every reader inside has left.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw) {
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+	ASSERT (!intr_context ());
+
+	lock_acquire (&rw->writer);
+	old_level = intr_disable ();
+	if (rw->readers > 0) {
+		rw->draining = true;
+		sema_down (&rw->drained);
+	}
+	intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for writing. */
+void
+rwlock_release_write (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+	ASSERT (rw->readers == 0);
+
+	lock_release (&rw->writer);
+}
+
+/* Initializes spinlock SPIN.
+
+   A spinlock guards a critical section of a few instructions,
+   such as a counter update, that must not sleep.  Pintos runs on
+   a single CPU, so holding one simply means running with
+   interrupts off; the locked flag catches recursive use.  Unlike
+   a lock, it may be used within an interrupt handler. */
+void
+spin_init (struct spinlock *spin) {
+	ASSERT (spin != NULL);
+
+	spin->locked = false;
+}
+
+/* Acquires SPIN, disabling interrupts until spin_unlock(). */
+void
+spin_lock (struct spinlock *spin) {
+	enum intr_level old_level;
+
+	ASSERT (spin != NULL);
+
+	old_level = intr_disable ();
+	ASSERT (!spin->locked);
+	spin->locked = true;
+	spin->old_level = old_level;
+}
+
+/* Releases SPIN and restores the interrupt level from before
+   spin_lock(). */
+void
+spin_unlock (struct spinlock *spin) {
+	ASSERT (spin != NULL);
+	ASSERT (spin->locked);
+
+	spin->locked = false;
+	intr_set_level (spin->old_level);
+}
@@ -1,9 +1,21 @@
 threads_SRC  = threads/init.c		# Main program.
 threads_SRC += threads/thread.c		# Thread management core.
+threads_SRC += threads/sched-stats.c	# Scheduler statistics.
+threads_SRC += threads/profile.c	# Sampling profiler.
+threads_SRC += threads/trace.c		# Event tracing.
+threads_SRC += threads/instrument.c	# Static branches and counters.
+threads_SRC += threads/cpu.c		# CPU enumeration.
 threads_SRC += threads/interrupt.c	# Interrupt core.
+threads_SRC += threads/intr-stats.c	# Interrupt statistics.
 threads_SRC += threads/intr-stubs.S	# Interrupt stubs.
+threads_SRC += threads/workqueue.c	# Deferred interrupt work.
 threads_SRC += threads/synch.c		# Synchronization.
+threads_SRC += threads/poll.c		# Waiting for any of several objects.
+threads_SRC += threads/lock-stats.c	# Lock contention statistics.
 threads_SRC += threads/palloc.c		# Page allocator.
+threads_SRC += threads/fpu.c		# FPU and SSE state.
 threads_SRC += threads/malloc.c		# Subpage allocator.
+threads_SRC += threads/vmalloc.c	# Virtually contiguous allocator.
+threads_SRC += threads/slab.c		# Object caches.
 threads_SRC += threads/start.S		# Startup code.
 threads_SRC += threads/mmu.c		    # Memory management unit related things.
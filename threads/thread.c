@@ -5,11 +5,17 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
+#include "threads/fpu.h"
+#include "threads/instrument.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/lock-stats.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
+#include "threads/workqueue.h"
+#include "devices/timer.h"
 #include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -24,15 +30,84 @@
    Do not modify this value. */
 #define THREAD_BASIC 0xd42df210
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
-/* List of processes in sleep. */
-static struct list sleep_list;
+/* Processes in THREAD_READY state, that is, processes that are
+   ready to run but not actually running.  There is one FIFO list
+   per priority level, and bit P of ready_bitmap is set if and only
+   if ready_queues[P] is non-empty, so the highest-priority ready
+   thread is found with a single find-last-set instruction. */
+#if PRI_MAX >= 64
+#error ready_bitmap requires PRI_MAX < 64
+#endif
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_bitmap;
+static int ready_cnt;           /* # of threads in the ready queues. */
+
+/* The deadline class.  A thread that has called
+   thread_set_deadline() gets up to dl_runtime ticks of CPU in
+   every dl_period ticks, by dl_deadline, and is scheduled
+   earliest deadline first ahead of every thread in ready_queues.
+   dl_ready holds the ready ones that still have budget, in
+   deadline order.  Once a thread uses up its budget it falls back
+   to its priority's ready queue until the budget is refilled at
+   its deadline, so it cannot starve others, but is not stopped
+   either.
+
+   Admission control keeps the total dl_runtime / dl_period of
+   dl_threads within DL_BW_LIMIT, in units of 1 / DL_BW_ONE, so
+   every thread in the class can meet its deadlines. */
+#define DL_BW_ONE (1 << 20)
+#define DL_BW_LIMIT (DL_BW_ONE / 10 * 9)
+static struct list dl_ready;
+static struct list dl_threads;
+static int64_t dl_bw;
+
+/* The fair-share class, used in place of ready_queues when
+   thread_fair is set.  Every thread belongs to a group, led by
+   the thread fair_group points to: itself, unless
+   thread_fair_group put it in its process's group.  Each tick a
+   thread runs adds to its own vruntime and to its group leader's
+   group_vruntime, weighted by priority, so that a thread of
+   higher priority is charged less.  fair_groups holds every group
+   with ready members, by group_vruntime, and each leader's
+   fair_members holds them by vruntime; the next thread to run is
+   the least-charged member of the least-charged group.  A group
+   then gets the same share whether it has one thread or many.
+
+   fair_min only grows, following the group picked to run, and
+   each leader's fair_member_min follows its members the same
+   way.  A thread or group coming back after a sleep is placed no
+   further back than FAIR_CREDIT behind them, so that sleeping
+   does not bank CPU time.  FAIR_GRAN is how far behind the
+   running thread another must be to preempt it. */
+#define FAIR_TICK (1 << 16)     /* One tick at PRI_DEFAULT. */
+#define FAIR_GRAN FAIR_TICK
+#define FAIR_CREDIT (2 * FAIR_TICK)
+static struct rbtree fair_groups;
+static int64_t fair_min;
+
+/* List of all threads except the idle thread.  Threads are added
+   to this list when they are first scheduled and removed when they
+   exit.  Used by the MLFQS once-per-second recomputation. */
+static struct list all_list;
+/* Processes sleeping in timer_sleep(), ordered by wake-up tick,
+   and the earliest wake-up tick among them (INT64_MAX if none).
+   The cached tick lets thread_wakeup() return immediately on the
+   common timer interrupt where nobody is due. */
+static struct heap sleep_queue;
+static int64_t next_wakeup_tick;
+
+/* Sleepers thread_wakeup() wakes by itself; a worker thread wakes
+   any more that are due. */
+#define WAKEUP_BATCH 8
+static struct work wakeup_worker;
+static work_func wakeup_work;
 
 /* Idle thread. */
 static struct thread *idle_thread;
 
+/* Calls to thread_yield(). */
+DEFINE_COUNTER (thread_yields);
+
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
@@ -43,6 +118,14 @@ static struct lock tid_lock;
 /* Thread destruction requests */
 static struct list destruction_req;
 
+/* Pages of dead threads kept for reuse by thread_create(), so that
+   spawning a thread skips the page allocator and zeroing the whole
+   page.  init_thread() clears the struct thread header; the rest
+   of the page is kernel stack, which needs no zeroing. */
+#define THREAD_CACHE_MAX 16
+static struct list thread_cache;
+static size_t thread_cache_cnt;
+
 /* Statistics. */
 static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
@@ -50,13 +133,39 @@ static long long user_ticks;    /* # of timer ticks in user programs. */
 
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
+#define SLICE_MIN 1             /* Shortest adaptive time slice. */
+#define SLICE_MAX 16            /* Longest adaptive time slice. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
 
+/* If false (default), every thread gets TIME_SLICE ticks.
+   If true, a thread's slice adapts to how it used the last one.
+   Controlled by kernel command-line option "-slice=adaptive". */
+bool thread_adaptive_slice;
+
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* If false (default), run the highest-priority ready thread.
+   If true, share the CPU fairly, weighted by priority, and if
+   thread_fair_group is also true, fairly among processes rather
+   than threads.  Controlled by kernel command-line option
+   "-sched=fair" or "-sched=fair-group". */
+bool thread_fair;
+bool thread_fair_group;
+
+/* MLFQS state. */
+#define NICE_MIN -20            /* Lowest nice value. */
+#define NICE_MAX 20             /* Highest nice value. */
+#define MLFQS_PRI_TICKS 4       /* Ticks between priority updates. */
+static fixed_t load_avg;        /* System load average. */
+
+/* Threads whose recent_cpu grew since the last priority update.
+   Only these need their priority recomputed every MLFQS_PRI_TICKS
+   ticks; everyone else's inputs are unchanged. */
+static struct list mlfqs_dirty_list;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -65,6 +174,31 @@ static void init_thread (struct thread *, const char *name, int priority);
 static void do_schedule(int status);
 static void schedule (void);
 static tid_t allocate_tid (void);
+static void ready_queue_push (struct thread *);
+static void ready_queue_remove (struct thread *);
+static struct thread *ready_queue_pop (void);
+static int ready_queue_max_priority (void);
+static bool ready_queue_preempts (const struct thread *);
+static bool preempts (const struct thread *, const struct thread *);
+static bool dl_set (struct thread *, int64_t runtime, int64_t period);
+static void dl_wakeup (struct thread *);
+static void dl_replenish (int64_t now);
+static void fair_push (struct thread *);
+static void fair_remove (struct thread *);
+static struct thread *fair_first (void);
+static void fair_advance (struct thread *);
+static void fair_charge (struct thread *);
+static bool fair_preempts (const struct thread *, const struct thread *);
+static rbtree_less_func fair_member_less;
+static rbtree_less_func fair_group_less;
+static struct thread *thread_page_alloc (void);
+static void adapt_quantum (struct thread *);
+static void thread_page_free (struct thread *);
+static void mlfqs_tick (void);
+static void mlfqs_update_priority (struct thread *);
+static void mlfqs_update_second (void);
+static bool wakeup_less (const struct heap_elem *, const struct heap_elem *,
+		void *aux);
 
 /* Returns true if T appears to point to a valid thread. */
 #define is_thread(t) ((t) != NULL && (t)->magic == THREAD_MAGIC)
@@ -110,9 +244,21 @@ thread_init (void) {
 
 	/* Init the global thread context */
 	lock_init (&tid_lock);
-	list_init (&ready_list);
-	list_init (&sleep_list);
+	lock_set_name (&tid_lock, "tid");
+	for (int pri = PRI_MIN; pri <= PRI_MAX; pri++)
+		list_init (&ready_queues[pri]);
+	ready_bitmap = 0;
+	list_init (&dl_ready);
+	list_init (&dl_threads);
+	rbtree_init (&fair_groups, fair_group_less, NULL);
+	heap_init (&sleep_queue, wakeup_less, NULL);
+	work_init (&wakeup_worker, wakeup_work, NULL);
+	next_wakeup_tick = INT64_MAX;
+	list_init (&all_list);
+	list_init (&mlfqs_dirty_list);
+	load_avg = 0;
 	list_init (&destruction_req);
+	list_init (&thread_cache);
 
 	/* Set up a thread structure for the running thread. */
 	initial_thread = running_thread ();
@@ -135,6 +281,8 @@ thread_start (void) {
 
 	/* Wait for the idle thread to initialize idle_thread. */
 	sema_down (&idle_started);
+
+	register_sched_inspect_intr ();
 }
 
 /* Called by the timer interrupt handler at each timer tick.
@@ -144,6 +292,8 @@ thread_tick (void) {
 	struct thread *t = thread_current ();
 
 	/* Update statistics. */
+	if (t != idle_thread)
+		t->rusage.ru_ticks++;
 	if (t == idle_thread)
 		idle_ticks++;
 #ifdef USERPROG
@@ -153,16 +303,67 @@ thread_tick (void) {
 	else
 		kernel_ticks++;
 
+	if (thread_mlfqs)
+		mlfqs_tick ();
+
+	/* Charge a deadline thread's budget.  When it runs out, the
+	   thread goes back to its priority's ready queue. */
+	if (t->dl_budget > 0 && --t->dl_budget == 0)
+		intr_yield_on_return ();
+	if (thread_fair && t != idle_thread)
+		fair_charge (t);
+	if (!list_empty (&dl_threads))
+		dl_replenish (timer_ticks ());
+
 	/* Enforce preemption. */
-	if (++thread_ticks >= TIME_SLICE)
+	if (++thread_ticks >= t->quantum || ready_queue_preempts (t))
 		intr_yield_on_return ();
 }
 
+/* Credits TICKS timer ticks that passed while the CPU was halted
+   in tickless idle mode to the idle thread.  Called by the timer
+   driver with interrupts off. */
+void
+thread_idle_catch_up (int64_t ticks) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	idle_ticks += ticks;
+
+	/* Replay the MLFQS once-per-second updates for every second
+	   boundary skipped while the tick was stopped.  Nothing ran,
+	   so nobody's recent_cpu grew in between. */
+	if (thread_mlfqs) {
+		int64_t now = timer_ticks ();
+		int64_t seconds = now / TIMER_FREQ - (now - ticks) / TIMER_FREQ;
+
+		while (seconds-- > 0)
+			mlfqs_update_second ();
+	}
+}
+
+/* Returns the tick at which the earliest sleeping thread should
+   wake up, or a deadline thread get its budget back, or INT64_MAX
+   if there is neither. */
+int64_t
+thread_next_wakeup (void) {
+	int64_t next = next_wakeup_tick;
+	struct list_elem *e;
+
+	for (e = list_begin (&dl_threads); e != list_end (&dl_threads);
+			e = list_next (e)) {
+		struct thread *t = list_entry (e, struct thread, dl_elem);
+
+		if (t->dl_budget == 0 && t->dl_deadline < next)
+			next = t->dl_deadline;
+	}
+	return next;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) {
 	printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
 			idle_ticks, kernel_ticks, user_ticks);
+	sched_stats_print ();
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -189,7 +390,7 @@ thread_create (const char *name, int priority,
 	ASSERT (function != NULL);
 
 	/* Allocate thread. */
-	t = palloc_get_page (PAL_ZERO);
+	t = thread_page_alloc ();
 	if (t == NULL)
 		return TID_ERROR;
 
@@ -225,6 +426,7 @@ thread_block (void) {
 	ASSERT (!intr_context ());
 	ASSERT (intr_get_level () == INTR_OFF);
 	
+	trace (TRACE_BLOCK, 0, 0);
 	thread_current ()->status = THREAD_BLOCKED;
 	schedule ();
 }
@@ -245,16 +447,25 @@ thread_unblock (struct thread *t) {
 
 	old_level = intr_disable ();
 	ASSERT (t->status == THREAD_BLOCKED);
-	list_push_back (&ready_list, &t->elem);
+	if (t->dl_period > 0)
+		dl_wakeup (t);
+	ready_queue_push (t);
 	t->status = THREAD_READY;
+	sched_stats_unblock (t);
+	trace (TRACE_UNBLOCK, t->tid, 0);
 	intr_set_level (old_level);
 
 	// if (t != initial_thread && 
 	// 	t->priority > thread_current()->priority)
 	// 	thread_yield();
-	if (!intr_context() && t->priority > thread_current()->priority)
-		thread_yield();
-
+	if (preempts (t, thread_current ())) {
+		/* A deadline thread woken by an interrupt handler runs as
+		   soon as the handler returns, not at the next tick. */
+		if (!intr_context ())
+			thread_yield ();
+		else if (t->dl_budget > 0)
+			intr_yield_on_return ();
+	}
 }
 
 /* Returns the name of the running thread. */
@@ -296,10 +507,15 @@ thread_exit (void) {
 #ifdef USERPROG
 	process_exit ();
 #endif
+	fpu_exit ();
 
 	/* Just set our status to dying and schedule another process.
 	   We will be destroyed during the call to schedule_tail(). */
 	intr_disable ();
+	list_remove (&thread_current ()->allelem);
+	if (thread_current ()->mlfqs_dirty)
+		list_remove (&thread_current ()->mlfqs_elem);
+	dl_set (thread_current (), 0, 0);
 	do_schedule (THREAD_DYING);
 	NOT_REACHED ();
 }
@@ -313,13 +529,32 @@ thread_yield (void) {
 
 	ASSERT (!intr_context ());
 
+	COUNTER_INC (thread_yields);
 	old_level = intr_disable ();
 	if (curr != idle_thread)
-		list_push_back (&ready_list, &curr->elem);
+		ready_queue_push (curr);
 	do_schedule (THREAD_READY);
 	intr_set_level (old_level);
 }
 
+/* Invoke function 'func' on all threads, passing along 'aux'.
+   This function must be called with interrupts off. */
+void
+thread_foreach (thread_action_func *func, void *aux) {
+	struct list_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	for (e = list_begin (&all_list); e != list_end (&all_list);
+			e = list_next (e)) {
+		struct thread *t = list_entry (e, struct thread, allelem);
+		func (t, aux);
+	}
+}
+
+/* Puts the current thread to sleep until the timer reaches tick
+   TICKS.  It will be woken up by thread_wakeup(), or earlier by
+   thread_wake_early(). */
 void
 thread_sleep (int64_t ticks) {
 	struct thread *curr = thread_current ();
@@ -329,45 +564,216 @@ thread_sleep (int64_t ticks) {
 	old_level = intr_disable ();
 	if (curr != idle_thread) {
 		curr->time_to_wake_up = ticks;
-		list_push_back(&sleep_list, &curr->elem);
+		curr->asleep = true;
+		heap_push (&sleep_queue, &curr->heap_elem);
+		if (ticks < next_wakeup_tick)
+			next_wakeup_tick = ticks;
 		thread_block();
 	}
 	intr_set_level (old_level);
 }
 
+/* Wakes up at most MAX sleeping threads whose wake-up tick is at
+   or before TICKS.  Returns true if that left some due.  Called
+   with interrupts off. */
+static bool
+wake_sleepers (int64_t ticks, int max) {
+	struct heap_elem *e;
+	bool more = false;
+
+	while ((e = heap_top (&sleep_queue)) != NULL) {
+		struct thread *t = heap_entry (e, struct thread, heap_elem);
+		if (t->time_to_wake_up > ticks)
+			break;
+		if (max-- == 0) {
+			more = true;
+			break;
+		}
+		heap_pop (&sleep_queue);
+		t->asleep = false;
+		thread_unblock (t);
+	}
+
+	e = heap_top (&sleep_queue);
+	next_wakeup_tick = e != NULL
+		? heap_entry (e, struct thread, heap_elem)->time_to_wake_up
+		: INT64_MAX;
+	return more;
+}
+
+/* Takes T out of the sleep queue before its wake-up tick, if it is
+   sleeping in thread_sleep(), and returns true if so; the caller
+   must then thread_unblock() it.  Unlike thread_unblock(), this
+   never yields, so a caller may take out several sleepers before
+   letting any run.  Interrupts must be off. */
+bool
+thread_wake_early (struct thread *t) {
+	struct heap_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!t->asleep)
+		return false;
+	heap_remove (&sleep_queue, &t->heap_elem);
+	t->asleep = false;
+	e = heap_top (&sleep_queue);
+	next_wakeup_tick = e != NULL
+		? heap_entry (e, struct thread, heap_elem)->time_to_wake_up
+		: INT64_MAX;
+	return true;
+}
+
+/* Wakes up the due sleepers that thread_wakeup() left, a batch at
+   a time with interrupts off only for each batch. */
+static void
+wakeup_work (void *aux UNUSED) {
+	bool more;
+
+	do {
+		enum intr_level old_level = intr_disable ();
+		more = wake_sleepers (timer_ticks (), WAKEUP_BATCH);
+		intr_set_level (old_level);
+	} while (more);
+}
+
+/* Wakes up every sleeping thread whose wake-up tick is at or
+   before TICKS.  Called by the timer interrupt handler; costs
+   constant time when no thread is due and O(k log n) when k of n
+   sleeping threads wake up.  Past WAKEUP_BATCH of them, the rest
+   are left to a worker thread, so that the handler stays short. */
 void
 thread_wakeup (int64_t ticks) {
-	struct list_elem *node = list_begin(&sleep_list);
-	struct list_elem *end_node = list_end(&sleep_list);
-	struct list_elem *tmp;
-	struct thread *t;
-
 	ASSERT(intr_context());
 
-	while (node != end_node) {
-		tmp = node;
-		node = list_next(tmp);
+	if (ticks < next_wakeup_tick)
+		return;
 
-		t = list_entry(tmp, struct thread, elem);
-		if (t->time_to_wake_up <= ticks) {
-			list_remove(tmp);
-			thread_unblock(t);
-		}
-	}
+	if (wake_sleepers (ticks, WAKEUP_BATCH))
+		work_submit (&wakeup_worker);
 }
 
 /* Sets the current thread's priority to NEW_PRIORITY. */
 void
 thread_set_priority (int new_priority) {
 	struct thread *curr = thread_current();
+	enum intr_level old_level;
+	int donated;
 
-	if (curr->priority <= new_priority ||
-		list_empty(&curr->donor_list))
-		curr->priority = new_priority;
-	
+	/* The MLFQS computes priorities by itself. */
+	if (thread_mlfqs)
+		return;
+
+	/* The new priority only takes effect immediately if it is not
+	   below what is currently donated to us. */
+	old_level = intr_disable ();
 	curr->original_priority = new_priority;
+	donated = lock_max_donation (curr);
+	thread_update_priority (curr,
+			new_priority > donated ? new_priority : donated);
+	intr_set_level (old_level);
+
+	/* Yield only if someone with higher priority is now waiting. */
+	if (ready_queue_preempts (curr))
+		thread_yield();
+}
+
+/* Puts the current thread in the deadline class, with RUNTIME
+   ticks of CPU in every PERIOD ticks, or takes it out if RUNTIME
+   is 0.  Returns false, changing nothing, if RUNTIME is more than
+   PERIOD or admitting the thread would let the class as a whole
+   take more than its share of the CPU.
+
+   The thread keeps its priority, which it runs at once its
+   budget for a period is used up, and which orders it among a
+   semaphore's waiters. */
+bool
+thread_set_deadline (int64_t runtime, int64_t period) {
+	struct thread *curr = thread_current ();
+
+	if (!dl_set (curr, runtime, period))
+		return false;
+	if (ready_queue_preempts (curr))
+		thread_yield ();
+	return true;
+}
 
-	thread_yield();
+/* Does the work of thread_set_deadline() for T, which must be
+   running, without yielding. */
+static bool
+dl_set (struct thread *t, int64_t runtime, int64_t period) {
+	enum intr_level old_level;
+	int64_t old_bw = 0, new_bw = 0;
+
+	if (runtime < 0 || (runtime > 0 && runtime > period))
+		return false;
+
+	old_level = intr_disable ();
+	if (t->dl_period > 0)
+		old_bw = t->dl_runtime * DL_BW_ONE / t->dl_period;
+	if (runtime > 0)
+		new_bw = runtime * DL_BW_ONE / period;
+	if (dl_bw - old_bw + new_bw > DL_BW_LIMIT) {
+		intr_set_level (old_level);
+		return false;
+	}
+	dl_bw += new_bw - old_bw;
+
+	if (runtime == 0) {
+		if (t->dl_period > 0)
+			list_remove (&t->dl_elem);
+		t->dl_runtime = t->dl_period = t->dl_budget = 0;
+	} else {
+		if (t->dl_period == 0)
+			list_push_back (&dl_threads, &t->dl_elem);
+		t->dl_runtime = t->dl_budget = runtime;
+		t->dl_period = period;
+		t->dl_deadline = timer_ticks () + period;
+	}
+	intr_set_level (old_level);
+	return true;
+}
+
+/* Moves the running thread into the fair-share group led by
+   LEADER, which may be the running thread itself to lead a group
+   of its own again.  LEADER must outlive its membership. */
+void
+thread_set_fair_group (struct thread *leader) {
+	struct thread *curr = thread_current ();
+	enum intr_level old_level;
+
+	ASSERT (is_thread (leader));
+
+	old_level = intr_disable ();
+	curr->fair_group = leader;
+	curr->vruntime = leader->fair_member_min;
+	intr_set_level (old_level);
+}
+
+/* Sets T's effective priority to PRIORITY.  If T is sitting in the
+   ready queue, it is moved to the queue of its new priority level so
+   that next_thread_to_run() keeps seeing it in the right place; if it
+   is blocked on a semaphore, the semaphore's waiter heap is fixed up.
+   Used by priority donation in synch.c. */
+void
+thread_update_priority (struct thread *t, int priority) {
+	enum intr_level old_level;
+
+	ASSERT (is_thread (t));
+	ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+	old_level = intr_disable ();
+	if (t->priority == priority)
+		;
+	else if (t->status == THREAD_READY) {
+		ready_queue_remove (t);
+		t->priority = priority;
+		ready_queue_push (t);
+	} else {
+		t->priority = priority;
+		if (t->status == THREAD_BLOCKED)
+			sema_waiter_update (t);
+	}
+	intr_set_level (old_level);
 }
 
 /* Returns the current thread's priority. */
@@ -376,31 +782,130 @@ thread_get_priority (void) {
 	return thread_current ()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE, recomputes the
+   thread's priority based on the new value, and yields if the
+   running thread no longer has the highest priority. */
 void
-thread_set_nice (int nice UNUSED) {
-	/* TODO: Your implementation goes here */
+thread_set_nice (int nice) {
+	struct thread *curr = thread_current ();
+	enum intr_level old_level;
+
+	if (nice < NICE_MIN)
+		nice = NICE_MIN;
+	if (nice > NICE_MAX)
+		nice = NICE_MAX;
+
+	old_level = intr_disable ();
+	curr->nice = nice;
+	mlfqs_update_priority (curr);
+	intr_set_level (old_level);
+
+	if (ready_queue_preempts (curr))
+		thread_yield ();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice (void) {
-	/* TODO: Your implementation goes here */
-	return 0;
+	return thread_current ()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) {
-	/* TODO: Your implementation goes here */
-	return 0;
+	enum intr_level old_level = intr_disable ();
+	int load_avg_100 = fp_to_int_round (load_avg * 100);
+	intr_set_level (old_level);
+
+	return load_avg_100;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu (void) {
-	/* TODO: Your implementation goes here */
-	return 0;
+	enum intr_level old_level = intr_disable ();
+	int recent_cpu_100 = fp_to_int_round (thread_current ()->recent_cpu * 100);
+	intr_set_level (old_level);
+
+	return recent_cpu_100;
+}
+
+/* MLFQS bookkeeping for one timer tick, called from thread_tick().
+
+   recent_cpu of the running thread grows by one and that thread is
+   remembered as dirty.  Every MLFQS_PRI_TICKS ticks only the dirty
+   threads get their priority recomputed, and once per second
+   load_avg and every thread's recent_cpu and priority are. */
+static void
+mlfqs_tick (void) {
+	struct thread *t = thread_current ();
+	int64_t now = timer_ticks ();
+
+	if (t != idle_thread) {
+		t->recent_cpu = fp_add_int (t->recent_cpu, 1);
+		if (!t->mlfqs_dirty) {
+			t->mlfqs_dirty = true;
+			list_push_back (&mlfqs_dirty_list, &t->mlfqs_elem);
+		}
+	}
+
+	if (now % TIMER_FREQ == 0)
+		mlfqs_update_second ();
+	else if (now % MLFQS_PRI_TICKS == 0) {
+		while (!list_empty (&mlfqs_dirty_list)) {
+			struct thread *d = list_entry (list_pop_front (&mlfqs_dirty_list),
+					struct thread, mlfqs_elem);
+			d->mlfqs_dirty = false;
+			mlfqs_update_priority (d);
+		}
+	}
+}
+
+/* Recomputes T's priority from its recent_cpu and nice values:
+   priority = PRI_MAX - (recent_cpu / 4) - (nice * 2).
+   A ready thread is moved to its new ready queue in O(1). */
+static void
+mlfqs_update_priority (struct thread *t) {
+	int priority = PRI_MAX - fp_to_int (t->recent_cpu / 4) - t->nice * 2;
+
+	if (priority < PRI_MIN)
+		priority = PRI_MIN;
+	if (priority > PRI_MAX)
+		priority = PRI_MAX;
+	thread_update_priority (t, priority);
+}
+
+/* The once-per-second MLFQS update: recomputes load_avg, then decays
+   every thread's recent_cpu and recomputes its priority.  Because
+   ready threads live in per-priority queues, re-bucketing each one
+   is O(1) and the whole pass is a single walk over all_list with no
+   sorting.  This also covers every dirty thread. */
+static void
+mlfqs_update_second (void) {
+	struct thread *curr = thread_current ();
+	int ready_threads = ready_cnt + (curr != idle_thread ? 1 : 0);
+	fixed_t coeff;
+	struct list_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	/* load_avg = (59/60) * load_avg + (1/60) * ready_threads. */
+	load_avg = (fp_mul (fp_div (fp_from_int (59), fp_from_int (60)), load_avg)
+			+ fp_from_int (ready_threads) / 60);
+
+	/* recent_cpu = (2 * load_avg) / (2 * load_avg + 1) * recent_cpu + nice. */
+	coeff = fp_div (2 * load_avg, fp_add_int (2 * load_avg, 1));
+	for (e = list_begin (&all_list); e != list_end (&all_list);
+			e = list_next (e)) {
+		struct thread *t = list_entry (e, struct thread, allelem);
+
+		t->recent_cpu = fp_add_int (fp_mul (coeff, t->recent_cpu), t->nice);
+		mlfqs_update_priority (t);
+	}
+
+	while (!list_empty (&mlfqs_dirty_list))
+		list_entry (list_pop_front (&mlfqs_dirty_list),
+				struct thread, mlfqs_elem)->mlfqs_dirty = false;
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -417,13 +922,26 @@ idle (void *idle_started_ UNUSED) {
 	struct semaphore *idle_started = idle_started_;
 
 	idle_thread = thread_current ();
+
+	/* The idle thread takes no part in the MLFQS bookkeeping. */
+	intr_disable ();
+	list_remove (&idle_thread->allelem);
+	intr_enable ();
+
 	sema_up (idle_started);
 
 	for (;;) {
-		/* Let someone else run. */
+		/* Let someone else run.  If a tickless idle period was cut
+		   short by another interrupt, restore the periodic tick
+		   first. */
 		intr_disable ();
+		timer_idle_exit ();
 		thread_block ();
 
+		/* Nothing is runnable: stop ticking until the next sleep
+		   deadline, if tickless idle is enabled. */
+		timer_idle_enter ();
+
 		/* Re-enable interrupts and wait for the next one.
 
 		   The `sti' instruction disables interrupts until the
@@ -455,6 +973,8 @@ kernel_thread (thread_func *function, void *aux) {
    NAME. */
 static void
 init_thread (struct thread *t, const char *name, int priority) {
+	enum intr_level old_level;
+
 	ASSERT (t != NULL);
 	ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
 	ASSERT (name != NULL);
@@ -464,12 +984,345 @@ init_thread (struct thread *t, const char *name, int priority) {
 	strlcpy (t->name, name, sizeof t->name);
 	t->tf.rsp = (uint64_t) t + PGSIZE - sizeof (void *);
 	t->magic = THREAD_MAGIC;
+	t->quantum = TIME_SLICE;
 	t->priority = priority;
 
+	/* For the fair-share class: a new thread leads a group of its
+	   own, and starts level with the others, not ahead of them. */
+	t->fair_group = t;
+	rbtree_init (&t->fair_members, fair_member_less, NULL);
+	t->vruntime = t->group_vruntime = t->fair_member_min = fair_min;
+
 	/* For donation */
 	t->original_priority = priority;
 	t->wanted = NULL;
-	list_init(&t->donor_list);
+	heap_init (&t->held_locks, lock_donation_less, NULL);
+
+	/* For the MLFQS: a new thread inherits its creator's nice and
+	   recent_cpu; the initial thread starts from zero. */
+	if (t != running_thread ()) {
+		t->nice = running_thread ()->nice;
+		t->recent_cpu = running_thread ()->recent_cpu;
+	}
+	if (thread_mlfqs)
+		mlfqs_update_priority (t);
+
+#ifdef USERPROG
+	t->proc = t;
+	sema_init (&t->thread_gone, 0);
+#endif
+
+	old_level = intr_disable ();
+	list_push_back (&all_list, &t->allelem);
+	intr_set_level (old_level);
+}
+
+/* Weights of priorities PRI_DEFAULT + 20 down to PRI_DEFAULT - 19
+   in the fair-share class, each about 1.25 times the next, as
+   Linux weighs nice values. */
+static const int fair_weights[40] = {
+	88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705,
+	14949, 11916, 9548, 7620, 6100, 4904, 3906, 3121,
+	2501, 1991, 1586, 1277, 1024, 820, 655, 526,
+	423, 335, 272, 215, 172, 137, 110, 87,
+	70, 56, 45, 36, 29, 23, 18, 15,
+};
+
+/* Returns what one tick of CPU adds to the vruntime of a thread,
+   or the group_vruntime of a group leader, at PRIORITY. */
+static int64_t
+fair_tick_cost (int priority) {
+	int i = PRI_DEFAULT + 20 - priority;
+
+	if (i < 0)
+		i = 0;
+	if (i > 39)
+		i = 39;
+	return (int64_t) FAIR_TICK * 1024 / fair_weights[i];
+}
+
+/* Orders the ready members of a group, least vruntime first. */
+static bool
+fair_member_less (const struct rbtree_elem *a_,
+		const struct rbtree_elem *b_, void *aux UNUSED) {
+	const struct thread *a = rbtree_entry (a_, struct thread, fair_elem);
+	const struct thread *b = rbtree_entry (b_, struct thread, fair_elem);
+
+	return a->vruntime < b->vruntime;
+}
+
+/* Orders group leaders, least group_vruntime first. */
+static bool
+fair_group_less (const struct rbtree_elem *a_,
+		const struct rbtree_elem *b_, void *aux UNUSED) {
+	const struct thread *a = rbtree_entry (a_, struct thread, group_elem);
+	const struct thread *b = rbtree_entry (b_, struct thread, group_elem);
+
+	return a->group_vruntime < b->group_vruntime;
+}
+
+/* Adds ready thread T to its group's fair_members, and the group to
+   fair_groups if T is its first ready member.  Neither goes further
+   back than FAIR_CREDIT behind the others. */
+static void
+fair_push (struct thread *t) {
+	struct thread *g = t->fair_group;
+
+	if (t->vruntime < g->fair_member_min - FAIR_CREDIT)
+		t->vruntime = g->fair_member_min - FAIR_CREDIT;
+	if (rbtree_empty (&g->fair_members)) {
+		if (g->group_vruntime < fair_min - FAIR_CREDIT)
+			g->group_vruntime = fair_min - FAIR_CREDIT;
+		rbtree_insert (&fair_groups, &g->group_elem);
+	}
+	rbtree_insert (&g->fair_members, &t->fair_elem);
+}
+
+/* Removes ready thread T from its group's fair_members, and the
+   group from fair_groups if T was its last ready member. */
+static void
+fair_remove (struct thread *t) {
+	struct thread *g = t->fair_group;
+
+	rbtree_remove (&g->fair_members, &t->fair_elem);
+	if (rbtree_empty (&g->fair_members))
+		rbtree_remove (&fair_groups, &g->group_elem);
+}
+
+/* Returns the thread the fair-share class would run next: the
+   least-charged member of the least-charged group.  Returns a null
+   pointer if no thread is ready. */
+static struct thread *
+fair_first (void) {
+	struct rbtree_elem *e = rbtree_first (&fair_groups);
+	struct thread *g;
+
+	if (e == NULL)
+		return NULL;
+	g = rbtree_entry (e, struct thread, group_elem);
+	return rbtree_entry (rbtree_first (&g->fair_members),
+			struct thread, fair_elem);
+}
+
+/* T, taken from fair_first(), is about to run: moves fair_min and
+   its group's fair_member_min up to it. */
+static void
+fair_advance (struct thread *t) {
+	struct thread *g = t->fair_group;
+
+	if (g->group_vruntime > fair_min)
+		fair_min = g->group_vruntime;
+	if (t->vruntime > g->fair_member_min)
+		g->fair_member_min = t->vruntime;
+}
+
+/* Charges running thread T, and its group, for one tick of CPU.
+   The group is re-sorted if it is in fair_groups, which it is
+   while other members of it are ready. */
+static void
+fair_charge (struct thread *t) {
+	struct thread *g = t->fair_group;
+	bool queued = !rbtree_empty (&g->fair_members);
+
+	t->vruntime += fair_tick_cost (t->priority);
+	if (queued)
+		rbtree_remove (&fair_groups, &g->group_elem);
+	g->group_vruntime += fair_tick_cost (g->priority);
+	if (queued)
+		rbtree_insert (&fair_groups, &g->group_elem);
+}
+
+/* Returns true if ready thread T is far enough behind CURR, in
+   the fair-share class, to run in its place: compared with CURR
+   as a member of the same group, or else group against group. */
+static bool
+fair_preempts (const struct thread *t, const struct thread *curr) {
+	if (curr == idle_thread)
+		return true;
+	if (t->fair_group == curr->fair_group)
+		return t->vruntime + FAIR_GRAN < curr->vruntime;
+	return t->fair_group->group_vruntime + FAIR_GRAN
+		< curr->fair_group->group_vruntime;
+}
+
+/* Orders deadline threads by deadline, earliest first. */
+static bool
+dl_less (const struct list_elem *a_, const struct list_elem *b_,
+		void *aux UNUSED) {
+	const struct thread *a = list_entry (a_, struct thread, elem);
+	const struct thread *b = list_entry (b_, struct thread, elem);
+
+	return a->dl_deadline < b->dl_deadline;
+}
+
+/* Deadline thread T is waking up.  If what is left of its budget
+   would carry it past its share of the CPU before its deadline,
+   or the deadline has passed, starts it on a fresh period, as the
+   constant bandwidth server does: otherwise a thread that slept
+   could catch up on all its budget at once. */
+static void
+dl_wakeup (struct thread *t) {
+	int64_t now = timer_ticks ();
+
+	if (t->dl_budget == 0)
+		return;
+	if (now >= t->dl_deadline
+			|| t->dl_budget * t->dl_period
+			> (t->dl_deadline - now) * t->dl_runtime) {
+		t->dl_budget = t->dl_runtime;
+		t->dl_deadline = now + t->dl_period;
+	}
+}
+
+/* Refills the budget of every deadline thread that used it up and
+   whose deadline has come, as of tick NOW, moving the ready ones
+   up to dl_ready.  Interrupts must be off. */
+static void
+dl_replenish (int64_t now) {
+	struct list_elem *e;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	for (e = list_begin (&dl_threads); e != list_end (&dl_threads);
+			e = list_next (e)) {
+		struct thread *t = list_entry (e, struct thread, dl_elem);
+		bool ready = t->status == THREAD_READY;
+
+		if (t->dl_budget > 0 || now < t->dl_deadline)
+			continue;
+		if (ready)
+			ready_queue_remove (t);
+		t->dl_budget = t->dl_runtime;
+		t->dl_deadline += t->dl_period;
+		if (t->dl_deadline <= now)
+			t->dl_deadline = now + t->dl_period;
+		if (ready)
+			ready_queue_push (t);
+	}
+}
+
+/* Appends T to the ready queue of its priority level, or puts it
+   in dl_ready if it is a deadline thread with budget left.
+   Interrupts must be off. */
+static void
+ready_queue_push (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (t->dl_budget > 0) {
+		list_insert_ordered (&dl_ready, &t->elem, dl_less, NULL);
+		ready_cnt++;
+		return;
+	}
+	if (thread_fair) {
+		t->slice_boost = false;
+		fair_push (t);
+		ready_cnt++;
+		return;
+	}
+	if (t->slice_boost) {
+		t->slice_boost = false;
+		list_push_front (&ready_queues[t->priority], &t->elem);
+	} else
+		list_push_back (&ready_queues[t->priority], &t->elem);
+	ready_bitmap |= 1ULL << t->priority;
+	ready_cnt++;
+}
+
+/* Removes T, which must be ready, from its ready queue.
+   Interrupts must be off. */
+static void
+ready_queue_remove (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+	ASSERT (t->status == THREAD_READY);
+
+	if (t->dl_budget == 0 && thread_fair)
+		fair_remove (t);
+	else {
+		list_remove (&t->elem);
+		if (t->dl_budget == 0 && list_empty (&ready_queues[t->priority]))
+			ready_bitmap &= ~(1ULL << t->priority);
+	}
+	ready_cnt--;
+}
+
+/* Returns the highest priority among ready threads, or PRI_MIN - 1
+   if no thread is ready. */
+static int
+ready_queue_max_priority (void) {
+	if (ready_bitmap == 0)
+		return PRI_MIN - 1;
+	return 63 - __builtin_clzll (ready_bitmap);
+}
+
+/* Returns true if thread T, if it were ready, should run in place
+   of CURR. */
+static bool
+preempts (const struct thread *t, const struct thread *curr) {
+	if (t->dl_budget > 0)
+		return curr->dl_budget == 0 || t->dl_deadline < curr->dl_deadline;
+	if (curr->dl_budget > 0)
+		return false;
+	if (thread_fair)
+		return fair_preempts (t, curr);
+	return t->priority > curr->priority;
+}
+
+/* Returns true if some ready thread should run in place of CURR. */
+static bool
+ready_queue_preempts (const struct thread *curr) {
+	if (!list_empty (&dl_ready))
+		return preempts (list_entry (list_front (&dl_ready),
+					struct thread, elem), curr);
+	if (curr->dl_budget > 0)
+		return false;
+	if (thread_fair) {
+		struct thread *t = fair_first ();
+		return t != NULL && fair_preempts (t, curr);
+	}
+	return ready_queue_max_priority () > curr->priority;
+}
+
+/* Removes and returns the deadline thread with the earliest
+   deadline, if any has budget left, or else the frontmost thread
+   of the highest non-empty ready queue, or a null pointer if every
+   queue is empty. */
+static struct thread *
+ready_queue_pop (void) {
+	int pri = ready_queue_max_priority ();
+	struct list *queue;
+
+	if (!list_empty (&dl_ready)) {
+		ready_cnt--;
+		return list_entry (list_pop_front (&dl_ready), struct thread, elem);
+	}
+	if (thread_fair) {
+		struct thread *t = fair_first ();
+
+		if (t != NULL) {
+			ready_queue_remove (t);
+			fair_advance (t);
+		}
+		return t;
+	}
+	if (pri < PRI_MIN)
+		return NULL;
+
+	queue = &ready_queues[pri];
+	struct thread *t = list_entry (list_pop_front (queue), struct thread, elem);
+	if (list_empty (queue))
+		ready_bitmap &= ~(1ULL << pri);
+	ready_cnt--;
+	return t;
+}
+
+/* Orders sleeping threads by wake-up tick, earliest first. */
+static bool
+wakeup_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct thread *a = heap_entry (a_, struct thread, heap_elem);
+	const struct thread *b = heap_entry (b_, struct thread, heap_elem);
+
+	return a->time_to_wake_up < b->time_to_wake_up;
 }
 
 /* Chooses and returns the next thread to be scheduled.  Should
@@ -479,24 +1332,9 @@ init_thread (struct thread *t, const char *name, int priority) {
    idle_thread. */
 static struct thread *
 next_thread_to_run (void) {
-	if (list_empty (&ready_list))
-		return idle_thread;
-	else {
-		struct list_elem *node = list_begin(&ready_list);
-		struct list_elem *end_node = list_end(&ready_list);
-		struct thread *highest_thread, *tmp;
-
-		highest_thread = list_entry(node, struct thread, elem); // 초기값
-		while (node != end_node) {
-			tmp = list_entry(node, struct thread, elem);
-			if (highest_thread->priority < tmp->priority)
-				highest_thread = tmp;
-			node = list_next(node);
-		}
-		list_remove(&(highest_thread->elem));
-		return highest_thread;
-		// return list_entry (list_pop_front (&ready_list), struct thread, elem);
-	}
+	struct thread *next = ready_queue_pop ();
+
+	return next != NULL ? next : idle_thread;
 }
 
 /* Use iretq to launch the thread */
@@ -542,6 +1380,7 @@ thread_launch (struct thread *th) {
 	uint64_t tf_cur = (uint64_t) &running_thread ()->tf;
 	uint64_t tf = (uint64_t) &th->tf;
 	ASSERT (intr_get_level () == INTR_OFF);
+	sched_stats_launch (th);
 
 	/* The main switching logic.
 	 * We first restore the whole execution context into the intr_frame
@@ -607,7 +1446,7 @@ do_schedule(int status) {
 	while (!list_empty (&destruction_req)) {  // Q. 지표공간계에 어떻게 계시는거죠? 
 		struct thread *ghost =
 			list_entry (list_pop_front (&destruction_req), struct thread, elem);
-		palloc_free_page(ghost);  // A. 아, 싸패다. 떠남.
+		thread_page_free (ghost);  // A. 아, 싸패다. 떠남.
 	}
 	thread_current ()->status = status;
 	schedule ();
@@ -616,21 +1455,37 @@ do_schedule(int status) {
 static void
 schedule (void) {
 	struct thread *curr = running_thread ();
-	struct thread *next = next_thread_to_run ();
+	struct thread *next;
 
 	ASSERT (intr_get_level () == INTR_OFF);
 	ASSERT (curr->status != THREAD_RUNNING);
+
+	/* An interrupt that wakes a thread can preempt the idle thread
+	   in the middle of a tickless period, before its loop gets to
+	   timer_idle_exit(): restore the periodic tick on every way out
+	   of idle. */
+	if (curr == idle_thread)
+		timer_idle_exit ();
+	next = next_thread_to_run ();
 	ASSERT (is_thread (next));
+	sched_stats_schedule (curr, next,
+			curr->status == THREAD_READY && curr != idle_thread);
+	if (curr != next)
+		trace (TRACE_SWITCH, next->tid, curr->status);
+
 	/* Mark us as running. */
 	next->status = THREAD_RUNNING;
 
 	/* Start new time slice. */
+	if (thread_adaptive_slice && curr != idle_thread)
+		adapt_quantum (curr);
 	thread_ticks = 0;
 
 #ifdef USERPROG
 	/* Activate the new address space. */
 	process_activate (next);
 #endif
+	fpu_switch (next);
 
 	if (curr != next) {
 		/* If the thread we switched from is dying, destroy its struct
@@ -652,6 +1507,59 @@ schedule (void) {
 	}
 }
 
+/* Adjusts the time slice of CURR, which is being switched out,
+   according to how it used the slice that just ended.
+
+   A thread that blocks before its slice runs out is interactive or
+   I/O-bound: its slice halves, and when it wakes up it goes to the
+   front of its ready queue so that it gets the CPU back quickly.
+   A thread that runs its whole slice is CPU-bound: its slice
+   doubles, so it is switched out less often.  A thread that yields
+   early keeps its slice.  Priorities are never changed. */
+static void
+adapt_quantum (struct thread *curr) {
+	if (curr->status == THREAD_BLOCKED && thread_ticks < curr->quantum) {
+		if (curr->quantum > SLICE_MIN)
+			curr->quantum /= 2;
+		curr->slice_boost = true;
+	} else if (curr->status == THREAD_READY && thread_ticks >= curr->quantum) {
+		if (curr->quantum < SLICE_MAX)
+			curr->quantum *= 2;
+	}
+}
+
+/* Returns a page for a new thread, recycled from a dead thread if
+   possible, or a null pointer if memory is exhausted.  Only the
+   struct thread at the bottom of the page is guaranteed zeroed,
+   by init_thread(). */
+static struct thread *
+thread_page_alloc (void) {
+	struct thread *t = NULL;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	if (!list_empty (&thread_cache)) {
+		t = list_entry (list_pop_front (&thread_cache), struct thread, elem);
+		thread_cache_cnt--;
+	}
+	intr_set_level (old_level);
+
+	return t != NULL ? t : palloc_get_page (0);
+}
+
+/* Releases the page of dead thread T, keeping it for reuse unless
+   the cache is full. */
+static void
+thread_page_free (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (thread_cache_cnt < THREAD_CACHE_MAX) {
+		list_push_front (&thread_cache, &t->elem);
+		thread_cache_cnt++;
+	} else
+		palloc_free_page (t);
+}
+
 /* Returns a tid to use for a new thread. */
 static tid_t
 allocate_tid (void) {
@@ -0,0 +1,118 @@
+/* trace.c: Kernel event tracing.
+
+   With "-trace", tracepoints throughout the kernel record events
+   such as context switches, page faults and disk requests into a
+   ring of compact binary records, stamped with the TSC, that holds
+   the last of them.  Recording one takes no lock and prints
+   nothing, so unlike printf() it barely perturbs the timing it is
+   meant to show.  "-trace=PAGES" sizes the ring.
+
+   At power off trace_dump() prints the ring, oldest first, one
+   "trace" line per event.  utils/pintos-trace reads those lines
+   from the console log and turns them into Chrome trace JSON, to
+   be viewed with Perfetto or chrome://tracing. */
+
+#include "threads/trace.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/vmalloc.h"
+#include "devices/timer.h"
+#include "intrinsic.h"
+
+/* An event. */
+struct trace_rec {
+	uint64_t tsc;                       /* When. */
+	uint64_t arg;                       /* Depends on EVENT. */
+	int32_t tid;                        /* Running thread. */
+	uint16_t event;                     /* An enum trace_event. */
+	uint16_t aux;                       /* Depends on EVENT. */
+};
+
+/* Names of the events, as dumped. */
+static const char *event_names[TRACE_EVENT_CNT] = {
+	[TRACE_SWITCH] = "switch",
+	[TRACE_BLOCK] = "block",
+	[TRACE_UNBLOCK] = "unblock",
+	[TRACE_FAULT] = "fault",
+	[TRACE_SWAP_IN] = "swap-in",
+	[TRACE_SWAP_OUT] = "swap-out",
+	[TRACE_DISK_SUBMIT] = "disk-submit",
+	[TRACE_DISK_DONE] = "disk-done",
+	[TRACE_SYSCALL_ENTER] = "syscall-enter",
+	[TRACE_SYSCALL_EXIT] = "syscall-exit",
+	[TRACE_LOCK_WAIT] = "lock-wait",
+	[TRACE_LOCK_ACQUIRE] = "lock-acquire",
+};
+
+int trace_pages;
+DEFINE_STATIC_KEY (trace_key);
+
+static struct trace_rec *ring;      /* The ring, or null if off. */
+static size_t ring_size;            /* Records the ring holds. */
+static uint64_t event_cnt;          /* Events recorded. */
+
+/* Starts tracing if "-trace" asked for it. */
+void
+trace_init (void) {
+	if (trace_pages <= 0)
+		return;
+
+	ring = vmalloc (trace_pages * PGSIZE);
+	if (ring == NULL) {
+		printf ("trace: no memory for %d pages, tracing off\n", trace_pages);
+		return;
+	}
+	ring_size = trace_pages * PGSIZE / sizeof *ring;
+	static_key_enable (&trace_key);
+}
+
+/* Records EVENT with ARG and AUX, attributed to the running
+   thread.  May be called from an interrupt handler, and from
+   schedule(), where thread_current() would object that the
+   running thread is not THREAD_RUNNING. */
+void
+trace_record (enum trace_event event, uint64_t arg, uint16_t aux) {
+	struct thread *t = pg_round_down (rrsp ());
+	enum intr_level old_level = intr_disable ();
+	struct trace_rec *r;
+
+	if (ring != NULL) {
+		r = &ring[event_cnt++ % ring_size];
+		r->tsc = rdtsc ();
+		r->arg = arg;
+		r->tid = t->tid;
+		r->event = event;
+		r->aux = aux;
+	}
+	intr_set_level (old_level);
+}
+
+/* Prints the events in the ring, oldest first, as
+   "trace TSC TID EVENT ARG AUX" lines. */
+void
+trace_dump (void) {
+	struct trace_rec *r = ring;
+	uint64_t first, i;
+
+	/* Stop tracing, so that the ring holds still. */
+	if (r == NULL)
+		return;
+	static_key_disable (&trace_key);
+	ring = NULL;
+	barrier ();
+
+	first = event_cnt > ring_size ? event_cnt - ring_size : 0;
+	printf ("Trace: %llu events at %llu TSC Hz; last %llu follow\n",
+			event_cnt, timer_tsc_hz (), event_cnt - first);
+	for (i = first; i < event_cnt; i++) {
+		const struct trace_rec *e = &r[i % ring_size];
+
+		printf ("trace %llu %d %s %#llx %u\n", e->tsc, e->tid,
+				event_names[e->event], e->arg, e->aux);
+	}
+	vfree (r);
+}
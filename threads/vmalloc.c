@@ -0,0 +1,169 @@
+#include "threads/vmalloc.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include "threads/init.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Virtually contiguous kernel memory.
+
+   vmalloc() takes single pages from the kernel pool, wherever they
+   happen to be, and maps them one after another into
+   [VMALLOC_START, VMALLOC_END).  Therefore a big table needs no
+   physically contiguous run of pages, which a fragmented pool may
+   not have or may take a long bitmap scan to find.
+
+   The range lies under the same PML4 entry as KERN_BASE, whose page
+   directory pointer table every page table shares with base_pml4
+   (see pml4_create()), so a mapping added to base_pml4 shows up in
+   every address space at once.  Each area is followed by a guard
+   page that is never mapped, which catches overruns and tells
+   vfree() where the area ends.
+
+   The pages are not physically contiguous, and vtop() does not
+   work on their addresses, so vmalloc() memory must not be used
+   for DMA.  Neither function may be called from an interrupt
+   handler, but the memory may be used from one. */
+
+/* Pages in the range, guard pages included. */
+#define VMALLOC_PAGES ((VMALLOC_END - VMALLOC_START) / PGSIZE)
+
+static struct lock vmalloc_lock;        /* Guards used_map. */
+static struct bitmap *used_map;         /* Pages of the range in use. */
+
+static void *vmalloc_pages (size_t page_cnt, enum palloc_flags);
+static size_t unmap_area (uint8_t *va);
+static void release_range (uint8_t *va, size_t page_cnt);
+
+/* Initializes the allocator, given that physical memory ends at
+   MEM_END.  The page allocator, malloc(), and base_pml4 must
+   already be set up. */
+void
+vmalloc_init (uint64_t mem_end) {
+	ASSERT ((uint64_t) ptov (mem_end) <= VMALLOC_START);
+	ASSERT (VMALLOC_START >> PML4SHIFT == KERN_BASE >> PML4SHIFT);
+	ASSERT ((VMALLOC_END - 1) >> PML4SHIFT == KERN_BASE >> PML4SHIFT);
+
+	lock_init (&vmalloc_lock);
+	used_map = bitmap_create (VMALLOC_PAGES);
+	if (used_map == NULL)
+		PANIC ("vmalloc: no memory for the map");
+}
+
+/* Obtains and returns a new block of at least SIZE bytes, which is
+   virtually but not necessarily physically contiguous, starting on
+   a page boundary.  Returns a null pointer if memory or address
+   space is not available. */
+void *
+vmalloc (size_t size) {
+	return vmalloc_pages (DIV_ROUND_UP (size, PGSIZE), 0);
+}
+
+/* Like vmalloc(), but allocates A times B bytes initialized to
+   zeroes. */
+void *
+vcalloc (size_t a, size_t b) {
+	size_t size = a * b;
+
+	/* Make sure the size fits in size_t. */
+	if (b != 0 && size / b != a)
+		return NULL;
+	return vmalloc_pages (DIV_ROUND_UP (size, PGSIZE), PAL_ZERO);
+}
+
+/* Frees block P, which must have been previously allocated with
+   vmalloc() or vcalloc(). */
+void
+vfree (void *p) {
+	size_t page_cnt;
+
+	if (p == NULL)
+		return;
+	ASSERT (is_vmalloc_addr (p) && pg_ofs (p) == 0);
+
+	page_cnt = unmap_area (p);
+	release_range (p, page_cnt + 1);
+}
+
+/* Returns true if P points into the vmalloc() range. */
+bool
+is_vmalloc_addr (const void *p) {
+	return (uint64_t) p >= VMALLOC_START && (uint64_t) p < VMALLOC_END;
+}
+
+/* Reserves PAGE_CNT pages of the range plus a guard page and maps
+   a page of the kernel pool, obtained with FLAGS, at each.  Returns
+   the first, or a null pointer on failure. */
+static void *
+vmalloc_pages (size_t page_cnt, enum palloc_flags flags) {
+	uint8_t *start;
+	size_t page_idx, i;
+
+	if (page_cnt == 0)
+		return NULL;
+
+	lock_acquire (&vmalloc_lock);
+	page_idx = bitmap_scan_and_flip (used_map, 0, page_cnt + 1, false);
+	lock_release (&vmalloc_lock);
+	if (page_idx == BITMAP_ERROR)
+		return NULL;
+
+	start = (uint8_t *) VMALLOC_START + page_idx * PGSIZE;
+	for (i = 0; i < page_cnt; i++) {
+		uint64_t *pte = pml4e_walk (base_pml4,
+				(uint64_t) (start + i * PGSIZE), 1);
+		void *kpage = pte != NULL ? palloc_get_page (flags) : NULL;
+
+		if (kpage == NULL) {
+			unmap_area (start);
+			release_range (start, page_cnt + 1);
+			return NULL;
+		}
+		*pte = vtop (kpage) | PTE_P | PTE_W;
+	}
+	return start;
+}
+
+/* Unmaps the pages of the area at VA, up to the guard page, frees
+   them, and returns how many there were.
+
+   Every address space may have cached the mappings, so the pages
+   are only marked not present at first, and freed after the TLB
+   entries of every PCID are dropped. */
+static size_t
+unmap_area (uint8_t *va) {
+	size_t page_cnt, i;
+	uint64_t *pte;
+
+	for (page_cnt = 0; ; page_cnt++) {
+		pte = pml4e_walk (base_pml4, (uint64_t) (va + page_cnt * PGSIZE), 0);
+		if (pte == NULL || !(*pte & PTE_P))
+			break;
+		*pte &= ~(uint64_t) PTE_P;
+	}
+	pml4_flush_kernel ();
+
+	for (i = 0; i < page_cnt; i++) {
+		pte = pml4e_walk (base_pml4, (uint64_t) (va + i * PGSIZE), 0);
+		palloc_free_page (ptov (PTE_ADDR (*pte)));
+		*pte = 0;
+	}
+	return page_cnt;
+}
+
+/* Returns the PAGE_CNT pages of the range starting at VA, which
+   must no longer be mapped, to the free part of the range. */
+static void
+release_range (uint8_t *va, size_t page_cnt) {
+	size_t page_idx = pg_no (va) - pg_no (VMALLOC_START);
+
+	lock_acquire (&vmalloc_lock);
+	ASSERT (bitmap_all (used_map, page_idx, page_cnt));
+	bitmap_set_multiple (used_map, page_idx, page_cnt, false);
+	lock_release (&vmalloc_lock);
+}
@@ -0,0 +1,111 @@
+/* workqueue.c: Bottom halves for interrupt handlers.
+
+   work_submit() pushes a work item on a stack with a single
+   compare-and-swap, so it is safe from an interrupt handler and
+   never disables interrupts itself, and ups a semaphore.  One of
+   WORKER_CNT threads, in the deadline class and at PRI_MAX beyond
+   its budget, then takes the whole stack with an atomic exchange,
+   reverses it into submission order, and runs each item with
+   interrupts on.  An item that is already pending
+   is not queued again, so a handler that fires repeatedly before
+   its work runs causes it to run once. */
+
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of worker threads. */
+#define WORKER_CNT 2
+
+/* Each worker's deadline class reservation: WORKER_RUNTIME ticks
+   of CPU in every WORKER_PERIOD. */
+#define WORKER_RUNTIME 2
+#define WORKER_PERIOD 10
+
+/* Submitted work, most recent first. */
+static struct work *submitted;
+
+/* Counts submissions not yet seen by a worker. */
+static struct semaphore work_sema;
+
+static thread_func worker;
+
+/* Starts the worker threads. */
+void
+workqueue_init (void) {
+	int i;
+
+	sema_init (&work_sema, 0);
+	for (i = 0; i < WORKER_CNT; i++) {
+		char name[16];
+
+		snprintf (name, sizeof name, "worker%d", i);
+		if (thread_create (name, PRI_MAX, worker, NULL) == TID_ERROR)
+			PANIC ("cannot start %s", name);
+	}
+}
+
+/* Initializes W to call FUNC with AUX. */
+void
+work_init (struct work *w, work_func *func, void *aux) {
+	w->next = NULL;
+	w->func = func;
+	w->aux = aux;
+	w->pending = false;
+}
+
+/* Queues W to be run by a worker thread.  May be called from an
+   interrupt handler.  Returns false if W was already pending. */
+bool
+work_submit (struct work *w) {
+	struct work *head;
+
+	if (__atomic_exchange_n (&w->pending, true, __ATOMIC_ACQ_REL))
+		return false;
+
+	head = __atomic_load_n (&submitted, __ATOMIC_RELAXED);
+	do
+		w->next = head;
+	while (!__atomic_compare_exchange_n (&submitted, &head, w, true,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	sema_up (&work_sema);
+	if (intr_context ())
+		intr_yield_on_return ();
+	return true;
+}
+
+/* Worker thread: runs submitted work forever. */
+static void
+worker (void *aux UNUSED) {
+	thread_set_deadline (WORKER_RUNTIME, WORKER_PERIOD);
+	for (;;) {
+		struct work *w, *fifo = NULL;
+
+		sema_down (&work_sema);
+		w = __atomic_exchange_n (&submitted, NULL, __ATOMIC_ACQUIRE);
+
+		/* Another worker may have taken this submission along with
+		   its own. */
+		while (w != NULL) {
+			struct work *next = w->next;
+
+			w->next = fifo;
+			fifo = w;
+			w = next;
+		}
+
+		while (fifo != NULL) {
+			w = fifo;
+			fifo = w->next;
+
+			/* Clear pending first, so that W may be submitted again
+			   while it runs. */
+			__atomic_store_n (&w->pending, false, __ATOMIC_RELEASE);
+			w->func (w->aux);
+		}
+	}
+}
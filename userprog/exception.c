@@ -2,15 +2,41 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/process.h"
+#include "userprog/usercopy.h"
+#include "threads/instrument.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #include "intrinsic.h"
 
-/* Number of page faults processed. */
-static long long page_fault_cnt;
+/* Page faults of one cause, timed with the TSC from entry to
+   the handler until it is done. */
+struct fault_stats {
+	uint64_t cnt;           /* Number of faults. */
+	uint64_t cycles;        /* Total cycles spent handling them. */
+	uint64_t max;           /* Longest fault, in cycles. */
+};
+
+static struct fault_stats fault_stats[FAULT_CAUSE_CNT];
+
+/* Page faults taken in user and in kernel mode. */
+DEFINE_COUNTER (faults_user);
+DEFINE_COUNTER (faults_kernel);
+
+static const char *fault_cause_names[FAULT_CAUSE_CNT] = {
+	[FAULT_MINOR] = "minor",
+	[FAULT_FILE] = "file",
+	[FAULT_SWAP] = "swap-in",
+	[FAULT_COW] = "copy-on-write",
+	[FAULT_STACK] = "stack growth",
+	[FAULT_INVALID] = "invalid",
+};
 
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+static void inspect_faults (struct intr_frame *);
+static void inspect_launch (struct intr_frame *);
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -45,8 +71,6 @@ exception_init (void) {
 	intr_register_int (0, 0, INTR_ON, kill, "#DE Divide Error");
 	intr_register_int (1, 0, INTR_ON, kill, "#DB Debug Exception");
 	intr_register_int (6, 0, INTR_ON, kill, "#UD Invalid Opcode Exception");
-	intr_register_int (7, 0, INTR_ON, kill,
-			"#NM Device Not Available Exception");
 	intr_register_int (11, 0, INTR_ON, kill, "#NP Segment Not Present");
 	intr_register_int (12, 0, INTR_ON, kill, "#SS Stack Fault Exception");
 	intr_register_int (13, 0, INTR_ON, kill, "#GP General Protection Exception");
@@ -58,12 +82,100 @@ exception_init (void) {
 	   We need to disable interrupts for page faults because the
 	   fault address is stored in CR2 and needs to be preserved. */
 	intr_register_int (14, 0, INTR_OFF, page_fault, "#PF Page-Fault Exception");
+
+	/* Tool for measuring page faults. Calling this function via
+	   int 0x48.
+	   Input:
+	     @RDI - Cause, an enum fault_cause.
+	     @RSI - 0: number of faults,
+	            1: total cycles spent handling them,
+	            2: longest fault, in cycles.
+	   Output:
+	     @RAX - Requested counter, or -1 if RDI or RSI is out of
+	            range. */
+	intr_register_int (0x48, 3, INTR_OFF, inspect_faults,
+			"Inspect Page Faults");
+
+	/* Tool for timing process startup. Calling this function via
+	   int 0x4c.
+	   Input:
+	     @RDI - Point in the caller's last exec(), an enum
+	            launch_stamp.
+	   Output:
+	     @RAX - TSC value at that point, or -1 if RDI is out of
+	            range or the point was not reached. */
+	intr_register_int (0x4c, 3, INTR_OFF, inspect_launch,
+			"Inspect Process Launch");
 }
 
 /* Prints exception statistics. */
 void
 exception_print_stats (void) {
-	printf ("Exception: %lld page faults\n", page_fault_cnt);
+	int i;
+
+	/* The total counts only the faults that were not handled; the
+	   breakdown below also shows those that were. */
+	printf ("Exception: %llu page faults\n", fault_stats[FAULT_INVALID].cnt);
+	for (i = 0; i < FAULT_CAUSE_CNT; i++) {
+		const struct fault_stats *s = &fault_stats[i];
+
+		if (s->cnt != 0)
+			printf ("  %s: %llu, avg %llu cycles, max %llu cycles\n",
+					fault_cause_names[i], s->cnt, s->cycles / s->cnt, s->max);
+	}
+}
+
+/* Accounts for a fault of CAUSE that was taken at TSC value
+   START. */
+static void
+fault_account (enum fault_cause cause, uint64_t start) {
+	uint64_t cycles = rdtsc () - start;
+	struct fault_stats *s = &fault_stats[cause];
+	enum intr_level old_level = intr_disable ();
+
+	s->cnt++;
+	s->cycles += cycles;
+	if (cycles > s->max)
+		s->max = cycles;
+	intr_set_level (old_level);
+	thread_current ()->rusage.ru_faults++;
+}
+
+/* Answers the page fault inspection interrupt. */
+static void
+inspect_faults (struct intr_frame *f) {
+	const struct fault_stats *s;
+
+	if (f->R.rdi >= FAULT_CAUSE_CNT) {
+		f->R.rax = -1;
+		return;
+	}
+	s = &fault_stats[f->R.rdi];
+	switch (f->R.rsi) {
+		case 0:
+			f->R.rax = s->cnt;
+			break;
+		case 1:
+			f->R.rax = s->cycles;
+			break;
+		case 2:
+			f->R.rax = s->max;
+			break;
+		default:
+			f->R.rax = -1;
+			break;
+	}
+}
+
+/* Answers the process launch inspection interrupt. */
+static void
+inspect_launch (struct intr_frame *f) {
+	struct thread *t = thread_current ();
+
+	if (f->R.rdi >= LAUNCH_STAMP_CNT || t->launch[f->R.rdi] == 0)
+		f->R.rax = -1;
+	else
+		f->R.rax = t->launch[f->R.rdi];
 }
 
 /* Handler for an exception (probably) caused by a user process. */
@@ -122,6 +234,10 @@ page_fault (struct intr_frame *f) {
 	bool write;        /* True: access was write, false: access was read. */
 	bool user;         /* True: access by user, false: access by kernel. */
 	void *fault_addr;  /* Fault address. */
+	uint64_t start = rdtsc ();
+#ifdef VM
+	enum fault_cause cause;
+#endif
 
 	/* Obtain faulting address, the virtual address that was
 	   accessed to cause the fault.  It may point to code or to
@@ -129,6 +245,7 @@ page_fault (struct intr_frame *f) {
 	   that caused the fault (that's f->rip). */
 
 	fault_addr = (void *) rcr2();
+	trace (TRACE_FAULT, (uintptr_t) fault_addr, f->error_code);
 
 	/* Turn interrupts back on (they were only off so that we could
 	   be assured of reading CR2 before it changed). */
@@ -139,15 +256,31 @@ page_fault (struct intr_frame *f) {
 	not_present = (f->error_code & PF_P) == 0;
 	write = (f->error_code & PF_W) != 0;
 	user = (f->error_code & PF_U) != 0;
+	if (user)
+		COUNTER_INC (faults_user);
+	else
+		COUNTER_INC (faults_kernel);
 
 #ifdef VM
 	/* For project 3 and later. */
-	if (vm_try_handle_fault (f, fault_addr, user, write, not_present))
+	if (vm_try_handle_fault (f, fault_addr, user, write, not_present,
+				&cause)) {
+		fault_account (cause, start);
+		if (user) {
+			struct thread *t = thread_current ();
+
+			if (t->launch[LAUNCH_ARGS] != 0 && t->launch[LAUNCH_FAULT] == 0)
+				t->launch[LAUNCH_FAULT] = rdtsc ();
+			process_check_exit ();
+		}
 		return;
+	}
 #endif
-
-	/* Count page faults. */
-	page_fault_cnt++;
+	/* A bad user address met while copying to or from user memory:
+	   the copy returns failure to its caller. */
+	if (!user && usercopy_fixup (f))
+		return;
+	fault_account (FAULT_INVALID, start);
 
 	/* If the fault is true fault, show info and exit. */
 	printf ("Page fault at %p: %s error %s page in %s context.\n",
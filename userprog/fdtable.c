@@ -0,0 +1,332 @@
+/* fdtable.c: File descriptor tables.
+ *
+ * The entries of a table live in pages of file pointers, each
+ * allocated when a descriptor it holds is first used, so that a
+ * process that opens a few files pays for one page only and one
+ * that opens thousands does not pay for more than it uses.  A
+ * bitmap records the descriptors in use, and a summary word which
+ * of its words are full, so that the lowest free descriptor is
+ * found with two bit scans.
+ *
+ * Each entry holds a reference to its file from file_dup(), so
+ * descriptors made by dup2() share one open file and its position.
+ * A table copied for fork() gets a duplicate of each distinct file
+ * instead, from file_duplicate(), so that the child moves its own
+ * positions; descriptors that share a file in the parent share its
+ * duplicate in the child.
+ * The threads of a process share its table, so changes to a table
+ * are made under its lock, and the files they let go of are closed
+ * after it is released. */
+
+#include "userprog/fdtable.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdint.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+#define FD_PER_PAGE (PGSIZE / sizeof (struct file *))
+#define FD_PAGES (FD_LIMIT / FD_PER_PAGE)
+#define FD_WORDS (FD_LIMIT / 64)
+
+/* A file descriptor table. */
+struct fd_table {
+	struct file **pages[FD_PAGES];  /* Pages of entries, or null. */
+	uint64_t used[FD_WORDS];        /* Bit FD set if FD is in use. */
+	uint64_t full;                  /* Bit W set if used[W] is full. */
+	struct lock lock;               /* Held over changes, which the
+	                                   threads of a process may make
+	                                   at once. */
+};
+
+/* Returns the bit for FD in its word of a bitmap. */
+static inline uint64_t
+fd_bit (int fd) {
+	return 1ULL << (fd % 64);
+}
+
+/* Returns the entry of T for FD.  If its page does not exist yet,
+ * it is allocated if CREATE is true; otherwise, or if memory is
+ * short, returns a null pointer. */
+static struct file **
+fd_slot (struct fd_table *t, int fd, bool create) {
+	struct file ***page = &t->pages[fd / FD_PER_PAGE];
+
+	if (*page == NULL
+			&& (!create || (*page = palloc_get_page (PAL_ZERO)) == NULL))
+		return NULL;
+	return &(*page)[fd % FD_PER_PAGE];
+}
+
+/* Marks FD in use in T. */
+static void
+fd_mark_used (struct fd_table *t, int fd) {
+	uint64_t *word = &t->used[fd / 64];
+
+	*word |= fd_bit (fd);
+	if (*word == UINT64_MAX)
+		t->full |= 1ULL << (fd / 64);
+}
+
+/* Marks FD free in T. */
+static void
+fd_mark_free (struct fd_table *t, int fd) {
+	t->used[fd / 64] &= ~fd_bit (fd);
+	t->full &= ~(1ULL << (fd / 64));
+}
+
+/* Returns true if FD is a descriptor in use in T. */
+static bool
+fd_in_use (struct fd_table *t, int fd) {
+	return fd >= 0 && fd < FD_LIMIT && (t->used[fd / 64] & fd_bit (fd));
+}
+
+/* Returns another reference to entry FILE. */
+static struct file *
+fd_ref (struct file *file) {
+	return fd_is_console (file) ? file : file_dup (file);
+}
+
+/* Drops the reference of entry FILE. */
+static void
+fd_unref (struct file *file) {
+	if (!fd_is_console (file))
+		file_close (file);
+}
+
+/* A file of a table being copied, and its duplicate in the copy. */
+struct fd_copy {
+	struct hash_elem elem;          /* Element in the copy's map. */
+	struct file *parent;            /* File in the source table. */
+	struct file *child;             /* Its duplicate. */
+};
+
+/* Returns a hash of the source file of copy record E. */
+static uint64_t
+fd_copy_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct fd_copy *c = hash_entry (e, struct fd_copy, elem);
+
+	return hash_u64 ((uintptr_t) c->parent);
+}
+
+/* Returns true if copy record A has a lower source file than B. */
+static bool
+fd_copy_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct fd_copy, elem)->parent
+		< hash_entry (b, struct fd_copy, elem)->parent;
+}
+
+/* Frees copy record E. */
+static void
+fd_copy_free (struct hash_elem *e, void *aux UNUSED) {
+	free (hash_entry (e, struct fd_copy, elem));
+}
+
+/* Returns a reference to the duplicate of FILE in table copy
+ * COPIES, made by file_duplicate() the first time FILE is met, or
+ * a null pointer if memory is short. */
+static struct file *
+fd_copy_file (struct hash *copies, struct file *file) {
+	struct fd_copy key, *c;
+	struct hash_elem *e;
+
+	key.parent = file;
+	e = hash_find (copies, &key.elem);
+	if (e != NULL)
+		return file_dup (hash_entry (e, struct fd_copy, elem)->child);
+	c = malloc (sizeof *c);
+	if (c == NULL)
+		return NULL;
+	c->parent = file;
+	c->child = file_duplicate (file);
+	if (c->child == NULL) {
+		free (c);
+		return NULL;
+	}
+	hash_insert (copies, &c->elem);
+	return c->child;
+}
+
+/* Returns a new table with only the console's descriptors, or a
+ * null pointer if memory is short. */
+struct fd_table *
+fd_table_create (void) {
+	struct fd_table *t = calloc (1, sizeof *t);
+
+	if (t != NULL) {
+		if (fd_slot (t, 0, true) == NULL) {
+			free (t);
+			return NULL;
+		}
+		lock_init (&t->lock);
+		*fd_slot (t, 0, false) = FD_STDIN;
+		*fd_slot (t, 1, false) = FD_STDOUT;
+		fd_mark_used (t, 0);
+		fd_mark_used (t, 1);
+	}
+	return t;
+}
+
+/* Makes DST, a new table, have the descriptors of SRC, each with a
+ * duplicate of its file that has a position of its own.  The
+ * descriptors of SRC that share a file share one duplicate.  Only
+ * the descriptors in use are visited.  Returns false if memory is
+ * short. */
+bool
+fd_table_copy (struct fd_table *dst, struct fd_table *src) {
+	struct hash copies;
+	bool success = true;
+
+	if (!hash_init (&copies, fd_copy_hash, fd_copy_less, NULL))
+		return false;
+	lock_acquire (&src->lock);
+	for (int w = 0; w < FD_WORDS && success; w++) {
+		/* Drop what DST has and SRC no longer does, such as a
+		 * console descriptor. */
+		uint64_t bits = dst->used[w] & ~src->used[w];
+
+		while (bits != 0) {
+			fd_close (dst, w * 64 + __builtin_ctzll (bits));
+			bits &= bits - 1;
+		}
+
+		for (bits = src->used[w]; bits != 0; bits &= bits - 1) {
+			int fd = w * 64 + __builtin_ctzll (bits);
+			struct file **slot = fd_slot (dst, fd, true);
+			struct file *file = *fd_slot (src, fd, false);
+
+			if (slot != NULL && !fd_is_console (file))
+				file = fd_copy_file (&copies, file);
+			if (slot == NULL || file == NULL) {
+				success = false;
+				break;
+			}
+			if (fd_in_use (dst, fd))
+				fd_unref (*slot);
+			*slot = file;
+			fd_mark_used (dst, fd);
+		}
+	}
+	lock_release (&src->lock);
+	hash_destroy (&copies, fd_copy_free);
+	return success;
+}
+
+/* Closes the descriptors of T and frees it.  T may be null. */
+void
+fd_table_destroy (struct fd_table *t) {
+	if (t == NULL)
+		return;
+	for (int w = 0; w < FD_WORDS; w++) {
+		uint64_t bits = t->used[w];
+
+		while (bits != 0) {
+			int fd = w * 64 + __builtin_ctzll (bits);
+
+			bits &= bits - 1;
+			fd_unref (*fd_slot (t, fd, false));
+		}
+	}
+	for (size_t i = 0; i < FD_PAGES; i++)
+		palloc_free_page (t->pages[i]);
+	free (t);
+}
+
+/* Opens FILE in T under the lowest free descriptor and returns
+ * it, or -1 if T is full or memory is short.  T takes over the
+ * caller's reference to FILE. */
+int
+fd_alloc (struct fd_table *t, struct file *file) {
+	struct file **slot;
+	int w, fd = -1;
+
+	lock_acquire (&t->lock);
+	if (t->full != UINT64_MAX) {
+		w = __builtin_ctzll (~t->full);
+		fd = w * 64 + __builtin_ctzll (~t->used[w]);
+		slot = fd_slot (t, fd, true);
+		if (slot != NULL) {
+			*slot = file;
+			fd_mark_used (t, fd);
+		} else
+			fd = -1;
+	}
+	lock_release (&t->lock);
+	return fd;
+}
+
+/* Returns the entry of T for FD, which is a file or one of the
+ * console's stand-ins, or a null pointer if FD is not in use. */
+struct file *
+fd_get (struct fd_table *t, int fd) {
+	return fd_in_use (t, fd) ? *fd_slot (t, fd, false) : NULL;
+}
+
+/* Like fd_get(), but a file comes with a reference of its own from
+ * file_dup(), which the caller must close, so that it stays open
+ * even if another thread closes FD. */
+struct file *
+fd_get_dup (struct fd_table *t, int fd) {
+	struct file *file;
+
+	lock_acquire (&t->lock);
+	file = fd_get (t, fd);
+	if (file != NULL)
+		fd_ref (file);
+	lock_release (&t->lock);
+	return file;
+}
+
+/* Closes descriptor FD of T.  Returns false if FD was not in
+ * use. */
+bool
+fd_close (struct fd_table *t, int fd) {
+	struct file *file;
+	struct file **slot;
+
+	lock_acquire (&t->lock);
+	if (!fd_in_use (t, fd)) {
+		lock_release (&t->lock);
+		return false;
+	}
+	slot = fd_slot (t, fd, false);
+	file = *slot;
+	*slot = NULL;
+	fd_mark_free (t, fd);
+	lock_release (&t->lock);
+	fd_unref (file);
+	return true;
+}
+
+/* Makes NEWFD in T refer to what OLDFD does, first closing NEWFD
+ * if it is in use, and returns NEWFD.  Returns -1 if OLDFD is not
+ * in use, NEWFD is out of range, or memory is short. */
+int
+fd_dup2 (struct fd_table *t, int oldfd, int newfd) {
+	struct file *file, *old = NULL;
+	struct file **slot;
+
+	if (newfd < 0 || newfd >= FD_LIMIT)
+		return -1;
+	lock_acquire (&t->lock);
+	file = fd_get (t, oldfd);
+	if (file == NULL || (oldfd != newfd
+				&& (slot = fd_slot (t, newfd, true)) == NULL)) {
+		lock_release (&t->lock);
+		return -1;
+	}
+	if (oldfd != newfd) {
+		if (fd_in_use (t, newfd))
+			old = *slot;
+		*slot = fd_ref (file);
+		fd_mark_used (t, newfd);
+	}
+	lock_release (&t->lock);
+	if (old != NULL)
+		fd_unref (old);
+	return newfd;
+}
@@ -0,0 +1,156 @@
+/* futex.c: Waiting on words of user memory.
+ *
+ * A futex is an int in user memory that user code takes and
+ * releases with atomic instructions alone while it is uncontended.
+ * A thread that finds it taken sleeps with futex_wait(), which
+ * checks under FUTEX_LOCK that the word still holds the value the
+ * thread saw, so that a release in between is not missed, and the
+ * thread releasing it wakes the sleepers with futex_wake().
+ *
+ * Waiters are keyed on the kernel address of the word, which every
+ * process mapping its frame shares, so a futex in MAP_SHARED memory
+ * works across processes as well as between the threads of one.  A
+ * waiter keeps the frame pinned, so that it is neither evicted nor
+ * moved and the key stays valid until the waiter is woken. */
+
+#include "userprog/futex.h"
+#include <list.h>
+#include <stdint.h>
+#include "threads/lock-stats.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/usercopy.h"
+
+/* Number of lists the waiters are hashed into. */
+#define FUTEX_BUCKETS 64
+
+/* A thread waiting on a futex. */
+struct futex_waiter {
+	struct list_elem elem;      /* Element in its bucket. */
+	int *key;                   /* Kernel address of the word. */
+	struct thread *proc;        /* Process of the thread. */
+	struct semaphore sema;      /* Upped to wake the thread. */
+};
+
+/* Waiters, by hash of their key. */
+static struct list buckets[FUTEX_BUCKETS];
+
+/* Protects the buckets, and orders checks of a futex's value with
+ * the wake-ups after it is changed. */
+static struct lock futex_lock;
+
+/* Initializes the futex waiter table. */
+void
+futex_init (void) {
+	size_t i;
+
+	for (i = 0; i < FUTEX_BUCKETS; i++)
+		list_init (&buckets[i]);
+	lock_init (&futex_lock);
+	lock_set_name (&futex_lock, "futex");
+}
+
+/* Returns the bucket of waiters on KEY. */
+static struct list *
+bucket (const int *key) {
+	return &buckets[((uintptr_t) key >> 2) % FUTEX_BUCKETS];
+}
+
+/* Returns the kernel address of the futex at user address UADDR
+ * of the current process, which stays the same until futex_unpin()
+ * with *PIN, or a null pointer if UADDR is not an aligned word of
+ * writable memory. */
+static int *
+futex_pin (int *uaddr, void **pin) {
+	if ((uintptr_t) uaddr % sizeof *uaddr != 0)
+		return NULL;
+	return pin_user_page (uaddr, pin);
+}
+
+/* Drops the hold of futex_pin() through PIN. */
+static void
+futex_unpin (void *pin) {
+	unpin_user_page (pin);
+}
+
+/* Sleeps on the futex at UADDR until woken, if it holds VAL.
+ * Returns 0 once woken, or -1 if UADDR is bad, the futex does not
+ * hold VAL, or the process is exiting. */
+int
+futex_wait (int *uaddr, int val) {
+	struct futex_waiter w;
+	void *pin;
+
+	w.key = futex_pin (uaddr, &pin);
+	if (w.key == NULL)
+		return -1;
+	w.proc = thread_current ()->proc;
+	sema_init (&w.sema, 0);
+
+	lock_acquire (&futex_lock);
+	if (__atomic_load_n (w.key, __ATOMIC_SEQ_CST) != val || w.proc->exiting) {
+		lock_release (&futex_lock);
+		futex_unpin (pin);
+		return -1;
+	}
+	list_push_back (bucket (w.key), &w.elem);
+	lock_release (&futex_lock);
+
+	/* A wake-up may come before this, and is not lost. */
+	sema_down (&w.sema);
+	futex_unpin (pin);
+	return 0;
+}
+
+/* Wakes up to CNT threads sleeping on the futex at UADDR, oldest
+ * first, and returns how many, or -1 if UADDR is bad. */
+int
+futex_wake (int *uaddr, int cnt) {
+	struct list *list;
+	struct list_elem *e;
+	void *pin;
+	int *key = futex_pin (uaddr, &pin);
+	int woken = 0;
+
+	if (key == NULL)
+		return -1;
+	list = bucket (key);
+
+	lock_acquire (&futex_lock);
+	for (e = list_begin (list); e != list_end (list) && woken < cnt; ) {
+		struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+
+		e = list_next (e);
+		if (w->key == key) {
+			list_remove (&w->elem);
+			sema_up (&w->sema);
+			woken++;
+		}
+	}
+	lock_release (&futex_lock);
+	futex_unpin (pin);
+	return woken;
+}
+
+/* Wakes every thread of process PROC sleeping on a futex, so that
+ * it notices that PROC is exiting. */
+void
+futex_wake_process (struct thread *proc) {
+	size_t i;
+
+	lock_acquire (&futex_lock);
+	for (i = 0; i < FUTEX_BUCKETS; i++) {
+		struct list_elem *e;
+
+		for (e = list_begin (&buckets[i]); e != list_end (&buckets[i]); ) {
+			struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+
+			e = list_next (e);
+			if (w->proc == proc) {
+				list_remove (&w->elem);
+				sema_up (&w->sema);
+			}
+		}
+	}
+	lock_release (&futex_lock);
+}
@@ -0,0 +1,387 @@
+/* ioring.c: Asynchronous file operations through shared rings.
+ *
+ * io_setup() maps a page holding a submission and a completion ring
+ * (see lib/ioring.h) into the process.  io_enter() takes what the
+ * process queued in the first, checks each operation and copies or
+ * pins what it needs from user memory while the process is still
+ * current, and queues it for one of IORING_WORKER_CNT kernel
+ * threads.  The worker runs it and posts its completion through
+ * the page's kernel address, while the process goes on running.
+ *
+ * A read lands straight in the process's pages, which stay pinned
+ * with pin_user_page() until it completes, so that they are not
+ * evicted under the worker.  Each request holds a reference of its
+ * own to its file, so closing the descriptor does not pull the file
+ * from under a worker.  A process waits for its requests before it
+ * exits, execs or forks, so that no request outlives the files and
+ * memory it uses and no child shares a page a read still fills. */
+
+#include "userprog/ioring.h"
+#include <ioring.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/lock-stats.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/fdtable.h"
+#include "userprog/usercopy.h"
+
+/* Number of worker threads. */
+#define IORING_WORKER_CNT 4
+
+/* Most pages a read may span. */
+#define MAX_PAGES (IORING_MAX_LEN / PGSIZE + 1)
+
+/* A process's rings. */
+struct ioring {
+	struct io_ring *ring;           /* The shared page, by kernel address. */
+	uint32_t sq_head;               /* The indexes the kernel advances, */
+	uint32_t cq_tail;               /* as it last set them. */
+	unsigned inflight;              /* Operations taken, not completed. */
+	struct lock submit_lock;        /* Serializes io_enter()s, for SQ_HEAD. */
+	struct lock lock;               /* Guards CQ_TAIL, INFLIGHT and CQ. */
+	struct condition done;          /* Signaled on each completion. */
+};
+
+/* An operation taken from a submission ring. */
+struct io_request {
+	struct list_elem elem;          /* Element in PENDING. */
+	struct ioring *ring;            /* Ring to complete it into. */
+	struct thread *proc;            /* Process, for OPEN's descriptor. */
+	struct io_sqe sqe;              /* The operation. */
+	struct file *file;              /* Reference to its file, or null. */
+	void *data;                     /* Copy of WRITE's data, or null. */
+	char *name;                     /* Copy of OPEN's name, or null. */
+	size_t page_cnt;                /* Pages of a read pinned. */
+	uint8_t *kpages[MAX_PAGES];     /* Their kernel addresses. */
+	void *pins[MAX_PAGES];          /* Their pins. */
+};
+
+/* Requests waiting for a worker, oldest first. */
+static struct list pending;
+
+/* Guards PENDING, and the setting up of rings. */
+static struct lock pending_lock;
+
+/* Counts the requests in PENDING. */
+static struct semaphore pending_sema;
+
+static thread_func ioring_worker;
+
+/* Starts the worker threads. */
+void
+ioring_init (void) {
+	int i;
+
+	list_init (&pending);
+	lock_init (&pending_lock);
+	lock_set_name (&pending_lock, "ioring");
+	sema_init (&pending_sema, 0);
+	for (i = 0; i < IORING_WORKER_CNT; i++) {
+		char name[16];
+
+		snprintf (name, sizeof name, "ioring%d", i);
+		if (thread_create (name, PRI_DEFAULT, ioring_worker, NULL)
+				== TID_ERROR)
+			PANIC ("cannot start %s", name);
+	}
+}
+
+/* Maps the rings of process PROC at IORING_BASE, unless it has them
+ * already, and returns that address, or a null pointer if memory is
+ * short. */
+void *
+ioring_setup (struct thread *proc) {
+	void *result = (void *) IORING_BASE;
+
+	lock_acquire (&pending_lock);
+	if (proc->ioring == NULL) {
+		struct ioring *r = malloc (sizeof *r);
+
+		if (r != NULL && (r->ring = palloc_get_page (PAL_ZERO)) != NULL
+				&& pml4_set_page (proc->pml4, (void *) IORING_BASE, r->ring,
+					true)) {
+			r->sq_head = r->cq_tail = 0;
+			r->inflight = 0;
+			lock_init (&r->submit_lock);
+			lock_init (&r->lock);
+			cond_init (&r->done);
+			proc->ioring = r;
+		} else {
+			if (r != NULL)
+				palloc_free_page (r->ring);
+			free (r);
+			result = NULL;
+		}
+	}
+	lock_release (&pending_lock);
+	return result;
+}
+
+/* Takes a free completion slot of R for an operation.  Returns
+ * false if there is none, or the process has moved CQ_HEAD where
+ * it cannot be. */
+static bool
+ring_reserve (struct ioring *r) {
+	uint32_t unreaped;
+	bool ok;
+
+	lock_acquire (&r->lock);
+	unreaped = r->cq_tail - __atomic_load_n (&r->ring->cq_head,
+			__ATOMIC_ACQUIRE);
+	ok = unreaped <= IORING_ENTRIES
+		&& unreaped + r->inflight < IORING_ENTRIES;
+	if (ok)
+		r->inflight++;
+	lock_release (&r->lock);
+	return ok;
+}
+
+/* Posts the completion of an operation of R that ring_reserve()
+ * made room for. */
+static void
+ring_complete (struct ioring *r, uint64_t user_data, int32_t res) {
+	struct io_cqe *cqe;
+
+	lock_acquire (&r->lock);
+	cqe = &r->ring->cq[r->cq_tail % IORING_ENTRIES];
+	cqe->user_data = user_data;
+	cqe->res = res;
+	__atomic_store_n (&r->ring->cq_tail, ++r->cq_tail, __ATOMIC_RELEASE);
+	r->inflight--;
+	cond_broadcast (&r->done, &r->lock);
+	lock_release (&r->lock);
+}
+
+/* Checks the operation of REQ, and copies or pins what it needs
+ * from the current process, which submitted it.  Returns false if
+ * it is bad. */
+static bool
+request_prepare (struct io_request *req) {
+	const struct io_sqe *sqe = &req->sqe;
+	uint8_t *uaddr = (uint8_t *) sqe->addr;
+	uint8_t *upage;
+
+	if (sqe->op == IO_OPEN) {
+		req->name = palloc_get_page (0);
+		return req->name != NULL
+			&& copy_str_from_user (req->name, (const char *) uaddr, PGSIZE);
+	}
+	if (sqe->op > IO_OPEN)
+		return false;
+
+	/* Workers must not block on the console or a pipe. */
+	req->file = fd_get_dup (req->proc->fd_table, sqe->fd);
+	if (fd_is_console (req->file)) {
+		req->file = NULL;
+		return false;
+	}
+	if (req->file == NULL || file_get_inode (req->file) == NULL)
+		return false;
+	if (sqe->op == IO_FSYNC)
+		return true;
+
+	if (sqe->len > IORING_MAX_LEN || !is_user_range (uaddr, sqe->len)
+			|| ((sqe->op == IO_PREAD || sqe->op == IO_PWRITE)
+				&& sqe->offset < 0))
+		return false;
+	if (sqe->op == IO_WRITE || sqe->op == IO_PWRITE) {
+		req->data = malloc (sqe->len > 0 ? sqe->len : 1);
+		return req->data != NULL
+			&& copy_from_user (req->data, uaddr, sqe->len);
+	}
+
+	for (upage = pg_round_down (uaddr); upage < uaddr + sqe->len;
+			upage += PGSIZE) {
+		void *kpage = pin_user_page (upage, &req->pins[req->page_cnt]);
+
+		if (kpage == NULL)
+			return false;
+		req->kpages[req->page_cnt++] = kpage;
+
+		/* The worker writes it through the kernel's mapping, which
+		 * write-back of a file mapping does not look at. */
+		pml4_set_dirty (thread_current ()->pml4, upage, true);
+	}
+	return true;
+}
+
+/* Releases what REQ holds, and REQ itself. */
+static void
+request_free (struct io_request *req) {
+	size_t i;
+
+	for (i = 0; i < req->page_cnt; i++)
+		unpin_user_page (req->pins[i]);
+	file_close (req->file);
+	free (req->data);
+	palloc_free_page (req->name);
+	free (req);
+}
+
+/* Runs READ or PREAD REQ into its pinned pages. */
+static int32_t
+request_read (struct io_request *req) {
+	const struct io_sqe *sqe = &req->sqe;
+	size_t ofs = pg_ofs (sqe->addr), done = 0, i;
+
+	for (i = 0; i < req->page_cnt && done < sqe->len; i++) {
+		size_t chunk = PGSIZE - ofs < sqe->len - done
+			? PGSIZE - ofs : sqe->len - done;
+		uint8_t *kaddr = req->kpages[i] + ofs;
+		off_t n;
+
+		n = sqe->op == IO_READ
+			? file_read (req->file, kaddr, chunk)
+			: file_read_at (req->file, kaddr, chunk, sqe->offset + done);
+		done += n;
+		if ((size_t) n < chunk)
+			break;
+		ofs = 0;
+	}
+	return done;
+}
+
+/* Runs REQ and returns its result. */
+static int32_t
+request_run (struct io_request *req) {
+	const struct io_sqe *sqe = &req->sqe;
+	struct file *file;
+	int fd;
+
+	switch (sqe->op) {
+		case IO_WRITE:
+			return file_write (req->file, req->data, sqe->len);
+		case IO_PWRITE:
+			return file_write_at (req->file, req->data, sqe->len,
+					sqe->offset);
+		case IO_FSYNC:
+			filesys_sync ();
+			return 0;
+		case IO_OPEN:
+			file = filesys_open (req->name);
+			if (file == NULL)
+				return -1;
+			fd = fd_alloc (req->proc->fd_table, file);
+			if (fd < 0)
+				file_close (file);
+			return fd;
+		default:
+			return request_read (req);
+	}
+}
+
+/* Worker thread: runs pending requests forever. */
+static void
+ioring_worker (void *aux UNUSED) {
+	for (;;) {
+		struct io_request *req;
+		struct ioring *r;
+		uint64_t user_data;
+		int32_t res;
+
+		sema_down (&pending_sema);
+		lock_acquire (&pending_lock);
+		req = list_entry (list_pop_front (&pending), struct io_request, elem);
+		lock_release (&pending_lock);
+
+		res = request_run (req);
+		r = req->ring;
+		user_data = req->sqe.user_data;
+		request_free (req);
+		ring_complete (r, user_data, res);
+	}
+}
+
+/* Takes up to TO_SUBMIT operations from the submission ring of
+ * process PROC and starts them, then waits until the completion
+ * ring holds at least MIN_COMPLETE completions or nothing is left
+ * in flight.  Bad operations complete at once with -1.  Returns the
+ * number of operations taken, or -1 if PROC has no rings. */
+int
+ioring_enter (struct thread *proc, unsigned to_submit,
+		unsigned min_complete) {
+	struct ioring *r = proc->ioring;
+	struct io_ring *ring;
+	unsigned submitted = 0;
+
+	if (r == NULL)
+		return -1;
+	ring = r->ring;
+
+	lock_acquire (&r->submit_lock);
+	while (submitted < to_submit
+			&& r->sq_head != __atomic_load_n (&ring->sq_tail, __ATOMIC_ACQUIRE)
+			&& ring_reserve (r)) {
+		struct io_sqe sqe = ring->sq[r->sq_head % IORING_ENTRIES];
+		struct io_request *req;
+
+		__atomic_store_n (&ring->sq_head, ++r->sq_head, __ATOMIC_RELEASE);
+		submitted++;
+
+		req = calloc (1, sizeof *req);
+		if (req == NULL) {
+			ring_complete (r, sqe.user_data, -1);
+			continue;
+		}
+		req->ring = r;
+		req->proc = proc;
+		req->sqe = sqe;
+		if (!request_prepare (req)) {
+			request_free (req);
+			ring_complete (r, sqe.user_data, -1);
+			continue;
+		}
+
+		lock_acquire (&pending_lock);
+		list_push_back (&pending, &req->elem);
+		lock_release (&pending_lock);
+		sema_up (&pending_sema);
+	}
+	lock_release (&r->submit_lock);
+
+	lock_acquire (&r->lock);
+	while (r->inflight > 0
+			&& r->cq_tail - __atomic_load_n (&ring->cq_head, __ATOMIC_ACQUIRE)
+				< min_complete)
+		cond_wait (&r->done, &r->lock);
+	lock_release (&r->lock);
+	return submitted;
+}
+
+/* Waits until no operation of process PROC is in flight. */
+void
+ioring_drain (struct thread *proc) {
+	struct ioring *r = proc->ioring;
+
+	if (r == NULL)
+		return;
+	lock_acquire (&r->lock);
+	while (r->inflight > 0)
+		cond_wait (&r->done, &r->lock);
+	lock_release (&r->lock);
+}
+
+/* Waits for the operations of process PROC in flight, then unmaps
+ * and frees its rings. */
+void
+ioring_destroy (struct thread *proc) {
+	struct ioring *r = proc->ioring;
+
+	if (r == NULL)
+		return;
+	ioring_drain (proc);
+	if (proc->pml4 != NULL)
+		pml4_clear_page (proc->pml4, (void *) IORING_BASE);
+	palloc_free_page (r->ring);
+	free (r);
+	proc->ioring = NULL;
+}
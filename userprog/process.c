@@ -2,52 +2,151 @@
 #include "userprog/syscall.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <vdso.h>
+#include "userprog/fdtable.h"
+#include "userprog/futex.h"
 #include "userprog/gdt.h"
+#include "userprog/ioring.h"
+#include "userprog/reaper.h"
 #include "userprog/tss.h"
+#include "userprog/usercopy.h"
+#include "userprog/vdso.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/lock-stats.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #include "threads/synch.h"
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
 #include "intrinsic.h"
 #ifdef VM
+#include "vm/prefetch.h"
 #include "vm/vm.h"
 #endif
 
-static void process_cleanup (void);
+static void process_cleanup (bool exiting);
 static bool load (const char *file_name, struct intr_frame *if_);
 static void initd (void **args);
 static void __do_fork (void **);
+static void spawnd (void *);
+#ifdef VM
+static void clone_start (void *);
+#endif
+static void leave_process (void);
+static bool process_load (char *file_name, struct intr_frame *if_);
+static bool parse_argument (const char *cmd_line, struct intr_frame *if_);
+static bool load_image (struct file *, const char *name,
+		struct intr_frame *if_);
+static bool zygote_clone (struct file *, struct intr_frame *if_);
+
+/* Cache of struct child. */
+static struct kmem_cache *child_cache;
+
+/* Protects the cache of parsed executables. */
+static struct lock elf_cache_lock;
+
+/* Protects the table of zygotes. */
+static struct lock zygote_lock;
+
+/* Returns a hash of the tid of child record C. */
+static uint64_t
+child_hash (const struct hash_elem *c_, void *aux UNUSED) {
+	const struct child *c = hash_entry (c_, struct child, elem);
+
+	return hash_u64 (c->tid);
+}
+
+/* Returns true if child record A has a lower tid than B. */
+static bool
+child_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	return hash_entry (a_, struct child, elem)->tid
+		< hash_entry (b_, struct child, elem)->tid;
+}
+
+/* Adds the usage in B to A. */
+static void
+rusage_add (struct rusage *a, const struct rusage *b) {
+	a->ru_ticks += b->ru_ticks;
+	a->ru_faults += b->ru_faults;
+	a->ru_swapins += b->ru_swapins;
+	a->ru_inblock += b->ru_inblock;
+	a->ru_oublock += b->ru_oublock;
+	a->ru_nvcsw += b->ru_nvcsw;
+	a->ru_nivcsw += b->ru_nivcsw;
+}
+
+/* Gives PARENT a record of CHILD, the current thread, through
+ * which CHILD reports its exit status and PARENT waits for it. */
+void
+process_add_child (struct thread *parent, struct thread *child) {
+	struct child *record = kmem_cache_alloc (child_cache);
+
+	if (record == NULL)
+		PANIC ("child record: out of memory");
+	child->sorry_mama = record;
+
+	record->self_thread = child;
+	record->tid = child->tid;
+	memset (&record->rusage, 0, sizeof record->rusage);
+	sema_init (&record->sema, 0);
+	hash_insert (&parent->children, &record->elem);
+}
+
+/* Lets the child of record E, which is being freed, outlive its
+ * parent.  Interrupts must be off. */
+static void
+orphan_child (struct hash_elem *e, void *aux UNUSED) {
+	struct child *child = hash_entry (e, struct child, elem);
+
+	if (child->sema.value == 0)		// child is still alive
+		child->self_thread->sorry_mama = NULL;
+	kmem_cache_free (child_cache, child);
+}
+
+/* Sets up the state that all processes share.  Called once at boot,
+ * before the file system, which may drop cached executables. */
+void
+process_subsystem_init (void) {
+	child_cache = kmem_cache_create ("child", sizeof (struct child), 0, NULL);
+	if (child_cache == NULL)
+		PANIC ("child cache creation failed");
+	lock_init (&elf_cache_lock);
+	lock_set_name (&elf_cache_lock, "elf cache");
+	lock_init (&zygote_lock);
+	lock_set_name (&zygote_lock, "zygote");
+}
 
 /* General process initializer for initd and other process. */
 static void
 process_init (void) {
 	struct thread *current = thread_current ();
 
-	/* initialize fd_table */
-	intptr_t *fd_table = current->fd_table;
-	char i = 0;
-	while(i < FD_MAX) {	// 0 ~ FD_MAX (FD_MAX개)
-		fd_table[i++] = 0;
-	}
-	current->fd_count = 2;	// 0 (STDIN_FILENO), 1 (STDOUT_FILENO)
+	/* initialize fd_table, 0 (STDIN_FILENO), 1 (STDOUT_FILENO) */
+	current->fd_table = fd_table_create ();
+	if (current->fd_table == NULL)
+		PANIC ("fd table: out of memory");
 
 	/* initialize for deny write on executables */
-	current->running_executable = 0;  // NULL
+	current->running_executable = NULL;
 
 	/* initialize parent-child relationship */
 	current->sorry_mama = 0;  // NULL
-	list_init(&current->child_list);
+	if (!hash_init (&current->children, child_hash, child_less, NULL))
+		PANIC ("children table: out of memory");
 }
 
 /* Starts the first userland program, called "initd", loaded from FILE_NAME.
@@ -105,16 +204,11 @@ initd (void **args) {
 	struct semaphore *first_userprog_started = args[2];
 
 	/* main_thread does not call process_init().
-	 * Therefore, explicitly initialize child_list */
-	list_init(&main_thread->child_list);
+	 * Therefore, explicitly initialize its children */
+	if (!hash_init (&main_thread->children, child_hash, child_less, NULL))
+		PANIC ("children table: out of memory");
 
-	struct child *child = malloc(sizeof(struct child));
-	current->sorry_mama = child;
-
-	child->self_thread = current;
-	child->tid = current->tid;
-	sema_init(&child->sema, 0);
-	list_push_back(&main_thread->child_list, &child->elem);
+	process_add_child (main_thread, current);
 	sema_up(first_userprog_started);
 
 	if (process_exec (f_name) < 0)
@@ -128,10 +222,14 @@ tid_t
 process_fork (const char *name, struct intr_frame *if_ UNUSED) {
 	/* Clone current thread to new thread.*/
 	struct semaphore duplicate_done;
-	uintptr_t args[3] = { thread_current(), if_, &duplicate_done };
+	uintptr_t args[3] = { thread_current ()->proc, if_, &duplicate_done };
 	tid_t tid;
 	
 	sema_init(&duplicate_done, 0);
+	/* No read in flight may fill a page the child would share. */
+	ioring_drain (thread_current ()->proc);
+	/* Nor may memory of exited processes still wait to be freed. */
+	reaper_drain ();
 	tid = thread_create (name, PRI_DEFAULT, __do_fork, args);
 
 	if (tid != TID_ERROR)
@@ -143,66 +241,38 @@ process_fork (const char *name, struct intr_frame *if_ UNUSED) {
 
 #ifndef VM
 /* Duplicate the parent's address space by passing this function to the
- * pml4_for_each. This is only for the project 2. */
+ * pml4_clone, which calls it for each user page of the parent and puts
+ * *DST_PTE into the child's page table. This is only for the project 2. */
 static bool
-duplicate_pte (uint64_t *pte, void *va, void *aux) {
-	struct thread *current = thread_current ();
-	struct thread *parent = (struct thread *) aux;
+duplicate_pte (uint64_t *pte, uint64_t *dst_pte, void *va UNUSED,
+		void *aux UNUSED) {
 	void *parent_page;
 	void *newpage;
-	bool writable;
-
-	/* 1. TODO: If the parent_page is kernel page, then return immediately. */
-	if (is_kern_pte(pte))
-		return true;
 
-	/* 2. Resolve VA from the parent's page map level 4. */
-	parent_page = pml4_get_page (parent->pml4, va);
+	/* 1. Resolve the parent's page from its PTE. */
+	parent_page = ptov (PTE_ADDR (*pte));
 
-	/* 3. TODO: Allocate new PAL_USER page for the child and set result to
-	 *    TODO: NEWPAGE. */
-	newpage = palloc_get_page(PAL_USER | PAL_ZERO);
-
-	/* 4. TODO: Duplicate parent's page to the new page and
-	 *    TODO: check whether parent's page is writable or not (set WRITABLE
-	 *    TODO: according to the result). */
-	memcpy(newpage, parent_page, PGSIZE);
-	writable = is_writable(pte);
-
-	/* 5. Add new page to child's page table at address VA with WRITABLE
-	 *    permission. */
-	if (!pml4_set_page (current->pml4, va, newpage, writable)) {
-		/* 6. TODO: if fail to insert page, do error handling. */
+	/* 2. Allocate new PAL_USER page for the child. */
+	newpage = palloc_get_page (PAL_USER);
+	if (newpage == NULL)
 		return false;
-	}
+
+	/* 3. Duplicate parent's page to the new page, with the same
+	 *    permissions. */
+	copy_page (newpage, parent_page);
+	*dst_pte = vtop (newpage) | (*pte & (PTE_U | PTE_W | PTE_P));
 	return true;
 }
 #endif
 
 /* Duplicate the parent's open files to current.
  * Some of members should not be duplicated here (i.e. pml4, tf ...).
- * Note : I'm not sure that this code should have wrapped by `#ifndef VM`. */
+ * Pipe ends are duplicated like files, so a forked child shares
+ * its parent's pipes. */
 static bool
 duplicate_open_files(struct thread *current, struct thread *parent) {
-
-#ifdef VM
-	/* Implement maybe AFTER Project 3 */
-	/* What's AFTER LIKE? */
-#else
 	/* Duplicate files in fd_table. */
-	int i;
-	for (i = 0; i < FD_MAX; i++) {
-		if (parent->fd_table[i] == NULL)
-			continue;
-		current->fd_table[i] = file_duplicate(parent->fd_table[i]);
-	}
-	current->fd_count = parent->fd_count;
-
-	/* Duplicate running_executable file */
-	current->running_executable = file_duplicate(parent->running_executable);
-	
-#endif
-
+	return fd_table_copy (current->fd_table, parent->fd_table);
 }
 
 
@@ -225,17 +295,23 @@ __do_fork (void **aux) {
 
 	/* 2. Duplicate PT */
 	current->pml4 = pml4_create();
-	if (current->pml4 == NULL)
+	if (current->pml4 == NULL || !vdso_map (current->pml4, current->tid))
 		goto error;
 
 	process_activate (current);
 
 #ifdef VM
 	supplemental_page_table_init (&current->spt);
-	if (!supplemental_page_table_copy (&current->spt, &parent->spt))
+	lock_acquire (&parent->spt.lock);
+	if (!supplemental_page_table_copy (&current->spt, &parent->spt)) {
+		lock_release (&parent->spt.lock);
 		goto error;
+	}
+	lock_release (&parent->spt.lock);
 #else
-	if (!pml4_for_each (parent->pml4, duplicate_pte, parent))
+	/* Up to the vDSO, which vdso_map() has given the child. */
+	if (!pml4_clone (current->pml4, parent->pml4, NULL, (void *) VDSO_BASE,
+				duplicate_pte, NULL))
 		goto error;
 #endif
 
@@ -246,18 +322,19 @@ __do_fork (void **aux) {
 	 * TODO:       the resources of parent.*/
 	
 	/* 3. Duplicate thread. (with files) */
-	lock_acquire(&filesys_lock);
-	duplicate_open_files (current, parent);  //fd_table, running_executable
-	lock_release(&filesys_lock);
+	if (!duplicate_open_files (current, parent))  //fd_table
+		goto error;
 
-	/* 4. set parent-child relationship */
-	struct child *child = malloc(sizeof(struct child));
-	current->sorry_mama = child;
+	/* Duplicate running_executable file */
+	if (parent->running_executable != NULL) {
+		current->running_executable =
+			file_duplicate (parent->running_executable);
+		if (current->running_executable == NULL)
+			goto error;
+	}
 
-	child->self_thread = thread_current();
-	child->tid = thread_current()->tid;
-	sema_init(&child->sema, 0);
-	list_push_back(&parent->child_list, &child->elem);
+	/* 4. set parent-child relationship */
+	process_add_child (parent, current);
 	sema_up(duplicate_done);	// waking up parent
 								// 자식이(현재 스레드가) 부모 스레드의 커널 스택에 있는 정보들을
 								// 다 이용했기 때문에, 부모가 일어나서(wake up) fork handler 함수를
@@ -273,35 +350,116 @@ error:
 	thread_exit ();
 }
 
+/* Starts a new process running CMD_LINE, a page that is freed
+ * here, as a child of the current one, without first copying the
+ * current process as fork() and exec() would.  The child gets
+ * duplicates of the current process's open files, as after fork().
+ * Returns the new process's thread id once it is loaded, or
+ * TID_ERROR if the thread cannot be created, the open files cannot
+ * be duplicated or the program cannot be loaded. */
+tid_t
+process_spawn (char *cmd_line) {
+	struct semaphore loaded;
+	bool success = false;
+	void *args[4] = { thread_current ()->proc, cmd_line, &loaded, &success };
+	char name[sizeof thread_current ()->name];
+	tid_t tid;
+
+	strlcpy (name, cmd_line, sizeof name);
+	name[strcspn (name, " ")] = '\0';
+
+	sema_init (&loaded, 0);
+	tid = thread_create (name, PRI_DEFAULT, spawnd, args);
+	if (tid == TID_ERROR) {
+		palloc_free_page (cmd_line);
+		return TID_ERROR;
+	}
+	sema_down (&loaded);
+
+	if (!success) {
+		/* Reap the child, which is exiting. */
+		process_wait (tid);
+		return TID_ERROR;
+	}
+	return tid;
+}
+
+/* A thread function that loads a spawned process. */
+static void
+spawnd (void *aux_) {
+	void **aux = aux_;
+	struct thread *current = thread_current ();
+	struct thread *parent = aux[0];
+	char *cmd_line = aux[1];
+	struct semaphore *loaded = aux[2];
+	bool *success = aux[3];
+	struct intr_frame if_;
+	bool ok;
+
+#ifdef VM
+	supplemental_page_table_init (&current->spt);
+#endif
+	process_init ();
+
+	/* Set parent-child relationship before the parent can wait. */
+	process_add_child (parent, current);
+
+	if (duplicate_open_files (current, parent))
+		ok = process_load (cmd_line, &if_);
+	else {
+		palloc_free_page (cmd_line);
+		ok = false;
+	}
+	*success = ok;
+	sema_up (loaded);
+	if (!ok) {
+		current->exit_code = -1;
+		thread_exit ();
+	}
+
+	do_iret (&if_);
+	NOT_REACHED ();
+}
+
+/* Replaces the current execution context by F_NAME, a page that
+ * is freed here, and stores the initial user context into *IF_.
+ * Returns false if the program cannot be loaded. */
+static bool
+process_load (char *file_name, struct intr_frame *if_) {
+	bool success;
+
+	if_->ds = if_->es = if_->ss = SEL_UDSEG;
+	if_->cs = SEL_UCSEG;
+	if_->eflags = FLAG_IF | FLAG_MBS;
+
+	/* We first kill the current context */
+	process_cleanup (false);
+
+	/* And then load the binary */
+	success = load (file_name, if_);
+	palloc_free_page (file_name);
+	return success;
+}
+
 /* Switch the current execution context to the f_name.
  * Returns -1 on fail. */
 int
 process_exec (void *f_name) {
-	char *file_name = f_name;
-	bool success;
-
 	/* We cannot use the intr_frame in the thread structure.
 	 * This is because when current thread rescheduled,
 	 * it stores the execution information to the member. */
 	struct intr_frame _if;
-	_if.ds = _if.es = _if.ss = SEL_UDSEG;
-	_if.cs = SEL_UCSEG;
-	_if.eflags = FLAG_IF | FLAG_MBS;
-
-	/* We first kill the current context */
-	process_cleanup ();
+	struct thread *curr = thread_current ();
 
-	/* And then load the binary */
-	lock_acquire(&filesys_lock);
-	success = load (file_name, &_if);
-	lock_release(&filesys_lock);
+	memset (curr->launch, 0, sizeof curr->launch);
+	curr->launch[LAUNCH_START] = rdtsc ();
 
 	/* If load failed, quit. */
-	palloc_free_page (file_name);
-	if (!success)
+	if (!process_load (f_name, &_if))
 		return -1;
 
 	/* Start switched process. */
+	curr->launch[LAUNCH_ARGS] = rdtsc ();
 	do_iret (&_if);
 	NOT_REACHED ();
 }
@@ -323,16 +481,18 @@ process_wait (tid_t child_tid UNUSED) {
 	/* XXX: Hint) The pintos exit if process_wait (initd), we recommend you
 	 * XXX:       to add infinite loop here before
 	 * XXX:       implementing the process_wait. */
-	struct list *child_list = &thread_current()->child_list;
+	struct thread *proc = thread_current ()->proc;
+	struct hash *children = &proc->children;
 
 	if (child_tid > 0) {	// if valid tid,
-		struct child *child = find_child(child_list, child_tid);
+		struct child *child = find_child(children, child_tid);
 		if (child != NULL) {
 			sema_down(&child->sema);	// waiting for child to be dead.
 
 			int exit_code = child->exit_code;
-			list_remove(&child->elem);
-			free(child);
+			rusage_add (&proc->child_rusage, &child->rusage);
+			hash_delete(children, &child->elem);
+			kmem_cache_free (child_cache, child);
 			return exit_code;
 		}
 	}
@@ -349,8 +509,24 @@ process_exit (void) {
 	 * TODO: project2/process_termination.html).
 	 * TODO: We recommend you to implement process resource cleanup here. */
 
+	if (curr->proc != curr) {
+		leave_process ();
+		return;
+	}
+
 	// if user thread (process),
 	if (curr->pml4 != NULL){
+		/* The other threads go first: they run in the address space
+		 * and with the files torn down below. */
+		if (curr->thread_cnt > 0) {
+			curr->exiting = true;
+			futex_wake_process (curr);
+			while (curr->thread_cnt > 0)
+				sema_down (&curr->thread_gone);
+		}
+		/* So do its asynchronous operations. */
+		ioring_drain (curr);
+
 		printf ("%s: exit(%d)\n", curr->name, curr->exit_code);
 
 		old_level = intr_disable ();
@@ -358,46 +534,174 @@ process_exit (void) {
 		/* sorry mama... */
 		if(curr->sorry_mama != NULL){
 			curr->sorry_mama->exit_code = curr->exit_code;
+			rusage_add (&curr->sorry_mama->rusage, &curr->rusage);
+			rusage_add (&curr->sorry_mama->rusage, &curr->child_rusage);
 			sema_up(&curr->sorry_mama->sema);
 		}
 
-		/* 현재 프로세스의 child_list를 정리함 */
+		/* 현재 프로세스의 children을 정리함 */
 		/* 얌전히 있으면... 엄마가 금방 돌아올게...! 꼭..! */
-		struct list *child_list = &curr->child_list;
-		struct list_elem *e = list_head(child_list);
-
-		while (!list_empty(child_list)) {
-			struct list_elem *e = list_pop_front (child_list);
-			struct child *child = list_entry(e, struct child, elem);
-			if (child->sema.value == 0)		// child is still alive
-				child->self_thread->sorry_mama = NULL;
-			free(child);
-		}
+		hash_clear (&curr->children, orphan_child);
 		intr_set_level (old_level);
+		hash_destroy (&curr->children, NULL);
 
-		/* close all open files */
-		/* exec() 시에는 fd_table이 유지되어야 하기 때문에,
-		 * process_cleanup() 밖에 위치시킴 */
-		lock_acquire(&filesys_lock);
-		for (char fd = 2; fd < FD_MAX; fd++) {
-			file_close(curr->fd_table[fd]);
-		}
-		lock_release(&filesys_lock);
 	}
 
-	process_cleanup ();
+	process_cleanup (true);
+}
+
+#ifdef VM
+/* Starts a thread in the current process that shares its address
+ * space, open files and children, and runs user function ENTRY
+ * with FUNC and ARG as its arguments, on a stack of its own.  It
+ * enters user mode with the segments and flags of IF_.  When it
+ * exits, the int at user address CTID, if not null, is set to 0
+ * and woken as a futex, so that other threads can wait for it to
+ * end.  Returns the new thread's id, or TID_ERROR if the thread or
+ * its stack cannot be created. */
+tid_t
+process_clone (struct intr_frame *if_, uintptr_t entry, uint64_t func,
+		uint64_t arg, int *ctid) {
+	struct thread *proc = thread_current ()->proc;
+	struct intr_frame child_if;
+	struct semaphore started;
+	void *aux[5] = { proc, &child_if, ctid, NULL, &started };
+	enum intr_level old_level;
+	uint8_t *stack;
+	tid_t tid;
+
+	stack = vm_thread_stack_create ();
+	if (stack == NULL)
+		return TID_ERROR;
+	aux[3] = stack;
+
+	/* ENTRY starts as if called, with the stack pointer 16-byte
+	 * aligned before the return address, which is 0. */
+	memcpy (&child_if, if_, sizeof child_if);
+	child_if.rip = entry;
+	child_if.rsp = (uintptr_t) stack - sizeof (uint64_t);
+	child_if.R.rdi = func;
+	child_if.R.rsi = arg;
+	child_if.R.rax = 0;
+
+	/* Counted before it runs, so that an exit meanwhile waits for
+	 * it. */
+	old_level = intr_disable ();
+	if (proc->exiting) {
+		intr_set_level (old_level);
+		vm_thread_stack_destroy (stack);
+		return TID_ERROR;
+	}
+	proc->thread_cnt++;
+	intr_set_level (old_level);
+
+	sema_init (&started, 0);
+	tid = thread_create (proc->name, PRI_DEFAULT, clone_start, aux);
+	if (tid == TID_ERROR) {
+		old_level = intr_disable ();
+		proc->thread_cnt--;
+		intr_set_level (old_level);
+		vm_thread_stack_destroy (stack);
+		return TID_ERROR;
+	}
+	sema_down (&started);
+	return tid;
+}
+
+/* A thread function that enters user mode in a thread of a process
+ * made by process_clone(). */
+static void
+clone_start (void *aux_) {
+	void **aux = aux_;
+	struct thread *current = thread_current ();
+	struct thread *proc = aux[0];
+	struct intr_frame if_;
+
+	memcpy (&if_, aux[1], sizeof if_);
+	current->proc = proc;
+	if (thread_fair_group)
+		thread_set_fair_group (proc);
+	current->pml4 = proc->pml4;
+	current->fd_table = proc->fd_table;
+	current->clear_tid = aux[2];
+	current->user_stack = aux[3];
+	sema_up (aux[4]);
+
+	process_activate (current);
+	process_check_exit ();
+	do_iret (&if_);
+	NOT_REACHED ();
+}
+#endif
+
+/* Ends the current thread, one started by process_clone().  Unless
+ * it left by exit_thread(), it ends its whole process as well, with
+ * its exit code, as exit() does. */
+static void
+leave_process (void) {
+	struct thread *curr = thread_current ();
+	struct thread *proc = curr->proc;
+	enum intr_level old_level;
+	int zero = 0;
+
+	if (!curr->thread_done && !proc->exiting) {
+		proc->exit_code = curr->exit_code;
+		proc->exiting = true;
+		futex_wake_process (proc);
+	}
+
+	if (curr->clear_tid != NULL
+			&& copy_to_user (curr->clear_tid, &zero, sizeof zero))
+		futex_wake (curr->clear_tid, INT_MAX);
+#ifdef VM
+	vm_thread_stack_destroy (curr->user_stack);
+#endif
+
+	/* The main thread destroys the page tables once the count
+	 * drops, maybe before this thread is switched away from. */
+	curr->pml4 = NULL;
+	curr->fd_table = NULL;
+	pml4_activate (NULL);
+
+	old_level = intr_disable ();
+	thread_set_fair_group (curr);
+	rusage_add (&proc->rusage, &curr->rusage);
+	proc->thread_cnt--;
+	sema_up (&proc->thread_gone);
+	intr_set_level (old_level);
+}
+
+/* Ends the current thread if another thread of its process is
+ * making the process exit.  Called on the way back to user mode,
+ * which a thread of an exiting process does not return to. */
+void
+process_check_exit (void) {
+	struct thread *curr = thread_current ();
+
+	if (curr->pml4 != NULL && curr->proc->exiting) {
+		intr_enable ();
+		thread_exit ();
+	}
 }
 
-/* Free the current process's resources. */
+/* Free the current process's resources.  If EXITING, its open
+ * files and page tables go to the reaper, which releases them after
+ * the process is gone; otherwise, for exec(), the page tables are
+ * destroyed right away and the files stay open. */
 static void
-process_cleanup (void) {
+process_cleanup (bool exiting) {
 	struct thread *curr = thread_current ();
 
+	ioring_destroy (curr);
+
+#ifdef VM
+	/* Learn how much text to prefetch for the next run. */
+	prefetch_record (curr->running_executable);
+#endif
+
 	/* close executable file for this process */
-	lock_acquire(&filesys_lock);
 	file_close(curr->running_executable);
 	curr->running_executable = NULL;
-	lock_release(&filesys_lock);
 
 #ifdef VM
 	supplemental_page_table_kill (&curr->spt);
@@ -417,6 +721,16 @@ process_cleanup (void) {
 		 * that's been freed (and cleared). */
 		curr->pml4 = NULL;
 		pml4_activate (NULL);
+	}
+
+	if (exiting) {
+		/* close all open files */
+		/* exec() 시에는 fd_table이 유지되어야 하기 때문에,
+		 * exiting일 때만 reaper에게 넘김 */
+		reaper_release (pml4, curr->fd_table);
+		curr->fd_table = NULL;
+	} else if (pml4 != NULL) {
+		vdso_unmap (pml4);
 		pml4_destroy (pml4);
 	}
 }
@@ -447,9 +761,9 @@ process_activate (struct thread *next) {
 #define PT_PHDR    6            /* Program header table. */
 #define PT_STACK   0x6474e551   /* Stack segment. */
 
-#define PF_X 1          /* Executable. */
-#define PF_W 2          /* Writable. */
-#define PF_R 4          /* Readable. */
+#define PHDR_X 1        /* Executable. */
+#define PHDR_W 2        /* Writable. */
+#define PHDR_R 4        /* Readable. */
 
 /* Executable header.  See [ELF1] 1-4 to 1-8.
  * This appears at the very beginning of an ELF binary. */
@@ -491,62 +805,88 @@ static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		uint32_t read_bytes, uint32_t zero_bytes,
 		bool writable);
 
-/* Loads an ELF executable from FILE_NAME into the current thread.
- * Stores the executable's entry point into *RIP
- * and its initial stack pointer into *RSP.
- * Returns true if successful, false otherwise. */
-static bool
-load (const char *file_name, struct intr_frame *if_) {
-	struct thread *t = thread_current ();
-	struct ELF ehdr;
-	struct file *file = NULL;
-	off_t file_ofs;
-	bool success = false;
-	int i;
-	/* for parsing */
-	char *ptr;
+/* A PT_LOAD segment, as load_segment() takes it. */
+struct load_seg {
+	off_t file_page;            /* Page-aligned offset in the file. */
+	uint64_t mem_page;          /* Page-aligned user address. */
+	uint32_t read_bytes;        /* Bytes read from the file. */
+	uint32_t zero_bytes;        /* Bytes zeroed after them. */
+	bool writable;              /* Writable segment? */
+};
 
-	/* Allocate and activate page directory. */
-	t->pml4 = pml4_create ();
-	if (t->pml4 == NULL)
-		goto done;
-	process_activate (thread_current ());
+/* What loading an executable takes once its headers are parsed and
+ * validated. */
+struct elf_plan {
+	uint64_t entry;             /* Entry point. */
+	size_t seg_cnt;             /* Number of SEGS. */
+	struct load_seg segs[];     /* Segments to load, in order. */
+};
 
-	// 널문자('\0') 끼워넣기 신공
-	if((ptr = strchr((char *)file_name, ' '))){
-		*ptr = '\0';
-	}
+/* Executables whose plans are cached. */
+#define ELF_CACHE_SIZE 8
+
+/* A cached plan.  The inode is kept open, so that its write
+ * generation tells whether the plan is still good, until
+ * process_uncache() lets go of it as it is removed or its file
+ * system unmounted. */
+struct elf_cache_entry {
+	struct inode *inode;        /* Executable, or null if unused. */
+	unsigned gen;               /* inode_write_gen() when parsed. */
+	uint64_t used;              /* Value of elf_cache_clock at last use. */
+	struct elf_plan *plan;
+};
 
-	/* Open executable file. */
-	file = filesys_open (file_name);
-	if (file == NULL) {
-		printf ("load: %s: open failed\n", file_name);
-		goto done;
-	}
+static struct elf_cache_entry elf_cache[ELF_CACHE_SIZE];
+static uint64_t elf_cache_clock;
+
+/* Returns a copy of PLAN, or a null pointer if memory is short. */
+static struct elf_plan *
+elf_plan_copy (const struct elf_plan *plan) {
+	size_t size = sizeof *plan + plan->seg_cnt * sizeof *plan->segs;
+	struct elf_plan *copy = malloc (size);
+
+	if (copy != NULL)
+		memcpy (copy, plan, size);
+	return copy;
+}
+
+/* Reads and validates the headers of executable FILE and returns its
+ * plan, or a null pointer if FILE is not a loadable executable or
+ * memory is short. */
+static struct elf_plan *
+elf_parse (struct file *file) {
+	struct ELF ehdr;
+	struct elf_plan *plan;
+	off_t file_ofs;
+	int i;
 
 	/* Read and verify executable header. */
-	if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
+	if (file_read_at (file, &ehdr, sizeof ehdr, 0) != sizeof ehdr
 			|| memcmp (ehdr.e_ident, "\177ELF\2\1\1", 7)
 			|| ehdr.e_type != 2
 			|| ehdr.e_machine != 0x3E // amd64
 			|| ehdr.e_version != 1
 			|| ehdr.e_phentsize != sizeof (struct Phdr)
-			|| ehdr.e_phnum > 1024) {
-		printf ("load: %s: error loading executable\n", file_name);
-		goto done;
-	}
+			|| ehdr.e_phnum > 1024)
+		return NULL;
+
+	plan = malloc (sizeof *plan + ehdr.e_phnum * sizeof *plan->segs);
+	if (plan == NULL)
+		return NULL;
+	plan->entry = ehdr.e_entry;
+	plan->seg_cnt = 0;
 
 	/* Read program headers. */
 	file_ofs = ehdr.e_phoff;
 	for (i = 0; i < ehdr.e_phnum; i++) {
 		struct Phdr phdr;
+		struct load_seg *seg;
+		uint64_t page_offset;
 
-		if (file_ofs < 0 || file_ofs > file_length (file))
-			goto done;
-		file_seek (file, file_ofs);
-
-		if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-			goto done;
+		if (file_ofs < 0 || file_ofs > file_length (file)
+				|| file_read_at (file, &phdr, sizeof phdr, file_ofs)
+					!= sizeof phdr)
+			goto fail;
 		file_ofs += sizeof phdr;
 		switch (phdr.p_type) {
 			case PT_NULL:
@@ -559,49 +899,157 @@ load (const char *file_name, struct intr_frame *if_) {
 			case PT_DYNAMIC:
 			case PT_INTERP:
 			case PT_SHLIB:
-				goto done;
+				goto fail;
 			case PT_LOAD:
-				if (validate_segment (&phdr, file)) {
-					bool writable = (phdr.p_flags & PF_W) != 0;
-					uint64_t file_page = phdr.p_offset & ~PGMASK;
-					uint64_t mem_page = phdr.p_vaddr & ~PGMASK;
-					uint64_t page_offset = phdr.p_vaddr & PGMASK;
-					uint32_t read_bytes, zero_bytes;
-					if (phdr.p_filesz > 0) {
-						/* Normal segment.
-						 * Read initial part from disk and zero the rest. */
-						read_bytes = page_offset + phdr.p_filesz;
-						zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-								- read_bytes);
-					} else {
-						/* Entirely zero.
-						 * Don't read anything from disk. */
-						read_bytes = 0;
-						zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
-					}
-					if (!load_segment (file, file_page, (void *) mem_page,
-								read_bytes, zero_bytes, writable))
-						goto done;
+				if (!validate_segment (&phdr, file))
+					goto fail;
+				seg = &plan->segs[plan->seg_cnt++];
+				seg->writable = (phdr.p_flags & PHDR_W) != 0;
+				seg->file_page = phdr.p_offset & ~PGMASK;
+				seg->mem_page = phdr.p_vaddr & ~PGMASK;
+				page_offset = phdr.p_vaddr & PGMASK;
+				if (phdr.p_filesz > 0) {
+					/* Normal segment.
+					 * Read initial part from disk and zero the rest. */
+					seg->read_bytes = page_offset + phdr.p_filesz;
+					seg->zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
+							- seg->read_bytes);
+				} else {
+					/* Entirely zero.
+					 * Don't read anything from disk. */
+					seg->read_bytes = 0;
+					seg->zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
 				}
-				else
-					goto done;
 				break;
 		}
 	}
+	return plan;
 
-	/* Set up stack. */
-	if (!setup_stack (if_))
+fail:
+	free (plan);
+	return NULL;
+}
+
+/* Returns the plan for loading executable FILE, which the caller
+ * must free.  A repeated load of an executable that has not been
+ * written since skips reading and validating its headers.
+ * Returns a null pointer if FILE is not a loadable executable or
+ * memory is short. */
+static struct elf_plan *
+elf_plan_get (struct file *file) {
+	struct inode *inode = file_get_inode (file);
+	struct elf_cache_entry *e, *victim = &elf_cache[0];
+	struct elf_plan *plan;
+	unsigned gen;
+
+	lock_acquire (&elf_cache_lock);
+	gen = inode_write_gen (inode);
+	for (e = elf_cache; e < elf_cache + ELF_CACHE_SIZE; e++)
+		if (e->inode == inode) {
+			if (e->gen == gen) {
+				e->used = ++elf_cache_clock;
+				plan = elf_plan_copy (e->plan);
+				lock_release (&elf_cache_lock);
+				return plan;
+			}
+			/* Written since: parse again into this entry. */
+			victim = e;
+			break;
+		} else if (victim->inode != NULL
+				&& (e->inode == NULL || e->used < victim->used))
+			victim = e;
+	lock_release (&elf_cache_lock);
+
+	plan = elf_parse (file);
+	if (plan == NULL)
+		return NULL;
+
+	lock_acquire (&elf_cache_lock);
+	e = victim;
+	if (e->inode != NULL) {
+		inode_close (e->inode);
+		free (e->plan);
+		e->inode = NULL;
+	}
+	/* A removed executable is not cached again, since nothing would
+	 * then let go of it. */
+	if (!inode_is_removed (inode)
+			&& (e->plan = elf_plan_copy (plan)) != NULL) {
+		e->inode = inode_reopen (inode);
+		e->gen = gen;
+		e->used = ++elf_cache_clock;
+	}
+	lock_release (&elf_cache_lock);
+	return plan;
+}
+
+/* Drops the cached plans of INODE, or if INODE is null of every
+ * executable on MNT, closing the inodes they keep open: a removed
+ * executable's sectors are then freed once nothing else has it
+ * open, and MNT can be unmounted. */
+void
+process_uncache (struct mount *mnt, struct inode *inode) {
+	struct inode *drop[ELF_CACHE_SIZE];
+	struct elf_cache_entry *e;
+	size_t cnt = 0;
+
+	lock_acquire (&elf_cache_lock);
+	for (e = elf_cache; e < elf_cache + ELF_CACHE_SIZE; e++)
+		if (e->inode != NULL && (inode != NULL ? e->inode == inode
+					: inode_get_mount (e->inode) == mnt)) {
+			drop[cnt++] = e->inode;
+			free (e->plan);
+			e->inode = NULL;
+			e->plan = NULL;
+		}
+	lock_release (&elf_cache_lock);
+	while (cnt > 0)
+		inode_close (drop[--cnt]);
+}
+
+/* Loads an ELF executable from FILE_NAME into the current thread.
+ * Stores the executable's entry point into *RIP
+ * and its initial stack pointer into *RSP.
+ * Returns true if successful, false otherwise. */
+static bool
+load (const char *file_name, struct intr_frame *if_) {
+	struct thread *t = thread_current ();
+	struct file *file = NULL;
+	bool success = false;
+	/* for parsing */
+	char *ptr;
+
+	/* Allocate and activate page directory. */
+	t->pml4 = pml4_create ();
+	if (t->pml4 == NULL || !vdso_map (t->pml4, t->tid))
 		goto done;
+	process_activate (thread_current ());
 
-	/* Start address. */
-	if_->rip = ehdr.e_entry;
+	// 널문자('\0') 끼워넣기 신공
+	if((ptr = strchr((char *)file_name, ' '))){
+		*ptr = '\0';
+	}
+
+	/* Open executable file. */
+	file = filesys_open (file_name);
+	if (file == NULL) {
+		printf ("load: %s: open failed\n", file_name);
+		goto done;
+	}
+
+	/* A template of the executable, if there is one, has done
+	 * everything up to the arguments already. */
+	if (!zygote_clone (file, if_) && !load_image (file, file_name, if_))
+		goto done;
+	t->launch[LAUNCH_LOADED] = rdtsc ();
 
 	/* TODO: Your code goes here.
 	 * TODO: Implement argument passing (see project2/argument_passing.html). */
 	if(ptr){
 		*ptr = ' ';
 	}
-	parse_argument(file_name, if_);
+	if (!parse_argument (file_name, if_))
+		goto done;
 
 	success = true;
 
@@ -615,54 +1063,313 @@ done:
 	return success;
 }
 
+/* Loads the segments of executable FILE, named NAME, into the
+ * current address space and sets up its stack, storing the entry
+ * point and initial stack pointer into IF_.  Returns true if
+ * successful, false otherwise. */
+static bool
+load_image (struct file *file, const char *name, struct intr_frame *if_) {
+	struct elf_plan *plan;
+	bool success = false;
+	size_t i;
 
+	/* Parse the headers, or reuse what an earlier load parsed. */
+	plan = elf_plan_get (file);
+	if (plan == NULL) {
+		printf ("load: %s: error loading executable\n", name);
+		return false;
+	}
+	for (i = 0; i < plan->seg_cnt; i++) {
+		const struct load_seg *seg = &plan->segs[i];
 
-/*
-	예시 : args-many   1 2 3 4 5 6 7
-*/
-void
-parse_argument (void *f_name, struct intr_frame *if_) {
-	uintptr_t rsp = if_->rsp;
-	char *argv[LOADER_ARGS_LEN / 2 + 1];
-	char *token, *save_ptr;
-	int argc = 0;
+		if (!load_segment (file, seg->file_page, (void *) seg->mem_page,
+					seg->read_bytes, seg->zero_bytes, seg->writable))
+			goto done;
+	}
 
-	/* push token to user-stack and make argv */
-	token = strtok_r ((char *)f_name, " ", &save_ptr);
-	while (token != NULL) {
-		rsp -= strlen(token) + 1;
-		strlcpy(rsp, token, LOADER_ARGS_LEN+1);
-		argv[argc++] = rsp;
+	/* Set up stack. */
+	if (!setup_stack (if_))
+		goto done;
 
-		token = strtok_r (NULL, " ", &save_ptr);
+	/* Start address. */
+	if_->rip = plan->entry;
+#ifdef VM
+	prefetch_load (file, (void *) plan->entry);
+#endif
+	success = true;
+
+done:
+	free (plan);
+	return success;
+}
+
+#ifdef VM
+/* Zygotes: templates of processes, for programs run many times.
+ *
+ * process_zygote() loads an executable as exec() would, up to its
+ * arguments, into a kernel thread of its own, brings every page of
+ * it in, and parks the thread holding the address space.  A later
+ * load of the same executable, not written since, copies that
+ * address space copy-on-write as fork() does, instead of parsing
+ * the ELF, setting up the segments and stack and faulting the pages
+ * in, and only pushes its arguments.
+ *
+ * A zygote taken out of the table, because it was replaced or its
+ * executable was written, is retired: its thread tears it down once
+ * no load is copying it.  ZYGOTE_LOCK guards ZYGOTES and the USERS
+ * and RETIRED of each. */
+#define ZYGOTE_MAX 4
+
+struct zygote {
+	struct thread *thread;      /* Thread holding the address space. */
+	struct file *file;          /* Executable. */
+	unsigned gen;               /* inode_write_gen() when loaded. */
+	uintptr_t rip;              /* Entry point. */
+	uintptr_t rsp;              /* Initial stack pointer. */
+	bool loaded;                /* Loaded successfully? */
+	int users;                  /* Loads copying it now. */
+	bool retired;               /* Out of ZYGOTES? */
+	struct semaphore ready;     /* Up'd once loaded, or not. */
+	struct semaphore done;      /* Up'd to tear it down. */
+};
+
+static struct zygote *zygotes[ZYGOTE_MAX];
+
+/* Takes the zygote in *SLOT out of the table, to be torn down once
+ * no load is copying it.  ZYGOTE_LOCK must be held. */
+static void
+zygote_retire (struct zygote **slot) {
+	struct zygote *z = *slot;
+
+	*slot = NULL;
+	z->retired = true;
+	if (z->users == 0)
+		sema_up (&z->done);
+}
+
+/* A thread function that loads the executable of zygote Z_ and
+ * holds its address space until the zygote is torn down. */
+static void
+zygoted (void *z_) {
+	struct zygote *z = z_;
+	struct thread *curr = thread_current ();
+	struct intr_frame if_;
+	struct itree_elem *e;
+
+	supplemental_page_table_init (&curr->spt);
+	process_init ();
+	z->thread = curr;
+	curr->pml4 = pml4_create ();
+	if (curr->pml4 != NULL && vdso_map (curr->pml4, curr->tid)) {
+		process_activate (curr);
+		z->loaded = load_image (z->file, curr->name, &if_);
+	}
+	if (z->loaded) {
+		/* Every page is brought in now, so that no copy faults on
+		 * its way to main(). */
+		lock_acquire (&curr->spt.lock);
+		for (e = itree_first (&curr->spt.areas); e != NULL; e = itree_next (e))
+			vm_populate (itree_entry (e, struct vm_area, elem));
+		lock_release (&curr->spt.lock);
+		z->rip = if_.rip;
+		z->rsp = if_.rsp;
+	}
+	sema_up (&z->ready);
+
+	/* With no page tables left, the exit is not a process's. */
+	sema_down (&z->done);
+	process_cleanup (false);
+	hash_destroy (&curr->children, NULL);
+	file_close (z->file);
+	free (z);
+	thread_exit ();
+}
+
+/* Makes a zygote of the executable FILE_NAME, a page that is freed
+ * here, replacing the one it had, or retires every zygote if
+ * FILE_NAME is a null pointer.  Returns 0 if successful, -1 if the
+ * program cannot be loaded, memory is short or there are
+ * ZYGOTE_MAX zygotes of other executables already. */
+int
+process_zygote (char *file_name) {
+	struct zygote *z;
+	struct file *file;
+	size_t i, slot = ZYGOTE_MAX;
+
+	if (file_name == NULL) {
+		lock_acquire (&zygote_lock);
+		for (i = 0; i < ZYGOTE_MAX; i++)
+			if (zygotes[i] != NULL)
+				zygote_retire (&zygotes[i]);
+		lock_release (&zygote_lock);
+		return 0;
 	}
 
-	/* word alignment */
-	while ((rsp & 15) != 0) {
-		rsp--;
-		*(char *)rsp = 0;
+	file = filesys_open (file_name);
+	z = calloc (1, sizeof *z);
+	if (file == NULL || z == NULL) {
+		file_close (file);
+		free (z);
+		palloc_free_page (file_name);
+		return -1;
+	}
+	z->file = file;
+	z->gen = inode_write_gen (file_get_inode (file));
+	sema_init (&z->ready, 0);
+	sema_init (&z->done, 0);
+	if (thread_create (file_name, PRI_DEFAULT, zygoted, z) == TID_ERROR) {
+		file_close (file);
+		free (z);
+		palloc_free_page (file_name);
+		return -1;
+	}
+	palloc_free_page (file_name);
+	sema_down (&z->ready);
+	if (!z->loaded) {
+		sema_up (&z->done);
+		return -1;
 	}
-	
-	argv[argc] = 0;		// null pointer sentinel
 
-	/* rsp+8 16의 배수 align */
-	if (argc % 2 == 0) {
-		rsp -= 8;
-		*(uintptr_t *)rsp = 0;
+	lock_acquire (&zygote_lock);
+	for (i = 0; i < ZYGOTE_MAX; i++) {
+		if (zygotes[i] != NULL
+				&& file_get_inode (zygotes[i]->file) == file_get_inode (file))
+			zygote_retire (&zygotes[i]);
+		if (zygotes[i] == NULL && slot == ZYGOTE_MAX)
+			slot = i;
+	}
+	if (slot < ZYGOTE_MAX)
+		zygotes[slot] = z;
+	lock_release (&zygote_lock);
+	if (slot == ZYGOTE_MAX) {
+		sema_up (&z->done);
+		return -1;
 	}
+	return 0;
+}
 
-	/* push argv to user-stack */
-	int argv_size_b = (argc+1) * sizeof(char *);
-	rsp -= argv_size_b;
-	memcpy(rsp, argv, argv_size_b);
+/* Copies the zygote of executable FILE, if it has one and FILE has
+ * not been written since, into the current process, whose address
+ * space is empty, and stores the entry point and initial stack
+ * pointer into IF_.  Returns false, leaving the address space
+ * empty, if there is none or memory is short. */
+static bool
+zygote_clone (struct file *file, struct intr_frame *if_) {
+	struct thread *curr = thread_current ();
+	struct inode *inode = file_get_inode (file);
+	struct zygote *z = NULL;
+	bool success;
+	size_t i;
+
+	lock_acquire (&zygote_lock);
+	for (i = 0; i < ZYGOTE_MAX; i++)
+		if (zygotes[i] != NULL && file_get_inode (zygotes[i]->file) == inode) {
+			if (zygotes[i]->gen == inode_write_gen (inode)) {
+				z = zygotes[i];
+				z->users++;
+			} else
+				zygote_retire (&zygotes[i]);
+			break;
+		}
+	lock_release (&zygote_lock);
+	if (z == NULL)
+		return false;
 
-	/* false return address */
-	rsp -= 8;
-	*(uintptr_t *)rsp = 0;
-	
-	if_->rsp = rsp;
+	lock_acquire (&z->thread->spt.lock);
+	success = supplemental_page_table_copy (&curr->spt, &z->thread->spt);
+	lock_release (&z->thread->spt.lock);
+	if (success) {
+		if_->rip = z->rip;
+		if_->rsp = z->rsp;
+	} else
+		supplemental_page_table_kill (&curr->spt);
+
+	lock_acquire (&zygote_lock);
+	if (--z->users == 0 && z->retired)
+		sema_up (&z->done);
+	lock_release (&zygote_lock);
+	return success;
+}
+#else
+/* Without VM there is no copy-on-write to copy a zygote with. */
+int
+process_zygote (char *file_name) {
+	if (file_name != NULL)
+		palloc_free_page (file_name);
+	return -1;
+}
+
+static bool
+zygote_clone (struct file *file UNUSED, struct intr_frame *if_ UNUSED) {
+	return false;
+}
+#endif
+
+
+
+/* Pushes the arguments of CMD_LINE, separated by spaces, onto the
+ * user stack of IF_ and points IF_'s argc and argv registers at
+ * them.  The layout is computed first and built in a kernel page,
+ * which is then copied to the stack in one memcpy(), so there is no
+ * limit on the number of arguments other than the stack page.
+ * Returns false if they do not fit or memory is short.
+ *
+ * 예시 : args-many   1 2 3 4 5 6 7 */
+static bool
+parse_argument (const char *cmd_line, struct intr_frame *if_) {
+	size_t argc = 0, str_bytes = 0, size;
+	const char *p;
+	uint8_t *block;
+	char **argv;
+	char *str;
+	uintptr_t base;
+
+	/* 1. Count the arguments and the bytes of their strings. */
+	for (p = cmd_line + strspn (cmd_line, " "); *p != '\0';
+			p += strspn (p, " ")) {
+		size_t len = strcspn (p, " ");
+
+		argc++;
+		str_bytes += len + 1;
+		p += len;
+	}
+
+	/* 2. Lay out, from the bottom up: 8 bytes of padding below the
+	 *    new rsp, the false return address at rsp, argv with its
+	 *    null sentinel at rsp+8, which the padding leaves 16-byte
+	 *    aligned as after a call, and the strings at the top. */
+	size = 2 * sizeof (char *) + ROUND_UP ((argc + 1) * sizeof (char *), 16)
+		+ ROUND_UP (str_bytes, 16);
+	if (size > PGSIZE)
+		return false;
+	block = palloc_get_page (PAL_ZERO);
+	if (block == NULL)
+		return false;
+	base = if_->rsp - size;
+	argv = (char **) (block + 2 * sizeof (char *));
+	str = (char *) block + size - str_bytes;
+
+	/* 3. Fill in the strings and argv, at their user addresses. */
+	argc = 0;
+	for (p = cmd_line + strspn (cmd_line, " "); *p != '\0';
+			p += strspn (p, " ")) {
+		size_t len = strcspn (p, " ");
+
+		memcpy (str, p, len);
+		str[len] = '\0';
+		argv[argc++] = (char *) (base + ((uint8_t *) str - block));
+		str += len + 1;
+		p += len;
+	}
+
+	/* 4. One copy onto the user stack. */
+	memcpy ((void *) base, block, size);
+	palloc_free_page (block);
+
+	if_->rsp = base + sizeof (char *);
 	if_->R.rdi = argc;
-	if_->R.rsi = rsp+8;
+	if_->R.rsi = base + 2 * sizeof (char *);
+	return true;
 }
 
 /* Checks whether PHDR describes a valid, loadable segment in
@@ -813,13 +1520,6 @@ install_page (void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
-static bool
-lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
-}
-
 /* Loads a segment starting at offset OFS in FILE at address
  * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
  * memory are initialized, as follows:
@@ -841,25 +1541,14 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
-	while (read_bytes > 0 || zero_bytes > 0) {
-		/* Do calculate how to fill this page.
-		 * We will read PAGE_READ_BYTES bytes from FILE
-		 * and zero the final PAGE_ZERO_BYTES bytes. */
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
-			return false;
-
-		/* Advance. */
-		read_bytes -= page_read_bytes;
-		zero_bytes -= page_zero_bytes;
-		upage += PGSIZE;
-	}
-	return true;
+	/* The whole segment becomes one area; its pages are read from
+	 * FILE, or zeroed, when first touched.  A read-only segment is
+	 * file-backed, so that its pages are dropped rather than
+	 * swapped out and map the frames of the page cache. */
+	return vma_create (&thread_current ()->spt, upage,
+			read_bytes + zero_bytes,
+			writable || read_bytes == 0 ? VM_ANON : VM_FILE, writable,
+			read_bytes > 0 ? file : NULL, ofs, read_bytes) != NULL;
 }
 
 /* Create a PAGE of stack at the USER_STACK. Return true on success. */
@@ -868,10 +1557,13 @@ setup_stack (struct intr_frame *if_) {
 	bool success = false;
 	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
+	/* Map the stack on stack_bottom and claim the page immediately. */
+	if (vma_create (&thread_current ()->spt, stack_bottom, PGSIZE,
+				VM_ANON | VM_STACK, true, NULL, 0, 0) != NULL
+			&& vm_claim_page (stack_bottom)) {
+		if_->rsp = USER_STACK;
+		success = true;
+	}
 
 	return success;
 }
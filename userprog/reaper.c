@@ -0,0 +1,147 @@
+/* reaper.c: Deferred teardown of exited processes.
+ *
+ * An exiting process tells its parent first and then, instead of
+ * closing its files and freeing its page tables itself, hands them
+ * to kreaperd with reaper_release() and gives up the CPU.  kreaperd
+ * takes everything handed to it so far at once and releases it in
+ * a batch: every descriptor table, then every page table, along
+ * with the frames the page tables still map, which in the userprog
+ * build are all of the process's memory.  (The supplemental page
+ * table of the VM build is torn down by the process itself, as it
+ * must be from the process's own address space.)
+ *
+ * The parent can thus return from wait() before the teardown is
+ * done.  What is still waiting to be reaped cannot be allocated
+ * yet, so process_fork() first waits it out with reaper_drain(),
+ * like ioring_drain(); a fork right after a wait then finds the
+ * same memory free as if the teardown had been synchronous. */
+
+#include "userprog/reaper.h"
+#include <debug.h>
+#include <stdbool.h>
+#include "threads/lock-stats.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/fdtable.h"
+#include "userprog/vdso.h"
+
+/* What an exited process left to release. */
+struct corpse {
+	struct corpse *next;            /* Next in PENDING. */
+	uint64_t *pml4;                 /* Page tables, or null. */
+	struct fd_table *fd_table;      /* Open files, or null. */
+};
+
+/* Handed over and not yet taken by kreaperd, most recent first. */
+static struct corpse *pending;
+
+/* Corpses handed over and reaped, ever. */
+static uint64_t released_cnt;
+static uint64_t reaped_cnt;
+
+/* Guards the above.  REAPER_WORK is signaled when PENDING gets its
+ * first corpse, and REAPER_DONE after each batch. */
+static struct lock reaper_lock;
+static struct condition reaper_work;
+static struct condition reaper_done;
+static bool reaper_started;
+
+static thread_func reaper;
+
+/* Starts kreaperd. */
+void
+reaper_init (void) {
+	lock_init (&reaper_lock);
+	lock_set_name (&reaper_lock, "reaper");
+	cond_init (&reaper_work);
+	cond_init (&reaper_done);
+	if (thread_create ("kreaperd", PRI_DEFAULT, reaper, NULL) == TID_ERROR)
+		PANIC ("cannot start kreaperd");
+	reaper_started = true;
+}
+
+/* Closes the files of FD_TABLE and destroys page table PML4,
+ * either of which may be null, and frees the memory they map. */
+static void
+release (uint64_t *pml4, struct fd_table *fd_table) {
+	fd_table_destroy (fd_table);
+	if (pml4 != NULL) {
+		vdso_unmap (pml4);
+		pml4_destroy (pml4);
+	}
+}
+
+/* Hands PML4 and FD_TABLE, either of which may be null, of a process
+ * that has exited to kreaperd, which releases them as release()
+ * does.  PML4 must no longer be active.  Releases them right away if
+ * memory is too short to hand them over. */
+void
+reaper_release (uint64_t *pml4, struct fd_table *fd_table) {
+	struct corpse *c;
+
+	if (pml4 == NULL && fd_table == NULL)
+		return;
+	c = reaper_started ? malloc (sizeof *c) : NULL;
+	if (c == NULL) {
+		release (pml4, fd_table);
+		return;
+	}
+
+	c->pml4 = pml4;
+	c->fd_table = fd_table;
+	lock_acquire (&reaper_lock);
+	c->next = pending;
+	pending = c;
+	released_cnt++;
+	cond_signal (&reaper_work, &reaper_lock);
+	lock_release (&reaper_lock);
+}
+
+/* Waits until kreaperd has released everything handed to it so far. */
+void
+reaper_drain (void) {
+	uint64_t target;
+
+	if (!reaper_started)
+		return;
+	lock_acquire (&reaper_lock);
+	target = released_cnt;
+	while (reaped_cnt < target)
+		cond_wait (&reaper_done, &reaper_lock);
+	lock_release (&reaper_lock);
+}
+
+/* kreaperd: releases what exited processes left, a batch at a
+ * time.  All the files are closed before any memory is freed, so
+ * that what others can see of an exit, such as the end of a pipe,
+ * comes as soon as it can. */
+static void
+reaper (void *aux UNUSED) {
+	for (;;) {
+		struct corpse *batch, *c, *next;
+		uint64_t cnt = 0;
+
+		lock_acquire (&reaper_lock);
+		while (pending == NULL)
+			cond_wait (&reaper_work, &reaper_lock);
+		batch = pending;
+		pending = NULL;
+		lock_release (&reaper_lock);
+
+		for (c = batch; c != NULL; c = c->next)
+			release (NULL, c->fd_table);
+		for (c = batch; c != NULL; c = next) {
+			next = c->next;
+			release (c->pml4, NULL);
+			free (c);
+			cnt++;
+		}
+
+		lock_acquire (&reaper_lock);
+		reaped_cnt += cnt;
+		cond_broadcast (&reaper_done, &reaper_lock);
+		lock_release (&reaper_lock);
+	}
+}
@@ -1,7 +1,14 @@
 #include "userprog/syscall.h"
 #include "userprog/process.h"
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
+#include <iovec.h>
+#include <dirent.h>
+#include <stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <round.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/loader.h"
@@ -9,16 +16,196 @@
 #include "threads/flags.h"
 #include "threads/synch.h"
 #include "intrinsic.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
+#include "filesys/inode.h"
+#include "filesys/pipe.h"
 #include "threads/vaddr.h"
 #include "threads/mmu.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/poll.h"
+#include "threads/instrument.h"
+#include "threads/trace.h"
+#include "userprog/usercopy.h"
+#include "userprog/fdtable.h"
+#include "userprog/futex.h"
+#include "userprog/ioring.h"
+#include "devices/input.h"
+#include "devices/timer.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
 
+typedef void syscall_handler_func (struct intr_frame *);
+typedef uint64_t syscall_leaf_func (uint64_t, uint64_t, uint64_t);
+
+static syscall_leaf_func filesize_leaf;
+static syscall_leaf_func seek_leaf;
+static syscall_leaf_func tell_leaf;
+static syscall_leaf_func close_leaf;
+
+/* Handlers of the system calls, indexed by the numbers in
+ * lib/syscall-nr.h.  Numbers without a handler are null. */
+static syscall_handler_func *syscall_handlers[] = {
+	[SYS_HALT] = halt_syscall_handler,
+	[SYS_EXIT] = exit_syscall_handler,
+	[SYS_FORK] = fork_syscall_handler,
+	[SYS_EXEC] = exec_syscall_handler,
+	[SYS_WAIT] = wait_syscall_handler,
+	[SYS_CREATE] = create_syscall_handler,
+	[SYS_REMOVE] = remove_syscall_handler,
+	[SYS_OPEN] = open_syscall_handler,
+	[SYS_FILESIZE] = filesize_syscall_handler,
+	[SYS_READ] = read_syscall_handler,
+	[SYS_WRITE] = write_syscall_handler,
+	[SYS_SEEK] = seek_syscall_handler,
+	[SYS_TELL] = tell_syscall_handler,
+	[SYS_CLOSE] = close_syscall_handler,
+
+	[SYS_MMAP] = mmap_syscall_handler,
+	[SYS_MUNMAP] = munmap_syscall_handler,
+
+	[SYS_CHDIR] = chdir_syscall_handler,
+	[SYS_MKDIR] = mkdir_syscall_handler,
+	[SYS_READDIR] = readdir_syscall_handler,
+	[SYS_ISDIR] = isdir_syscall_handler,
+	[SYS_INUMBER] = inumber_syscall_handler,
+	[SYS_SYMLINK] = symlink_syscall_handler,
+
+	[SYS_DUP2] = dup2_syscall_handler,
+	[SYS_MOUNT] = mount_syscall_handler,
+	[SYS_UMOUNT] = umount_syscall_handler,
+
+	[SYS_SPAWN] = spawn_syscall_handler,
+	[SYS_READV] = readv_syscall_handler,
+	[SYS_WRITEV] = writev_syscall_handler,
+	[SYS_PREAD] = pread_syscall_handler,
+	[SYS_PWRITE] = pwrite_syscall_handler,
+	[SYS_PIPE] = pipe_syscall_handler,
+	[SYS_GETDENTS] = getdents_syscall_handler,
+	[SYS_GETRUSAGE] = getrusage_syscall_handler,
+	[SYS_MADVISE] = madvise_syscall_handler,
+	[SYS_MSYNC] = msync_syscall_handler,
+	[SYS_CLONE] = clone_syscall_handler,
+	[SYS_EXIT_THREAD] = exit_thread_syscall_handler,
+	[SYS_FUTEX] = futex_syscall_handler,
+	[SYS_IO_SETUP] = io_setup_syscall_handler,
+	[SYS_IO_ENTER] = io_enter_syscall_handler,
+	[SYS_COPY_FILE_RANGE] = copy_file_range_syscall_handler,
+	[SYS_STAT] = stat_syscall_handler,
+	[SYS_FSTAT] = fstat_syscall_handler,
+	[SYS_FSYNC] = fsync_syscall_handler,
+	[SYS_SYNC] = sync_syscall_handler,
+	[SYS_FALLOCATE] = fallocate_syscall_handler,
+	[SYS_FTRUNCATE] = ftruncate_syscall_handler,
+	[SYS_ZYGOTE] = zygote_syscall_handler,
+	[SYS_CLONE_FILE] = clone_file_syscall_handler,
+	[SYS_POLL] = poll_syscall_handler,
+};
+
+/* One more than the highest system call number. */
+#define SYSCALL_CNT (sizeof syscall_handlers / sizeof *syscall_handlers)
+
+/* Leaf system calls, which take their arguments and return their
+ * result in registers and never need the caller's user context:
+ * they do not touch user memory, fork, exec or exit.
+ * syscall_entry calls them directly, saving only the registers a C
+ * function may clobber instead of building an intr_frame.  Other
+ * numbers are null and take the full path. */
+syscall_leaf_func *syscall_leaf_handlers[SYSCALL_CNT] = {
+	[SYS_FILESIZE] = filesize_leaf,
+	[SYS_SEEK] = seek_leaf,
+	[SYS_TELL] = tell_leaf,
+	[SYS_CLOSE] = close_leaf,
+};
+const uint64_t syscall_leaf_cnt = SYSCALL_CNT;
+
+/* Names of the system calls, for syscall_print_stats(). */
+static const char *syscall_names[SYSCALL_CNT] = {
+	[SYS_HALT] = "halt",
+	[SYS_EXIT] = "exit",
+	[SYS_FORK] = "fork",
+	[SYS_EXEC] = "exec",
+	[SYS_WAIT] = "wait",
+	[SYS_CREATE] = "create",
+	[SYS_REMOVE] = "remove",
+	[SYS_OPEN] = "open",
+	[SYS_FILESIZE] = "filesize",
+	[SYS_READ] = "read",
+	[SYS_WRITE] = "write",
+	[SYS_SEEK] = "seek",
+	[SYS_TELL] = "tell",
+	[SYS_CLOSE] = "close",
+
+	[SYS_MMAP] = "mmap",
+	[SYS_MUNMAP] = "munmap",
+
+	[SYS_CHDIR] = "chdir",
+	[SYS_MKDIR] = "mkdir",
+	[SYS_READDIR] = "readdir",
+	[SYS_ISDIR] = "isdir",
+	[SYS_INUMBER] = "inumber",
+	[SYS_SYMLINK] = "symlink",
+
+	[SYS_DUP2] = "dup2",
+	[SYS_MOUNT] = "mount",
+	[SYS_UMOUNT] = "umount",
+
+	[SYS_SPAWN] = "spawn",
+	[SYS_READV] = "readv",
+	[SYS_WRITEV] = "writev",
+	[SYS_PREAD] = "pread",
+	[SYS_PWRITE] = "pwrite",
+	[SYS_PIPE] = "pipe",
+	[SYS_GETDENTS] = "getdents",
+	[SYS_GETRUSAGE] = "getrusage",
+	[SYS_MADVISE] = "madvise",
+	[SYS_MSYNC] = "msync",
+	[SYS_CLONE] = "clone",
+	[SYS_EXIT_THREAD] = "exit_thread",
+	[SYS_FUTEX] = "futex",
+	[SYS_IO_SETUP] = "io_setup",
+	[SYS_IO_ENTER] = "io_enter",
+	[SYS_COPY_FILE_RANGE] = "copy_file_range",
+	[SYS_STAT] = "stat",
+	[SYS_FSTAT] = "fstat",
+	[SYS_FSYNC] = "fsync",
+	[SYS_SYNC] = "sync",
+	[SYS_FALLOCATE] = "fallocate",
+	[SYS_FTRUNCATE] = "ftruncate",
+	[SYS_ZYGOTE] = "zygote",
+	[SYS_CLONE_FILE] = "clone_file",
+	[SYS_POLL] = "poll",
+};
+
+/* Log2 buckets of a system call latency histogram: bucket B counts
+ * calls that took 2**B to 2**(B + 1) - 1 cycles, the last bucket
+ * any longer ones. */
+#define SYSCALL_HIST_BUCKETS 40
+
+/* Calls of one system call, kept while counters are on.  The time
+ * of a call is split into cycles spent waiting for locks other
+ * threads held and the rest, its work.  Calls that do not return,
+ * such as exit() and a successful exec(), are counted but not
+ * timed. */
+struct syscall_stats {
+	uint64_t cnt;                       /* Calls made. */
+	uint64_t work;                      /* Total cycles of work. */
+	uint64_t wait;                      /* Total cycles waiting for locks. */
+	uint64_t work_hist[SYSCALL_HIST_BUCKETS];   /* Calls by work. */
+	uint64_t wait_hist[SYSCALL_HIST_BUCKETS];   /* Calls that waited,
+	                                               by waiting. */
+};
+
+static struct syscall_stats syscall_stats[SYSCALL_CNT];
+
+static intr_handler_func inspect_syscalls;
+
 /* System call.
  *
  * Previously system call services was handled by the interrupt handler
@@ -44,7 +231,118 @@ syscall_init (void) {
 	write_msr(MSR_SYSCALL_MASK,
 			FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
 
-	lock_init(&filesys_lock);
+	futex_init ();
+
+	/* Accounting every call means taking the leaf calls the full
+	 * way too. */
+	if (counters_enabled)
+		memset (syscall_leaf_handlers, 0, sizeof syscall_leaf_handlers);
+
+	/* System call statistics, via int 0x4d.
+	 * Input:
+	 *   @RDI - System call number.
+	 *   @RSI - 0: number of calls,
+	 *          1: total cycles of work,
+	 *          2: total cycles waiting for locks,
+	 *          3 + B: calls in bucket B of the histogram of work,
+	 *          3 + SYSCALL_HIST_BUCKETS + B: calls in bucket B of
+	 *          the histogram of waiting for locks.
+	 * Output:
+	 *   @RAX - Requested counter, or -1 if RDI or RSI is out of
+	 *          range.  All are 0 unless counters are on. */
+	intr_register_int (0x4d, 3, INTR_OFF, inspect_syscalls,
+			"Inspect System Calls");
+}
+
+/* Returns the histogram bucket of CYCLES. */
+static int
+hist_bucket (uint64_t cycles) {
+	int b = cycles > 1 ? 63 - __builtin_clzll (cycles) : 0;
+
+	return b < SYSCALL_HIST_BUCKETS ? b : SYSCALL_HIST_BUCKETS - 1;
+}
+
+/* Accounts for a call NR, which the current thread began at TSC
+ * START, when its lock_wait was WAIT_START. */
+static void
+syscall_account (uint16_t nr, uint64_t start, uint64_t wait_start) {
+	struct syscall_stats *s = &syscall_stats[nr];
+	uint64_t wait = thread_current ()->lock_wait - wait_start;
+	uint64_t cycles = rdtsc () - start;
+	uint64_t work = cycles > wait ? cycles - wait : 0;
+	enum intr_level old_level = intr_disable ();
+
+	s->work += work;
+	s->work_hist[hist_bucket (work)]++;
+	if (wait > 0) {
+		s->wait += wait;
+		s->wait_hist[hist_bucket (wait)]++;
+	}
+	intr_set_level (old_level);
+}
+
+/* Prints a line of histogram HIST, named NAME, if it has any
+ * calls. */
+static void
+print_hist (const char *name, const uint64_t hist[]) {
+	int b;
+
+	for (b = 0; b < SYSCALL_HIST_BUCKETS; b++)
+		if (hist[b] != 0)
+			break;
+	if (b == SYSCALL_HIST_BUCKETS)
+		return;
+	printf ("    %s:", name);
+	for (; b < SYSCALL_HIST_BUCKETS; b++)
+		if (hist[b] != 0)
+			printf (" 2^%d:%llu", b, hist[b]);
+	printf ("\n");
+}
+
+/* Prints the statistics of every system call made, if counters
+ * were on. */
+void
+syscall_print_stats (void) {
+	size_t nr;
+
+	if (!counters_key.enabled)
+		return;
+	printf ("System calls:\n");
+	for (nr = 0; nr < SYSCALL_CNT; nr++) {
+		const struct syscall_stats *s = &syscall_stats[nr];
+
+		if (s->cnt == 0)
+			continue;
+		printf ("  %s: %llu, %llu cycles of work, %llu waiting for locks\n",
+				syscall_names[nr], s->cnt, s->work, s->wait);
+		print_hist ("work", s->work_hist);
+		print_hist ("lock wait", s->wait_hist);
+	}
+}
+
+/* Answers the system call inspection interrupt. */
+static void
+inspect_syscalls (struct intr_frame *f) {
+	const struct syscall_stats *s;
+	uint64_t i = f->R.rsi;
+
+	if (f->R.rdi >= SYSCALL_CNT) {
+		f->R.rax = -1;
+		return;
+	}
+	s = &syscall_stats[f->R.rdi];
+	if (i == 0)
+		f->R.rax = s->cnt;
+	else if (i == 1)
+		f->R.rax = s->work;
+	else if (i == 2)
+		f->R.rax = s->wait;
+	else if (i < 3 + SYSCALL_HIST_BUCKETS)
+		f->R.rax = s->work_hist[i - 3];
+	else if (i < 3 + 2 * SYSCALL_HIST_BUCKETS)
+		f->R.rax = s->wait_hist[i - 3 - SYSCALL_HIST_BUCKETS];
+	else
+		f->R.rax = -1;
 }
 
 /* The main system call interface */
@@ -52,44 +350,76 @@ void
 syscall_handler (struct intr_frame *f UNUSED) {
 	syscall_handler_func *handler;
 
-	handler = syscall_handlers[f->R.rax];
+#ifdef VM
+	/* Kernel faults on the stack in this call grow it against the
+	 * user's stack pointer. */
+	thread_current ()->user_rsp = f->rsp;
+#endif
+	handler = f->R.rax < SYSCALL_CNT ? syscall_handlers[f->R.rax] : NULL;
 	if (handler) {
-		handler(f);		// handle system call.
+		uint16_t nr = f->R.rax;
+
+		trace (TRACE_SYSCALL_ENTER, nr, 0);
+		if (static_branch_unlikely (counters_key)) {
+			uint64_t wait_start = thread_current ()->lock_wait;
+			uint64_t start = rdtsc ();
+
+			syscall_stats[nr].cnt++;
+			handler (f);
+			syscall_account (nr, start, wait_start);
+		} else
+			handler(f);		// handle system call.
+		trace (TRACE_SYSCALL_EXIT, f->R.rax, nr);
+		process_check_exit ();
 	}
 	else {
-		intr_dump_frame (f);
-		PANIC ("Unexpected system call");
-	}
-		
-}
-
-/* This assertion should be used when
-   the argument sent by user is POINTER TYPE */
-void assert_valid_address(void * uaddr) {
-	/* invalid if uaddr is null or kernel virtual address */
-	if (!uaddr || is_kernel_vaddr(uaddr)) {
+		/* Unknown system call number: only the process is at fault. */
 		thread_current()->exit_code = -1;
 		thread_exit();
 	}
+}
 
-	/* just check if uaddr is actually mapped to some physical address */
-	if (!pml4_get_page(thread_current()->pml4, uaddr)) {
-		thread_current()->exit_code = -1;
-		thread_exit();
-	}
+/* Kills the current process, which passed a bad pointer. */
+static void bad_user_pointer (void) {
+	thread_current()->exit_code = -1;
+	thread_exit();
 }
 
-struct child *find_child (struct list *child_list, int tid) {
-	struct list_elem *e = list_head(child_list);
+/* Copies the string at user address USTR into a new page, which
+   the caller must free.  Kills the process if USTR is a bad
+   pointer; returns a null pointer if memory is short. */
+static char *string_from_user (const char *ustr) {
+	char *kstr = palloc_get_page (0);
 
-	while ((e = list_next(e)) != list_end(child_list)) {
-		struct child *child = list_entry(e, struct child, elem);
-		if (tid == child->tid) {
-			return child;
-		}
+	if (kstr != NULL && !copy_str_from_user (kstr, ustr, PGSIZE)) {
+		palloc_free_page (kstr);
+		bad_user_pointer ();
 	}
+	return kstr;
+}
+
+/* Returns what FD of the current process refers to: a file, one
+   of the console's stand-ins FD_STDIN and FD_STDOUT, or a null
+   pointer if FD is not open. */
+static struct file *fd_entry (int fd) {
+	return fd_get (thread_current()->fd_table, fd);
+}
 
-	return NULL;
+/* Returns the file the current process has open as FD, or a null
+   pointer if FD is not a descriptor of an open file. */
+static struct file *fd_file (int fd) {
+	struct file *file = fd_entry (fd);
+
+	return fd_is_console (file) ? NULL : file;
+}
+
+struct child *find_child (struct hash *children, int tid) {
+	struct child key;
+	struct hash_elem *e;
+
+	key.tid = tid;
+	e = hash_find (children, &key.elem);
+	return e != NULL ? hash_entry (e, struct child, elem) : NULL;
 }
 
 /*
@@ -105,7 +435,10 @@ void halt_syscall_handler (struct intr_frame *f) {
  * exit (int status)
  */
 void exit_syscall_handler (struct intr_frame *f) {
-	thread_current()->exit_code = f->R.rdi;
+	/* A process another thread is ending keeps the status that
+	 * thread gave. */
+	if (!thread_current ()->proc->exiting)
+		thread_current()->exit_code = f->R.rdi;
 	thread_exit();
 } 
 
@@ -115,11 +448,15 @@ void exit_syscall_handler (struct intr_frame *f) {
  */
 void fork_syscall_handler (struct intr_frame *f) {
 	struct thread *curr = thread_current();
-	struct list *child_list = &curr->child_list;
-	int tid = process_fork(f->R.rdi, f);
+	char name[sizeof curr->name];
+	int tid;
+
+	if (!copy_str_from_user (name, (const char *) f->R.rdi, sizeof name))
+		bad_user_pointer ();
+	tid = process_fork(name, f);
 
 	if (tid > 0) {	// if valid tid,
-		struct child *child = find_child(child_list, tid);
+		struct child *child = find_child(&curr->proc->children, tid);
 		if (child != NULL) {
 			f->R.rax = tid;
 			return;
@@ -135,16 +472,18 @@ void fork_syscall_handler (struct intr_frame *f) {
  * exec (const char *file)
  */
 void exec_syscall_handler (struct intr_frame *f) {
-	assert_valid_address(f->R.rdi);
+	struct thread *curr = thread_current ();
+	char *arg_copy;
 
-	char *arg, *arg_copy;
-	arg = f->R.rdi;
+	/* The other threads would be left without an address space. */
+	if (curr->proc != curr || curr->thread_cnt > 0) {
+		f->R.rax = -1;
+		return;
+	}
 
 	/* Make a copy of argument */
-	arg_copy = palloc_get_page (0);
+	arg_copy = string_from_user ((const char *) f->R.rdi);
 	if (arg_copy != NULL) {
-		strlcpy(arg_copy, arg, PGSIZE);
-
 		/* Never return if succeed */
 		int result = process_exec(arg_copy);
 	}
@@ -153,6 +492,36 @@ void exec_syscall_handler (struct intr_frame *f) {
 	thread_exit();
 } 
 
+/*
+ * pid_t
+ * spawn (const char *cmd_line)
+ */
+void spawn_syscall_handler (struct intr_frame *f) {
+	char *cmd_line = string_from_user ((const char *) f->R.rdi);
+
+	f->R.rax = cmd_line != NULL ? process_spawn (cmd_line) : TID_ERROR;
+}
+
+/*
+ * int
+ * zygote (const char *file)
+ *
+ * Later exec() and spawn() of FILE copy it as loaded now.  A null
+ * FILE drops every such template.
+ */
+void zygote_syscall_handler (struct intr_frame *f) {
+	char *file = NULL;
+
+	if (f->R.rdi != 0) {
+		file = string_from_user ((const char *) f->R.rdi);
+		if (file == NULL) {
+			f->R.rax = -1;
+			return;
+		}
+	}
+	f->R.rax = process_zygote (file);
+}
+
 /*
  * int 
  * wait (pid_t pid)
@@ -168,14 +537,11 @@ void wait_syscall_handler (struct intr_frame *f) {
  * create (const char *file, unsigned initial_size)
  */
 void create_syscall_handler (struct intr_frame *f) {
-	assert_valid_address(f->R.rdi);
-
-	char *name = f->R.rdi;
+	char *name = string_from_user ((const char *) f->R.rdi);
 	unsigned initial_size = f->R.rsi;
-	lock_acquire(&filesys_lock);
-	bool success = filesys_create(name, initial_size);
-	lock_release(&filesys_lock);
+	bool success = name != NULL && filesys_create(name, initial_size);
 
+	palloc_free_page (name);
 	f->R.rax = success;
 } 
 
@@ -184,107 +550,183 @@ void create_syscall_handler (struct intr_frame *f) {
  * remove (const char *file)
  */
 void remove_syscall_handler (struct intr_frame *f) {
-	assert_valid_address(f->R.rdi);
-	
-	char *name = f->R.rdi;
-	lock_acquire(&filesys_lock);
-	bool success = filesys_remove(name);
-	lock_release(&filesys_lock);
+	char *name = string_from_user ((const char *) f->R.rdi);
+	bool success = name != NULL && filesys_remove(name);
 
+	palloc_free_page (name);
 	f->R.rax = success;
 } 
 
 /*
  * int
- * open (const char *file)
+ * open_flags (const char *file, int flags)
  */
 void open_syscall_handler (struct intr_frame *f) {
-	assert_valid_address(f->R.rdi);
-
-	char *file_name = f->R.rdi;
-	uintptr_t *fd_table = thread_current()->fd_table;
-	uintptr_t *file_opened;
-
-	/* check file_name and fd_count */
-	if (!file_name || thread_current()->fd_count >= FD_MAX) {
+	char *file_name = string_from_user ((const char *) f->R.rdi);
+	int flags = f->R.rsi;
+	struct file *file_opened;
+	int fd;
+
+	/* check file_name and flags */
+	if (!file_name || (flags & ~(O_DIRECT | O_COMPRESS)) != 0) {
+		palloc_free_page (file_name);
 		f->R.rax = -1;
 		return;
 	}
-	lock_acquire(&filesys_lock);
 	file_opened = filesys_open(file_name);
-	lock_release(&filesys_lock);
+	palloc_free_page (file_name);
 
 	/* check the file has been successfully opened */
 	if (!file_opened) {
 		f->R.rax = -1;
 		return;
 	}
-	
-	/* find empty entry */
-	for (char idx = 2; idx < FD_MAX; idx++) {
-		if (!fd_table[idx]) {	// 2번부터 빈 공간 선형 탐색
-			fd_table[idx] = file_opened;
-			f->R.rax = idx;		// 유저에게 fd를 넘겨주는 순간
-			thread_current()->fd_count += 1;
-			return;
-		}
+	if (flags & O_DIRECT)
+		file_set_direct (file_opened, true);
+	if ((flags & O_COMPRESS) && !file_set_compressed (file_opened)) {
+		file_close (file_opened);
+		f->R.rax = -1;
+		return;
 	}
 
-	/* should not be reached */
-	NOT_REACHED();
+	/* lowest free fd, 유저에게 fd를 넘겨주는 순간 */
+	fd = fd_alloc (thread_current()->fd_table, file_opened);
+	if (fd < 0)
+		file_close(file_opened);
+	f->R.rax = fd;
 } 
 
 /* 
  * int
  * filesize (int fd)
  */
-void filesize_syscall_handler (struct intr_frame *f) {
-	int fd = f->R.rdi;
-	intptr_t *fd_table = thread_current()->fd_table;
+static uint64_t filesize_leaf (uint64_t fd, uint64_t a2 UNUSED,
+		uint64_t a3 UNUSED) {
+	struct file *file = fd_file (fd);
 
 	/* fd validity check */
-	if (fd < 2 || fd >= FD_MAX || fd_table[fd] == NULL) {
-		f->R.rax = -1;
-		return;
-	}
+	if (file == NULL)
+		return -1;
 
-	lock_acquire(&filesys_lock);
-	int32_t f_len = file_length(fd_table[fd]);
-	lock_release(&filesys_lock);
+	return file_length(file);
+}
 
-	f->R.rax = f_len;
+void filesize_syscall_handler (struct intr_frame *f) {
+	f->R.rax = filesize_leaf (f->R.rdi, f->R.rsi, f->R.rdx);
 } 
 
+/* Most pages of a read() or write() with O_DIRECT moved at once. */
+#define DIRECT_PAGES 16
+
+/* Moves up to SIZE bytes of FILE, opened with O_DIRECT, at its
+ * position straight between the disk and the user pages from
+ * BUFFER, DIRECT_PAGES of them at a time pinned for the purpose,
+ * into BUFFER unless WRITE, and returns the number of bytes moved.
+ * Sets *REST to true if the bytes left must go through the buffer
+ * cache instead: if BUFFER does not start a page, if a page is not
+ * writable user memory, or as file_direct() says. */
+static int32_t
+direct_rw (struct file *file, uint8_t *buffer, unsigned size, bool write,
+		bool *rest) {
+	int32_t moved = 0;
+
+	*rest = pg_ofs (buffer) != 0;
+	while (!*rest && (unsigned) moved < size) {
+		void *kpages[DIRECT_PAGES], *pins[DIRECT_PAGES];
+		unsigned chunk = size - moved < DIRECT_PAGES * PGSIZE
+			? size - moved : DIRECT_PAGES * PGSIZE;
+		size_t cnt = DIV_ROUND_UP (chunk, PGSIZE), i;
+		off_t n = -1;
+
+		for (i = 0; i < cnt; i++) {
+			uint8_t *upage = buffer + moved + i * PGSIZE;
+
+			kpages[i] = pin_user_page (upage, &pins[i]);
+			if (kpages[i] == NULL)
+				break;
+			/* Written through the kernel's mapping, as in ioring.c. */
+			if (!write)
+				pml4_set_dirty (thread_current ()->pml4, upage, true);
+		}
+		if (i == cnt)
+			n = file_direct (file, kpages, chunk, write);
+		while (i-- > 0)
+			unpin_user_page (pins[i]);
+		if (n < 0)
+			*rest = true;
+		else {
+			moved += n;
+			if ((unsigned) n < chunk)
+				break;
+		}
+	}
+	return moved;
+}
+
 /* 
  * int
  * read (int fd, void *buffer, unsigned size)
  */
 void read_syscall_handler (struct intr_frame *f) {
-	assert_valid_address(f->R.rsi);
-
 	int fd = f->R.rdi;
-	char *buffer = f->R.rsi;
+	uint8_t *buffer = (uint8_t *) f->R.rsi;
 	unsigned size = f->R.rdx;
-	intptr_t *fd_table = thread_current()->fd_table;
+	struct file *file = fd_entry (fd);
 	int32_t read_bytes = 0;
-	int i = 0;
+	uint8_t *bounce;
 
-	if (fd == STDIN_FILENO) {
-		while(size-- > 0) {
-			buffer[i++] = (char) input_getc();
-			read_bytes++;
-		}
+	if (!is_user_range (buffer, size))
+		bad_user_pointer ();
+
+	/* fd validity check */
+	if (file == NULL || file == FD_STDOUT) {
+		f->R.rax = -1;
+		return;
 	}
-	else {
-		/* fd validity check */
-		if (fd < 2 || fd >= FD_MAX || fd_table[fd] == NULL) {
-			f->R.rax = -1;
+	if (file != FD_STDIN && file_is_direct (file)) {
+		bool rest;
+
+		read_bytes = direct_rw (file, buffer, size, false, &rest);
+		if (!rest) {
+			f->R.rax = read_bytes;
 			return;
 		}
-		lock_acquire(&filesys_lock);
-		read_bytes = file_read(fd_table[fd], buffer, size);
-		lock_release(&filesys_lock);
 	}
+
+	/* Otherwise data goes through a kernel page and is copied out a
+	   page at a time, so that no page fault happens inside the file
+	   system. */
+	bounce = palloc_get_page (0);
+	if (bounce == NULL) {
+		f->R.rax = -1;
+		return;
+	}
+	while ((unsigned) read_bytes < size) {
+		int32_t chunk = size - read_bytes < PGSIZE ? size - read_bytes : PGSIZE;
+		int32_t n = chunk;
+		uint8_t *src = bounce;
+
+		if (file == FD_STDIN) {
+			for (int i = 0; i < chunk; )
+				i += input_read (bounce + i, chunk - i, false);
+		} else if (chunk != PGSIZE || (src = file_take_page (file)) == NULL) {
+			/* Unless a pipe gave up a whole page of its own. */
+			src = bounce;
+			n = file_read(file, bounce, chunk);
+		}
+		if (!copy_to_user (buffer + read_bytes, src, n)) {
+			if (src != bounce)
+				palloc_free_page (src);
+			palloc_free_page (bounce);
+			bad_user_pointer ();
+		}
+		if (src != bounce)
+			palloc_free_page (src);
+		read_bytes += n;
+		if (n < chunk)
+			break;
+	}
+	palloc_free_page (bounce);
 	f->R.rax = read_bytes;
 } 
 
@@ -293,109 +735,793 @@ void read_syscall_handler (struct intr_frame *f) {
  * write (int fd, const void *buffer, unsigned size)
  */
 void write_syscall_handler (struct intr_frame *f) {
-	assert_valid_address(f->R.rsi);
-
 	int fd = f->R.rdi;
-	const void *buffer = f->R.rsi;
+	const uint8_t *buffer = (const uint8_t *) f->R.rsi;
 	unsigned size = f->R.rdx;
-	intptr_t *fd_table = thread_current()->fd_table;
+	struct file *file = fd_entry (fd);
 	int32_t written_bytes = 0;
+	uint8_t *bounce;
+
+	if (!is_user_range (buffer, size))
+		bad_user_pointer ();
 
-	if (fd == STDOUT_FILENO) {
-		putbuf(buffer, size);
-		written_bytes = size;
+	/* fd validity check */
+	if (file == NULL || file == FD_STDIN) {
+		f->R.rax = -1;
+		return;
 	}
-	else {
-		/* fd validity check */
-		if (fd < 2 || fd >= FD_MAX || fd_table[fd] == NULL) {
-			f->R.rax = -1;
+	if (file != FD_STDOUT && file_is_direct (file)) {
+		bool rest;
+
+		written_bytes = direct_rw (file, (uint8_t *) buffer, size, true,
+				&rest);
+		if (!rest) {
+			f->R.rax = written_bytes;
 			return;
 		}
-		lock_acquire(&filesys_lock);
-		written_bytes = file_write(fd_table[fd], buffer, size);
-		lock_release(&filesys_lock);
 	}
+
+	/* As in read(), through a kernel page. */
+	bounce = palloc_get_page (0);
+	if (bounce == NULL) {
+		f->R.rax = -1;
+		return;
+	}
+	while ((unsigned) written_bytes < size) {
+		int32_t chunk = size - written_bytes < PGSIZE ? size - written_bytes : PGSIZE;
+		int32_t n = chunk;
+
+		if (!copy_from_user (bounce, buffer + written_bytes, chunk)) {
+			palloc_free_page (bounce);
+			bad_user_pointer ();
+		}
+		if (file == FD_STDOUT)
+			putbuf((const char *) bounce, chunk);
+		else if (chunk == PGSIZE && file_give_page (file, bounce)) {
+			/* A pipe took the page itself; continue in a new one. */
+			bounce = palloc_get_page (0);
+			if (bounce == NULL) {
+				written_bytes += n;
+				break;
+			}
+		} else
+			n = file_write(file, bounce, chunk);
+		written_bytes += n;
+		if (n < chunk)
+			break;
+	}
+	palloc_free_page (bounce);
 	f->R.rax = written_bytes;
 } 
 
 /* 
- * void
- * seek (int fd, unsigned position)
+ * int
+ * pread (int fd, void *buffer, unsigned size, off_t offset)
  */
-void seek_syscall_handler (struct intr_frame *f) {
+void pread_syscall_handler (struct intr_frame *f) {
+	struct file *file = fd_file (f->R.rdi);
+	uint8_t *buffer = (uint8_t *) f->R.rsi;
+	unsigned size = f->R.rdx;
+	off_t offset = f->R.r10;
+	int32_t read_bytes = 0;
+	uint8_t *bounce;
+
+	if (!is_user_range (buffer, size))
+		bad_user_pointer ();
+
+	/* fd validity check; the console has no offsets */
+	if (file == NULL || offset < 0) {
+		f->R.rax = -1;
+		return;
+	}
+
+	/* As in read(), but from OFFSET, leaving the file position
+	   alone. */
+	bounce = palloc_get_page (0);
+	if (bounce == NULL) {
+		f->R.rax = -1;
+		return;
+	}
+	while ((unsigned) read_bytes < size) {
+		int32_t chunk = size - read_bytes < PGSIZE ? size - read_bytes : PGSIZE;
+		int32_t n = file_read_at(file, bounce, chunk, offset + read_bytes);
+
+		if (!copy_to_user (buffer + read_bytes, bounce, n)) {
+			palloc_free_page (bounce);
+			bad_user_pointer ();
+		}
+		read_bytes += n;
+		if (n < chunk)
+			break;
+	}
+	palloc_free_page (bounce);
+	f->R.rax = read_bytes;
+}
+
+/* 
+ * int
+ * pwrite (int fd, const void *buffer, unsigned size, off_t offset)
+ */
+void pwrite_syscall_handler (struct intr_frame *f) {
+	struct file *file = fd_file (f->R.rdi);
+	const uint8_t *buffer = (const uint8_t *) f->R.rsi;
+	unsigned size = f->R.rdx;
+	off_t offset = f->R.r10;
+	int32_t written_bytes = 0;
+	uint8_t *bounce;
+
+	if (!is_user_range (buffer, size))
+		bad_user_pointer ();
+
+	/* fd validity check; the console has no offsets */
+	if (file == NULL || offset < 0) {
+		f->R.rax = -1;
+		return;
+	}
+
+	/* As in write(), but at OFFSET. */
+	bounce = palloc_get_page (0);
+	if (bounce == NULL) {
+		f->R.rax = -1;
+		return;
+	}
+	while ((unsigned) written_bytes < size) {
+		int32_t chunk = size - written_bytes < PGSIZE ? size - written_bytes : PGSIZE;
+		int32_t n;
+
+		if (!copy_from_user (bounce, buffer + written_bytes, chunk)) {
+			palloc_free_page (bounce);
+			bad_user_pointer ();
+		}
+		n = file_write_at(file, bounce, chunk, offset + written_bytes);
+		written_bytes += n;
+		if (n < chunk)
+			break;
+	}
+	palloc_free_page (bounce);
+	f->R.rax = written_bytes;
+}
+
+/* 
+ * int
+ * copy_file_range (int in_fd, int out_fd, unsigned len)
+ */
+void copy_file_range_syscall_handler (struct intr_frame *f) {
+	struct file *in = fd_file (f->R.rdi);
+	struct file *out = fd_file (f->R.rsi);
+	unsigned len = f->R.rdx;
+
+	/* fd validity check; the console has no file to copy */
+	if (in == NULL || out == NULL || len > INT32_MAX) {
+		f->R.rax = -1;
+		return;
+	}
+	f->R.rax = file_copy (out, in, len);
+}
+
+/* Copies the IOVCNT iovecs at user address UIOV into a new array,
+   which the caller must free, and stores the total of their sizes
+   into *TOTAL.  Kills the process if UIOV or any of the buffers is
+   a bad pointer; returns a null pointer if IOVCNT is out of range,
+   the total would not fit in the return value, or memory is
+   short. */
+static struct iovec *iovec_from_user (const struct iovec *uiov, int iovcnt,
+		size_t *total) {
+	struct iovec *iov;
+
+	if (iovcnt <= 0 || iovcnt > IOV_MAX)
+		return NULL;
+	iov = malloc (iovcnt * sizeof *iov);
+	if (iov == NULL)
+		return NULL;
+	if (!copy_from_user (iov, uiov, iovcnt * sizeof *iov)) {
+		free (iov);
+		bad_user_pointer ();
+	}
+
+	*total = 0;
+	for (int i = 0; i < iovcnt; i++) {
+		if (!is_user_range (iov[i].iov_base, iov[i].iov_len)) {
+			free (iov);
+			bad_user_pointer ();
+		}
+		*total += iov[i].iov_len;
+		if (iov[i].iov_len > INT32_MAX || *total > INT32_MAX) {
+			free (iov);
+			return NULL;
+		}
+	}
+	return iov;
+}
+
+/* Moves SIZE bytes between the kernel buffer BUF and the user
+   buffers of IOV, starting OFS bytes into IOV[*I], into them if
+   TO_USER and out of them otherwise, and advances *I and *OFS past
+   the bytes moved.  Returns false if a buffer is a bad pointer. */
+static bool iovec_copy (const struct iovec *iov, int *i, size_t *ofs,
+		uint8_t *buf, size_t size, bool to_user) {
+	while (size > 0) {
+		size_t left = iov[*i].iov_len - *ofs;
+		size_t n = size < left ? size : left;
+		uint8_t *ubuf = (uint8_t *) iov[*i].iov_base + *ofs;
+
+		if (!(to_user ? copy_to_user (ubuf, buf, n)
+					: copy_from_user (buf, ubuf, n)))
+			return false;
+		buf += n;
+		size -= n;
+		*ofs += n;
+		if (*ofs == iov[*i].iov_len) {
+			++*i;
+			*ofs = 0;
+		}
+	}
+	return true;
+}
+
+/* 
+ * int
+ * readv (int fd, const struct iovec *iov, int iovcnt)
+ */
+void readv_syscall_handler (struct intr_frame *f) {
 	int fd = f->R.rdi;
-	uintptr_t *fd_table = thread_current()->fd_table;
-	unsigned new_pos = f->R.rsi;
+	struct file *file = fd_entry (fd);
+	struct iovec *iov;
+	size_t total, read_bytes = 0, ofs = 0;
+	int i = 0;
+	uint8_t *bounce;
 
 	/* fd validity check */
-	if (fd < 2 || fd >= FD_MAX || fd_table[fd] == NULL)
-		
-	/* new position validity check */
-	if (new_pos < 0)
+	if (file == NULL || file == FD_STDOUT) {
+		f->R.rax = -1;
+		return;
+	}
+	iov = iovec_from_user ((const struct iovec *) f->R.rsi, f->R.rdx, &total);
+	if (iov == NULL) {
+		f->R.rax = -1;
+		return;
+	}
+
+	/* As in read(), but a page of the file is read at a time and
+	   scattered over as many buffers as it spans. */
+	bounce = palloc_get_page (0);
+	if (bounce == NULL) {
+		free (iov);
+		f->R.rax = -1;
 		return;
-	
-	lock_acquire(&filesys_lock);
-	file_seek(fd_table[fd], new_pos);
-	lock_release(&filesys_lock);
+	}
+	while (read_bytes < total) {
+		size_t chunk = total - read_bytes < PGSIZE ? total - read_bytes : PGSIZE;
+		size_t n = chunk;
+
+		if (file == FD_STDIN) {
+			for (size_t k = 0; k < chunk; )
+				k += input_read (bounce + k, chunk - k, false);
+		} else
+			n = file_read(file, bounce, chunk);
+		if (!iovec_copy (iov, &i, &ofs, bounce, n, true)) {
+			palloc_free_page (bounce);
+			free (iov);
+			bad_user_pointer ();
+		}
+		read_bytes += n;
+		if (n < chunk)
+			break;
+	}
+	palloc_free_page (bounce);
+	free (iov);
+	f->R.rax = read_bytes;
 }
 
 /* 
- * unsigned
- * tell (int fd)
+ * int
+ * writev (int fd, const struct iovec *iov, int iovcnt)
  */
-void tell_syscall_handler (struct intr_frame *f) {
+void writev_syscall_handler (struct intr_frame *f) {
 	int fd = f->R.rdi;
-	uintptr_t *fd_table = thread_current()->fd_table;
-	unsigned position = 0;
+	struct file *file = fd_entry (fd);
+	struct iovec *iov;
+	size_t total, written_bytes = 0, ofs = 0;
+	int i = 0;
+	uint8_t *bounce;
 
 	/* fd validity check */
-	if (fd < 2 || fd >= FD_MAX || fd_table[fd] == NULL) {
+	if (file == NULL || file == FD_STDIN) {
+		f->R.rax = -1;
+		return;
+	}
+	iov = iovec_from_user ((const struct iovec *) f->R.rsi, f->R.rdx, &total);
+	if (iov == NULL) {
 		f->R.rax = -1;
 		return;
 	}
 
-	lock_acquire(&filesys_lock);
-	position = file_tell(fd_table[fd]);
-	lock_release(&filesys_lock);
+	/* The buffers are gathered a page at a time, so that small
+	   pieces of one record go to the file in one write. */
+	bounce = palloc_get_page (0);
+	if (bounce == NULL) {
+		free (iov);
+		f->R.rax = -1;
+		return;
+	}
+	while (written_bytes < total) {
+		size_t chunk = total - written_bytes < PGSIZE ? total - written_bytes : PGSIZE;
+		size_t n = chunk;
+
+		if (!iovec_copy (iov, &i, &ofs, bounce, chunk, false)) {
+			palloc_free_page (bounce);
+			free (iov);
+			bad_user_pointer ();
+		}
+		if (file == FD_STDOUT)
+			putbuf((const char *) bounce, chunk);
+		else
+			n = file_write(file, bounce, chunk);
+		written_bytes += n;
+		if (n < chunk)
+			break;
+	}
+	palloc_free_page (bounce);
+	free (iov);
+	f->R.rax = written_bytes;
+}
 
-	f->R.rax = position;
+/* 
+ * void
+ * seek (int fd, unsigned position)
+ */
+static uint64_t seek_leaf (uint64_t fd, uint64_t new_pos,
+		uint64_t a3 UNUSED) {
+	struct file *file = fd_file (fd);
+
+	/* fd validity check */
+	if (file != NULL)
+		file_seek(file, (unsigned) new_pos);
+	return 0;
+}
+
+void seek_syscall_handler (struct intr_frame *f) {
+	seek_leaf (f->R.rdi, f->R.rsi, f->R.rdx);
+}
+
+/* 
+ * unsigned
+ * tell (int fd)
+ */
+static uint64_t tell_leaf (uint64_t fd, uint64_t a2 UNUSED,
+		uint64_t a3 UNUSED) {
+	struct file *file = fd_file (fd);
+
+	/* fd validity check */
+	if (file == NULL)
+		return -1;
+
+	return file_tell(file);
+}
+
+void tell_syscall_handler (struct intr_frame *f) {
+	f->R.rax = tell_leaf (f->R.rdi, f->R.rsi, f->R.rdx);
 } 
 
 /* 
  * void
  * close (int fd)
  */
+static uint64_t close_leaf (uint64_t fd, uint64_t a2 UNUSED,
+		uint64_t a3 UNUSED) {
+	/* silently fail on a bad fd... */
+	fd_close (thread_current()->fd_table, fd);
+	return 0;
+}
+
 void close_syscall_handler (struct intr_frame *f) {
-	int fd = f->R.rdi;
-	uintptr_t *fd_table = thread_current()->fd_table;
+	close_leaf (f->R.rdi, f->R.rsi, f->R.rdx);
+} 
 
-	/* fd validity check */
-	if (fd < 2 || fd >= FD_MAX || fd_table[fd] == NULL)
-		return;	// silently fail...
+/* 
+ * int
+ * pipe (int fds[2])
+ */
+void pipe_syscall_handler (struct intr_frame *f) {
+	int *ufds = (int *) f->R.rdi;
+	struct fd_table *fd_table = thread_current()->fd_table;
+	struct pipe *pipe;
+	struct file *ends[2] = { NULL, NULL };
+	int fds[2] = { -1, -1 };
+
+	if (!is_user_range (ufds, sizeof fds))
+		bad_user_pointer ();
+
+	f->R.rax = -1;
+	pipe = pipe_create ();
+	if (pipe == NULL)
+		return;
+	ends[0] = file_open_pipe (pipe, false);
+	ends[1] = file_open_pipe (pipe, true);
+	if (ends[0] == NULL || ends[1] == NULL
+			|| (fds[0] = fd_alloc (fd_table, ends[0])) < 0
+			|| (fds[1] = fd_alloc (fd_table, ends[1])) < 0)
+		goto fail;
+	if (!copy_to_user (ufds, fds, sizeof fds))
+		bad_user_pointer ();	// exit closes both ends
+	f->R.rax = 0;
+	return;
+
+fail:
+	/* Closing the last end frees the pipe. */
+	if (fds[0] >= 0)
+		fd_close (fd_table, fds[0]);
+	else
+		file_close (ends[0]);
+	file_close (ends[1]);
+	if (ends[0] == NULL && ends[1] == NULL)
+		free (pipe);
+}
 
-	lock_acquire(&filesys_lock);
-	file_close(fd_table[fd]);
-	lock_release(&filesys_lock);
+/* 
+ * int
+ * getdents (int fd, struct dirent *ents, unsigned cnt)
+ */
+void getdents_syscall_handler (struct intr_frame *f) {
+	struct file *file = fd_file (f->R.rdi);
+	struct dirent *ents = (struct dirent *) f->R.rsi;
+	unsigned cnt = f->R.rdx;
+	struct inode *inode = file != NULL ? file_get_inode (file) : NULL;
+	struct dirent *bounce;
+	struct dir *dir;
+	off_t pos;
+	unsigned stored = 0;
+
+	if (cnt > INT32_MAX / sizeof *ents || !is_user_range (ents, cnt * sizeof *ents))
+		bad_user_pointer ();
+
+	/* fd validity check; only directories have entries */
+	if (inode == NULL || !inode_is_dir (inode)) {
+		f->R.rax = -1;
+		return;
+	}
 
-	fd_table[fd] = NULL;
-	ASSERT(thread_current()->fd_count > 2);
-	thread_current()->fd_count -= 1;
-} 
+	/* A page of entries per pass over the directory, from the file
+	   position on, which is left past the last entry returned. */
+	bounce = palloc_get_page (0);
+	dir = dir_open (inode_reopen (inode));
+	if (bounce == NULL || dir == NULL) {
+		palloc_free_page (bounce);
+		dir_close (dir);
+		f->R.rax = -1;
+		return;
+	}
+	pos = file_tell (file);
+	while (stored < cnt) {
+		unsigned chunk = cnt - stored < PGSIZE / sizeof *ents
+			? cnt - stored : PGSIZE / sizeof *ents;
+		unsigned n = dir_read_entries (dir, &pos, bounce, chunk);
+
+		if (!copy_to_user (ents + stored, bounce, n * sizeof *ents)) {
+			palloc_free_page (bounce);
+			dir_close (dir);
+			bad_user_pointer ();
+		}
+		stored += n;
+		if (n < chunk)
+			break;
+	}
+	file_seek (file, pos);
+	palloc_free_page (bounce);
+	dir_close (dir);
+	f->R.rax = stored;
+}
+
+/* 
+ * int
+ * getrusage (int who, struct rusage *usage)
+ */
+void getrusage_syscall_handler (struct intr_frame *f) {
+	int who = f->R.rdi;
+	struct rusage *usage = (struct rusage *) f->R.rsi;
+	struct thread *curr = thread_current ();
+
+	if (!is_user_range (usage, sizeof *usage))
+		bad_user_pointer ();
+
+	/* children count once they are waited for, as on Unix */
+	if (who != RUSAGE_SELF && who != RUSAGE_CHILDREN) {
+		f->R.rax = -1;
+		return;
+	}
+	if (!copy_to_user (usage, who == RUSAGE_SELF
+				? &curr->rusage : &curr->child_rusage, sizeof *usage))
+		bad_user_pointer ();
+	f->R.rax = 0;
+}
+
+/* 
+ * int
+ * stat (const char *file, struct stat *st)
+ */
+void stat_syscall_handler (struct intr_frame *f) {
+	char *file_name = string_from_user ((const char *) f->R.rdi);
+	struct stat *ust = (struct stat *) f->R.rsi;
+	struct stat st;
+	bool found;
+
+	if (!is_user_range (ust, sizeof *ust)) {
+		palloc_free_page (file_name);
+		bad_user_pointer ();
+	}
+
+	/* The file is looked up but never opened. */
+	found = file_name != NULL && filesys_stat (file_name, &st);
+	palloc_free_page (file_name);
+	if (!found) {
+		f->R.rax = -1;
+		return;
+	}
+	if (!copy_to_user (ust, &st, sizeof st))
+		bad_user_pointer ();
+	f->R.rax = 0;
+}
+
+/* 
+ * int
+ * fstat (int fd, struct stat *st)
+ */
+void fstat_syscall_handler (struct intr_frame *f) {
+	struct file *file = fd_file (f->R.rdi);
+	struct stat *ust = (struct stat *) f->R.rsi;
+	struct stat st;
+
+	if (!is_user_range (ust, sizeof *ust))
+		bad_user_pointer ();
+
+	/* fd validity check; the console and pipes have no inode */
+	if (file == NULL || file_get_inode (file) == NULL) {
+		f->R.rax = -1;
+		return;
+	}
+	inode_stat (file_get_inode (file), &st);
+	if (!copy_to_user (ust, &st, sizeof st))
+		bad_user_pointer ();
+	f->R.rax = 0;
+}
+
+/* 
+ * int
+ * fsync (int fd)
+ */
+void fsync_syscall_handler (struct intr_frame *f) {
+	struct file *file = fd_file (f->R.rdi);
+
+	/* fd validity check; a pipe has nothing to write back */
+	if (file == NULL || file_get_inode (file) == NULL) {
+		f->R.rax = -1;
+		return;
+	}
+	filesys_sync ();
+
+	/* Written data that could not be given sectors is still only
+	 * in memory. */
+	f->R.rax = inode_is_stuck (file_get_inode (file)) ? -1 : 0;
+}
+
+/* 
+ * void
+ * sync (void)
+ */
+void sync_syscall_handler (struct intr_frame *f UNUSED) {
+	filesys_sync ();
+}
+
+/* 
+ * int
+ * fallocate (int fd, off_t len)
+ */
+void fallocate_syscall_handler (struct intr_frame *f) {
+	struct file *file = fd_file (f->R.rdi);
+	off_t len = f->R.rsi;
+
+	/* fd validity check; the console and pipes have no blocks */
+	if (file == NULL || file_get_inode (file) == NULL || len < 0) {
+		f->R.rax = -1;
+		return;
+	}
+	f->R.rax = file_allocate (file, len) ? 0 : -1;
+}
+
+/* 
+ * int
+ * ftruncate (int fd, off_t len)
+ */
+void ftruncate_syscall_handler (struct intr_frame *f) {
+	struct file *file = fd_file (f->R.rdi);
+	off_t len = f->R.rsi;
+
+	/* fd validity check; the console and pipes have no blocks */
+	if (file == NULL || file_get_inode (file) == NULL || len < 0) {
+		f->R.rax = -1;
+		return;
+	}
+	f->R.rax = file_truncate (file, len) ? 0 : -1;
+}
+
+/* 
+ * int
+ * clone_file (const char *src, const char *dst)
+ *
+ * Creates DST sharing the data of SRC, copied on write.
+ */
+void clone_file_syscall_handler (struct intr_frame *f) {
+	char *src = string_from_user ((const char *) f->R.rdi);
+	char *dst = src != NULL
+		? string_from_user ((const char *) f->R.rsi) : NULL;
+	bool success = dst != NULL && filesys_clone (src, dst);
+
+	palloc_free_page (dst);
+	palloc_free_page (src);
+	f->R.rax = success ? 0 : -1;
+}
+
+/* Sets the REVENTS of each of the NFDS descriptors in FDS, open as
+ * FILES, to the events it is ready for, and adds the queues woken
+ * when that changes to those PT waits on.  Returns the number of
+ * descriptors with events. */
+static int
+poll_fds (struct pollfd *fds, struct file **files, unsigned nfds,
+		struct poll_table *pt) {
+	int ready = 0;
+	unsigned i;
+
+	for (i = 0; i < nfds; i++) {
+		unsigned events;
+
+		if (fds[i].fd < 0)
+			events = 0;
+		else if (files[i] == NULL)
+			events = POLLNVAL;
+		else if (files[i] == FD_STDIN)
+			events = input_poll (pt) ? POLLIN : 0;
+		else if (files[i] == FD_STDOUT)
+			events = POLLOUT;
+		else
+			events = file_poll (files[i], pt);
+		fds[i].revents = events
+			& (fds[i].events | POLLERR | POLLHUP | POLLNVAL);
+		if (fds[i].revents != 0)
+			ready++;
+	}
+	return ready;
+}
+
+/* 
+ * int
+ * poll (struct pollfd *fds, unsigned nfds, int timeout)
+ *
+ * Waits until some of the NFDS descriptors in FDS are ready, for
+ * at most TIMEOUT milliseconds unless it is negative, and returns
+ * how many, 0 on timeout.  The thread sleeps on the wait queues of
+ * the pipes and console it polls, with the timeout in the sleep
+ * queue.
+ */
+void poll_syscall_handler (struct intr_frame *f) {
+	struct pollfd *ufds = (struct pollfd *) f->R.rdi;
+	unsigned nfds = f->R.rsi;
+	int timeout = f->R.rdx;
+	struct fd_table *fd_table = thread_current ()->fd_table;
+	struct pollfd *fds;
+	struct file **files;
+	struct poll_entry *entries;
+	struct poll_table pt;
+	int64_t deadline;
+	int ready;
+	unsigned i;
+
+	if (nfds > POLL_MAX) {
+		f->R.rax = -1;
+		return;
+	}
+	if (!is_user_range (ufds, nfds * sizeof *ufds))
+		bad_user_pointer ();
+	fds = malloc (nfds * sizeof *fds + 1);
+	files = malloc (nfds * sizeof *files + 1);
+	entries = malloc (nfds * sizeof *entries + 1);
+	if (fds == NULL || files == NULL || entries == NULL) {
+		free (fds);
+		free (files);
+		free (entries);
+		f->R.rax = -1;
+		return;
+	}
+	if (!copy_from_user (fds, ufds, nfds * sizeof *fds)) {
+		free (fds);
+		free (files);
+		free (entries);
+		bad_user_pointer ();
+	}
+
+	/* Each file is held open until the end, even if another thread
+	 * closes its descriptor. */
+	for (i = 0; i < nfds; i++)
+		files[i] = fds[i].fd >= 0 ? fd_get_dup (fd_table, fds[i].fd) : NULL;
+	deadline = timeout < 0 ? INT64_MAX
+		: timer_ticks () + DIV_ROUND_UP ((int64_t) timeout * TIMER_FREQ, 1000);
+
+	/* Once on the queues, PT stays there, so a wake-up between a
+	 * look and poll_sleep() makes it look again. */
+	poll_table_init (&pt, entries, nfds);
+	ready = poll_fds (fds, files, nfds, timeout != 0 ? &pt : NULL);
+	while (ready == 0 && timer_ticks () < deadline) {
+		poll_sleep (&pt, deadline);
+		ready = poll_fds (fds, files, nfds, NULL);
+	}
+	poll_table_done (&pt);
+
+	for (i = 0; i < nfds; i++)
+		if (files[i] != NULL && !fd_is_console (files[i]))
+			file_close (files[i]);
+	free (files);
+	free (entries);
+	if (!copy_to_user (ufds, fds, nfds * sizeof *fds)) {
+		free (fds);
+		bad_user_pointer ();
+	}
+	free (fds);
+	f->R.rax = ready;
+}
 
 /* 
  * int
  * dup2 (int oldfd, int newfd)
  */
 void dup2_syscall_handler (struct intr_frame *f) {
-
+	/* NEWFD then shares OLDFD's open file, and its position. */
+	f->R.rax = fd_dup2 (thread_current()->fd_table, f->R.rdi, f->R.rsi);
 }  
 
 /* 
  * void *
- * mmap (void *addr, size_t length, int writable, int fd, off_t offset)
+ * mmap_flags (void *addr, size_t length, int writable, int fd,
+ *             off_t offset, int flags)
  */
 void mmap_syscall_handler (struct intr_frame *f) {
+#ifdef VM
+	int fd = f->R.r10;
+	int flags = f->R.r9;
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	struct file *file;
+	void *addr;
+
+	if (flags & ~(MAP_POPULATE | MAP_SHARED)) {
+		f->R.rax = (uint64_t) NULL;
+		return;
+	}
+
+	/* Other threads of the process change its areas one at a
+	 * time too. */
+	lock_acquire (&spt->lock);
+
+	/* Anonymous memory.  File mappings are shared through their
+	 * file already. */
+	if (fd == MMAP_ANON)
+		addr = do_mmap_anon ((void *) f->R.rdi, f->R.rsi, f->R.rdx != 0,
+				(flags & MAP_SHARED) != 0);
+	else {
+		/* fd validity check */
+		file = fd_file (fd);
+		if (file == NULL) {
+			lock_release (&spt->lock);
+			f->R.rax = (uint64_t) NULL;
+			return;
+		}
+		addr = do_mmap((void *) f->R.rdi, f->R.rsi, f->R.rdx, file, f->R.r8);
+	}
 
+	if (addr != NULL && (flags & MAP_POPULATE))
+		vm_populate (vma_find (spt, addr));
+	lock_release (&spt->lock);
+	f->R.rax = (uint64_t) addr;
+#else
+	f->R.rax = (uint64_t) NULL;
+#endif
 }  
 
 /* 
@@ -403,9 +1529,107 @@ void mmap_syscall_handler (struct intr_frame *f) {
  * munmap (void *addr)
  */
 void munmap_syscall_handler (struct intr_frame *f) {
+#ifdef VM
+	struct lock *lock = &thread_current ()->proc->spt.lock;
 
+	lock_acquire (lock);
+	do_munmap((void *) f->R.rdi);
+	lock_release (lock);
+#endif
 }  
 
+/* 
+ * int
+ * msync (void *addr, size_t length)
+ */
+void msync_syscall_handler (struct intr_frame *f) {
+#ifdef VM
+	struct lock *lock = &thread_current ()->proc->spt.lock;
+
+	lock_acquire (lock);
+	f->R.rax = do_msync ((void *) f->R.rdi, f->R.rsi);
+	lock_release (lock);
+#else
+	f->R.rax = -1;
+#endif
+}
+
+/* 
+ * int
+ * madvise (void *addr, size_t length, int advice)
+ */
+void madvise_syscall_handler (struct intr_frame *f) {
+#ifdef VM
+	struct lock *lock = &thread_current ()->proc->spt.lock;
+
+	lock_acquire (lock);
+	f->R.rax = vm_madvise ((void *) f->R.rdi, f->R.rsi, f->R.rdx);
+	lock_release (lock);
+#else
+	f->R.rax = -1;
+#endif
+}
+
+/* 
+ * pid_t
+ * clone (void (*entry) (void (*) (void *), void *),
+ *        void (*func) (void *), void *arg, int *ctid)
+ */
+void clone_syscall_handler (struct intr_frame *f) {
+#ifdef VM
+	f->R.rax = process_clone (f, f->R.rdi, f->R.rsi, f->R.rdx,
+			(int *) f->R.r10);
+#else
+	f->R.rax = TID_ERROR;
+#endif
+}
+
+/* 
+ * void
+ * exit_thread (void)
+ */
+void exit_thread_syscall_handler (struct intr_frame *f UNUSED) {
+	/* The main thread leaving ends the process, as exit (0). */
+	thread_current ()->thread_done = true;
+	thread_exit ();
+}
+
+/* 
+ * int
+ * futex (int *addr, int op, int val)
+ */
+void futex_syscall_handler (struct intr_frame *f) {
+	int *addr = (int *) f->R.rdi;
+	int val = f->R.rdx;
+
+	switch (f->R.rsi) {
+		case FUTEX_WAIT:
+			f->R.rax = futex_wait (addr, val);
+			break;
+		case FUTEX_WAKE:
+			f->R.rax = futex_wake (addr, val);
+			break;
+		default:
+			f->R.rax = -1;
+	}
+}
+
+/* 
+ * struct io_ring *
+ * io_setup (void)
+ */
+void io_setup_syscall_handler (struct intr_frame *f) {
+	f->R.rax = (uint64_t) ioring_setup (thread_current ()->proc);
+}
+
+/* 
+ * int
+ * io_enter (unsigned to_submit, unsigned min_complete)
+ */
+void io_enter_syscall_handler (struct intr_frame *f) {
+	f->R.rax = ioring_enter (thread_current ()->proc, f->R.rdi, f->R.rsi);
+}
+
 /* 
  * bool
  * chdir (const char *dir)
@@ -451,15 +1675,30 @@ void inumber_syscall_handler (struct intr_frame *f) {
  * symlink (const char* target, const char* linkpath)
  */
 void symlink_syscall_handler (struct intr_frame *f) {
-
+	char *target = string_from_user ((const char *) f->R.rdi);
+	char *linkpath = target != NULL
+		? string_from_user ((const char *) f->R.rsi) : NULL;
+	bool success = linkpath != NULL && filesys_symlink (target, linkpath);
+
+	palloc_free_page (linkpath);
+	palloc_free_page (target);
+	f->R.rax = success ? 0 : -1;
 }  
 
 /* 
  * int
- * mount (const char *path, int chan_no, int dev_no)
+ * mount_flags (const char *path, int chan_no, int dev_no, int flags)
  */
 void mount_syscall_handler (struct intr_frame *f) {
-
+	char *path = string_from_user ((const char *) f->R.rdi);
+	int chan_no = f->R.rsi, dev_no = f->R.rdx, flags = f->R.r10;
+	bool success = path != NULL && !(flags & ~MOUNT_FORMAT)
+		&& (chan_no == MOUNT_TMPFS ? filesys_mount_tmpfs (path, dev_no)
+			: filesys_mount (path, chan_no, dev_no,
+				flags & MOUNT_FORMAT));
+
+	palloc_free_page (path);
+	f->R.rax = success ? 0 : -1;
 }  
 
 /* 
@@ -467,6 +1706,10 @@ void mount_syscall_handler (struct intr_frame *f) {
  * umount (const char *path)
  */
 void umount_syscall_handler (struct intr_frame *f) {
+	char *path = string_from_user ((const char *) f->R.rdi);
+	bool success = path != NULL && filesys_umount (path);
 
+	palloc_free_page (path);
+	f->R.rax = success ? 0 : -1;
 } 
 
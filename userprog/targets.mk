@@ -2,5 +2,12 @@ userprog_SRC  = userprog/process.c	# Process loading.
 userprog_SRC += userprog/exception.c	# User exception handler.
 userprog_SRC += userprog/syscall-entry.S # System call entry.
 userprog_SRC += userprog/syscall.c	# System call handler.
+userprog_SRC += userprog/fdtable.c	# File descriptor tables.
+userprog_SRC += userprog/futex.c	# Waiting on user memory.
+userprog_SRC += userprog/vdso.c	# Kernel data mapped into processes.
+userprog_SRC += userprog/ioring.c	# Asynchronous file operations.
+userprog_SRC += userprog/reaper.c	# Deferred teardown of processes.
+userprog_SRC += userprog/usercopy.c	# Copying to and from user memory.
+userprog_SRC += userprog/usercopy-stubs.S # User copy routines.
 userprog_SRC += userprog/gdt.c		# GDT initialization.
 userprog_SRC += userprog/tss.c		# TSS management.
@@ -0,0 +1,120 @@
+/* usercopy.c: Copying between kernel and user memory.
+ *
+ * A user buffer is checked only for lying below KERN_BASE and is
+ * then copied in one go, so valid buffers cost no page table
+ * walks: the MMU checks every byte anyway.  A fault on a page the
+ * VM can bring in is resolved as usual, and the copy goes on.
+ * Any other fault in the copy routines of usercopy-stubs.S resumes
+ * them at a point that reports the failure to the caller. */
+
+#include "userprog/usercopy.h"
+#include <stdint.h>
+#include "threads/interrupt.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
+
+/* In usercopy-stubs.S. */
+size_t usercopy (void *dst, const void *src, size_t size);
+size_t usercopy_str (char *dst, const char *src, size_t size);
+extern const char usercopy_fault[], usercopy_resume[];
+extern const char usercopy_str_fault[], usercopy_str_resume[];
+
+/* Returns true if the SIZE bytes at UADDR all lie in user space. */
+bool
+is_user_range (const void *uaddr, size_t size) {
+	uintptr_t start = (uintptr_t) uaddr;
+
+	return start + size >= start && start + size <= KERN_BASE;
+}
+
+/* Copies SIZE bytes from user address USRC to DST.  Returns false
+ * if they are not all in mapped user memory. */
+bool
+copy_from_user (void *dst, const void *usrc, size_t size) {
+	return is_user_range (usrc, size) && usercopy (dst, usrc, size) == 0;
+}
+
+/* Copies SIZE bytes from SRC to user address UDST.  Returns false
+ * if they are not all in writable user memory. */
+bool
+copy_to_user (void *udst, const void *src, size_t size) {
+	return is_user_range (udst, size) && usercopy (udst, src, size) == 0;
+}
+
+/* Copies the string at user address USRC into DST, which has room
+ * for SIZE bytes, truncating it like strlcpy() if it is longer.
+ * Returns false if the string is not all in mapped user memory. */
+bool
+copy_str_from_user (char *dst, const char *usrc, size_t size) {
+	uintptr_t start = (uintptr_t) usrc;
+	size_t limit, len;
+
+	if (size == 0 || start >= KERN_BASE)
+		return false;
+	limit = KERN_BASE - start < size ? KERN_BASE - start : size;
+	len = usercopy_str (dst, usrc, limit);
+	if (len == SIZE_MAX)
+		return false;
+	if (len == limit) {
+		/* Running into kernel space is a bad pointer, running out
+		 * of room a long string. */
+		if (limit < size)
+			return false;
+		dst[size - 1] = '\0';
+	}
+	return true;
+}
+
+/* Called on a page fault in kernel mode that could not be
+ * resolved.  If it hit one of the copy routines, makes F resume
+ * where that routine returns failure, and returns true. */
+bool
+usercopy_fixup (struct intr_frame *f) {
+	if (f->rip == (uintptr_t) usercopy_fault)
+		f->rip = (uintptr_t) usercopy_resume;
+	else if (f->rip == (uintptr_t) usercopy_str_fault)
+		f->rip = (uintptr_t) usercopy_str_resume;
+	else
+		return false;
+	return true;
+}
+
+/* Returns the kernel address of user address UADDR of the current
+ * process, which stays the same until unpin_user_page() with *PIN,
+ * or a null pointer if UADDR is not in writable user memory.  The
+ * kernel may then use the page while the process is elsewhere. */
+void *
+pin_user_page (void *uaddr, void **pin) {
+	if (!is_user_vaddr (uaddr))
+		return NULL;
+#ifdef VM
+	struct frame *frame = vm_pin_user (uaddr);
+
+	*pin = frame;
+	return frame != NULL
+		? (uint8_t *) frame->kva + pg_ofs (uaddr) : NULL;
+#else
+	/* Without VM, user pages never move. */
+	uint64_t *pte = pml4e_walk (thread_current ()->pml4, (uint64_t) uaddr, 0);
+
+	*pin = NULL;
+	if (pte == NULL || (*pte & (PTE_P | PTE_W)) != (PTE_P | PTE_W))
+		return NULL;
+	return pml4_get_page (thread_current ()->pml4, uaddr);
+#endif
+}
+
+/* Drops the hold of pin_user_page() through PIN. */
+void
+unpin_user_page (void *pin) {
+#ifdef VM
+	vm_unpin_user (pin);
+#else
+	(void) pin;
+#endif
+}
@@ -0,0 +1,62 @@
+/* vdso.c: Pages of kernel data mapped read-only into every process.
+ *
+ * The system-wide page is allocated once and mapped into every
+ * process; the timer keeps its tick count current, so a user
+ * program reads the time with a plain load instead of a trap.
+ * The per-process page is allocated by vdso_map() and freed by
+ * vdso_unmap(), which must run before pml4_destroy() would free
+ * the shared page along with the process's own. */
+
+#include "userprog/vdso.h"
+#include <debug.h>
+#include <vdso.h>
+#include "devices/timer.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+
+/* The page shared by all processes. */
+static struct vdso *vdso;
+
+/* Allocates the shared page and starts the timer updating it.
+ * Must run after timer_calibrate(). */
+void
+vdso_init (void) {
+	vdso = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+	vdso->timer_freq = TIMER_FREQ;
+	vdso->tsc_hz = timer_tsc_hz ();
+	timer_mirror_ticks (&vdso->ticks);
+}
+
+/* Maps the vDSO pages into PML4, for process PID.  Returns false
+ * if memory is exhausted. */
+bool
+vdso_map (uint64_t *pml4, int pid) {
+	struct vdso_proc *proc;
+
+	ASSERT (vdso != NULL);
+
+	proc = palloc_get_page (PAL_ZERO);
+	if (proc == NULL)
+		return false;
+	proc->pid = pid;
+
+	if (!pml4_set_page (pml4, (void *) VDSO_BASE, vdso, false)
+			|| !pml4_set_page (pml4, (void *) VDSO_PROC, proc, false)) {
+		pml4_clear_page (pml4, (void *) VDSO_BASE);
+		palloc_free_page (proc);
+		return false;
+	}
+	return true;
+}
+
+/* Unmaps the vDSO pages from PML4, if mapped, and frees the
+ * process's own. */
+void
+vdso_unmap (uint64_t *pml4) {
+	void *proc = pml4_get_page (pml4, (void *) VDSO_PROC);
+
+	pml4_clear_page (pml4, (void *) VDSO_BASE);
+	pml4_clear_page (pml4, (void *) VDSO_PROC);
+	if (proc != NULL)
+		palloc_free_page (proc);
+}
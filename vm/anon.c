@@ -1,7 +1,18 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
 #include "vm/vm.h"
+#include <bitmap.h>
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "devices/disk.h"
+#include "threads/lock-stats.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/trace.h"
+#include "threads/vaddr.h"
+#include "vm/zswap.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,36 +28,382 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* Number of disk sectors in a swap slot, which holds one page. */
+#define SLOT_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Swap disks, by kernel command-line option "-swap", as a
+ * comma-separated list of hdC:D[:PRIO]. */
+char *swap_disks = "hd1:1";
+
+/* A swap area: one swap disk, holding the global slots from FIRST
+ * to FIRST + bitmap_size (MAP).  Slots are allocated from the
+ * areas of the highest priority that have room, a cluster at a
+ * time, round-robin among areas of equal priority, so that
+ * consecutive clusters go to different disks and are written in
+ * parallel.  Each area's slots in use, and where its next
+ * allocation starts looking, are guarded by SWAP_LOCK; its disk
+ * requests for anon_swap_out_cluster() by LOCK. */
+struct swap_area {
+	struct disk *disk;
+	int prio;
+	size_t first;
+	struct bitmap *map;
+	size_t cursor;
+	struct disk_request reqs[SWAP_CLUSTER_MAX];
+	struct lock lock;
+};
+
+#define SWAP_AREA_MAX 4
+static struct swap_area swap_areas[SWAP_AREA_MAX];  /* By priority. */
+static size_t swap_area_cnt;
+static size_t swap_slot_cnt;        /* Slots in all areas. */
+static size_t swap_turn;            /* Next area of equal priority. */
+
+/* A slot is shared by the pages that shared a frame copy-on-write
+ * when it was swapped out; SLOT_REFS counts them, by global slot.
+ * SWAP_LOCK guards them and the areas' maps. */
+static uint16_t *slot_refs;
+static struct lock swap_lock;
+
+/* Maps LENGTH bytes of zeroed memory at ADDR, writable if
+ * WRITABLE.  Only an area is created; its pages come into being as
+ * they are touched.  If SHARED, the area's memory is shared with the
+ * children forked from now on instead of being copied on write.
+ * Returns ADDR, or a null pointer if the mapping is invalid,
+ * overlaps an existing one or memory is short. */
+void *
+do_mmap_anon (void *addr, size_t length, bool writable, bool shared) {
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	struct vm_area *area;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || length == 0)
+		return NULL;
+	area = vma_create (spt, addr, length, VM_ANON | VM_MMAP, writable,
+			NULL, 0, 0);
+	if (area == NULL)
+		return NULL;
+	if (shared && (area->shmem = shmem_create (DIV_ROUND_UP (length,
+						PGSIZE))) == NULL) {
+		vma_destroy (spt, area);
+		return NULL;
+	}
+	return addr;
+}
+
+/* Adds DISK as a swap area of priority PRIO, areas of higher
+ * priority being used first.  Returns false if DISK is already an
+ * area, there are too many, it is too small for a slot, or memory
+ * is short.  Must be called before slots are allocated. */
+static bool
+swap_area_add (struct disk *disk, int prio) {
+	struct swap_area *a;
+	size_t i;
+
+	if (swap_area_cnt >= SWAP_AREA_MAX
+			|| disk_size (disk) / SLOT_SECTORS == 0)
+		return false;
+	for (i = 0; i < swap_area_cnt; i++)
+		if (swap_areas[i].disk == disk)
+			return false;
+
+	/* Keep the areas sorted by descending priority. */
+	for (i = swap_area_cnt; i > 0 && swap_areas[i - 1].prio < prio; i--)
+		continue;
+	memmove (&swap_areas[i + 1], &swap_areas[i],
+			(swap_area_cnt - i) * sizeof *swap_areas);
+	a = &swap_areas[i];
+	a->disk = disk;
+	a->prio = prio;
+	a->map = bitmap_create (disk_size (disk) / SLOT_SECTORS);
+	a->cursor = 0;
+	if (a->map == NULL) {
+		memmove (&swap_areas[i], &swap_areas[i + 1],
+				(swap_area_cnt - i) * sizeof *swap_areas);
+		return false;
+	}
+	swap_area_cnt++;
+
+	/* Lay out the global slots over the areas in order. */
+	swap_slot_cnt = 0;
+	for (i = 0; i < swap_area_cnt; i++) {
+		swap_areas[i].first = swap_slot_cnt;
+		swap_slot_cnt += bitmap_size (swap_areas[i].map);
+	}
+	return true;
+}
+
+/* Parses "hdC:D[:PRIO]" in S into the disk it names and its
+ * priority, 0 by default.  Returns the disk, or a null pointer if S
+ * is malformed or there is no such disk. */
+static struct disk *
+parse_swap_disk (const char *s, int *prio) {
+	if (s[0] != 'h' || s[1] != 'd' || s[2] < '0' || s[2] > '9'
+			|| s[3] != ':' || s[4] < '0' || s[4] > '1'
+			|| (s[5] != '\0' && s[5] != ':'))
+		return NULL;
+	*prio = s[5] == ':' ? atoi (s + 6) : 0;
+	return disk_get (s[2] - '0', s[4] - '0');
+}
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	char *spec, *s, *save_ptr;
+	size_t i;
+
+	lock_init (&swap_lock);
+	lock_set_name (&swap_lock, "swap");
+
+	spec = malloc (strlen (swap_disks) + 1);
+	if (spec == NULL)
+		PANIC ("swap disk list allocation failed");
+	strlcpy (spec, swap_disks, strlen (swap_disks) + 1);
+	for (s = strtok_r (spec, ",", &save_ptr); s != NULL;
+			s = strtok_r (NULL, ",", &save_ptr)) {
+		struct disk *d;
+		int prio;
+
+		d = parse_swap_disk (s, &prio);
+		if (d == NULL)
+			printf ("swap: no disk \"%s\", skipped\n", s);
+		else if (!swap_area_add (d, prio))
+			printf ("swap: cannot use %s, skipped\n", s);
+	}
+	free (spec);
+	if (swap_area_cnt == 0)
+		return;
+	swap_disk = swap_areas[0].disk;
+	for (i = 0; i < swap_area_cnt; i++)
+		lock_init (&swap_areas[i].lock);
+
+	slot_refs = calloc (swap_slot_cnt, sizeof *slot_refs);
+	if (slot_refs == NULL)
+		PANIC ("swap reference counts allocation failed");
+	zswap_init (swap_slot_cnt);
+}
+
+/* Returns the swap area holding global slot SLOT. */
+static struct swap_area *
+slot_area (size_t slot) {
+	size_t i;
+
+	for (i = swap_area_cnt - 1; i > 0; i--)
+		if (slot >= swap_areas[i].first)
+			break;
+	ASSERT (slot - swap_areas[i].first < bitmap_size (swap_areas[i].map));
+	return &swap_areas[i];
+}
+
+/* Writes the page at KVA to swap slot SLOT on its disk. */
+void
+anon_slot_write (size_t slot, const void *kva) {
+	struct swap_area *a = slot_area (slot);
+
+	disk_write_from (a->disk, (slot - a->first) * SLOT_SECTORS,
+			SLOT_SECTORS, kva, DISK_SRC_SWAP);
+}
+
+/* Allocates CNT consecutive free slots of area A, at its cursor if
+ * possible, and returns the first one as a global slot, or
+ * BITMAP_ERROR if there are none.  SWAP_LOCK must be held. */
+static size_t
+area_alloc (struct swap_area *a, size_t cnt) {
+	size_t slot;
+
+	ASSERT (lock_held_by_current_thread (&swap_lock));
+	slot = bitmap_scan_and_flip (a->map, a->cursor, cnt, false);
+	if (slot == BITMAP_ERROR && a->cursor != 0)
+		slot = bitmap_scan_and_flip (a->map, 0, cnt, false);
+	if (slot == BITMAP_ERROR)
+		return BITMAP_ERROR;
+	a->cursor = slot + cnt;
+	return a->first + slot;
+}
+
+/* Allocates CNT consecutive free slots, all in one area, and
+ * returns the first one, or BITMAP_ERROR if there are none.  Each
+ * allocation goes to the next area of the highest priority with
+ * room, so that consecutive ones are spread over its disks. */
+static size_t
+slot_alloc (size_t cnt) {
+	size_t slot = BITMAP_ERROR;
+	size_t i, j, k;
+
+	if (swap_area_cnt == 0)
+		return BITMAP_ERROR;
+
+	lock_acquire (&swap_lock);
+	for (i = 0; i < swap_area_cnt && slot == BITMAP_ERROR; i = j) {
+		/* Areas I through J - 1 share a priority. */
+		for (j = i + 1; j < swap_area_cnt
+				&& swap_areas[j].prio == swap_areas[i].prio; j++)
+			continue;
+		for (k = 0; k < j - i && slot == BITMAP_ERROR; k++)
+			slot = area_alloc (&swap_areas[i + (swap_turn + k) % (j - i)],
+					cnt);
+	}
+	if (slot != BITMAP_ERROR) {
+		swap_turn++;
+		for (k = 0; k < cnt; k++)
+			slot_refs[slot + k] = 1;
+	}
+	lock_release (&swap_lock);
+
+	return slot;
+}
+
+/* Drops the reference of PAGE to its swap slot, freeing the slot if
+ * it was the last, and takes the page off its owner's swap count.
+ * SWAP_LOCK must be held. */
+static void
+slot_put (struct page *page) {
+	size_t slot = page->anon.slot;
+
+	ASSERT (lock_held_by_current_thread (&swap_lock));
+	ASSERT (slot_refs[slot] > 0);
+	if (--slot_refs[slot] == 0) {
+		struct swap_area *a = slot_area (slot);
+
+		ASSERT (bitmap_test (a->map, slot - a->first));
+		zswap_drop (slot);
+		bitmap_reset (a->map, slot - a->first);
+	}
+	page->anon.slot = BITMAP_ERROR;
+	page->spt->swap_cnt--;
+}
+
+/* Reads swap slot SLOT into the page at KVA, from the compressed
+ * cache if it is there. */
+static void
+slot_read (size_t slot, void *kva) {
+	trace (TRACE_SWAP_IN, slot, 0);
+	if (!zswap_load (slot, kva)) {
+		struct swap_area *a = slot_area (slot);
+
+		disk_read_from (a->disk, (slot - a->first) * SLOT_SECTORS,
+				SLOT_SECTORS, kva, DISK_SRC_SWAP);
+	}
 }
 
 /* Initialize the file mapping */
 bool
-anon_initializer (struct page *page, enum vm_type type, void *kva) {
+anon_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = BITMAP_ERROR;
+	return true;
+}
+
+/* Returns the swap slot holding PAGE, or BITMAP_ERROR if PAGE is
+ * not an anonymous page that was swapped out. */
+size_t
+anon_swap_slot (const struct page *page) {
+	if (VM_TYPE (page->operations->type) != VM_ANON)
+		return BITMAP_ERROR;
+	return page->anon.slot;
+}
+
+/* Makes anonymous page DST, which is not resident, share the swap
+ * slot of SRC, which is swapped out: DST is either another page of
+ * the frame SRC was just evicted from, or the copy of SRC in a
+ * forked child. */
+void
+anon_swap_share (struct page *dst, const struct page *src) {
+	size_t slot = src->anon.slot;
+
+	ASSERT (VM_TYPE (dst->operations->type) == VM_ANON);
+	ASSERT (slot != BITMAP_ERROR);
+
+	lock_acquire (&swap_lock);
+	ASSERT (slot_refs[slot] < UINT16_MAX);
+	slot_refs[slot]++;
+	dst->anon.slot = slot;
+	dst->spt->swap_cnt++;
+	lock_release (&swap_lock);
 }
 
 /* Swap in the page by read contents from the swap disk. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->slot == BITMAP_ERROR)
+		return false;
+	slot_read (anon_page->slot, kva);
+	thread_current ()->rusage.ru_swapins++;
+	lock_acquire (&swap_lock);
+	slot_put (page);
+	lock_release (&swap_lock);
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	return anon_swap_out_cluster (&page, 1);
+}
+
+/* Swaps out the CNT anonymous pages in PAGES, all resident, to
+ * consecutive swap slots on one disk, so that they are written in
+ * one sequential pass: every write is submitted before waiting for
+ * any, and the disk merges them.  Clusters swapped out at the same
+ * time by different threads go to different disks, if there are
+ * several of the same priority.  Pages that the compressed cache
+ * keeps are not written.  Returns false, writing nothing, if swap
+ * has no room for all of them. */
+bool
+anon_swap_out_cluster (struct page *pages[], size_t cnt) {
+	struct swap_area *a;
+	struct disk_request *reqs;
+	size_t slot;
+	size_t i, n = 0;
+
+	ASSERT (cnt <= SWAP_CLUSTER_MAX);
+
+	slot = slot_alloc (cnt);
+	if (slot == BITMAP_ERROR)
+		return false;
+	a = slot_area (slot);
+	reqs = a->reqs;
+	lock_acquire (&a->lock);
+	for (i = 0; i < cnt; i++) {
+		struct anon_page *anon_page = &pages[i]->anon;
+
+		ASSERT (VM_TYPE (pages[i]->operations->type) == VM_ANON);
+		ASSERT (anon_page->slot == BITMAP_ERROR);
+		trace (TRACE_SWAP_OUT, slot + i, 0);
+		anon_page->slot = slot + i;
+		if (zswap_store (slot + i, pages[i]->frame->kva))
+			continue;
+		disk_request_init (&reqs[n], a->disk,
+				(slot + i - a->first) * SLOT_SECTORS, SLOT_SECTORS,
+				pages[i]->frame->kva, true);
+		reqs[n].source = DISK_SRC_SWAP;
+		disk_submit (&reqs[n++]);
+	}
+	for (i = 0; i < n; i++)
+		disk_wait (&reqs[i]);
+	lock_release (&a->lock);
+
+	lock_acquire (&swap_lock);
+	for (i = 0; i < cnt; i++)
+		pages[i]->spt->swap_cnt++;
+	lock_release (&swap_lock);
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	if (anon_page->slot != BITMAP_ERROR) {
+		lock_acquire (&swap_lock);
+		slot_put (page);
+		lock_release (&swap_lock);
+	}
+	vm_release_frame (page);
 }
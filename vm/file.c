@@ -1,7 +1,25 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
+#include <round.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/inode.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 
+/* Flusher: a kernel thread that writes dirty file pages back every
+ * FLUSH_INTERVAL ticks, FLUSH_BATCH at a time, so that eviction
+ * mostly finds them clean and munmap has little left to write.
+ * After FLUSH_ROUNDS full batches it waits for the next round. */
+#define FLUSH_INTERVAL TIMER_FREQ
+#define FLUSH_BATCH 32
+#define FLUSH_ROUNDS 8
+
+static void flusher (void *aux);
+
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
 static void file_backed_destroy (struct page *page);
@@ -19,40 +37,239 @@ void
 vm_file_init (void) {
 }
 
+/* Starts the flusher.  The rest of the VM must be initialized. */
+void
+vm_file_start_flusher (void) {
+	if (thread_create ("flusher", PRI_DEFAULT, flusher, NULL) == TID_ERROR)
+		PANIC ("flusher: cannot create thread");
+}
+
+/* Orders file pages by inode, then by offset.  Files occupy
+ * consecutive sectors, so this is the order of their sectors. */
+static int
+page_sector_cmp (const void *a_, const void *b_) {
+	const struct page *a = *(struct page * const *) a_;
+	const struct page *b = *(struct page * const *) b_;
+	disk_sector_t ia = inode_get_inumber (file_get_inode (a->file.file));
+	disk_sector_t ib = inode_get_inumber (file_get_inode (b->file.file));
+
+	if (ia != ib)
+		return ia < ib ? -1 : 1;
+	if (a->file.offset != b->file.offset)
+		return a->file.offset < b->file.offset ? -1 : 1;
+	return 0;
+}
+
+/* Writes back the CNT pages in PAGES, whose write-back has begun,
+ * in order of their sectors, so that each run of contiguous pages
+ * reaches the disk as one sequential stream of sectors.  Returns
+ * false if a write fell short. */
+static bool
+flush_pages (struct page *pages[], size_t cnt) {
+	bool success = true;
+
+	qsort (pages, cnt, sizeof *pages, page_sector_cmp);
+	for (size_t i = 0; i < cnt; i++) {
+		struct file_page *file_page = &pages[i]->file;
+		bool ok = file_write_at (file_page->file, pages[i]->frame->kva,
+				file_page->read_bytes, file_page->offset)
+			== (off_t) file_page->read_bytes;
+
+		vm_writeback_end (pages[i], ok);
+		success = success && ok;
+	}
+	return success;
+}
+
+/* Flusher thread. */
+static void
+flusher (void *aux UNUSED) {
+	struct page *pages[FLUSH_BATCH];
+
+	for (;;) {
+		size_t cnt, round = 0;
+
+		timer_sleep (FLUSH_INTERVAL);
+		do {
+			cnt = vm_writeback_scan (pages, FLUSH_BATCH);
+			flush_pages (pages, cnt);
+		} while (cnt == FLUSH_BATCH && ++round < FLUSH_ROUNDS);
+	}
+}
+
+/* Writes back the dirty pages of AREA, a file mapping of the
+ * current process, in batches sorted by sector.  Destroying the
+ * pages afterwards then only has pages still in flight in the
+ * flusher to wait for. */
+void
+file_backed_flush_area (struct vm_area *area) {
+	file_backed_flush_range (area, vma_start (area), vma_end (area));
+}
+
+/* Writes back the dirty pages of AREA, a file mapping of the
+ * current process, in [START, END), in batches sorted by sector,
+ * and waits for those of them the flusher is writing back already.
+ * Frames shared copy-on-write are left for eviction or munmap() to
+ * write back, as by the flusher.  Returns false if a write fell
+ * short. */
+bool
+file_backed_flush_range (struct vm_area *area, const void *start,
+		const void *end) {
+	struct list_elem *cursor = list_begin (&area->pages);
+	struct page *pages[FLUSH_BATCH];
+	struct list_elem *e;
+	bool success = true;
+	size_t cnt;
+
+	while ((cnt = vm_writeback_area (area, start, end, &cursor, pages,
+					FLUSH_BATCH)) > 0)
+		success = flush_pages (pages, cnt) && success;
+
+	for (e = list_begin (&area->pages); e != list_end (&area->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, area_elem);
+
+		if (page->va >= start && page->va < end)
+			vm_writeback_wait (page);
+	}
+	return success;
+}
+
 /* Initialize the file backed page */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 
 	struct file_page *file_page = &page->file;
+	ASSERT (page->area != NULL && page->area->file != NULL);
+	file_page->file = page->area->file;
+	vma_page_backing (page, &file_page->offset, &file_page->read_bytes);
+	return true;
 }
 
-/* Swap in the page by read contents from the file. */
+/* Swap in the page by read contents from the file.  Shared clean
+ * pages come from the text cache instead, so this reads past the
+ * page cache. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+	struct file_page *file_page = &page->file;
+
+	if (inode_read_at (file_get_inode (file_page->file), kva,
+				file_page->read_bytes, file_page->offset)
+			!= (off_t) file_page->read_bytes)
+		return false;
+	memset ((uint8_t *) kva + file_page->read_bytes, 0,
+			PGSIZE - file_page->read_bytes);
+	return true;
+}
+
+/* Writes PAGE back to its file if it is resident and has been
+ * modified.  Returns false on a short write. */
+static bool
+file_backed_write_back (struct page *page) {
+	struct file_page *file_page = &page->file;
+	uint64_t *pml4 = page->pml4;
+
+	if (page->frame == NULL || !pml4_is_dirty (pml4, page->va))
+		return true;
+	/* The dirty bit of a 2 MB page stands for all its pages. */
+	if (pml4_split_huge (pml4, page->va))
+		pml4_set_dirty (pml4, page->va, false);
+	return file_write_at (file_page->file, page->frame->kva,
+			file_page->read_bytes, file_page->offset)
+		== (off_t) file_page->read_bytes;
 }
 
 /* Swap out the page by writeback contents to the file. */
 static bool
 file_backed_swap_out (struct page *page) {
 	struct file_page *file_page UNUSED = &page->file;
+
+	return file_backed_write_back (page);
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
 	struct file_page *file_page UNUSED = &page->file;
+
+	vm_writeback_wait (page);
+	file_backed_write_back (page);
+	vm_release_frame (page);
 }
 
-/* Do the mmap */
+/* Do the mmap.  Only an area is created; its pages are read from
+ * FILE as they are touched.  Returns ADDR, or a null pointer if the
+ * mapping is invalid or overlaps an existing one. */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	off_t file_len;
+	size_t read_bytes;
+
+	if (addr == NULL || pg_ofs (addr) != 0 || length == 0
+			|| offset < 0 || offset % PGSIZE != 0)
+		return NULL;
+	file_len = file_length (file);
+	if (file_len == 0)
+		return NULL;
+
+	read_bytes = offset < file_len ? (size_t) (file_len - offset) : 0;
+	if (read_bytes > length)
+		read_bytes = length;
+	if (vma_create (&thread_current ()->proc->spt, addr, length, VM_FILE,
+				writable != 0, file, offset, read_bytes) == NULL)
+		return NULL;
+	return addr;
 }
 
-/* Do the munmap */
+/* Do the msync.  Writes the dirty pages of the file mappings in
+ * the LENGTH bytes at page-aligned ADDR back to their files, with
+ * file_backed_flush_range(); anonymous areas in the range have
+ * nothing to write.  Returns 0 if successful, -1 if the range is
+ * bad, part of it is not mapped or a write fell short. */
+int
+do_msync (void *addr, size_t length) {
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	uintptr_t start = (uintptr_t) addr;
+	uintptr_t end = start + ROUND_UP (length, PGSIZE);
+	uintptr_t covered = start;
+	struct itree_elem *e;
+	bool success = true;
+
+	if (pg_ofs (addr) != 0 || end < start || end > KERN_BASE)
+		return -1;
+
+	/* Areas do not overlap, so they come in order of address. */
+	for (e = itree_first_overlap (&spt->areas, start, end);
+			e != NULL && e->start < end; e = itree_next (e)) {
+		struct vm_area *area = itree_entry (e, struct vm_area, elem);
+
+		if (e->start > covered)
+			success = false;
+		covered = e->end;
+		if (VM_TYPE (area->type) == VM_FILE
+				&& !file_backed_flush_range (area, (void *) start,
+					(void *) end))
+			success = false;
+	}
+	return success && covered >= end ? 0 : -1;
+}
+
+/* Do the munmap.  ADDR must be the start of a mapping; if it
+ * maps a file, its dirty pages are written back to it. */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	struct vm_area *area = vma_find (spt, addr);
+
+	if (area == NULL || vma_start (area) != addr)
+		return;
+	if (VM_TYPE (area->type) == VM_FILE) {
+		file_backed_flush_area (area);
+		vma_destroy (spt, area);
+	} else if (area->type & VM_MMAP)
+		vma_destroy (spt, area);
 }
@@ -0,0 +1,127 @@
+/* prefetch.c: Load-time prefetch of executable text.
+ *
+ * A program that starts up faults in most of its text one page at
+ * a time.  With prefetching enabled, load() reads the page holding
+ * the entry point and the first pages of its segment right away,
+ * in file order and as one batch, instead.  How many pages is
+ * learned per executable: when a process exits, the number of pages
+ * of that segment it actually accessed is folded into a hint kept for the
+ * executable's inode, and the next load of the same program
+ * prefetches that many. */
+
+#include "vm/prefetch.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+bool prefetch_enabled;
+
+/* Number of executables with a hint, and the most pages
+ * prefetched for one. */
+#define HINT_CNT 32
+#define PREFETCH_MAX 32
+
+/* Pages of text used by the last runs of an executable. */
+struct prefetch_hint {
+	disk_sector_t inumber;      /* Inode of the executable. */
+	size_t page_cnt;            /* Pages to prefetch; 0 if unused. */
+};
+
+static struct prefetch_hint hints[HINT_CNT];
+static size_t next_victim;      /* Hint to replace next. */
+static struct lock hint_lock;
+
+/* Initializes the prefetch hints. */
+void
+prefetch_init (void) {
+	lock_init (&hint_lock);
+}
+
+/* Returns the hint for INUMBER, or a null pointer if there is
+ * none.  HINT_LOCK must be held. */
+static struct prefetch_hint *
+hint_find (disk_sector_t inumber) {
+	size_t i;
+
+	for (i = 0; i < HINT_CNT; i++)
+		if (hints[i].page_cnt != 0 && hints[i].inumber == inumber)
+			return &hints[i];
+	return NULL;
+}
+
+/* Prefetches the text of EXEC, just loaded by the current process
+ * with entry point ENTRY: the entry page, then the first pages of
+ * its segment up to the executable's hint. */
+void
+prefetch_load (struct file *exec, void *entry) {
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	struct vm_area *area = vma_find (spt, entry);
+	struct prefetch_hint *hint;
+	size_t page_cnt = 0;
+	uint8_t *upage;
+
+	spt->entry = entry;
+	if (!prefetch_enabled || area == NULL)
+		return;
+
+	lock_acquire (&hint_lock);
+	hint = hint_find (inode_get_inumber (file_get_inode (exec)));
+	if (hint != NULL)
+		page_cnt = hint->page_cnt;
+	lock_release (&hint_lock);
+
+	vm_claim_page (pg_round_down (entry));
+	upage = vma_start (area);
+	if (page_cnt > 1)
+		vm_map_ahead (area, upage, upage + page_cnt * PGSIZE);
+}
+
+/* Records how many pages of the text segment of EXEC the current
+ * process used, for the next run.  Called just before the
+ * process's address space is torn down. */
+void
+prefetch_record (struct file *exec) {
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	struct vm_area *area = vma_find (spt, spt->entry);
+	struct prefetch_hint *hint;
+	disk_sector_t inumber;
+	struct list_elem *e;
+	size_t used = 0;
+
+	if (!prefetch_enabled || exec == NULL || area == NULL)
+		return;
+
+	/* A page counts as used only if the process accessed it: a page
+	 * prefetched and then evicted, or still mapped but never touched,
+	 * does not. */
+	for (e = list_begin (&area->pages); e != list_end (&area->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, area_elem);
+
+		if (page->touched || (page->frame != NULL
+					&& pml4_is_accessed (page->pml4, page->va)))
+			used++;
+	}
+	if (used == 0)
+		return;
+	if (used > PREFETCH_MAX)
+		used = PREFETCH_MAX;
+
+	/* Average with the previous runs, so that one odd run does not
+	 * throw the hint off. */
+	inumber = inode_get_inumber (file_get_inode (exec));
+	lock_acquire (&hint_lock);
+	hint = hint_find (inumber);
+	if (hint == NULL) {
+		hint = &hints[next_victim];
+		next_victim = (next_victim + 1) % HINT_CNT;
+		hint->inumber = inumber;
+		hint->page_cnt = used;
+	} else
+		hint->page_cnt = (hint->page_cnt + used + 1) / 2;
+	lock_release (&hint_lock);
+}
@@ -56,6 +56,18 @@ uninit_initialize (struct page *page, void *kva) {
 		(init ? init (page, aux) : true);
 }
 
+/* Turns PAGE into a page of its final type, like
+ * uninit_initialize(), but leaves the contents of the frame at KVA
+ * alone: PAGE shares a frame that is already filled in. */
+bool
+uninit_adopt (struct page *page, void *kva) {
+	struct uninit_page *uninit = &page->uninit;
+
+	ASSERT (page->operations == &uninit_ops);
+
+	return uninit->page_initializer (page, uninit->type, kva);
+}
+
 /* Free the resources hold by uninit_page. Although most of pages are transmuted
  * to other page objects, it is possible to have uninit pages when the process
  * exit, which are never referenced during the execution.
@@ -63,6 +75,8 @@ uninit_initialize (struct page *page, void *kva) {
 static void
 uninit_destroy (struct page *page) {
 	struct uninit_page *uninit UNUSED = &page->uninit;
-	/* TODO: Fill this function.
-	 * TODO: If you don't have anything to do, just return. */
+
+	/* A page filled along with others may have been given a frame
+	 * before the fill failed. */
+	vm_release_frame (page);
 }
@@ -1,8 +1,130 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <bitmap.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/init.h"
+#include "threads/lock-stats.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "vm/prefetch.h"
+
+/* Caches of struct page and struct frame.  vm_dealloc_page()'s
+ * free() hands pages back to their cache. */
+static struct kmem_cache *page_cache;
+static struct kmem_cache *frame_cache;
+
+/* Frame table: every frame holding a user page is on one of two
+ * lists, oldest first.  Frames used again since they were last
+ * looked at are on the active list; eviction takes victims from
+ * the inactive list, which is refilled from the old end of the
+ * active one.  FRAME_LOCK guards both lists and the link between
+ * each frame and its page. */
+static struct list active_frames;
+static struct list inactive_frames;
+static size_t active_cnt;
+static size_t inactive_cnt;
+static struct lock frame_lock;
+
+/* Signaled, with FRAME_LOCK, when a frame's write-back is done. */
+static struct condition writeback_done;
+
+/* Text cache: the page cache of file contents.  Frames holding
+ * whole pages of files, keyed on the inode and offset they were
+ * read from, so that every process running a program, mapping a
+ * file read-only or reading it maps or copies from the same frame
+ * and the clean page exists once.  A cached frame stays in the
+ * frame table when no page is left on it, holding its inode open,
+ * and is then the cheapest victim of eviction, which it is subject
+ * to like any other frame.  Guarded by FRAME_LOCK. */
+static struct hash text_cache;
+
+/* The zero frame: a frame of zeros, never evicted or freed, that
+ * read faults on untouched zero-filled pages map read-only. */
+static struct frame *zero_frame;
+
+/* Number of inactive frames looked at for a clean file page before
+ * settling for a frame that must be written out. */
+#define EVICT_SCAN 32
+
+/* Maximum number of anonymous pages swapped out together. */
+#define SWAP_BATCH SWAP_CLUSTER_MAX
+
+/* Swap readahead window, in pages: the first after a sequential
+ * fault, and the largest. */
+#define RA_MIN 2
+#define RA_MAX 16
+
+/* Pages of a file mapping read ahead at a time by MAP_POPULATE,
+ * as many as the buffer cache queues for readahead at once. */
+#define POPULATE_WINDOW 4
+
+/* Stack growth.  A fault below the stack grows it if it is at most
+ * STACK_SLACK bytes below the stack pointer, which covers pushes
+ * and the red zone, and leaves at least STACK_GUARD bytes unmapped
+ * between the stack and the area below it.  The whole gap from the
+ * fault up to the old bottom is added to the stack, and up to
+ * STACK_BULK pages of it nearest the fault are mapped right away
+ * from free frames, so that a large frame is not faulted in one
+ * page at a time. */
+#define STACK_LIMIT (1024 * 1024)
+#define STACK_SLACK 128
+#define STACK_GUARD PGSIZE
+#define STACK_BULK 32
+
+/* Stacks of threads started by clone(): areas of THREAD_STACK
+ * bytes, taken one after another down from the lowest address the
+ * main stack may grow to, each with at least STACK_GUARD bytes left
+ * unmapped on either side so that an overflow faults. */
+#define THREAD_STACK (64 * PGSIZE)
+
+size_t fault_around_pages = 8;
+bool huge_pages = true;
+size_t stack_limit = STACK_LIMIT;
+size_t rss_soft_limit = 0;
+size_t rss_hard_limit = 0;
+bool kswapd_enabled = true;
+size_t reclaim_low_pages = 0;
+bool ksm_enabled = true;
+
+/* Background reclaim.  When an allocation leaves fewer than
+ * RECLAIM_LOW free user frames, kswapd is woken to evict in
+ * batches until there are RECLAIM_HIGH, so that faults usually
+ * find a free frame instead of evicting one themselves.  By
+ * default the low watermark is 1/64 of the user pool, within
+ * [RECLAIM_MIN, RECLAIM_MAX], and the high one twice that. */
+#define RECLAIM_MIN SWAP_BATCH
+#define RECLAIM_MAX 256
+static size_t reclaim_low;
+static size_t reclaim_high;
+static struct semaphore kswapd_sema;
+static bool kswapd_awake;
+
+static hash_hash_func text_hash;
+static hash_less_func text_less;
+static void zero_frame_init (void);
+static bool zero_share (struct page *);
+static void fault_around (struct page *);
+static void map_ahead (struct vm_area *, uint8_t *start, uint8_t *end);
+static void area_readahead (struct vm_area *, uint8_t *start, uint8_t *end);
+static bool huge_fault (struct page *, bool *ok);
+static bool claim_with_frame (struct page *, struct frame *);
+static void frame_unpin (struct page *);
+static void kswapd_start (void);
+static void ksm_start (void);
+static struct shmem *shmem_get (struct shmem *);
+static bool shmem_claim (struct page *);
+static void ksm_forget (struct frame *);
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -15,7 +137,24 @@ vm_init (void) {
 #endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	page_cache = kmem_cache_create ("page", sizeof (struct page), 0, NULL);
+	frame_cache = kmem_cache_create ("frame", sizeof (struct frame), 0, NULL);
+	if (page_cache == NULL || frame_cache == NULL)
+		PANIC ("vm cache creation failed");
+	list_init (&active_frames);
+	list_init (&inactive_frames);
+	active_cnt = inactive_cnt = 0;
+	lock_init (&frame_lock);
+	lock_set_name (&frame_lock, "frame");
+	cond_init (&writeback_done);
+	if (!hash_init (&text_cache, text_hash, text_less, NULL))
+		PANIC ("text cache: out of memory");
+	zero_frame_init ();
+	vma_init ();
+	prefetch_init ();
+	vm_file_start_flusher ();
+	kswapd_start ();
+	ksm_start ();
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -33,9 +172,9 @@ page_get_type (struct page *page) {
 }
 
 /* Helpers */
-static struct frame *vm_get_victim (void);
+static struct frame *vm_get_victim (struct supplemental_page_table *owner);
 static bool vm_do_claim_page (struct page *page);
-static struct frame *vm_evict_frame (void);
+static struct frame *vm_evict_frame (struct supplemental_page_table *owner);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -46,15 +185,38 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	ASSERT (VM_TYPE(type) != VM_UNINIT)
 
-	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	bool (*initializer) (struct page *, enum vm_type, void *);
+	struct page *page;
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
 
-		/* TODO: Insert the page into the spt. */
+		page = kmem_cache_alloc (page_cache);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, pg_round_down (upage), init, type, aux, initializer);
+		page->writable = writable;
+		page->pml4 = thread_current ()->pml4;
+		page->spt = spt;
+		page->area = NULL;
+		page->touched = false;
+
+		if (!spt_insert_page (spt, page)) {
+			kmem_cache_free (page_cache, page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
@@ -62,82 +224,837 @@ err:
 
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	struct page key;
+	struct hash_elem *e;
 
-	return page;
+	key.va = pg_round_down (va);
+	e = hash_find (&spt->pages, &key.spt_elem);
+	return e != NULL ? hash_entry (e, struct page, spt_elem) : NULL;
 }
 
 /* Insert PAGE into spt with validation. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt, struct page *page) {
+	ASSERT (pg_ofs (page->va) == 0);
 
-	return succ;
+	return hash_insert (&spt->pages, &page->spt_elem) == NULL;
 }
 
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	hash_delete (&spt->pages, &page->spt_elem);
+	if (page->area != NULL)
+		list_remove (&page->area_elem);
 	vm_dealloc_page (page);
+}
+
+/* Adds FRAME to the tail of the active or inactive list.
+ * FRAME_LOCK must be held. */
+static void
+frame_push (struct frame *frame, bool active) {
+	frame->active = active;
+	if (active) {
+		list_push_back (&active_frames, &frame->elem);
+		active_cnt++;
+	} else {
+		list_push_back (&inactive_frames, &frame->elem);
+		inactive_cnt++;
+	}
+}
+
+/* Removes FRAME from its list.  FRAME_LOCK must be held. */
+static void
+frame_unlink (struct frame *frame) {
+	list_remove (&frame->elem);
+	if (frame->active)
+		active_cnt--;
+	else
+		inactive_cnt--;
+}
+
+/* Makes PAGE share FRAME.  FRAME_LOCK must be held. */
+static void
+frame_attach (struct frame *frame, struct page *page) {
+	if (frame != zero_frame)
+		page->spt->rss++;
+	list_push_back (&frame->pages, &page->frame_elem);
+	frame->share_cnt++;
+	frame->page = list_entry (list_front (&frame->pages), struct page,
+			frame_elem);
+	page->frame = frame;
+}
+
+/* Takes PAGE off FRAME.  FRAME_LOCK must be held. */
+static void
+frame_detach (struct frame *frame, struct page *page) {
+	ASSERT (page->frame == frame);
+
+	if (frame != zero_frame)
+		page->spt->rss--;
+	list_remove (&page->frame_elem);
+	frame->share_cnt--;
+	frame->page = list_empty (&frame->pages) ? NULL
+		: list_entry (list_front (&frame->pages), struct page, frame_elem);
+	page->frame = NULL;
+}
+
+/* Replaces the 2 MB mappings that cover pages sharing FRAME by
+ * 4 kB ones.  Returns false if memory is short. */
+static bool
+frame_split (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (!pml4_split_huge (page->pml4, page->va))
+			return false;
+	}
+	return true;
+}
+
+/* Returns true if FRAME was accessed since the last call, through
+ * the mapping of any page sharing it or through its kernel alias,
+ * and clears all those accessed bits. */
+static bool
+frame_test_and_clear_accessed (struct frame *frame) {
+	bool accessed = pml4_is_accessed (base_pml4, frame->kva);
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (pml4_is_accessed (page->pml4, page->va)) {
+			pml4_set_accessed (page->pml4, page->va, false);
+			page->touched = true;
+			accessed = true;
+		}
+	}
+	if (accessed)
+		pml4_set_accessed (base_pml4, frame->kva, false);
+	return accessed;
+}
+
+/* Returns true if FRAME can be reused without writing it out: it
+ * holds file-backed pages that were not written to, or no page at
+ * all but a cached copy of a file. */
+static bool
+frame_is_clean_file (struct frame *frame) {
+	struct list_elem *e;
+
+	if (frame->page == NULL)
+		return true;
+	if (VM_TYPE (frame->page->operations->type) != VM_FILE
+			|| pml4_is_dirty (base_pml4, frame->kva))
+		return false;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (pml4_is_dirty (page->pml4, page->va))
+			return false;
+	}
+	return true;
+}
+
+/* Returns true if every page sharing FRAME belongs to OWNER. */
+static bool
+frame_owned_by (struct frame *frame, struct supplemental_page_table *owner) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e))
+		if (list_entry (e, struct page, frame_elem)->spt != owner)
+			return false;
+	return true;
+}
+
+/* Returns true if FRAME holds a page of an area advised to be
+ * read once in order, MADV_SEQUENTIAL, whose accesses therefore do
+ * not count as reuse. */
+static bool
+frame_sequential (const struct frame *frame) {
+	const struct page *page = frame->page;
+
+	return page != NULL && page->area != NULL
+		&& page->area->advice == MADV_SEQUENTIAL;
+}
+
+/* Moves frames from the old end of the active list to the inactive
+ * list until the inactive list is at least as long, giving those
+ * accessed since the last pass another round on the active list.
+ * Each frame is looked at once at most.  FRAME_LOCK must be held. */
+static void
+refill_inactive (void) {
+	size_t budget = active_cnt;
+
+	while (inactive_cnt < active_cnt && budget-- > 0) {
+		struct frame *frame = list_entry (list_front (&active_frames),
+				struct frame, elem);
+		bool pinned = frame->pin_cnt > 0;
+		bool accessed = !pinned
+			&& (frame->page != NULL || frame->inode != NULL)
+			&& frame_test_and_clear_accessed (frame)
+			&& !frame_sequential (frame);
+
+		frame_unlink (frame);
+		frame_push (frame, accessed || pinned);
+	}
+}
+
+/* Get the struct frame, that will be evicted.
+ *
+ * Scans the inactive list from its old end.  Frames accessed since
+ * they were deactivated are promoted back to the active list, and
+ * pinned ones are rotated out of the way.  Among the rest, the
+ * first clean file page is taken, since dropping it costs no I/O;
+ * pages of MADV_SEQUENTIAL areas are not promoted for having been
+ * used, since they are not used again;
+ * if none turns up within EVICT_SCAN frames, the oldest frame seen
+ * is taken instead.  The victim stays on the inactive list.
+ * If OWNER is not null, only frames whose pages all belong to OWNER
+ * are considered, which leaves out cached frames without pages;
+ * the others are left as they are.
+ * Returns a null pointer if every frame is pinned or in use.
+ * FRAME_LOCK must be held. */
+static struct frame *
+vm_get_victim (struct supplemental_page_table *owner) {
+	struct frame *fallback = NULL;
+	size_t budget, seen = 0;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	refill_inactive ();
+	budget = active_cnt + inactive_cnt;
+	while (budget-- > 0 && !list_empty (&inactive_frames)) {
+		struct frame *frame = list_entry (list_front (&inactive_frames),
+				struct frame, elem);
+
+		frame_unlink (frame);
+		if (frame->pin_cnt > 0
+				|| (frame->page == NULL
+					&& (frame->inode == NULL || owner != NULL))
+				|| (owner != NULL && !frame_owned_by (frame, owner))) {
+			frame_push (frame, false);
+			continue;
+		}
+		if (frame_test_and_clear_accessed (frame)
+				&& !frame_sequential (frame)) {
+			frame_push (frame, true);
+			if (list_empty (&inactive_frames))
+				refill_inactive ();
+			continue;
+		}
+		frame_push (frame, false);
+		/* Eviction works on 4 kB mappings. */
+		if (!frame_split (frame))
+			continue;
+		if (frame_is_clean_file (frame))
+			return frame;
+		if (fallback == NULL)
+			fallback = frame;
+		if (++seen >= EVICT_SCAN)
+			break;
+	}
+	return fallback;
+}
+
+/* Unmaps the pages sharing FRAME, so that they fault instead of
+ * writing while the frame is being written out, and returns
+ * whether any was dirty.  The dirty bits survive in the
+ * not-present PTEs. */
+static bool
+frame_unmap (struct frame *frame) {
+	bool dirty = false;
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		dirty = dirty || pml4_is_dirty (page->pml4, page->va);
+		pml4_clear_page (page->pml4, page->va);
+	}
+	return dirty;
+}
+
+/* Maps the pages sharing FRAME back after a failed swap-out,
+ * marking them DIRTY, and makes the frame active so that other
+ * frames are tried first.  FRAME_LOCK must be held. */
+static void
+frame_remap (struct frame *frame, bool dirty) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		pml4_set_page (page->pml4, page->va, frame->kva,
+				page->writable && frame->share_cnt == 1);
+		pml4_set_dirty (page->pml4, page->va, dirty);
+	}
+	frame_unlink (frame);
+	frame_push (frame, true);
+}
+
+/* Gives the one page left on FRAME, found through the reverse
+ * map, write access back once the other pages that shared FRAME
+ * copy-on-write have let go of it, so that its next write does not
+ * fault just to find itself alone.  Shared read-only file frames,
+ * frames being written back and pages not mapped at FRAME are left
+ * alone.  The page keeps its accessed and dirty bits.  FRAME_LOCK
+ * must be held. */
+static void
+frame_unshare (struct frame *frame) {
+	struct page *page = frame->page;
+	bool accessed, dirty;
+
+	if (frame->share_cnt != 1 || frame == zero_frame || frame->shmem
+			|| frame->inode != NULL || frame->writeback || !page->writable
+			|| pml4_is_huge (page->pml4, page->va)
+			|| pml4_get_page (page->pml4, page->va) != frame->kva)
+		return;
+	accessed = pml4_is_accessed (page->pml4, page->va);
+	dirty = pml4_is_dirty (page->pml4, page->va);
+	pml4_set_page (page->pml4, page->va, frame->kva, true);
+	pml4_set_accessed (page->pml4, page->va, accessed);
+	pml4_set_dirty (page->pml4, page->va, dirty);
+}
+
+/* FRAME->page, an anonymous page, was just swapped out.  Points
+ * the other pages sharing FRAME at the same swap slot. */
+static void
+frame_share_slot (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_next (&frame->page->frame_elem);
+			e != list_end (&frame->pages); e = list_next (e))
+		anon_swap_share (list_entry (e, struct page, frame_elem), frame->page);
+}
+
+/* Writes out the pages sharing FRAME, which have been unmapped.
+ * Anonymous pages share one swap slot; file pages are each written
+ * back if dirty.  FRAME_LOCK must be held. */
+static bool
+frame_swap_out (struct frame *frame) {
+	struct list_elem *e;
+
+	if (VM_TYPE (frame->page->operations->type) == VM_ANON) {
+		if (!swap_out (frame->page))
+			return false;
+		frame_share_slot (frame);
+		return true;
+	}
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e))
+		if (!swap_out (list_entry (e, struct page, frame_elem)))
+			return false;
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Removes FRAME from the text cache, if it is there, and closes
+ * the inode the cache held open for it.  FRAME_LOCK must be held. */
+static void
+text_forget (struct frame *frame) {
+	if (frame->inode != NULL) {
+		hash_delete (&text_cache, &frame->text_elem);
+		inode_close (frame->inode);
+		frame->inode = NULL;
+	}
+}
+
+/* Takes every page off FRAME after they were swapped out.
+ * FRAME_LOCK must be held. */
+static void
+frame_evict_pages (struct frame *frame) {
+	while (frame->page != NULL)
+		frame_detach (frame, frame->page);
+	text_forget (frame);
+}
+
+/* Takes FRAME, which holds no page, out of the frame table and
+ * frees it, and returns its page, which the caller must free.
+ * FRAME_LOCK must be held. */
+static void *
+frame_discard (struct frame *frame) {
+	void *kva = frame->kva;
+
+	ASSERT (frame->page == NULL);
+
+	text_forget (frame);
+	ksm_forget (frame);
+	frame_unlink (frame);
+	kmem_cache_free (frame_cache, frame);
+	return kva;
+}
+
+/* Frees FRAME, which holds no page, back to the user pool.
+ * FRAME_LOCK must be held. */
+static void
+frame_free (struct frame *frame) {
+	palloc_free_page (frame_discard (frame));
+}
+
+/* BATCH[0] holds an anonymous victim.  Adds up to MAX - 1 more
+ * anonymous victims of OWNER, if not null, to BATCH, so that they
+ * can be swapped out together, and returns the size of the batch.
+ * FRAME_LOCK must be held. */
+static size_t
+gather_anon_victims (struct frame *batch[], size_t max,
+		struct supplemental_page_table *owner) {
+	size_t cnt = 1, i;
+
+	/* Pinning victims already taken makes vm_get_victim() pass
+	 * them over. */
+	batch[0]->pin_cnt++;
+	while (cnt < max) {
+		struct frame *frame = vm_get_victim (owner);
+
+		if (frame == NULL || frame->page == NULL
+				|| VM_TYPE (frame->page->operations->type) != VM_ANON)
+			break;
+		frame->pin_cnt++;
+		batch[cnt++] = frame;
+	}
+	for (i = 0; i < cnt; i++)
+		batch[i]->pin_cnt--;
+	return cnt;
+}
+
+/* Evict one page and return the corresponding frame.
+ * Return NULL on error.
+ * If OWNER is not null, only pages of OWNER are evicted.
+ *
+ * An anonymous victim is swapped out together with up to
+ * SWAP_BATCH - 1 other anonymous victims, in consecutive swap
+ * slots.  The frames of the others go back to the user pool, where
+ * the next few vm_get_frame() calls find them without evicting. */
 static struct frame *
-vm_get_victim (void) {
+vm_evict_frame (struct supplemental_page_table *owner) {
 	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	size_t tries;
+
+	lock_acquire (&frame_lock);
+	for (tries = active_cnt + inactive_cnt; tries > 0; tries--) {
+		struct frame *batch[SWAP_BATCH];
+		struct page *pages[SWAP_BATCH];
+		bool dirty[SWAP_BATCH];
+		size_t cnt = 1, i;
+		bool success;
+
+		batch[0] = vm_get_victim (owner);
+		if (batch[0] == NULL)
+			break;
+		if (batch[0]->page == NULL) {
+			/* A cached copy of a file that nothing maps. */
+			text_forget (batch[0]);
+			victim = batch[0];
+			victim->pin_cnt = 1;
+			break;
+		}
+		if (VM_TYPE (batch[0]->page->operations->type) == VM_ANON)
+			cnt = gather_anon_victims (batch, SWAP_BATCH, owner);
+		for (i = 0; i < cnt; i++) {
+			pages[i] = batch[i]->page;
+			dirty[i] = frame_unmap (batch[i]);
+		}
+
+		success = cnt > 1 && anon_swap_out_cluster (pages, cnt);
+		if (success) {
+			for (i = 0; i < cnt; i++)
+				frame_share_slot (batch[i]);
+		} else {
+			/* No run of free slots that long: evict just one. */
+			for (i = 1; i < cnt; i++)
+				frame_remap (batch[i], dirty[i]);
+			cnt = 1;
+			success = frame_swap_out (batch[0]);
+		}
+		if (!success) {
+			frame_remap (batch[0], dirty[0]);
+			continue;
+		}
+
+		for (i = 0; i < cnt; i++) {
+			frame_evict_pages (batch[i]);
+			if (i > 0)
+				frame_free (batch[i]);
+		}
+		victim = batch[0];
+		victim->pin_cnt = 1;
+		break;
+	}
+	lock_release (&frame_lock);
 
 	return victim;
 }
 
-/* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
+/* Returns a new pinned frame for KVA, a page from the user pool,
+ * or a null pointer if memory is short. */
 static struct frame *
-vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+frame_wrap (void *kva) {
+	struct frame *frame = kmem_cache_alloc (frame_cache);
 
-	return NULL;
+	if (frame == NULL)
+		return NULL;
+	frame->kva = kva;
+	frame->page = NULL;
+	list_init (&frame->pages);
+	frame->share_cnt = 0;
+	frame->pin_cnt = 1;
+	frame->writeback = false;
+	frame->read_cnt = 0;
+	frame->inode = NULL;
+	frame->checksum = 0;
+	frame->ksm_pass = 0;
+	frame->ksm_listed = false;
+	frame->shmem = false;
+	frame->futex_cnt = 0;
+
+	/* New frames start out inactive: a page touched only once
+	 * is reclaimed before it can push out the working set. */
+	lock_acquire (&frame_lock);
+	frame_push (frame, false);
+	lock_release (&frame_lock);
+	return frame;
+}
+
+/* Reclaim thread: evicts frames back to the user pool whenever it
+ * is woken, until the high watermark is reached or nothing more
+ * can be evicted. */
+static void
+kswapd (void *aux UNUSED) {
+	for (;;) {
+		sema_down (&kswapd_sema);
+		while (palloc_free_count (PAL_USER) < reclaim_high) {
+			struct frame *frame = vm_evict_frame (NULL);
+
+			if (frame == NULL)
+				break;
+			lock_acquire (&frame_lock);
+			frame_free (frame);
+			lock_release (&frame_lock);
+		}
+		/* A wake-up that comes before this is lost, but then the
+		 * next allocation below the watermark wakes us again. */
+		__atomic_store_n (&kswapd_awake, false, __ATOMIC_RELEASE);
+	}
+}
+
+/* Starts kswapd, unless "-no-kswapd" said not to, with watermarks
+ * sized from the user pool unless "-kswapd-low" gave one. */
+static void
+kswapd_start (void) {
+	struct palloc_stats stats;
+
+	if (!kswapd_enabled)
+		return;
+	palloc_get_stats (PAL_USER, &stats);
+	reclaim_low = reclaim_low_pages;
+	if (reclaim_low == 0) {
+		reclaim_low = stats.page_cnt / 64;
+		if (reclaim_low < RECLAIM_MIN)
+			reclaim_low = RECLAIM_MIN;
+		if (reclaim_low > RECLAIM_MAX)
+			reclaim_low = RECLAIM_MAX;
+	}
+	reclaim_high = 2 * reclaim_low;
+	sema_init (&kswapd_sema, 0);
+	if (thread_create ("kswapd", PRI_DEFAULT, kswapd, NULL) == TID_ERROR)
+		PANIC ("kswapd: cannot create thread");
+}
+
+/* Wakes kswapd if the user pool is below the low watermark and it
+ * is not awake already. */
+static void
+kswapd_check (void) {
+	if (reclaim_high != 0 && palloc_free_count (PAL_USER) < reclaim_low
+			&& !__atomic_exchange_n (&kswapd_awake, true, __ATOMIC_ACQ_REL))
+		sema_up (&kswapd_sema);
+}
+
+/* Returns a new pinned frame from the user pool, or a null
+ * pointer if the pool is empty. */
+static struct frame *
+frame_alloc (void) {
+	void *kva = palloc_get_page (PAL_USER);
+	struct frame *frame;
+
+	kswapd_check ();
+	if (kva == NULL)
+		return NULL;
+	frame = frame_wrap (kva);
+	if (frame == NULL)
+		palloc_free_page (kva);
+	return frame;
+}
+
+/* Returns true if SPT holds at least LIMIT frames, if LIMIT is not
+ * 0. */
+static bool
+rss_reached (const struct supplemental_page_table *spt, size_t limit) {
+	return limit != 0 && spt->rss >= limit;
+}
+
+/* Returns a free frame, pinned, for a page of SPT mapped ahead of
+ * use, or a null pointer if there is none or SPT is at its soft
+ * RSS limit. */
+static struct frame *
+frame_alloc_spare (const struct supplemental_page_table *spt) {
+	return rss_reached (spt, spt->rss_soft) ? NULL : frame_alloc ();
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
  * and return it. This always return valid address. That is, if the user pool
  * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * space.
+ * The frame is for a page of SPT.  At its hard RSS limit, SPT gives
+ * up one of its own frames for it, and at its soft limit it does
+ * so rather than evict another process's page.  Only when it has
+ * nothing left to evict is anyone else's page taken.
+ * The frame is returned pinned, so that it is not evicted before
+ * its new page has been read in. */
 static struct frame *
-vm_get_frame (void) {
+vm_get_frame (struct supplemental_page_table *spt) {
 	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+
+	if (rss_reached (spt, spt->rss_hard))
+		frame = vm_evict_frame (spt);
+	if (frame == NULL)
+		frame = frame_alloc ();
+	if (frame == NULL && rss_reached (spt, spt->rss_soft))
+		frame = vm_evict_frame (spt);
+	if (frame == NULL)
+		frame = vm_evict_frame (NULL);
 
 	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
 	return frame;
 }
 
-/* Growing the stack. */
-static void
-vm_stack_growth (void *addr UNUSED) {
+/* Growing the stack.  If a fault at ADDR, with user stack pointer
+ * RSP, is a valid access below the stack of the current process,
+ * extends the stack down to ADDR, maps the page of ADDR and those
+ * above it in bulk, and returns true.  Otherwise returns false. */
+static bool
+vm_stack_growth (void *addr, uintptr_t rsp) {
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	struct vm_area *area = vma_find (spt, (uint8_t *) USER_STACK - 1);
+	uint8_t *upage = pg_round_down (addr);
+	uint8_t *bottom, *end, *va;
+	struct page *page;
+
+	if (area == NULL || !(area->type & VM_STACK))
+		return false;
+	bottom = vma_start (area);
+	if (upage >= bottom || (uintptr_t) addr + STACK_SLACK < rsp
+			|| (uint8_t *) USER_STACK - upage > (ptrdiff_t) spt->stack_limit
+			|| (uintptr_t) upage < STACK_GUARD
+			|| itree_first_overlap (&spt->areas,
+				(uintptr_t) upage - STACK_GUARD, (uintptr_t) bottom) != NULL)
+		return false;
+
+	/* Only anonymous zero pages start out in the area, so moving
+	 * its start changes no page's backing. */
+	itree_remove (&spt->areas, &area->elem);
+	itree_insert (&spt->areas, &area->elem, (uintptr_t) upage, USER_STACK);
+
+	page = vma_populate (area, upage);
+	if (page == NULL || !vm_do_claim_page (page))
+		return false;
+
+	end = upage + STACK_BULK * PGSIZE < bottom
+		? upage + STACK_BULK * PGSIZE : bottom;
+	for (va = upage + PGSIZE; va < end; va += PGSIZE) {
+		struct frame *frame;
+
+		page = vma_populate (area, va);
+		if (page == NULL || (frame = frame_alloc_spare (spt)) == NULL)
+			break;
+		claim_with_frame (page, frame);
+		frame_unpin (page);
+	}
+	return true;
+}
+
+/* Maps a stack for a new thread of the current process, below the
+ * main stack and any other thread's, and returns its top, or a null
+ * pointer if there is no room. */
+void *
+vm_thread_stack_create (void) {
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	uintptr_t top = (USER_STACK - spt->stack_limit - STACK_GUARD) & ~PGMASK;
+	struct vm_area *area = NULL;
+
+	lock_acquire (&spt->lock);
+	while (area == NULL && top >= THREAD_STACK + 2 * STACK_GUARD) {
+		uintptr_t bottom = top - THREAD_STACK;
+		struct itree_elem *e = itree_first_overlap (&spt->areas,
+				bottom - STACK_GUARD, top + STACK_GUARD);
+
+		if (e != NULL)
+			top = (e->start & ~PGMASK) - STACK_GUARD;
+		else if ((area = vma_create (spt, (void *) bottom, THREAD_STACK,
+						VM_ANON, true, NULL, 0, 0)) == NULL)
+			break;
+	}
+	lock_release (&spt->lock);
+	return area != NULL ? vma_end (area) : NULL;
+}
+
+/* Unmaps the thread stack of the current process whose top is
+ * TOP. */
+void
+vm_thread_stack_destroy (void *top) {
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	struct vm_area *area;
+
+	lock_acquire (&spt->lock);
+	area = vma_find (spt, (uint8_t *) top - 1);
+	if (area != NULL && vma_end (area) == top && !(area->type & VM_MMAP))
+		vma_destroy (spt, area);
+	lock_release (&spt->lock);
+}
+
+/* Handle the fault on write_protected page
+ *
+ * PAGE, which is writable, shares its frame copy-on-write, or is
+ * mapped onto the zero frame.  If it is the last page left on a
+ * frame, it just gets write access back; otherwise it is given a
+ * private copy of the frame, and if that leaves one page on the old
+ * frame, that page gets write access back through the reverse map. */
+static bool
+vm_handle_wp (struct page *page) {
+	struct frame *old, *new;
+
+	lock_acquire (&frame_lock);
+	old = page->frame;
+	if (old == NULL) {
+		/* Evicted since the fault: the retried access faults it
+		 * back in. */
+		lock_release (&frame_lock);
+		return true;
+	}
+	if (old->share_cnt == 1 && old != zero_frame) {
+		pml4_set_page (page->pml4, page->va, old->kva, true);
+		lock_release (&frame_lock);
+		return true;
+	}
+	old->pin_cnt++;
+	lock_release (&frame_lock);
+
+	new = vm_get_frame (page->spt);
+	copy_page (new->kva, old->kva);
+	pml4_set_accessed (base_pml4, new->kva, false);
+
+	lock_acquire (&frame_lock);
+	frame_detach (old, page);
+	frame_unshare (old);
+	old->pin_cnt--;
+	frame_attach (new, page);
+	new->pin_cnt--;
+	lock_release (&frame_lock);
+
+	/* The PTE exists, so this cannot fail. */
+	pml4_set_page (page->pml4, page->va, new->kva, true);
+	return true;
+}
+
+/* Returns the page of the current process at VA, creating it if VA
+ * lies in one of its areas but has not been touched yet.  Returns a
+ * null pointer if VA is not mapped. */
+static struct page *
+vm_lookup_page (void *va) {
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	struct page *page = spt_find_page (spt, va);
+
+	if (page == NULL) {
+		struct vm_area *area = vma_find (spt, va);
+		if (area != NULL)
+			page = vma_populate (area, pg_round_down (va));
+	}
+	return page;
+}
+
+/* Returns what bringing in PAGE, which is not present, takes. */
+static enum fault_cause
+fault_cause (struct page *page) {
+	off_t offset;
+	size_t read_bytes;
+
+	switch (VM_TYPE (page->operations->type)) {
+		case VM_UNINIT:
+			if (page->area == NULL)
+				return page_get_type (page) == VM_FILE ? FAULT_FILE : FAULT_MINOR;
+			vma_page_backing (page, &offset, &read_bytes);
+			return read_bytes != 0 ? FAULT_FILE : FAULT_MINOR;
+		case VM_ANON:
+			return page->frame == NULL ? FAULT_SWAP : FAULT_MINOR;
+		case VM_FILE:
+			return page->frame == NULL ? FAULT_FILE : FAULT_MINOR;
+		default:
+			return FAULT_MINOR;
+	}
 }
 
-/* Handle the fault on write_protected page */
+/* Handles a fault at user address ADDR of the current process, as
+ * vm_try_handle_fault() does.  The lock of its supplemental page
+ * table must be held. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present, enum fault_cause *cause) {
+	struct page *page;
+	bool ok;
+
+	page = vm_lookup_page (addr);
+	if (page == NULL) {
+		*cause = FAULT_STACK;
+		return not_present
+			&& vm_stack_growth (addr, user ? f->rsp : thread_current ()->user_rsp);
+	}
+	if (write && !page->writable)
+		return false;
+	page->touched = true;
+
+	/* A protection fault on a writable page is a write to a frame
+	 * shared copy-on-write. */
+	if (!not_present) {
+		*cause = FAULT_COW;
+		return write && vm_handle_wp (page);
+	}
+	*cause = fault_cause (page);
+	if (huge_fault (page, &ok))
+		return ok;
+	if (!write && zero_share (page))
+		return true;
+	if (!vm_do_claim_page (page))
+		return false;
+	fault_around (page);
+	return true;
 }
 
-/* Return true on success */
+/* Return true on success, storing what the fault was into
+ * *CAUSE.  The threads of a process fault one at a time. */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present, enum fault_cause *cause) {
+	struct supplemental_page_table *spt;
+	bool ok;
 
-	return vm_do_claim_page (page);
+	/* Validate the fault.  Kernel threads have no user address
+	 * space. */
+	if (thread_current ()->pml4 == NULL || addr == NULL
+			|| !is_user_vaddr (addr))
+		return false;
+
+	spt = &thread_current ()->proc->spt;
+	lock_acquire (&spt->lock);
+	ok = handle_fault (f, addr, user, write, not_present, cause);
+	lock_release (&spt->lock);
+	return ok;
 }
 
 /* Free the page.
@@ -150,41 +1067,1562 @@ vm_dealloc_page (struct page *page) {
 
 /* Claim the page that allocate on VA. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct page *page = vm_lookup_page (va);
 
+	if (page == NULL)
+		return false;
+	if (page->frame != NULL)
+		return true;
 	return vm_do_claim_page (page);
 }
 
-/* Claim the PAGE and set up the mmu. */
-static bool
-vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+/* Returns the frame of the current process's page at user address
+ * UADDR, faulted in for writing first if need be, with a pin and a
+ * futex waiter counted on it, so that it is neither evicted nor
+ * freed and the kernel address of UADDR stays the same.  Returns a
+ * null pointer if UADDR is not mapped writable. */
+struct frame *
+vm_pin_user (const void *uaddr) {
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	struct frame *frame = NULL;
+	enum fault_cause cause;
+	int tries;
 
-	/* Set links */
-	frame->page = page;
-	page->frame = frame;
+	lock_acquire (&spt->lock);
+	for (tries = 0; frame == NULL && tries < 3; tries++) {
+		struct page *page = vm_lookup_page ((void *) uaddr);
+		bool resident;
+
+		if (page == NULL || !page->writable)
+			break;
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+		/* A frame shared copy-on-write, or the zero frame, is about
+		 * to be replaced by the page's own. */
+		lock_acquire (&frame_lock);
+		resident = page->frame != NULL;
+		if (resident && (page->frame->shmem
+					|| (page->frame->share_cnt == 1
+						&& page->frame != zero_frame))) {
+			frame = page->frame;
+			frame->pin_cnt++;
+			frame->futex_cnt++;
+		}
+		lock_release (&frame_lock);
 
-	return swap_in (page, frame->kva);
+		if (frame == NULL && !handle_fault (NULL, (void *) uaddr, false,
+					true, !resident, &cause))
+			break;
+	}
+	lock_release (&spt->lock);
+	return frame;
 }
 
-/* Initialize new supplemental page table */
+/* Drops the pin of vm_pin_user() on FRAME, freeing it if its pages
+ * went away meanwhile. */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+vm_unpin_user (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	ASSERT (frame->pin_cnt > 0 && frame->futex_cnt > 0);
+	frame->pin_cnt--;
+	if (--frame->futex_cnt == 0 && frame->pin_cnt == 0
+			&& frame->page == NULL && frame->inode == NULL
+			&& frame->read_cnt == 0 && !frame->shmem)
+		frame_free (frame);
+	lock_release (&frame_lock);
 }
 
-/* Copy supplemental page table from src to dst */
-bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+/* Lets the frame of PAGE, if any, be evicted again. */
+static void
+frame_unpin (struct page *page) {
+	lock_acquire (&frame_lock);
+	if (page->frame != NULL) {
+		ASSERT (page->frame->pin_cnt > 0);
+		page->frame->pin_cnt--;
+	}
+	lock_release (&frame_lock);
 }
 
-/* Free the resource hold by the supplemental page table */
-void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+/* Gives PAGE the pinned FRAME, maps it and reads its contents in,
+ * leaving the frame pinned. */
+static bool
+claim_with_frame (struct page *page, struct frame *frame) {
+	/* Set links */
+	lock_acquire (&frame_lock);
+	frame_attach (frame, page);
+	lock_release (&frame_lock);
+
+	if (!pml4_set_page (page->pml4, page->va, frame->kva, page->writable)) {
+		vm_release_frame (page);
+		return false;
+	}
+	if (!swap_in (page, frame->kva))
+		return false;
+
+	/* Reading the contents in went through the kernel alias, which
+	 * is not a use of the page. */
+	pml4_set_accessed (base_pml4, frame->kva, false);
+	return true;
+}
+
+/* Gives PAGE a frame, maps it and reads its contents in, leaving
+ * the frame pinned. */
+static bool
+claim_pinned (struct page *page) {
+	return claim_with_frame (page, vm_get_frame (page->spt));
+}
+
+/* Swap readahead.  PAGE, of the current process, was just read
+ * back from swap slot SLOT.  Faults that follow the previous one
+ * within its readahead window count as sequential and double the
+ * window, up to RA_MAX pages; any other fault closes it.  An area
+ * advised MADV_RANDOM gets no window and one advised
+ * MADV_SEQUENTIAL the largest right away.  The following pages of
+ * the window whose contents are in the slots right after SLOT are
+ * then read in as well, into free frames only, and left inactive
+ * and unreferenced so that they are the first to go if they are
+ * not used. */
+static void
+swap_readahead (struct page *page, size_t slot) {
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	int advice = page->area != NULL ? page->area->advice : MADV_NORMAL;
+	uint8_t *va = page->va;
+	size_t i;
+
+	if (advice == MADV_RANDOM)
+		spt->ra_window = 0;
+	else if (advice == MADV_SEQUENTIAL)
+		spt->ra_window = RA_MAX;
+	else if (spt->ra_last != NULL && va > (uint8_t *) spt->ra_last
+			&& va <= (uint8_t *) spt->ra_last + (spt->ra_window + 1) * PGSIZE)
+		spt->ra_window = spt->ra_window == 0 ? RA_MIN
+			: spt->ra_window * 2 < RA_MAX ? spt->ra_window * 2 : RA_MAX;
+	else
+		spt->ra_window = 0;
+	spt->ra_last = va;
+
+	for (i = 1; i <= spt->ra_window; i++) {
+		uint8_t *upage = va + i * PGSIZE;
+		struct page *next;
+		struct frame *frame;
+
+		if (!is_user_vaddr (upage))
+			break;
+		next = spt_find_page (spt, upage);
+		if (next == NULL || next->frame != NULL
+				|| anon_swap_slot (next) != slot + i)
+			break;
+		frame = frame_alloc_spare (spt);
+		if (frame == NULL)
+			break;
+		if (claim_with_frame (next, frame))
+			pml4_set_accessed (next->pml4, next->va, false);
+		frame_unpin (next);
+	}
+}
+
+/* Sets up the zero frame.  It is kept off the frame table, so it
+ * is never chosen for eviction, and its pin is never dropped. */
+static void
+zero_frame_init (void) {
+	zero_frame = kmem_cache_alloc (frame_cache);
+	if (zero_frame == NULL)
+		PANIC ("zero frame: out of memory");
+	zero_frame->kva = palloc_get_page (PAL_USER | PAL_ZERO);
+	if (zero_frame->kva == NULL)
+		PANIC ("zero frame: out of memory");
+	zero_frame->page = NULL;
+	list_init (&zero_frame->pages);
+	zero_frame->share_cnt = 0;
+	zero_frame->pin_cnt = 1;
+	zero_frame->writeback = false;
+	zero_frame->read_cnt = 0;
+	zero_frame->inode = NULL;
+	zero_frame->ksm_listed = false;
+	zero_frame->shmem = false;
+	zero_frame->futex_cnt = 0;
+}
+
+/* If PAGE is an untouched anonymous page that would be filled with
+ * zeros, maps it read-only onto the zero frame and returns true.
+ * The first write gives it a frame of its own, in vm_handle_wp(). */
+static bool
+zero_share (struct page *page) {
+	off_t offset;
+	size_t read_bytes;
+
+	if (VM_TYPE (page->operations->type) != VM_UNINIT || page->area == NULL
+			|| VM_TYPE (page->area->type) != VM_ANON
+			|| page->area->shmem != NULL)
+		return false;
+	vma_page_backing (page, &offset, &read_bytes);
+	if (read_bytes != 0)
+		return false;
+
+	lock_acquire (&frame_lock);
+	frame_attach (zero_frame, page);
+	lock_release (&frame_lock);
+	if (!uninit_adopt (page, zero_frame->kva)
+			|| !pml4_set_page (page->pml4, page->va, zero_frame->kva, false)) {
+		vm_release_frame (page);
+		return false;
+	}
+	return true;
+}
+
+/* Returns a hash of the inode and offset of text frame F. */
+static uint64_t
+text_hash (const struct hash_elem *f_, void *aux UNUSED) {
+	const struct frame *f = hash_entry (f_, struct frame, text_elem);
+	uint64_t key[2] = { (uintptr_t) f->inode, f->offset };
+
+	return hash_buf (key, sizeof key, 0);
+}
+
+/* Returns true if text frame A precedes text frame B. */
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct frame *a = hash_entry (a_, struct frame, text_elem);
+	const struct frame *b = hash_entry (b_, struct frame, text_elem);
+
+	if (a->inode != b->inode)
+		return (uintptr_t) a->inode < (uintptr_t) b->inode;
+	return a->offset < b->offset;
+}
+
+/* If PAGE has never been loaded and holds a whole page of a
+ * read-only executable segment or file mapping, stores the inode
+ * and offset it is read from into *INODE and *OFFSET, and the
+ * inode's write generation into *GEN, and returns true. */
+static bool
+text_key (struct page *page, struct inode **inode, off_t *offset,
+		unsigned *gen) {
+	struct vm_area *area = page->area;
+	size_t read_bytes;
+
+	if (VM_TYPE (page->operations->type) != VM_UNINIT || area == NULL
+			|| area->writable || area->file == NULL)
+		return false;
+	vma_page_backing (page, offset, &read_bytes);
+	if (read_bytes != PGSIZE)
+		return false;
+	*inode = file_get_inode (area->file);
+	*gen = inode_write_gen (*inode);
+	return true;
+}
+
+/* Takes FRAME out of the text cache, and frees it if no page is
+ * left on it and nobody has it pinned.  FRAME_LOCK must be held. */
+static void
+text_drop (struct frame *frame) {
+	text_forget (frame);
+	if (frame->page == NULL && frame->pin_cnt == 0)
+		frame_free (frame);
+}
+
+/* Returns the frame of the text cache holding the page of INODE at
+ * OFFSET, pinned, or a null pointer if there is none.  A frame read
+ * before INODE was last written is dropped from the cache
+ * instead. */
+static struct frame *
+text_lookup (struct inode *inode, off_t offset) {
+	struct frame key, *frame = NULL;
+	struct hash_elem *e;
+
+	key.inode = inode;
+	key.offset = offset;
+	lock_acquire (&frame_lock);
+	e = hash_find (&text_cache, &key.text_elem);
+	if (e != NULL) {
+		frame = hash_entry (e, struct frame, text_elem);
+		if (frame->write_gen == inode_write_gen (inode))
+			frame->pin_cnt++;
+		else {
+			text_drop (frame);
+			frame = NULL;
+		}
+	}
+	lock_release (&frame_lock);
+	return frame;
+}
+
+/* Enters FRAME, just read from INODE at OFFSET when its write
+ * generation was GEN, into the text cache, unless it is already
+ * there or another frame got there first.  A removed inode is not
+ * cached, so the cache never holds the last opener of one, whose
+ * close would free its blocks under FRAME_LOCK.  The kernel alias of
+ * FRAME, written by the read, is marked clean, since the contents
+ * are now those of the file.  FRAME_LOCK must be held. */
+static void
+text_enter (struct frame *frame, struct inode *inode, off_t offset,
+		unsigned gen) {
+	if (frame->inode != NULL || inode_is_removed (inode))
+		return;
+	frame->inode = inode;
+	frame->offset = offset;
+	frame->write_gen = gen;
+	if (hash_insert (&text_cache, &frame->text_elem) != NULL) {
+		frame->inode = NULL;
+		return;
+	}
+	inode_reopen (inode);
+	pml4_set_dirty (base_pml4, frame->kva, false);
+}
+
+/* Reads the page of INODE at OFFSET into FRAME, which is pinned and
+ * holds no page, and enters it into the text cache.  Returns false
+ * if the read falls short. */
+static bool
+text_fill (struct frame *frame, struct inode *inode, off_t offset) {
+	unsigned gen = inode_write_gen (inode);
+
+	if (inode_read_at (inode, frame->kva, PGSIZE, offset) != PGSIZE)
+		return false;
+	lock_acquire (&frame_lock);
+	text_enter (frame, inode, offset, gen);
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Unpins FRAME, which was returned by text_lookup() or filled by
+ * text_fill(), freeing it if it holds no page and is not cached.
+ * FRAME_LOCK must be held. */
+static void
+text_unpin (struct frame *frame) {
+	ASSERT (frame->pin_cnt > 0);
+	if (--frame->pin_cnt == 0 && frame->page == NULL && frame->inode == NULL)
+		frame_free (frame);
+}
+
+/* Maps PAGE onto the frame of the text cache holding its contents,
+ * the page of INODE at OFFSET.  If there is none and READ is true,
+ * the page is read into a new frame of the cache first.  Returns
+ * true if successful. */
+static bool
+text_share (struct page *page, struct inode *inode, off_t offset, bool read) {
+	struct frame *frame = text_lookup (inode, offset);
+
+	if (frame == NULL) {
+		if (!read)
+			return false;
+		frame = vm_get_frame (page->spt);
+		if (!text_fill (frame, inode, offset)) {
+			lock_acquire (&frame_lock);
+			text_unpin (frame);
+			lock_release (&frame_lock);
+			return false;
+		}
+	}
+	lock_acquire (&frame_lock);
+	frame_attach (frame, page);
+	lock_release (&frame_lock);
+
+	if (!uninit_adopt (page, frame->kva)
+			|| !pml4_set_page (page->pml4, page->va, frame->kva, false)) {
+		lock_acquire (&frame_lock);
+		frame->pin_cnt--;
+		lock_release (&frame_lock);
+		vm_release_frame (page);
+		return false;
+	}
+	frame_unpin (page);
+	return true;
+}
+
+/* Enters the frame of PAGE, just read from INODE at OFFSET when
+ * its write generation was GEN, into the text cache, unless
+ * another process got there first. */
+static void
+text_publish (struct page *page, struct inode *inode, off_t offset,
+		unsigned gen) {
+	lock_acquire (&frame_lock);
+	if (page->frame != NULL)
+		text_enter (page->frame, inode, offset, gen);
+	lock_release (&frame_lock);
+}
+
+/* Page cache for file reads.  Returns the frame of the text cache
+ * holding the page of INODE at page-aligned OFFSET, which must lie
+ * wholly within INODE, pinned.  If it is not cached and CREATE is
+ * true, it is read into a new frame, evicting another if memory is
+ * short.  Returns a null pointer if the page is not cached and
+ * CREATE is false, or on failure.  The caller copies from the
+ * frame's kva and then releases it with vm_cache_put().  Until
+ * then the frame is not freed, even if it leaves the cache and
+ * the last page on it goes. */
+struct frame *
+vm_cache_get (struct inode *inode, off_t offset, bool create) {
+	struct frame *frame;
+	bool ok = true;
+
+	ASSERT (offset % PGSIZE == 0);
+
+	/* Files are read before the VM is up. */
+	if (frame_cache == NULL)
+		return NULL;
+	frame = text_lookup (inode, offset);
+	if (frame == NULL) {
+		if (!create)
+			return NULL;
+		frame = frame_alloc ();
+		if (frame == NULL)
+			frame = vm_evict_frame (NULL);
+		if (frame == NULL)
+			return NULL;
+		ok = text_fill (frame, inode, offset);
+	}
+
+	lock_acquire (&frame_lock);
+	if (ok)
+		frame->read_cnt++;
+	else
+		text_unpin (frame);
+	lock_release (&frame_lock);
+	return ok ? frame : NULL;
+}
+
+/* Releases FRAME, returned by vm_cache_get(). */
+void
+vm_cache_put (struct frame *frame) {
+	lock_acquire (&frame_lock);
+	ASSERT (frame->read_cnt > 0);
+	frame->read_cnt--;
+	text_unpin (frame);
+	lock_release (&frame_lock);
+}
+
+/* Drops the frames of INODE that no page maps from the text cache,
+ * and takes the others out of it, so that the cache no longer
+ * holds INODE open. */
+void
+vm_cache_drop (struct inode *inode) {
+	struct list *lists[2] = { &active_frames, &inactive_frames };
+	size_t i;
+
+	if (frame_cache == NULL)
+		return;
+	lock_acquire (&frame_lock);
+	for (i = 0; i < 2; i++) {
+		struct list_elem *e = list_begin (lists[i]);
+
+		while (e != list_end (lists[i])) {
+			struct frame *frame = list_entry (e, struct frame, elem);
+
+			e = list_next (e);
+			if (frame->inode == inode)
+				text_drop (frame);
+		}
+	}
+	lock_release (&frame_lock);
+}
+
+/* Fault-around.  PAGE, of the current process, was just faulted
+ * in.  If it is read from a file, the other file-backed pages of
+ * its area in the same window of fault_around_pages pages are
+ * mapped as well: those whose frame is in the text cache by
+ * sharing it, the others by reading them into free frames.  There
+ * is no asynchronous disk I/O to queue the reads on, so they are
+ * done here, but never at the cost of an eviction, and the pages
+ * are left inactive and unreferenced so that they are the first to
+ * go if they are not used.
+ * An area advised MADV_RANDOM gets no fault-around.  In one advised
+ * MADV_SEQUENTIAL the window is twice as long and starts at the
+ * fault, and the file window past it is queued to be read ahead
+ * into the buffer cache. */
+static void
+fault_around (struct page *page) {
+	struct vm_area *area = page->area;
+	size_t window = fault_around_pages * PGSIZE;
+	uint8_t *start, *end, *file_end;
+
+	if (area == NULL || area->file == NULL || fault_around_pages <= 1
+			|| area->advice == MADV_RANDOM)
+		return;
+	file_end = (uint8_t *) vma_start (area)
+		+ ROUND_UP (area->read_bytes, PGSIZE);
+	if (area->advice == MADV_SEQUENTIAL) {
+		window *= 2;
+		start = page->va;
+		end = start + window;
+		if (end < file_end)
+			area_readahead (area, end, end + window);
+	} else {
+		start = (uint8_t *) ROUND_DOWN ((uintptr_t) page->va, window);
+		end = start + window;
+	}
+	if (start < (uint8_t *) vma_start (area))
+		start = vma_start (area);
+	if (end > file_end || end < start)
+		end = file_end;
+	map_ahead (area, start, end);
+}
+
+/* Maps the file-backed pages of AREA, of the current process, in
+ * [START, END) that have no frame yet, for fault_around() and
+ * vm_map_ahead(): by sharing a frame from the text cache, or by
+ * reading them into free frames, never at the cost of an eviction.
+ * The pages are left inactive and unreferenced. */
+static void
+map_ahead (struct vm_area *area, uint8_t *start, uint8_t *end) {
+	uint8_t *upage;
+
+	for (upage = start; upage < end; upage += PGSIZE) {
+		struct page *p;
+		struct frame *frame;
+		struct inode *inode;
+		off_t offset;
+		unsigned gen;
+		bool text;
+
+		p = spt_find_page (&thread_current ()->proc->spt, upage);
+		if (p == NULL)
+			p = vma_populate (area, upage);
+		if (p == NULL || p->frame != NULL
+				|| VM_TYPE (p->operations->type) == VM_ANON)
+			continue;
+
+		text = text_key (p, &inode, &offset, &gen);
+		if (text && text_share (p, inode, offset, false))
+			continue;
+		frame = frame_alloc_spare (p->spt);
+		if (frame == NULL)
+			break;
+		if (claim_with_frame (p, frame)) {
+			pml4_set_accessed (p->pml4, p->va, false);
+			if (text)
+				text_publish (p, inode, offset, gen);
+		}
+		frame_unpin (p);
+	}
+}
+
+/* Maps the file-backed pages of AREA, of the current process, in
+ * [START, END) ahead of any access, as one batch: the reads of the
+ * whole range are queued first, then the pages mapped as
+ * fault-around does, into free frames only, left unreferenced. */
+void
+vm_map_ahead (struct vm_area *area, void *start_, void *end_) {
+	uint8_t *start = start_, *end = end_;
+	uint8_t *file_end = (uint8_t *) vma_start (area)
+		+ ROUND_UP (area->read_bytes, PGSIZE);
+
+	if (area->file == NULL)
+		return;
+	if (start < (uint8_t *) vma_start (area))
+		start = vma_start (area);
+	if (end > file_end)
+		end = file_end;
+	if (start >= end)
+		return;
+	area_readahead (area, start, end);
+	map_ahead (area, start, end);
+}
+
+/* Queues the file contents of the pages of AREA in [START, END) to be
+ * read into the buffer cache, without waiting for them. */
+static void
+area_readahead (struct vm_area *area, uint8_t *start, uint8_t *end) {
+	size_t ofs = start - (uint8_t *) vma_start (area);
+	size_t end_ofs = end - (uint8_t *) vma_start (area);
+
+	if (area->file == NULL || ofs >= area->read_bytes)
+		return;
+	if (end_ofs > area->read_bytes)
+		end_ofs = area->read_bytes;
+	inode_readahead (file_get_inode (area->file), area->offset + ofs,
+			area->offset + end_ofs);
+}
+
+/* MADV_WILLNEED on the pages of AREA, of the current process, in
+ * [START, END).  The file contents are read ahead into the buffer
+ * cache, where the pages find them when they fault.  Swap has no
+ * asynchronous reads, so pages in swap are read back here, into
+ * free frames only, and left inactive and unreferenced as after
+ * swap readahead. */
+static void
+area_willneed (struct vm_area *area, uint8_t *start, uint8_t *end) {
+	struct list_elem *e;
+
+	area_readahead (area, start, end);
+	for (e = list_begin (&area->pages); e != list_end (&area->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, area_elem);
+		struct frame *frame;
+
+		if ((uint8_t *) page->va < start || (uint8_t *) page->va >= end
+				|| page->frame != NULL
+				|| anon_swap_slot (page) == BITMAP_ERROR)
+			continue;
+		frame = frame_alloc_spare (page->spt);
+		if (frame == NULL)
+			break;
+		if (claim_with_frame (page, frame))
+			pml4_set_accessed (page->pml4, page->va, false);
+		frame_unpin (page);
+	}
+}
+
+/* MADV_DONTNEED on the pages of AREA, of the current process, in
+ * [START, END): destroys the pages that were touched, so that they
+ * are created from the area again if they are touched again, and
+ * read as zeros or from the area's file.  Anonymous pages are
+ * dropped with their swap slots, without writing them anywhere;
+ * pages of file mappings are written back first, as by munmap().
+ * Pages of shared memory are only unmapped: their contents stay in
+ * the shared memory, for the other processes.
+ * Returns false if a page could not be dropped. */
+static bool
+area_dontneed (struct vm_area *area, uint8_t *start, uint8_t *end) {
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	struct list_elem *e, *next;
+	bool success = true;
+
+	for (e = list_begin (&area->pages); e != list_end (&area->pages);
+			e = next) {
+		struct page *page = list_entry (e, struct page, area_elem);
+
+		next = list_next (e);
+		if ((uint8_t *) page->va < start || (uint8_t *) page->va >= end
+				|| VM_TYPE (page->operations->type) == VM_UNINIT)
+			continue;
+		/* Pages are unmapped one by one. */
+		if (!pml4_split_huge (page->pml4, page->va)) {
+			success = false;
+			continue;
+		}
+		spt_remove_page (spt, page);
+	}
+	return success;
+}
+
+/* MAP_POPULATE: maps the pages of AREA, just created in the
+ * current process, right away instead of on first touch.  The file
+ * contents are queued to be read ahead one window of
+ * POPULATE_WINDOW pages ahead of the pages being mapped, so that
+ * the disk reads them in long runs while the pages are filled from
+ * the buffer cache instead of being read one fault at a time.
+ * Pages are mapped from free frames only, as by fault-around; the
+ * rest are left to fault in as usual. */
+void
+vm_populate (struct vm_area *area) {
+	uint8_t *upage;
+
+	ASSERT (area != NULL);
+
+	area_readahead (area, vma_start (area),
+			(uint8_t *) vma_start (area) + POPULATE_WINDOW * PGSIZE);
+	for (upage = vma_start (area); upage < (uint8_t *) vma_end (area);
+			upage += PGSIZE) {
+		struct page *p = spt_find_page (&thread_current ()->proc->spt, upage);
+		struct frame *frame;
+		struct inode *inode;
+		off_t offset;
+		unsigned gen;
+		bool text;
+
+		if (pg_no (upage) % POPULATE_WINDOW == 0)
+			area_readahead (area, upage + POPULATE_WINDOW * PGSIZE,
+					upage + 2 * POPULATE_WINDOW * PGSIZE);
+		if (p == NULL)
+			p = vma_populate (area, upage);
+		if (p == NULL)
+			break;
+		if (p->frame != NULL)
+			continue;
+		if (area->shmem != NULL) {
+			if (!shmem_claim (p))
+				break;
+			continue;
+		}
+
+		text = text_key (p, &inode, &offset, &gen);
+		if (text && text_share (p, inode, offset, false))
+			continue;
+		frame = frame_alloc_spare (p->spt);
+		if (frame == NULL)
+			break;
+		if (claim_with_frame (p, frame) && text)
+			text_publish (p, inode, offset, gen);
+		frame_unpin (p);
+	}
+}
+
+/* Gives advice ADVICE, one of MADV_*, on the LENGTH bytes at
+ * page-aligned ADDR in the current process.  The access patterns
+ * are kept per area, so they apply to the whole of every area the
+ * range overlaps; MADV_WILLNEED and MADV_DONTNEED act on the pages
+ * in the range only.  Returns 0 if successful, -1 if the arguments
+ * are bad, part of the range is not mapped or a page could not be
+ * dropped. */
+int
+vm_madvise (void *addr, size_t length, int advice) {
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	uintptr_t start = (uintptr_t) addr;
+	uintptr_t end = start + ROUND_UP (length, PGSIZE);
+	uintptr_t covered = start;
+	struct itree_elem *e;
+	bool success = true;
+
+	if (pg_ofs (addr) != 0 || end < start || end > KERN_BASE
+			|| advice < MADV_NORMAL || advice > MADV_DONTNEED)
+		return -1;
+
+	/* Areas do not overlap, so they come in order of address. */
+	for (e = itree_first_overlap (&spt->areas, start, end);
+			e != NULL && e->start < end; e = itree_next (e)) {
+		struct vm_area *area = itree_entry (e, struct vm_area, elem);
+		uint8_t *s = (uint8_t *) (e->start > start ? e->start : start);
+		uint8_t *t = (uint8_t *) (e->end < end ? e->end : end);
+
+		if (e->start > covered)
+			success = false;
+		covered = e->end;
+		if (advice == MADV_WILLNEED)
+			area_willneed (area, s, t);
+		else if (advice == MADV_DONTNEED)
+			success = area_dontneed (area, s, t) && success;
+		else
+			area->advice = advice;
+	}
+	return success && covered >= end ? 0 : -1;
+}
+
+/* Huge pages.  A not-present fault on a page of a 2 MB aligned
+ * chunk that lies wholly in one area, and none of whose other
+ * pages has been touched yet, fills the whole chunk at once from
+ * one physically contiguous block of free frames and maps it with
+ * a single PDE.  Each 4 kB piece is still a page with a frame of
+ * its own, so the rest of the VM sees no difference, except that
+ * the chunk is split into 4 kB mappings before any of its pages is
+ * evicted, shared copy-on-write or cleaned.  Read-only areas are
+ * left alone, since their pages are shared through the text cache
+ * instead.
+ * Returns false if PAGE does not qualify or memory is short, and
+ * then nothing has changed; otherwise sets *OK to whether
+ * the contents were read in. */
+static bool
+huge_fault (struct page *page, bool *ok) {
+	struct supplemental_page_table *spt = &thread_current ()->proc->spt;
+	struct vm_area *area = page->area;
+	uint8_t *chunk = (uint8_t *) ((uintptr_t) page->va & ~(HUGE_PGSIZE - 1));
+	size_t idx = ((uint8_t *) page->va - chunk) / PGSIZE;
+	size_t i, cnt;
+	uint8_t *kva;
+
+	if (!huge_pages || area == NULL || area->shmem != NULL
+			|| VM_TYPE (page->operations->type) != VM_UNINIT
+			|| !area->writable
+			|| (void *) chunk < vma_start (area)
+			|| (void *) (chunk + HUGE_PGSIZE) > vma_end (area))
+		return false;
+
+	/* Look nearest first, where a touched page most likely is. */
+	for (i = 1; i < HUGE_PGCNT; i++)
+		if ((i <= idx && spt_find_page (spt, chunk + (idx - i) * PGSIZE))
+				|| (idx + i < HUGE_PGCNT
+					&& spt_find_page (spt, chunk + (idx + i) * PGSIZE)))
+			return false;
+
+	kva = palloc_get_aligned (PAL_USER, HUGE_PGCNT, HUGE_PGCNT);
+	if (kva == NULL)
+		return false;
+
+	/* Give every page of the chunk its frame, pinned. */
+	for (cnt = 0; cnt < HUGE_PGCNT; cnt++) {
+		uint8_t *va = chunk + cnt * PGSIZE;
+		struct page *p = cnt == idx ? page : vma_populate (area, va);
+		struct frame *frame = p != NULL ? frame_wrap (kva + cnt * PGSIZE) : NULL;
+
+		if (frame == NULL)
+			break;
+		lock_acquire (&frame_lock);
+		frame_attach (frame, p);
+		lock_release (&frame_lock);
+	}
+
+	if (cnt < HUGE_PGCNT
+			|| !pml4_set_huge_page (page->pml4, chunk, kva, area->writable)) {
+		/* Pages created stay untouched, for 4 kB faults. */
+		for (i = 0; i < HUGE_PGCNT; i++) {
+			if (i < cnt)
+				vm_release_frame (spt_find_page (spt, chunk + i * PGSIZE));
+			else
+				palloc_free_page (kva + i * PGSIZE);
+		}
+		return false;
+	}
+
+	*ok = true;
+	for (i = 0; i < HUGE_PGCNT; i++) {
+		struct page *p = spt_find_page (spt, chunk + i * PGSIZE);
+
+		if (*ok && !swap_in (p, p->frame->kva))
+			*ok = false;
+		pml4_set_accessed (base_pml4, p->frame->kva, false);
+		frame_unpin (p);
+	}
+	return true;
+}
+
+/* Claim the PAGE and set up the mmu. */
+static bool
+vm_do_claim_page (struct page *page) {
+	size_t slot = anon_swap_slot (page);
+	struct inode *inode;
+	off_t offset;
+	unsigned gen;
+	bool text = text_key (page, &inode, &offset, &gen);
+	bool success;
+
+	if (page->area != NULL && page->area->shmem != NULL)
+		return shmem_claim (page);
+
+	/* Read-only text is read from disk by the first process to
+	 * touch it only, into the text cache, if it is not there from
+	 * a read of the file already. */
+	if (text && text_share (page, inode, offset, true))
+		return true;
+
+	success = claim_pinned (page);
+	if (success && text)
+		text_publish (page, inode, offset, gen);
+	frame_unpin (page);
+	if (success && slot != BITMAP_ERROR)
+		swap_readahead (page, slot);
+	return success;
+}
+
+/* Unmaps PAGE, if it is resident, and takes it off its frame,
+ * freeing the frame if no other page shares it.  Page types call
+ * this from their destroy operation. */
+void
+vm_release_frame (struct page *page) {
+	struct frame *frame;
+
+	/* Only the owner gives a page a frame, so a page without one
+	 * stays without. */
+	if (page->frame == NULL)
+		return;
+	lock_acquire (&frame_lock);
+	frame = page->frame;
+	if (frame != NULL) {
+		pml4_clear_page (page->pml4, page->va);
+		frame_detach (frame, page);
+		frame_unshare (frame);
+		if (frame->share_cnt == 0 && frame != zero_frame
+				&& frame->inode == NULL && frame->read_cnt == 0
+				&& !frame->shmem && frame->futex_cnt == 0)
+			frame_free (frame);
+	}
+	lock_release (&frame_lock);
+}
+
+/* Write-back.  A file page about to be written back to its file
+ * has its frame pinned and marked in flight, and its dirty bits
+ * cleared first, so that a write to it during the write-back
+ * dirties it again.  A frame shared copy-on-write is left for
+ * eviction to deal with.  FRAME_LOCK must be held. */
+static bool
+writeback_begin (struct page *page) {
+	struct frame *frame = page->frame;
+
+	if (frame == NULL || frame->share_cnt != 1 || frame->pin_cnt > 0
+			|| VM_TYPE (page->operations->type) != VM_FILE
+			|| !pml4_is_dirty (page->pml4, page->va)
+			|| !pml4_split_huge (page->pml4, page->va))
+		return false;
+	frame->pin_cnt++;
+	frame->writeback = true;
+	pml4_set_dirty (page->pml4, page->va, false);
+	pml4_set_dirty (base_pml4, frame->kva, false);
+	return true;
+}
+
+/* Starts the write-back of up to MAX dirty file pages of any
+ * process, stores them in PAGES and returns how many there are.
+ * Inactive frames, the next to be evicted, come first. */
+size_t
+vm_writeback_scan (struct page *pages[], size_t max) {
+	struct list *lists[] = { &inactive_frames, &active_frames };
+	size_t cnt = 0;
+
+	lock_acquire (&frame_lock);
+	for (size_t i = 0; i < 2; i++) {
+		struct list_elem *e;
+
+		for (e = list_begin (lists[i]); e != list_end (lists[i]) && cnt < max;
+				e = list_next (e)) {
+			struct frame *frame = list_entry (e, struct frame, elem);
+
+			if (frame->page != NULL && writeback_begin (frame->page))
+				pages[cnt++] = frame->page;
+		}
+	}
+	lock_release (&frame_lock);
+	return cnt;
+}
+
+/* Starts the write-back of up to MAX dirty pages of AREA, which
+ * belongs to the current process, in [START, END), from *CURSOR on
+ * in its list of pages, stores them in PAGES and returns how many
+ * there are.  *CURSOR is left where the next call should resume. */
+size_t
+vm_writeback_area (struct vm_area *area, const void *start, const void *end,
+		struct list_elem **cursor, struct page *pages[], size_t max) {
+	size_t cnt = 0;
+
+	lock_acquire (&frame_lock);
+	for (; *cursor != list_end (&area->pages) && cnt < max;
+			*cursor = list_next (*cursor)) {
+		struct page *page = list_entry (*cursor, struct page, area_elem);
+
+		if (page->va >= start && page->va < end && writeback_begin (page))
+			pages[cnt++] = page;
+	}
+	lock_release (&frame_lock);
+	return cnt;
+}
+
+/* Ends the write-back of PAGE, which succeeded if OK. */
+void
+vm_writeback_end (struct page *page, bool ok) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame = page->frame;
+	ASSERT (frame != NULL && frame->writeback);
+	if (!ok)
+		pml4_set_dirty (page->pml4, page->va, true);
+	frame->writeback = false;
+	frame->pin_cnt--;
+	cond_broadcast (&writeback_done, &frame_lock);
+	lock_release (&frame_lock);
+}
+
+/* Waits until PAGE is not being written back. */
+void
+vm_writeback_wait (struct page *page) {
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && page->frame->writeback)
+		cond_wait (&writeback_done, &frame_lock);
+	lock_release (&frame_lock);
+}
+
+/* Returns a hash of page P's va. */
+static uint64_t
+page_hash (const struct hash_elem *p_, void *aux UNUSED) {
+	const struct page *p = hash_entry (p_, struct page, spt_elem);
+
+	return hash_u64 (pg_no (p->va));
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct page *a = hash_entry (a_, struct page, spt_elem);
+	const struct page *b = hash_entry (b_, struct page, spt_elem);
+
+	return a->va < b->va;
+}
+
+/* Initialize new supplemental page table */
+void
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	if (!hash_init (&spt->pages, page_hash, page_less, NULL))
+		PANIC ("supplemental page table: out of memory");
+	lock_init (&spt->lock);
+	itree_init (&spt->areas);
+	spt->ra_last = NULL;
+	spt->ra_window = 0;
+	spt->entry = NULL;
+	spt->stack_limit = stack_limit;
+	spt->rss = 0;
+	spt->swap_cnt = 0;
+	spt->rss_soft = rss_soft_limit;
+	spt->rss_hard = rss_hard_limit;
+}
+
+/* pml4_clone() callback for fork.  Maps the page of the child, in
+ * the supplemental page table AUX, at VA onto the frame it shares
+ * with the parent's, read-only and clean, and makes the parent's
+ * read-only as well, keeping its dirty bit.  Pages the child does
+ * not share, or that were evicted meanwhile, are left unmapped.
+ * FRAME_LOCK must be held. */
+static bool
+share_pte (uint64_t *src_pte, uint64_t *dst_pte, void *va, void *aux) {
+	struct page *page = spt_find_page (aux, va);
+
+	if (page == NULL || page->frame == NULL
+			|| vtop (page->frame->kva) != PTE_ADDR (*src_pte))
+		return true;
+	*src_pte &= ~(uint64_t) PTE_W;
+	*dst_pte = *src_pte & ~(uint64_t) (PTE_D | PTE_A);
+	return true;
+}
+
+/* Copies the pages of SRC_AREA that have been loaded into DST_AREA
+ * of the current process.  Pages never touched are not copied; they
+ * are created from the area on the child's first touch, as in the
+ * parent.
+ * The others share the parent's frame copy-on-write: both sides
+ * map it read-only, and the first to write gets its own copy from
+ * vm_handle_wp(), so fork copies no data.  Swapped-out anonymous
+ * pages share the parent's swap slot, which counts its users, and
+ * are not mapped.  The frames are shared page by page first; the
+ * mappings are then made in one pass over the leaf page tables of
+ * the area. */
+static bool
+copy_area_pages (struct vm_area *dst_area, struct vm_area *src_area) {
+	uint64_t *src_pml4 = NULL;
+	struct list_elem *e;
+	bool success;
+
+	for (e = list_begin (&src_area->pages); e != list_end (&src_area->pages);
+			e = list_next (e)) {
+		struct page *src_page = list_entry (e, struct page, area_elem);
+		struct page *dst_page;
+		struct frame *frame;
+		bool resident;
+
+		if (VM_TYPE (src_page->operations->type) == VM_UNINIT)
+			continue;
+
+		/* The contents come from the parent, so no initializer. */
+		if (!vm_alloc_page_with_initializer (dst_area->type, src_page->va,
+					dst_area->writable, NULL, NULL))
+			return false;
+		dst_page = spt_find_page (&thread_current ()->proc->spt, src_page->va);
+		vma_attach (dst_area, dst_page);
+
+		/* Pin the parent's page.  An anonymous page that was swapped
+		 * out is inherited by its swap slot instead, without reading it
+		 * in: each process reads the slot into a frame of its own on
+		 * its first touch.  Eviction sets the slot before it lets go
+		 * of the frame, both under the lock.  Any other page is
+		 * brought back into memory first if it was evicted. */
+		lock_acquire (&frame_lock);
+		resident = src_page->frame != NULL;
+		if (resident)
+			src_page->frame->pin_cnt++;
+		else if (VM_TYPE (dst_area->type) == VM_ANON
+				&& anon_swap_slot (src_page) != BITMAP_ERROR) {
+			success = uninit_adopt (dst_page, NULL);
+			if (success)
+				anon_swap_share (dst_page, src_page);
+			lock_release (&frame_lock);
+			if (!success)
+				return false;
+			continue;
+		}
+		lock_release (&frame_lock);
+		if (!resident && !claim_pinned (src_page)) {
+			frame_unpin (src_page);
+			return false;
+		}
+		frame = src_page->frame;
+
+		/* Sharing is done page by page. */
+		if (!pml4_split_huge (src_page->pml4, src_page->va)) {
+			frame_unpin (src_page);
+			return false;
+		}
+
+		/* Share the frame.  Initializing the child's page only sets
+		 * up its type, since there is no initializer to run. */
+		lock_acquire (&frame_lock);
+		frame_attach (frame, dst_page);
+		lock_release (&frame_lock);
+		if (!swap_in (dst_page, frame->kva)) {
+			vm_release_frame (dst_page);
+			frame_unpin (src_page);
+			return false;
+		}
+		src_pml4 = src_page->pml4;
+		frame_unpin (src_page);
+	}
+	if (src_pml4 == NULL)
+		return true;
+
+	/* Eviction changes the PTEs of shared frames under the lock. */
+	lock_acquire (&frame_lock);
+	success = pml4_clone (thread_current ()->pml4, src_pml4,
+			vma_start (src_area), vma_end (src_area), share_pte,
+			&thread_current ()->proc->spt);
+	lock_release (&frame_lock);
+	return success;
+}
+
+/* Copy supplemental page table from src to dst */
+bool
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct itree_elem *e;
+
+	dst->entry = src->entry;
+	dst->stack_limit = src->stack_limit;
+	dst->rss_soft = src->rss_soft;
+	dst->rss_hard = src->rss_hard;
+	for (e = itree_first (&src->areas); e != NULL; e = itree_next (e)) {
+		struct vm_area *src_area = itree_entry (e, struct vm_area, elem);
+		struct vm_area *dst_area;
+
+		dst_area = vma_create (dst, vma_start (src_area),
+				(uint8_t *) vma_end (src_area) - (uint8_t *) vma_start (src_area),
+				src_area->type, src_area->writable, src_area->file,
+				src_area->offset, src_area->read_bytes);
+		if (dst_area == NULL)
+			return false;
+		dst_area->advice = src_area->advice;
+		if (src_area->shmem != NULL) {
+			/* The child maps the same frames as it touches them. */
+			dst_area->shmem = shmem_get (src_area->shmem);
+		} else if (!copy_area_pages (dst_area, src_area))
+			return false;
+	}
+	return true;
+}
+
+/* Teardown batch: as many pages as a page-table leaf maps. */
+#define KILL_BATCH (PGSIZE / sizeof (void *))
+
+/* Takes the resident pages of AREA, which is being torn down and
+ * was unmapped with vma_unmap(), off their frames, up to KILL_BATCH
+ * pages per hold of the frame lock, and frees the frames left
+ * unused to palloc in bulk.  Pages that need writing back first,
+ * dirty file pages, and pinned frames are left to their destroy
+ * operation.  BATCH has room for KILL_BATCH pointers. */
+static void
+area_release_frames (struct vm_area *area, void **batch) {
+	struct list_elem *e = list_begin (&area->pages);
+
+	while (e != list_end (&area->pages)) {
+		size_t cnt = 0, seen;
+
+		lock_acquire (&frame_lock);
+		for (seen = 0; e != list_end (&area->pages) && seen < KILL_BATCH;
+				e = list_next (e), seen++) {
+			struct page *page = list_entry (e, struct page, area_elem);
+			struct frame *frame = page->frame;
+
+			if (frame == NULL || frame->pin_cnt > 0
+					|| (VM_TYPE (page->operations->type) == VM_FILE
+						&& pml4_is_dirty (page->pml4, page->va)))
+				continue;
+			frame_detach (frame, page);
+			if (frame->share_cnt == 0 && frame != zero_frame
+					&& frame->inode == NULL)
+				batch[cnt++] = frame_discard (frame);
+		}
+		lock_release (&frame_lock);
+		palloc_free_pages (batch, cnt);
+	}
+}
+
+/* Destroys the page that E is embedded in. */
+static void
+page_kill (struct hash_elem *e, void *aux UNUSED) {
+	vm_dealloc_page (hash_entry (e, struct page, spt_elem));
+}
+
+/* Free the resource hold by the supplemental page table */
+void
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	/* TODO: Destroy all the supplemental_page_table hold by thread and
+	 * TODO: writeback all the modified contents to the storage. */
+	void **batch = palloc_get_page (0);
+	struct itree_elem *e;
+
+	/* Frames go back in bulk; the pages then have little left to
+	 * do but free their swap slots. */
+	for (e = itree_first (&spt->areas); e != NULL; e = itree_next (e)) {
+		struct vm_area *area = itree_entry (e, struct vm_area, elem);
+
+		vma_unmap (area);
+		if (VM_TYPE (area->type) == VM_FILE)
+			file_backed_flush_area (area);
+		if (batch != NULL)
+			area_release_frames (area, batch);
+	}
+	if (batch != NULL)
+		palloc_free_page (batch);
+	hash_clear (&spt->pages, page_kill);
+	vma_kill (spt);
+}
+
+/* Shared anonymous memory: the memory of an area mapped with
+ * MAP_SHARED, which the children forked afterwards map as well
+ * instead of sharing it copy-on-write.  It holds a frame for each of
+ * its pages that a process has touched, created zeroed by the first
+ * and mapped writable into every process as it touches the page, so
+ * that all of them see each other's writes at once.  The frames are
+ * pinned for as long as any process maps the memory: they are never
+ * swapped out, and a process dropping its pages, with munmap(),
+ * MADV_DONTNEED or exit, leaves the contents to the others.  So that
+ * this cannot take up all of memory, shared memory in all is
+ * limited to a quarter of the user pool.  Guarded by FRAME_LOCK. */
+struct shmem {
+	size_t ref_cnt;             /* Number of areas mapping it. */
+	size_t page_cnt;            /* Number of pages. */
+	struct frame **frames;      /* Frame of each page, or null. */
+};
+
+static size_t shmem_pages;      /* Pages of all shared memory. */
+
+/* Returns new shared memory of PAGE_CNT pages, for one area, or a
+ * null pointer if memory is short or shared memory would exceed its
+ * limit. */
+struct shmem *
+shmem_create (size_t page_cnt) {
+	struct palloc_stats stats;
+	struct shmem *shm;
+	bool ok;
+
+	palloc_get_stats (PAL_USER, &stats);
+	lock_acquire (&frame_lock);
+	ok = page_cnt <= stats.page_cnt / 4 - shmem_pages;
+	if (ok)
+		shmem_pages += page_cnt;
+	lock_release (&frame_lock);
+	if (!ok)
+		return NULL;
+
+	shm = malloc (sizeof *shm);
+	if (shm != NULL && (shm->frames = calloc (page_cnt,
+					sizeof *shm->frames)) == NULL) {
+		free (shm);
+		shm = NULL;
+	}
+	if (shm == NULL) {
+		lock_acquire (&frame_lock);
+		shmem_pages -= page_cnt;
+		lock_release (&frame_lock);
+		return NULL;
+	}
+	shm->ref_cnt = 1;
+	shm->page_cnt = page_cnt;
+	return shm;
+}
+
+/* Returns SHM, with a new reference to it for another area. */
+static struct shmem *
+shmem_get (struct shmem *shm) {
+	lock_acquire (&frame_lock);
+	shm->ref_cnt++;
+	lock_release (&frame_lock);
+	return shm;
+}
+
+/* Drops a reference to SHM, held by an area whose pages have all
+ * been destroyed, and frees it with its frames if it was the
+ * last. */
+void
+shmem_put (struct shmem *shm) {
+	size_t i;
+
+	lock_acquire (&frame_lock);
+	if (--shm->ref_cnt > 0) {
+		lock_release (&frame_lock);
+		return;
+	}
+	for (i = 0; i < shm->page_cnt; i++) {
+		struct frame *frame = shm->frames[i];
+
+		if (frame != NULL) {
+			ASSERT (frame->share_cnt == 0);
+			frame->shmem = false;
+			frame_free (frame);
+		}
+	}
+	shmem_pages -= shm->page_cnt;
+	lock_release (&frame_lock);
+	free (shm->frames);
+	free (shm);
+}
+
+/* Maps PAGE, of a shared area of the current process, onto the frame
+ * of its shared memory that holds it, after creating a zeroed frame
+ * for it if no process has touched it yet.  Returns false if
+ * memory is short. */
+static bool
+shmem_claim (struct page *page) {
+	struct vm_area *area = page->area;
+	struct shmem *shm = area->shmem;
+	size_t idx = pg_no (page->va) - pg_no (vma_start (area));
+	struct frame *frame, *new = NULL;
+
+	lock_acquire (&frame_lock);
+	frame = shm->frames[idx];
+	lock_release (&frame_lock);
+	if (frame == NULL) {
+		new = vm_get_frame (page->spt);
+		memset (new->kva, 0, PGSIZE);
+		pml4_set_accessed (base_pml4, new->kva, false);
+	}
+
+	/* Another process may have created the frame meanwhile.  The
+	 * pin of the new frame is the one shared memory holds. */
+	lock_acquire (&frame_lock);
+	frame = shm->frames[idx];
+	if (frame == NULL) {
+		frame = shm->frames[idx] = new;
+		frame->shmem = true;
+		new = NULL;
+	}
+	frame_attach (frame, page);
+	if (new != NULL)
+		frame_free (new);
+	lock_release (&frame_lock);
+
+	if ((VM_TYPE (page->operations->type) == VM_UNINIT
+				&& !uninit_adopt (page, frame->kva))
+			|| !pml4_set_page (page->pml4, page->va, frame->kva,
+				page->writable)) {
+		vm_release_frame (page);
+		return false;
+	}
+	return true;
+}
+
+/* Same-page merging.  ksmd, a thread at PRI_MIN, so that it runs
+ * when nothing else wants to, walks the frame table KSM_BATCH
+ * frames at a time, every KSM_INTERVAL ticks.  It checksums each
+ * frame that holds only anonymous pages.  A frame whose checksum
+ * did not change since the previous pass is taken to be stable,
+ * and is merged into the zero frame or into a stable frame of the
+ * same checksum seen earlier in this pass, if their contents
+ * match: its pages then share the other frame copy-on-write, as
+ * after fork(), and it is freed.  A write splits them apart again
+ * through vm_handle_wp().  Otherwise the frame goes into the merge
+ * table for later frames to find.  The table is only a hint: a
+ * checksum outdated by a write since is caught when the
+ * contents are compared, with both frames mapped read-only.  It is
+ * emptied at the end of every pass.  FRAME_LOCK guards it all. */
+#define KSM_INTERVAL (TIMER_FREQ / 10)
+#define KSM_BATCH 32
+
+static struct hash ksm_table;
+static unsigned ksm_pass = 1;
+static uint64_t zero_checksum;
+static uint64_t ksm_scanned;        /* Frames checksummed. */
+static uint64_t ksm_merged;         /* Frames merged away. */
+static uint64_t ksm_zero_merged;    /* Of those, into the zero frame. */
+
+/* Returns the checksum of the page at KVA. */
+static uint64_t
+page_checksum (const void *kva) {
+	const uint64_t *w = kva;
+	uint64_t h = 14695981039346656037ULL;
+	size_t i;
+
+	for (i = 0; i < PGSIZE / sizeof *w; i++)
+		h = (h ^ w[i]) * 1099511628211ULL;
+	return h;
+}
+
+/* Hashes frame F by its checksum. */
+static uint64_t
+ksm_hash (const struct hash_elem *f_, void *aux UNUSED) {
+	const struct frame *f = hash_entry (f_, struct frame, ksm_elem);
+
+	return hash_u64 (f->checksum);
+}
+
+/* Returns true if frame A's checksum is below frame B's. */
+static bool
+ksm_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	return hash_entry (a_, struct frame, ksm_elem)->checksum
+		< hash_entry (b_, struct frame, ksm_elem)->checksum;
+}
+
+/* Takes the frame E is in off the merge table, for hash_clear(). */
+static void
+ksm_unlist (struct hash_elem *e, void *aux UNUSED) {
+	hash_entry (e, struct frame, ksm_elem)->ksm_listed = false;
+}
+
+/* Takes FRAME, which is being freed, off the merge table.
+ * FRAME_LOCK must be held. */
+static void
+ksm_forget (struct frame *frame) {
+	if (frame->ksm_listed) {
+		hash_delete (&ksm_table, &frame->ksm_elem);
+		frame->ksm_listed = false;
+	}
+}
+
+/* Returns true if FRAME may be merged: it holds anonymous pages
+ * only, and nothing is using it behind them.  FRAME_LOCK must be
+ * held. */
+static bool
+ksm_candidate (struct frame *frame) {
+	struct list_elem *e;
+
+	if (frame == zero_frame || frame->page == NULL || frame->pin_cnt > 0
+			|| frame->writeback || frame->read_cnt > 0 || frame->inode != NULL)
+		return false;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e))
+		if (VM_TYPE (list_entry (e, struct page, frame_elem)->operations->type)
+				!= VM_ANON)
+			return false;
+	return true;
+}
+
+/* Maps the pages sharing FRAME read-only if READ_ONLY, or else as
+ * writable as they may be, keeping their accessed bits. */
+static void
+frame_protect (struct frame *frame, bool read_only) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		bool accessed = pml4_is_accessed (page->pml4, page->va);
+
+		pml4_set_page (page->pml4, page->va, frame->kva, !read_only
+				&& page->writable && frame->share_cnt == 1);
+		pml4_set_accessed (page->pml4, page->va, accessed);
+	}
+}
+
+/* Moves the pages of SRC onto DST, if both hold the same bytes, and
+ * frees SRC.  Returns true if so.  FRAME_LOCK must be held. */
+static bool
+ksm_merge (struct frame *dst, struct frame *src) {
+	bool same;
+
+	ASSERT (dst != src);
+
+	if (!frame_split (src) || (dst != zero_frame && !frame_split (dst)))
+		return false;
+
+	/* Read-only first, so that neither can change once compared.
+	 * The zero frame is never mapped writable. */
+	frame_protect (src, true);
+	if (dst != zero_frame)
+		frame_protect (dst, true);
+	same = !memcmp (dst->kva, src->kva, PGSIZE);
+	if (!same) {
+		frame_protect (src, false);
+		if (dst != zero_frame)
+			frame_protect (dst, false);
+		return false;
+	}
+
+	while (src->page != NULL) {
+		struct page *page = src->page;
+		bool accessed = pml4_is_accessed (page->pml4, page->va);
+
+		frame_detach (src, page);
+		frame_attach (dst, page);
+		pml4_set_page (page->pml4, page->va, dst->kva, false);
+		pml4_set_accessed (page->pml4, page->va, accessed);
+	}
+	frame_free (src);
+	ksm_merged++;
+	if (dst == zero_frame)
+		ksm_zero_merged++;
+	return true;
+}
+
+/* Returns the next frame this pass has not looked at, or a null
+ * pointer if there is none left.  FRAME_LOCK must be held. */
+static struct frame *
+ksm_next_frame (void) {
+	struct list *lists[2] = { &inactive_frames, &active_frames };
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		struct list_elem *e;
+
+		for (e = list_begin (lists[i]); e != list_end (lists[i]);
+				e = list_next (e)) {
+			struct frame *frame = list_entry (e, struct frame, elem);
+
+			if (frame->ksm_pass != ksm_pass) {
+				frame->ksm_pass = ksm_pass;
+				if (ksm_candidate (frame))
+					return frame;
+			}
+		}
+	}
+	return NULL;
+}
+
+/* Looks at the next frame of the pass.  Returns false if the pass
+ * is over. */
+static bool
+ksm_scan_one (void) {
+	struct frame *frame;
+	struct hash_elem *found;
+	uint64_t checksum;
+	bool stable;
+
+	lock_acquire (&frame_lock);
+	frame = ksm_next_frame ();
+	if (frame == NULL) {
+		hash_clear (&ksm_table, ksm_unlist);
+		ksm_pass++;
+		lock_release (&frame_lock);
+		return false;
+	}
+
+	checksum = page_checksum (frame->kva);
+	stable = checksum == frame->checksum;
+	frame->checksum = checksum;
+	ksm_scanned++;
+	if (stable && !(checksum == zero_checksum
+				&& ksm_merge (zero_frame, frame))) {
+		found = hash_find (&ksm_table, &frame->ksm_elem);
+		if (found == NULL) {
+			hash_insert (&ksm_table, &frame->ksm_elem);
+			frame->ksm_listed = true;
+		} else {
+			struct frame *other = hash_entry (found, struct frame, ksm_elem);
+
+			if (!ksm_candidate (other) || !ksm_merge (other, frame)) {
+				/* Keep the frame whose contents still match. */
+				hash_replace (&ksm_table, &frame->ksm_elem);
+				other->ksm_listed = false;
+				frame->ksm_listed = true;
+			}
+		}
+	}
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Same-page merging thread. */
+static void
+ksmd (void *aux UNUSED) {
+	for (;;) {
+		int i;
+
+		timer_sleep (KSM_INTERVAL);
+		for (i = 0; i < KSM_BATCH; i++)
+			if (!ksm_scan_one ())
+				break;
+	}
+}
+
+/* Starts ksmd, unless "-no-ksm" said not to. */
+static void
+ksm_start (void) {
+	if (!hash_init (&ksm_table, ksm_hash, ksm_less, NULL))
+		PANIC ("merge table: out of memory");
+	zero_checksum = page_checksum (zero_frame->kva);
+	if (ksm_enabled
+			&& thread_create ("ksmd", PRI_MIN, ksmd, NULL) == TID_ERROR)
+		PANIC ("ksmd: cannot create thread");
+}
+
+/* Prints same-page merging statistics. */
+void
+ksm_print_stats (void) {
+	if (ksm_enabled)
+		printf ("KSM: %llu frames scanned, %llu merged, %llu into the zero "
+				"frame\n", ksm_scanned, ksm_merged, ksm_zero_merged);
 }
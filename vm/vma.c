@@ -0,0 +1,203 @@
+/* vma.c: Virtual memory areas.
+ *
+ * A process's address space is described by a set of areas kept in
+ * an interval tree in its supplemental page table.  Mapping a
+ * segment, a file or the stack only creates an area; the struct
+ * page for an address is created by vma_populate() when the
+ * address is first touched, so page metadata grows with the
+ * resident set instead of the size of the mappings. */
+
+#include "vm/vma.h"
+#include <round.h>
+#include <string.h>
+#include <syscall-nr.h>
+#include <ioring.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/mmu.h"
+#include "threads/slab.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* Cache of struct vm_area. */
+static struct kmem_cache *area_cache;
+
+static bool vma_load (struct page *, void *aux);
+
+/* Initializes the area allocator. */
+void
+vma_init (void) {
+	area_cache = kmem_cache_create ("vm_area", sizeof (struct vm_area), 0,
+			NULL);
+	if (area_cache == NULL)
+		PANIC ("vm_area cache creation failed");
+}
+
+/* Creates an area of LENGTH bytes, rounded up to whole pages, at
+ * page-aligned START in SPT.  Its pages are of TYPE and writable
+ * if WRITABLE.  The first READ_BYTES bytes of the area are read
+ * from FILE starting at OFFSET and the rest is zeroed; FILE may be
+ * null if READ_BYTES is 0.  FILE is reopened, so the caller keeps
+ * its own handle.
+ * Returns the new area, or a null pointer if the range is not in
+ * user space, overlaps an existing area, or memory is short. */
+struct vm_area *
+vma_create (struct supplemental_page_table *spt, void *start, size_t length,
+		enum vm_type type, bool writable,
+		struct file *file, off_t offset, size_t read_bytes) {
+	uintptr_t s = (uintptr_t) start;
+	uintptr_t e = s + ROUND_UP (length, PGSIZE);
+	struct vm_area *area;
+
+	ASSERT (pg_ofs (start) == 0);
+	ASSERT (read_bytes <= length);
+	ASSERT (file != NULL || read_bytes == 0);
+
+	if (length == 0 || e <= s || e > KERN_BASE)
+		return NULL;
+	/* The kernel maps the vDSO and I/O ring pages itself. */
+	if (s < IORING_END && e > VDSO_BASE)
+		return NULL;
+	if (itree_first_overlap (&spt->areas, s, e) != NULL)
+		return NULL;
+
+	area = kmem_cache_alloc (area_cache);
+	if (area == NULL)
+		return NULL;
+	area->file = NULL;
+	if (file != NULL && (area->file = file_reopen (file)) == NULL) {
+		kmem_cache_free (area_cache, area);
+		return NULL;
+	}
+	area->type = type;
+	area->writable = writable;
+	area->offset = offset;
+	area->read_bytes = read_bytes;
+	area->advice = MADV_NORMAL;
+	area->shmem = NULL;
+	list_init (&area->pages);
+	itree_insert (&spt->areas, &area->elem, s, e);
+	return area;
+}
+
+/* Returns the area of SPT that contains VA, or a null pointer if
+ * VA is not mapped. */
+struct vm_area *
+vma_find (struct supplemental_page_table *spt, const void *va) {
+	struct itree_elem *e = itree_find (&spt->areas, (uintptr_t) va);
+
+	return e != NULL ? itree_entry (e, struct vm_area, elem) : NULL;
+}
+
+/* Creates the uninitialized page for page-aligned UPAGE in AREA,
+ * which belongs to the current process, and adds it to the
+ * current process's supplemental page table.  Returns the page, or
+ * a null pointer if memory is short. */
+struct page *
+vma_populate (struct vm_area *area, void *upage) {
+	struct page *page;
+
+	ASSERT (pg_ofs (upage) == 0);
+	ASSERT (upage >= vma_start (area) && upage < vma_end (area));
+
+	if (!vm_alloc_page_with_initializer (area->type, upage, area->writable,
+				vma_load, area))
+		return NULL;
+	page = spt_find_page (&thread_current ()->proc->spt, upage);
+	vma_attach (area, page);
+	return page;
+}
+
+/* Records that PAGE belongs to AREA. */
+void
+vma_attach (struct vm_area *area, struct page *page) {
+	page->area = area;
+	list_push_back (&area->pages, &page->area_elem);
+}
+
+/* Stores the offset in its area's file of PAGE into *OFFSET and the
+ * number of bytes of PAGE backed by that file into *READ_BYTES. */
+void
+vma_page_backing (const struct page *page, off_t *offset,
+		size_t *read_bytes) {
+	const struct vm_area *area = page->area;
+	size_t ofs = (uint8_t *) page->va - (uint8_t *) vma_start (area);
+
+	ASSERT (area != NULL);
+
+	*offset = area->offset + ofs;
+	if (ofs >= area->read_bytes)
+		*read_bytes = 0;
+	else if (area->read_bytes - ofs < PGSIZE)
+		*read_bytes = area->read_bytes - ofs;
+	else
+		*read_bytes = PGSIZE;
+}
+
+/* Fills the frame of PAGE, a page of area AUX, on its first fault. */
+static bool
+vma_load (struct page *page, void *aux UNUSED) {
+	uint8_t *kva = page->frame->kva;
+	off_t offset;
+	size_t read_bytes;
+
+	ASSERT (page->area == aux);
+
+	/* The page gets a private copy, so it is read past the page
+	 * cache. */
+	vma_page_backing (page, &offset, &read_bytes);
+	if (read_bytes > 0
+			&& inode_read_at (file_get_inode (page->area->file), kva,
+				read_bytes, offset) != (off_t) read_bytes)
+		return false;
+	memset (kva + read_bytes, 0, PGSIZE - read_bytes);
+	return true;
+}
+
+/* Frees AREA and the file and shared memory it holds. */
+static void
+area_free (struct vm_area *area) {
+	file_close (area->file);
+	if (area->shmem != NULL)
+		shmem_put (area->shmem);
+	kmem_cache_free (area_cache, area);
+}
+
+/* Marks every page of AREA, which belongs to the current process,
+ * not present in one pass, so that destroying the pages afterwards
+ * does not invalidate their TLB entries one at a time.  Dirty bits
+ * are kept for write-back. */
+void
+vma_unmap (struct vm_area *area) {
+	uint64_t *pml4 = thread_current ()->pml4;
+
+	if (pml4 != NULL)
+		pml4_clear_range (pml4, vma_start (area), vma_end (area));
+}
+
+/* Unmaps AREA from SPT, which must be the current process's, and
+ * destroys its pages, writing back dirty file pages. */
+void
+vma_destroy (struct supplemental_page_table *spt, struct vm_area *area) {
+	vma_unmap (area);
+	while (!list_empty (&area->pages)) {
+		struct page *page = list_entry (list_front (&area->pages),
+				struct page, area_elem);
+		spt_remove_page (spt, page);
+	}
+	itree_remove (&spt->areas, &area->elem);
+	area_free (area);
+}
+
+/* Frees all the areas of SPT, whose pages must already have been
+ * destroyed. */
+void
+vma_kill (struct supplemental_page_table *spt) {
+	struct itree_elem *e;
+
+	while ((e = itree_first (&spt->areas)) != NULL) {
+		itree_remove (&spt->areas, e);
+		area_free (itree_entry (e, struct vm_area, elem));
+	}
+}
@@ -0,0 +1,338 @@
+/* zswap.c: Compressed cache in front of the swap disk.
+ *
+ * A page swapped out keeps its swap slot, but if it compresses
+ * well its contents stay in kernel memory instead of going to the
+ * disk: a page filled with one repeated word, such as a zero page,
+ * as just that word, and other pages compressed with LZRW1, a
+ * byte-oriented LZ77 that compresses a page in one fast pass.
+ * Pages that do not shrink to ZSWAP_MAX_LEN bytes go to the disk as
+ * before.  Swapping a cached page in decompresses it without any
+ * I/O.
+ *
+ * The cache holds at most zswap_max bytes, entries included.  To
+ * make room, the entries stored longest ago are written back, in
+ * LRU order, to the disk sectors of their slots, which were
+ * reserved for them all along, and dropped from the cache.
+ *
+ * ZSWAP_LOCK guards everything here.  It is held across a
+ * write-back, so that a slot being written back is never read from
+ * the disk before its write is done. */
+
+#include "vm/zswap.h"
+#include <debug.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/disk.h"
+#include "threads/lock-stats.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* Largest compressed page worth keeping. */
+#define ZSWAP_MAX_LEN (PGSIZE / 2)
+
+/* LZRW1: an item is a literal byte or a copy of 3 to 18 bytes from
+ * up to 4095 bytes back, in two bytes; a 16-bit control word before
+ * every 16 items tells which are copies. */
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH 18
+#define LZ_HASH_BITS 12
+
+/* How a page is stored. */
+enum zswap_kind {
+	ZSWAP_SAME,                 /* One 64-bit word, repeated. */
+	ZSWAP_LZ,                   /* LZRW1-compressed. */
+};
+
+/* A cached page. */
+struct zswap_entry {
+	struct list_elem elem;      /* In the LRU list, oldest first. */
+	size_t slot;                /* Swap slot. */
+	enum zswap_kind kind;
+	uint64_t word;              /* For ZSWAP_SAME. */
+	size_t len;                 /* Bytes of DATA, for ZSWAP_LZ. */
+	uint8_t data[];             /* Compressed page, for ZSWAP_LZ. */
+};
+
+size_t zswap_max_kb;
+bool zswap_enabled = true;
+
+static struct zswap_entry **entries;    /* By slot; null if not cached. */
+static struct list lru;
+static struct lock zswap_lock;
+static size_t zswap_max;            /* Most bytes of cached data. */
+static size_t zswap_bytes;          /* Bytes of cached data. */
+
+/* Scratch space for compression and write-back.  Guarded by
+ * ZSWAP_LOCK. */
+static uint8_t lz_buf[ZSWAP_MAX_LEN];
+static uint16_t lz_hash[1 << LZ_HASH_BITS];
+static void *bounce;
+
+/* Statistics. */
+static uint64_t same_cnt;           /* Pages stored as one word. */
+static uint64_t lz_cnt;             /* Pages stored compressed. */
+static uint64_t reject_cnt;         /* Pages that went to the disk. */
+static uint64_t load_cnt;           /* Swap-ins from the cache. */
+static uint64_t writeback_cnt;      /* Entries written back. */
+
+/* Sets up the cache for SLOT_CNT swap slots, sized by
+ * "-zswap" or else to 1/16 of the kernel pool, unless "-no-zswap"
+ * turned it off or memory is short. */
+void
+zswap_init (size_t slot_cnt) {
+	struct palloc_stats stats;
+
+	list_init (&lru);
+	lock_init (&zswap_lock);
+	lock_set_name (&zswap_lock, "zswap");
+	if (!zswap_enabled)
+		return;
+
+	palloc_get_stats (0, &stats);
+	zswap_max = zswap_max_kb != 0 ? zswap_max_kb * 1024
+		: stats.page_cnt / 16 * PGSIZE;
+	entries = calloc (slot_cnt, sizeof *entries);
+	bounce = palloc_get_page (0);
+	if (entries == NULL || bounce == NULL || zswap_max == 0) {
+		free (entries);
+		palloc_free_page (bounce);
+		entries = NULL;
+		printf ("zswap: no memory, compressed swap cache off\n");
+	}
+}
+
+/* Returns the word that fills all of PAGE, if one does, in *WORD. */
+static bool
+same_filled (const void *page, uint64_t *word) {
+	const uint64_t *w = page;
+	size_t i;
+
+	for (i = 1; i < PGSIZE / sizeof *w; i++)
+		if (w[i] != w[0])
+			return false;
+	*word = w[0];
+	return true;
+}
+
+/* Returns the hash of the 3 bytes at P. */
+static inline size_t
+lz_hash3 (const uint8_t *p) {
+	uint32_t v = p[0] | p[1] << 8 | p[2] << 16;
+
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Compresses the page at SRC into lz_buf.  Returns the compressed
+ * length, or 0 if it would exceed ZSWAP_MAX_LEN. */
+static size_t
+lz_compress (const uint8_t *src) {
+	uint8_t *dst = lz_buf, *ctrl = NULL;
+	uint8_t *end = lz_buf + ZSWAP_MAX_LEN;
+	unsigned bits = 0;
+	size_t pos = 0;
+
+	/* Positions are stored plus 1, so that 0 is empty. */
+	memset (lz_hash, 0, sizeof lz_hash);
+	while (pos < PGSIZE) {
+		size_t len = 0, ofs = 0;
+
+		if (bits % 16 == 0) {
+			if (end - dst < 2 + 2 * 16)
+				return 0;
+			ctrl = dst;
+			ctrl[0] = ctrl[1] = 0;
+			dst += 2;
+		}
+
+		if (pos + LZ_MIN_MATCH <= PGSIZE) {
+			size_t h = lz_hash3 (src + pos);
+			size_t cand = lz_hash[h];
+
+			lz_hash[h] = pos + 1;
+			if (cand != 0 && pos - (cand - 1) < 4096) {
+				size_t max = PGSIZE - pos < LZ_MAX_MATCH
+					? PGSIZE - pos : LZ_MAX_MATCH;
+
+				cand--;
+				while (len < max && src[cand + len] == src[pos + len])
+					len++;
+				ofs = pos - cand;
+			}
+		}
+
+		if (len >= LZ_MIN_MATCH) {
+			ctrl[bits % 16 / 8] |= 1 << bits % 8;
+			*dst++ = ofs >> 4;
+			*dst++ = (ofs & 0xf) << 4 | (len - LZ_MIN_MATCH);
+			pos += len;
+		} else
+			*dst++ = src[pos++];
+		bits++;
+	}
+	return dst - lz_buf;
+}
+
+/* Decompresses the LEN bytes at SRC into the page at DST. */
+static void
+lz_decompress (const uint8_t *src, size_t len, uint8_t *dst) {
+	const uint8_t *end = src + len;
+	unsigned ctrl = 0, bits = 0;
+	size_t pos = 0;
+
+	while (src < end) {
+		if (bits % 16 == 0) {
+			ctrl = src[0] | src[1] << 8;
+			src += 2;
+		}
+		if (ctrl & 1 << bits % 16) {
+			size_t ofs = src[0] << 4 | src[1] >> 4;
+			size_t n = (src[1] & 0xf) + LZ_MIN_MATCH;
+
+			ASSERT (ofs > 0 && ofs <= pos && pos + n <= PGSIZE);
+			/* Copies may overlap their source, byte by byte. */
+			while (n-- > 0) {
+				dst[pos] = dst[pos - ofs];
+				pos++;
+			}
+			src += 2;
+		} else {
+			ASSERT (pos < PGSIZE);
+			dst[pos++] = *src++;
+		}
+		bits++;
+	}
+	ASSERT (pos == PGSIZE);
+}
+
+/* Fills the page at KVA with the contents of E. */
+static void
+entry_decode (const struct zswap_entry *e, void *kva) {
+	if (e->kind == ZSWAP_SAME) {
+		uint64_t *w = kva;
+		size_t i;
+
+		for (i = 0; i < PGSIZE / sizeof *w; i++)
+			w[i] = e->word;
+	} else
+		lz_decompress (e->data, e->len, kva);
+}
+
+/* Takes E out of the cache and frees it.  ZSWAP_LOCK must be
+ * held. */
+static void
+entry_free (struct zswap_entry *e) {
+	ASSERT (lock_held_by_current_thread (&zswap_lock));
+
+	list_remove (&e->elem);
+	entries[e->slot] = NULL;
+	zswap_bytes -= sizeof *e + e->len;
+	free (e);
+}
+
+/* Writes back the oldest entries to their slots on the disk until
+ * an entry of SIZE bytes fits.  ZSWAP_LOCK must be held. */
+static void
+make_room (size_t size) {
+	while (zswap_bytes + size > zswap_max && !list_empty (&lru)) {
+		struct zswap_entry *e = list_entry (list_front (&lru),
+				struct zswap_entry, elem);
+
+		entry_decode (e, bounce);
+		anon_slot_write (e->slot, bounce);
+		entry_free (e);
+		writeback_cnt++;
+	}
+}
+
+/* Keeps the page at KVA, just swapped out to SLOT, in the cache
+ * rather than writing it to the disk, if it compresses well.
+ * Returns true if so, false if the caller must write it. */
+bool
+zswap_store (size_t slot, const void *kva) {
+	struct zswap_entry *e;
+	uint64_t word;
+	size_t len = 0;
+	bool same;
+
+	if (entries == NULL)
+		return false;
+
+	lock_acquire (&zswap_lock);
+	ASSERT (entries[slot] == NULL);
+	same = same_filled (kva, &word);
+	if (!same && (len = lz_compress (kva)) == 0) {
+		reject_cnt++;
+		lock_release (&zswap_lock);
+		return false;
+	}
+	make_room (sizeof *e + len);
+	e = malloc (sizeof *e + len);
+	if (e == NULL || zswap_bytes + sizeof *e + len > zswap_max) {
+		free (e);
+		reject_cnt++;
+		lock_release (&zswap_lock);
+		return false;
+	}
+	e->slot = slot;
+	e->kind = same ? ZSWAP_SAME : ZSWAP_LZ;
+	e->word = word;
+	e->len = len;
+	memcpy (e->data, lz_buf, len);
+	entries[slot] = e;
+	list_push_back (&lru, &e->elem);
+	zswap_bytes += sizeof *e + len;
+	if (same)
+		same_cnt++;
+	else
+		lz_cnt++;
+	lock_release (&zswap_lock);
+	return true;
+}
+
+/* Fills the page at KVA with SLOT's contents if they are in the
+ * cache, and returns true.  Returns false if they are on the disk,
+ * in which case they have already reached it. */
+bool
+zswap_load (size_t slot, void *kva) {
+	struct zswap_entry *e;
+
+	if (entries == NULL)
+		return false;
+
+	lock_acquire (&zswap_lock);
+	e = entries[slot];
+	if (e != NULL) {
+		entry_decode (e, kva);
+		load_cnt++;
+	}
+	lock_release (&zswap_lock);
+	return e != NULL;
+}
+
+/* Forgets SLOT, which was freed. */
+void
+zswap_drop (size_t slot) {
+	if (entries == NULL)
+		return;
+
+	lock_acquire (&zswap_lock);
+	if (entries[slot] != NULL)
+		entry_free (entries[slot]);
+	lock_release (&zswap_lock);
+}
+
+/* Prints statistics of the compressed swap cache. */
+void
+zswap_print_stats (void) {
+	if (entries == NULL)
+		return;
+	printf ("Zswap: %llu same-filled, %llu compressed, %llu rejected pages; "
+			"%llu loads, %llu written back; %zu of %zu bytes used\n",
+			same_cnt, lz_cnt, reject_cnt, load_cnt, writeback_cnt,
+			zswap_bytes, zswap_max);
+}